@@ -91,6 +91,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <syslog.h>
@@ -210,6 +211,8 @@ int  put_string (register char *s);
 int  write_char (int c);
 int  put_char (int c);
 int  get_char (void);
+void set_deadline (int secs);
+int  read_room (char *string, int len, char *seen, int have);
 int  chat_send (register char *s);
 char *character (int c);
 void chat_expect (register char *s);
@@ -499,6 +502,20 @@ void fatal(int code, const char *fmt, ...)
 int alarmed = 0;
 int alarmsig = 0;
 
+/*
+ * Characters are read from the modem into read_buf and handed out
+ * one at a time by get_char.  Anything after the end of the last
+ * string we wait for belongs to whatever runs after us, so we can't
+ * read past it: get_string sets read_max to how many characters it
+ * can take without that risk.  Reads wait no later than the deadline
+ * set by set_deadline, and get_char sets alarmed if it passes.
+ */
+static char read_buf[STR_LEN];
+static int read_pos, read_len;
+int read_max = 1;
+static struct timespec read_deadline;
+static int have_deadline;
+
 SIGTYPE sigalrm(int signo)
 {
     int flags;
@@ -609,10 +626,10 @@ void terminate(int status)
 	int c, rep_len;
 
 	rep_len = strlen(report_buffer);
+	read_max = 1;
+	set_deadline(1);
 	while (rep_len + 1 <= sizeof(report_buffer)) {
-	    alarm(1);
 	    c = get_char();
-	    alarm(0);
 	    if (c < 0 || iscntrl(c))
 		break;
 	    report_buffer[rep_len] = c;
@@ -1185,24 +1202,62 @@ int chat_send (register char *s)
     return 0;
 }
 
+/*
+ * set_deadline - make reads time out secs seconds from now,
+ * or never if secs is 0.
+ */
+void set_deadline(int secs)
+{
+    have_deadline = secs > 0;
+    if (have_deadline) {
+	clock_gettime(CLOCK_MONOTONIC, &read_deadline);
+	read_deadline.tv_sec += secs;
+    }
+}
+
 int get_char(void)
 {
-    int status;
-    char c;
+    int status, ms;
+    struct timespec now;
+    struct pollfd pfd;
 
-    status = read(0, &c, 1);
-    checksigs();
+    if (read_pos < read_len)
+	return read_buf[read_pos++] & 0x7F;
 
-    switch (status) {
-    case 1:
-	return ((int)c & 0x7F);
+    for (;;) {
+	ms = -1;
+	if (have_deadline) {
+	    clock_gettime(CLOCK_MONOTONIC, &now);
+	    ms = (read_deadline.tv_sec - now.tv_sec) * 1000
+		+ (read_deadline.tv_nsec - now.tv_nsec) / 1000000;
+	    if (ms <= 0) {
+		alarmed = 1;
+		return (-1);
+	    }
+	}
+	pfd.fd = 0;
+	pfd.events = POLLIN;
+	status = poll(&pfd, 1, ms);
+	checksigs();
+	if (status > 0)
+	    break;
+	if (status < 0 && errno != EINTR)
+	    return (-1);
+    }
 
-    default:
-	msgf("warning: read() on stdin returned %d", status);
+    if (read_max > sizeof(read_buf))
+	read_max = sizeof(read_buf);
+    status = read(0, read_buf, read_max);
+    checksigs();
 
-    case -1:
-	return (-1);
+    if (status > 0) {
+	read_len = status;
+	read_pos = 1;
+	return (read_buf[0] & 0x7F);
     }
+    if (status == 0)
+	msgf("warning: read() on stdin returned %d", status);
+    return (-1);
 }
 
 int put_char(int c)
@@ -1328,15 +1383,38 @@ int echo_stderr(int n)
     return ret;
 }
 
+/*
+ * read_room - return how many characters could arrive after the have
+ * characters ending at seen without completing a match of the first
+ * len characters of string.  This errs on the low side: it assumes
+ * that the last character seen starts the longest possible match.
+ */
+int read_room(char *string, int len, char *seen, int have)
+{
+    int k;
+
+    if (have == 0 || len == 0)
+	return len > 0? len: 1;
+    k = len - 1;
+    if (k > have)
+	k = have;
+    for (; k > 0; --k)
+	if ((string[k - 1] & 0x7F) == seen[-1])
+	    break;
+    return len - k;
+}
+
 /*
  *	'Wait for' this string to appear on this file descriptor.
  */
 int get_string(register char *string)
 {
     char temp[STR_LEN];
-    int c, printed = 0, len, minlen;
+    int c, n, printed = 0, len, minlen;
     register char *s = temp, *end = s + STR_LEN;
     char *logged = temp;
+    int abort_lens[MAX_ABORTS], report_lens[MAX_REPORTS];
+    char ends[256];		/* which chars end some string we look for */
 
     fail_reason = (char *)0;
     string = clean(string, 0);
@@ -1358,11 +1436,52 @@ int get_string(register char *string)
 	return (1);
     }
 
-    alarm(timeout);
+    /*
+     * Most characters can't complete a match, so only look at the
+     * abort and report strings after one that ends one of them.
+     */
+    memset(ends, 0, sizeof(ends));
+    ends[(unsigned char) string[len - 1]] = 1;
+    for (n = 0; n < n_aborts; ++n) {
+	abort_lens[n] = strlen(abort_string[n]);
+	if (abort_lens[n] == 0)
+	    memset(ends, 1, sizeof(ends));
+	else
+	    ends[(unsigned char) abort_string[n][abort_lens[n] - 1]] = 1;
+    }
+    for (n = 0; n < n_reports; ++n) {
+	if (report_string[n] == NULL)
+	    continue;
+	report_lens[n] = strlen(report_string[n]);
+	if (report_lens[n] == 0)
+	    memset(ends, 1, sizeof(ends));
+	else
+	    ends[(unsigned char) report_string[n][report_lens[n] - 1]] = 1;
+    }
+
+    set_deadline(timeout);
     alarmed = 0;
 
-    while ( ! alarmed && (c = get_char()) >= 0) {
-	int n, abort_len, report_len;
+    for (;;) {
+	int abort_len, report_len, room;
+
+	if (read_pos >= read_len) {
+	    read_max = read_room(string, len, s, s - temp);
+	    for (n = 0; n < n_aborts; ++n) {
+		room = read_room(abort_string[n], abort_lens[n], s, s - temp);
+		if (room < read_max)
+		    read_max = room;
+	    }
+	    for (n = 0; n < n_reports; ++n) {
+		if (report_string[n] == NULL)
+		    continue;
+		room = read_room(report_string[n], report_lens[n], s, s - temp);
+		if (room < read_max)
+		    read_max = room;
+	    }
+	}
+	if ((c = get_char()) < 0)
+	    break;
 
 	if (echo) {
 	    if (echo_stderr(c) != 0) {
@@ -1392,9 +1511,9 @@ int get_string(register char *string)
 	}
 
 	if (!report_gathering) {
-	    for (n = 0; n < n_reports; ++n) {
+	    for (n = 0; ends[c] && n < n_reports; ++n) {
 		if ((report_string[n] != (char*) NULL) &&
-		    s - temp >= (report_len = strlen(report_string[n])) &&
+		    s - temp >= (report_len = report_lens[n]) &&
 		    strncmp(s - report_len, report_string[n], report_len) == 0) {
 		    time_t time_now   = time ((time_t*) NULL);
 		    struct tm* tm_now = localtime (&time_now);
@@ -1429,13 +1548,12 @@ int get_string(register char *string)
 		msgf(" -- got it\n");
 	    }
 
-	    alarm(0);
 	    alarmed = 0;
 	    return (1);
 	}
 
-	for (n = 0; n < n_aborts; ++n) {
-	    if (s - temp >= (abort_len = strlen(abort_string[n])) &&
+	for (n = 0; ends[c] && n < n_aborts; ++n) {
+	    if (s - temp >= (abort_len = abort_lens[n]) &&
 		strncmp(s - abort_len, abort_string[n], abort_len) == 0) {
 		if (verbose) {
 		    if (s > logged)
@@ -1443,7 +1561,6 @@ int get_string(register char *string)
 		    msgf(" -- failed");
 		}
 
-		alarm(0);
 		alarmed = 0;
 		exit_code = n + 4;
 		strcpy(fail_reason = fail_buffer, abort_string[n]);
@@ -1462,13 +1579,8 @@ int get_string(register char *string)
 	    logged = temp + (logged - s);
 	    s = temp + minlen;
 	}
-
-	if (alarmed && verbose)
-	    msgf("warning: alarm synchronization problem");
     }
 
-    alarm(0);
-    
     if (verbose && printed) {
 	if (alarmed)
 	    msgf(" -- read timed out");
@@ -162,6 +162,15 @@ struct compressor {
 				 + DEFLATE_METHOD_VAL)
 #define DEFLATE_CHK_SEQUENCE	0
 
+/*
+ * pppd may append these to the Deflate option it gives the kernel for
+ * the transmit direction (they never go to the peer): the compression
+ * level, the strategy and the memLevel to use, each either the value
+ * to pass to zlib or DEFLATE_TUNE_DEFAULT.
+ */
+#define DEFLATE_TUNE_LEN	3
+#define DEFLATE_TUNE_DEFAULT	0xff
+
 /*
  * Definitions for MPPE.
  */
@@ -25,9 +25,22 @@
 #ifndef _VJCOMPRESS_H_
 #define _VJCOMPRESS_H_
 
+#ifndef MAX_STATES
 #define MAX_STATES 16		/* must be > 2 and < 256 */
+#endif
 #define MAX_HDR	   128
 
+/*
+ * Transmit states in use are also kept on hash chains keyed on their
+ * addresses and ports.
+ */
+#if MAX_STATES > 32
+#define VJ_HASH_BITS 8
+#else
+#define VJ_HASH_BITS 6
+#endif
+#define VJ_HASH_SIZE (1 << VJ_HASH_BITS)
+
 /*
  * Compressed packet format:
  *
@@ -101,9 +114,11 @@
  */
 struct cstate {
     struct cstate *cs_next;	/* next most recently used state (xmit only) */
+    struct cstate *cs_prev;	/* next less recently used state (xmit only) */
+    struct cstate *cs_hnext;	/* next state on its hash chain (xmit only) */
     u_short cs_hlen;		/* size of hdr (receive only) */
     u_char cs_id;		/* connection # associated with this state */
-    u_char cs_filler;
+    u_char cs_hash;		/* hash chain it is on (xmit only) */
     union {
 	char csu_hdr[MAX_HDR];
 	struct ip csu_ip;	/* ip/tcp hdr from most recent packet */
@@ -123,6 +138,7 @@ struct vjcompress {
 #ifndef VJ_NO_STATS
     struct vjstat stats;
 #endif
+    struct cstate *hash[VJ_HASH_SIZE];	/* xmit state hash chains */
     struct cstate tstate[MAX_STATES];	/* xmit connection states */
     struct cstate rstate[MAX_STATES];	/* receive connection states */
 };
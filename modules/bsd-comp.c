@@ -125,6 +125,8 @@ struct bsd_db {
     u_int   comp_count;			/* compressed packets */
     u_int   comp_bytes;			/* compressed bytes */
     u_short *lens;			/* array of lengths of codes */
+    u_short *prefix;			/* preceding code, by code */
+    u_char  *suffix;			/* last character, by code */
     struct bsd_dict {
 	union {				/* hash value */
 	    u_int32_t	fcode;
@@ -206,6 +208,10 @@ struct compressor ppp_bsd_compress = {
 
 #define DECOMP_CHUNK	256
 
+/* space for the decompressor's lens, prefix and suffix arrays */
+#define BSD_CODES_LEN(maxmaxcode) \
+	(((maxmaxcode) + 1) * (2 * sizeof(u_short) + sizeof(u_char)))
+
 /*
  * clear the dictionary
  */
@@ -370,18 +376,25 @@ bsd_alloc(options, opt_len, decomp)
 	return NULL;
     bzero(db, sizeof(*db) - sizeof(db->dict));
 
+    /*
+     * The decompressor also keeps the length, prefix and suffix of
+     * each code in arrays of their own, in one allocation, so that
+     * decoding a string doesn't go through the hash table.
+     */
     if (!decomp) {
 	db->lens = NULL;
     } else {
 #ifdef __osf__
-	db->lens = (u_short *) ALLOC_SLEEP((maxmaxcode+1) * sizeof(db->lens[0]));
+	db->lens = (u_short *) ALLOC_SLEEP(BSD_CODES_LEN(maxmaxcode));
 #else
-	db->lens = (u_short *) ALLOC_NOSLEEP((maxmaxcode+1) * sizeof(db->lens[0]));
+	db->lens = (u_short *) ALLOC_NOSLEEP(BSD_CODES_LEN(maxmaxcode));
 #endif
 	if (!db->lens) {
 	    FREE(db, newlen);
 	    return NULL;
 	}
+	db->prefix = db->lens + maxmaxcode + 1;
+	db->suffix = (u_char *) (db->prefix + maxmaxcode + 1);
     }
 
     db->totlen = newlen;
@@ -400,7 +413,7 @@ bsd_free(state)
     struct bsd_db *db = (struct bsd_db *) state;
 
     if (db->lens)
-	FREE(db->lens, (db->maxmaxcode+1) * sizeof(db->lens[0]));
+	FREE(db->lens, BSD_CODES_LEN(db->maxmaxcode));
     FREE(db, db->totlen);
 }
 
@@ -439,9 +452,16 @@ bsd_init(db, options, opt_len, unit, hdrlen, mru, debug, decomp)
 	return 0;
 
     if (decomp) {
-	i = LAST+1;
-	while (i != 0)
+	/*
+	 * Codes not assigned yet look like single characters, so
+	 * that a bad code in a corrupt packet can't send the
+	 * decoder outside the buffer or around a loop.
+	 */
+	i = db->maxmaxcode + 1;
+	while (i != 0) {
 	    db->lens[--i] = 1;
+	    db->prefix[i] = 0;
+	}
     }
     i = db->hsize;
     while (i != 0) {
@@ -807,6 +827,8 @@ bsd_incomp(state, dmsg)
 
 		db->max_ent = ++max_ent;
 		db->lens[max_ent] = db->lens[ent]+1;
+		db->prefix[max_ent] = ent;
+		db->suffix[max_ent] = c;
 	    }
 	    ent = c;
 	} while (--slen != 0);
@@ -1011,37 +1033,21 @@ bsd_decompress(state, cmsg, dmpp)
 	    wptr = dmsg->b_wptr;
 	    space = dmsg->b_datap->db_lim - wptr - codelen - extra;
 	}
+	/*
+	 * The string is written from its end, following the prefixes
+	 * for as many characters as its length says it has.
+	 */
 	p = (wptr += codelen);
-	while (finchar > LAST) {
-	    dictp = &db->dict[db->dict[finchar].cptr];
-#ifdef DEBUG
-	    --codelen;
-	    if (codelen <= 0) {
-		freemsg(dmsg);
-		printf("bsd_decomp%d: fell off end of chain ", db->unit);
-		printf("0x%x at 0x%x by 0x%x, max_ent=0x%x\n",
-		       incode, finchar, db->dict[finchar].cptr, max_ent);
-		return DECOMP_FATALERROR;
-	    }
-	    if (dictp->codem1 != finchar-1) {
-		freemsg(dmsg);
-		printf("bsd_decomp%d: bad code chain 0x%x finchar=0x%x ",
-		       db->unit, incode, finchar);
-		printf("oldcode=0x%x cptr=0x%x codem1=0x%x\n", oldcode,
-		       db->dict[finchar].cptr, dictp->codem1);
-		return DECOMP_FATALERROR;
-	    }
-#endif
-	    *--p = dictp->f.hs.suffix;
-	    finchar = dictp->f.hs.prefix;
+	while (--codelen > 0) {
+	    *--p = db->suffix[finchar];
+	    finchar = db->prefix[finchar];
 	}
-	*--p = finchar;
-
 #ifdef DEBUG
-	if (--codelen != 0)
-	    printf("bsd_decomp%d: short by %d after code 0x%x, max_ent=0x%x\n",
-		   db->unit, codelen, incode, max_ent);
+	if (finchar > LAST)
+	    printf("bsd_decomp%d: chain too long for code 0x%x, max_ent=0x%x\n",
+		   db->unit, incode, max_ent);
 #endif
+	*--p = finchar;
 
 	if (extra)		/* the KwKwK case again */
 	    *wptr++ = finchar;
@@ -1087,6 +1093,8 @@ bsd_decompress(state, cmsg, dmpp)
 
 	    db->max_ent = ++max_ent;
 	    db->lens[max_ent] = db->lens[oldcode]+1;
+	    db->prefix[max_ent] = oldcode;
+	    db->suffix[max_ent] = finchar;
 
 	    /* Expand code size if needed. */
 	    if (max_ent >= MAXCODE(n_bits) && max_ent < db->maxmaxcode) {
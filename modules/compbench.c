@@ -0,0 +1,834 @@
+/*
+ * compbench.c - run the kernel compressors over captured traffic.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: compbench [-n passes] [-b bits] [-w window] [-s blocksize]
+ *		    [-V pppdump] file ...
+ *
+ * Reads the frames out of files written by pppd's "record" option and
+ * replays them through BSD-Compress, Deflate and VJ header
+ * compression, as compiled from this directory with the STREAMS
+ * message routines below in place of the kernel's.  Each direction
+ * of the link gets its own compressor and decompressor, as it would on
+ * a real link, and every frame is decompressed again and compared with
+ * what went in.  Frames that were already compressed when they were
+ * captured, and CCP, are left out.  For each method we print the
+ * bytes in and out, the ratio, and the rate each side ran at, over
+ * the given number of passes through the capture.
+ *
+ * With -s, each frame is handed over as a chain of blocks of that
+ * size, as it might arrive from the stream head, to exercise the code
+ * paths which cross from one block to the next.
+ *
+ * With -V, the output of BSD-Compress and of Deflate is also written
+ * back out as a record file, behind a CCP Configure-Ack in each
+ * direction, and given to "pppdump -p -d -w", whose decompressed
+ * frames must then match the original ones.
+ *
+ * Build with "make compbench".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/stream.h>
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+
+#include <net/ppp_defs.h>
+#include <net/vjcompress.h>
+#define PACKETPTR	mblk_t *
+#include <net/ppp-comp.h>
+
+#include "fcs.h"
+
+extern struct compressor ppp_bsd_compress, ppp_deflate;
+
+struct frame {
+    int		dir;		/* 0 sent, 1 received */
+    int		len;
+    u_char	*data;		/* with a full 4-byte PPP header */
+};
+
+static struct frame *frames;
+static int nframes, maxframes;
+static int nskipped;
+static long total_bytes;
+static int max_len;
+
+static int blocksize;
+
+struct result {
+    const char	*name;
+    long	in, out;		/* bytes, over all passes */
+    long	frames, compressed;
+    double	ctime, dtime;		/* seconds */
+    int		errors;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * ppp_header - return the length of the PPP header on the len bytes
+ * at p, which may have left out the address and control fields and
+ * the first byte of the protocol, and set *protop to the protocol;
+ * or return -1 if the frame is too short to have a protocol.
+ */
+static int
+ppp_header(u_char *p, int len, int *protop)
+{
+    int hlen;
+
+    hlen = 0;
+    if (len >= 2 && p[0] == PPP_ALLSTATIONS && p[1] == PPP_UI)
+	hlen = 2;
+    if (len < hlen + 1)
+	return -1;
+    *protop = p[hlen++];
+    if ((*protop & 1) == 0) {
+	if (len < hlen + 1)
+	    return -1;
+	*protop = (*protop << 8) + p[hlen++];
+    }
+    return hlen;
+}
+
+static void
+add_frame(int dir, u_char *p, int len)
+{
+    int proto, hlen;
+    u_char *q;
+
+    hlen = ppp_header(p, len, &proto);
+    if (hlen < 0)
+	return;
+    p += hlen;
+    len -= hlen;
+    /* only network-layer data, and not what was compressed already */
+    if (proto >= 0x4000 || proto == PPP_COMP || proto == 0xfb) {
+	++nskipped;
+	return;
+    }
+    if (nframes == maxframes) {
+	maxframes = maxframes? 2 * maxframes: 1024;
+	frames = realloc(frames, maxframes * sizeof(*frames));
+	if (frames == NULL) {
+	    perror("compbench: realloc");
+	    exit(1);
+	}
+    }
+    q = malloc(len + PPP_HDRLEN);
+    if (q == NULL) {
+	perror("compbench: malloc");
+	exit(1);
+    }
+    q[0] = PPP_ALLSTATIONS;
+    q[1] = PPP_UI;
+    q[2] = proto >> 8;
+    q[3] = proto;
+    memcpy(q + PPP_HDRLEN, p, len);
+    len += PPP_HDRLEN;
+    frames[nframes].dir = dir;
+    frames[nframes].len = len;
+    frames[nframes].data = q;
+    ++nframes;
+    total_bytes += len;
+    if (len > max_len)
+	max_len = len;
+}
+
+/*
+ * read_record - pick the frames with a good FCS out of a record file.
+ * Type 1 and 2 records hold the bytes sent and received, still HDLC
+ * framed, after a 2-byte count; 3 and 4 have no data; 5, 6 and 7 are
+ * times, of 4, 1 and 4 bytes.
+ */
+static void
+read_record(const char *name)
+{
+    FILE *f;
+    int c, n, dir;
+    struct {
+	u_char	buf[65536];
+	int	cnt, esc;
+    } pkt[2], *pp;
+
+    f = fopen(name, "r");
+    if (f == NULL) {
+	perror(name);
+	exit(1);
+    }
+    memset(pkt, 0, sizeof(pkt));
+    while ((c = getc(f)) != EOF) {
+	switch (c) {
+	case 1:
+	case 2:
+	    dir = c - 1;
+	    pp = &pkt[dir];
+	    n = getc(f) << 8;
+	    n += getc(f);
+	    for (; n > 0; --n) {
+		c = getc(f);
+		if (c == EOF)
+		    break;
+		if (c == '~') {
+		    if (pp->cnt > 2 && !pp->esc
+			&& ppp_fcs16(PPP_INITFCS16, pp->buf, pp->cnt)
+			    == PPP_GOODFCS16)
+			add_frame(dir, pp->buf, pp->cnt - 2);
+		    pp->cnt = 0;
+		    pp->esc = 0;
+		} else if (c == '}' && !pp->esc) {
+		    pp->esc = 1;
+		} else {
+		    if (pp->esc)
+			c ^= 0x20;
+		    pp->esc = 0;
+		    if (pp->cnt < sizeof(pp->buf))
+			pp->buf[pp->cnt++] = c;
+		}
+	    }
+	    break;
+	case 3:
+	case 4:
+	    break;
+	case 5:
+	case 7:
+	    for (n = 4; n > 0; --n)
+		getc(f);
+	    break;
+	case 6:
+	    getc(f);
+	    break;
+	default:
+	    fprintf(stderr, "%s: bad record type %d\n", name, c);
+	    exit(1);
+	}
+    }
+    fclose(f);
+}
+
+/*
+ * Userspace versions of the STREAMS message routines, as declared in
+ * shim/sys/stream.h.
+ */
+mblk_t *
+allocb(int size, unsigned int pri)
+{
+    mblk_t *bp;
+
+    bp = malloc(sizeof(*bp));
+    if (bp == NULL)
+	return NULL;
+    bp->b_data.db_base = malloc(size > 0? size: 1);
+    if (bp->b_data.db_base == NULL) {
+	free(bp);
+	return NULL;
+    }
+    bp->b_data.db_lim = bp->b_data.db_base + size;
+    bp->b_datap = &bp->b_data;
+    bp->b_rptr = bp->b_wptr = bp->b_data.db_base;
+    bp->b_cont = NULL;
+    return bp;
+}
+
+void
+freeb(mblk_t *bp)
+{
+    free(bp->b_data.db_base);
+    free(bp);
+}
+
+void
+freemsg(mblk_t *mp)
+{
+    mblk_t *next;
+
+    for (; mp != NULL; mp = next) {
+	next = mp->b_cont;
+	freeb(mp);
+    }
+}
+
+int
+msgdsize(mblk_t *mp)
+{
+    int n;
+
+    for (n = 0; mp != NULL; mp = mp->b_cont)
+	n += mp->b_wptr - mp->b_rptr;
+    return n;
+}
+
+/*
+ * pullupmsg - make the first len bytes of mp (all of it if len is -1)
+ * contiguous in its first block.  Blocks emptied by this are freed.
+ */
+int
+pullupmsg(mblk_t *mp, int len)
+{
+    unsigned char *buf, *p;
+    mblk_t *bp;
+    int n;
+
+    if (len < 0)
+	len = msgdsize(mp);
+    if (mp->b_wptr - mp->b_rptr >= len)
+	return 1;
+    if (msgdsize(mp) < len)
+	return 0;
+    buf = malloc(len);
+    if (buf == NULL)
+	return 0;
+    p = buf;
+    n = mp->b_wptr - mp->b_rptr;
+    memcpy(p, mp->b_rptr, n);
+    p += n;
+    len -= n;
+    while (len > 0) {
+	bp = mp->b_cont;
+	n = bp->b_wptr - bp->b_rptr;
+	if (n > len)
+	    n = len;
+	memcpy(p, bp->b_rptr, n);
+	p += n;
+	len -= n;
+	bp->b_rptr += n;
+	if (bp->b_rptr == bp->b_wptr) {
+	    mp->b_cont = bp->b_cont;
+	    freeb(bp);
+	}
+    }
+    free(mp->b_data.db_base);
+    mp->b_data.db_base = mp->b_rptr = buf;
+    mp->b_data.db_lim = mp->b_wptr = p;
+    return 1;
+}
+
+/*
+ * make_msg - copy len bytes at p into a message, in blocks of
+ * blocksize bytes if -s was given.
+ */
+static mblk_t *
+make_msg(u_char *p, int len)
+{
+    mblk_t *mp, **mpp, *bp;
+    int n;
+
+    mp = NULL;
+    mpp = &mp;
+    do {
+	n = (blocksize > 0 && len > blocksize)? blocksize: len;
+	bp = allocb(n, BPRI_MED);
+	if (bp == NULL) {
+	    fprintf(stderr, "compbench: out of memory\n");
+	    exit(1);
+	}
+	memcpy(bp->b_wptr, p, n);
+	bp->b_wptr += n;
+	*mpp = bp;
+	mpp = &bp->b_cont;
+	p += n;
+	len -= n;
+    } while (len > 0);
+    return mp;
+}
+
+/* msg_equal - say whether message mp holds the len bytes at p */
+static int
+msg_equal(mblk_t *mp, u_char *p, int len)
+{
+    int n;
+
+    for (; mp != NULL; mp = mp->b_cont) {
+	n = mp->b_wptr - mp->b_rptr;
+	if (n > len || memcmp(mp->b_rptr, p, n) != 0)
+	    return 0;
+	p += n;
+	len -= n;
+    }
+    return len == 0;
+}
+
+/* msg_flatten - copy the bytes of mp to p, returning how many */
+static int
+msg_flatten(mblk_t *mp, u_char *p)
+{
+    int n, len;
+
+    for (len = 0; mp != NULL; mp = mp->b_cont) {
+	n = mp->b_wptr - mp->b_rptr;
+	memcpy(p + len, mp->b_rptr, n);
+	len += n;
+    }
+    return len;
+}
+
+/*
+ * Writing a record file for pppdump.
+ */
+static FILE *recf;
+static u_char recbuf[32768];
+static int reclen, recdir;
+
+static void
+rec_flush(void)
+{
+    if (reclen == 0)
+	return;
+    putc(recdir + 1, recf);
+    putc(reclen >> 8, recf);
+    putc(reclen, recf);
+    fwrite(recbuf, reclen, 1, recf);
+    reclen = 0;
+}
+
+static void
+rec_raw(int c)
+{
+    if (reclen >= sizeof(recbuf))
+	rec_flush();
+    recbuf[reclen++] = c;
+}
+
+static void
+rec_byte(int c)
+{
+    if (c == '~' || c == '}') {
+	rec_raw('}');
+	c ^= 0x20;
+    }
+    rec_raw(c);
+}
+
+static void
+rec_frame(int dir, u_char *p, int len)
+{
+    int i, fcs;
+
+    if (dir != recdir)
+	rec_flush();
+    recdir = dir;
+    fcs = ppp_fcs16(PPP_INITFCS16, p, len) ^ 0xffff;
+    rec_raw('~');
+    for (i = 0; i < len; ++i)
+	rec_byte(p[i]);
+    rec_byte(fcs & 0xff);
+    rec_byte(fcs >> 8);
+    rec_raw('~');
+}
+
+/* rec_confack - a CCP Configure-Ack for the option opt */
+static void
+rec_confack(int dir, u_char *opt, int optlen)
+{
+    u_char p[PPP_HDRLEN + CCP_HDRLEN + CCP_MAX_OPTION_LENGTH];
+
+    p[0] = PPP_ALLSTATIONS;
+    p[1] = PPP_UI;
+    p[2] = PPP_CCP >> 8;
+    p[3] = PPP_CCP & 0xff;
+    p[4] = CCP_CONFACK;
+    p[5] = 1;
+    p[6] = 0;
+    p[7] = CCP_HDRLEN + optlen;
+    memcpy(p + PPP_HDRLEN + CCP_HDRLEN, opt, optlen);
+    rec_frame(dir, p, PPP_HDRLEN + CCP_HDRLEN + optlen);
+}
+
+/*
+ * check_pppdump - run pppdump over the record file we wrote, and
+ * compare the frames it decompressed with the originals.
+ */
+static int
+check_pppdump(const char *pppdump, const char *name, char *recname)
+{
+    char pcapname[] = "/tmp/compbench-XXXXXX";
+    u_int32_t hdr[2], epb[5];
+    u_char *buf, *p;
+    int fd, pid, status, i, len, hlen, bad, proto;
+    FILE *f;
+
+    fd = mkstemp(pcapname);
+    if (fd < 0) {
+	perror("compbench: mkstemp");
+	return 1;
+    }
+    close(fd);
+    pid = fork();
+    if (pid < 0) {
+	perror("compbench: fork");
+	return 1;
+    }
+    if (pid == 0) {
+	execlp(pppdump, pppdump, "-p", "-d", "-w", pcapname, recname,
+	       (char *) NULL);
+	perror(pppdump);
+	_exit(127);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	fprintf(stderr, "compbench: %s failed\n", pppdump);
+	unlink(pcapname);
+	return 1;
+    }
+
+    f = fopen(pcapname, "r");
+    unlink(pcapname);
+    if (f == NULL) {
+	perror(pcapname);
+	return 1;
+    }
+    buf = malloc(max_len + 65536);
+    i = bad = 0;
+    while (fread(hdr, sizeof(hdr), 1, f) == 1) {
+	len = hdr[1] - 12;
+	if (len < 0 || len > max_len + 65536
+	    || fread(buf, len + 4, 1, f) != 1)
+	    break;
+	if (hdr[0] != 6)		/* enhanced packet block */
+	    continue;
+	memcpy(epb, buf, sizeof(epb));
+	p = buf + sizeof(epb);
+	len = epb[3];
+	/* after the direction byte, the header may be compressed */
+	hlen = len > 1? ppp_header(p + 1, len - 1, &proto): -1;
+	if (hlen < 0 || proto == PPP_CCP)
+	    continue;
+	len -= 1 + hlen;
+	if (i >= nframes || p[0] != (frames[i].dir == 0)
+	    || PPP_PROTOCOL(frames[i].data) != proto
+	    || len != frames[i].len - PPP_HDRLEN
+	    || memcmp(p + 1 + hlen, frames[i].data + PPP_HDRLEN, len) != 0)
+	    ++bad;
+	++i;
+    }
+    fclose(f);
+    free(buf);
+    if (i != nframes)
+	bad += abs(nframes - i);
+    if (bad)
+	printf("pppdump: %s: %d of %d frames differ\n", name, bad, nframes);
+    else
+	printf("pppdump: %s: all %d frames match\n", name, nframes);
+    return bad != 0;
+}
+
+/*
+ * run_ccp - replay the capture through one CCP compressor.
+ */
+static void
+run_ccp(struct result *res, struct compressor *cp, u_char *opt, int optlen,
+	int passes, const char *pppdump)
+{
+    void *xs[2], *rs[2];
+    mblk_t *mp, *cmp, *dmp;
+    int pass, i, dir, olen, rv, mru;
+    double t0;
+    u_char *obuf;
+    char recname[] = "/tmp/compbench-XXXXXX";
+    int fd;
+
+    mru = max_len - PPP_HDRLEN;
+    if (mru < PPP_MRU)
+	mru = PPP_MRU;
+    for (dir = 0; dir < 2; ++dir) {
+	xs[dir] = cp->comp_alloc(opt, optlen);
+	rs[dir] = cp->decomp_alloc(opt, optlen);
+	if (xs[dir] == NULL || rs[dir] == NULL) {
+	    fprintf(stderr, "compbench: can't allocate %s\n", res->name);
+	    exit(1);
+	}
+    }
+
+    /* the record file for pppdump is written on the first pass */
+    if (pppdump != NULL) {
+	fd = mkstemp(recname);
+	if (fd < 0 || (recf = fdopen(fd, "w")) == NULL) {
+	    perror("compbench: record file");
+	    exit(1);
+	}
+	putc(7, recf);
+	for (i = 0; i < 4; ++i)
+	    putc(0, recf);
+	rec_confack(0, opt, optlen);
+	rec_confack(1, opt, optlen);
+    }
+    obuf = malloc(max_len + 1024);
+
+    for (pass = 0; pass < passes; ++pass) {
+	for (dir = 0; dir < 2; ++dir) {
+	    cp->comp_init(xs[dir], opt, optlen, dir, 0, 0);
+	    cp->decomp_init(rs[dir], opt, optlen, dir, 0, mru, 0);
+	}
+	for (i = 0; i < nframes; ++i) {
+	    dir = frames[i].dir;
+	    mp = make_msg(frames[i].data, frames[i].len);
+
+	    t0 = now();
+	    olen = cp->compress(xs[dir], &cmp, mp, frames[i].len,
+				mru + PPP_HDRLEN);
+	    res->ctime += now() - t0;
+	    res->in += frames[i].len;
+	    ++res->frames;
+
+	    if (cmp != NULL) {
+		res->out += olen;
+		++res->compressed;
+		freemsg(mp);
+		if (recf != NULL)
+		    rec_frame(dir, obuf, msg_flatten(cmp, obuf));
+		t0 = now();
+		rv = cp->decompress(rs[dir], cmp, &dmp);
+		res->dtime += now() - t0;
+		freemsg(cmp);
+		if (rv != DECOMP_OK || dmp == NULL
+		    || !msg_equal(dmp, frames[i].data, frames[i].len)) {
+		    if (res->errors++ == 0)
+			fprintf(stderr, "%s: frame %d (%s) did not come back"
+				" (%d)\n", res->name, i,
+				dir? "rcvd": "sent", rv);
+		}
+		if (dmp != NULL)
+		    freemsg(dmp);
+	    } else {
+		res->out += frames[i].len;
+		if (recf != NULL)
+		    rec_frame(dir, frames[i].data, frames[i].len);
+		t0 = now();
+		cp->incomp(rs[dir], mp);
+		res->dtime += now() - t0;
+		freemsg(mp);
+	    }
+	}
+	if (recf != NULL) {
+	    rec_flush();
+	    fclose(recf);
+	    recf = NULL;
+	    if (check_pppdump(pppdump, res->name, recname))
+		++res->errors;
+	    unlink(recname);
+	}
+    }
+    free(obuf);
+    for (dir = 0; dir < 2; ++dir) {
+	cp->comp_free(xs[dir]);
+	cp->decomp_free(rs[dir]);
+    }
+}
+
+/*
+ * run_vj - replay the TCP/IP frames through VJ header compression,
+ * as ppp_comp.c does it.
+ */
+static void
+run_vj(struct result *res, int passes)
+{
+    struct vjcompress xs[2], rs[2];
+    u_char *buf, *vjhdr, *dp, *iphdr, *out;
+    u_int iphlen;
+    int pass, i, dir, len, type, vjlen, olen;
+    double t0;
+    struct ip *ip;
+
+    buf = malloc(max_len + 16);
+    out = malloc(max_len + MAX_HDR + 16);
+    for (pass = 0; pass < passes; ++pass) {
+	for (dir = 0; dir < 2; ++dir) {
+	    vj_compress_init(&xs[dir], -1);
+	    vj_compress_init(&rs[dir], -1);
+	}
+	for (i = 0; i < nframes; ++i) {
+	    dir = frames[i].dir;
+	    len = frames[i].len;
+	    if (PPP_PROTOCOL(frames[i].data) != PPP_IP)
+		continue;
+	    ip = (struct ip *) (buf + PPP_HDRLEN);
+	    memcpy(buf, frames[i].data, len);
+	    if (len < PPP_HDRLEN + sizeof(struct ip) || ip->ip_p != IPPROTO_TCP)
+		continue;
+	    res->in += len;
+	    ++res->frames;
+
+	    t0 = now();
+	    type = vj_compress_tcp(ip, len - PPP_HDRLEN, &xs[dir], 1, &vjhdr);
+	    res->ctime += now() - t0;
+
+	    dp = buf + PPP_HDRLEN;
+	    olen = len;
+	    t0 = now();
+	    switch (type) {
+	    case TYPE_COMPRESSED_TCP:
+		olen = buf + len - vjhdr + PPP_HDRLEN;
+		++res->compressed;
+		vjlen = vj_uncompress_tcp(vjhdr, buf + len - vjhdr,
+					  buf + len - vjhdr, &rs[dir],
+					  &iphdr, &iphlen);
+		if (vjlen < 0) {
+		    olen = -olen;
+		    break;
+		}
+		memcpy(out, buf, PPP_HDRLEN);
+		memcpy(out + PPP_HDRLEN, iphdr, iphlen);
+		memcpy(out + PPP_HDRLEN + iphlen, vjhdr + vjlen,
+		       buf + len - vjhdr - vjlen);
+		len = PPP_HDRLEN + iphlen + (buf + len - vjhdr - vjlen);
+		dp = out;
+		break;
+	    case TYPE_UNCOMPRESSED_TCP:
+		if (!vj_uncompress_uncomp(dp, len - PPP_HDRLEN, &rs[dir]))
+		    olen = -olen;
+		dp = buf;
+		break;
+	    default:
+		dp = buf;
+		break;
+	    }
+	    res->dtime += now() - t0;
+	    if (olen < 0 || len != frames[i].len
+		|| memcmp(dp, frames[i].data, len) != 0) {
+		if (res->errors++ == 0)
+		    fprintf(stderr, "%s: frame %d (%s) did not come back\n",
+			    res->name, i, dir? "rcvd": "sent");
+		olen = abs(olen);
+	    }
+	    res->out += olen;
+	}
+    }
+    free(buf);
+    free(out);
+}
+
+static void
+print_result(struct result *res)
+{
+    printf("%-12s %8ld %8ld %9.2f %9.2f %6.3f %9.1f %9.1f %6d\n",
+	   res->name, res->frames, res->compressed, res->in / 1e6,
+	   res->out / 1e6, res->out? (double) res->in / res->out: 0.0,
+	   res->ctime > 0? res->in / res->ctime / 1e6: 0.0,
+	   res->dtime > 0? res->in / res->dtime / 1e6: 0.0, res->errors);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c, passes, bits, window, errors;
+    const char *pppdump;
+    struct result res[3];
+    u_char bsd_opt[CILEN_BSD_COMPRESS], z_opt[CILEN_DEFLATE];
+    char bsd_name[16], z_name[16];
+
+    passes = 1;
+    bits = BSD_MAX_BITS;
+    window = DEFLATE_MAX_SIZE;
+    pppdump = NULL;
+    while ((c = getopt(argc, argv, "n:b:w:s:V:")) != -1) {
+	switch (c) {
+	case 'n':
+	    passes = atoi(optarg);
+	    break;
+	case 'b':
+	    bits = atoi(optarg);
+	    break;
+	case 'w':
+	    window = atoi(optarg);
+	    break;
+	case 's':
+	    blocksize = atoi(optarg);
+	    break;
+	case 'V':
+	    pppdump = optarg;
+	    break;
+	default:
+	    goto usage;
+	}
+    }
+    if (optind >= argc || passes < 1 || bits < BSD_MIN_BITS
+	|| bits > BSD_MAX_BITS || window < DEFLATE_MIN_SIZE + 1
+	|| window > DEFLATE_MAX_SIZE || blocksize < 0) {
+    usage:
+	fprintf(stderr, "Usage: %s [-n passes] [-b bits] [-w window]"
+		" [-s blocksize] [-V pppdump] file ...\n", argv[0]);
+	exit(1);
+    }
+    for (; optind < argc; ++optind)
+	read_record(argv[optind]);
+    if (nframes == 0) {
+	fprintf(stderr, "compbench: no frames to compress\n");
+	exit(1);
+    }
+    printf("%d frames, %.2f MB, %d skipped; %d pass%s\n", nframes,
+	   total_bytes / 1e6, nskipped, passes, passes == 1? "": "es");
+
+    memset(res, 0, sizeof(res));
+    bsd_opt[0] = CI_BSD_COMPRESS;
+    bsd_opt[1] = CILEN_BSD_COMPRESS;
+    bsd_opt[2] = BSD_MAKE_OPT(BSD_CURRENT_VERSION, bits);
+    snprintf(bsd_name, sizeof(bsd_name), "bsd-comp %d", bits);
+    res[0].name = bsd_name;
+    run_ccp(&res[0], &ppp_bsd_compress, bsd_opt, sizeof(bsd_opt), passes,
+	    pppdump);
+
+    z_opt[0] = CI_DEFLATE;
+    z_opt[1] = CILEN_DEFLATE;
+    z_opt[2] = DEFLATE_MAKE_OPT(window);
+    z_opt[3] = DEFLATE_CHK_SEQUENCE;
+    snprintf(z_name, sizeof(z_name), "deflate %d", window);
+    res[1].name = z_name;
+    run_ccp(&res[1], &ppp_deflate, z_opt, sizeof(z_opt), passes, pppdump);
+
+    res[2].name = "vj";
+    run_vj(&res[2], passes);
+
+    printf("%-12s %8s %8s %9s %9s %6s %9s %9s %6s\n", "method", "frames",
+	   "compr", "in MB", "out MB", "ratio", "comp MB/s", "dec MB/s",
+	   "errors");
+    errors = 0;
+    for (c = 0; c < 3; ++c) {
+	print_result(&res[c]);
+	errors += res[c].errors;
+    }
+    exit(errors? 1: 0);
+}
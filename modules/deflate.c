@@ -68,18 +68,71 @@
  * State for a Deflate (de)compressor.
  */
 struct deflate_state {
+    struct deflate_state *next;	/* on the pool of idle states */
     int		seqno;
     int		w_size;
+    int		level;		/* compressor tuning */
+    int		strategy;
+    int		mem_level;
     int		unit;
     int		hdrlen;
     int		mru;
     int		debug;
+    int		bypass;		/* packets left to send without trying */
+    int		bypass_len;	/* length of the last bypass */
+    int		win_count;	/* packets in the current sample */
+    u_int	win_in;		/* bytes in them */
+    u_int	win_saved;	/* bytes compression saved on them */
     z_stream	strm;
     struct compstat stats;
 };
 
 #define DEFLATE_OVHD	2		/* Deflate overhead/packet */
 
+/*
+ * On a link carrying mostly encrypted or already compressed data,
+ * nearly every packet goes out uncompressed, after deflate has spent
+ * as long on it as on one that compresses.  So the compressor looks
+ * at each sample of DEFLATE_BYPASS_WINDOW packets, and if compression
+ * saved less than deflate_bypass_min percent of their bytes, it sends
+ * the next deflate_bypass_probe packets uncompressed without trying,
+ * then tries another sample.  Each sample that still doesn't compress
+ * doubles the bypass, up to deflate_bypass_max packets.
+ *
+ * The peer's decompressor still adds the packets it receives
+ * uncompressed to its history, so ours must as well.  During a bypass
+ * the compressor is switched to level 0, which only copies the data
+ * into the window, and the stored blocks it makes are thrown away.
+ * Setting deflate_bypass_min to 0 turns this off.
+ */
+#define DEFLATE_BYPASS_WINDOW	16
+
+int deflate_bypass_min = 3;
+int deflate_bypass_probe = 64;
+int deflate_bypass_max = 256;
+
+#ifdef SOL2
+/*
+ * Deflate states, with their windows and hash tables, are big, and
+ * each CCP negotiation frees one and allocates another, which on a
+ * concentrator with many links adds up to a lot of churn.  So when
+ * one is freed it is kept, up to deflate_pool_max of them (which can
+ * be set in /etc/system), to be handed to the next negotiation for
+ * the same window size (and for a compressor, memLevel).  Compressor and decompressor states are kept
+ * apart, since zlib sets them up differently.
+ */
+int deflate_pool_max = 8;
+static struct deflate_state *deflate_pool[2];	/* compress, decompress */
+static int deflate_pool_count;
+static kmutex_t deflate_pool_lock;
+
+void deflate_pool_init(void);
+void deflate_pool_fini(void);
+static struct deflate_state *z_pool_get(int decomp, int w_size,
+					 int mem_level);
+static int	z_pool_put(struct deflate_state *state, int decomp);
+#endif
+
 static void	*z_alloc(void *, u_int items, u_int size);
 static void	*z_alloc_init(void *, u_int items, u_int size);
 static void	z_free(void *, void *ptr);
@@ -99,6 +152,9 @@ static int	z_decompress(void *state, mblk_t *cmp,
 static void	z_comp_reset(void *state);
 static void	z_decomp_reset(void *state);
 static void	z_comp_stats(void *state, struct compstat *stats);
+static void	z_bypass_sample(struct deflate_state *state, int orig_len,
+				int olen);
+static void	z_bypass_stop(struct deflate_state *state);
 
 /*
  * Procedures exported to ppp_comp.c.
@@ -138,6 +194,7 @@ struct compressor ppp_deflate_draft = {
 };
 
 #define DECOMP_CHUNK	512
+#define DECOMP_MAX_FIRST 4096		/* most for the first output block */
 
 /*
  * Space allocation and freeing routines for use by zlib routines.
@@ -189,15 +246,22 @@ z_free(notused, ptr)
     struct zchunk *z = ((struct zchunk *) ptr) - 1;
 
     if (z->guard != GUARD_MAGIC) {
-	printf("ppp: z_free of corrupted chunk at %x (%x, %x)\n",
+	printf("ppp: z_free of corrupted chunk at %p (%x, %x)\n",
 	       z, z->size, z->guard);
 	return;
     }
     FREE(z, z->size);
 }
 
+#ifdef Z_RLE
+#define DEFLATE_MAX_STRATEGY	Z_RLE
+#else
+#define DEFLATE_MAX_STRATEGY	Z_HUFFMAN_ONLY
+#endif
+
 /*
- * Allocate space for a compressor.
+ * Allocate space for a compressor.  pppd may have put the level,
+ * strategy and memLevel to use after the option itself.
  */
 static void *
 z_comp_alloc(options, opt_len)
@@ -205,9 +269,9 @@ z_comp_alloc(options, opt_len)
     int opt_len;
 {
     struct deflate_state *state;
-    int w_size;
+    int w_size, level, strategy, mem_level;
 
-    if (opt_len != CILEN_DEFLATE
+    if ((opt_len != CILEN_DEFLATE && opt_len != CILEN_DEFLATE + DEFLATE_TUNE_LEN)
 	|| (options[0] != CI_DEFLATE && options[0] != CI_DEFLATE_DRAFT)
 	|| options[1] != CILEN_DEFLATE
 	|| DEFLATE_METHOD(options[2]) != DEFLATE_METHOD_VAL
@@ -221,6 +285,39 @@ z_comp_alloc(options, opt_len)
     if (w_size < 9 || w_size > DEFLATE_MAX_SIZE)
 	return NULL;
 
+    level = Z_DEFAULT_COMPRESSION;
+    strategy = Z_DEFAULT_STRATEGY;
+    mem_level = 8;
+    if (opt_len > CILEN_DEFLATE) {
+	if (options[4] != DEFLATE_TUNE_DEFAULT)
+	    level = options[4];
+	if (options[5] != DEFLATE_TUNE_DEFAULT)
+	    strategy = options[5];
+	if (options[6] != DEFLATE_TUNE_DEFAULT)
+	    mem_level = options[6];
+	if (level > 9
+	    || strategy > DEFLATE_MAX_STRATEGY
+	    || mem_level < 1 || mem_level > MAX_MEM_LEVEL)
+	    return NULL;
+    }
+
+#ifdef SOL2
+    if ((state = z_pool_get(0, w_size, mem_level)) != NULL) {
+	deflateReset(&state->strm);
+	if ((state->bypass > 0 || state->level != level
+	     || state->strategy != strategy)
+	    && deflateParams(&state->strm, level, strategy) != Z_OK) {
+	    deflateEnd(&state->strm);
+	    FREE(state, sizeof(*state));
+	    return NULL;
+	}
+	state->level = level;
+	state->strategy = strategy;
+	state->bypass = 0;
+	bzero(&state->stats, sizeof(state->stats));
+	return (void *) state;
+    }
+#endif
 
 #ifdef __osf__
     state = (struct deflate_state *) ALLOC_SLEEP(sizeof(*state));
@@ -234,14 +331,18 @@ z_comp_alloc(options, opt_len)
     state->strm.next_in = NULL;
     state->strm.zalloc = (alloc_func) z_alloc_init;
     state->strm.zfree = (free_func) z_free;
-    if (deflateInit2(&state->strm, Z_DEFAULT_COMPRESSION, DEFLATE_METHOD_VAL,
-		     -w_size, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    if (deflateInit2(&state->strm, level, DEFLATE_METHOD_VAL,
+		     -w_size, mem_level, strategy) != Z_OK) {
 	FREE(state, sizeof(*state));
 	return NULL;
     }
 
     state->strm.zalloc = (alloc_func) z_alloc;
     state->w_size = w_size;
+    state->level = level;
+    state->strategy = strategy;
+    state->mem_level = mem_level;
+    state->bypass = 0;
     bzero(&state->stats, sizeof(state->stats));
     return (void *) state;
 }
@@ -252,6 +353,10 @@ z_comp_free(arg)
 {
     struct deflate_state *state = (struct deflate_state *) arg;
 
+#ifdef SOL2
+    if (z_pool_put(state, 0))
+	return;
+#endif
     deflateEnd(&state->strm);
     FREE(state, sizeof(*state));
 }
@@ -278,6 +383,7 @@ z_comp_init(arg, options, opt_len, unit, hdrlen, debug)
     state->debug = debug;
 
     deflateReset(&state->strm);
+    z_bypass_stop(state);
 
     return 1;
 }
@@ -318,9 +424,11 @@ z_compress(arg, mret, mp, orig_len, maxolen)
     if (proto > 0x3fff || proto == 0xfd || proto == 0xfb)
 	return orig_len;
 
-    /* Allocate one mblk initially. */
+    /* Allocate one mblk initially, unless the output is to be dropped. */
     if (maxolen > orig_len)
 	maxolen = orig_len;
+    if (state->bypass > 0)
+	maxolen = 0;
     if (maxolen <= PPP_HDRLEN + 2) {
 	wspace = 0;
 	m = NULL;
@@ -430,9 +538,60 @@ z_compress(arg, mret, mp, orig_len, maxolen)
     state->stats.unc_bytes += orig_len;
     state->stats.unc_packets++;
 
+    if (state->bypass > 0) {
+	if (--state->bypass == 0)
+	    deflateParams(&state->strm, state->level, state->strategy);
+    } else if (deflate_bypass_min > 0)
+	z_bypass_sample(state, orig_len, olen);
+
     return olen;
 }
 
+/*
+ * Add a packet to the current sample, and when the sample is done
+ * decide whether the next packets are worth compressing.
+ */
+static void
+z_bypass_sample(state, orig_len, olen)
+    struct deflate_state *state;
+    int orig_len, olen;
+{
+    state->win_in += orig_len;
+    state->win_saved += orig_len - olen;
+    if (++state->win_count < DEFLATE_BYPASS_WINDOW)
+	return;
+
+    if (state->win_saved * 100 < state->win_in * deflate_bypass_min) {
+	if (state->bypass_len == 0)
+	    state->bypass_len = deflate_bypass_probe;
+	else if ((state->bypass_len *= 2) > deflate_bypass_max)
+	    state->bypass_len = deflate_bypass_max;
+	state->bypass = state->bypass_len;
+	/* the last packet was flushed, so this makes no output */
+	deflateParams(&state->strm, 0, state->strategy);
+    } else
+	state->bypass_len = 0;
+    state->win_count = 0;
+    state->win_in = 0;
+    state->win_saved = 0;
+}
+
+/*
+ * Go back to compressing every packet and start a new sample.
+ */
+static void
+z_bypass_stop(state)
+    struct deflate_state *state;
+{
+    if (state->bypass > 0)
+	deflateParams(&state->strm, state->level, state->strategy);
+    state->bypass = 0;
+    state->bypass_len = 0;
+    state->win_count = 0;
+    state->win_in = 0;
+    state->win_saved = 0;
+}
+
 static void
 z_comp_stats(arg, stats)
     void *arg;
@@ -477,6 +636,14 @@ z_decomp_alloc(options, opt_len)
     if (w_size < 9 || w_size > DEFLATE_MAX_SIZE)
 	return NULL;
 
+#ifdef SOL2
+    if ((state = z_pool_get(1, w_size, 0)) != NULL) {
+	inflateReset(&state->strm);
+	bzero(&state->stats, sizeof(state->stats));
+	return (void *) state;
+    }
+#endif
+
 #ifdef __osf__
     state = (struct deflate_state *) ALLOC_SLEEP(sizeof(*state));
 #else
@@ -495,6 +662,7 @@ z_decomp_alloc(options, opt_len)
 
     state->strm.zalloc = (alloc_func) z_alloc;
     state->w_size = w_size;
+    state->mem_level = 0;
     bzero(&state->stats, sizeof(state->stats));
     return (void *) state;
 }
@@ -505,6 +673,10 @@ z_decomp_free(arg)
 {
     struct deflate_state *state = (struct deflate_state *) arg;
 
+#ifdef SOL2
+    if (z_pool_put(state, 1))
+	return;
+#endif
     inflateEnd(&state->strm);
     FREE(state, sizeof(*state));
 }
@@ -598,15 +770,22 @@ z_decompress(arg, mi, mop)
     }
     ++state->seqno;
 
-    /* Allocate an output message block. */
-    mo = allocb(DECOMP_CHUNK + state->hdrlen, BPRI_MED);
+    /*
+     * Allocate an output message block, big enough for a packet of
+     * up to the MRU so that most packets come out in one block.
+     */
+    ospace = state->mru + PPP_HDRLEN;
+    if (ospace < DECOMP_CHUNK)
+	ospace = DECOMP_CHUNK;
+    else if (ospace > DECOMP_MAX_FIRST)
+	ospace = DECOMP_MAX_FIRST;
+    mo = allocb(ospace + state->hdrlen, BPRI_MED);
     if (mo == NULL)
 	return DECOMP_ERROR;
     mo_head = mo;
     mo->b_cont = NULL;
     mo->b_rptr += state->hdrlen;
     mo->b_wptr = wptr = mo->b_rptr;
-    ospace = DECOMP_CHUNK;
     olen = 0;
 
     /*
@@ -769,4 +948,80 @@ z_incomp(arg, mi)
     state->stats.unc_packets++;
 }
 
+#ifdef SOL2
+/*
+ * Set up the pool of idle states when the module is loaded, and
+ * free whatever is in it when it is unloaded.
+ */
+void
+deflate_pool_init()
+{
+    mutex_init(&deflate_pool_lock, NULL, MUTEX_DRIVER, NULL);
+}
+
+void
+deflate_pool_fini()
+{
+    struct deflate_state *state;
+    int decomp;
+
+    for (decomp = 0; decomp < 2; ++decomp) {
+	while ((state = deflate_pool[decomp]) != NULL) {
+	    deflate_pool[decomp] = state->next;
+	    if (decomp)
+		inflateEnd(&state->strm);
+	    else
+		deflateEnd(&state->strm);
+	    FREE(state, sizeof(*state));
+	}
+    }
+    deflate_pool_count = 0;
+    mutex_destroy(&deflate_pool_lock);
+}
+
+/*
+ * Take an idle state with the given window size and memLevel from
+ * the pool.
+ */
+static struct deflate_state *
+z_pool_get(decomp, w_size, mem_level)
+    int decomp, w_size, mem_level;
+{
+    struct deflate_state *state, **sp;
+
+    mutex_enter(&deflate_pool_lock);
+    for (sp = &deflate_pool[decomp]; (state = *sp) != NULL; sp = &state->next) {
+	if (state->w_size == w_size && state->mem_level == mem_level) {
+	    *sp = state->next;
+	    --deflate_pool_count;
+	    break;
+	}
+    }
+    mutex_exit(&deflate_pool_lock);
+    return state;
+}
+
+/*
+ * Keep a state that is no longer needed, if the pool has room.
+ * Returns 1 if it was kept.
+ */
+static int
+z_pool_put(state, decomp)
+    struct deflate_state *state;
+    int decomp;
+{
+    int kept = 0;
+
+    mutex_enter(&deflate_pool_lock);
+    if (deflate_pool_count < deflate_pool_max) {
+	state->next = deflate_pool[decomp];
+	deflate_pool[decomp] = state;
+	++deflate_pool_count;
+	kept = 1;
+    }
+    mutex_exit(&deflate_pool_lock);
+    return kept;
+}
+#endif /* SOL2 */
+
 #endif /* DO_DEFLATE */
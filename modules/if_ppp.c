@@ -122,6 +122,34 @@ static int if_ppp_output(struct ifnet *, struct mbuf *,
 static int if_ppp_ioctl(struct ifnet *, u_int, caddr_t);
 static struct mbuf *make_mbufs(mblk_t *, int);
 static mblk_t *make_message(struct mbuf *, int);
+static mblk_t *loan_mblk(struct mbuf *);
+#ifndef __osf__
+static struct mbuf *loan_mbuf(mblk_t *, int);
+#endif
+
+/*
+ * Cluster mbufs being sent are handed down the stream as mblks
+ * that point at the cluster, rather than being copied.  Each one
+ * on loan has one of these, which frees the mbuf when the mblk is
+ * freed.  They are kept on a free list once allocated.
+ */
+struct mbuf_loan {
+    struct free_rtn frtn;
+    struct mbuf *m;
+    struct mbuf_loan *next;
+};
+
+static struct mbuf_loan *loan_list;	/* free loan records */
+static int loans_out;		/* mbufs currently on loan */
+
+#ifdef __osf__
+#define M_ISCLUSTER(m)	(((m)->m_flags & M_EXT) != 0)
+#else
+#define M_ISCLUSTER(m)	((m)->m_off > MMAXOFF)
+#endif
+
+/* worth lending rather than copying */
+#define LOANABLE(m)	(M_ISCLUSTER(m) && (m)->m_len > MLEN)
 
 #ifdef SNIT_SUPPORT
 /* Fake ether header for SNIT */
@@ -139,9 +167,14 @@ int
 if_ppp_unload()
 {
     int i;
+    struct mbuf_loan *lp;
 
-    if (if_ppp_count > 0)
+    if (if_ppp_count > 0 || loans_out > 0)
 	return EBUSY;
+    while ((lp = loan_list) != 0) {
+	loan_list = lp->next;
+	FREE(lp, sizeof(struct mbuf_loan));
+    }
     for (i = 0; i < ppp_nalloc; ++i)
 	if (ifs[i] != 0)
 	    ppp_if_detach(ifs[i]);
@@ -422,8 +455,15 @@ if_ppp_rput(q, mp)
 	proto = PPP_PROTOCOL(mp->b_rptr);
 	adjmsg(mp, PPP_HDRLEN);
 	len = msgdsize(mp);
-	mb = make_mbufs(mp, sizeof(struct ifnet *));
-	freemsg(mp);
+#ifdef __osf__
+	mb = NULL;
+#else
+	mb = loan_mbuf(mp, sizeof(struct ifnet *));
+#endif
+	if (mb == NULL) {
+	    mb = make_mbufs(mp, sizeof(struct ifnet *));
+	    freemsg(mp);
+	}
 	if (mb == NULL) {
 	    if (sp->flags & DBGLOG)
 		printf("if_ppp%d: make_mbufs failed\n", ifp->if_unit);
@@ -730,8 +770,115 @@ make_mbufs(mp, off)
     }
 }
 
+#ifndef __osf__
+/*
+ * Called when the mbuf made by loan_mbuf is freed.
+ */
+static int
+loan_mbuf_free(arg)
+    int arg;
+{
+    int s;
+
+    freeb((mblk_t *) arg);
+    s = splimp();
+    --loans_out;
+    splx(s);
+    return 0;
+}
+
+/*
+ * Make an mbuf that points at the data in mp, if it is all in one
+ * block of our own that is big enough for a cluster, with its start
+ * aligned and room for off bytes in front.  The network code may
+ * change the packet in place, so we have to be the block's only user.
+ * On success, mp belongs to the mbuf.
+ */
+static struct mbuf *
+loan_mbuf(mp, off)
+    mblk_t *mp;
+    int off;
+{
+    struct mbuf *m;
+    int len, s;
+
+    len = mp->b_wptr - mp->b_rptr;
+    if (mp->b_cont != 0 || mp->b_datap->db_ref > 1 || len <= 2 * MLEN
+	|| mp->b_rptr - mp->b_datap->db_base < off
+	|| ((u_long) mp->b_rptr & (sizeof(u_long) - 1)) != 0)
+	return 0;
+    m = mclgetx(loan_mbuf_free, (int) mp, (caddr_t) mp->b_rptr, len,
+		M_DONTWAIT);
+    if (m != 0) {
+	s = splimp();
+	++loans_out;
+	splx(s);
+    }
+    return m;
+}
+#endif /* __osf__ */
+
+/*
+ * Called when an mblk made by loan_mblk is freed.
+ */
+static void
+loan_mblk_free(arg)
+    char *arg;
+{
+    struct mbuf_loan *lp = (struct mbuf_loan *) arg;
+    int s;
+
+    m_free(lp->m);
+    s = splimp();
+    lp->next = loan_list;
+    loan_list = lp;
+    --loans_out;
+    splx(s);
+}
+
+/*
+ * Make an mblk that points at the data in the cluster mbuf m.
+ * On success, m belongs to the mblk.
+ */
+static mblk_t *
+loan_mblk(m)
+    struct mbuf *m;
+{
+    struct mbuf_loan *lp;
+    mblk_t *mp;
+    int s;
+
+    s = splimp();
+    if ((lp = loan_list) != 0)
+	loan_list = lp->next;
+    splx(s);
+    if (lp == 0) {
+	lp = (struct mbuf_loan *) ALLOC_NOSLEEP(sizeof(struct mbuf_loan));
+	if (lp == 0)
+	    return 0;
+    }
+    lp->m = m;
+    lp->frtn.free_func = loan_mblk_free;
+    lp->frtn.free_arg = (char *) lp;
+    mp = esballoc(mtod(m, unsigned char *), m->m_len, BPRI_LO, &lp->frtn);
+    s = splimp();
+    if (mp == 0) {
+	lp->next = loan_list;
+	loan_list = lp;
+    } else
+	++loans_out;
+    splx(s);
+    if (mp == 0)
+	return 0;
+    mp->b_wptr += m->m_len;
+    return mp;
+}
+
 /*
  * Turn an mbuf chain into a STREAMS message.
+ * Big cluster mbufs after the first are taken off the chain and
+ * lent to the message instead of being copied; the modules below
+ * us only change the packet in the first block.
  */
 #define ALLOCB_MAX	4096
 
@@ -740,30 +887,43 @@ make_message(m, off)
     struct mbuf *m;
     int off;
 {
-    mblk_t *head, **prevp, *mp;
+    mblk_t *head, **prevp, *mp, *lmp;
     int len, space, n, nb;
     unsigned char *cp, *dp;
-    struct mbuf *nm;
+    struct mbuf *nm, *pm;
 
-    len = 0;
-    for (nm = m; nm != 0; nm = nm->m_next)
-	len += nm->m_len;
+    len = m->m_len;
+    for (nm = m->m_next; nm != 0; nm = nm->m_next)
+	if (!LOANABLE(nm))
+	    len += nm->m_len;
     prevp = &head;
     space = 0;
     cp = mtod(m, unsigned char *);
     nb = m->m_len;
     for (;;) {
 	while (nb <= 0) {
+	    pm = m;
 	    m = m->m_next;
 	    if (m == 0) {
 		*prevp = 0;
 		return head;
 	    }
+	    if (prevp != &head && LOANABLE(m) && (lmp = loan_mblk(m)) != 0) {
+		pm->m_next = m->m_next;
+		m->m_next = 0;
+		*prevp = lmp;
+		prevp = &lmp->b_cont;
+		space = 0;
+		m = pm;
+		continue;
+	    }
 	    cp = mtod(m, unsigned char *);
 	    nb = m->m_len;
 	}
 	if (space == 0) {
 	    space = len + off;
+	    if (space < nb + off)	/* a loan fell through */
+		space = nb + off;
 	    if (space > ALLOCB_MAX)
 		space = ALLOCB_MAX;
 	    mp = allocb(space, BPRI_LO);
@@ -147,6 +147,13 @@ krwlock_t ppp_lower_lock;
  * Shared (reader) access to ppa_lower_lock guarantees that no lower
  * stream will be unlinked and that the lowerq field of all upperstr_t
  * structures won't change.
+ *
+ * The control stream hands each received data packet to the network
+ * protocol stream it is for with put(), so the packet is sent up
+ * from inside that stream's own perimeter, in order with any packets
+ * its service procedure is still sending.  Each PPA's streams have
+ * their own inner perimeters, so packets for different PPAs can be
+ * handled on different CPUs at once.
  */
 
 #else /* SOL2 */
@@ -159,6 +166,13 @@ krwlock_t ppp_lower_lock;
 
 #endif /* SOL2 */
 
+/*
+ * Each PPA remembers which of its streams it last found for each
+ * SAP, in a table indexed by PPP_SAPHASH of the SAP.
+ */
+#define PPP_SAPMAP_SIZE	16	/* power of 2 */
+#define PPP_SAPHASH(sap)	(((sap) >> 1) & (PPP_SAPMAP_SIZE - 1))
+
 /*
  * Private information; one per upper stream.
  */
@@ -183,6 +197,7 @@ typedef struct upperstr {
     int ppa_id;
     queue_t *lowerq;		/* write queue attached below this PPA */
     struct upperstr *nextppa;	/* next control stream */
+    struct upperstr *sapmap[PPP_SAPMAP_SIZE]; /* see find_dest */
     int mru;
     int mtu;
     struct pppstat stats;	/* statistics */
@@ -266,12 +281,14 @@ static void dlpi_error(queue_t *, upperstr_t *, int, int, int);
 static void dlpi_ok(queue_t *, int);
 #endif
 static int send_data(mblk_t *, upperstr_t *);
+static void send_up(upperstr_t *, mblk_t *);
 static void new_ppa(queue_t *, mblk_t *);
 static void attach_ppa(queue_t *, mblk_t *);
 static void detach_ppa(queue_t *, mblk_t *);
 static void detach_lower(queue_t *, mblk_t *);
 static void debug_dump(queue_t *, mblk_t *);
 static upperstr_t *find_dest(upperstr_t *, int);
+static void forget_dest(upperstr_t *, upperstr_t *);
 #if defined(SOL2)
 static upperstr_t *find_promisc(upperstr_t *, int);
 static mblk_t *prepend_ether(upperstr_t *, mblk_t *, int);
@@ -544,6 +561,7 @@ pppclose(q, flag)
 	 * remove it from the PPA's list.
 	 */
 	if ((as = up->ppa) != 0) {
+	    forget_dest(as, up);
 	    for (; as->next != 0; as = as->next)
 		if (as->next == up) {
 		    as->next = up->next;
@@ -1683,6 +1701,7 @@ detach_ppa(q, mp)
 	return;
     }
 
+    forget_dest(us->ppa, us);
     for (t = us->ppa; t->next != 0; t = t->next)
 	if (t->next == us) {
 	    t->next = us->next;
@@ -1811,6 +1830,22 @@ pppurput(q, mp)
 	return 0;
     }
 
+    if ((ppa->flags & US_CONTROL) == 0) {
+	/*
+	 * A network protocol stream, given a packet by its control
+	 * stream.  Send it straight up, unless there are packets
+	 * queued ahead of it or the stream above is flow-controlled.
+	 * Since this runs inside this stream's perimeter, it can't
+	 * overtake a packet that pppursrv is sending up.
+	 */
+	if (mp->b_datap->db_type == M_DATA && qsize(q) == 0
+	    && canputnext(q))
+	    send_up(ppa, mp);
+	else
+	    putq(q, mp);
+	return 0;
+    }
+
     switch (mp->b_datap->db_type) {
     case M_CTL:
 	MT_ENTER(&ppa->stats_lock);
@@ -1895,8 +1930,8 @@ pppurput(q, mp)
 	    if (proto < 0x8000 && (us = find_dest(ppa, proto)) != 0) {
 		/*
 		 * A data packet for some network protocol.
-		 * Queue it on the upper stream for that protocol.
-		 * XXX could we just putnext it?  (would require thought)
+		 * Pass it to the upper stream for that protocol,
+		 * whose put procedure sends it up if it can.
 		 * The rblocked flag is there to ensure that we keep
 		 * messages in order for each network protocol.
 		 */
@@ -1905,7 +1940,7 @@ pppurput(q, mp)
 		if (!us->rblocked && !canput(us->q))
 		    us->rblocked = 1;
 		if (!us->rblocked)
-		    putq(us->q, mp);
+		    put(us->q, mp);
 		else
 		    putq(q, mp);
 		break;
@@ -1931,10 +1966,7 @@ pppursrv(q)
     queue_t *q;
 {
     upperstr_t *us, *as;
-    mblk_t *mp, *hdr;
-#ifndef NO_DLPI
-    dl_unitdata_ind_t *ud;
-#endif
+    mblk_t *mp;
     int proto;
 
     us = (upperstr_t *) q->q_ptr;
@@ -1971,7 +2003,7 @@ pppursrv(q)
 	    if (proto < 0x8000 && (as = find_dest(us, proto)) != 0) {
 		if (!canput(as->q))
 		    break;
-		putq(as->q, mp);
+		put(as->q, mp);
 	    } else {
 		if (!canputnext(q))
 		    break;
@@ -1997,47 +2029,15 @@ pppursrv(q)
 		
     } else {
 	/*
-	 * A network protocol stream.  Put a DLPI header on each
-	 * packet and send it on.
-	 * (Actually, it seems that the IP module will happily
-	 * accept M_DATA messages without the DL_UNITDATA_IND header.)
+	 * A network protocol stream.  Send on the packets that
+	 * couldn't be sent straight up.
 	 */
 	while ((mp = getq(q)) != 0) {
 	    if (!canputnext(q)) {
 		putbq(q, mp);
 		break;
 	    }
-#ifndef NO_DLPI
-	    proto = PPP_PROTOCOL(mp->b_rptr);
-	    mp->b_rptr += PPP_HDRLEN;
-	    hdr = allocb(sizeof(dl_unitdata_ind_t) + 2 * sizeof(uint),
-			 BPRI_MED);
-	    if (hdr == 0) {
-		/* XXX should put it back and use bufcall */
-		freemsg(mp);
-		continue;
-	    }
-	    hdr->b_datap->db_type = M_PROTO;
-	    ud = (dl_unitdata_ind_t *) hdr->b_wptr;
-	    hdr->b_wptr += sizeof(dl_unitdata_ind_t) + 2 * sizeof(uint);
-	    hdr->b_cont = mp;
-	    ud->dl_primitive = DL_UNITDATA_IND;
-	    ud->dl_dest_addr_length = sizeof(uint);
-	    ud->dl_dest_addr_offset = sizeof(dl_unitdata_ind_t);
-	    ud->dl_src_addr_length = sizeof(uint);
-	    ud->dl_src_addr_offset = ud->dl_dest_addr_offset + sizeof(uint);
-#if DL_CURRENT_VERSION >= 2
-	    ud->dl_group_address = 0;
-#endif
-	    /* Send the DLPI client the data with the SAP they requested,
-	       (e.g. ETHERTYPE_IP) rather than the PPP protocol number
-	       (e.g. PPP_IP) */
-	    ((uint *)(ud + 1))[0] = us->req_sap;	/* dest SAP */
-	    ((uint *)(ud + 1))[1] = us->req_sap;	/* src SAP */
-	    putnext(q, hdr);
-#else /* NO_DLPI */
-	    putnext(q, mp);
-#endif /* NO_DLPI */
+	    send_up(us, mp);
 	}
 	/*
 	 * Now that we have consumed some packets from this queue,
@@ -2052,19 +2052,93 @@ pppursrv(q)
     return 0;
 }
 
+/*
+ * Put a DLPI header on a received packet and send it up a network
+ * protocol stream.
+ * (Actually, it seems that the IP module will happily
+ * accept M_DATA messages without the DL_UNITDATA_IND header.)
+ */
+static void
+send_up(us, mp)
+    upperstr_t *us;
+    mblk_t *mp;
+{
+#ifndef NO_DLPI
+    mblk_t *hdr;
+    dl_unitdata_ind_t *ud;
+
+    mp->b_rptr += PPP_HDRLEN;
+    hdr = allocb(sizeof(dl_unitdata_ind_t) + 2 * sizeof(uint), BPRI_MED);
+    if (hdr == 0) {
+	/* XXX should put it back and use bufcall */
+	freemsg(mp);
+	return;
+    }
+    hdr->b_datap->db_type = M_PROTO;
+    ud = (dl_unitdata_ind_t *) hdr->b_wptr;
+    hdr->b_wptr += sizeof(dl_unitdata_ind_t) + 2 * sizeof(uint);
+    hdr->b_cont = mp;
+    ud->dl_primitive = DL_UNITDATA_IND;
+    ud->dl_dest_addr_length = sizeof(uint);
+    ud->dl_dest_addr_offset = sizeof(dl_unitdata_ind_t);
+    ud->dl_src_addr_length = sizeof(uint);
+    ud->dl_src_addr_offset = ud->dl_dest_addr_offset + sizeof(uint);
+#if DL_CURRENT_VERSION >= 2
+    ud->dl_group_address = 0;
+#endif
+    /* Send the DLPI client the data with the SAP they requested,
+       (e.g. ETHERTYPE_IP) rather than the PPP protocol number
+       (e.g. PPP_IP) */
+    ((uint *)(ud + 1))[0] = us->req_sap;	/* dest SAP */
+    ((uint *)(ud + 1))[1] = us->req_sap;	/* src SAP */
+    putnext(us->q, hdr);
+#else /* NO_DLPI */
+    putnext(us->q, mp);
+#endif /* NO_DLPI */
+}
+
+/*
+ * Find the stream attached to ppa that is bound to proto.  The one
+ * found last for each SAP is kept in ppa->sapmap, so most packets
+ * don't walk the list of attached streams.  A stream's SAP is bound
+ * and unbound from its own queues, so an entry is checked before it
+ * is used.  Entries are cleared (by forget_dest) before the stream
+ * is detached or freed, which only happens with the outer perimeter
+ * held exclusively.
+ */
 static upperstr_t *
 find_dest(ppa, proto)
     upperstr_t *ppa;
     int proto;
 {
     upperstr_t *us;
+    upperstr_t **slot = &ppa->sapmap[PPP_SAPHASH(proto)];
 
+    us = *slot;
+    if (us != 0 && us->sap == proto)
+	return us;
     for (us = ppa->next; us != 0; us = us->next)
 	if (proto == us->sap)
 	    break;
+    if (us != 0)
+	*slot = us;
     return us;
 }
 
+/*
+ * Remove any sapmap entries for us from its PPA's table.
+ */
+static void
+forget_dest(ppa, us)
+    upperstr_t *ppa, *us;
+{
+    int i;
+
+    for (i = 0; i < PPP_SAPMAP_SIZE; ++i)
+	if (ppa->sapmap[i] == us)
+	    ppa->sapmap[i] = 0;
+}
+
 #if defined (SOL2)
 /*
  * Test upstream promiscuous conditions. As of now, only pass IPv4 and
@@ -2154,7 +2228,13 @@ prepend_udind(us, mp, proto)
 }
 
 /*
- * For any recognized promiscuous streams, send data upstream
+ * For any recognized promiscuous streams, send data upstream.
+ * The header each kind of listener wants is built once, in an mblk
+ * of its own ahead of the packet, and each further listener of that
+ * kind gets a dupmsg of the result, so the packet data is shared by
+ * all of them and never copied; they only read it.  The last
+ * listener of each kind gets the message itself.  Listeners that are
+ * flow-controlled are passed over before anything is duplicated.
  */
 static void
 promisc_sendup(ppa, mp, proto, skip)
@@ -2162,48 +2242,37 @@ promisc_sendup(ppa, mp, proto, skip)
     mblk_t *mp;
     int proto, skip;
 {
-    mblk_t *dup_mp, *dup_dup_mp;
-    upperstr_t *prus, *nprus;
-
-    if ((prus = find_promisc(ppa, proto)) != 0) {
-	if (dup_mp = dupmsg(mp)) {
-
-	    if (skip)
-		dup_mp->b_rptr += PPP_HDRLEN;
-
-	    for ( ; nprus = find_promisc(prus->next, proto); 
-		    prus = nprus) {
-
-		if (dup_dup_mp = dupmsg(dup_mp)) {
-		    if (canputnext(prus->q)) {
-			if (prus->flags & US_RAWDATA) {
-			    dup_dup_mp = prepend_ether(prus, dup_dup_mp, proto);
-			    putnext(prus->q, dup_dup_mp);
-			} else {
-			    dup_dup_mp = prepend_udind(prus, dup_dup_mp, proto);
-			    putnext(prus->q, dup_dup_mp);
-			}
-		    } else {
-			DPRINT("ppp_urput: data to promisc q dropped\n");
-			freemsg(dup_dup_mp);
-		    }
-		}
-	    }
-
-	    if (canputnext(prus->q)) {
-		if (prus->flags & US_RAWDATA) {
-		    dup_mp = prepend_ether(prus, dup_mp, proto);
-		    putnext(prus->q, dup_mp);
-		} else {
-		    dup_mp = prepend_udind(prus, dup_mp, proto);
-		    putnext(prus->q, dup_mp);
-		}
-	    } else {
-		DPRINT("ppp_urput: data to promisc q dropped\n");
-		freemsg(dup_mp);
-	    }
+    mblk_t *msg[2], *dup_mp;		/* DLPI, raw */
+    upperstr_t *prus, *last[2];
+    int raw;
+
+    msg[0] = msg[1] = 0;
+    for (prus = find_promisc(ppa, proto); prus != 0;
+	 prus = find_promisc(prus->next, proto)) {
+	if (!canputnext(prus->q)) {
+	    DPRINT("ppp_urput: data to promisc q dropped\n");
+	    continue;
+	}
+	raw = (prus->flags & US_RAWDATA) != 0;
+	if (msg[raw] != 0) {
+	    if ((dup_mp = dupmsg(msg[raw])) != 0)
+		putnext(last[raw]->q, dup_mp);
+	    last[raw] = prus;
+	    continue;
 	}
+	if ((dup_mp = dupmsg(mp)) == 0)
+	    continue;
+	if (skip)
+	    dup_mp->b_rptr += PPP_HDRLEN;
+	if (raw)
+	    msg[raw] = prepend_ether(prus, dup_mp, proto);
+	else
+	    msg[raw] = prepend_udind(prus, dup_mp, proto);
+	last[raw] = prus;
     }
+    for (raw = 0; raw < 2; ++raw)
+	if (msg[raw] != 0)
+	    putnext(last[raw]->q, msg[raw]);
 }
 #endif /* defined(SOL2) */
 
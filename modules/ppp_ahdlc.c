@@ -109,6 +109,7 @@ static int ahdlc_wput(queue_t *, mblk_t *);
 static int ahdlc_rput(queue_t *, mblk_t *);
 static void ahdlc_encode(queue_t *, mblk_t *);
 static void ahdlc_decode(queue_t *, mblk_t *);
+static void ahdlc_fcs_init(void);
 static int msg_byte(mblk_t *, unsigned int);
 
 #if defined(SOL2)
@@ -120,6 +121,14 @@ static int msg_byte(mblk_t *, unsigned int);
 #define ABS(x)	    (x >= 0 ? x : (-x))
 #endif /* SOL2 */
 
+/*
+ * Space left in front of each received frame, enough for a full
+ * PPP header when the address, control and protocol fields are
+ * compressed.  Keeping it a multiple of 4 leaves the alignment of
+ * what follows unchanged.
+ */
+#define RX_HEADROOM	PPP_HDRLEN
+
 /*
  * Extract byte i of message mp 
  */
@@ -271,6 +280,7 @@ MOD_OPEN(ahdlc_open)
 
     q->q_ptr	 = (caddr_t) state;
     WR(q)->q_ptr = (caddr_t) state;
+    ahdlc_fcs_init();
 
 #if defined(USE_MUTEX)
     mutex_init(&state->lock, NULL, MUTEX_DEFAULT, NULL);
@@ -569,6 +579,102 @@ ahdlc_rput(q, mp)
  */
 #define IN_TX_MAP(c, m)	((m)[(c) >> 5] & (1 << ((c) & 0x1f)))
 
+/*
+ * FCS tables for slicing-by-8: fcstab8[k][b] is the FCS contribution
+ * of byte b followed by k more bytes of zeros.  Row 0 is fcstab.
+ */
+static u_short fcstab8[8][256];
+static int fcstab8_ready;
+
+static void
+ahdlc_fcs_init()
+{
+    int i, k;
+
+    if (fcstab8_ready)
+	return;
+    for (i = 0; i < 256; i++)
+	fcstab8[0][i] = fcstab[i];
+    for (k = 1; k < 8; k++)
+	for (i = 0; i < 256; i++)
+	    fcstab8[k][i] = (fcstab8[k-1][i] >> 8)
+		^ fcstab[fcstab8[k-1][i] & 0xff];
+    fcstab8_ready = 1;
+}
+
+/*
+ * Run the FCS over len bytes at dp, eight at a time where possible
+ */
+static ushort_t
+ahdlc_fcs(fcs, dp, len)
+    ushort_t	fcs;
+    uchar_t	*dp;
+    int		len;
+{
+    if (fcstab8_ready) {
+	for (; len >= 8; dp += 8, len -= 8) {
+	    fcs ^= dp[0] | (dp[1] << 8);
+	    fcs = fcstab8[7][fcs & 0xff] ^ fcstab8[6][fcs >> 8]
+		^ fcstab8[5][dp[2]] ^ fcstab8[4][dp[3]]
+		^ fcstab8[3][dp[4]] ^ fcstab8[2][dp[5]]
+		^ fcstab8[1][dp[6]] ^ fcstab8[0][dp[7]];
+	}
+    }
+    for (; len > 0; dp++, len--)
+	fcs = PPP_FCS(fcs, *dp);
+    return fcs;
+}
+
+/*
+ * Word-at-a-time tests for whether any byte of the long w is zero or
+ * is b.  They work in either byte order.
+ */
+#define ONES_W		(~0UL / 0xff)
+#define HAS_ZERO_W(w)	(((w) - ONES_W) & ~(w) & (ONES_W << 7))
+#define HAS_BYTE_W(w, b) HAS_ZERO_W((w) ^ (ONES_W * (b)))
+
+/*
+ * True if xaccm escapes only 0x7d and 0x7e, as on most links once the
+ * ACCM has been negotiated, so that escapes are rare and whole words
+ * can be checked for them at once
+ */
+#define SIMPLE_TX_MAP(m) \
+    (((m)[0] | (m)[1] | (m)[2] | ((m)[3] & ~0x60000000) \
+      | (m)[4] | (m)[5] | (m)[6] | (m)[7]) == 0)
+
+/*
+ * Find the first byte from dp up to end that xaccm says must be
+ * escaped, or end if there are none.  With a simple map, whole words
+ * without 0x7d or 0x7e are passed over.
+ */
+static uchar_t *
+ahdlc_tx_scan(dp, end, xaccm, simple)
+    uchar_t	*dp, *end;
+    u_int32_t	*xaccm;
+    int		simple;
+{
+    unsigned long w;
+    int		i;
+
+    if (simple) {
+	for (; dp < end && ((uintpointer_t) dp & (sizeof(w) - 1)) != 0; dp++)
+	    if (IN_TX_MAP(*dp, xaccm))
+		return dp;
+	for (; end - dp >= sizeof(w); dp += sizeof(w)) {
+	    w = *(unsigned long *) dp;
+	    if (HAS_BYTE_W(w, PPP_ESCAPE) || HAS_BYTE_W(w, PPP_FLAG)) {
+		for (i = 0; i < sizeof(w); i++)
+		    if (IN_TX_MAP(dp[i], xaccm))
+			return dp + i;
+	    }
+	}
+    }
+    for (; dp < end; dp++)
+	if (IN_TX_MAP(*dp, xaccm))
+	    return dp;
+    return end;
+}
+
 static void
 ahdlc_encode(q, mp)
     queue_t	*q;
@@ -579,8 +685,8 @@ ahdlc_encode(q, mp)
     ushort_t		fcs;
     size_t		outmp_len;
     mblk_t		*outmp, *tmp;
-    uchar_t		*dp, fcs_val;
-    int			is_lcp, code;
+    uchar_t		*dp, *end, *ep, fcs_val;
+    int			is_lcp, code, simple;
 #if defined(SOL2)
     clock_t		lbolt;
 #endif /* SOL2 */
@@ -595,12 +701,48 @@ ahdlc_encode(q, mp)
 #endif /* USE_MUTEX */
 
     /*
-     * Allocate an output buffer large enough to handle a case where all
-     * characters need to be escaped
+     * All control characters must be escaped for LCP packets with code
+     * values between 1 (Conf-Req) and 7 (Code-Rej).
+     */
+    is_lcp = ((MSG_BYTE(mp, 0) == PPP_ALLSTATIONS) && 
+	      (MSG_BYTE(mp, 1) == PPP_UI) && 
+	      (MSG_BYTE(mp, 2) == (PPP_LCP >> 8)) &&
+	      (MSG_BYTE(mp, 3) == (PPP_LCP & 0xff)) &&
+	      LCP_USE_DFLT(mp));
+
+    xaccm = state->xaccm;
+    if (is_lcp) {
+	bcopy((caddr_t)state->xaccm, (caddr_t)loc_xaccm, sizeof(loc_xaccm));
+	loc_xaccm[0] = ~0;	/* force escape on 0x00 through 0x1f */
+	xaccm = loc_xaccm;
+    }
+
+    simple = SIMPLE_TX_MAP(xaccm);
+
+    /*
+     * Work out the FCS, and how many bytes there will be once escaped
+     */
+    fcs = PPP_INITFCS;		/* Initial FCS is 0xffff */
+    outmp_len = 0;
+    for (tmp = mp; tmp; tmp = tmp->b_cont) {
+	if (tmp->b_datap->db_type != M_DATA)
+	    continue;	/* skip if db_type is something other than M_DATA */
+	dp = tmp->b_rptr;
+	end = tmp->b_wptr;
+	fcs = ahdlc_fcs(fcs, dp, end - dp);
+	outmp_len += end - dp;
+	while ((dp = ahdlc_tx_scan(dp, end, xaccm, simple)) < end) {
+	    outmp_len++;
+	    dp++;
+	}
+    }
+
+    /*
+     * Allocate an output buffer just large enough for the frame once
+     * escaped
      */
-    outmp_len = (msgdsize(mp)	 << 1) +		/* input block x 2 */
-		(sizeof(fcs)	 << 2) +		/* HDLC FCS x 4 */
-		(sizeof(uchar_t) << 1);			/* HDLC flags x 2 */
+    outmp_len += (sizeof(fcs)	 << 2) +		/* HDLC FCS x 4 */
+		 (sizeof(uchar_t) << 1);		/* HDLC flags x 2 */
 
     outmp = allocb(outmp_len, BPRI_MED);
     if (outmp == NULL) {
@@ -636,40 +778,22 @@ ahdlc_encode(q, mp)
 #endif
 
     /*
-     * All control characters must be escaped for LCP packets with code
-     * values between 1 (Conf-Req) and 7 (Code-Rej).
-     */
-    is_lcp = ((MSG_BYTE(mp, 0) == PPP_ALLSTATIONS) && 
-	      (MSG_BYTE(mp, 1) == PPP_UI) && 
-	      (MSG_BYTE(mp, 2) == (PPP_LCP >> 8)) &&
-	      (MSG_BYTE(mp, 3) == (PPP_LCP & 0xff)) &&
-	      LCP_USE_DFLT(mp));
-
-    xaccm = state->xaccm;
-    if (is_lcp) {
-	bcopy((caddr_t)state->xaccm, (caddr_t)loc_xaccm, sizeof(loc_xaccm));
-	loc_xaccm[0] = ~0;	/* force escape on 0x00 through 0x1f */
-	xaccm = loc_xaccm;
-    }
-
-    fcs = PPP_INITFCS;		/* Initial FCS is 0xffff */
-
-    /*
-     * Process this block and the rest (if any) attached to the this one
+     * Copy this block and the rest (if any) attached to the this one,
+     * a run at a time between the bytes that need escaping
      */
     for (tmp = mp; tmp; tmp = tmp->b_cont) {
-	if (tmp->b_datap->db_type == M_DATA) {
-	    for (dp = tmp->b_rptr; dp < tmp->b_wptr; dp++) {
-		fcs = PPP_FCS(fcs, *dp);
-		if (IN_TX_MAP(*dp, xaccm)) {
-		    *outmp->b_wptr++ = PPP_ESCAPE;
-		    *outmp->b_wptr++ = *dp ^ PPP_TRANS;
-		} else {
-		    *outmp->b_wptr++ = *dp;
-		}
-	    }
-	} else {
+	if (tmp->b_datap->db_type != M_DATA)
 	    continue;	/* skip if db_type is something other than M_DATA */
+	for (dp = tmp->b_rptr, end = tmp->b_wptr; dp < end; dp = ep + 1) {
+	    ep = ahdlc_tx_scan(dp, end, xaccm, simple);
+	    if (ep > dp) {
+		bcopy((caddr_t) dp, (caddr_t) outmp->b_wptr, ep - dp);
+		outmp->b_wptr += ep - dp;
+	    }
+	    if (ep == end)
+		break;
+	    *outmp->b_wptr++ = PPP_ESCAPE;
+	    *outmp->b_wptr++ = *ep ^ PPP_TRANS;
 	}
     }
 
@@ -715,6 +839,35 @@ ahdlc_encode(q, mp)
 #define IN_RX_MAP(c, m)	((((unsigned int) (uchar_t) (c)) < 0x20) && \
 			(m) & (1 << (c)))
 
+/*
+ * Find the first byte from dp up to end that is a flag, an escape or
+ * in raccm, or end if there are none.  With an empty raccm, as on most
+ * links once it has been negotiated, whole words without 0x7d or 0x7e
+ * are passed over.
+ */
+static uchar_t *
+ahdlc_rx_scan(dp, end, raccm)
+    uchar_t	*dp, *end;
+    u_int32_t	raccm;
+{
+    unsigned long w;
+
+    if (raccm == 0) {
+	for (; dp < end && ((uintpointer_t) dp & (sizeof(w) - 1)) != 0; dp++)
+	    if (*dp == PPP_FLAG || *dp == PPP_ESCAPE)
+		return dp;
+	for (; end - dp >= sizeof(w); dp += sizeof(w)) {
+	    w = *(unsigned long *) dp;
+	    if (HAS_BYTE_W(w, PPP_ESCAPE) || HAS_BYTE_W(w, PPP_FLAG))
+		break;
+	}
+    }
+    for (; dp < end; dp++)
+	if (*dp == PPP_FLAG || *dp == PPP_ESCAPE || IN_RX_MAP(*dp, raccm))
+	    return dp;
+    return end;
+}
+
 
 /*
  * Process received characters.
@@ -726,7 +879,8 @@ ahdlc_decode(q, mp)
 {
     ahdlc_state_t   *state;
     mblk_t	    *om;
-    uchar_t	    *dp;
+    uchar_t	    *dp, *ep;
+    int		    n;
 
     state = (ahdlc_state_t *) q->q_ptr;
 
@@ -739,6 +893,28 @@ ahdlc_decode(q, mp)
     for (; mp != 0; om = mp->b_cont, freeb(mp), mp = om)
     for (dp = mp->b_rptr; dp < mp->b_wptr; dp++) {
 
+	/*
+	 * In the middle of a frame, once every kind of byte the
+	 * checks below look for has been seen, copy the run up to the
+	 * next flag, escape or mapped character in one go, as far as
+	 * the buffer has room.  What stops the run is handled below.
+	 */
+	if ((state->flags & (RCV_FLAGS | IFLUSH | ESCAPED)) == RCV_FLAGS
+	    && state->rx_buf != 0) {
+	    ep = ahdlc_rx_scan(dp, mp->b_wptr, state->raccm);
+	    n = state->rx_buf_size - msgdsize(state->rx_buf);
+	    if (ep - dp < n)
+		n = ep - dp;
+	    if (n > 0) {
+		state->infcs = ahdlc_fcs(state->infcs, dp, n);
+		bcopy(dp, state->rx_buf->b_wptr, n);
+		state->rx_buf->b_wptr += n;
+		dp += n;
+		if (dp == mp->b_wptr)
+		    break;
+	    }
+	}
+
 	/*
 	 * This should detect the lack of 8-bit communication channel
 	 * which is necessary for PPP to work. In addition, it also
@@ -803,12 +979,15 @@ ahdlc_decode(q, mp)
 	 * Allocate a receive buffer, large enough to store a frame (after
 	 * un-escaping) of at least 1500 octets. If MRU is negotiated to
 	 * be more than the default, then allocate that much. In addition,
-	 * we add an extra 32-bytes for a fudge factor
-	 */ 
+	 * we add an extra 32-bytes for a fudge factor, and leave room
+	 * in front for ppp_comp to put back an address, control and
+	 * protocol field the peer left out, rather than having to
+	 * chain on another mblk for them.
+	 */
 	if (state->rx_buf == 0) {
 	    state->rx_buf_size  = (state->mru < PPP_MRU ? PPP_MRU : state->mru);
 	    state->rx_buf_size += (sizeof(u_int32_t) << 3);
-	    state->rx_buf = allocb(state->rx_buf_size, BPRI_MED);
+	    state->rx_buf = allocb(state->rx_buf_size + RX_HEADROOM, BPRI_MED);
 
 	    /*
 	     * If allocation fails, try again on the next frame
@@ -817,6 +996,8 @@ ahdlc_decode(q, mp)
 		state->flags |= IFLUSH;
 		continue;
 	    }
+	    state->rx_buf->b_rptr += RX_HEADROOM;
+	    state->rx_buf->b_wptr = state->rx_buf->b_rptr;
 	    state->flags &= ~(IFLUSH | ESCAPED);
 	    state->infcs  = PPP_INITFCS;
 	}
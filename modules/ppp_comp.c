@@ -391,7 +391,7 @@ ppp_comp_wput(q, mp)
 	    nrslots = mp->b_cont->b_rptr[1] + 1;
 	    if (nxslots > MAX_STATES || nrslots > MAX_STATES)
 		break;
-	    vj_compress_init(&cp->vj_comp, nxslots);
+	    vj_compress_init(&cp->vj_comp, nxslots - 1);
 	    cp->vj_last_ierrors = cp->stats.ppp_ierrors;
 	    error = 0;
 	    iop->ioc_count = 0;
@@ -848,7 +848,8 @@ ppp_comp_rsrv(q)
 	     * We need to put some bytes on the front of the packet
 	     * to make a full-length PPP header.
 	     * If we can put them in *mp, we do, otherwise we
-	     * tack another mblk on the front.
+	     * tack another mblk on the front.  ppp_ahdlc leaves
+	     * room for them in front of each frame it receives.
 	     * XXX we really shouldn't need to carry around
 	     * the address and control at this stage.
 	     */
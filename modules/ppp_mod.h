@@ -67,6 +67,18 @@
 #define NOTSUSER()		(suser()? 0: EPERM)
 #endif /* AIX */
 
+#ifdef PPP_USERSPACE		/* built into a program, see compbench.c */
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#define ALLOC_SLEEP(n)		malloc((n))
+#define ALLOC_NOSLEEP(n)	malloc((n))
+#define FREE(p, n)		free((p))
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BSD_LITTLE_ENDIAN
+#endif
+#endif /* PPP_USERSPACE */
+
 /*
  * Macros for printing debugging stuff.
  */
@@ -0,0 +1,33 @@
+/*
+ * Just enough of the STREAMS message interface for the compressors
+ * in modules/ to be built into an ordinary program (see compbench.c).
+ * A message is a chain of blocks linked through b_cont; the bytes of
+ * each block run from b_rptr to b_wptr, with room up to db_lim.
+ */
+#ifndef PPP_SHIM_SYS_STREAM_H
+#define PPP_SHIM_SYS_STREAM_H
+
+typedef struct datab {
+    unsigned char	*db_base;
+    unsigned char	*db_lim;
+} dblk_t;
+
+typedef struct msgb {
+    struct msgb		*b_cont;
+    unsigned char	*b_rptr;
+    unsigned char	*b_wptr;
+    struct datab	*b_datap;
+    struct datab	b_data;
+} mblk_t;
+
+#define BPRI_LO		1
+#define BPRI_MED	2
+#define BPRI_HI		3
+
+mblk_t	*allocb(int size, unsigned int pri);
+void	freeb(mblk_t *bp);
+void	freemsg(mblk_t *mp);
+int	pullupmsg(mblk_t *mp, int len);
+int	msgdsize(mblk_t *mp);
+
+#endif /* PPP_SHIM_SYS_STREAM_H */
@@ -56,6 +56,10 @@ typedef u_long  n_long;
 #include <netinet/in_systm.h>
 #endif
 
+#ifdef PPP_USERSPACE
+#include <strings.h>
+#endif
+
 #ifdef SOL2
 #include <sys/sunddi.h>
 #endif
@@ -88,6 +92,14 @@ typedef u_long  n_long;
 #define getth_off(base)	((base).th_off)
 #endif
 
+/*
+ * Hash a connection's addresses and ports, the first word of its TCP
+ * header, to pick its chain.
+ */
+#define VJ_HASH(src, dst, ports) \
+    (((u_int32_t)((src) ^ (dst) ^ (ports)) * 0x9e3779b1U) \
+     >> (32 - VJ_HASH_BITS))
+
 void
 vj_compress_init(comp, max_state)
     struct vjcompress *comp;
@@ -102,8 +114,10 @@ vj_compress_init(comp, max_state)
     for (i = max_state; i > 0; --i) {
 	tstate[i].cs_id = i;
 	tstate[i].cs_next = &tstate[i - 1];
+	tstate[i - 1].cs_prev = &tstate[i];
     }
     tstate[0].cs_next = &tstate[max_state];
+    tstate[max_state].cs_prev = &tstate[0];
     tstate[0].cs_id = 0;
     comp->last_cs = &tstate[0];
     comp->last_recv = 255;
@@ -209,28 +223,29 @@ vj_compress_tcp(ip, mlen, comp, compress_cid, vjhdrp)
 	ip->ip_dst.s_addr != cs->cs_ip.ip_dst.s_addr ||
 	*(int *)th != ((int *)&cs->cs_ip)[getip_hl(cs->cs_ip)]) {
 	/*
-	 * Wasn't the first -- search for it.
+	 * Wasn't the first -- look for it on its hash chain.
 	 *
-	 * States are kept in a circularly linked list with
-	 * last_cs pointing to the end of the list.  The
-	 * list is kept in lru order by moving a state to the
-	 * head of the list whenever it is referenced.  Since
-	 * the list is short and, empirically, the connection
-	 * we want is almost always near the front, we locate
-	 * states via linear search.  If we don't find a state
-	 * for the datagram, the oldest state is (re-)used.
+	 * States are kept in a circular, doubly linked list with
+	 * last_cs pointing to the end of the list.  The list is
+	 * kept in lru order by moving a state to the head of the
+	 * list whenever it is referenced.  States that have been
+	 * used are also on a hash chain for their addresses and
+	 * ports, so a busy link with many conversations doesn't
+	 * have to search the whole list for each packet.  If we
+	 * don't find a state for the datagram, the oldest state
+	 * is (re-)used.
 	 */
-	register struct cstate *lcs;
 	register struct cstate *lastcs = comp->last_cs;
+	register struct cstate **csp;
+	u_int h = VJ_HASH(ip->ip_src.s_addr, ip->ip_dst.s_addr, *(int *)th);
 
-	do {
-	    lcs = cs; cs = cs->cs_next;
+	for (cs = comp->hash[h]; cs != 0; cs = cs->cs_hnext) {
 	    INCR(vjs_searches);
 	    if (ip->ip_src.s_addr == cs->cs_ip.ip_src.s_addr
 		&& ip->ip_dst.s_addr == cs->cs_ip.ip_dst.s_addr
 		&& *(int *)th == ((int *)&cs->cs_ip)[getip_hl(cs->cs_ip)])
 		goto found;
-	} while (cs != lastcs);
+	}
 
 	/*
 	 * Didn't find it -- re-use oldest cstate.  Send an
@@ -241,11 +256,20 @@ vj_compress_tcp(ip, mlen, comp, compress_cid, vjhdrp)
 	 * last_cs to update the lru linkage.
 	 */
 	INCR(vjs_misses);
-	comp->last_cs = lcs;
+	cs = lastcs;
+	comp->last_cs = cs->cs_prev;
 	hlen += getth_off(*th);
 	hlen <<= 2;
 	if (hlen > mlen)
 	    return (TYPE_IP);
+	for (csp = &comp->hash[cs->cs_hash]; *csp != 0; csp = &(*csp)->cs_hnext)
+	    if (*csp == cs) {
+		*csp = cs->cs_hnext;
+		break;
+	    }
+	cs->cs_hash = h;
+	cs->cs_hnext = comp->hash[h];
+	comp->hash[h] = cs;
 	goto uncompressed;
 
     found:
@@ -253,10 +277,13 @@ vj_compress_tcp(ip, mlen, comp, compress_cid, vjhdrp)
 	 * Found it -- move to the front on the connection list.
 	 */
 	if (cs == lastcs)
-	    comp->last_cs = lcs;
+	    comp->last_cs = cs->cs_prev;
 	else {
-	    lcs->cs_next = cs->cs_next;
+	    cs->cs_prev->cs_next = cs->cs_next;
+	    cs->cs_next->cs_prev = cs->cs_prev;
 	    cs->cs_next = lastcs->cs_next;
+	    cs->cs_prev = lastcs;
+	    lastcs->cs_next->cs_prev = cs;
 	    lastcs->cs_next = cs;
 	}
     }
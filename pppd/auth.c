@@ -82,6 +82,7 @@
 #include <pwd.h>
 #include <grp.h>
 #include <string.h>
+#include <inttypes.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -132,13 +133,22 @@
 #include "multilink.h"
 #include "pathnames.h"
 #include "session.h"
+#include "secrets.h"
 
 
-/* Bits in scan_authfile return value */
-#define NONWILD_SERVER	1
-#define NONWILD_CLIENT	2
-
-#define ISWILD(word)	(word[0] == '*' && word[1] == 0)
+/* The secrets files, as we last read them. */
+static struct secrets_table pap_secrets =
+    SECRETS_INIT(PPP_PATH_UPAPFILE, SECRETS_PAP, 3);
+static struct secrets_table chap_secrets =
+    SECRETS_INIT(PPP_PATH_CHAPFILE, SECRETS_CHAP, 3);
+static struct secrets_table srp_secrets =
+    SECRETS_INIT(PPP_PATH_SRPFILE, SECRETS_SRP, 3);
+#ifdef PPP_WITH_EAPTLS
+static struct secrets_table eaptls_server_secrets =
+    SECRETS_INIT(PPP_PATH_EAPTLSSERVFILE, SECRETS_EAPTLS_SERVER, 6);
+static struct secrets_table eaptls_client_secrets =
+    SECRETS_INIT(PPP_PATH_EAPTLSCLIFILE, SECRETS_EAPTLS_CLIENT, 6);
+#endif
 
 /* The name by which the peer authenticated itself to us. */
 char peer_authname[MAXNAMELEN];
@@ -152,6 +162,18 @@ int auth_done[NUM_PPP];
 /* List of addresses which the peer may use. */
 static struct permitted_ip *addresses[NUM_PPP];
 
+/*
+ * The same list as a binary trie on the address bits, so that the
+ * first entry matching an address can be found without trying each
+ * one.  Each node records the first entry in the list whose base and
+ * mask are the node's prefix; node 0 is the root.
+ */
+struct ip_trie_node {
+    int		child[2];	/* 0 if none */
+    int		entry;		/* index in the list, or -1 */
+};
+static struct ip_trie_node *address_trie[NUM_PPP];
+
 /* Wordlist giving addresses which the peer may use
    without authenticating itself. */
 static struct wordlist *noauth_addrs;
@@ -186,6 +208,9 @@ pap_check_hook_fn *pap_check_hook = NULL;
 /* Hook for a plugin to check the PAP user and password */
 pap_auth_hook_fn *pap_auth_hook = NULL;
 
+/* Set by a plugin whose pap_auth_hook may be run on the offload thread */
+bool pap_auth_hook_offload = 0;
+
 /* Hook for a plugin to know about the PAP user logout */
 pap_logout_hook_fn *pap_logout_hook = NULL;
 
@@ -235,6 +260,8 @@ static pid_t auth_script_pid = 0;
  */
 bool uselogin = 0;		/* Use /etc/passwd for checking PAP */
 bool session_mgmt = 0;		/* Do session management (login records) */
+bool session_wtmp = 1;		/* Record sessions in utmp and wtmp */
+bool session_defer = 0;		/* Open the PAM session after IPCP is up */
 bool cryptpap = 0;		/* Passwords in pap-secrets are encrypted */
 bool refuse_pap = 0;		/* Don't wanna auth. ourselves with PAP */
 bool refuse_chap = 0;		/* Don't wanna auth. ourselves with CHAP */
@@ -269,15 +296,31 @@ char *cert_file    = NULL;  /* Client certificate file (pem format) */
 char *privkey_file = NULL;  /* Client private key file (pem format) */
 char *pkcs12_file  = NULL;  /* Client private key envelope file (pkcs12 format) */
 bool need_peer_eap = 0;	    /* Require peer to authenticate us */
+char *tls_ticket_secret = NULL; /* Secret that session tickets are sealed with */
+bool tls_session_cache = 0; /* Keep sessions in a tdb shared by all pppds */
+int tls_session_lifetime = 3600; /* Seconds a session can be resumed for */
 #endif
 
 static char *uafname;		/* name of most recent +ua file */
 
+/*
+ * When each of the session limits (idle time, connect time and
+ * traffic) next needs looking at, in seconds of ppp_get_time, or 0 if
+ * it isn't in force.  One callout serves them all.
+ */
+static time_t idle_due, connect_due, octets_due;
+static time_t limits_start;	/* when the network came up */
+static uint64_t octets_last;	/* octets used at the last check */
+static time_t octets_last_time;
+
+/* longest we wait between traffic checks, however slow the link */
+#define MAXOCTETS_MAX_WAIT	30
+
 /* Prototypes for procedures local to this file. */
 
 static void network_phase (int);
-static void check_idle (void *);
-static void connect_time_expired (void *);
+static void check_limits (void *);
+static void schedule_limits (time_t);
 static int  null_login (int);
 static int  get_pap_passwd (char *);
 static int  have_pap_secret (int *);
@@ -289,18 +332,19 @@ static int  have_srp_secret(char *client, char *server, int need_ip,
 static int  have_eaptls_secret_server
 (char *client, char *server, int need_ip, int *lacks_ipp);
 static int  have_eaptls_secret_client (char *client, char *server);
-static int  scan_authfile_eaptls(FILE * f, char *client, char *server,
+static int  scan_authfile_eaptls(struct secrets_table *t,
+			       char *client, char *server,
 			       char *cli_cert, char *serv_cert,
 			       char *ca_cert, char *pk,
 			       struct wordlist ** addrs,
-			       struct wordlist ** opts,
-			       char *filename, int flags);
+			       struct wordlist ** opts, int flags);
 #endif
 
-static int  ip_addr_check (u_int32_t, struct permitted_ip *);
-static int  scan_authfile(FILE *, char *, char *, char *,
-			  struct wordlist **, struct wordlist **,
-			  char *, int);
+static struct ip_trie_node *ip_trie_build (struct permitted_ip *, int);
+static int  ip_addr_check (u_int32_t, struct permitted_ip *,
+			   struct ip_trie_node *);
+static int  scan_authfile(struct secrets_table *, char *, char *, char *,
+			  struct wordlist **, struct wordlist **, int);
 static void free_wordlist (struct wordlist *);
 static void auth_script (char *);
 static void auth_script_done (void *);
@@ -310,9 +354,7 @@ static int  setupapfile (char **);
 static int  privgroup (char **);
 static int  set_noauth_addr (char **);
 static int  set_permitted_number (char **);
-static void check_access (FILE *, char *);
 static int  wordlist_count (struct wordlist *);
-static void check_maxoctets (void *);
 
 /*
  * Authentication-related options.
@@ -422,6 +464,10 @@ struct option auth_options[] = {
       &session_mgmt },
     { "enable-session", o_bool, &session_mgmt,
       "Enable session accounting for remote peers", OPT_PRIV | 1 },
+    { "nowtmp", o_bool, &session_wtmp,
+      "Don't record sessions in utmp and wtmp", OPT_PRIV | 0 },
+    { "defer-session", o_bool, &session_defer,
+      "Open the PAM session once the network is up", OPT_PRIV | 1 },
 
     { "papcrypt", o_bool, &cryptpap,
       "PAP passwords are encrypted", 1 },
@@ -460,6 +506,15 @@ struct option auth_options[] = {
     { "pkcs12", o_string, &pkcs12_file, "EAP-TLS client credentials in PKCS12 format" },
     { "need-peer-eap", o_bool, &need_peer_eap,
       "Require the peer to authenticate us", 1 },
+    { "tls-ticket-secret", o_string, &tls_ticket_secret,
+      "Give EAP-TLS peers session tickets sealed with this secret", OPT_PRIV },
+#ifdef PPP_WITH_TDB
+    { "tls-session-cache", o_bool, &tls_session_cache,
+      "Share EAP-TLS sessions between pppds to be resumed", OPT_PRIV | 1 },
+#endif
+    { "tls-session-lifetime", o_int, &tls_session_lifetime,
+      "Seconds an EAP-TLS session can be resumed for",
+      OPT_PRIV | OPT_LLIMIT, NULL, 0, 1 },
 #endif /* PPP_WITH_EAPTLS */
     { NULL }
 };
@@ -897,6 +952,7 @@ link_established(int unit)
     }
     auth_pending[unit] = auth;
     auth_done[unit] = 0;
+    PPP_PROBE2(pppd, auth_start, unit, auth);
 
     if (!auth)
 	network_phase(unit);
@@ -1016,6 +1072,7 @@ continue_networks(int unit)
 void
 auth_peer_fail(int unit, int protocol)
 {
+    PPP_PROBE4(pppd, auth_done, unit, protocol, 1, 0);
     /*
      * Authentication failure: take the link down
      */
@@ -1059,6 +1116,7 @@ auth_peer_success(int unit, int protocol, int prot_flavor,
 	warn("auth_peer_success: unknown protocol %x", protocol);
 	return;
     }
+    PPP_PROBE4(pppd, auth_done, unit, protocol, 1, 1);
 
     /*
      * Save the authenticated name of the peer for later.
@@ -1086,6 +1144,7 @@ auth_peer_success(int unit, int protocol, int prot_flavor,
 void
 auth_withpeer_fail(int unit, int protocol)
 {
+    PPP_PROBE4(pppd, auth_done, unit, protocol, 0, 0);
     if (passwd_from_file)
 	BZERO(passwd, MAXSECRETLEN);
     /*
@@ -1140,6 +1199,7 @@ auth_withpeer_success(int unit, int protocol, int prot_flavor)
 	bit = 0;
     }
 
+    PPP_PROBE4(pppd, auth_done, unit, protocol, 0, 1);
     notice("%s authentication succeeded", prot);
 
     /* Save the authentication method for later. */
@@ -1161,6 +1221,7 @@ void
 np_up(int unit, int proto)
 {
     int tlim;
+    struct timeval now;
 
     if (num_np_up == 0) {
 	/*
@@ -1170,26 +1231,23 @@ np_up(int unit, int proto)
 	unsuccess = 0;
 	new_phase(PHASE_RUNNING);
 
+	/*
+	 * Work out when to first check the idle time, the connect
+	 * time and the traffic limit.
+	 */
+	ppp_get_time(&now);
 	if (idle_time_hook != 0)
 	    tlim = (*idle_time_hook)(NULL);
 	else
 	    tlim = ppp_get_max_idle_time();
-	if (tlim > 0)
-	    TIMEOUT(check_idle, NULL, tlim);
-
-	/*
-	 * Set a timeout to close the connection once the maximum
-	 * connect time has expired.
-	 */
-	if (ppp_get_max_connect_time() > 0)
-	    TIMEOUT(connect_time_expired, 0, ppp_get_max_connect_time());
-
-	/*
-	 * Configure a check to see if session has outlived it's limit
-	 *   in terms of octets
-	 */
-	if (maxoctets > 0)
-	    TIMEOUT(check_maxoctets, NULL, maxoctets_timeout);
+	idle_due = tlim > 0? now.tv_sec + tlim: 0;
+	limits_start = now.tv_sec;
+	connect_due = ppp_get_max_connect_time() > 0?
+	    now.tv_sec + ppp_get_max_connect_time(): 0;
+	octets_due = maxoctets > 0? now.tv_sec + maxoctets_timeout: 0;
+	octets_last = 0;
+	octets_last_time = now.tv_sec;
+	schedule_limits(now.tv_sec);
 
 	/*
 	 * Detach now, if the updetach option was given.
@@ -1214,9 +1272,7 @@ void
 np_down(int unit, int proto)
 {
     if (--num_np_up == 0) {
-	UNTIMEOUT(check_idle, NULL);
-	UNTIMEOUT(connect_time_expired, NULL);
-	UNTIMEOUT(check_maxoctets, NULL);
+	UNTIMEOUT(check_limits, NULL);
 	new_phase(PHASE_NETWORK);
     }
 }
@@ -1234,14 +1290,55 @@ np_finished(int unit, int proto)
 }
 
 /*
- * Periodic callback to check if session has reached its limit. The period defaults
- * to 1 second and is configurable by setting "mo-timeout" in configuration
+ * schedule_limits - set the callout for the earliest limit due.
  */
 static void
-check_maxoctets(void *arg)
+schedule_limits(time_t now)
 {
-    unsigned int used;
+    time_t next = 0;
+
+    if (idle_due && (!next || idle_due < next))
+	next = idle_due;
+    if (connect_due && (!next || connect_due < next))
+	next = connect_due;
+    if (octets_due && (!next || octets_due < next))
+	next = octets_due;
+    UNTIMEOUT(check_limits, NULL);
+    if (next)
+	TIMEOUT(check_limits, NULL, next > now? next - now: 0);
+}
+
+/*
+ * auth_limits_changed - the connect time or traffic limit has been
+ * changed while the link may be up, so look at them afresh.
+ */
+void
+auth_limits_changed(void)
+{
+    struct timeval now;
+
+    if (num_np_up == 0)
+	return;
+    ppp_get_time(&now);
+    connect_due = ppp_get_max_connect_time() > 0?
+	limits_start + ppp_get_max_connect_time(): 0;
+    octets_due = maxoctets > 0? now.tv_sec: 0;
+    schedule_limits(now.tv_sec);
+}
+
+/*
+ * check_octets - see whether the session has used up its traffic
+ * limit.  If not, return how long to wait before looking again: at
+ * the rate since the last check it would take twice that to reach the
+ * limit, but we look at least every MAXOCTETS_MAX_WAIT seconds and at
+ * most every maxoctets_timeout ("mo-timeout") seconds.
+ */
+static int
+check_octets(time_t now)
+{
+    uint64_t used = 0, rate;
     ppp_link_stats_st stats;
+    int wait;
 
     if (ppp_get_link_stats(&stats)) {
         switch(maxoctets_dir) {
@@ -1264,29 +1361,41 @@ check_maxoctets(void *arg)
     }
 
     if (used > maxoctets) {
-	notice("Traffic limit reached. Limit: %u Used: %u", maxoctets, used);
+	notice("Traffic limit reached. Limit: %u Used: %" PRIu64, maxoctets, used);
 	ppp_set_status(EXIT_TRAFFIC_LIMIT);
 	lcp_close(0, "Traffic limit");
 	link_stats_print = 0;
 	need_holdoff = 0;
-    } else {
-        TIMEOUT(check_maxoctets, NULL, maxoctets_timeout);
+	return -1;
     }
+
+    wait = MAXOCTETS_MAX_WAIT;
+    if (now > octets_last_time && used > octets_last) {
+	rate = (used - octets_last) / (now - octets_last_time);
+	if (rate > 0 && (maxoctets - used) / (2 * rate) < (uint64_t) wait)
+	    wait = (maxoctets - used) / (2 * rate);
+    }
+    if (wait < maxoctets_timeout)
+	wait = maxoctets_timeout;
+    octets_last = used;
+    octets_last_time = now;
+    return wait;
 }
 
 /*
  * check_idle - check whether the link has been idle for long
- * enough that we can shut it down.
+ * enough that we can shut it down.  If not, return how long to wait
+ * before looking again.
  */
-static void
-check_idle(void *arg)
+static int
+check_idle(void)
 {
     struct ppp_idle idle;
     time_t itime;
     int tlim;
 
     if (!get_idle_time(0, &idle))
-	return;
+	return 0;
     if (idle_time_hook != 0) {
 	tlim = idle_time_hook(&idle);
     } else {
@@ -1299,20 +1408,42 @@ check_idle(void *arg)
 	ppp_set_status(EXIT_IDLE_TIMEOUT);
 	lcp_close(0, "Link inactive");
 	need_holdoff = 0;
-    } else {
-	TIMEOUT(check_idle, NULL, tlim);
+	return -1;
     }
+    return tlim;
 }
 
 /*
- * connect_time_expired - log a message and close the connection.
+ * check_limits - look at whichever session limits are due, and close
+ * the link if one has been reached.  Only the limits that are due
+ * read the kernel's counters.
  */
 static void
-connect_time_expired(void *arg)
+check_limits(void *arg)
 {
-    info("Connect time expired");
-    ppp_set_status(EXIT_CONNECT_TIME);
-    lcp_close(0, "Connect time expired");	/* Close connection */
+    struct timeval now;
+    int wait;
+
+    ppp_get_time(&now);
+    if (connect_due && now.tv_sec >= connect_due) {
+	info("Connect time expired");
+	ppp_set_status(EXIT_CONNECT_TIME);
+	lcp_close(0, "Connect time expired");	/* Close connection */
+	return;
+    }
+    if (idle_due && now.tv_sec >= idle_due) {
+	wait = check_idle();
+	if (wait < 0)
+	    return;
+	idle_due = wait > 0? now.tv_sec + wait: 0;
+    }
+    if (octets_due && now.tv_sec >= octets_due) {
+	wait = check_octets(now.tv_sec);
+	if (wait < 0)
+	    return;
+	octets_due = now.tv_sec + wait;
+    }
+    schedule_limits(now.tv_sec);
 }
 
 /*
@@ -1471,134 +1602,228 @@ auth_reset(int unit)
 
 
 /*
- * check_passwd - Check the user name and passwd against the PAP secrets
- * file.  If requested, also check against the system password database,
- * and login the user if OK.
- *
- * returns:
- *	UPAP_AUTHNAK: Authentication failed.
- *	UPAP_AUTHACK: Authentication succeeded.
- * In either case, msg points to an appropriate message.
+ * A PAP check in progress.  The plugin hook, the session calls and
+ * crypt can all take a while, so they are run on the offload thread;
+ * looking up the secret and acting on the result happen in the main
+ * loop.
  */
-int
-check_passwd(int unit,
-	     char *auser, int userlen,
-	     char *apasswd, int passwdlen, char **msg)
-{
+struct passwd_check {
+    int unit;
     int ret;
-    char *filename;
-    FILE *f;
-    struct wordlist *addrs = NULL, *opts = NULL;
-    char passwd[256], user[256];
+    char *msg;
+    int login_secret;		/* secret is @login */
+    struct wordlist *addrs;
+    struct wordlist *opts;
+    check_passwd_cb *done;
+    void *arg;
+    char user[256];
+    char passwd[256];
     char secret[MAXWORDLEN];
-    static int attempts = 0;
+};
 
-    /*
-     * Make copies of apasswd and auser, then null-terminate them.
-     * If there are unprintable characters in the password, make
-     * them visible.
-     */
-    slprintf(passwd, sizeof(passwd), "%.*v", passwdlen, apasswd);
-    slprintf(user, sizeof(user), "%.*v", userlen, auser);
-    *msg = "";
+static int passwd_attempts = 0;
 
-    /*
-     * Check if a plugin wants to handle this.
-     */
-    if (pap_auth_hook) {
-	ret = (*pap_auth_hook)(user, passwd, msg, &addrs, &opts);
-	if (ret >= 0) {
-	    /* note: set_allowed_addrs() saves opts (but not addrs):
-	       don't free it! */
-	    if (ret)
-		set_allowed_addrs(unit, addrs, opts);
-	    else if (opts != 0)
-		free_wordlist(opts);
-	    if (addrs != 0)
-		free_wordlist(addrs);
-	    BZERO(passwd, sizeof(passwd));
-	    return ret? UPAP_AUTHACK: UPAP_AUTHNAK;
-	}
+static void passwd_check_secrets(struct passwd_check *);
+static void passwd_check_reply(void *);
+
+/*
+ * passwd_hook_work - ask the plugin, on the offload thread.
+ */
+static int
+passwd_hook_work(void *arg)
+{
+    struct passwd_check *pc = arg;
+
+    return (*pap_auth_hook)(pc->user, pc->passwd, &pc->msg,
+			    &pc->addrs, &pc->opts);
+}
+
+static void
+passwd_hook_done(void *arg, int ret)
+{
+    struct passwd_check *pc = arg;
+
+    if (ret < 0) {
+	/* the plugin left it to us */
+	passwd_check_secrets(pc);
+	return;
     }
+    prof_end(PROF_AUTH);
+    /* note: set_allowed_addrs() saves opts (but not addrs):
+       don't free it! */
+    if (ret)
+	set_allowed_addrs(pc->unit, pc->addrs, pc->opts);
+    else if (pc->opts != 0)
+	free_wordlist(pc->opts);
+    pc->opts = NULL;
+    pc->ret = ret? UPAP_AUTHACK: UPAP_AUTHNAK;
+    passwd_check_reply(pc);
+}
 
-    /*
-     * Open the file of pap secrets and scan for a suitable secret
-     * for authenticating this user.
-     */
-    filename = PPP_PATH_UPAPFILE;
-    addrs = opts = NULL;
-    ret = UPAP_AUTHNAK;
-    f = fopen(filename, "r");
-    if (f == NULL) {
-	error("Can't open PAP password file %s: %m", filename);
+/*
+ * passwd_verify_work - check the password against the secret, or the
+ * login database, on the offload thread.
+ */
+static int
+passwd_verify_work(void *arg)
+{
+    struct passwd_check *pc = arg;
+    int ret = UPAP_AUTHACK;
 
-    } else {
-	check_access(f, filename);
-	if (scan_authfile(f, user, our_name, secret, &addrs, &opts, filename, 0) < 0) {
-	    warn("no PAP secret found for %s", user);
-	} else {
-	    /*
-	     * If the secret is "@login", it means to check
-	     * the password against the login database.
-	     */
-	    int login_secret = strcmp(secret, "@login") == 0;
-	    ret = UPAP_AUTHACK;
-	    if (uselogin || login_secret) {
-		/* login option or secret is @login */
-		if (session_full(user, passwd, devnam, msg) == 0) {
-		    ret = UPAP_AUTHNAK;
-		}
-	    } else if (session_mgmt) {
-		if (session_check(user, NULL, devnam, NULL) == 0) {
-		    warn("Peer %q failed PAP Session verification", user);
-		    ret = UPAP_AUTHNAK;
-		}
-	    }
-	    if (secret[0] != 0 && !login_secret) {
-		/* password given in pap-secrets - must match */
-		if (cryptpap || strcmp(passwd, secret) != 0) {
+    if (uselogin || pc->login_secret) {
+	/* login option or secret is @login */
+	if (session_full(pc->user, pc->passwd, devnam, &pc->msg) == 0) {
+	    ret = UPAP_AUTHNAK;
+	}
+    } else if (session_mgmt) {
+	if (session_check(pc->user, NULL, devnam, NULL) == 0) {
+	    warn("Peer %q failed PAP Session verification", pc->user);
+	    ret = UPAP_AUTHNAK;
+	}
+    }
+    if (pc->secret[0] != 0 && !pc->login_secret) {
+	/* password given in pap-secrets - must match */
+	if (cryptpap || strcmp(pc->passwd, pc->secret) != 0) {
 #ifdef HAVE_CRYPT_H
-		    char *cbuf = crypt(passwd, secret);
-		    if (!cbuf || strcmp(cbuf, secret) != 0)
+	    char *cbuf = crypt(pc->passwd, pc->secret);
+	    if (!cbuf || strcmp(cbuf, pc->secret) != 0)
 #endif
-			ret = UPAP_AUTHNAK;
-		}
-	    }
+		ret = UPAP_AUTHNAK;
 	}
-	fclose(f);
     }
+    return ret;
+}
+
+static void
+passwd_verify_done(void *arg, int ret)
+{
+    struct passwd_check *pc = arg;
 
+    prof_end(PROF_AUTH);
+    pc->ret = ret;
     if (ret == UPAP_AUTHNAK) {
-        if (**msg == 0)
-	    *msg = "Login incorrect";
+	if (*pc->msg == 0)
+	    pc->msg = "Login incorrect";
 	/*
-	 * XXX can we ever get here more than once??
 	 * Frustrate passwd stealer programs.
 	 * Allow 10 tries, but start backing off after 3 (stolen from login).
 	 * On 10'th, drop the connection.
 	 */
-	if (attempts++ >= 10) {
-	    warn("%d LOGIN FAILURES ON %s, %s", attempts, devnam, user);
-	    lcp_close(unit, "login failed");
+	if (passwd_attempts++ >= 10) {
+	    warn("%d LOGIN FAILURES ON %s, %s", passwd_attempts, devnam,
+		 pc->user);
+	    lcp_close(pc->unit, "login failed");
+	}
+	if (passwd_attempts > 3) {
+	    /* hold back the answer, rather than the whole of pppd */
+	    TIMEOUT(passwd_check_reply, pc, (passwd_attempts - 3) * 5);
+	    return;
 	}
-	if (attempts > 3)
-	    sleep((u_int) (attempts - 3) * 5);
-	if (opts != NULL)
-	    free_wordlist(opts);
 
     } else {
-	attempts = 0;			/* Reset count */
-	if (**msg == 0)
-	    *msg = "Login ok";
-	set_allowed_addrs(unit, addrs, opts);
+	passwd_attempts = 0;		/* Reset count */
+	if (*pc->msg == 0)
+	    pc->msg = "Login ok";
+	set_allowed_addrs(pc->unit, pc->addrs, pc->opts);
+	pc->opts = NULL;
     }
+    passwd_check_reply(pc);
+}
 
-    if (addrs != NULL)
-	free_wordlist(addrs);
-    BZERO(passwd, sizeof(passwd));
-    BZERO(secret, sizeof(secret));
+/*
+ * passwd_check_secrets - look for a suitable secret in the PAP secrets
+ * file for authenticating this user.
+ */
+static void
+passwd_check_secrets(struct passwd_check *pc)
+{
+    char *filename;
 
-    return ret;
+    filename = PPP_PATH_UPAPFILE;
+    pc->addrs = pc->opts = NULL;
+    if (!secrets_load(&pap_secrets)) {
+	error("Can't open PAP password file %s: %m", filename);
+
+    } else if (scan_authfile(&pap_secrets, pc->user, our_name, pc->secret,
+			     &pc->addrs, &pc->opts, 0) < 0) {
+	warn("no PAP secret found for %s", pc->user);
+
+    } else {
+	/*
+	 * If the secret is "@login", it means to check
+	 * the password against the login database.
+	 */
+	pc->login_secret = strcmp(pc->secret, "@login") == 0;
+	ppp_offload(passwd_verify_work, passwd_verify_done, pc);
+	return;
+    }
+    passwd_verify_done(pc, UPAP_AUTHNAK);
+}
+
+/*
+ * passwd_check_reply - pass the result back, and clean up.
+ */
+static void
+passwd_check_reply(void *arg)
+{
+    struct passwd_check *pc = arg;
+
+    (*pc->done)(pc->arg, pc->ret, pc->msg);
+    if (pc->opts != NULL)
+	free_wordlist(pc->opts);
+    if (pc->addrs != NULL)
+	free_wordlist(pc->addrs);
+    BZERO(pc, sizeof(*pc));
+    free(pc);
+}
+
+/*
+ * check_passwd - Check the user name and passwd against the PAP secrets
+ * file.  If requested, also check against the system password database,
+ * and login the user if OK.
+ *
+ * The answer may take a while, so done(arg, ret, msg) is called with
+ * it, possibly before check_passwd returns, where ret is:
+ *	UPAP_AUTHNAK: Authentication failed.
+ *	UPAP_AUTHACK: Authentication succeeded.
+ * In either case, msg points to an appropriate message.
+ */
+void
+check_passwd(int unit,
+	     char *auser, int userlen,
+	     char *apasswd, int passwdlen, check_passwd_cb *done, void *arg)
+{
+    struct passwd_check *pc;
+
+    pc = calloc(1, sizeof(*pc));
+    if (pc == NULL)
+	novm("PAP check");
+    pc->unit = unit;
+    pc->ret = UPAP_AUTHNAK;
+    pc->msg = "";
+    pc->done = done;
+    pc->arg = arg;
+    prof_begin(PROF_AUTH);
+
+    /*
+     * Make copies of apasswd and auser, then null-terminate them.
+     * If there are unprintable characters in the password, make
+     * them visible.
+     */
+    slprintf(pc->passwd, sizeof(pc->passwd), "%.*v", passwdlen, apasswd);
+    slprintf(pc->user, sizeof(pc->user), "%.*v", userlen, auser);
+
+    /*
+     * Check if a plugin wants to handle this.
+     */
+    if (pap_auth_hook) {
+	if (pap_auth_hook_offload)
+	    ppp_offload(passwd_hook_work, passwd_hook_done, pc);
+	else
+	    passwd_hook_done(pc, passwd_hook_work(pc));
+	return;
+    }
+    passwd_check_secrets(pc);
 }
 
 /*
@@ -1609,8 +1834,6 @@ check_passwd(int unit,
 static int
 null_login(int unit)
 {
-    char *filename;
-    FILE *f;
     int i, ret;
     struct wordlist *addrs, *opts;
     char secret[MAXWORDLEN];
@@ -1626,17 +1849,13 @@ null_login(int unit)
      * Open the file of pap secrets and scan for a suitable secret.
      */
     if (ret <= 0) {
-	filename = PPP_PATH_UPAPFILE;
 	addrs = NULL;
-	f = fopen(filename, "r");
-	if (f == NULL)
+	if (!secrets_load(&pap_secrets))
 	    return 0;
-	check_access(f, filename);
 
-	i = scan_authfile(f, "", our_name, secret, &addrs, &opts, filename, 0);
+	i = scan_authfile(&pap_secrets, "", our_name, secret, &addrs, &opts, 0);
 	ret = i >= 0 && secret[0] == 0;
 	BZERO(secret, sizeof(secret));
-	fclose(f);
     }
 
     if (ret)
@@ -1659,8 +1878,6 @@ null_login(int unit)
 static int
 get_pap_passwd(char *passwd)
 {
-    char *filename;
-    FILE *f;
     int ret;
     char secret[MAXWORDLEN];
 
@@ -1673,15 +1890,11 @@ get_pap_passwd(char *passwd)
 	    return ret;
     }
 
-    filename = PPP_PATH_UPAPFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&pap_secrets))
 	return 0;
-    check_access(f, filename);
-    ret = scan_authfile(f, user,
+    ret = scan_authfile(&pap_secrets, user,
 			(remote_name[0]? remote_name: NULL),
-			secret, NULL, NULL, filename, 0);
-    fclose(f);
+			secret, NULL, NULL, 0);
     if (ret < 0)
 	return 0;
     if (passwd != NULL)
@@ -1698,9 +1911,7 @@ get_pap_passwd(char *passwd)
 static int
 have_pap_secret(int *lacks_ipp)
 {
-    FILE *f;
     int ret;
-    char *filename;
     struct wordlist *addrs;
 
     /* let the plugin decide, if there is one */
@@ -1710,14 +1921,11 @@ have_pap_secret(int *lacks_ipp)
 	    return ret;
     }
 
-    filename = PPP_PATH_UPAPFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&pap_secrets))
 	return 0;
 
-    ret = scan_authfile(f, (explicit_remote? remote_name: NULL), our_name,
-			NULL, &addrs, NULL, filename, 0);
-    fclose(f);
+    ret = scan_authfile(&pap_secrets, (explicit_remote? remote_name: NULL),
+			our_name, NULL, &addrs, NULL, 0);
     if (ret >= 0 && !some_ip_ok(addrs)) {
 	if (lacks_ipp != 0)
 	    *lacks_ipp = 1;
@@ -1740,9 +1948,7 @@ static int
 have_chap_secret(char *client, char *server,
 		 int need_ip, int *lacks_ipp)
 {
-    FILE *f;
     int ret;
-    char *filename;
     struct wordlist *addrs;
 
     if (chap_check_hook) {
@@ -1752,9 +1958,7 @@ have_chap_secret(char *client, char *server,
 	}
     }
 
-    filename = PPP_PATH_CHAPFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&chap_secrets))
 	return 0;
 
     if (client != NULL && client[0] == 0)
@@ -1762,8 +1966,7 @@ have_chap_secret(char *client, char *server,
     else if (server != NULL && server[0] == 0)
 	server = NULL;
 
-    ret = scan_authfile(f, client, server, NULL, &addrs, NULL, filename, 0);
-    fclose(f);
+    ret = scan_authfile(&chap_secrets, client, server, NULL, &addrs, NULL, 0);
     if (ret >= 0 && need_ip && !some_ip_ok(addrs)) {
 	if (lacks_ipp != 0)
 	    *lacks_ipp = 1;
@@ -1785,14 +1988,10 @@ have_chap_secret(char *client, char *server,
 static int
 have_srp_secret(char *client, char *server, int need_ip, int *lacks_ipp)
 {
-    FILE *f;
     int ret;
-    char *filename;
     struct wordlist *addrs;
 
-    filename = PPP_PATH_SRPFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&srp_secrets))
 	return 0;
 
     if (client != NULL && client[0] == 0)
@@ -1800,8 +1999,7 @@ have_srp_secret(char *client, char *server, int need_ip, int *lacks_ipp)
     else if (server != NULL && server[0] == 0)
 	server = NULL;
 
-    ret = scan_authfile(f, client, server, NULL, &addrs, NULL, filename, 0);
-    fclose(f);
+    ret = scan_authfile(&srp_secrets, client, server, NULL, &addrs, NULL, 0);
     if (ret >= 0 && need_ip && !some_ip_ok(addrs)) {
 	if (lacks_ipp != 0)
 	    *lacks_ipp = 1;
@@ -1823,9 +2021,7 @@ int
 get_secret(int unit, char *client, char *server,
 	   char *secret, int *secret_len, int am_server)
 {
-    FILE *f;
     int ret, len;
-    char *filename;
     struct wordlist *addrs, *opts;
     char secbuf[MAXWORDLEN];
 
@@ -1838,19 +2034,16 @@ get_secret(int unit, char *client, char *server,
 	    return 0;
 	}
     } else {
-	filename = PPP_PATH_CHAPFILE;
 	addrs = NULL;
 	secbuf[0] = 0;
 
-	f = fopen(filename, "r");
-	if (f == NULL) {
-	    error("Can't open chap secret file %s: %m", filename);
+	if (!secrets_load(&chap_secrets)) {
+	    error("Can't open chap secret file %s: %m", chap_secrets.filename);
 	    return 0;
 	}
-	check_access(f, filename);
 
-	ret = scan_authfile(f, client, server, secbuf, &addrs, &opts, filename, 0);
-	fclose(f);
+	ret = scan_authfile(&chap_secrets, client, server, secbuf, &addrs,
+			    &opts, 0);
 	if (ret < 0)
 	    return 0;
 
@@ -1884,28 +2077,22 @@ int
 get_srp_secret(int unit, char *client, char *server,
 	       char *secret, int am_server)
 {
-    FILE *fp;
     int ret;
-    char *filename;
     struct wordlist *addrs, *opts;
 
     if (!am_server && passwd[0] != '\0') {
 	strlcpy(secret, passwd, MAXWORDLEN);
     } else {
-	filename = PPP_PATH_SRPFILE;
 	addrs = NULL;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-	    error("Can't open srp secret file %s: %m", filename);
+	if (!secrets_load(&srp_secrets)) {
+	    error("Can't open srp secret file %s: %m", srp_secrets.filename);
 	    return 0;
 	}
-	check_access(fp, filename);
 
 	secret[0] = '\0';
-	ret = scan_authfile(fp, client, server, secret, &addrs, &opts,
-	    filename, am_server);
-	fclose(fp);
+	ret = scan_authfile(&srp_secrets, client, server, secret, &addrs,
+	    &opts, am_server);
 	if (ret < 0)
 	    return 0;
 
@@ -1942,6 +2129,9 @@ set_allowed_addrs(int unit, struct wordlist *addrs,
     if (addresses[unit] != NULL)
 	free(addresses[unit]);
     addresses[unit] = NULL;
+    if (address_trie[unit] != NULL)
+	free(address_trie[unit]);
+    address_trie[unit] = NULL;
     if (extra_options != NULL)
 	free_wordlist(extra_options);
     extra_options = opts;
@@ -2056,6 +2246,9 @@ set_allowed_addrs(int unit, struct wordlist *addrs,
     ip[n].base = 0;		/* to terminate the list */
     ip[n].mask = 0;
 
+    address_trie[unit] = ip_trie_build(ip, n + 1);
+    if (address_trie[unit] == NULL)
+	novm("allowed address trie");
     addresses[unit] = ip;
 
     /*
@@ -2088,13 +2281,18 @@ auth_ip_addr(int unit, u_int32_t addr)
     if (ppp_bad_ip_addr(addr))
 	return 0;
 
+    /* an address in the pool is only for the pppd holding it */
+    ok = ippool_check(addr);
+    if (ok >= 0)
+	return ok;
+
     if (allowed_address_hook) {
 	ok = allowed_address_hook(addr);
 	if (ok >= 0) return ok;
     }
 
     if (addresses[unit] != NULL) {
-	ok = ip_addr_check(addr, addresses[unit]);
+	ok = ip_addr_check(addr, addresses[unit], address_trie[unit]);
 	if (ok >= 0)
 	    return ok;
     }
@@ -2104,12 +2302,80 @@ auth_ip_addr(int unit, u_int32_t addr)
     return allow_any_ip || privileged || !have_route_to(addr);
 }
 
+/*
+ * ip_trie_build - make a trie of the n entries in a list of permitted
+ * addresses.  The masks are all contiguous, as set_allowed_addrs makes
+ * them.  Returns NULL if there isn't enough memory.
+ */
+static struct ip_trie_node *
+ip_trie_build(struct permitted_ip *addrs, int n)
+{
+    struct ip_trie_node *trie, *tp;
+    int i, k, len, bit, nnodes, max;
+    u_int32_t base, mask;
+
+    max = 64;
+    trie = malloc(max * sizeof(*trie));
+    if (trie == NULL)
+	return NULL;
+    trie[0].child[0] = trie[0].child[1] = 0;
+    trie[0].entry = -1;
+    nnodes = 1;
+
+    for (k = 0; k < n; ++k) {
+	base = ntohl(addrs[k].base);
+	mask = ntohl(addrs[k].mask);
+	for (len = 0; len < 32 && (mask & (0x80000000U >> len)) != 0; ++len)
+	    ;
+	i = 0;
+	while (len-- > 0) {
+	    bit = (base & 0x80000000U) != 0;
+	    base <<= 1;
+	    if (trie[i].child[bit] == 0) {
+		if (nnodes == max) {
+		    max *= 2;
+		    tp = realloc(trie, max * sizeof(*trie));
+		    if (tp == NULL) {
+			free(trie);
+			return NULL;
+		    }
+		    trie = tp;
+		}
+		trie[nnodes].child[0] = trie[nnodes].child[1] = 0;
+		trie[nnodes].entry = -1;
+		trie[i].child[bit] = nnodes++;
+	    }
+	    i = trie[i].child[bit];
+	}
+	if (trie[i].entry < 0)
+	    trie[i].entry = k;
+    }
+    return trie;
+}
+
+/*
+ * ip_addr_check - return whether the first entry in the list that
+ * matches addr permits it.  The last entry in the list matches any
+ * address, so there always is one.
+ */
 static int
-ip_addr_check(u_int32_t addr, struct permitted_ip *addrs)
+ip_addr_check(u_int32_t addr, struct permitted_ip *addrs,
+	      struct ip_trie_node *trie)
 {
-    for (; ; ++addrs)
-	if ((addr & addrs->mask) == addrs->base)
-	    return addrs->permit;
+    int i, depth, best;
+
+    addr = ntohl(addr);
+    best = -1;
+    for (i = 0, depth = 0; ; ++depth) {
+	if (trie[i].entry >= 0 && (best < 0 || trie[i].entry < best))
+	    best = trie[i].entry;
+	if (depth == 32)
+	    break;
+	i = trie[i].child[(addr >> (31 - depth)) & 1];
+	if (i == 0)
+	    break;
+    }
+    return addrs[best].permit;
 }
 
 /*
@@ -2167,22 +2433,162 @@ auth_number(void)
     return 0;
 }
 
+struct secret_check {
+    char *secret;
+    int flags;
+};
+
 /*
- * check_access - complain if a secret file has too-liberal permissions.
+ * secret_usable - check that the secret in an entry can be used, and
+ * copy it to the caller's buffer (if any).  Returns 1 if it can be used.
+ */
+static int
+secret_usable(const char **words, void *arg)
+{
+    struct secret_check *sc = arg;
+    int xxx;
+    FILE *sf;
+    const char *word, *cp;
+    char atfile[MAXWORDLEN];
+    char lsecret[MAXWORDLEN];
+
+    word = words[2];
+
+    /*
+     * SRP-SHA1 authenticator should never be reading secrets from
+     * a file.  (Authenticatee may, though.)
+     */
+    if (sc->flags && ((cp = strchr(word, ':')) == NULL ||
+	strchr(cp + 1, ':') == NULL))
+	return 0;
+
+    if (sc->secret == NULL)
+	return 1;
+
+    /*
+     * Special syntax: @/pathname means read secret from file.
+     */
+    if (word[0] == '@' && word[1] == '/') {
+	strlcpy(atfile, word+1, sizeof(atfile));
+	if ((sf = fopen(atfile, "r")) == NULL) {
+	    warn("can't open indirect secret file %s", atfile);
+	    return 0;
+	}
+	check_access(sf, atfile);
+	if (!getword(sf, lsecret, &xxx, atfile)) {
+	    warn("no secret in indirect secret file %s", atfile);
+	    fclose(sf);
+	    return 0;
+	}
+	fclose(sf);
+	strlcpy(sc->secret, lsecret, MAXWORDLEN);
+	BZERO(lsecret, sizeof(lsecret));
+    } else
+	strlcpy(sc->secret, word, MAXWORDLEN);
+    return 1;
+}
+
+/*
+ * The wordlists made from a secrets entry are each allocated as one
+ * block: this header, then the nodes, then the words.  A long list of
+ * allowed addresses thus costs one malloc and one free, not one of
+ * each per word.  free_wordlist recognises a list which starts a
+ * block on the list below, and frees other lists node by node as
+ * before.
+ */
+struct wordlist_block {
+    struct wordlist_block *next;
+};
+
+static struct wordlist_block *wordlist_blocks;	/* those still in use */
+
+/*
+ * wordlist_block_alloc - make a block for a list of n words taking
+ * len bytes in all, and return its first node.
+ */
+static struct wordlist *
+wordlist_block_alloc(int n, size_t len)
+{
+    struct wordlist_block *bp;
+
+    bp = malloc(sizeof(*bp) + n * sizeof(struct wordlist) + len);
+    if (bp == NULL)
+	novm("authorized addresses");
+    bp->next = wordlist_blocks;
+    wordlist_blocks = bp;
+    return (struct wordlist *) (bp + 1);
+}
+
+/*
+ * secret_wordlists - make wordlists of the words in an entry after
+ * the fixed ones: the address authorization info in *addrs and,
+ * after a "--" word, the extra options in *opts.  Either can be NULL.
  */
 static void
-check_access(FILE *f, char *filename)
+secret_wordlists(struct secrets_table *t, const struct ppp_secrets_entry *ep,
+		 struct wordlist **addrs, struct wordlist **opts)
 {
-    struct stat sbuf;
+    struct wordlist *ap, *list[2];
+    const char *words, *word;
+    char *p[2];
+    int i, n, k, count[2];
+    size_t len[2], l;
 
-    if (fstat(fileno(f), &sbuf) < 0) {
-	warn("cannot stat secret file %s: %m", filename);
-    } else if ((sbuf.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
-	warn("Warning - secret file %s has world and/or group access",
-	     filename);
+    if (addrs != NULL)
+	*addrs = NULL;
+    if (opts != NULL)
+	*opts = NULL;
+    if ((words = secrets_words(t, ep, &n)) == NULL)
+	return;
+
+    /* size the two lists: 0 is the addresses, 1 the options */
+    count[0] = count[1] = 0;
+    len[0] = len[1] = 0;
+    k = 0;
+    for (i = 0, word = words; i < n; ++i, word += strlen(word) + 1) {
+	if (i < t->nfixed)
+	    continue;
+	if (k == 0 && strcmp(word, "--") == 0) {
+	    k = 1;
+	    continue;
+	}
+	++count[k];
+	len[k] += strlen(word) + 1;
+    }
+    for (k = 0; k < 2; ++k) {
+	list[k] = NULL;
+	if (count[k] > 0 && (k == 0? addrs: opts) != NULL) {
+	    list[k] = wordlist_block_alloc(count[k], len[k]);
+	    p[k] = (char *) (list[k] + count[k]);
+	}
+	count[k] = 0;
     }
-}
 
+    k = 0;
+    for (i = 0, word = words; i < n; ++i, word += strlen(word) + 1) {
+	if (i < t->nfixed)
+	    continue;
+	if (k == 0 && strcmp(word, "--") == 0) {
+	    k = 1;
+	    continue;
+	}
+	if (list[k] == NULL)
+	    continue;
+	ap = &list[k][count[k]];
+	if (count[k] > 0)
+	    ap[-1].next = ap;
+	ap->next = NULL;
+	l = strlen(word) + 1;
+	ap->word = p[k];
+	memcpy(p[k], word, l);
+	p[k] += l;
+	++count[k];
+    }
+    if (addrs != NULL)
+	*addrs = list[0];
+    if (opts != NULL)
+	*opts = list[1];
+}
 
 /*
  * scan_authfile - Scan an authorization file for a secret suitable
@@ -2199,158 +2605,24 @@ check_access(FILE *f, char *filename)
  * match.
  */
 static int
-scan_authfile(FILE *f, char *client, char *server,
+scan_authfile(struct secrets_table *t, char *client, char *server,
 	      char *secret, struct wordlist **addrs,
-	      struct wordlist **opts, char *filename,
-	      int flags)
+	      struct wordlist **opts, int flags)
 {
-    int newline, xxx;
-    int got_flag, best_flag;
-    FILE *sf;
-    struct wordlist *ap, *addr_list, *alist, **app;
-    char word[MAXWORDLEN];
-    char atfile[MAXWORDLEN];
-    char lsecret[MAXWORDLEN];
-    char *cp;
+    const struct ppp_secrets_entry *ep;
+    struct secret_check sc;
+    int ret;
 
     if (addrs != NULL)
 	*addrs = NULL;
     if (opts != NULL)
 	*opts = NULL;
-    addr_list = NULL;
-    if (!getword(f, word, &newline, filename))
-	return -1;		/* file is empty??? */
-    newline = 1;
-    best_flag = -1;
-    for (;;) {
-	/*
-	 * Skip until we find a word at the start of a line.
-	 */
-	while (!newline && getword(f, word, &newline, filename))
-	    ;
-	if (!newline)
-	    break;		/* got to end of file */
-
-	/*
-	 * Got a client - check if it's a match or a wildcard.
-	 */
-	got_flag = 0;
-	if (client != NULL && strcmp(word, client) != 0 && !ISWILD(word)) {
-	    newline = 0;
-	    continue;
-	}
-	if (!ISWILD(word))
-	    got_flag = NONWILD_CLIENT;
-
-	/*
-	 * Now get a server and check if it matches.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (!ISWILD(word)) {
-	    if (server != NULL && strcmp(word, server) != 0)
-		continue;
-	    got_flag |= NONWILD_SERVER;
-	}
-
-	/*
-	 * Got some sort of a match - see if it's better than what
-	 * we have already.
-	 */
-	if (got_flag <= best_flag)
-	    continue;
-
-	/*
-	 * Get the secret.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-
-	/*
-	 * SRP-SHA1 authenticator should never be reading secrets from
-	 * a file.  (Authenticatee may, though.)
-	 */
-	if (flags && ((cp = strchr(word, ':')) == NULL ||
-	    strchr(cp + 1, ':') == NULL))
-	    continue;
-
-	if (secret != NULL) {
-	    /*
-	     * Special syntax: @/pathname means read secret from file.
-	     */
-	    if (word[0] == '@' && word[1] == '/') {
-		strlcpy(atfile, word+1, sizeof(atfile));
-		if ((sf = fopen(atfile, "r")) == NULL) {
-		    warn("can't open indirect secret file %s", atfile);
-		    continue;
-		}
-		check_access(sf, atfile);
-		if (!getword(sf, word, &xxx, atfile)) {
-		    warn("no secret in indirect secret file %s", atfile);
-		    fclose(sf);
-		    continue;
-		}
-		fclose(sf);
-	    }
-	    strlcpy(lsecret, word, sizeof(lsecret));
-	}
-
-	/*
-	 * Now read address authorization info and make a wordlist.
-	 */
-	app = &alist;
-	for (;;) {
-	    if (!getword(f, word, &newline, filename) || newline)
-		break;
-	    ap = (struct wordlist *)
-		    malloc(sizeof(struct wordlist) + strlen(word) + 1);
-	    if (ap == NULL)
-		novm("authorized addresses");
-	    ap->word = (char *) (ap + 1);
-	    strcpy(ap->word, word);
-	    *app = ap;
-	    app = &ap->next;
-	}
-	*app = NULL;
-
-	/*
-	 * This is the best so far; remember it.
-	 */
-	best_flag = got_flag;
-	if (addr_list)
-	    free_wordlist(addr_list);
-	addr_list = alist;
-	if (secret != NULL)
-	    strlcpy(secret, lsecret, MAXWORDLEN);
-
-	if (!newline)
-	    break;
-    }
-
-    /* scan for a -- word indicating the start of options */
-    for (app = &addr_list; (ap = *app) != NULL; app = &ap->next)
-	if (strcmp(ap->word, "--") == 0)
-	    break;
-    /* ap = start of options */
-    if (ap != NULL) {
-	ap = ap->next;		/* first option */
-	free(*app);			/* free the "--" word */
-	*app = NULL;		/* terminate addr list */
-    }
-    if (opts != NULL)
-	*opts = ap;
-    else if (ap != NULL)
-	free_wordlist(ap);
-    if (addrs != NULL)
-	*addrs = addr_list;
-    else if (addr_list != NULL)
-	free_wordlist(addr_list);
-
-    return best_flag;
+    sc.secret = secret;
+    sc.flags = flags;
+    ret = secrets_lookup(t, client, server, secret_usable, &sc, &ep);
+    if (ret >= 0)
+	secret_wordlists(t, ep, addrs, opts);
+    return ret;
 }
 
 /*
@@ -2373,7 +2645,17 @@ static void
 free_wordlist(struct wordlist *wp)
 {
     struct wordlist *next;
+    struct wordlist_block **bpp, *bp;
 
+    if (wp == NULL)
+	return;
+    for (bpp = &wordlist_blocks; (bp = *bpp) != NULL; bpp = &bp->next) {
+	if (wp == (struct wordlist *) (bp + 1)) {
+	    *bpp = bp->next;
+	    free(bp);
+	    return;
+	}
+    }
     while (wp != NULL) {
 	next = wp->next;
 	free(wp);
@@ -2444,18 +2726,14 @@ static int
 have_eaptls_secret_server(char *client, char *server,
 			  int need_ip, int *lacks_ipp)
 {
-    FILE *f;
     int ret;
-    char *filename;
     struct wordlist *addrs;
     char servcertfile[MAXWORDLEN];
     char clicertfile[MAXWORDLEN];
     char cacertfile[MAXWORDLEN];
     char pkfile[MAXWORDLEN];
 
-    filename = PPP_PATH_EAPTLSSERVFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&eaptls_server_secrets))
 		return 0;
 
     if (client != NULL && client[0] == 0)
@@ -2464,11 +2742,9 @@ have_eaptls_secret_server(char *client, char *server,
 		server = NULL;
 
     ret =
-	scan_authfile_eaptls(f, client, server, clicertfile, servcertfile,
-			     cacertfile, pkfile, &addrs, NULL, filename,
-			     0);
-
-    fclose(f);
+	scan_authfile_eaptls(&eaptls_server_secrets, client, server,
+			     clicertfile, servcertfile, cacertfile, pkfile,
+			     &addrs, NULL, 0);
 
 /*
     if (ret >= 0 && !eaptls_init_ssl(1, cacertfile, servcertfile,
@@ -2491,9 +2767,7 @@ have_eaptls_secret_server(char *client, char *server,
 static int
 have_eaptls_secret_client(char *client, char *server)
 {
-    FILE *f;
     int ret;
-    char *filename;
     struct wordlist *addrs = NULL;
     char servcertfile[MAXWORDLEN];
     char clicertfile[MAXWORDLEN];
@@ -2510,16 +2784,13 @@ have_eaptls_secret_client(char *client, char *server)
 	if (pkcs12_file)
 		return 1;
 
-    filename = PPP_PATH_EAPTLSCLIFILE;
-    f = fopen(filename, "r");
-    if (f == NULL)
+    if (!secrets_load(&eaptls_client_secrets))
 		return 0;
 
     ret =
-	scan_authfile_eaptls(f, client, server, clicertfile, servcertfile,
-			     cacertfile, pkfile, &addrs, NULL, filename,
-			     0);
-    fclose(f);
+	scan_authfile_eaptls(&eaptls_client_secrets, client, server,
+			     clicertfile, servcertfile, cacertfile, pkfile,
+			     &addrs, NULL, 0);
 
 /*
     if (ret >= 0 && !eaptls_init_ssl(0, cacertfile, clicertfile,
@@ -2534,157 +2805,47 @@ have_eaptls_secret_client(char *client, char *server)
 }
 
 
+/*
+ * scan_authfile_eaptls - find the certificates and key for
+ * authenticating `client' on `server' in an EAP-TLS secrets file,
+ * as scan_authfile does for the other secrets files.  A "-" for
+ * either certificate means there isn't one.
+ */
 static int
-scan_authfile_eaptls(FILE *f, char *client, char *server,
+scan_authfile_eaptls(struct secrets_table *t, char *client, char *server,
 		     char *cli_cert, char *serv_cert, char *ca_cert,
 		     char *pk, struct wordlist **addrs,
-		     struct wordlist **opts,
-		     char *filename, int flags)
+		     struct wordlist **opts, int flags)
 {
-    int newline;
-    int got_flag, best_flag;
-    struct wordlist *ap, *addr_list, *alist, **app;
-    char word[MAXWORDLEN];
+    const struct ppp_secrets_entry *ep;
+    const char *word;
+    int best_flag, n;
 
     if (addrs != NULL)
 	*addrs = NULL;
     if (opts != NULL)
 	*opts = NULL;
-    addr_list = NULL;
-    if (!getword(f, word, &newline, filename))
-	return -1;		/* file is empty??? */
-    newline = 1;
-    best_flag = -1;
-    for (;;) {
-	/*
-	 * Skip until we find a word at the start of a line.
-	 */
-	while (!newline && getword(f, word, &newline, filename));
-	if (!newline)
-	    break;		/* got to end of file */
-
-	/*
-	 * Got a client - check if it's a match or a wildcard.
-	 */
-	got_flag = 0;
-	if (client != NULL && strcmp(word, client) != 0 && !ISWILD(word)) {
-	    newline = 0;
-	    continue;
-	}
-	if (!ISWILD(word))
-	    got_flag = NONWILD_CLIENT;
-
-	/*
-	 * Now get a server and check if it matches.
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (!ISWILD(word)) {
-	    if (server != NULL && strcmp(word, server) != 0)
-		continue;
-	    got_flag |= NONWILD_SERVER;
-	}
-
-	/*
-	 * Got some sort of a match - see if it's better than what
-	 * we have already.
-	 */
-	if (got_flag <= best_flag)
-	    continue;
-
-	/*
-	 * Get the cli_cert
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (strcmp(word, "-") != 0) {
-	    strlcpy(cli_cert, word, MAXWORDLEN);
-	} else
-	    cli_cert[0] = 0;
-
-	/*
-	 * Get serv_cert
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	if (strcmp(word, "-") != 0) {
-	    strlcpy(serv_cert, word, MAXWORDLEN);
-	} else
-	    serv_cert[0] = 0;
-
-	/*
-	 * Get ca_cert
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	strlcpy(ca_cert, word, MAXWORDLEN);
-
-	/*
-	 * Get pk
-	 */
-	if (!getword(f, word, &newline, filename))
-	    break;
-	if (newline)
-	    continue;
-	strlcpy(pk, word, MAXWORDLEN);
-
-
-	/*
-	 * Now read address authorization info and make a wordlist.
-	 */
-	app = &alist;
-	for (;;) {
-	    if (!getword(f, word, &newline, filename) || newline)
-		break;
-	    ap = (struct wordlist *)
-		malloc(sizeof(struct wordlist) + strlen(word) + 1);
-	    if (ap == NULL)
-		novm("authorized addresses");
-	    ap->word = (char *) (ap + 1);
-	    strcpy(ap->word, word);
-	    *app = ap;
-	    app = &ap->next;
-	}
-	*app = NULL;
-	/*
-	 * This is the best so far; remember it.
-	 */
-	best_flag = got_flag;
-	if (addr_list)
-	    free_wordlist(addr_list);
-	addr_list = alist;
-
-	if (!newline)
-	    break;
-    }
-
-    /* scan for a -- word indicating the start of options */
-    for (app = &addr_list; (ap = *app) != NULL; app = &ap->next)
-	if (strcmp(ap->word, "--") == 0)
-	    break;
-    /* ap = start of options */
-    if (ap != NULL) {
-	ap = ap->next;		/* first option */
-	free(*app);		/* free the "--" word */
-	*app = NULL;		/* terminate addr list */
-    }
-    if (opts != NULL)
-	*opts = ap;
-    else if (ap != NULL)
-	free_wordlist(ap);
-    if (addrs != NULL)
-	*addrs = addr_list;
-    else if (addr_list != NULL)
-	free_wordlist(addr_list);
+    best_flag = secrets_lookup(t, client, server, NULL, NULL, &ep);
+    if (best_flag < 0 || (word = secrets_words(t, ep, &n)) == NULL)
+	return -1;
+
+    word += strlen(word) + 1;		/* server */
+    word += strlen(word) + 1;
+    if (strcmp(word, "-") != 0) {
+	strlcpy(cli_cert, word, MAXWORDLEN);
+    } else
+	cli_cert[0] = 0;
+    word += strlen(word) + 1;
+    if (strcmp(word, "-") != 0) {
+	strlcpy(serv_cert, word, MAXWORDLEN);
+    } else
+	serv_cert[0] = 0;
+    word += strlen(word) + 1;
+    strlcpy(ca_cert, word, MAXWORDLEN);
+    word += strlen(word) + 1;
+    strlcpy(pk, word, MAXWORDLEN);
 
+    secret_wordlists(t, ep, addrs, opts);
     return best_flag;
 }
 
@@ -2694,9 +2855,8 @@ get_eaptls_secret(int unit, char *client, char *server,
 		  char *clicertfile, char *servcertfile, char *cacertfile,
 		  char *capath, char *pkfile, char *pkcs12, int am_server)
 {
-    FILE *fp;
     int ret;
-    char *filename         = NULL;
+    struct secrets_table *t;
     struct wordlist *addrs = NULL;
     struct wordlist *opts  = NULL;
 
@@ -2728,22 +2888,17 @@ get_eaptls_secret(int unit, char *client, char *server,
 	}
 	else
 	{
-		filename = (am_server ? PPP_PATH_EAPTLSSERVFILE : PPP_PATH_EAPTLSCLIFILE);
+		t = (am_server ? &eaptls_server_secrets : &eaptls_client_secrets);
 		addrs = NULL;
 
-		fp = fopen(filename, "r");
-		if (fp == NULL)
+		if (!secrets_load(t))
 		{
-			error("Can't open eap-tls secret file %s: %m", filename);
+			error("Can't open eap-tls secret file %s: %m", t->filename);
 			return 0;
 		}
 
-		check_access(fp, filename);
-
-		ret = scan_authfile_eaptls(fp, client, server, clicertfile, servcertfile,
-				cacertfile, pkfile, &addrs, &opts, filename, 0);
-
-		fclose(fp);
+		ret = scan_authfile_eaptls(t, client, server, clicertfile, servcertfile,
+				cacertfile, pkfile, &addrs, &opts, 0);
 
 		if (ret < 0) return 0;
 	}
@@ -2767,4 +2922,72 @@ get_eaptls_secret(int unit, char *client, char *server,
 
     return 1;
 }
+
+
+/*
+ * eaptls_load_contexts - set up ahead of time the TLS contexts that
+ * sessions are going to want: ours as a server for each set of
+ * certificates in the eaptls-server file, and as a client with the
+ * files given as options.  A pre-forking server calls this so that
+ * each session starts with these already loaded; called again, it
+ * sets up afresh any whose files have changed.
+ */
+#define EAPTLS_PRELOAD_MAX	8
+
+void
+eaptls_load_contexts(void)
+{
+    static char seen[EAPTLS_PRELOAD_MAX][3 * MAXWORDLEN];
+    struct secrets_table *t = &eaptls_server_secrets;
+    char servcertfile[MAXWORDLEN];
+    char clicertfile[MAXWORDLEN];
+    char cacertfile[MAXWORDLEN];
+    char capath[MAXWORDLEN];
+    char pkfile[MAXWORDLEN];
+    char pkcs12[MAXWORDLEN];
+    const char *word;
+    SSL_CTX *ctx;
+    uint32_t i;
+    int j, n, nseen = 0;
+
+    if ((((cacert_file || ca_path) && cert_file && privkey_file) || pkcs12_file)
+	&& get_eaptls_secret(0, NULL, NULL, clicertfile, servcertfile,
+			     cacertfile, capath, pkfile, pkcs12, 0)
+	&& (ctx = eaptls_init_ssl(0, cacertfile, capath, clicertfile,
+				  pkfile, pkcs12)) != NULL)
+	SSL_CTX_free(ctx);
+
+    if (!auth_required || !secrets_load(t))
+	return;
+    for (i = 0; i < t->nentries && nseen < EAPTLS_PRELOAD_MAX; ++i) {
+	if ((word = secrets_words(t, &t->entries[i], &n)) == NULL || n < 6)
+	    continue;
+	word += strlen(word) + 1;		/* client */
+	word += strlen(word) + 1;		/* server */
+	word += strlen(word) + 1;		/* client's certificate */
+	strlcpy(servcertfile, word, MAXWORDLEN);
+	word += strlen(word) + 1;
+	strlcpy(cacertfile, word, MAXWORDLEN);
+	word += strlen(word) + 1;
+	strlcpy(pkfile, word, MAXWORDLEN);
+	if (strcmp(servcertfile, "-") == 0)
+	    continue;
+
+	/* most entries share the few sets of files there are */
+	slprintf(seen[nseen], sizeof(seen[0]), "%s\n%s\n%s",
+		 servcertfile, cacertfile, pkfile);
+	for (j = 0; j < nseen; ++j)
+	    if (strcmp(seen[j], seen[nseen]) == 0)
+		break;
+	if (j < nseen)
+	    continue;
+	++nseen;
+
+	if (eaptls_passwd_hook && (*eaptls_passwd_hook)(pkfile, passwd) < 0)
+	    continue;
+	ctx = eaptls_init_ssl(1, cacertfile, "", servcertfile, pkfile, "");
+	if (ctx != NULL)
+	    SSL_CTX_free(ctx);
+    }
+}
 #endif
@@ -66,9 +66,18 @@
  */
 static int setbsdcomp (char **);
 static int setdeflate (char **);
+static int setdeflatestrategy (char **);
 static char bsd_value[8];
 static char deflate_value[8];
 
+/*
+ * How our Deflate compressor is tuned; -1 leaves it to zlib.
+ */
+static int deflate_level = -1;
+static int deflate_strategy = -1;
+static int deflate_memlevel = -1;
+static char deflate_strategy_value[12];
+
 /*
  * Option variables.
  */
@@ -102,6 +111,16 @@ static struct option ccp_option_list[] = {
       "don't allow Deflate compression", OPT_ALIAS | OPT_PRIOSUB | OPT_A2CLR,
       &ccp_allowoptions[0].deflate },
 
+    { "deflate-level", o_int, &deflate_level,
+      "set the Deflate compression level", OPT_PRIO | OPT_LIMITS,
+      NULL, 9, 0 },
+    { "deflate-strategy", o_special, (void *)setdeflatestrategy,
+      "set the Deflate compression strategy",
+      OPT_PRIO | OPT_A2STRVAL | OPT_STATIC, deflate_strategy_value },
+    { "deflate-memlevel", o_int, &deflate_memlevel,
+      "set the Deflate compression memory level", OPT_PRIO | OPT_LIMITS,
+      NULL, 9, 1 },
+
     { "nodeflatedraft", o_bool, &ccp_wantoptions[0].deflate_draft,
       "don't use draft deflate #", OPT_A2COPY,
       &ccp_allowoptions[0].deflate_draft },
@@ -259,6 +278,10 @@ static int ccp_localstate[NUM_PPP];
 
 #define RACKTIMEOUT	1	/* second */
 
+static struct ccp_stats ccp_stats[NUM_PPP];
+static struct timeval ccp_rreq_time[NUM_PPP];	/* when we sent the reset-req */
+static uint64_t ccp_rtt_total[NUM_PPP];		/* of the acked reset-reqs, us */
+
 static int all_rejected[NUM_PPP];	/* we rejected all peer's options */
 
 /*
@@ -349,6 +372,59 @@ setdeflate(char **argv)
     return 1;
 }
 
+static int
+setdeflatestrategy(char **argv)
+{
+    static const char *names[] = { "default", "filtered", "huffman", "rle" };
+    int i;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+	if (strcmp(*argv, names[i]) == 0) {
+	    deflate_strategy = i;	/* the zlib Z_*_STRATEGY value */
+	    strlcpy(deflate_strategy_value, names[i],
+		    sizeof(deflate_strategy_value));
+	    return 1;
+	}
+    }
+    ppp_option_error("invalid parameter '%s' for deflate-strategy option",
+		     *argv);
+    return 0;
+}
+
+/*
+ * deflate_test - see whether the kernel can compress with the Deflate
+ * option at p, tuned as the deflate-level, deflate-strategy and
+ * deflate-memlevel options say.  If the kernel won't take the tuned
+ * option but will take the plain one, the tuning is dropped.
+ */
+static int
+deflate_test(int unit, u_char *p)
+{
+    u_char opt[CILEN_DEFLATE + DEFLATE_TUNE_LEN];
+    int res;
+
+    if (deflate_level < 0 && deflate_strategy < 0 && deflate_memlevel < 0)
+	return ccp_test(unit, p, CILEN_DEFLATE, 1);
+
+    BCOPY(p, opt, CILEN_DEFLATE);
+    opt[CILEN_DEFLATE] = deflate_level < 0? DEFLATE_TUNE_DEFAULT: deflate_level;
+    opt[CILEN_DEFLATE+1] = deflate_strategy < 0? DEFLATE_TUNE_DEFAULT:
+	deflate_strategy;
+    opt[CILEN_DEFLATE+2] = deflate_memlevel < 0? DEFLATE_TUNE_DEFAULT:
+	deflate_memlevel;
+    res = ccp_test(unit, opt, sizeof(opt), 1);
+    if (res > 0)
+	return res;
+
+    res = ccp_test(unit, p, CILEN_DEFLATE, 1);
+    if (res > 0) {
+	warn("Kernel refused the Deflate tuning options; "
+	     "using its defaults");
+	deflate_level = deflate_strategy = deflate_memlevel = -1;
+    }
+    return res;
+}
+
 /*
  * ccp_init - initialize CCP.
  */
@@ -422,6 +498,8 @@ ccp_close(int unit, char *reason)
 static void
 ccp_lowerup(int unit)
 {
+    memset(&ccp_stats[unit], 0, sizeof(ccp_stats[unit]));
+    ccp_rtt_total[unit] = 0;
     fsm_lowerup(&ccp_fsm[unit]);
 }
 
@@ -467,6 +545,45 @@ ccp_input(int unit, u_char *p, int len)
 	ccp_close(unit, "No compression negotiated");
 }
 
+/*
+ * ccp_reset_acked - note how long the peer took to ack our reset-req.
+ */
+static void
+ccp_reset_acked(int unit)
+{
+    struct ccp_stats *st = &ccp_stats[unit];
+    struct timeval now;
+    long rtt;
+
+    ++st->reset_ack_rcvd;
+    if (ppp_get_time(&now) < 0)
+	return;
+    rtt = (now.tv_sec - ccp_rreq_time[unit].tv_sec) * 1000000L
+	+ now.tv_usec - ccp_rreq_time[unit].tv_usec;
+    if (rtt < 0)
+	rtt = 0;
+    ccp_rtt_total[unit] += rtt;
+    st->reset_rtt_us = ccp_rtt_total[unit] / st->reset_ack_rcvd;
+    if (rtt > st->reset_rtt_max_us)
+	st->reset_rtt_max_us = rtt;
+}
+
+/*
+ * ccp_get_stats - return the methods in use and the reset counts.
+ */
+void
+ccp_get_stats(int unit, struct ccp_stats *st)
+{
+    *st = ccp_stats[unit];
+    st->comp_method = st->decomp_method = 0;
+    if (ccp_fsm[unit].state == OPENED) {
+	if (ANY_COMPRESS(ccp_hisoptions[unit]))
+	    st->comp_method = ccp_hisoptions[unit].method;
+	if (ANY_COMPRESS(ccp_gotoptions[unit]))
+	    st->decomp_method = ccp_gotoptions[unit].method;
+    }
+}
+
 /*
  * Handle a CCP-specific code.
  */
@@ -479,6 +596,7 @@ ccp_extcode(fsm *f, int code, int id, u_char *p, int len)
 	    break;
 	/* send a reset-ack, which the transmitter will see and
 	   reset its compression state. */
+	++ccp_stats[f->unit].reset_req_rcvd;
 	fsm_sdata(f, CCP_RESETACK, id, NULL, 0);
 	break;
 
@@ -486,6 +604,7 @@ ccp_extcode(fsm *f, int code, int id, u_char *p, int len)
 	if (ccp_localstate[f->unit] & RACK_PENDING && id == f->reqid) {
 	    ccp_localstate[f->unit] &= ~(RACK_PENDING | RREQ_REPEAT);
 	    UNTIMEOUT(ccp_rack_timeout, f);
+	    ccp_reset_acked(f->unit);
 	}
 	break;
 
@@ -514,6 +633,76 @@ ccp_protrej(int unit)
 
 }
 
+/*
+ * What CCP keeps in the peer cache (see peer_cache_get): the methods
+ * the peer rejected, and the sizes it nak'd the others down to.
+ * Nothing is kept when MPPE is in use.
+ */
+struct ccp_cache {
+    bool rej_bsd_compress;
+    bool rej_deflate_correct;
+    bool rej_deflate_draft;
+    bool rej_predictor_1;
+    bool rej_predictor_2;
+    unsigned short bsd_bits;
+    unsigned short deflate_size;
+};
+
+/*
+ * ccp_cache_save - remember how CCP went with this peer.
+ */
+static void
+ccp_cache_save(fsm *f)
+{
+    ccp_options *wo = &ccp_wantoptions[f->unit];
+    ccp_options *go = &ccp_gotoptions[f->unit];
+    struct ccp_cache c;
+
+    if (go->mppe)
+	return;
+    memset(&c, 0, sizeof(c));
+    c.rej_bsd_compress = wo->bsd_compress && !go->bsd_compress;
+    c.rej_deflate_correct = wo->deflate && wo->deflate_correct
+	&& !(go->deflate && go->deflate_correct);
+    c.rej_deflate_draft = wo->deflate && wo->deflate_draft
+	&& !(go->deflate && go->deflate_draft);
+    c.rej_predictor_1 = wo->predictor_1 && !go->predictor_1;
+    c.rej_predictor_2 = wo->predictor_2 && !go->predictor_2;
+    c.bsd_bits = go->bsd_compress? go->bsd_bits: 0;
+    c.deflate_size = go->deflate? go->deflate_size: 0;
+    peer_cache_put(PPP_CCP, &c, sizeof(c));
+}
+
+/*
+ * ccp_cache_seed - leave out the methods this peer rejected last
+ * time, and start from the sizes it wanted.
+ */
+static void
+ccp_cache_seed(fsm *f)
+{
+    ccp_options *go = &ccp_gotoptions[f->unit];
+    struct ccp_cache c;
+
+    if (go->mppe || !peer_cache_get(PPP_CCP, &c, sizeof(c)))
+	return;
+    if (c.rej_bsd_compress)
+	go->bsd_compress = 0;
+    if (c.rej_deflate_correct)
+	go->deflate_correct = 0;
+    if (c.rej_deflate_draft)
+	go->deflate_draft = 0;
+    if (!go->deflate_correct && !go->deflate_draft)
+	go->deflate = 0;
+    if (c.rej_predictor_1)
+	go->predictor_1 = 0;
+    if (c.rej_predictor_2)
+	go->predictor_2 = 0;
+    if (c.bsd_bits >= BSD_MIN_BITS && c.bsd_bits < go->bsd_bits)
+	go->bsd_bits = c.bsd_bits;
+    if (c.deflate_size >= DEFLATE_MIN_WORKS && c.deflate_size < go->deflate_size)
+	go->deflate_size = c.deflate_size;
+}
+
 /*
  * ccp_resetci - initialize at start of negotiation.
  */
@@ -525,6 +714,7 @@ ccp_resetci(fsm *f)
 
     *go = ccp_wantoptions[f->unit];
     all_rejected[f->unit] = 0;
+    ccp_cache_seed(f);
 
 #ifdef PPP_WITH_MPPE
     if (go->mppe) {
@@ -1222,7 +1412,7 @@ ccp_reqci(fsm *f, u_char *p, int *lenp, int dont_nak)
 		 */
 		if (p == p0) {
 		    for (;;) {
-			res = ccp_test(f->unit, p, CILEN_DEFLATE, 1);
+			res = deflate_test(f->unit, p);
 			if (res > 0)
 			    break;		/* it's OK now */
 			if (res < 0 || nb == DEFLATE_MIN_WORKS || dont_nak) {
@@ -1429,6 +1619,7 @@ ccp_up(fsm *f)
 	    notice("%s receive compression enabled", method_name(go, NULL));
     } else if (ANY_COMPRESS(*ho))
 	notice("%s transmit compression enabled", method_name(ho, NULL));
+    ccp_cache_save(f);
 #ifdef PPP_WITH_MPPE
     if (go->mppe) {
 	mppe_clear_keys();
@@ -1443,6 +1634,12 @@ ccp_up(fsm *f)
 static void
 ccp_down(fsm *f)
 {
+    struct ccp_stats *st = &ccp_stats[f->unit];
+
+    if (st->reset_req_sent > 0 || st->reset_req_rcvd > 0)
+	info("CCP: sent %u reset-requests, %u acked (mean %u us, max %u us),"
+	     " received %u", st->reset_req_sent, st->reset_ack_rcvd,
+	     st->reset_rtt_us, st->reset_rtt_max_us, st->reset_req_rcvd);
     if (ccp_localstate[f->unit] & RACK_PENDING)
 	UNTIMEOUT(ccp_rack_timeout, f);
     ccp_localstate[f->unit] = 0;
@@ -1631,6 +1828,8 @@ ccp_datainput(int unit, u_char *pkt, int len)
 		fsm_sdata(f, CCP_RESETREQ, f->reqid = ++f->id, NULL, 0);
 		TIMEOUT(ccp_rack_timeout, f, RACKTIMEOUT);
 		ccp_localstate[f->unit] |= RACK_PENDING;
+		++ccp_stats[unit].reset_req_sent;
+		ppp_get_time(&ccp_rreq_time[unit]);
 	    } else
 		ccp_localstate[f->unit] |= RREQ_REPEAT;
 	}
@@ -1649,7 +1848,10 @@ ccp_rack_timeout(void *arg)
 	fsm_sdata(f, CCP_RESETREQ, f->reqid, NULL, 0);
 	TIMEOUT(ccp_rack_timeout, f, RACKTIMEOUT);
 	ccp_localstate[f->unit] &= ~RREQ_REPEAT;
-    } else
+	++ccp_stats[f->unit].reset_req_sent;
+    } else {
 	ccp_localstate[f->unit] &= ~RACK_PENDING;
+	++ccp_stats[f->unit].reset_timeouts;
+    }
 }
 
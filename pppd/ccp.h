@@ -32,8 +32,19 @@
 #ifndef PPP_CCP_H
 #define PPP_CCP_H
 
+#include <stdint.h>
+
 #include "pppdconf.h"
 
+/*
+ * The private trailer on the Deflate option passed to ccp_test for the
+ * transmit direction, as also defined in <net/ppp-comp.h>.
+ */
+#ifndef DEFLATE_TUNE_LEN
+#define DEFLATE_TUNE_LEN	3	/* level, strategy, memLevel */
+#define DEFLATE_TUNE_DEFAULT	0xff
+#endif
+
 typedef struct ccp_options {
     bool bsd_compress;		/* do BSD Compress? */
     bool deflate;		/* do Deflate? */
@@ -55,4 +66,21 @@ extern ccp_options ccp_hisoptions[];
 
 extern struct protent ccp_protent;
 
+/*
+ * Which methods are in use and how CCP resets have gone since the
+ * link came up, for the stats file.
+ */
+struct ccp_stats {
+    unsigned char comp_method;	/* option code for transmit, 0 if none */
+    unsigned char decomp_method; /* and for receive */
+    uint32_t reset_req_sent;	/* reset-requests we sent, repeats too */
+    uint32_t reset_req_rcvd;	/* reset-requests from the peer */
+    uint32_t reset_ack_rcvd;	/* reset-acks for our requests */
+    uint32_t reset_timeouts;	/* requests we gave up waiting on */
+    uint32_t reset_rtt_us;	/* mean time from request to ack */
+    uint32_t reset_rtt_max_us;	/* and the longest */
+};
+
+void ccp_get_stats(int unit, struct ccp_stats *);
+
 #endif
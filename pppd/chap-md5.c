@@ -73,27 +73,13 @@ chap_md5_verify_response(int id, char *name,
 	if (response_len == MD5_DIGEST_LENGTH) {
 
 		/* Generate hash of ID, secret, challenge */
-		PPP_MD_CTX* ctx = PPP_MD_CTX_new();
-		if (ctx) {
+		struct iovec iov[3] = {
+			{ &idbyte, 1 },
+			{ secret, secret_len },
+			{ challenge, challenge_len },
+		};
 
-			if (PPP_DigestInit(ctx, PPP_md5())) {
-
-				if (PPP_DigestUpdate(ctx, &idbyte, 1)) {
-
-					if (PPP_DigestUpdate(ctx, secret, secret_len)) {
-
-						if (PPP_DigestUpdate(ctx, challenge, challenge_len)) {
-
-							if (PPP_DigestFinal(ctx, hash, &hash_len)) {
-
-								success = 1;
-							}
-						}
-					}
-				}
-			}
-			PPP_MD_CTX_free(ctx);
-		}
+		success = PPP_Digest(PPP_md5(), iov, 3, hash, &hash_len);
 	}
 	if (success && memcmp(hash, response, hash_len) == 0) {
 		slprintf(message, message_space, "Access granted");
@@ -110,29 +96,16 @@ chap_md5_make_response(unsigned char *response, int id, char *our_name,
 {
 	unsigned char idbyte = id;
 	int challenge_len = *challenge++;
-	int hash_len = MD5_DIGEST_LENGTH;
-
-	PPP_MD_CTX* ctx = PPP_MD_CTX_new();
-	if (ctx) {
+	unsigned int hash_len = MD5_DIGEST_LENGTH;
 
-		if (PPP_DigestInit(ctx, PPP_md5())) {
+	struct iovec iov[3] = {
+		{ &idbyte, 1 },
+		{ secret, secret_len },
+		{ challenge, challenge_len },
+	};
 
-			if (PPP_DigestUpdate(ctx, &idbyte, 1)) {
-
-				if (PPP_DigestUpdate(ctx, secret, secret_len)) {
-
-					if (PPP_DigestUpdate(ctx, challenge, challenge_len)) {
-
-						if (PPP_DigestFinal(ctx, &response[1], &hash_len)) {
-
-							response[0] = hash_len;
-						}
-					}
-				}
-			}
-		}
-		PPP_MD_CTX_free(ctx);
-	}
+	if (PPP_Digest(PPP_md5(), iov, 3, &response[1], &hash_len))
+		response[0] = hash_len;
 }
 
 static struct chap_digest_type md5_digest = {
@@ -54,6 +54,9 @@ int chap_mdtype_all = MDTYPE_ALL;
 /* Hook for a plugin to validate CHAP challenge */
 chap_verify_hook_fn *chap_verify_hook = NULL;
 
+/* Set by a plugin whose chap_verify_hook may be run on the offload thread */
+bool chap_verify_hook_offload = 0;
+
 /*
  * Option variables.
  */
@@ -106,6 +109,7 @@ static struct chap_server_state {
 	int challenge_pktlen;
 	unsigned char challenge[CHAL_MAX_PKTLEN];
 	char message[256];
+	unsigned verify_seq;		/* counts checks, to spot stale answers */
 } server;
 
 /* Values for flags in chap_client_state and chap_server_state */
@@ -115,6 +119,7 @@ static struct chap_server_state {
 #define AUTH_FAILED		8
 #define TIMEOUT_PENDING		0x10
 #define CHALLENGE_VALID		0x20
+#define VERIFY_PENDING		0x40
 
 /*
  * Prototypes.
@@ -128,6 +133,9 @@ static void chap_generate_challenge(struct chap_server_state *ss);
 static void chap_handle_response(struct chap_server_state *ss, int code,
 		unsigned char *pkt, int len);
 static chap_verify_hook_fn chap_verify_response;
+static void chap_verified(void *arg, int ok);
+static void chap_send_result(struct chap_server_state *ss, int id,
+		char *name, int session_ok);
 static void chap_respond(struct chap_client_state *cs, int id,
 		unsigned char *pkt, int len);
 static void chap_handle_status(struct chap_client_state *cs, int code, int id,
@@ -204,6 +212,7 @@ chap_lowerdown(int unit)
 	if (ss->flags & TIMEOUT_PENDING)
 		UNTIMEOUT(chap_server_timeout, ss);
 	ss->flags = 0;
+	++ss->verify_seq;		/* forget any check still going */
 }
 
 /*
@@ -331,6 +340,46 @@ chap_generate_challenge(struct chap_server_state *ss)
 	p[3] = len;
 }
 
+/*
+ * A response being checked on the offload thread; see chap_verified.
+ * The verifier gets copies of everything, since the main loop goes on
+ * using the packet buffer and may start a new challenge if the link
+ * bounces in the meantime.
+ */
+struct chap_verify {
+	struct chap_server_state *ss;
+	unsigned seq;			/* ss->verify_seq when it started */
+	int id;
+	chap_verify_hook_fn *verifier;	/* NULL if already done */
+	int ok;				/* the verifier's answer */
+	int check_session;		/* session_check wanted too */
+	int session_ok;
+	char *ourname;
+	struct chap_digest_type *digest;
+	char name[MAXNAMELEN+1];
+	unsigned char challenge[MAX_CHALLENGE_LEN+1];
+	unsigned char response[256];
+	char message[256];
+};
+
+/*
+ * chap_verify_work - run the blocking parts of checking a response.
+ */
+static int
+chap_verify_work(void *arg)
+{
+	struct chap_verify *cv = arg;
+
+	if (cv->verifier)
+		cv->ok = (*cv->verifier)(cv->name, cv->ourname, cv->id,
+					 cv->digest, cv->challenge,
+					 cv->response, cv->message,
+					 sizeof(cv->message));
+	if (cv->ok && cv->check_session)
+		cv->session_ok = session_check(cv->name, NULL, devnam, NULL);
+	return cv->ok;
+}
+
 /*
  * chap_handle_response - check the response to our challenge.
  */
@@ -338,58 +387,132 @@ static void
 chap_handle_response(struct chap_server_state *ss, int id,
 		     unsigned char *pkt, int len)
 {
-	int response_len, ok, mlen;
-	unsigned char *response, *p;
+	int response_len;
+	unsigned char *response, *challenge;
 	char *name = NULL;
-	chap_verify_hook_fn *verifier;
-	char rname[MAXNAMELEN+1];
+	struct chap_verify *cv;
 
 	if ((ss->flags & LOWERUP) == 0)
 		return;
 	if (id != ss->challenge[PPP_HDRLEN+1] || len < 2)
 		return;
-	if (ss->flags & CHALLENGE_VALID) {
-		response = pkt;
-		GETCHAR(response_len, pkt);
-		len -= response_len + 1;	/* length of name */
-		name = (char *)pkt + response_len;
-		if (len < 0)
-			return;
+	/* still checking an earlier one; the peer will send it again */
+	if (ss->flags & VERIFY_PENDING)
+		return;
+	if ((ss->flags & CHALLENGE_VALID) == 0) {
+		if (ss->flags & AUTH_DONE)
+			chap_send_result(ss, id, NULL, 1);
+		return;
+	}
 
-		if (ss->flags & TIMEOUT_PENDING) {
-			ss->flags &= ~TIMEOUT_PENDING;
-			UNTIMEOUT(chap_server_timeout, ss);
-		}
+	response = pkt;
+	GETCHAR(response_len, pkt);
+	len -= response_len + 1;	/* length of name */
+	name = (char *)pkt + response_len;
+	if (len < 0)
+		return;
 
-		if (explicit_remote) {
-			name = remote_name;
-		} else {
-			/* Null terminate and clean remote name. */
-			slprintf(rname, sizeof(rname), "%.*v", len, name);
-			name = rname;
+	if (ss->flags & TIMEOUT_PENDING) {
+		ss->flags &= ~TIMEOUT_PENDING;
+		UNTIMEOUT(chap_server_timeout, ss);
+	}
 
-			/* strip the MS domain name */
-			if (chapms_strip_domain && strrchr(rname, '\\')) {
-				char tmp[MAXNAMELEN+1];
+	prof_begin(PROF_AUTH);
+	cv = calloc(1, sizeof(*cv));
+	if (cv == NULL)
+		novm("CHAP check");
+	cv->ss = ss;
+	cv->seq = ++ss->verify_seq;
+	cv->id = id;
+	cv->ourname = ss->name;
+	cv->digest = ss->digest;
+	cv->session_ok = 1;
+
+	if (explicit_remote) {
+		strlcpy(cv->name, remote_name, sizeof(cv->name));
+	} else {
+		/* Null terminate and clean remote name. */
+		slprintf(cv->name, sizeof(cv->name), "%.*v", len, name);
 
-				strcpy(tmp, strrchr(rname, '\\') + 1);
-				strcpy(rname, tmp);
-			}
-		}
+		/* strip the MS domain name */
+		if (chapms_strip_domain && strrchr(cv->name, '\\')) {
+			char tmp[MAXNAMELEN+1];
 
-		if (chap_verify_hook)
-			verifier = chap_verify_hook;
-		else
-			verifier = chap_verify_response;
-		ok = (*verifier)(name, ss->name, id, ss->digest,
-				 ss->challenge + PPP_HDRLEN + CHAP_HDRLEN,
-				 response, ss->message, sizeof(ss->message));
-		if (!ok || !auth_number()) {
-			ss->flags |= AUTH_FAILED;
-			warn("Peer %q failed CHAP authentication", name);
+			strcpy(tmp, strrchr(cv->name, '\\') + 1);
+			strcpy(cv->name, tmp);
+		}
+	}
+	challenge = ss->challenge + PPP_HDRLEN + CHAP_HDRLEN;
+	memcpy(cv->challenge, challenge, challenge[0] + 1);
+	memcpy(cv->response, response, response_len + 1);
+
+	/*
+	 * Once the response checks out, we need to check session
+	 * restrictions to ensure everything is OK, but only when first
+	 * authenticating, and only if we're configured to check.  This
+	 * allows us to do PAM checks on PPP servers that authenticate
+	 * against ActiveDirectory, and use AD for account info (like
+	 * when using Winbind integrated with PAM).
+	 */
+	cv->check_session = session_mgmt && !(ss->flags & AUTH_DONE);
+
+	/*
+	 * Our own checks against the secrets file are quick, and use
+	 * things the main loop does, so only a plugin that says it can
+	 * be run on the offload thread is.
+	 */
+	if (chap_verify_hook && chap_verify_hook_offload) {
+		cv->verifier = chap_verify_hook;
+	} else {
+		cv->ok = (*(chap_verify_hook? chap_verify_hook:
+			    chap_verify_response))(cv->name, cv->ourname, id,
+				cv->digest, cv->challenge, cv->response,
+				cv->message, sizeof(cv->message));
+		if (!cv->ok || !cv->check_session) {
+			chap_verified(cv, cv->ok);
+			return;
 		}
-	} else if ((ss->flags & AUTH_DONE) == 0)
+	}
+	ss->flags |= VERIFY_PENDING;
+	ppp_offload(chap_verify_work, chap_verified, cv);
+}
+
+/*
+ * chap_verified - act on the result of checking a response.
+ */
+static void
+chap_verified(void *arg, int ok)
+{
+	struct chap_verify *cv = arg;
+	struct chap_server_state *ss = cv->ss;
+
+	prof_end(PROF_AUTH);
+	/* the link went down in the meantime */
+	if (cv->seq != ss->verify_seq) {
+		free(cv);
 		return;
+	}
+	ss->flags &= ~VERIFY_PENDING;
+	memcpy(ss->message, cv->message, sizeof(ss->message));
+	if (!ok || !auth_number()) {
+		ss->flags |= AUTH_FAILED;
+		warn("Peer %q failed CHAP authentication", cv->name);
+	}
+	chap_send_result(ss, cv->id, cv->name, cv->session_ok);
+	BZERO(cv, sizeof(*cv));
+	free(cv);
+}
+
+/*
+ * chap_send_result - tell the peer how its response went, and if it
+ * was to the current challenge, act on that.
+ */
+static void
+chap_send_result(struct chap_server_state *ss, int id, char *name,
+		 int session_ok)
+{
+	int mlen, len;
+	unsigned char *p;
 
 	/* send the response */
 	p = outpacket_buf;
@@ -406,21 +529,10 @@ chap_handle_response(struct chap_server_state *ss, int id,
 
 	if (ss->flags & CHALLENGE_VALID) {
 		ss->flags &= ~CHALLENGE_VALID;
-		if (!(ss->flags & AUTH_DONE) && !(ss->flags & AUTH_FAILED)) {
-		    /*
-		     * Auth is OK, so now we need to check session restrictions
-		     * to ensure everything is OK, but only if we used a
-		     * plugin, and only if we're configured to check.  This
-		     * allows us to do PAM checks on PPP servers that
-		     * authenticate against ActiveDirectory, and use AD for
-		     * account info (like when using Winbind integrated with
-		     * PAM).
-		     */
-		    if (session_mgmt &&
-			session_check(name, NULL, devnam, NULL) == 0) {
+		if (!(ss->flags & AUTH_DONE) && !(ss->flags & AUTH_FAILED)
+		    && !session_ok) {
 			ss->flags |= AUTH_FAILED;
 			warn("Peer %q failed CHAP Session verification", name);
-		    }
 		}
 		if (ss->flags & AUTH_FAILED) {
 			auth_peer_fail(0, PPP_CHAP);
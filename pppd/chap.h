@@ -150,6 +150,13 @@ typedef int (chap_verify_hook_fn)(char *name, char *ourname, int id,
 			char *message, int message_space);
 extern chap_verify_hook_fn *chap_verify_hook;
 
+/*
+ * A plugin whose chap_verify_hook may block for a while, and doesn't touch
+ *   anything the main loop uses, can set this to have the hook run on the
+ *   offload thread (see ppp_offload) while pppd gets on with other things.
+ */
+extern bool chap_verify_hook_offload;
+
 /* Called by digest code to register a digest type */
 extern void chap_register_digest(struct chap_digest_type *);
 
@@ -536,9 +536,9 @@ ChallengeHash(u_char PeerChallenge[16], u_char *rchallenge,
 	      char *username, u_char Challenge[8])
     
 {
-    PPP_MD_CTX* ctx;
+    struct iovec iov[3];
     u_char	hash[SHA_DIGEST_LENGTH];
-    int     hash_len;
+    unsigned int hash_len;
     const char *user;
 
     /* remove domain from "domain\username" */
@@ -546,30 +546,15 @@ ChallengeHash(u_char PeerChallenge[16], u_char *rchallenge,
 	++user;
     else
 	user = username;
-    
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, PeerChallenge, 16)) {
-
-                if (PPP_DigestUpdate(ctx, rchallenge, 16)) {
-
-                    if (PPP_DigestUpdate(ctx, user, strlen(user))) {
-                        
-                        hash_len = SHA_DIGEST_LENGTH;
-                        if (PPP_DigestFinal(ctx, hash, &hash_len)) {
-
-                            BCOPY(hash, Challenge, 8);
-                        }
-                    }
-                }
-            }
-        }
 
-        PPP_MD_CTX_free(ctx);
-    }
+    iov[0].iov_base = PeerChallenge;
+    iov[0].iov_len = 16;
+    iov[1].iov_base = rchallenge;
+    iov[1].iov_len = 16;
+    iov[2].iov_base = (char *) user;
+    iov[2].iov_len = strlen(user);
+    if (PPP_Digest(PPP_sha1(), iov, 3, hash, &hash_len))
+	BCOPY(hash, Challenge, 8);
 }
 
 /*
@@ -592,20 +577,12 @@ ascii2unicode(char ascii[], int ascii_len, u_char unicode[])
 static void
 NTPasswordHash(u_char *secret, int secret_len, unsigned char* hash)
 {
-    PPP_MD_CTX* ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_md4())) {
-
-            if (PPP_DigestUpdate(ctx, secret, secret_len)) {
+    struct iovec iov;
+    unsigned int hash_len;
 
-                int hash_len = MD4_DIGEST_LENGTH;
-                PPP_DigestFinal(ctx, hash, &hash_len);
-            }
-        }
-        
-        PPP_MD_CTX_free(ctx);
-    }
+    iov.iov_base = secret;
+    iov.iov_len = secret_len;
+    PPP_Digest(PPP_md4(), &iov, 1, hash, &hash_len);
 }
 
 static void
@@ -685,53 +662,28 @@ GenerateAuthenticatorResponse(unsigned char* PasswordHashHash,
 	  0x6E };
 
     int		i;
-    PPP_MD_CTX *ctx;
+    struct iovec iov[3];
     u_char	Digest[SHA_DIGEST_LENGTH];
-    int     hash_len;
+    unsigned int hash_len;
     u_char	Challenge[8];
 
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
+    iov[0].iov_base = PasswordHashHash;
+    iov[0].iov_len = MD4_DIGEST_LENGTH;
+    iov[1].iov_base = NTResponse;
+    iov[1].iov_len = 24;
+    iov[2].iov_base = Magic1;
+    iov[2].iov_len = sizeof(Magic1);
+    PPP_Digest(PPP_sha1(), iov, 3, Digest, &hash_len);
 
-            if (PPP_DigestUpdate(ctx, PasswordHashHash, MD4_DIGEST_LENGTH)) {
-
-                if (PPP_DigestUpdate(ctx, NTResponse, 24)) {
-
-                    if (PPP_DigestUpdate(ctx, Magic1, sizeof(Magic1))) {
-                        
-                        hash_len = sizeof(Digest);
-                        PPP_DigestFinal(ctx, Digest, &hash_len);
-                    }
-                }
-            }
-        }
-        PPP_MD_CTX_free(ctx);
-    }
-    
     ChallengeHash(PeerChallenge, rchallenge, username, Challenge);
 
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, Digest, sizeof(Digest))) {
-
-                if (PPP_DigestUpdate(ctx, Challenge, sizeof(Challenge))) {
-
-                    if (PPP_DigestUpdate(ctx, Magic2, sizeof(Magic2))) {
-                        
-                        hash_len = sizeof(Digest);
-                        PPP_DigestFinal(ctx, Digest, &hash_len);
-                    }
-                }
-            }
-        }
-
-        PPP_MD_CTX_free(ctx);
-    }
+    iov[0].iov_base = Digest;
+    iov[0].iov_len = sizeof(Digest);
+    iov[1].iov_base = Challenge;
+    iov[1].iov_len = sizeof(Challenge);
+    iov[2].iov_base = Magic2;
+    iov[2].iov_len = sizeof(Magic2);
+    PPP_Digest(PPP_sha1(), iov, 3, Digest, &hash_len);
 
     /* Convert to ASCII hex string. */
     for (i = 0; i < MAX((MS_AUTH_RESPONSE_LENGTH / 2), sizeof(Digest)); i++) {
@@ -842,14 +794,12 @@ ChapMS2(unsigned char *rchallenge, unsigned char *PeerChallenge,
 {
     /* ARGSUSED */
     u_char *p = &response[MS_CHAP2_PEER_CHALLENGE];
-    int i;
 
     BZERO(response, MS_CHAP2_RESPONSE_LEN);
 
     /* Generate the Peer-Challenge if requested, or copy it if supplied. */
     if (!PeerChallenge)
-	for (i = 0; i < MS_CHAP2_PEER_CHAL_LEN; i++)
-	    *p++ = (u_char) (drand48() * 0xff);
+	random_bytes(p, MS_CHAP2_PEER_CHAL_LEN);
     else
 	BCOPY(PeerChallenge, &response[MS_CHAP2_PEER_CHALLENGE],
 	      MS_CHAP2_PEER_CHAL_LEN);
@@ -0,0 +1,350 @@
+/*
+ * control.c - take commands on a unix socket while the link runs.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/param.h>
+
+#include "pppd-private.h"
+#include "fsm.h"
+#include "lcp.h"
+#include "ipcp.h"
+
+/*
+ * The control-socket option names a unix socket on which pppd takes
+ * commands while it runs, as an alternative to sending it signals
+ * which can't carry an argument or a reply.  A client connects,
+ * writes one command line, reads the reply up to end of file and
+ * is done.  The socket is served from the event loop like any other
+ * fd, so a command is carried out between packets, just as a signal
+ * is, and never in the middle of handling one.
+ *
+ * Only root can connect, since the socket is made mode 0600.
+ */
+char	control_path[MAXPATHLEN];	/* socket to take commands on */
+
+#define CONTROL_MAX_CONN	4	/* connections waiting for a command */
+#define CONTROL_LINE_MAX	256
+#define CONTROL_REPLY_MAX	32768	/* big enough for the whole trace */
+
+static int control_fd = -1;
+static int control_nconn;
+static char control_name[MAXPATHLEN];	/* control_path, or with our pid */
+
+struct control_reply {
+    char buf[CONTROL_REPLY_MAX];
+    int len;
+};
+
+static void control_accept(int, void *);
+
+/*
+ * control_line - printer_func which adds one line to a reply.
+ */
+static void
+control_line(void *arg, char *fmt, ...)
+{
+    struct control_reply *r = arg;
+    va_list args;
+    int room;
+
+    room = sizeof(r->buf) - r->len - 1;
+    if (room <= 0)
+	return;
+    va_start(args, fmt);
+    r->len += vslprintf(r->buf + r->len, room + 1, fmt, args);
+    va_end(args);
+    r->buf[r->len++] = '\n';
+}
+
+static void
+control_status(struct control_reply *r)
+{
+    control_line(r, "pid %d", getpid());
+    control_line(r, "phase %s", phase_name(phase));
+    if (ifname[0])
+	control_line(r, "interface %s", ifname);
+    if (peer_authname[0])
+	control_line(r, "peer %q", peer_authname);
+    if (ipcp_fsm[0].state == OPENED) {
+	control_line(r, "local %I", ipcp_gotoptions[0].ouraddr);
+	control_line(r, "remote %I", ipcp_hisoptions[0].hisaddr);
+    }
+    if (phase == PHASE_RUNNING)
+	control_line(r, "uptime %d", link_uptime());
+    if (ppp_get_max_connect_time() > 0)
+	control_line(r, "limit time %d", ppp_get_max_connect_time());
+    if (maxoctets > 0)
+	control_line(r, "limit octets %u", maxoctets);
+}
+
+static void
+control_stats(struct control_reply *r)
+{
+    ppp_link_stats_st stats;
+
+    if (!ppp_get_link_stats(&stats)) {
+	control_line(r, "error link is not up");
+	return;
+    }
+    control_line(r, "bytes_in %lu", (unsigned long) stats.bytes_in);
+    control_line(r, "bytes_out %lu", (unsigned long) stats.bytes_out);
+    control_line(r, "pkts_in %u", stats.pkts_in);
+    control_line(r, "pkts_out %u", stats.pkts_out);
+    control_line(r, "uptime %d", link_uptime());
+    if (lcp_echo_rtt(0) > 0)
+	control_line(r, "echo_rtt_us %u", lcp_echo_rtt(0));
+}
+
+/*
+ * control_limit - "limit time N" or "limit octets N [in|out|sum|max]",
+ * with 0 to lift the limit.  A change takes effect at once on a link
+ * that is up.
+ */
+static void
+control_limit(struct control_reply *r, char *what, char *val, char *dir)
+{
+    static const char *dirs[] = { "sum", "in", "out", "max" };
+    unsigned long n;
+    char *end;
+    int d = -1;
+
+    if (what == NULL || val == NULL) {
+	control_line(r, "error usage: limit time|octets n [in|out|sum|max]");
+	return;
+    }
+    n = strtoul(val, &end, 10);
+    if (*end != 0 || end == val || n > UINT32_MAX) {
+	control_line(r, "error bad number %s", val);
+	return;
+    }
+    if (dir != NULL) {
+	for (d = sizeof(dirs) / sizeof(dirs[0]) - 1; d >= 0; --d)
+	    if (strcmp(dir, dirs[d]) == 0)
+		break;
+	if (d < 0 || strcmp(what, "octets") != 0) {
+	    control_line(r, "error bad direction %s", dir);
+	    return;
+	}
+    }
+    if (strcmp(what, "time") == 0) {
+	if (n > INT_MAX) {
+	    control_line(r, "error bad number %s", val);
+	    return;
+	}
+	ppp_set_max_connect_time(n);
+    } else if (strcmp(what, "octets") == 0) {
+	ppp_set_session_limit(n);
+	if (d >= 0)
+	    ppp_set_session_limit_dir(d);
+    } else {
+	control_line(r, "error unknown limit %s", what);
+	return;
+    }
+    notice("Control socket set %s limit to %lu", what, n);
+    auth_limits_changed();
+    control_line(r, "ok");
+}
+
+/*
+ * control_command - carry out one command line, leaving the reply
+ * in r.
+ */
+static void
+control_command(char *line, struct control_reply *r)
+{
+    char *argv[5];
+    int argc;
+    char *p;
+
+    argc = 0;
+    for (p = strtok(line, " \t\r\n"); p != NULL && argc < 5;
+	 p = strtok(NULL, " \t\r\n"))
+	argv[argc++] = p;
+    if (argc == 0) {
+	control_line(r, "error no command");
+	return;
+    }
+    while (argc < 5)
+	argv[argc++] = NULL;
+
+    if (strcmp(argv[0], "status") == 0) {
+	control_status(r);
+    } else if (strcmp(argv[0], "stats") == 0) {
+	control_stats(r);
+    } else if (strcmp(argv[0], "trace") == 0) {
+	trace_print(control_line, r);
+    } else if (strcmp(argv[0], "memory") == 0) {
+	mem_print(control_line, r);
+#ifdef PPP_WITH_PROFILING
+    } else if (strcmp(argv[0], "profile") == 0) {
+	prof_print(control_line, r);
+#endif
+    } else if (strcmp(argv[0], "limit") == 0) {
+	control_limit(r, argv[1], argv[2], argv[3]);
+    } else if (strcmp(argv[0], "ccp") == 0) {
+	if (phase != PHASE_NETWORK && phase != PHASE_RUNNING) {
+	    control_line(r, "error link is not up");
+	    return;
+	}
+	open_ccp_flag = 1;
+	control_line(r, "ok");
+    } else if (strcmp(argv[0], "hangup") == 0) {
+	notice("Hangup requested on control socket");
+	kill_link = 1;
+	control_line(r, "ok");
+    } else {
+	control_line(r, "error unknown command %s", argv[0]);
+    }
+}
+
+/*
+ * control_conn - a connection has sent its command, or gone away.
+ */
+static void
+control_conn(int fd, void *arg)
+{
+    static struct control_reply reply;
+    char line[CONTROL_LINE_MAX];
+    char *p;
+    int n;
+
+    n = read(fd, line, sizeof(line) - 1);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+	return;
+    if (n > 0) {
+	line[n] = 0;
+	if ((p = strchr(line, '\n')) != NULL)
+	    *p = 0;
+	reply.len = 0;
+	control_command(line, &reply);
+	/* the reply fits in the socket buffer, so this doesn't wait */
+	if (write(fd, reply.buf, reply.len) < 0)
+	    dbglog("control socket reply: %m");
+    }
+    ppp_remove_fd_handler(fd);
+    close(fd);
+    if (control_nconn-- == CONTROL_MAX_CONN)
+	ppp_add_fd_handler(control_fd, control_accept, NULL);
+}
+
+/*
+ * control_accept - take a new connection, and wait for its command.
+ */
+static void
+control_accept(int fd, void *arg)
+{
+    int conn;
+
+    conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+	if (errno != EAGAIN && errno != EINTR)
+	    error("control socket accept: %m");
+	return;
+    }
+    fcntl(conn, F_SETFD, FD_CLOEXEC);
+    fcntl(conn, F_SETFL, fcntl(conn, F_GETFL) | O_NONBLOCK);
+    ppp_add_fd_handler(conn, control_conn, NULL);
+    /* don't take more until one of these is done */
+    if (++control_nconn == CONTROL_MAX_CONN)
+	ppp_remove_fd_handler(control_fd);
+}
+
+static void
+control_exit(void *arg, int val)
+{
+    if (control_fd >= 0) {
+	close(control_fd);
+	control_fd = -1;
+	unlink(control_name);
+    }
+}
+
+/*
+ * control_start - make the control socket, if one was asked for.
+ * The sessions of a prefork-socket server all have the same options,
+ * so each one adds its pid to the name rather than take over the
+ * others' socket.
+ */
+void
+control_start(void)
+{
+    struct sockaddr_un addr;
+    int sock;
+
+    if (control_path[0] == 0 || control_fd >= 0)
+	return;
+    if (prefork_path[0])
+	slprintf(control_name, sizeof(control_name), "%s.%d",
+		 control_path, getpid());
+    else
+	strlcpy(control_name, control_path, sizeof(control_name));
+    if (strlen(control_name) >= sizeof(addr.sun_path)) {
+	error("control-socket name %s is too long", control_name);
+	return;
+    }
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+	error("Couldn't create control socket: %m");
+	return;
+    }
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, control_name, sizeof(addr.sun_path));
+    unlink(control_name);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	|| chmod(control_name, 0600) < 0 || listen(sock, 8) < 0) {
+	error("Couldn't listen on %s: %m", control_name);
+	close(sock);
+	return;
+    }
+    control_fd = sock;
+    ppp_add_fd_handler(sock, control_accept, NULL);
+    ppp_add_notify(NF_EXIT, control_exit, NULL);
+    info("Taking commands on %s", control_name);
+}
@@ -34,12 +34,25 @@
 #define MAX_KEY_SIZE 32
 #define MAX_IV_SIZE 32
 
+/*
+ * The one-shot digests keep a context for each thread that uses them,
+ * where the compiler can; without, they don't keep one at all.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define PPP_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__)
+#define PPP_THREAD_LOCAL __thread
+#endif
+
 struct _PPP_MD
 {
     int  (*init_fn)(PPP_MD_CTX *ctx);
     int  (*update_fn)(PPP_MD_CTX *ctx, const void *data, size_t cnt);
     int  (*final_fn)(PPP_MD_CTX *ctx, unsigned char *out, unsigned int *outlen);
     void (*clean_fn)(PPP_MD_CTX *ctx);
+    /* optional: PPP_Digest without a PPP_MD_CTX */
+    int  (*digest_fn)(const struct iovec *iov, int iovcnt,
+                      unsigned char *out, unsigned int *outlen);
 };
 
 struct _PPP_MD_CTX
@@ -43,6 +43,7 @@
 #endif
 
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/err.h>
 #include <openssl/provider.h>
 struct crypto_ctx {
 
@@ -51,6 +52,14 @@ struct crypto_ctx {
 } g_crypto_ctx;
 #endif
 
+/*
+ * Loading OpenSSL's providers reads its configuration and maps the
+ * legacy module, which sessions that never use CHAP, EAP or MPPE
+ * needn't pay for; so it is done the first time a digest or cipher
+ * is set up, if PPP_crypto_init hasn't been called by then.
+ */
+static int crypto_inited;
+
 PPP_MD_CTX *PPP_MD_CTX_new()
 {
     return (PPP_MD_CTX*) calloc(1, sizeof(PPP_MD_CTX));
@@ -68,6 +77,9 @@ void PPP_MD_CTX_free(PPP_MD_CTX* ctx)
 
 int PPP_DigestInit(PPP_MD_CTX *ctx, const PPP_MD *type)
 {
+    if (!crypto_inited) {
+        PPP_crypto_init();
+    }
     if (ctx) {
         ctx->md = *type;
         if (ctx->md.init_fn) {
@@ -93,6 +105,33 @@ int PPP_DigestFinal(PPP_MD_CTX *ctx, unsigned char *out, unsigned int *outlen)
     return 0;
 }
 
+int PPP_Digest(const PPP_MD *type, const struct iovec *iov, int iovcnt,
+        unsigned char *out, unsigned int *outlen)
+{
+    PPP_MD_CTX *ctx;
+    int i, retval = 0;
+
+    if (type->digest_fn) {
+        return type->digest_fn(iov, iovcnt, out, outlen);
+    }
+
+    ctx = PPP_MD_CTX_new();
+    if (ctx) {
+        if (PPP_DigestInit(ctx, type)) {
+            for (i = 0; i < iovcnt; i++) {
+                if (!PPP_DigestUpdate(ctx, iov[i].iov_base, iov[i].iov_len)) {
+                    break;
+                }
+            }
+            if (i == iovcnt) {
+                retval = PPP_DigestFinal(ctx, out, outlen);
+            }
+        }
+        PPP_MD_CTX_free(ctx);
+    }
+    return retval;
+}
+
 PPP_CIPHER_CTX *PPP_CIPHER_CTX_new(void)
 {
     return calloc(1, sizeof(PPP_CIPHER_CTX));
@@ -112,6 +151,9 @@ void PPP_CIPHER_CTX_free(PPP_CIPHER_CTX *ctx)
 
 int PPP_CipherInit(PPP_CIPHER_CTX *ctx, const PPP_CIPHER *cipher, const unsigned char *key, const unsigned char *iv, int encr)
 {
+    if (!crypto_inited) {
+        PPP_crypto_init();
+    }
     if (ctx && cipher) {
         ctx->is_encr = encr;
         ctx->cipher = *cipher;
@@ -143,11 +185,20 @@ int PPP_crypto_init()
 {
     int retval = 0;
 
+    if (crypto_inited) {
+        return 1;
+    }
+    crypto_inited = 1;
+
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    /*
+     * MD4 and DES live in the legacy provider, but if it isn't there,
+     * ppp-md4.c and ppp-des.c use their own.
+     */
     g_crypto_ctx.legacy = OSSL_PROVIDER_load(NULL, "legacy");
     if (g_crypto_ctx.legacy == NULL)
     {
-        goto done;
+        ERR_clear_error();
     }
 
     g_crypto_ctx.provider = OSSL_PROVIDER_load(NULL, "default");
@@ -165,6 +216,7 @@ done:
 
 int PPP_crypto_deinit()
 {
+    crypto_inited = 0;
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
     if (g_crypto_ctx.legacy) {
         OSSL_PROVIDER_unload(g_crypto_ctx.legacy);
@@ -227,6 +279,22 @@ int test_md4()
         PPP_MD_CTX_free(ctx);
     }
 
+    /* the same thing in one call, from two pieces */
+    if (success) {
+        struct iovec iov[2] = {
+            { data, 10 },
+            { data + 10, sizeof(data) - 10 },
+        };
+
+        success = 0;
+        memset(hash, 0, sizeof(hash));
+        hash_len = sizeof(hash);
+        if (PPP_Digest(PPP_md4(), iov, 2, hash, &hash_len)
+            && memcmp(hash, result, MD4_DIGEST_LENGTH) == 0) {
+            success = 1;
+        }
+    }
+
     return success;
 }
 
@@ -275,6 +343,22 @@ int test_md5()
         PPP_MD_CTX_free(ctx);
     }
 
+    /* the same thing in one call, from two pieces */
+    if (success) {
+        struct iovec iov[2] = {
+            { data, 10 },
+            { data + 10, sizeof(data) - 10 },
+        };
+
+        success = 0;
+        memset(hash, 0, sizeof(hash));
+        hash_len = sizeof(hash);
+        if (PPP_Digest(PPP_md5(), iov, 2, hash, &hash_len)
+            && memcmp(hash, result, MD5_DIGEST_LENGTH) == 0) {
+            success = 1;
+        }
+    }
+
     return success;
 }
 
@@ -324,6 +408,22 @@ int test_sha()
         PPP_MD_CTX_free(ctx);
     }
 
+    /* the same thing in one call, from two pieces */
+    if (success) {
+        struct iovec iov[2] = {
+            { data, 10 },
+            { data + 10, sizeof(data) - 10 },
+        };
+
+        success = 0;
+        memset(hash, 0, sizeof(hash));
+        hash_len = sizeof(hash);
+        if (PPP_Digest(PPP_sha1(), iov, 2, hash, &hash_len)
+            && memcmp(hash, result, SHA_DIGEST_LENGTH) == 0) {
+            success = 1;
+        }
+    }
+
     return success;
 }
 
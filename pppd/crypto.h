@@ -30,6 +30,8 @@
 #ifndef PPP_CRYPTO_H
 #define PPP_CRYPTO_H
 
+#include <sys/uio.h>
+
 #ifndef MD5_DIGEST_LENGTH
 #define MD5_DIGEST_LENGTH 16
 #endif
@@ -91,6 +93,13 @@ int PPP_DigestUpdate(PPP_MD_CTX *ctx,
 int PPP_DigestFinal(PPP_MD_CTX *ctx,
         unsigned char *out, unsigned int *outlen);
 
+/*
+ * Compute the digest of the iovcnt buffers in iov, one after another,
+ * without the caller needing a context object
+ */
+int PPP_Digest(const PPP_MD *type, const struct iovec *iov, int iovcnt,
+        unsigned char *out, unsigned int *outlen);
+
 
 struct _PPP_CIPHER_CTX;
 struct _PPP_CIPHER;
@@ -143,7 +152,8 @@ int PPP_CipherFinal(PPP_CIPHER_CTX *ctx,
         unsigned char *out, int *outl);
 
 /*
- * Global initialization, must be called once per process
+ * Global initialization.  The first PPP_DigestInit or PPP_CipherInit
+ * does this if it hasn't been done; calling it again does nothing.
  */
 int PPP_crypto_init();
 
@@ -52,6 +52,7 @@
 #endif
 
 #include "pppd-private.h"
+#include "fcs.h"
 #include "fsm.h"
 #include "ipcp.h"
 #include "lcp.h"
@@ -64,14 +65,29 @@ int escape_flag;
 int flush_flag;
 int fcs;
 
+/*
+ * Frames waiting for the link to come up are kept one after another
+ * in pend_buf, from pend_head to pend_tail, each after a struct packet
+ * giving its length.  When there isn't room for another, the oldest
+ * ones are dropped to make room.
+ */
 struct packet {
     int length;
-    struct packet *next;
-    unsigned char data[1];
+    unsigned char data[];
 };
 
-struct packet *pend_q;
-struct packet *pend_qtail;
+#define PEND_ALIGN(n)	(((n) + sizeof(int) - 1) & ~(sizeof(int) - 1))
+#define PEND_RECLEN(len) PEND_ALIGN(sizeof(struct packet) + (len))
+
+static unsigned char *pend_buf;
+static int pend_size;		/* bytes in pend_buf */
+static int pend_head;		/* offset of the oldest frame */
+static int pend_tail;		/* offset just past the newest */
+static int pend_dropped;	/* frames dropped for lack of room */
+
+#ifdef PPP_WITH_FILTER
+static int kernel_pass_filter;	/* the driver applies pass_filter */
+#endif
 
 static int active_packet(unsigned char *, int);
 
@@ -92,7 +108,14 @@ demand_conf(void)
     if (frame == NULL)
 	novm("demand frame");
     framelen = 0;
-    pend_q = NULL;
+    pend_size = demand_queue;
+    if (pend_size > 0) {
+	pend_buf = malloc(pend_size);
+	if (pend_buf == NULL)
+	    novm("demand queue");
+    }
+    pend_head = pend_tail = 0;
+    pend_dropped = 0;
     escape_flag = 0;
     flush_flag = 0;
     fcs = PPP_INITFCS;
@@ -103,7 +126,7 @@ demand_conf(void)
 	    fatal("Couldn't set up demand-dialled PPP interface: %m");
 
 #ifdef PPP_WITH_FILTER
-    set_filters(&pass_filter, &active_filter);
+    kernel_pass_filter = set_filters(&pass_filter, &active_filter);
 #endif
 
     /*
@@ -138,7 +161,6 @@ demand_block(void)
 void
 demand_discard(void)
 {
-    struct packet *pkt, *nextpkt;
     int i;
     struct protent *protp;
 
@@ -148,11 +170,8 @@ demand_discard(void)
     get_loop_output();
 
     /* discard all saved packets */
-    for (pkt = pend_q; pkt != NULL; pkt = nextpkt) {
-	nextpkt = pkt->next;
-	free(pkt);
-    }
-    pend_q = NULL;
+    pend_head = pend_tail = 0;
+    pend_dropped = 0;
     framelen = 0;
     flush_flag = 0;
     escape_flag = 0;
@@ -173,45 +192,6 @@ demand_unblock(void)
 	    sifnpmode(0, protp->protocol & ~0x8000, NPMODE_PASS);
 }
 
-/*
- * FCS lookup table as calculated by genfcstab.
- */
-static u_short fcstab[256] = {
-	0x0000,	0x1189,	0x2312,	0x329b,	0x4624,	0x57ad,	0x6536,	0x74bf,
-	0x8c48,	0x9dc1,	0xaf5a,	0xbed3,	0xca6c,	0xdbe5,	0xe97e,	0xf8f7,
-	0x1081,	0x0108,	0x3393,	0x221a,	0x56a5,	0x472c,	0x75b7,	0x643e,
-	0x9cc9,	0x8d40,	0xbfdb,	0xae52,	0xdaed,	0xcb64,	0xf9ff,	0xe876,
-	0x2102,	0x308b,	0x0210,	0x1399,	0x6726,	0x76af,	0x4434,	0x55bd,
-	0xad4a,	0xbcc3,	0x8e58,	0x9fd1,	0xeb6e,	0xfae7,	0xc87c,	0xd9f5,
-	0x3183,	0x200a,	0x1291,	0x0318,	0x77a7,	0x662e,	0x54b5,	0x453c,
-	0xbdcb,	0xac42,	0x9ed9,	0x8f50,	0xfbef,	0xea66,	0xd8fd,	0xc974,
-	0x4204,	0x538d,	0x6116,	0x709f,	0x0420,	0x15a9,	0x2732,	0x36bb,
-	0xce4c,	0xdfc5,	0xed5e,	0xfcd7,	0x8868,	0x99e1,	0xab7a,	0xbaf3,
-	0x5285,	0x430c,	0x7197,	0x601e,	0x14a1,	0x0528,	0x37b3,	0x263a,
-	0xdecd,	0xcf44,	0xfddf,	0xec56,	0x98e9,	0x8960,	0xbbfb,	0xaa72,
-	0x6306,	0x728f,	0x4014,	0x519d,	0x2522,	0x34ab,	0x0630,	0x17b9,
-	0xef4e,	0xfec7,	0xcc5c,	0xddd5,	0xa96a,	0xb8e3,	0x8a78,	0x9bf1,
-	0x7387,	0x620e,	0x5095,	0x411c,	0x35a3,	0x242a,	0x16b1,	0x0738,
-	0xffcf,	0xee46,	0xdcdd,	0xcd54,	0xb9eb,	0xa862,	0x9af9,	0x8b70,
-	0x8408,	0x9581,	0xa71a,	0xb693,	0xc22c,	0xd3a5,	0xe13e,	0xf0b7,
-	0x0840,	0x19c9,	0x2b52,	0x3adb,	0x4e64,	0x5fed,	0x6d76,	0x7cff,
-	0x9489,	0x8500,	0xb79b,	0xa612,	0xd2ad,	0xc324,	0xf1bf,	0xe036,
-	0x18c1,	0x0948,	0x3bd3,	0x2a5a,	0x5ee5,	0x4f6c,	0x7df7,	0x6c7e,
-	0xa50a,	0xb483,	0x8618,	0x9791,	0xe32e,	0xf2a7,	0xc03c,	0xd1b5,
-	0x2942,	0x38cb,	0x0a50,	0x1bd9,	0x6f66,	0x7eef,	0x4c74,	0x5dfd,
-	0xb58b,	0xa402,	0x9699,	0x8710,	0xf3af,	0xe226,	0xd0bd,	0xc134,
-	0x39c3,	0x284a,	0x1ad1,	0x0b58,	0x7fe7,	0x6e6e,	0x5cf5,	0x4d7c,
-	0xc60c,	0xd785,	0xe51e,	0xf497,	0x8028,	0x91a1,	0xa33a,	0xb2b3,
-	0x4a44,	0x5bcd,	0x6956,	0x78df,	0x0c60,	0x1de9,	0x2f72,	0x3efb,
-	0xd68d,	0xc704,	0xf59f,	0xe416,	0x90a9,	0x8120,	0xb3bb,	0xa232,
-	0x5ac5,	0x4b4c,	0x79d7,	0x685e,	0x1ce1,	0x0d68,	0x3ff3,	0x2e7a,
-	0xe70e,	0xf687,	0xc41c,	0xd595,	0xa12a,	0xb0a3,	0x8238,	0x93b1,
-	0x6b46,	0x7acf,	0x4854,	0x59dd,	0x2d62,	0x3ceb,	0x0e70,	0x1ff9,
-	0xf78f,	0xe606,	0xd49d,	0xc514,	0xb1ab,	0xa022,	0x92b9,	0x8330,
-	0x7bc7,	0x6a4e,	0x58d5,	0x495c,	0x3de3,	0x2c6a,	0x1ef1,	0x0f78
-};
-#define PPP_FCS(fcs, c)	(((fcs) >> 8) ^ fcstab[((fcs) ^ (c)) & 0xff])
-
 /*
  * loop_chars - process characters received from the loopback.
  * Calls loop_frame when a complete frame has been accumulated.
@@ -220,10 +200,30 @@ static u_short fcstab[256] = {
 int
 loop_chars(unsigned char *p, int n)
 {
-    int c, rv;
+    int c, rv, run;
 
     rv = 0;
     for (; n > 0; --n) {
+	/*
+	 * Copy whatever comes before the next flag or escape in one go.
+	 */
+	if (!escape_flag && !flush_flag) {
+	    for (run = 0; run < n && p[run] != PPP_FLAG
+		     && p[run] != PPP_ESCAPE; ++run)
+		;
+	    if (run > framemax - framelen)
+		run = framemax - framelen;
+	    if (run > 0) {
+		memcpy(frame + framelen, p, run);
+		fcs = ppp_fcs16(fcs, p, run);
+		framelen += run;
+		p += run;
+		n -= run;
+		if (n == 0)
+		    break;
+	    }
+	}
+
 	c = *p++;
 	if (c == PPP_FLAG) {
 	    if (!escape_flag && !flush_flag
@@ -252,7 +252,7 @@ loop_chars(unsigned char *p, int n)
 	    continue;
 	}
 	frame[framelen++] = c;
-	fcs = PPP_FCS(fcs, c);
+	fcs = ppp_fcs16(fcs, (unsigned char *) frame + framelen - 1, 1);
     }
     return rv;
 }
@@ -262,8 +262,9 @@ loop_chars(unsigned char *p, int n)
  * decide whether to bring up the link or not, and, if we want
  * to transmit this frame later, put it on the pending queue.
  * Return value is 1 if we need to bring up the link, 0 otherwise.
- * We assume that the kernel driver has already applied the
- * pass_filter, so we won't get packets it rejected.
+ * If the kernel driver took our filters, it has already applied
+ * the pass_filter, so we won't get packets it rejected; otherwise
+ * we apply it here.
  * We apply the active_filter to see if we want this packet to
  * bring up the link.
  */
@@ -271,6 +272,7 @@ int
 loop_frame(unsigned char *frame, int len)
 {
     struct packet *pkt;
+    int reclen;
 
     /* dbglog("from loop: %P", frame, len); */
     if (len < PPP_HDRLEN)
@@ -280,17 +282,26 @@ loop_frame(unsigned char *frame, int len)
     if (!active_packet(frame, len))
 	return 0;
 
-    pkt = (struct packet *) malloc(sizeof(struct packet) + len);
-    if (pkt != NULL) {
-	pkt->length = len;
-	pkt->next = NULL;
-	memcpy(pkt->data, frame, len);
-	if (pend_q == NULL)
-	    pend_q = pkt;
-	else
-	    pend_qtail->next = pkt;
-	pend_qtail = pkt;
+    reclen = PEND_RECLEN(len);
+    if (reclen > pend_size) {
+	++pend_dropped;
+	return 1;
+    }
+    while (pend_tail - pend_head + reclen > pend_size) {
+	/* drop the oldest */
+	pkt = (struct packet *) (pend_buf + pend_head);
+	pend_head += PEND_RECLEN(pkt->length);
+	++pend_dropped;
     }
+    if (pend_tail + reclen > pend_size) {
+	memmove(pend_buf, pend_buf + pend_head, pend_tail - pend_head);
+	pend_tail -= pend_head;
+	pend_head = 0;
+    }
+    pkt = (struct packet *) (pend_buf + pend_tail);
+    pkt->length = len;
+    memcpy(pkt->data, frame, len);
+    pend_tail += reclen;
     return 1;
 }
 
@@ -301,27 +312,38 @@ loop_frame(unsigned char *frame, int len)
 void
 demand_rexmit(int proto)
 {
-    struct packet *pkt, *prev, *nextpkt;
+    struct packet *pkt;
+    int pos, keep, reclen, n, bytes;
 
-    prev = NULL;
-    pkt = pend_q;
-    pend_q = NULL;
-    for (; pkt != NULL; pkt = nextpkt) {
-	nextpkt = pkt->next;
+    /*
+     * Send this protocol's frames, and move the others up to keep
+     * them.  Nothing is logged until they have all gone, so the
+     * first one goes out as soon as the link is up.
+     */
+    keep = 0;
+    n = bytes = 0;
+    for (pos = pend_head; pos < pend_tail; pos += reclen) {
+	pkt = (struct packet *) (pend_buf + pos);
+	reclen = PEND_RECLEN(pkt->length);
 	if (PPP_PROTOCOL(pkt->data) == proto) {
-	    output(0, pkt->data, pkt->length);
-	    free(pkt);
+	    output_frame(0, pkt->data, pkt->length);
+	    ++n;
+	    bytes += pkt->length;
 	} else {
-	    if (prev == NULL)
-		pend_q = pkt;
-	    else
-		prev->next = pkt;
-	    prev = pkt;
+	    memmove(pend_buf + keep, pkt, reclen);
+	    keep += reclen;
 	}
     }
-    pend_qtail = prev;
-    if (prev != NULL)
-	prev->next = NULL;
+    pend_head = 0;
+    pend_tail = keep;
+
+    if (n > 0)
+	dbglog("sent %d queued packets (%d bytes) for protocol 0x%x",
+	       n, bytes, proto);
+    if (pend_dropped) {
+	info("%d packets were dropped while the link came up", pend_dropped);
+	pend_dropped = 0;
+    }
 }
 
 /*
@@ -339,7 +361,7 @@ active_packet(unsigned char *p, int len)
     proto = PPP_PROTOCOL(p);
 #ifdef PPP_WITH_FILTER
     p[0] = 1;		/* outbound packet indicator */
-    if ((pass_filter.bf_len != 0
+    if ((pass_filter.bf_len != 0 && !kernel_pass_filter
 	 && bpf_filter(pass_filter.bf_insns, p, len, len) == 0)
 	|| (active_filter.bf_len != 0
 	    && bpf_filter(active_filter.bf_insns, p, len, len) == 0)) {
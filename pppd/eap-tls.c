@@ -50,6 +50,10 @@
 #include <openssl/ui.h>
 #include <openssl/x509v3.h>
 #include <openssl/pkcs12.h>
+#include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
 
 #include "pppd-private.h"
 #include "tls.h"
@@ -60,6 +64,9 @@
 #include "chap_ms.h"
 #include "mppe.h"
 #include "pathnames.h"
+#ifdef PPP_WITH_TDB
+#include "tdb.h"
+#endif
 
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 #define SSL3_RT_HEADER  0x100
@@ -249,6 +256,349 @@ static int eaptls_UI_reader(UI *ui, UI_STRING *uis) {
 }
 #endif
 
+/*
+ * Server-side session resumption.
+ *
+ * Session tickets are sealed with keys derived from the secret in the
+ * tls-ticket-secret file and the number of the current period of
+ * tls-session-lifetime seconds.  Every pppd sharing the file derives the
+ * same keys, without having to talk to each other, and the keys change
+ * every period.  A ticket sealed in the period before is still taken,
+ * and the peer is given a new one.
+ *
+ * Peers which don't do tickets can resume sessions kept in a tdb
+ * shared by all pppds, with tls-session-cache.
+ */
+#define EAPTLS_TICKET_SECRET_LEN        32
+
+static unsigned char ticket_secret[EAPTLS_TICKET_SECRET_LEN];
+static int have_ticket_secret;
+
+/*
+ * Read the ticket secret, making one up if the file doesn't exist yet.
+ * Whatever is in the file (at least 16 bytes of it) is hashed to make
+ * the secret.
+ */
+static int eaptls_load_ticket_secret(const char *path)
+{
+    unsigned char buf[1024];
+    char tmp[MAXWORDLEN + 16];
+    int fd, n;
+
+    if (have_ticket_secret)
+        return 1;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 && errno == ENOENT) {
+        /* write it somewhere else first, so nobody reads half of it */
+        slprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            error("EAP-TLS: Can't create %s: %m", tmp);
+            return 0;
+        }
+        if (RAND_bytes(buf, EAPTLS_TICKET_SECRET_LEN) != 1
+            || write(fd, buf, EAPTLS_TICKET_SECRET_LEN) != EAPTLS_TICKET_SECRET_LEN
+            || fsync(fd) < 0) {
+            error("EAP-TLS: Can't write %s: %m", tmp);
+            close(fd);
+            unlink(tmp);
+            return 0;
+        }
+        close(fd);
+        /* if another pppd got there first, use theirs */
+        if (link(tmp, path) < 0 && errno != EEXIST)
+            error("EAP-TLS: Can't create %s: %m", path);
+        else
+            dbglog("EAP-TLS: Created session ticket secret %s", path);
+        unlink(tmp);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        error("EAP-TLS: Can't open %s: %m", path);
+        return 0;
+    }
+    n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n < 16) {
+        error("EAP-TLS: %s is too short to be a session ticket secret", path);
+        return 0;
+    }
+    SHA256(buf, n, ticket_secret);
+    OPENSSL_cleanse(buf, sizeof(buf));
+    have_ticket_secret = 1;
+    return 1;
+}
+
+/*
+ * Derive the name and keys of the tickets for a period.  The name is
+ * the first 16 bytes of what is derived for it.
+ */
+static void eaptls_ticket_keys(uint64_t period, unsigned char *name,
+                               unsigned char *aes_key, unsigned char *hmac_key)
+{
+    unsigned char msg[9], out[SHA256_DIGEST_LENGTH];
+    unsigned int len;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        msg[1 + i] = period >> (56 - 8 * i);
+
+    msg[0] = 'n';
+    HMAC(EVP_sha256(), ticket_secret, sizeof(ticket_secret), msg, sizeof(msg), out, &len);
+    memcpy(name, out, 16);
+    msg[0] = 'e';
+    HMAC(EVP_sha256(), ticket_secret, sizeof(ticket_secret), msg, sizeof(msg), aes_key, &len);
+    msg[0] = 'h';
+    HMAC(EVP_sha256(), ticket_secret, sizeof(ticket_secret), msg, sizeof(msg), hmac_key, &len);
+    OPENSSL_cleanse(out, sizeof(out));
+}
+
+/*
+ * Set up cctx to seal a new ticket (enc is 1) or open the one named
+ * key_name, and put the key for its HMAC in hmac_key.  Returns as the
+ * OpenSSL ticket key callback does: 1 if all is well, 2 if the ticket
+ * should be replaced, 0 if it isn't one of ours, and -1 on failure.
+ */
+static int eaptls_ticket_key(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+                             EVP_CIPHER_CTX *cctx, unsigned char *hmac_key,
+                             int enc)
+{
+    unsigned char name[16], aes_key[SHA256_DIGEST_LENGTH];
+    uint64_t period = time(NULL) / tls_session_lifetime;
+    int i, ret = 0;
+
+    if (enc) {
+        eaptls_ticket_keys(period, key_name, aes_key, hmac_key);
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) == 1
+            && EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, aes_key, iv) == 1)
+            ret = 1;
+        else
+            ret = -1;
+    } else {
+        for (i = 0; i < 2 && period >= (uint64_t) i; i++) {
+            eaptls_ticket_keys(period - i, name, aes_key, hmac_key);
+            if (memcmp(name, key_name, sizeof(name)) == 0) {
+                if (EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, aes_key, iv) == 1)
+                    ret = i? 2: 1;
+                else
+                    ret = -1;
+                break;
+            }
+        }
+        if (ret == 0)
+            dbglog("EAP-TLS: Session ticket has expired or isn't ours");
+        /* a TLSv1.3 ticket is only used once, so the peer needs another */
+        if (ret == 1 && SSL_version(ssl) >= TLS1_3_VERSION)
+            ret = 2;
+    }
+    OPENSSL_cleanse(aes_key, sizeof(aes_key));
+    return ret;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int eaptls_ticket_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+                            EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+{
+    unsigned char hmac_key[SHA256_DIGEST_LENGTH];
+    OSSL_PARAM params[3];
+    int ret;
+
+    ret = eaptls_ticket_key(ssl, key_name, iv, cctx, hmac_key, enc);
+    if (ret > 0) {
+        params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+                                                      hmac_key, sizeof(hmac_key));
+        params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                     (char *) "SHA256", 0);
+        params[2] = OSSL_PARAM_construct_end();
+        if (EVP_MAC_CTX_set_params(hctx, params) != 1)
+            ret = -1;
+    }
+    OPENSSL_cleanse(hmac_key, sizeof(hmac_key));
+    return ret;
+}
+#else
+static int eaptls_ticket_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+                            EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc)
+{
+    unsigned char hmac_key[SHA256_DIGEST_LENGTH];
+    int ret;
+
+    ret = eaptls_ticket_key(ssl, key_name, iv, cctx, hmac_key, enc);
+    if (ret > 0 && HMAC_Init_ex(hctx, hmac_key, sizeof(hmac_key), EVP_sha256(), NULL) != 1)
+        ret = -1;
+    OPENSSL_cleanse(hmac_key, sizeof(hmac_key));
+    return ret;
+}
+#endif
+
+#ifdef PPP_WITH_TDB
+/*
+ * The shared session cache.  Each record is keyed by the session ID
+ * and holds the time it expires, then the session in DER.
+ */
+static TDB_CONTEXT *session_db;
+static pid_t session_db_pid;
+static time_t session_db_pruned;
+
+static TDB_CONTEXT *eaptls_session_db(void)
+{
+    /* a forked pppd needs its own */
+    if (session_db != NULL && session_db_pid != getpid()) {
+        if (tdb_reopen(session_db) != 0)
+            session_db = NULL;
+        session_db_pid = getpid();
+    }
+    if (session_db == NULL) {
+        session_db = tdb_open(PPP_PATH_EAPTLS_SESSIONS, 0, TDB_SIPHASH,
+                              O_RDWR | O_CREAT, 0600);
+        if (session_db == NULL)
+            warn("EAP-TLS: Can't open session cache %s: %m",
+                 PPP_PATH_EAPTLS_SESSIONS);
+        session_db_pid = getpid();
+    }
+    return session_db;
+}
+
+static int eaptls_prune_session(TDB_CONTEXT *db, TDB_DATA key, TDB_DATA dbuf,
+                                void *arg)
+{
+    int64_t expires;
+
+    if (dbuf.dsize < sizeof(expires))
+        return tdb_delete(db, key) != 0;
+    memcpy(&expires, dbuf.dptr, sizeof(expires));
+    if (expires <= *(time_t *) arg)
+        tdb_delete(db, key);
+    return 0;
+}
+
+static int eaptls_cache_new(SSL *ssl, SSL_SESSION *sess)
+{
+    TDB_CONTEXT *db = eaptls_session_db();
+    TDB_DATA key, dbuf;
+    unsigned int idlen;
+    unsigned char *p;
+    int64_t expires;
+    time_t now;
+    int len;
+
+    if (db == NULL)
+        return 0;
+    key.dptr = (char *) SSL_SESSION_get_id(sess, &idlen);
+    key.dsize = idlen;
+    len = i2d_SSL_SESSION(sess, NULL);
+    if (idlen == 0 || len <= 0)
+        return 0;
+    dbuf.dsize = sizeof(expires) + len;
+    if ((dbuf.dptr = malloc(dbuf.dsize)) == NULL)
+        return 0;
+    expires = (int64_t) SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess);
+    memcpy(dbuf.dptr, &expires, sizeof(expires));
+    p = (unsigned char *) dbuf.dptr + sizeof(expires);
+    i2d_SSL_SESSION(sess, &p);
+    if (tdb_store(db, key, dbuf, TDB_REPLACE) != 0)
+        dbglog("EAP-TLS: Couldn't add session to the cache");
+    OPENSSL_cleanse(dbuf.dptr, dbuf.dsize);
+    free(dbuf.dptr);
+
+    /* every so often, throw out what has expired */
+    now = time(NULL);
+    if (now - session_db_pruned >= tls_session_lifetime) {
+        session_db_pruned = now;
+        tdb_traverse(db, eaptls_prune_session, &now);
+    }
+
+    /* we didn't keep a reference to it */
+    return 0;
+}
+
+static SSL_SESSION *eaptls_cache_get(SSL *ssl, const unsigned char *id,
+                                     int idlen, int *copy)
+{
+    TDB_CONTEXT *db = eaptls_session_db();
+    SSL_SESSION *sess = NULL;
+    TDB_DATA key, dbuf;
+    const unsigned char *p;
+    int64_t expires;
+
+    *copy = 0;
+    if (db == NULL)
+        return NULL;
+    key.dptr = (char *) id;
+    key.dsize = idlen;
+    dbuf = tdb_fetch(db, key);
+    if (dbuf.dptr == NULL)
+        return NULL;
+    if (dbuf.dsize > sizeof(expires)) {
+        memcpy(&expires, dbuf.dptr, sizeof(expires));
+        p = (unsigned char *) dbuf.dptr + sizeof(expires);
+        if (expires > time(NULL))
+            sess = d2i_SSL_SESSION(NULL, &p, dbuf.dsize - sizeof(expires));
+    }
+    if (sess == NULL)
+        tdb_delete(db, key);
+    OPENSSL_cleanse(dbuf.dptr, dbuf.dsize);
+    free(dbuf.dptr);
+    return sess;
+}
+
+static void eaptls_cache_remove(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    TDB_CONTEXT *db = eaptls_session_db();
+    TDB_DATA key;
+    unsigned int idlen;
+
+    if (db == NULL)
+        return;
+    key.dptr = (char *) SSL_SESSION_get_id(sess, &idlen);
+    key.dsize = idlen;
+    tdb_delete(db, key);
+}
+#endif /* PPP_WITH_TDB */
+
+/*
+ * Let peers resume their sessions, if we've been asked to.  The
+ * session ID context ties sessions to our certificate and the CAs we
+ * trust, so one can't be resumed where it couldn't have been set up.
+ */
+static void eaptls_init_resumption(SSL_CTX *ctx, char *cacertfile, char *capath,
+                                   char *certfile, char *pkcs12)
+{
+    unsigned char sid_ctx[SHA256_DIGEST_LENGTH];
+    char buf[4 * MAXWORDLEN + 16];
+    int len;
+
+    if (!tls_ticket_secret && !tls_session_cache)
+        return;
+
+    len = slprintf(buf, sizeof(buf), "pppd EAP-TLS\n%s\n%s\n%s\n%s",
+                   cacertfile, capath, certfile, pkcs12);
+    SHA256((unsigned char *) buf, len, sid_ctx);
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx));
+    SSL_CTX_set_timeout(ctx, tls_session_lifetime);
+
+    if (tls_ticket_secret && eaptls_load_ticket_secret(tls_ticket_secret)) {
+        SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, eaptls_ticket_cb);
+#else
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, eaptls_ticket_cb);
+#endif
+    }
+
+#ifdef PPP_WITH_TDB
+    if (tls_session_cache) {
+        /* each session has its own SSL_CTX, so only the tdb is any use */
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER
+                                       | SSL_SESS_CACHE_NO_INTERNAL);
+        SSL_CTX_sess_set_new_cb(ctx, eaptls_cache_new);
+        SSL_CTX_sess_set_get_cb(ctx, eaptls_cache_get);
+        SSL_CTX_sess_set_remove_cb(ctx, eaptls_cache_remove);
+    }
+#endif
+}
+
 /*
  * Initialize the SSL stacks and tests if certificates, key and crl
  * for client or server use can be loaded.
@@ -263,6 +613,8 @@ SSL_CTX *eaptls_init_ssl(int init_server, char *cacertfile, char *capath,
 #endif
     SSL_CTX     *ctx;
     SSL         *ssl;
+    const char  *files[7];
+    char         tag[2 * MAXWORDLEN + MAXSECRETLEN + 64];
     X509        *tmp;
     X509        *cert = NULL;
     PKCS12      *p12 = NULL;
@@ -298,6 +650,26 @@ SSL_CTX *eaptls_init_ssl(int init_server, char *cacertfile, char *capath,
 
     tls_init();
 
+    /*
+     * Unless one of them has changed, use what was loaded from these
+     * files last time, rather than reading them all again.
+     */
+    files[0] = cacertfile;
+    files[1] = capath;
+    files[2] = certfile;
+    files[3] = privkeyfile;
+    files[4] = pkcs12;
+    files[5] = crl_dir;
+    files[6] = crl_file;
+    slprintf(tag, sizeof(tag), "eap-tls %s %s %s %d %d %s",
+             init_server ? "server" : "client",
+             max_tls_version ? max_tls_version : "",
+             tls_ticket_secret ? tls_ticket_secret : "",
+             tls_session_cache, tls_session_lifetime, passwd);
+    ctx = tls_ctx_get(tag, files, 7);
+    if (ctx)
+        return ctx;
+
 #ifndef OPENSSL_NO_ENGINE
     /* load the openssl config file only once and load it before triggering
        the loading of a global openssl config file via SSL_CTX_new()
@@ -586,6 +958,8 @@ SSL_CTX *eaptls_init_ssl(int init_server, char *cacertfile, char *capath,
      */
     SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
     SSL_CTX_sess_set_new_cb(ctx, ssl_new_session_cb);
+    if (init_server)
+        eaptls_init_resumption(ctx, cacertfile, capath, certfile, pkcs12);
 
     /* Configure the maximum SSL version */
     tls_set_version(ctx, max_tls_version);
@@ -600,6 +974,7 @@ SSL_CTX *eaptls_init_ssl(int init_server, char *cacertfile, char *capath,
         goto fail;
     }
 
+    tls_ctx_put(tag, files, 7, ctx);
     return ctx;
 
 fail:
@@ -707,10 +1082,14 @@ int eaptls_init_ssl_server(eap_state * esp)
 
     ets->tls_v13 = 0;
 
-    ets->data = NULL;
+    ets->receiving = 0;
     ets->datalen = 0;
+    ets->sendlen = 0;
+    ets->sent = 0;
+    ets->rtx_len = 0;
     ets->alert_sent = 0;
     ets->alert_recv = 0;
+    ets->resume_checked = 0;
     return 1;
 
 fail:
@@ -776,10 +1155,14 @@ int eaptls_init_ssl_client(eap_state * esp)
 
     ets->tls_v13 = 0;
 
-    ets->data = NULL;
+    ets->receiving = 0;
     ets->datalen = 0;
+    ets->sendlen = 0;
+    ets->sent = 0;
+    ets->rtx_len = 0;
     ets->alert_sent = 0;
     ets->alert_recv = 0;
+    ets->resume_checked = 0;
     return 1;
 
 fail:
@@ -791,6 +1174,14 @@ fail:
 
 void eaptls_free_session(struct eaptls_session *ets)
 {
+    /*
+     * EAP-TLS has no close_notify, and without one SSL_free takes the
+     * session out of the cache, so it couldn't be resumed.
+     */
+    if (ets->ssl && SSL_is_init_finished(ets->ssl)
+        && !ets->alert_sent && !ets->alert_recv)
+        SSL_set_shutdown(ets->ssl, SSL_SENT_SHUTDOWN);
+
     if (ets->ssl)
         SSL_free(ets->ssl);
 
@@ -817,9 +1208,37 @@ int eaptls_is_init_finished(struct eaptls_session *ets)
     return 0;
 }
 
+/*
+ * Throw away the last message we sent, which was kept in from_ssl in
+ * case its last fragment had to be sent again.  By now ssl has usually
+ * written nothing after it, so the whole buffer can go at once.
+ */
+static void eaptls_drop_sent(struct eaptls_session *ets)
+{
+    u_char discard[4096];
+    int n, left;
+
+    left = ets->sent;
+    ets->sent = 0;
+    ets->rtx_len = 0;
+    if (left == 0)
+        return;
+    if (BIO_pending(ets->from_ssl) <= left) {
+        (void)BIO_reset(ets->from_ssl);
+        return;
+    }
+    while (left > 0) {
+        n = BIO_read(ets->from_ssl, discard, MIN(left, sizeof(discard)));
+        if (n <= 0)
+            break;
+        left -= n;
+    }
+}
+
 /*
  * Handle a received packet, reassembling fragmented messages and
- * passing them to the ssl engine
+ * passing them to the ssl engine.  Fragments go straight into the
+ * BIO as they arrive; ssl only looks at them once the last is in.
  */
 int eaptls_receive(struct eaptls_session *ets, u_char * inp, int len)
 {
@@ -835,6 +1254,9 @@ int eaptls_receive(struct eaptls_session *ets, u_char * inp, int len)
     GETCHAR(flags, inp);
     len--;
 
+    /* the peer has all of our last message, now it has answered */
+    eaptls_drop_sent(ets);
+
     if (flags & EAP_TLS_FLAGS_LI && len > 4) {
         /*
          * LenghtIncluded flag set -> this is the first packet of a message
@@ -846,35 +1268,26 @@ int eaptls_receive(struct eaptls_session *ets, u_char * inp, int len)
         GETLONG(tlslen, inp);
         len -= 4;
 
-        if (!ets->data) {
+        if (!ets->receiving) {
 
             if (tlslen > EAP_TLS_MAX_LEN) {
                 error("EAP-TLS: TLS message length > %d, truncated", EAP_TLS_MAX_LEN);
                 tlslen = EAP_TLS_MAX_LEN;
             }
 
-            /*
-             * Allocate memory for the whole message
-            */
-            ets->data = malloc(tlslen);
-            if (!ets->data)
-                fatal("EAP-TLS: allocation error\n");
-
+            ets->receiving = 1;
             ets->datalen = 0;
             ets->tlslen = tlslen;
         }
         else
             warn("EAP-TLS: non-first LI packet? that's odd...");
     }
-    else if (!ets->data) {
+    else if (!ets->receiving) {
         /*
          * A non fragmented message without LI flag
         */
  
-        ets->data = malloc(len);
-        if (!ets->data)
-            fatal("EAP-TLS: memory allocation error in eaptls_receive\n");
- 
+        ets->receiving = 1;
         ets->datalen = 0;
         ets->tlslen = len;
     }
@@ -894,7 +1307,8 @@ int eaptls_receive(struct eaptls_session *ets, u_char * inp, int len)
         return 1;
     }
 
-    BCOPY(inp, ets->data + ets->datalen, len);
+    if (len > 0 && BIO_write(ets->into_ssl, inp, len) != len)
+        tls_log_sslerr();
     ets->datalen += len;
 
     if (!ets->frag) {
@@ -903,29 +1317,56 @@ int eaptls_receive(struct eaptls_session *ets, u_char * inp, int len)
          * If we have the whole message, pass it to ssl 
          */
 
+        ets->receiving = 0;
         if (ets->datalen != ets->tlslen) {
             warn("EAP-TLS: received data != TLS message length");
+            (void)BIO_reset(ets->into_ssl);
             return 1;
         }
 
-        if (BIO_write(ets->into_ssl, ets->data, ets->datalen) == -1)
-            tls_log_sslerr();
-
         SSL_read(ets->ssl, dummy, 65536);
 
-        free(ets->data);
-        ets->data = NULL;
-        ets->datalen = 0;
+        /* a resumed session didn't show us a certificate to check */
+        if (SSL_is_server(ets->ssl) && !ets->resume_checked
+            && SSL_is_init_finished(ets->ssl) && SSL_session_reused(ets->ssl)) {
+            ets->resume_checked = 1;
+            if (tls_verify_session(ets->ssl) < 0) {
+                SSL_CTX_remove_session(ets->ctx, SSL_get_session(ets->ssl));
+                return 1;
+            }
+            info("EAP-TLS: Resumed an earlier session");
+        }
     }
 
     return 0;
 }
 
+/*
+ * Put the eap-tls type, flags and, for the first of several
+ * fragments, the length of the message in outp, followed by len bytes
+ * of the message from offset.
+ */
+static void eaptls_put_fragment(struct eaptls_session *ets, u_char ** outp,
+                                u_char flags, int offset, int len)
+{
+    char *data;
+
+    PUTCHAR(EAPT_TLS, *outp);
+    PUTCHAR(flags, *outp);
+    if (flags & EAP_TLS_FLAGS_LI)
+        PUTLONG(ets->sendlen, *outp);
+
+    BIO_get_mem_data(ets->from_ssl, &data);
+    BCOPY(data + offset, *outp, len);
+    INCPTR(len, *outp);
+}
+
 /*
  * Return an eap-tls packet in outp.
- * A TLS message read from the ssl engine is buffered in ets->data.
- * At each call we control if there is buffered data and send a 
- * packet of mtu bytes.
+ * A TLS message read from the ssl engine is left in from_ssl, and
+ * each call sends the next mtu bytes of it from there.  It stays
+ * there after the last of it has gone, so that the last fragment can
+ * be sent again from the same place, until the peer answers.
  */
 int eaptls_send(struct eaptls_session *ets, u_char ** outp)
 {
@@ -933,39 +1374,32 @@ int eaptls_send(struct eaptls_session *ets, u_char ** outp)
     int size;
     u_char fromtls[65536];
     int res;
-    u_char *start;
-
-    start = *outp;
+    u_char flags;
 
-    if (!ets->data)
+    if (!ets->sendlen)
     {
+        eaptls_drop_sent(ets);
+
         if(!ets->alert_sent)
         {
             res = SSL_read(ets->ssl, fromtls, 65536);
         }
 
         /*
-         * Read from ssl 
+         * See what ssl has for us
          */
-        if ((res = BIO_read(ets->from_ssl, fromtls, 65536)) == -1)
+        if ((res = BIO_pending(ets->from_ssl)) <= 0)
         {
             warn("EAP-TLS send: No data from BIO_read");
             return 1;
         }
 
-        ets->datalen = res;
-
-        ets->data = malloc(ets->datalen);
-        if (!ets->data)
-            fatal("EAP-TLS: memory allocation error in eaptls_send\n");
-
-        BCOPY(fromtls, ets->data, ets->datalen);
-
+        ets->sendlen = MIN(res, EAP_TLS_MAX_LEN);
         ets->offset = 0;
         first = 1;
     }
 
-    size = ets->datalen - ets->offset;
+    size = ets->sendlen - ets->offset;
     
     if (size > ets->mtu) {
         size = ets->mtu;
@@ -973,42 +1407,35 @@ int eaptls_send(struct eaptls_session *ets, u_char ** outp)
     } else
         ets->frag = 0;
 
-    PUTCHAR(EAPT_TLS, *outp);
-
     /*
      * Set right flags and length if necessary 
      */
-    if (ets->frag && first) {
-        PUTCHAR(EAP_TLS_FLAGS_LI | EAP_TLS_FLAGS_MF, *outp);
-        PUTLONG(ets->datalen, *outp);
-    } else if (ets->frag) {
-        PUTCHAR(EAP_TLS_FLAGS_MF, *outp);
-    } else
-        PUTCHAR(0, *outp);
+    if (ets->frag && first)
+        flags = EAP_TLS_FLAGS_LI | EAP_TLS_FLAGS_MF;
+    else if (ets->frag)
+        flags = EAP_TLS_FLAGS_MF;
+    else
+        flags = 0;
 
-    /*
-     * Copy the data in outp 
-     */
-    BCOPY(ets->data + ets->offset, *outp, size);
-    INCPTR(size, *outp);
+    eaptls_put_fragment(ets, outp, flags, ets->offset, size);
 
     /*
-     * Copy the packet in retransmission buffer 
+     * Remember where it came from, for a retransmission
      */
-    BCOPY(start, &ets->rtx[0], *outp - start);
-    ets->rtx_len = *outp - start;
+    ets->rtx_offset = ets->offset;
+    ets->rtx_len = size;
+    ets->rtx_flags = flags;
 
     ets->offset += size;
 
-    if (ets->offset >= ets->datalen) {
+    if (ets->offset >= ets->sendlen) {
 
         /*
          * The whole message has been sent 
          */
 
-        free(ets->data);
-        ets->data = NULL;
-        ets->datalen = 0;
+        ets->sent = ets->sendlen;
+        ets->sendlen = 0;
         ets->offset = 0;
     }
 
@@ -1016,12 +1443,12 @@ int eaptls_send(struct eaptls_session *ets, u_char ** outp)
 }
 
 /*
- * Get the sent packet from the retransmission buffer
+ * Send the last packet again, from where it still is in from_ssl
  */
 void eaptls_retransmit(struct eaptls_session *ets, u_char ** outp)
 {
-    BCOPY(ets->rtx, *outp, ets->rtx_len);
-    INCPTR(ets->rtx_len, *outp);
+    eaptls_put_fragment(ets, outp, ets->rtx_flags, ets->rtx_offset,
+                        ets->rtx_len);
 }
 
 /*
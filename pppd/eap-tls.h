@@ -49,10 +49,12 @@ struct tls_info;
 
 struct eaptls_session
 {
-    u_char *data;               /* buffered data */
-    int datalen;                /* buffered data len */
-    int offset;                 /* from where to send */
+    bool receiving;             /* part of a message has come in */
+    int datalen;                /* how much of it */
     int tlslen;                 /* total length of tls data */
+    int sendlen;                /* length of the message going out */
+    int offset;                 /* from where to send */
+    int sent;                   /* length of the last message sent */
     bool frag;                  /* packet is fragmented */
     bool tls_v13;               /* whether we've negotiated TLSv1.3 */
     SSL_CTX *ctx;
@@ -64,8 +66,10 @@ struct eaptls_session
     u_char alert_sent_desc;
     bool alert_recv;
     u_char alert_recv_desc;
-    char rtx[EAP_TLS_MAX_LEN];  /* retransmission buffer */
+    bool resume_checked;        /* checked the peer of a resumed session */
+    int rtx_offset;             /* the last fragment sent, to retransmit */
     int rtx_len;
+    u_char rtx_flags;
     int mtu;                    /* unit mtu */
     struct tls_info *info;
 };
@@ -86,6 +90,7 @@ void eaptls_retransmit(struct eaptls_session *ets, u_char ** outp);
 int get_eaptls_secret(int unit, char *client, char *server,
               char *clicertfile, char *servcertfile, char *cacertfile,
               char *capath, char *pkfile, char *pkcs12, int am_server);
+void eaptls_load_contexts(void);
 
 #ifdef PPP_WITH_MPPE
 void eaptls_gen_mppe_keys(struct eaptls_session *ets, int client);
@@ -66,6 +66,7 @@
 #include "pppd-private.h"
 #include "options.h"
 #include "pathnames.h"
+#include "magic.h"
 #include "crypto.h"
 #include "crypto_ms.h"
 #include "eap.h"
@@ -813,7 +814,6 @@ eap_send_request(eap_state *esp)
 {
 	u_char *outp;
 	u_char *lenloc;
-	u_char *ptr;
 	int outlen;
 	int challen;
 	char *str;
@@ -880,9 +880,7 @@ eap_send_request(eap_state *esp)
 			    MIN_CHALLENGE_LENGTH;
 		PUTCHAR(challen, outp);
 		esp->es_challen = challen;
-		ptr = esp->es_challenge;
-		while (--challen >= 0)
-			*ptr++ = (u_char) (drand48() * 0x100);
+		random_bytes(esp->es_challenge, challen);
 		BCOPY(esp->es_challenge, outp, esp->es_challen);
 		INCPTR(esp->es_challen, outp);
 		BCOPY(esp->es_server.ea_name, outp, esp->es_server.ea_namelen);
@@ -1070,9 +1068,7 @@ eap_send_request(eap_state *esp)
 		challen = MIN_CHALLENGE_LENGTH +
 		    ((MAX_CHALLENGE_LENGTH - MIN_CHALLENGE_LENGTH) * drand48());
 		esp->es_challen = challen;
-		ptr = esp->es_challenge;
-		while (--challen >= 0)
-			*ptr++ = drand48() * 0x100;
+		random_bytes(esp->es_challenge, challen);
 		BCOPY(esp->es_challenge, outp, esp->es_challen);
 		INCPTR(esp->es_challen, outp);
 		break;
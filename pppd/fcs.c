@@ -0,0 +1,466 @@
+/*
+ * fcs.c - compute the PPP FCS-16 and FCS-32 over a buffer.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fcs.h"
+
+/*
+ * Both FCSs are bit-reflected CRCs, so each is kept in tables for
+ * slicing-by-8: fcsNtab[k][b] is the effect on the FCS of byte b
+ * followed by k bytes of zeros.  Row 0 is the usual byte-at-a-time
+ * table.  They are built the first time an FCS is asked for.
+ */
+#define FCS16_POLY	0x8408		/* x^16 + x^12 + x^5 + 1, reflected */
+#define FCS32_POLY	0xedb88320	/* the IEEE 802.3 polynomial, reflected */
+
+static uint16_t fcs16tab[8][256];
+static uint32_t fcs32tab[8][256];
+static int fcs_ready;
+
+/*
+ * Carry-less multiplication on x86-64, and the CRC32 instructions of
+ * ARMv8, which use the FCS-32 polynomial.  The x86 CRC32 instruction
+ * uses the Castagnoli polynomial, so it is no use here.  Nothing does
+ * FCS-16 in hardware.
+ */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define FCS32_PCLMUL
+#include <immintrin.h>
+static int have_pclmul;
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define FCS32_ARMV8
+#include <arm_acle.h>
+#endif
+
+static void
+fcs_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+	c = i;
+	for (k = 0; k < 8; k++)
+	    c = (c & 1)? (c >> 1) ^ FCS16_POLY: c >> 1;
+	fcs16tab[0][i] = c;
+	c = i;
+	for (k = 0; k < 8; k++)
+	    c = (c & 1)? (c >> 1) ^ FCS32_POLY: c >> 1;
+	fcs32tab[0][i] = c;
+    }
+    for (k = 1; k < 8; k++) {
+	for (i = 0; i < 256; i++) {
+	    fcs16tab[k][i] = (fcs16tab[k-1][i] >> 8)
+		^ fcs16tab[0][fcs16tab[k-1][i] & 0xff];
+	    fcs32tab[k][i] = (fcs32tab[k-1][i] >> 8)
+		^ fcs32tab[0][fcs32tab[k-1][i] & 0xff];
+	}
+    }
+#ifdef FCS32_PCLMUL
+    __builtin_cpu_init();
+    have_pclmul = __builtin_cpu_supports("pclmul")
+	&& __builtin_cpu_supports("sse4.1");
+#endif
+    fcs_ready = 1;
+}
+
+static uint16_t
+fcs16_bytewise(uint16_t fcs, const unsigned char *p, size_t len)
+{
+    for (; len > 0; --len)
+	fcs = (fcs >> 8) ^ fcs16tab[0][(fcs ^ *p++) & 0xff];
+    return fcs;
+}
+
+static uint16_t
+fcs16_slice8(uint16_t fcs, const unsigned char *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8) {
+	fcs ^= p[0] | (p[1] << 8);
+	fcs = fcs16tab[7][fcs & 0xff] ^ fcs16tab[6][fcs >> 8]
+	    ^ fcs16tab[5][p[2]] ^ fcs16tab[4][p[3]]
+	    ^ fcs16tab[3][p[4]] ^ fcs16tab[2][p[5]]
+	    ^ fcs16tab[1][p[6]] ^ fcs16tab[0][p[7]];
+    }
+    return fcs16_bytewise(fcs, p, len);
+}
+
+static uint32_t
+fcs32_bytewise(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    for (; len > 0; --len)
+	fcs = (fcs >> 8) ^ fcs32tab[0][(fcs ^ *p++) & 0xff];
+    return fcs;
+}
+
+static uint32_t
+fcs32_slice8(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    for (; len >= 8; p += 8, len -= 8) {
+	fcs ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+	fcs = fcs32tab[7][fcs & 0xff] ^ fcs32tab[6][(fcs >> 8) & 0xff]
+	    ^ fcs32tab[5][(fcs >> 16) & 0xff] ^ fcs32tab[4][fcs >> 24]
+	    ^ fcs32tab[3][p[4]] ^ fcs32tab[2][p[5]]
+	    ^ fcs32tab[1][p[6]] ^ fcs32tab[0][p[7]];
+    }
+    return fcs32_bytewise(fcs, p, len);
+}
+
+#ifdef FCS32_PCLMUL
+/*
+ * Fold 64 bytes at a time into four 128-bit accumulators, then down to
+ * one, then reduce that to 32 bits, as in Intel's "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction".  The constants
+ * are powers of x modulo the reflected polynomial given in the paper.
+ * Takes len >= 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+fcs32_pclmul_blocks(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(fcs));
+    p += 64;
+    len -= 64;
+
+    for (; len >= 64; p += 64, len -= 64) {
+	x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+	x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+	x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+	x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+	x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+	x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+	x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			   _mm_loadu_si128((const __m128i *) (p + 0x00)));
+	x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+			   _mm_loadu_si128((const __m128i *) (p + 0x10)));
+	x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+			   _mm_loadu_si128((const __m128i *) (p + 0x20)));
+	x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+			   _mm_loadu_si128((const __m128i *) (p + 0x30)));
+    }
+
+    /* fold the four accumulators into one */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* then any remaining 16-byte blocks */
+    for (; len >= 16; p += 16, len -= 16) {
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+			   _mm_loadu_si128((const __m128i *) p));
+    }
+
+    /* 128 bits down to 64 */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* and a Barrett reduction to 32 */
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+static uint32_t
+fcs32_pclmul(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    size_t n;
+
+    if (len >= 64) {
+	n = len & ~(size_t) 15;
+	fcs = fcs32_pclmul_blocks(fcs, p, n);
+	p += n;
+	len -= n;
+    }
+    return fcs32_slice8(fcs, p, len);
+}
+#endif /* FCS32_PCLMUL */
+
+#ifdef FCS32_ARMV8
+static uint32_t
+fcs32_armv8(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    uint64_t w;
+
+    for (; len > 0 && ((uintptr_t) p & 7) != 0; --len)
+	fcs = __crc32b(fcs, *p++);
+    for (; len >= 8; p += 8, len -= 8) {
+	w = *(const uint64_t *) p;
+	fcs = __crc32d(fcs, w);
+    }
+    for (; len > 0; --len)
+	fcs = __crc32b(fcs, *p++);
+    return fcs;
+}
+#endif /* FCS32_ARMV8 */
+
+/*
+ * ppp_fcs16 - run the 16-bit FCS over len bytes at p, starting from fcs.
+ */
+uint16_t
+ppp_fcs16(uint16_t fcs, const unsigned char *p, size_t len)
+{
+    if (!fcs_ready)
+	fcs_init();
+    return fcs16_slice8(fcs, p, len);
+}
+
+/*
+ * ppp_fcs32 - run the 32-bit FCS over len bytes at p, starting from fcs,
+ * using the CPU's help where there is any.
+ */
+uint32_t
+ppp_fcs32(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    if (!fcs_ready)
+	fcs_init();
+#ifdef FCS32_ARMV8
+    return fcs32_armv8(fcs, p, len);
+#else
+#ifdef FCS32_PCLMUL
+    if (have_pclmul)
+	return fcs32_pclmul(fcs, p, len);
+#endif
+    return fcs32_slice8(fcs, p, len);
+#endif
+}
+
+#if defined(UNIT_TEST) || defined(FCS_BENCH)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint32_t
+v_fcs16_bytewise(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    return fcs16_bytewise(fcs, p, len);
+}
+
+static uint32_t
+v_fcs16_slice8(uint32_t fcs, const unsigned char *p, size_t len)
+{
+    return fcs16_slice8(fcs, p, len);
+}
+
+static struct fcs_variant {
+    char	*name;
+    int		bits;
+    uint32_t	(*fn)(uint32_t, const unsigned char *, size_t);
+} variants[] = {
+    { "fcs16 bytewise", 16, v_fcs16_bytewise },
+    { "fcs16 slice-by-8", 16, v_fcs16_slice8 },
+    { "fcs32 bytewise", 32, fcs32_bytewise },
+    { "fcs32 slice-by-8", 32, fcs32_slice8 },
+#ifdef FCS32_PCLMUL
+    { "fcs32 pclmul", 32, fcs32_pclmul },
+#endif
+#ifdef FCS32_ARMV8
+    { "fcs32 armv8 crc32", 32, fcs32_armv8 },
+#endif
+    { NULL }
+};
+
+static int
+variant_usable(struct fcs_variant *v)
+{
+#ifdef FCS32_PCLMUL
+    if (v->fn == fcs32_pclmul)
+	return have_pclmul;
+#endif
+    return 1;
+}
+#endif /* UNIT_TEST || FCS_BENCH */
+
+#ifdef UNIT_TEST
+/*
+ * Check each variant against the byte-at-a-time one over every length
+ * and alignment that matters, and the published check values.
+ */
+int
+main(int argc, char *argv[])
+{
+    static unsigned char buf[1024 + 16];
+    struct fcs_variant *v;
+    uint32_t want, got;
+    uint16_t fcs16;
+    uint32_t fcs32;
+    size_t len, off;
+    int failure = 0;
+
+    fcs_init();
+    srand(1);
+    for (len = 0; len < sizeof(buf); ++len)
+	buf[len] = rand();
+
+    /* CRC-16/X-25 and CRC-32 of "123456789" */
+    if ((ppp_fcs16(PPP_INITFCS16, (unsigned char *) "123456789", 9) ^ 0xffff)
+	!= 0x906e) {
+	printf("FCS-16 check value test failed\n");
+	failure++;
+    }
+    if ((ppp_fcs32(PPP_INITFCS32, (unsigned char *) "123456789", 9)
+	 ^ 0xffffffff) != 0xcbf43926) {
+	printf("FCS-32 check value test failed\n");
+	failure++;
+    }
+
+    /* a frame followed by its FCS, low byte first, leaves the good value */
+    fcs16 = ppp_fcs16(PPP_INITFCS16, buf, 100) ^ 0xffff;
+    buf[100] = fcs16;
+    buf[101] = fcs16 >> 8;
+    if (ppp_fcs16(PPP_INITFCS16, buf, 102) != PPP_GOODFCS16) {
+	printf("FCS-16 residue test failed\n");
+	failure++;
+    }
+    fcs32 = ppp_fcs32(PPP_INITFCS32, buf, 1000) ^ 0xffffffff;
+    buf[1000] = fcs32;
+    buf[1001] = fcs32 >> 8;
+    buf[1002] = fcs32 >> 16;
+    buf[1003] = fcs32 >> 24;
+    if (ppp_fcs32(PPP_INITFCS32, buf, 1004) != PPP_GOODFCS32) {
+	printf("FCS-32 residue test failed\n");
+	failure++;
+    }
+
+    for (v = variants; v->name != NULL; ++v) {
+	if (!variant_usable(v))
+	    continue;
+	for (off = 0; off < 16; ++off) {
+	    for (len = 0; len + off <= 1024; len += (len < 300? 1: 37)) {
+		if (v->bits == 16)
+		    want = fcs16_bytewise(0x1234 + len, buf + off, len);
+		else
+		    want = fcs32_bytewise(0x12345678 + len, buf + off, len);
+		got = v->fn(v->bits == 16? 0x1234 + len: 0x12345678 + len,
+			    buf + off, len);
+		if (got != want) {
+		    printf("%s test failed at offset %zu length %zu\n",
+			   v->name, off, len);
+		    failure++;
+		    break;
+		}
+	    }
+	}
+    }
+
+    return failure;
+}
+#endif /* UNIT_TEST */
+
+#ifdef FCS_BENCH
+/*
+ * Report the throughput of each variant on frames of a few sizes.
+ */
+int
+main(int argc, char *argv[])
+{
+    static size_t sizes[] = { 64, 256, 1500, 9000, 65536 };
+    struct fcs_variant *v;
+    struct timespec t0, t1;
+    unsigned char *buf;
+    volatile uint32_t sink;
+    uint32_t fcs;
+    size_t i, total;
+    double secs;
+    long iter, n;
+
+    fcs_init();
+    buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    if (buf == NULL)
+	return 1;
+    for (i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; ++i)
+	buf[i] = rand();
+
+    printf("%-20s", "");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	printf(" %8zu", sizes[i]);
+    printf("   (MB/s by frame size)\n");
+    for (v = variants; v->name != NULL; ++v) {
+	if (!variant_usable(v))
+	    continue;
+	printf("%-20s", v->name);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	    /* aim for about 64MB of data, which takes long enough to time */
+	    iter = (64 << 20) / sizes[i];
+	    fcs = 0;
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    for (n = 0; n < iter; ++n)
+		fcs = v->fn(fcs, buf, sizes[i]);
+	    clock_gettime(CLOCK_MONOTONIC, &t1);
+	    sink = fcs;
+	    total = iter * sizes[i];
+	    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	    printf(" %8.0f", total / secs / 1e6);
+	}
+	printf("\n");
+    }
+    (void) sink;
+    free(buf);
+    return 0;
+}
+#endif /* FCS_BENCH */
@@ -0,0 +1,52 @@
+/*
+ * fcs.h - the PPP frame check sequences of RFC 1662, FCS-16 and FCS-32.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPP_FCS_H
+#define PPP_FCS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Both are computed without the final complement, as in RFC 1662:
+ * start from the initial value, run the FCS over the frame, and the
+ * result is the good value if the frame and its FCS arrived intact.
+ * The 16-bit values are the same as PPP_INITFCS and PPP_GOODFCS in
+ * ppp_defs.h.
+ */
+#define PPP_INITFCS16	0xffff
+#define PPP_GOODFCS16	0xf0b8
+#define PPP_INITFCS32	0xffffffff
+#define PPP_GOODFCS32	0xdebb20e3
+#define PPP_FCS32LEN	4
+
+uint16_t ppp_fcs16(uint16_t fcs, const unsigned char *p, size_t len);
+uint32_t ppp_fcs32(uint32_t fcs, const unsigned char *p, size_t len);
+
+#endif
@@ -53,6 +53,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/time.h>
 
 #include "pppd-private.h"
 #include "fsm.h"
@@ -66,11 +67,37 @@ static void fsm_rtermreq (fsm *, int, u_char *, int);
 static void fsm_rtermack (fsm *);
 static void fsm_rcoderej (fsm *, u_char *, int);
 static void fsm_sconfreq (fsm *, int);
+static void fsm_settimer (fsm *, int);
+static unsigned int fsm_ms (void);
+static void fsm_rtt_sample (fsm *);
 
 #define PROTO_NAME(f)	((f)->callbacks->proto_name)
 
 int peer_mru[NUM_PPP];
 
+bool adaptive_restart = 1;
+
+/*
+ * Smoothed round-trip time of the link in ms, or 0 if we haven't
+ * measured it yet.  It is shared by all the protocols on the link,
+ * so once LCP has measured it the NCPs can use it from their first
+ * request.
+ */
+static int link_rtt;
+
+/*
+ * fsm_set_state - move to a new state, noting it in the event trace.
+ */
+static void
+fsm_set_state(fsm *f, int state)
+{
+    if (f->state != state) {
+	PPP_PROBE4(pppd, fsm_state, f->protocol, PROTO_NAME(f), f->state,
+		   state);
+	trace_state(PROTO_NAME(f), state);
+    }
+    f->state = state;
+}
 
 /*
  * fsm_init - Initialize fsm.
@@ -97,18 +124,22 @@ fsm_init(fsm *f)
 void
 fsm_lowerup(fsm *f)
 {
+    /* a new link may have a different RTT */
+    if (f->protocol == PPP_LCP)
+	link_rtt = 0;
+
     switch( f->state ){
     case INITIAL:
-	f->state = CLOSED;
+	fsm_set_state(f, CLOSED);
 	break;
 
     case STARTING:
 	if( f->flags & OPT_SILENT )
-	    f->state = STOPPED;
+	    fsm_set_state(f, STOPPED);
 	else {
 	    /* Send an initial configure-request */
 	    fsm_sconfreq(f, 0);
-	    f->state = REQSENT;
+	    fsm_set_state(f, REQSENT);
 	}
 	break;
 
@@ -128,17 +159,17 @@ fsm_lowerdown(fsm *f)
 {
     switch( f->state ){
     case CLOSED:
-	f->state = INITIAL;
+	fsm_set_state(f, INITIAL);
 	break;
 
     case STOPPED:
-	f->state = STARTING;
+	fsm_set_state(f, STARTING);
 	if( f->callbacks->starting )
 	    (*f->callbacks->starting)(f);
 	break;
 
     case CLOSING:
-	f->state = INITIAL;
+	fsm_set_state(f, INITIAL);
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	break;
 
@@ -146,14 +177,14 @@ fsm_lowerdown(fsm *f)
     case REQSENT:
     case ACKRCVD:
     case ACKSENT:
-	f->state = STARTING;
+	fsm_set_state(f, STARTING);
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	break;
 
     case OPENED:
 	if( f->callbacks->down )
 	    (*f->callbacks->down)(f);
-	f->state = STARTING;
+	fsm_set_state(f, STARTING);
 	break;
 
     default:
@@ -170,23 +201,23 @@ fsm_open(fsm *f)
 {
     switch( f->state ){
     case INITIAL:
-	f->state = STARTING;
+	fsm_set_state(f, STARTING);
 	if( f->callbacks->starting )
 	    (*f->callbacks->starting)(f);
 	break;
 
     case CLOSED:
 	if( f->flags & OPT_SILENT )
-	    f->state = STOPPED;
+	    fsm_set_state(f, STOPPED);
 	else {
 	    /* Send an initial configure-request */
 	    fsm_sconfreq(f, 0);
-	    f->state = REQSENT;
+	    fsm_set_state(f, REQSENT);
 	}
 	break;
 
     case CLOSING:
-	f->state = STOPPING;
+	fsm_set_state(f, STOPPING);
 	/* fall through */
     case STOPPED:
     case OPENED:
@@ -223,16 +254,16 @@ terminate_layer(fsm *f, int nextstate)
 	 * We've already fired off one Terminate-Request just to be nice
 	 * to the peer, but we're not going to wait for a reply.
 	 */
-	f->state = nextstate == CLOSING ? CLOSED : STOPPED;
+	fsm_set_state(f, nextstate == CLOSING ? CLOSED : STOPPED);
 	if( f->callbacks->finished )
 	    (*f->callbacks->finished)(f);
 	return;
     }
 
-    TIMEOUT(fsm_timeout, f, f->timeouttime);
     --f->retransmits;
+    fsm_settimer(f, f->maxtermtransmits - f->retransmits);
 
-    f->state = nextstate;
+    fsm_set_state(f, nextstate);
 }
 
 /*
@@ -248,13 +279,13 @@ fsm_close(fsm *f, char *reason)
     f->term_reason_len = (reason == NULL? 0: strlen(reason));
     switch( f->state ){
     case STARTING:
-	f->state = INITIAL;
+	fsm_set_state(f, INITIAL);
 	break;
     case STOPPED:
-	f->state = CLOSED;
+	fsm_set_state(f, CLOSED);
 	break;
     case STOPPING:
-	f->state = CLOSING;
+	fsm_set_state(f, CLOSING);
 	break;
 
     case REQSENT:
@@ -282,15 +313,16 @@ fsm_timeout(void *arg)
 	    /*
 	     * We've waited for an ack long enough.  Peer probably heard us.
 	     */
-	    f->state = (f->state == CLOSING)? CLOSED: STOPPED;
+	    fsm_set_state(f, (f->state == CLOSING)? CLOSED: STOPPED);
 	    if( f->callbacks->finished )
 		(*f->callbacks->finished)(f);
 	} else {
 	    /* Send Terminate-Request */
 	    fsm_sdata(f, TERMREQ, f->reqid = ++f->id,
 		      (u_char *) f->term_reason, f->term_reason_len);
-	    TIMEOUT(fsm_timeout, f, f->timeouttime);
 	    --f->retransmits;
+	    fsm_settimer(f, f->maxtermtransmits - f->retransmits);
+	    trace_retransmit(PROTO_NAME(f), f->retransmits);
 	}
 	break;
 
@@ -299,7 +331,7 @@ fsm_timeout(void *arg)
     case ACKSENT:
 	if (f->retransmits <= 0) {
 	    warn("%s: timeout sending Config-Requests\n", PROTO_NAME(f));
-	    f->state = STOPPED;
+	    fsm_set_state(f, STOPPED);
 	    if( (f->flags & OPT_PASSIVE) == 0 && f->callbacks->finished )
 		(*f->callbacks->finished)(f);
 
@@ -308,8 +340,9 @@ fsm_timeout(void *arg)
 	    if (f->callbacks->retransmit)
 		(*f->callbacks->retransmit)(f);
 	    fsm_sconfreq(f, 1);		/* Re-send Configure-Request */
+	    trace_retransmit(PROTO_NAME(f), f->retransmits);
 	    if( f->state == ACKRCVD )
-		f->state = REQSENT;
+		fsm_set_state(f, REQSENT);
 	}
 	break;
 
@@ -417,13 +450,13 @@ fsm_rconfreq(fsm *f, int id, u_char *inp, int len)
 	if( f->callbacks->down )
 	    (*f->callbacks->down)(f);	/* Inform upper layers */
 	fsm_sconfreq(f, 0);		/* Send initial Configure-Request */
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
 
     case STOPPED:
 	/* Negotiation started by our peer */
 	fsm_sconfreq(f, 0);		/* Send initial Configure-Request */
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
     }
 
@@ -445,17 +478,17 @@ fsm_rconfreq(fsm *f, int id, u_char *inp, int len)
     if (code == CONFACK) {
 	if (f->state == ACKRCVD) {
 	    UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
-	    f->state = OPENED;
+	    fsm_set_state(f, OPENED);
 	    if (f->callbacks->up)
 		(*f->callbacks->up)(f);	/* Inform upper layers */
 	} else
-	    f->state = ACKSENT;
+	    fsm_set_state(f, ACKSENT);
 	f->nakloops = 0;
 
     } else {
 	/* we sent CONFNAK or CONFREJ */
 	if (f->state != ACKRCVD)
-	    f->state = REQSENT;
+	    fsm_set_state(f, REQSENT);
 	if( code == CONFNAK )
 	    ++f->nakloops;
     }
@@ -476,6 +509,7 @@ fsm_rconfack(fsm *f, int id, u_char *inp, int len)
 	error("Received bad configure-ack: %P", inp, len);
 	return;
     }
+    fsm_rtt_sample(f);
     f->seen_ack = 1;
     f->rnakloops = 0;
 
@@ -486,7 +520,7 @@ fsm_rconfack(fsm *f, int id, u_char *inp, int len)
 	break;
 
     case REQSENT:
-	f->state = ACKRCVD;
+	fsm_set_state(f, ACKRCVD);
 	f->retransmits = f->maxconfreqtransmits;
 	break;
 
@@ -494,12 +528,12 @@ fsm_rconfack(fsm *f, int id, u_char *inp, int len)
 	/* Huh? an extra valid Ack? oh well... */
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	fsm_sconfreq(f, 0);
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
 
     case ACKSENT:
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
-	f->state = OPENED;
+	fsm_set_state(f, OPENED);
 	f->retransmits = f->maxconfreqtransmits;
 	if (f->callbacks->up)
 	    (*f->callbacks->up)(f);	/* Inform upper layers */
@@ -510,7 +544,7 @@ fsm_rconfack(fsm *f, int id, u_char *inp, int len)
 	if (f->callbacks->down)
 	    (*f->callbacks->down)(f);	/* Inform upper layers */
 	fsm_sconfreq(f, 0);		/* Send initial Configure-Request */
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
     }
 }
@@ -545,6 +579,7 @@ fsm_rconfnakrej(fsm *f, int code, int id, u_char *inp, int len)
 	}
     }
 
+    fsm_rtt_sample(f);
     f->seen_ack = 1;
 
     switch (f->state) {
@@ -558,7 +593,7 @@ fsm_rconfnakrej(fsm *f, int code, int id, u_char *inp, int len)
 	/* They didn't agree to what we wanted - try another request */
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	if (ret < 0)
-	    f->state = STOPPED;		/* kludge for stopping CCP */
+	    fsm_set_state(f, STOPPED);		/* kludge for stopping CCP */
 	else
 	    fsm_sconfreq(f, 0);		/* Send Configure-Request */
 	break;
@@ -567,7 +602,7 @@ fsm_rconfnakrej(fsm *f, int code, int id, u_char *inp, int len)
 	/* Got a Nak/reject when we had already had an Ack?? oh well... */
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	fsm_sconfreq(f, 0);
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
 
     case OPENED:
@@ -575,7 +610,7 @@ fsm_rconfnakrej(fsm *f, int code, int id, u_char *inp, int len)
 	if (f->callbacks->down)
 	    (*f->callbacks->down)(f);	/* Inform upper layers */
 	fsm_sconfreq(f, 0);		/* Send initial Configure-Request */
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
     }
 }
@@ -590,7 +625,7 @@ fsm_rtermreq(fsm *f, int id, u_char *p, int len)
     switch (f->state) {
     case ACKRCVD:
     case ACKSENT:
-	f->state = REQSENT;		/* Start over but keep trying */
+	fsm_set_state(f, REQSENT);		/* Start over but keep trying */
 	break;
 
     case OPENED:
@@ -599,7 +634,7 @@ fsm_rtermreq(fsm *f, int id, u_char *p, int len)
 	} else
 	    info("%s terminated by peer", PROTO_NAME(f));
 	f->retransmits = 0;
-	f->state = STOPPING;
+	fsm_set_state(f, STOPPING);
 	if (f->callbacks->down)
 	    (*f->callbacks->down)(f);	/* Inform upper layers */
 	TIMEOUT(fsm_timeout, f, f->timeouttime);
@@ -619,26 +654,26 @@ fsm_rtermack(fsm *f)
     switch (f->state) {
     case CLOSING:
 	UNTIMEOUT(fsm_timeout, f);
-	f->state = CLOSED;
+	fsm_set_state(f, CLOSED);
 	if( f->callbacks->finished )
 	    (*f->callbacks->finished)(f);
 	break;
     case STOPPING:
 	UNTIMEOUT(fsm_timeout, f);
-	f->state = STOPPED;
+	fsm_set_state(f, STOPPED);
 	if( f->callbacks->finished )
 	    (*f->callbacks->finished)(f);
 	break;
 
     case ACKRCVD:
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
 
     case OPENED:
 	if (f->callbacks->down)
 	    (*f->callbacks->down)(f);	/* Inform upper layers */
 	fsm_sconfreq(f, 0);
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 	break;
     }
 }
@@ -661,7 +696,7 @@ fsm_rcoderej(fsm *f, u_char *inp, int len)
     warn("%s: Rcvd Code-Reject for code %d, id %d", PROTO_NAME(f), code, id);
 
     if( f->state == ACKRCVD )
-	f->state = REQSENT;
+	fsm_set_state(f, REQSENT);
 }
 
 
@@ -678,7 +713,7 @@ fsm_protreject(fsm *f)
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	/* fall through */
     case CLOSED:
-	f->state = CLOSED;
+	fsm_set_state(f, CLOSED);
 	if( f->callbacks->finished )
 	    (*f->callbacks->finished)(f);
 	break;
@@ -690,7 +725,7 @@ fsm_protreject(fsm *f)
 	UNTIMEOUT(fsm_timeout, f);	/* Cancel timeout */
 	/* fall through */
     case STOPPED:
-	f->state = STOPPED;
+	fsm_set_state(f, STOPPED);
 	if( f->callbacks->finished )
 	    (*f->callbacks->finished)(f);
 	break;
@@ -729,6 +764,13 @@ fsm_sconfreq(fsm *f, int retransmit)
 	f->reqid = ++f->id;
     }
 
+    /*
+     * Only time a request that is sent once: an answer to a resent
+     * one could be to any of its copies.
+     */
+    f->timing = !retransmit;
+    f->reqtime = fsm_ms();
+
     f->seen_ack = 0;
 
     /*
@@ -749,7 +791,69 @@ fsm_sconfreq(fsm *f, int retransmit)
 
     /* start the retransmit timer */
     --f->retransmits;
-    TIMEOUT(fsm_timeout, f, f->timeouttime);
+    fsm_settimer(f, f->maxconfreqtransmits - f->retransmits);
+}
+
+
+/*
+ * fsm_ms - return the time in ms, for measuring intervals.
+ */
+static unsigned int
+fsm_ms(void)
+{
+    struct timeval tv;
+
+    ppp_get_time(&tv);
+    return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * fsm_rtt_sample - note the round-trip time of the request just
+ * answered, if we can tell it.
+ */
+static void
+fsm_rtt_sample(fsm *f)
+{
+    int rtt;
+
+    if (!f->timing)
+	return;
+    f->timing = 0;
+    rtt = fsm_ms() - f->reqtime;
+    if (rtt <= 0)
+	rtt = 1;
+    if (link_rtt == 0)
+	link_rtt = rtt;
+    else
+	link_rtt += (rtt - link_rtt) / 8;
+}
+
+/*
+ * fsm_settimer - start the restart timer after sending a request
+ * for the sent'th time.  Once the link RTT is known the timer starts
+ * at twice the RTT and doubles with each resend, up to the restart
+ * interval, or up to the starting value if a slow link has made that
+ * longer.  Until then, or without adaptive_restart, it is always the
+ * restart interval.
+ */
+static void
+fsm_settimer(fsm *f, int sent)
+{
+    int ms, max;
+
+    ms = max = f->timeouttime * 1000;
+    if (adaptive_restart && link_rtt > 0) {
+	ms = 2 * link_rtt;
+	if (ms < MINRTO)
+	    ms = MINRTO;
+	if (ms > max)
+	    max = ms;
+	while (--sent > 0 && ms < max)
+	    ms *= 2;
+	if (ms > max)
+	    ms = max;
+    }
+    ppp_timeout(fsm_timeout, f, ms / 1000, (ms % 1000) * 1000);
 }
 
 
@@ -75,7 +75,8 @@ typedef struct fsm {
     unsigned char id;			/* Current id */
     unsigned char reqid;		/* Current request id */
     unsigned char seen_ack;		/* Have received valid Ack/Nak/Rej to Req */
-    int timeouttime;		/* Timeout time in milliseconds */
+    unsigned char timing;		/* reqtime is for the only copy of reqid */
+    int timeouttime;		/* Timeout time in seconds */
     int maxconfreqtransmits;	/* Maximum Configure-Request transmissions */
     int retransmits;		/* Number of retransmissions left */
     int maxtermtransmits;	/* Maximum Terminate-Request transmissions */
@@ -85,6 +86,7 @@ typedef struct fsm {
     struct fsm_callbacks *callbacks;	/* Callback routines */
     char *term_reason;		/* Reason for closing protocol */
     int term_reason_len;	/* Length of term_reason */
+    unsigned int reqtime;	/* When the current request was sent, in ms */
 } fsm;
 
 
@@ -140,6 +142,7 @@ typedef struct fsm_callbacks {
  * Timeouts.
  */
 #define DEFTIMEOUT	3	/* Timeout time in seconds */
+#define MINRTO		200	/* Shortest adaptive timeout in ms */
 #define DEFMAXTERMREQS	2	/* Maximum Terminate-Request transmissions */
 #define DEFMAXCONFREQS	10	/* Maximum Configure-Request transmissions */
 #define DEFMAXNAKLOOPS	5	/* Maximum number of nak loops */
@@ -162,5 +165,6 @@ void fsm_sdata (fsm *, int, int, unsigned char *, int);
  * Variables
  */
 extern int peer_mru[];		/* currently negotiated peer MRU (per unit) */
+extern bool adaptive_restart;	/* base timeouts on the measured RTT */
 
 #endif
@@ -48,6 +48,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -177,6 +179,9 @@ static struct option ipcp_option_list[] = {
     { "ms-wins", o_special, (void *)setwinsaddr,
       "Nameserver for SMB over TCP/IP for peer", OPT_A2LIST },
 
+    { "ip-pool", o_special, (void *)ippool_option,
+      "Shared pool of addresses for peers", OPT_PRIV },
+
     { "ipcp-restart", o_int, &ipcp_fsm[0].timeouttime,
       "Set timeout for IPCP", OPT_PRIO },
     { "ipcp-max-terminate", o_int, &ipcp_fsm[0].maxtermtransmits,
@@ -333,8 +338,9 @@ setvjslots(char **argv)
 
     if (!ppp_int_option(*argv, &value))
 	return 0;
-    if (value < 2 || value > 16) {
-	ppp_option_error("vj-max-slots value must be between 2 and 16");
+    if (value < 2 || value > MAX_VJ_SLOTS) {
+	ppp_option_error("vj-max-slots value must be between 2 and %d",
+			 MAX_VJ_SLOTS);
 	return 0;
     }
     ipcp_wantoptions [0].maxslotindex =
@@ -674,6 +680,78 @@ ipcp_protrej(int unit)
 }
 
 
+/*
+ * What IPCP keeps in the peer cache (see peer_cache_get): whether the
+ * peer rejected VJ compression or what it nak'd it to, and the
+ * addresses it gave us.
+ */
+struct ipcp_cache {
+    bool rej_vj;
+    bool neg_vj;
+    bool old_vj;
+    bool cflag;
+    int vj_protocol;
+    int maxslotindex;
+    uint32_t ouraddr;		/* 0 unless the peer chose it */
+    uint32_t dnsaddr[2];
+};
+
+/*
+ * ipcp_cache_save - remember how IPCP went with this peer.
+ */
+static void
+ipcp_cache_save(fsm *f)
+{
+    ipcp_options *wo = &ipcp_wantoptions[f->unit];
+    ipcp_options *go = &ipcp_gotoptions[f->unit];
+    struct ipcp_cache c;
+
+    memset(&c, 0, sizeof(c));
+    c.rej_vj = wo->neg_vj && !go->neg_vj;
+    c.neg_vj = go->neg_vj;
+    c.old_vj = go->old_vj;
+    c.cflag = go->cflag;
+    c.vj_protocol = go->vj_protocol;
+    c.maxslotindex = go->maxslotindex;
+    if (wo->ouraddr == 0)
+	c.ouraddr = go->ouraddr;
+    c.dnsaddr[0] = go->dnsaddr[0];
+    c.dnsaddr[1] = go->dnsaddr[1];
+    peer_cache_put(PPP_IPCP, &c, sizeof(c));
+}
+
+/*
+ * ipcp_cache_seed - start from what worked with this peer last time:
+ * leave out VJ compression if it was rejected, and ask for the same
+ * addresses as before where we would otherwise leave the peer to
+ * choose them.  The peer can still nak them as usual.
+ */
+static void
+ipcp_cache_seed(fsm *f)
+{
+    ipcp_options *go = &ipcp_gotoptions[f->unit];
+    struct ipcp_cache c;
+
+    if (!peer_cache_get(PPP_IPCP, &c, sizeof(c)))
+	return;
+    if (c.rej_vj)
+	go->neg_vj = 0;
+    else if (go->neg_vj && c.neg_vj) {
+	go->old_vj = c.old_vj;
+	go->vj_protocol = c.vj_protocol;
+	if (c.maxslotindex < go->maxslotindex)
+	    go->maxslotindex = c.maxslotindex;
+	go->cflag = go->cflag && c.cflag;
+    }
+    if ((go->neg_addr || go->old_addrs) && go->accept_local
+	&& go->ouraddr == 0)
+	go->ouraddr = c.ouraddr;
+    if (go->req_dns1 && go->dnsaddr[0] == 0)
+	go->dnsaddr[0] = c.dnsaddr[0];
+    if (go->req_dns2 && go->dnsaddr[1] == 0)
+	go->dnsaddr[1] = c.dnsaddr[1];
+}
+
 /*
  * ipcp_resetci - Reset our CI.
  * Called by fsm_sconfreq, Send Configure Request.
@@ -699,12 +777,18 @@ ipcp_resetci(fsm *f)
     *go = *wo;
     if (!ask_for_local)
 	go->ouraddr = 0;
+    ipcp_cache_seed(f);
     if (ip_choose_hook) {
 	ip_choose_hook(&wo->hisaddr);
 	if (wo->hisaddr) {
 	    wo->accept_remote = 0;
 	}
     }
+    if (wo->hisaddr == 0) {
+	wo->hisaddr = ippool_get();
+	if (wo->hisaddr)
+	    wo->accept_remote = 0;
+    }
     BZERO(&ipcp_hisoptions[f->unit], sizeof(ipcp_options));
 }
 
@@ -1854,6 +1938,7 @@ ipcp_up(fsm *f)
         ppp_script_setenv("WINS2", ip_ntoa(go->winsaddr[1]), 0);
     if (usepeerwins && (go->winsaddr[0] || go->winsaddr[1]))
         ppp_script_setenv("USEPEERWINS", "1", 0);
+    ipcp_cache_save(f);
 
     /*
      * Check that the peer is allowed to use the IP address it wants.
@@ -1865,7 +1950,8 @@ ipcp_up(fsm *f)
     }
 
     /* set tcp compression */
-    sifvjcomp(f->unit, ho->neg_vj, ho->cflag, ho->maxslotindex);
+    sifvjcomp(f->unit, ho->neg_vj, ho->cflag, ho->maxslotindex,
+	      go->neg_vj? go->maxslotindex: MAX_STATES - 1);
 
     /*
      * If we are doing dial-on-demand, the interface is already
@@ -2023,7 +2109,7 @@ ipcp_down(fsm *f)
 	ipcp_is_up = 0;
 	np_down(f->unit, PPP_IP);
     }
-    sifvjcomp(f->unit, 0, 0, 0);
+    sifvjcomp(f->unit, 0, 0, 0, 0);
 
     print_link_stats(); /* _after_ running the notifiers and ip_down_hook(),
 			 * because print_link_stats() sets link_stats_valid
@@ -2145,29 +2231,54 @@ ipcp_script(char *script, int wait)
 }
 
 /*
- * create_resolv - create the replacement resolv.conf file
+ * create_resolv - create the replacement resolv.conf file.
+ * Resolvers watching the file reload it whenever it is written, so
+ * we leave it alone if it already says what we would write, and
+ * otherwise write a new file and rename it into place, so that it
+ * is never seen half written.
  */
 static void
 create_resolv(u_int32_t peerdns1, u_int32_t peerdns2)
 {
-    FILE *f;
-
-    f = fopen(PPP_PATH_RESOLV, "w");
-    if (f == NULL) {
-	error("Failed to create %s: %m", PPP_PATH_RESOLV);
-	return;
-    }
+    char buf[64], old[sizeof(buf)], path[MAXPATHLEN], tmp[MAXPATHLEN];
+    int fd, len, n;
 
+    len = 0;
     if (peerdns1)
-	fprintf(f, "nameserver %s\n", ip_ntoa(peerdns1));
-
+	len += slprintf(buf + len, sizeof(buf) - len, "nameserver %s\n",
+			ip_ntoa(peerdns1));
     if (peerdns2 && peerdns2 != peerdns1)
-	fprintf(f, "nameserver %s\n", ip_ntoa(peerdns2));
-
-    if (ferror(f))
-	error("Write failed to %s: %m", PPP_PATH_RESOLV);
+	len += slprintf(buf + len, sizeof(buf) - len, "nameserver %s\n",
+			ip_ntoa(peerdns2));
+
+    fd = open(PPP_PATH_RESOLV, O_RDONLY);
+    if (fd >= 0) {
+	n = read(fd, old, sizeof(old));
+	close(fd);
+	if (n == len && memcmp(old, buf, len) == 0)
+	    return;
+    }
 
-    fclose(f);
+    /* if it is a symbolic link, replace what it points to */
+    if (realpath(PPP_PATH_RESOLV, path) == NULL)
+	strlcpy(path, PPP_PATH_RESOLV, sizeof(path));
+    slprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+	error("Failed to create %s: %m", tmp);
+	return;
+    }
+    if (write(fd, buf, len) != len) {
+	error("Write failed to %s: %m", tmp);
+	close(fd);
+	unlink(tmp);
+	return;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0) {
+	error("Failed to rename %s to %s: %m", tmp, path);
+	unlink(tmp);
+    }
 }
 
 /*
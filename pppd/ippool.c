@@ -0,0 +1,300 @@
+/*
+ * ippool.c - assign peer addresses from a pool shared by pppds.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "pppd-private.h"
+#include "options.h"
+#include "pathnames.h"
+
+/*
+ * With the ip-pool option, a peer that has no address from the
+ * options or the secrets file is given one from a range that all the
+ * pppds using the same range share through a memory-mapped file.
+ * The file holds, for each address, the pid of the pppd using it, or
+ * 0.  Taking an address is one compare-and-swap of its entry, from 0
+ * to our pid, so pppds never wait for each other.  Each starts
+ * looking at the place after where the last one started, so while
+ * the pool isn't nearly full the first entry looked at is usually
+ * free.  An entry left behind by a pppd that died is taken over once
+ * there are no free ones.  The header keeps counts of the addresses
+ * in use and the most that have been, for monitoring.
+ */
+#define IPPOOL_MAGIC	0x50504950	/* "PPIP" */
+#define IPPOOL_VERSION	1
+#define IPPOOL_MAX	(1 << 20)	/* addresses in one pool */
+
+struct ippool_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t first;		/* first address, host byte order */
+    uint32_t count;		/* number of addresses */
+    uint32_t in_use;		/* entries with a pid in them */
+    uint32_t high_water;	/* most that in_use has been */
+    uint32_t hint;		/* where the next pppd starts looking */
+    uint32_t pad;
+    int32_t owner[];		/* pid using each address, or 0 */
+};
+
+#define IPPOOL_SIZE(n)	(sizeof(struct ippool_header) + (n) * sizeof(int32_t))
+
+#define process_exists(n)	(kill((n), 0) == 0 || errno != ESRCH)
+
+static u_int32_t pool_first, pool_count;	/* from the option */
+static struct ippool_header *pool;
+static int pool_index = -1;		/* entry we hold, or -1 */
+
+static void ippool_exit(void *, int);
+
+/*
+ * ippool_option - handle the ip-pool option, which gives the range as
+ * first-last or as addr/bits.
+ */
+int
+ippool_option(char **argv)
+{
+    char *arg = *argv, *sep, c;
+    u_int32_t a, b;
+    int bits;
+
+    sep = strpbrk(arg, "-/");
+    if (sep == NULL) {
+	ppp_option_error("ip-pool: %s is not a range", arg);
+	return 0;
+    }
+    c = *sep;
+    *sep = 0;
+    a = inet_addr(arg);
+    *sep = c;
+    if (a == INADDR_NONE) {
+	ppp_option_error("ip-pool: bad address in %s", arg);
+	return 0;
+    }
+    a = ntohl(a);
+    if (c == '-') {
+	b = inet_addr(sep + 1);
+	if (b == INADDR_NONE) {
+	    ppp_option_error("ip-pool: bad address in %s", arg);
+	    return 0;
+	}
+	b = ntohl(b);
+    } else {
+	bits = atoi(sep + 1);
+	if (bits < 12 || bits > 30) {
+	    ppp_option_error("ip-pool: prefix length must be from 12 to 30");
+	    return 0;
+	}
+	/* leave out the network and broadcast addresses */
+	a &= ~0U << (32 - bits);
+	b = a + (1U << (32 - bits)) - 2;
+	++a;
+    }
+    if (b < a || b - a >= IPPOOL_MAX) {
+	ppp_option_error("ip-pool: range %s must hold 1 to %d addresses",
+			 arg, IPPOOL_MAX);
+	return 0;
+    }
+    pool_first = a;
+    pool_count = b - a + 1;
+    return 1;
+}
+
+/*
+ * ippool_open - map the file for our range, setting it up if we are
+ * the first to use it.
+ */
+static int
+ippool_open(void)
+{
+    char path[MAXPATHLEN];
+    struct ippool_header hdr;
+    struct stat st;
+    size_t size = IPPOOL_SIZE(pool_count);
+    int fd;
+    void *map;
+
+    slprintf(path, sizeof(path), "%s%I-%I", PPP_PATH_IPPOOL,
+	     htonl(pool_first), htonl(pool_first + pool_count - 1));
+    fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW, 0644);
+    if (fd < 0) {
+	error("Couldn't open %s: %m", path);
+	return 0;
+    }
+    /* serialize setting the file up; allocation doesn't need this */
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) < 0) {
+	error("Couldn't stat %s: %m", path);
+	goto fail;
+    }
+    if (st.st_size == 0) {
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = IPPOOL_MAGIC;
+	hdr.version = IPPOOL_VERSION;
+	hdr.first = pool_first;
+	hdr.count = pool_count;
+	if (ftruncate(fd, size) < 0
+	    || pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	    error("Couldn't set up %s: %m", path);
+	    goto fail;
+	}
+    } else if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+	       || hdr.magic != IPPOOL_MAGIC || hdr.version != IPPOOL_VERSION
+	       || hdr.first != pool_first || hdr.count != pool_count
+	       || st.st_size < size) {
+	error("%s is not an address pool for this range", path);
+	goto fail;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	error("Couldn't map %s: %m", path);
+	goto fail;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+    pool = map;
+    return 1;
+
+ fail:
+    close(fd);
+    return 0;
+}
+
+/*
+ * ippool_take - try to make entry i ours, if it holds pid old.
+ */
+static int
+ippool_take(u_int32_t i, int32_t old)
+{
+    u_int32_t n, hw;
+
+    if (!__sync_bool_compare_and_swap(&pool->owner[i], old, getpid()))
+	return 0;
+    if (old == 0) {
+	n = __sync_add_and_fetch(&pool->in_use, 1);
+	while ((hw = pool->high_water) < n
+	       && !__sync_bool_compare_and_swap(&pool->high_water, hw, n))
+	    ;
+    }
+    pool_index = i;
+    return 1;
+}
+
+/*
+ * ippool_get - return an address from the pool for the peer, in
+ * network byte order, or 0 if there is no pool or nothing free in it.
+ * The address is ours until pppd exits.
+ */
+u_int32_t
+ippool_get(void)
+{
+    u_int32_t start, i, j;
+    int32_t o;
+
+    if (pool_count == 0)
+	return 0;
+    if (pool_index >= 0)
+	return htonl(pool_first + pool_index);
+    if (pool == NULL) {
+	if (!ippool_open()) {
+	    pool_count = 0;
+	    return 0;
+	}
+	ppp_add_notify(NF_EXIT, ippool_exit, NULL);
+    }
+
+    start = __sync_fetch_and_add(&pool->hint, 1) % pool_count;
+    for (i = 0; i < pool_count && pool_index < 0; ++i) {
+	j = (start + i) % pool_count;
+	if (pool->owner[j] == 0)
+	    ippool_take(j, 0);
+    }
+    /* none free: look for addresses held by pppds that have gone */
+    for (i = 0; i < pool_count && pool_index < 0; ++i) {
+	j = (start + i) % pool_count;
+	o = pool->owner[j];
+	if (o != 0 && !process_exists(o))
+	    ippool_take(j, o);
+    }
+    if (pool_index < 0) {
+	warn("No free address in the IP address pool");
+	return 0;
+    }
+    dbglog("Using %I from the IP address pool (%u of %u in use, at most %u)",
+	   htonl(pool_first + pool_index), pool->in_use, pool_count,
+	   pool->high_water);
+    return htonl(pool_first + pool_index);
+}
+
+/*
+ * ippool_check - say whether the peer may use addr, if the pool has
+ * anything to say about it: 1 if it is the pool address we hold, 0 if
+ * it is another address in the pool, or -1 if it isn't in the pool.
+ */
+int
+ippool_check(u_int32_t addr)
+{
+    addr = ntohl(addr);
+    if (pool_count == 0 || addr < pool_first
+	|| addr - pool_first >= pool_count)
+	return -1;
+    return pool_index >= 0 && addr - pool_first == pool_index;
+}
+
+/*
+ * ippool_exit - give our address back.
+ */
+static void
+ippool_exit(void *arg, int val)
+{
+    if (pool == NULL || pool_index < 0)
+	return;
+    if (__sync_bool_compare_and_swap(&pool->owner[pool_index], getpid(), 0))
+	__sync_sub_and_fetch(&pool->in_use, 1);
+    pool_index = -1;
+}
@@ -73,6 +73,8 @@ static void lcp_delayed_up(void *);
 int	lcp_echo_interval = 0; 	/* Interval between LCP echo-requests */
 int	lcp_echo_fails = 0;	/* Tolerance to unanswered echo-requests */
 bool	lcp_echo_adaptive = 0;	/* request echo only if the link was idle */
+int	lcp_echo_max_interval = 0; /* back off to this on a healthy link */
+int	lcp_mtu_probe = 0;	/* probe the path MTU up from this size */
 bool	lax_recv = 0;		/* accept control chars in asyncmap */
 bool	noendpoint = 0;		/* don't send/accept endpoint discriminator */
 
@@ -152,8 +154,17 @@ static struct option lcp_option_list[] = {
       "Set time in seconds between LCP echo requests", OPT_PRIO },
     { "lcp-echo-adaptive", o_bool, &lcp_echo_adaptive,
       "Suppress LCP echo requests if traffic was received", 1 },
+    { "lcp-echo-max-interval", o_int, &lcp_echo_max_interval,
+      "Set maximum time in seconds between LCP echo requests", OPT_PRIO },
+    { "lcp-mtu-probe", o_int, &lcp_mtu_probe,
+      "Probe the path MTU with padded echo requests, up from this size",
+      OPT_PRIO },
     { "lcp-restart", o_int, &lcp_fsm[0].timeouttime,
       "Set time in seconds between LCP retransmissions", OPT_PRIO },
+    { "adaptive-restart", o_bool, &adaptive_restart,
+      "Base retransmission times on the measured round-trip time", 1 },
+    { "noadaptive-restart", o_bool, &adaptive_restart,
+      "Retransmit only at the restart interval" },
     { "lcp-max-terminate", o_int, &lcp_fsm[0].maxtermtransmits,
       "Set maximum number of LCP terminate-request transmissions", OPT_PRIO },
     { "lcp-max-configure", o_int, &lcp_fsm[0].maxconfreqtransmits,
@@ -197,6 +208,26 @@ lcp_options lcp_hisoptions[NUM_PPP];	/* Options that we ack'd */
 static int lcp_echos_pending = 0;	/* Number of outstanding echo msgs */
 static int lcp_echo_number   = 0;	/* ID number of next echo frame */
 static int lcp_echo_timer_running = 0;  /* set if a timer is running */
+static int lcp_echo_cur_interval = 0;	/* current interval in ms */
+static struct timeval lcp_echo_sent;	/* when the last request went out */
+static u_int32_t lcp_echo_srtt;		/* smoothed round trip time, us */
+static u_int32_t lcp_echo_rttvar;	/* and its mean deviation */
+
+/*
+ * Path MTU probing: a binary search between a size known to get
+ * through (lcp_probe_lo) and the MTU negotiated (lcp_probe_hi), with
+ * Echo-Requests padded to the size being tried.  The interface MTU is
+ * raised to each size that is echoed back.  lcp_probe_hi is 0 when
+ * no probe is going on.
+ */
+#define MTU_PROBE_TRIES		3	/* requests sent for each size */
+#define MTU_PROBE_TIMEOUT	1	/* seconds to wait for each */
+
+static int lcp_probe_lo, lcp_probe_hi;
+static int lcp_probe_size;		/* size being tried */
+static int lcp_probe_id;		/* id of the last request for it */
+static int lcp_probe_tries;		/* requests sent for it */
+static int lcp_probe_timer_running;
 
 static u_char nak_buffer[PPP_MRU];	/* where we construct a nak packet */
 
@@ -216,6 +247,8 @@ static void lcp_starting(fsm *);	/* We need lower layer up */
 static void lcp_finished(fsm *);	/* We need lower layer down */
 static int  lcp_extcode(fsm *, int, int, u_char *, int);
 static void lcp_rprotrej(fsm *, u_char *, int);
+static void lcp_cache_save(fsm *);	/* Remember how it went */
+static void lcp_cache_seed(fsm *);	/* Start from last time */
 
 /*
  * routines to send LCP echos to peer
@@ -227,6 +260,8 @@ static void LcpEchoTimeout(void *);
 static void lcp_received_echo_reply(fsm *, int, u_char *, int);
 static void LcpSendEchoRequest(fsm *);
 static void LcpLinkFailure(fsm *);
+static void lcp_mtu_probe_next(fsm *);
+static void LcpMtuProbeTimeout(void *);
 static void LcpEchoCheck(fsm *);
 
 static fsm_callbacks lcp_callbacks = {	/* LCP callback routines */
@@ -634,6 +669,75 @@ lcp_resetci(fsm *f)
 	ao->neg_endpoint = 0;
     peer_mru[f->unit] = PPP_MRU;
     auth_reset(f->unit);
+    lcp_cache_seed(f);
+}
+
+
+/*
+ * What LCP keeps in the peer cache (see peer_cache_get): the options
+ * the peer rejected.  The authentication method is left out, as the
+ * cache is keyed on the device when there is no remote number, and
+ * what one caller agreed to must not decide what the next is asked for.
+ */
+struct lcp_cache {
+    bool rej_asyncmap;
+    bool rej_pcompression;
+    bool rej_accompression;
+    bool rej_lqr;
+    bool rej_mrru;
+    bool rej_ssnhf;
+    bool rej_endpoint;
+};
+
+/*
+ * lcp_cache_save - remember how LCP went with this peer.
+ */
+static void
+lcp_cache_save(fsm *f)
+{
+    lcp_options *wo = &lcp_wantoptions[f->unit];
+    lcp_options *go = &lcp_gotoptions[f->unit];
+    struct lcp_cache c;
+
+    memset(&c, 0, sizeof(c));
+    c.rej_asyncmap = wo->neg_asyncmap && !go->neg_asyncmap;
+    c.rej_pcompression = wo->neg_pcompression && !go->neg_pcompression;
+    c.rej_accompression = wo->neg_accompression && !go->neg_accompression;
+    c.rej_lqr = wo->neg_lqr && !go->neg_lqr;
+    if (multilink) {
+	c.rej_mrru = wo->neg_mrru && !go->neg_mrru;
+	c.rej_ssnhf = wo->neg_ssnhf && !go->neg_ssnhf;
+	c.rej_endpoint = wo->neg_endpoint && !go->neg_endpoint;
+    }
+    peer_cache_put(PPP_LCP, &c, sizeof(c));
+}
+
+/*
+ * lcp_cache_seed - start from what worked with this peer last time.
+ * Options it rejected are left out; nothing else is changed.
+ */
+static void
+lcp_cache_seed(fsm *f)
+{
+    lcp_options *go = &lcp_gotoptions[f->unit];
+    struct lcp_cache c;
+
+    if (!peer_cache_get(PPP_LCP, &c, sizeof(c)))
+	return;
+    if (c.rej_asyncmap)
+	go->neg_asyncmap = 0;
+    if (c.rej_pcompression)
+	go->neg_pcompression = 0;
+    if (c.rej_accompression)
+	go->neg_accompression = 0;
+    if (c.rej_lqr)
+	go->neg_lqr = 0;
+    if (c.rej_mrru)
+	go->neg_mrru = 0;
+    if (c.rej_ssnhf)
+	go->neg_ssnhf = 0;
+    if (c.rej_endpoint)
+	go->neg_endpoint = 0;
 }
 
 
@@ -1852,7 +1956,7 @@ lcp_up(fsm *f)
     lcp_options *ho = &lcp_hisoptions[f->unit];
     lcp_options *go = &lcp_gotoptions[f->unit];
     lcp_options *ao = &lcp_allowoptions[f->unit];
-    int mtu, mru;
+    int mtu, mru, ifmtu;
 
     if (!go->neg_magicnumber)
 	go->magicnumber = 0;
@@ -1870,10 +1974,21 @@ lcp_up(fsm *f)
      */
     mtu = ho->neg_mru? ho->mru: PPP_MRU;
     mru = go->neg_mru? MAX(wo->mru, go->mru): PPP_MRU;
+    lcp_probe_hi = 0;
 #ifdef PPP_WITH_MULTILINK
     if (!(multilink && go->neg_mrru && ho->neg_mrru))
 #endif /* PPP_WITH_MULTILINK */
-	ppp_set_mtu(f->unit, MIN(MIN(mtu, mru), ao->mru));
+    {
+	ifmtu = MIN(MIN(mtu, mru), ao->mru);
+	/* start from the size known to work and see what else does */
+	if (lcp_mtu_probe >= HEADERLEN + 4
+	    && lcp_mtu_probe < MIN(ifmtu, PPP_MRU)) {
+	    lcp_probe_lo = lcp_mtu_probe;
+	    lcp_probe_hi = MIN(ifmtu, PPP_MRU);
+	    ifmtu = lcp_mtu_probe;
+	}
+	ppp_set_mtu(f->unit, ifmtu);
+    }
     ppp_send_config(f->unit, mtu,
 		    (ho->neg_asyncmap? ho->asyncmap: 0xffffffff),
 		    ho->neg_pcompression, ho->neg_accompression);
@@ -1883,8 +1998,11 @@ lcp_up(fsm *f)
 
     if (ho->neg_mru)
 	peer_mru[f->unit] = ho->mru;
+    lcp_cache_save(f);
 
     lcp_echo_lowerup(f->unit);  /* Enable echo messages */
+    if (lcp_probe_hi)
+	lcp_mtu_probe_next(f);
 
     link_established(f->unit);
 }
@@ -2208,7 +2326,8 @@ LcpEchoCheck (fsm *f)
      */
     if (lcp_echo_timer_running)
 	warn("assertion lcp_echo_timer_running==0 failed");
-    TIMEOUT (LcpEchoTimeout, f, lcp_echo_interval);
+    ppp_timeout(LcpEchoTimeout, f, lcp_echo_cur_interval / 1000,
+		(lcp_echo_cur_interval % 1000) * 1000);
     lcp_echo_timer_running = 1;
 }
 
@@ -2233,6 +2352,8 @@ static void
 lcp_received_echo_reply (fsm *f, int id, u_char *inp, int len)
 {
     u_int32_t magic;
+    struct timeval now;
+    long rtt, err;
 
     /* Check the magic number - don't count replies from ourselves. */
     if (len < 4) {
@@ -2246,10 +2367,75 @@ lcp_received_echo_reply (fsm *f, int id, u_char *inp, int len)
 	return;
     }
 
+    /* the reply to a probe, which got there and back at its size */
+    if (lcp_probe_hi && id == lcp_probe_id
+	&& len + HEADERLEN == lcp_probe_size) {
+	if (lcp_probe_timer_running) {
+	    UNTIMEOUT(LcpMtuProbeTimeout, f);
+	    lcp_probe_timer_running = 0;
+	}
+	lcp_probe_lo = lcp_probe_size;
+	ppp_set_mtu(f->unit, lcp_probe_lo);
+	lcp_echos_pending = 0;
+	lcp_mtu_probe_next(f);
+	return;
+    }
+
+    /*
+     * Only time the reply to the latest request; an earlier one could
+     * be matched against the wrong send time.
+     */
+    if (lcp_echos_pending > 0 && id == ((lcp_echo_number - 1) & 0xFF)
+	&& ppp_get_time(&now) == 0) {
+	rtt = (now.tv_sec - lcp_echo_sent.tv_sec) * 1000000L
+	    + now.tv_usec - lcp_echo_sent.tv_usec;
+	if (rtt < 1)
+	    rtt = 1;
+
+	/*
+	 * A reply much slower than usual means the link may be in
+	 * trouble, so go back to probing at lcp-echo-interval;
+	 * otherwise back off towards lcp-echo-max-interval.
+	 */
+	if (lcp_echo_srtt != 0
+	    && rtt > lcp_echo_srtt + 4 * (long) lcp_echo_rttvar)
+	    lcp_echo_cur_interval = lcp_echo_interval * 1000;
+	else if (lcp_echo_max_interval > lcp_echo_interval) {
+	    lcp_echo_cur_interval *= 2;
+	    if (lcp_echo_cur_interval > lcp_echo_max_interval * 1000)
+		lcp_echo_cur_interval = lcp_echo_max_interval * 1000;
+	}
+
+	/* Estimator as for TCP (RFC 6298): gains 1/8 and 1/4 */
+	if (lcp_echo_srtt == 0) {
+	    lcp_echo_srtt = rtt;
+	    lcp_echo_rttvar = rtt / 2;
+	} else {
+	    err = rtt - (long) lcp_echo_srtt;
+	    lcp_echo_srtt += err / 8;
+	    if (err < 0)
+		err = -err;
+	    lcp_echo_rttvar += (err - (long) lcp_echo_rttvar) / 4;
+	}
+	dbglog("lcp: echo rtt %ld us, srtt %u us, rttvar %u us, next in %d ms",
+	       rtt, lcp_echo_srtt, lcp_echo_rttvar, lcp_echo_cur_interval);
+	statsfile_echo_rtt(rtt);
+    }
+
     /* Reset the number of outstanding echo frames */
     lcp_echos_pending = 0;
 }
 
+/*
+ * lcp_echo_rtt - return the smoothed LCP echo round trip time in
+ * microseconds, or 0 if no echo-reply has been timed yet.
+ */
+uint32_t
+lcp_echo_rtt(int unit)
+{
+    return lcp_echo_srtt;
+}
+
 /*
  * LcpSendEchoRequest - Send an echo request frame to the peer
  */
@@ -2270,6 +2456,10 @@ LcpSendEchoRequest (fsm *f)
 	}
     }
 
+    /* An unanswered request: probe at the base rate until one is answered */
+    if (lcp_echos_pending > 0)
+	lcp_echo_cur_interval = lcp_echo_interval * 1000;
+
     /*
      * If adaptive echos have been enabled, only send the echo request if
      * no traffic was received since the last one.
@@ -2278,7 +2468,7 @@ LcpSendEchoRequest (fsm *f)
 	static unsigned int last_pkts_in = 0;
 	struct pppd_stats cur_stats;
 
-	if (get_ppp_stats(f->unit, &cur_stats) && cur_stats.pkts_in != last_pkts_in) {
+	if (get_link_stats(f->unit, &cur_stats) && cur_stats.pkts_in != last_pkts_in) {
 	    last_pkts_in = cur_stats.pkts_in;
 	    /* receipt of traffic indicates the link is working... */
 	    lcp_echos_pending = 0;
@@ -2293,11 +2483,74 @@ LcpSendEchoRequest (fsm *f)
         lcp_magic = lcp_gotoptions[f->unit].magicnumber;
 	pktp = pkt;
 	PUTLONG(lcp_magic, pktp);
+        ppp_get_time(&lcp_echo_sent);
         fsm_sdata(f, ECHOREQ, lcp_echo_number++ & 0xFF, pkt, pktp - pkt);
 	++lcp_echos_pending;
     }
 }
 
+/*
+ * lcp_mtu_probe_send - send an Echo-Request padded out to the size
+ * being tried, built in place in outpacket_buf.
+ */
+static void
+lcp_mtu_probe_send(fsm *f)
+{
+    u_char *data = outpacket_buf + PPP_HDRLEN + HEADERLEN, *p = data;
+    int len = lcp_probe_size - HEADERLEN;
+
+    PUTLONG(lcp_gotoptions[f->unit].magicnumber, p);
+    memset(p, 0, len - 4);
+    lcp_probe_id = lcp_echo_number++ & 0xFF;
+    fsm_sdata(f, ECHOREQ, lcp_probe_id, data, len);
+    ++lcp_probe_tries;
+    ppp_timeout(LcpMtuProbeTimeout, f, MTU_PROBE_TIMEOUT, 0);
+    lcp_probe_timer_running = 1;
+}
+
+/*
+ * lcp_mtu_probe_next - try the size halfway between what we know gets
+ * through and the largest that might, or finish if they have met.
+ */
+static void
+lcp_mtu_probe_next(fsm *f)
+{
+    if (f->state != OPENED) {
+	lcp_probe_hi = 0;
+	return;
+    }
+    if (lcp_probe_lo >= lcp_probe_hi) {
+	info("Path MTU probe done, MTU %d", lcp_probe_lo);
+	lcp_probe_hi = 0;
+	return;
+    }
+    lcp_probe_size = (lcp_probe_lo + lcp_probe_hi + 1) / 2;
+    lcp_probe_tries = 0;
+    dbglog("lcp: probing the path with %d byte echo-requests",
+	   lcp_probe_size);
+    lcp_mtu_probe_send(f);
+}
+
+/*
+ * LcpMtuProbeTimeout - no reply to a probe: try again, or give up on
+ * that size.
+ */
+static void
+LcpMtuProbeTimeout(void *arg)
+{
+    fsm *f = (fsm *) arg;
+
+    lcp_probe_timer_running = 0;
+    if (lcp_probe_hi == 0 || f->state != OPENED)
+	return;
+    if (lcp_probe_tries < MTU_PROBE_TRIES) {
+	lcp_mtu_probe_send(f);
+	return;
+    }
+    lcp_probe_hi = lcp_probe_size - 1;
+    lcp_mtu_probe_next(f);
+}
+
 /*
  * lcp_echo_lowerup - Start the timer for the LCP frame
  */
@@ -2311,6 +2564,9 @@ lcp_echo_lowerup (int unit)
     lcp_echos_pending      = 0;
     lcp_echo_number        = 0;
     lcp_echo_timer_running = 0;
+    lcp_echo_cur_interval  = lcp_echo_interval * 1000;
+    lcp_echo_srtt          = 0;
+    lcp_echo_rttvar        = 0;
   
     /* If a timeout interval is specified then start the timer */
     if (lcp_echo_interval != 0)
@@ -2330,4 +2586,9 @@ lcp_echo_lowerdown (int unit)
         UNTIMEOUT (LcpEchoTimeout, f);
         lcp_echo_timer_running = 0;
     }
+    if (lcp_probe_timer_running != 0) {
+	UNTIMEOUT (LcpMtuProbeTimeout, f);
+	lcp_probe_timer_running = 0;
+    }
+    lcp_probe_hi = 0;
 }
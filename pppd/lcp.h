@@ -137,6 +137,7 @@ void lcp_close(int, char *);
 void lcp_lowerup(int);
 void lcp_lowerdown(int);
 void lcp_sprotrej(int, unsigned char *, int);	/* send protocol reject */
+uint32_t lcp_echo_rtt(int);			/* smoothed echo RTT, us */
 
 extern struct protent lcp_protent;
 
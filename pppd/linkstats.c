@@ -0,0 +1,303 @@
+/*
+ * linkstats.c - the link's counters and connect time.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+#include "pppd-private.h"
+
+static struct timeval start_time;	/* Time when link was started. */
+
+static struct pppd_stats old_link_stats;
+static struct pppd_stats cur_link_stats; /* counters read this wakeup */
+static int cur_link_stats_valid;
+struct pppd_stats link_stats;
+unsigned link_connect_time;
+int link_stats_valid;
+int link_stats_print;
+
+/*
+ * link_stats_start - note the time as we start to bring the link up.
+ * Whatever was recorded for the last session no longer applies.
+ */
+void
+link_stats_start(void)
+{
+    ppp_get_time(&start_time);
+    link_stats_valid = 0;
+    link_connect_time = 0;
+}
+
+/*
+ * link_stats_expire - forget the counters read from the kernel, at
+ * each wakeup of the main loop.
+ */
+void
+link_stats_expire(void)
+{
+    cur_link_stats_valid = 0;
+}
+
+void
+print_link_stats(void)
+{
+    /*
+     * Print connect time and statistics.
+     */
+    if (link_stats_print && link_stats_valid) {
+       int t = (link_connect_time + 5) / 6;    /* 1/10ths of minutes */
+       info("Connect time %d.%d minutes.", t/10, t%10);
+       info("Sent %u bytes, received %u bytes.",
+	    link_stats.bytes_out, link_stats.bytes_in);
+       link_stats_print = 0;
+    }
+}
+
+/*
+ * get_link_stats - get the counters for the link.  They are read
+ * from the kernel at most once each time round the main loop, so
+ * several protocols and plugins looking at them in response to the
+ * same event (such as the link going down) share one read.
+ */
+int
+get_link_stats(int u, struct pppd_stats *stats)
+{
+    if (!cur_link_stats_valid) {
+	if (!get_ppp_stats(u, &cur_link_stats))
+	    return 0;
+	cur_link_stats_valid = 1;
+    }
+    *stats = cur_link_stats;
+    return 1;
+}
+
+/*
+ * reset_link_stats - "reset" stats when link goes up.  The counters
+ * and connect time recorded when a previous session went down (with
+ * persist or demand) don't describe this one.
+ */
+void
+reset_link_stats(int u)
+{
+    link_stats_valid = 0;
+    link_connect_time = 0;
+    if (!get_link_stats(u, &old_link_stats))
+	return;
+    ppp_get_time(&start_time);
+    statsfile_start();
+}
+
+/*
+ * link_uptime - how many seconds the link has been up.
+ */
+int
+link_uptime(void)
+{
+    struct timeval now;
+
+    if (phase == PHASE_DEAD || ppp_get_time(&now) < 0)
+	return 0;
+    return now.tv_sec - start_time.tv_sec;
+}
+
+/*
+ * link_stats_since_reset - get the counters since the link came up.
+ */
+static int
+link_stats_since_reset(int u, struct pppd_stats *stats)
+{
+    if (!get_link_stats(u, stats))
+	return 0;
+    stats->bytes_in  -= old_link_stats.bytes_in;
+    stats->bytes_out -= old_link_stats.bytes_out;
+    stats->pkts_in   -= old_link_stats.pkts_in;
+    stats->pkts_out  -= old_link_stats.pkts_out;
+    return 1;
+}
+
+/*
+ * update_link_stats - get stats at link termination.
+ */
+static void
+update_link_stats(int u)
+{
+    struct timeval now;
+    char numbuf[32];
+
+    if (!link_stats_since_reset(u, &link_stats)
+	|| ppp_get_time(&now) < 0)
+	return;
+    link_connect_time = now.tv_sec - start_time.tv_sec;
+    link_stats_valid = 1;
+    statsfile_stop();
+
+    slprintf(numbuf, sizeof(numbuf), "%u", link_connect_time);
+    ppp_script_setenv("CONNECT_TIME", numbuf, 0);
+    snprintf(numbuf, sizeof(numbuf), "%" PRIu64, link_stats.bytes_out);
+    ppp_script_setenv("BYTES_SENT", numbuf, 0);
+    snprintf(numbuf, sizeof(numbuf), "%" PRIu64, link_stats.bytes_in);
+    ppp_script_setenv("BYTES_RCVD", numbuf, 0);
+}
+
+/*
+ * ppp_get_link_stats - get the counters since the link came up.  With
+ * a NULL argument, this records them (and the connect time) for
+ * print_link_stats and the scripts; otherwise it's just a cheap look
+ * at the current values.
+ */
+bool
+ppp_get_link_stats(ppp_link_stats_st *stats)
+{
+    if (stats == NULL) {
+	update_link_stats(0);
+	return false;
+    }
+    return link_stats_since_reset(0, stats);
+}
+
+int ppp_get_link_uptime()
+{
+    /* the time it was up for once it has gone down, else so far */
+    if (link_stats_valid)
+	return link_connect_time;
+    return link_uptime();
+}
+
+#ifdef UNIT_TEST
+/*
+ * Stand-ins for the rest of pppd: a clock and kernel counters that
+ * the test moves along by hand.
+ */
+ppp_phase_t phase = PHASE_DEAD;
+static time_t test_now;
+static struct pppd_stats test_counters;
+
+int ppp_get_time(struct timeval *tv)
+{
+    tv->tv_sec = test_now;
+    tv->tv_usec = 0;
+    return 0;
+}
+
+int get_ppp_stats(int u, struct pppd_stats *stats)
+{
+    *stats = test_counters;
+    return 1;
+}
+
+void statsfile_start(void) { }
+void statsfile_stop(void) { }
+void ppp_script_setenv(char *var, char *value, int iskey) { }
+void info(char *fmt, ...) { }
+
+int slprintf(char *buf, int buflen, char *fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vsnprintf(buf, buflen, fmt, args);
+    va_end(args);
+    return n;
+}
+
+/*
+ * session - bring the link up at time start, check the uptime and
+ * counters reported while it is up and after it goes down at time end.
+ */
+static int
+session(const char *name, time_t start, time_t end, uint64_t bytes)
+{
+    ppp_link_stats_st stats;
+    int failure = 0;
+
+    test_now = start;
+    phase = PHASE_ESTABLISH;
+    link_stats_expire();
+    link_stats_start();
+    reset_link_stats(0);
+
+    test_now = start + 1;
+    if (ppp_get_link_uptime() != 1) {
+	printf("%s: uptime while up is %d, not 1\n", name,
+	       ppp_get_link_uptime());
+	failure++;
+    }
+
+    test_now = end;
+    test_counters.bytes_in += bytes;
+    link_stats_expire();
+    ppp_get_link_stats(NULL);
+    phase = PHASE_DEAD;
+    if (ppp_get_link_uptime() != end - start) {
+	printf("%s: uptime after down is %d, not %ld\n", name,
+	       ppp_get_link_uptime(), (long) (end - start));
+	failure++;
+    }
+    if (!ppp_get_link_stats(&stats) || stats.bytes_in != bytes) {
+	printf("%s: %" PRIu64 " bytes in, not %" PRIu64 "\n", name,
+	       stats.bytes_in, bytes);
+	failure++;
+    }
+    return failure;
+}
+
+/*
+ * Take the link up and down twice, as with persist or demand, and
+ * check that the second session doesn't report the first one's time.
+ */
+int
+main(int argc, char *argv[])
+{
+    int failure = 0;
+
+    failure += session("first session", 100, 160, 1000);
+    failure += session("second session", 200, 210, 500);
+
+    /* bringing the link up again forgets the last connect time */
+    test_now = 300;
+    phase = PHASE_ESTABLISH;
+    link_stats_start();
+    test_now = 303;
+    if (ppp_get_link_uptime() != 3) {
+	printf("third session: uptime before IPCP is up is %d, not 3\n",
+	       ppp_get_link_uptime());
+	failure++;
+    }
+    return failure;
+}
+#endif /* UNIT_TEST */
@@ -46,9 +46,18 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
 
 #include "pppd-private.h"
 #include "magic.h"
@@ -57,6 +66,63 @@
 extern long mrand48 (void);
 extern void srand48 (long);
 
+/*
+ * Random bytes for challenges and magic numbers are taken from a pool
+ * filled from the kernel's generator RANDOM_POOL bytes at a time, so
+ * that each challenge costs a copy rather than a system call.  Bytes
+ * are wiped as they are handed out.  The pool is refilled after a
+ * fork, so parent and child never hand out the same bytes, and locked
+ * because the offload thread may want some too.
+ */
+#define RANDOM_POOL	4096
+
+static unsigned char random_pool[RANDOM_POOL];
+static int random_left;			/* bytes not yet handed out */
+static pid_t random_pid;		/* process that filled the pool */
+#ifdef HAVE_PTHREAD_CREATE
+static pthread_mutex_t random_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/*
+ * random_fill - fill buf from the kernel, returning 0 if we can't.
+ */
+static int
+random_fill(unsigned char *buf, size_t len)
+{
+    ssize_t n;
+    int fd;
+
+#ifdef HAVE_GETRANDOM
+    while (len > 0) {
+	n = getrandom(buf, len, 0);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	buf += n;
+	len -= n;
+    }
+    if (len == 0)
+	return 1;
+#endif
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+	return 0;
+    while (len > 0) {
+	n = read(fd, buf, len);
+	if (n <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    break;
+	}
+	buf += n;
+	len -= n;
+    }
+    close(fd);
+    return len == 0;
+}
+
 /*
  * magic_init - Initialize the magic number generator.
  *
@@ -81,7 +147,10 @@ magic_init(void)
 u_int32_t
 magic(void)
 {
-    return (u_int32_t) mrand48();
+    u_int32_t m;
+
+    random_bytes((unsigned char *) &m, sizeof(m));
+    return m;
 }
 
 /*
@@ -90,10 +159,33 @@ magic(void)
 void
 random_bytes(unsigned char *buf, int len)
 {
-	int i;
+    unsigned char *p;
+    int i, n;
 
-	for (i = 0; i < len; ++i)
-		buf[i] = mrand48() >> 24;
+#ifdef HAVE_PTHREAD_CREATE
+    pthread_mutex_lock(&random_lock);
+#endif
+    while (len > 0) {
+	if (random_left == 0 || random_pid != getpid()) {
+	    if (!random_fill(random_pool, sizeof(random_pool))) {
+		/* no kernel generator: fall back on drand48 */
+		for (i = 0; i < RANDOM_POOL; ++i)
+		    random_pool[i] = mrand48() >> 24;
+	    }
+	    random_left = RANDOM_POOL;
+	    random_pid = getpid();
+	}
+	n = len < random_left? len: random_left;
+	p = random_pool + RANDOM_POOL - random_left;
+	memcpy(buf, p, n);
+	memset(p, 0, n);
+	random_left -= n;
+	buf += n;
+	len -= n;
+    }
+#ifdef HAVE_PTHREAD_CREATE
+    pthread_mutex_unlock(&random_lock);
+#endif
 }
 
 #ifdef NO_DRAND48
@@ -66,6 +66,8 @@
  * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE		/* for the posix_spawn extensions */
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -79,6 +81,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <syslog.h>
+#include <time.h>
 #include <netdb.h>
 #include <utmp.h>
 #include <pwd.h>
@@ -87,13 +90,16 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <limits.h>
 #include <inttypes.h>
 #include <net/if.h>
+#include <spawn.h>
 
 #include "pppd-private.h"
 #include "options.h"
@@ -121,6 +127,15 @@
 #include "cbcp.h"
 #endif
 
+#if defined(PPP_WITH_EAPTLS) || defined(PPP_WITH_PEAP)
+#include <openssl/ssl.h>
+#include "tls.h"
+#endif
+
+#ifdef PPP_WITH_EAPTLS
+#include "eap-tls.h"
+#endif
+
 #ifdef AT_CHANGE
 #include "atcp.h"
 #endif
@@ -141,6 +156,8 @@ struct notifier *phasechange = NULL;
 struct notifier *exitnotify = NULL;
 struct notifier *sigreceived = NULL;
 struct notifier *fork_notifier = NULL;
+struct notifier *prefork_notifier = NULL;
+struct notifier *prefork_pool_notifier = NULL;
 
 int hungup;			/* terminal has been hung up */
 int privileged;			/* we're running as real uid root */
@@ -155,13 +172,38 @@ int ppp_session_number;		/* Session number, for channels with such a
 int childwait_done;		/* have timed out waiting for children */
 
 #ifdef PPP_WITH_TDB
+/*
+ * Chains in the database, which holds several records for each
+ * session; a prime, as the hash is taken modulo this.
+ */
+#define PPPDB_HASH_SIZE	8191
+
+/* Pack the database on exit once it has this many free fragments. */
+#define PPPDB_REPACK_FRAGMENTS	128
+
 TDB_CONTEXT *pppdb;		/* database for storing status etc. */
+static int db_dirty;		/* script_env changed since our entry was stored */
+static int db_batching;		/* database changes are being queued */
+static int db_pid;		/* the pid in db_key and our index entries */
+
+/*
+ * Variables with a session index: a record under "VAR_INDEX=value"
+ * holding, as an array of int32_t, the pid of each pppd that has
+ * that value, so that pppd-sessions can find the sessions for a user,
+ * an address or an interface without traversing the database.  Unlike
+ * a key, an index can name several pppds, as when a user has more
+ * than one session.
+ */
+static const char *db_indexed[] = {
+    "IFNAME", "IPLOCAL", "IPREMOTE", "PEERNAME", NULL
+};
 #endif
 
 char db_key[32];
 
 int (*holdoff_hook)(void) = NULL;
 int (*new_phase_hook)(int) = NULL;
+int (*script_hook)(char *, char * const *) = NULL;
 void (*snoop_recv_hook)(unsigned char *p, int len) = NULL;
 void (*snoop_send_hook)(unsigned char *p, int len) = NULL;
 
@@ -177,15 +219,26 @@ int asked_to_quit;
 int open_ccp_flag;
 int listen_time;
 int got_sigusr2;
+static int got_sigusr1;
 int got_sigterm;
 int got_sighup;
 
 static sigset_t signals_handled;
 static int waiting;
 static int sigpipe[2];
+static int sigfd = -1;		/* fd for reading signals, if use_signalfd */
 
 char **script_env;		/* Env. variable values for scripts */
 int s_env_nalloc;		/* # words avail at script_env */
+static int s_env_count;		/* # variables in script_env */
+
+/*
+ * Open-addressed hash of the variables in script_env by name, holding
+ * 1 + their index, so that setting one doesn't mean comparing it with
+ * all the others.  If we can't get memory for it we search script_env.
+ */
+static int *env_hash;
+static int env_hash_size;	/* a power of 2, > 2 * s_env_count */
 
 u_char outpacket_buf[PPP_MRU+PPP_HDRLEN]; /* buffer for outgoing packet */
 u_char inpacket_buf[PPP_MRU+PPP_HDRLEN]; /* buffer for incoming packet */
@@ -197,17 +250,9 @@ int privopen;			/* don't lock, open device as root */
 
 char *no_ppp_msg = "Sorry - this system lacks PPP kernel support\n";
 
-GIDSET_TYPE groups[NGROUPS_MAX];/* groups the user is in */
+GIDSET_TYPE *groups;		/* groups the user is in */
 int ngroups;			/* How many groups valid in groups */
 
-static struct timeval start_time;	/* Time when link was started. */
-
-static struct pppd_stats old_link_stats;
-struct pppd_stats link_stats;
-unsigned link_connect_time;
-int link_stats_valid;
-int link_stats_print;
-
 int error_count;
 
 bool bundle_eof;
@@ -223,6 +268,7 @@ struct subprocess {
     void	(*done)(void *);
     void	*arg;
     int		killable;
+    struct timeval start;
     struct subprocess *next;
 };
 
@@ -235,8 +281,13 @@ static void create_pidfile(int pid);
 static void create_linkpidfile(int pid);
 static void cleanup(void);
 static void get_input(void);
+static void input_packet(u_char *, int);
+static void build_proto_table(void);
+static void prefork_server(int *, char ***);
 static void calltimeout(void);
 static struct timeval *timeleft(struct timeval *);
+static void wait_for_events(void);
+static void call_fd_handlers(void);
 static void kill_my_pg(int);
 static void hup(int);
 static void term(int);
@@ -244,7 +295,9 @@ static void chld(int);
 static void toggle_debug(int);
 static void open_ccp(int);
 static void bad_signal(int);
+static void handle_signal_fd(void);
 static void holdoff_end(void *);
+static int wait_for_admission(void);
 static void forget_child(int pid, int status);
 static int reap_kids(void);
 static void childwait_end(void *);
@@ -253,7 +306,11 @@ static void childwait_end(void *);
 static void update_db_entry(void);
 static void add_db_key(const char *);
 static void delete_db_key(const char *);
+static void db_index(const char *, int);
+static void flush_db(void);
 static void cleanup_db(void);
+static void db_rekey(void);
+static void db_snapshot(void *);
 #endif
 
 static void handle_events(void);
@@ -323,11 +380,6 @@ int ppp_ifunit()
     return ifunit;
 }
 
-int ppp_get_link_uptime()
-{
-    return link_connect_time;
-}
-
 /*
  * PPP Data Link Layer "protocol" table.
  * One entry per supported protocol.
@@ -362,8 +414,6 @@ main(int argc, char *argv[])
     struct protent *protp;
     char numbuf[16];
 
-    PPP_crypto_init();
-
     strlcpy(path_ipup, PPP_PATH_IPUP, MAXPATHLEN);
     strlcpy(path_ipdown, PPP_PATH_IPDOWN, MAXPATHLEN);
 
@@ -394,7 +444,18 @@ main(int argc, char *argv[])
     slprintf(numbuf, sizeof(numbuf), "%d", uid);
     ppp_script_setenv("ORIG_UID", numbuf, 0);
 
-    ngroups = getgroups(NGROUPS_MAX, groups);
+    /* NGROUPS_MAX can be 65536, so only take room for the ones we have */
+    ngroups = getgroups(0, NULL);
+    if (ngroups > 0) {
+	groups = malloc(ngroups * sizeof(*groups));
+	if (groups == NULL)
+	    novm("group list");
+	ngroups = getgroups(ngroups, groups);
+    }
+    if (ngroups < 0)
+	ngroups = 0;
+    ppp_mem_account("packet-buffers",
+		    sizeof(inpacket_buf) + sizeof(outpacket_buf), 0);
 
     /*
      * Initialize magic number generator now so that protocols may
@@ -407,6 +468,7 @@ main(int argc, char *argv[])
      */
     for (i = 0; (protp = protocols[i]) != NULL; ++i)
         (*protp->init)(0);
+    build_proto_table();
 
     /*
      * Initialize the default channel.
@@ -419,10 +481,27 @@ main(int argc, char *argv[])
      * Parse, in order, the system options file, the user's options file,
      * and the command line arguments.
      */
+    prof_begin(PROF_OPTIONS);
     if (!ppp_options_from_file(PPP_PATH_SYSOPTIONS, !privileged, 0, 1)
 	|| !options_from_user()
 	|| !parse_args(argc-1, argv+1))
 	exit(EXIT_OPTION_ERROR);
+    prof_end(PROF_OPTIONS);
+
+    /*
+     * In a pre-forking server, we come back from here in a new
+     * process for each session, with the session's own options.
+     */
+    if (prefork_path[0]) {
+	int sargc;
+	char **sargv;
+
+	prefork_server(&sargc, &sargv);
+	prof_begin(PROF_OPTIONS);
+	if (!parse_args(sargc, sargv))
+	    exit(EXIT_OPTION_ERROR);
+	prof_end(PROF_OPTIONS);
+    }
     devnam_fixed = 1;		/* can no longer change device name */
 
     /*
@@ -495,16 +574,22 @@ main(int argc, char *argv[])
     sys_init();
 
 #ifdef PPP_WITH_TDB
-    pppdb = tdb_open(PPP_PATH_PPPDB, 0, 0, O_RDWR|O_CREAT, 0644);
+    pppdb = tdb_open(PPP_PATH_PPPDB, PPPDB_HASH_SIZE, TDB_SIPHASH,
+		     O_RDWR|O_CREAT, 0644);
     if (pppdb != NULL) {
-	slprintf(db_key, sizeof(db_key), "pppd%d", getpid());
+	db_pid = getpid();
+	slprintf(db_key, sizeof(db_key), "pppd%d", db_pid);
 	update_db_entry();
+	if (db_snapshot_interval > 0)
+	    db_snapshot(NULL);
     } else {
 	warn("Warning: couldn't open ppp database %s", PPP_PATH_PPPDB);
 	if (multilink) {
 	    warn("Warning: disabling multilink");
 	    multilink = 0;
 	}
+	if (admit_rate > 0)
+	    warn("Warning: disabling admission control");
     }
 #endif
 
@@ -534,6 +619,8 @@ main(int argc, char *argv[])
 
     create_linkpidfile(getpid());
 
+    control_start();
+
     waiting = 0;
 
     /*
@@ -589,7 +676,10 @@ main(int argc, char *argv[])
 	    info("Starting link");
 	}
 
-	ppp_get_time(&start_time);
+	if (!wait_for_admission())
+	    break;
+
+	link_stats_start();
 	ppp_script_unsetenv("CONNECT_TIME");
 	ppp_script_unsetenv("BYTES_SENT");
 	ppp_script_unsetenv("BYTES_RCVD");
@@ -666,22 +756,42 @@ main(int argc, char *argv[])
 static void
 handle_events(void)
 {
-    struct timeval timo;
     unsigned char buf[16];
 
+    prof_begin(PROF_LOOP);
     kill_link = open_ccp_flag = 0;
 
+#ifdef PPP_WITH_TDB
+    /* write out what the last round of events did to our entry */
+    flush_db();
+#endif
+
+    /* pick up any signals queued since we last looked */
+    if (sigfd >= 0)
+	handle_signal_fd();
+
+    /* log what we didn't stop to log while handling the last events */
+    flush_log();
+
     /* alert via signal pipe */
     waiting = 1;
     /* flush signal pipe */
     for (; read(sigpipe[0], buf, sizeof(buf)) > 0; );
-    add_fd(sigpipe[0]);
     /* wait if necessary */
-    if (!(got_sighup || got_sigterm || got_sigusr2 || got_sigchld))
-	wait_input(timeleft(&timo));
+    if (!(got_sighup || got_sigterm || got_sigusr1 || got_sigusr2
+	  || got_sigchld)) {
+	prof_begin(PROF_WAIT);
+	wait_for_events();
+	prof_end(PROF_WAIT);
+    }
     waiting = 0;
-    remove_fd(sigpipe[0]);
+    link_stats_expire();
+    if (sigfd >= 0)
+	handle_signal_fd();
 
+    prof_begin(PROF_FDS);
+    call_fd_handlers();
+    prof_end(PROF_FDS);
     calltimeout();
     if (got_sighup) {
 	info("Hangup (SIGHUP)");
@@ -702,10 +812,15 @@ handle_events(void)
 	got_sigchld = 0;
 	reap_kids();	/* Don't leave dead kids lying around */
     }
+    if (got_sigusr1) {
+	got_sigusr1 = 0;
+	trace_dump();
+    }
     if (got_sigusr2) {
 	open_ccp_flag = 1;
 	got_sigusr2 = 0;
     }
+    prof_end(PROF_LOOP);
 }
 
 /*
@@ -724,6 +839,12 @@ setup_signals(void)
     fcntl(sigpipe[0], F_SETFL, fcntl(sigpipe[0], F_GETFL) | O_NONBLOCK);
     fcntl(sigpipe[1], F_SETFL, fcntl(sigpipe[1], F_GETFL) | O_NONBLOCK);
 
+    /*
+     * The signal pipe is only ever read by handle_events, so it can stay
+     * in the set of fds that wait_input waits for.
+     */
+    add_fd(sigpipe[0]);
+
     /*
      * Compute mask of all interesting signals and install signal handlers
      * for each.  Only one signal handler may be active at a time.  Therefore,
@@ -797,6 +918,62 @@ setup_signals(void)
      * be sufficient.
      */
     signal(SIGPIPE, SIG_IGN);
+
+    /*
+     * With the signalfd option, the signals we act on in the main loop
+     * are blocked and read from an fd along with the other input, so
+     * their handlers are called from handle_events rather than
+     * asynchronously.  The handlers above stay installed in case the
+     * signals ever get unblocked.
+     */
+    if (use_signalfd) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+	sigfd = open_signal_fd(&mask);
+	if (sigfd >= 0)
+	    add_fd(sigfd);
+	else
+	    warn("Couldn't set up signalfd, using signal handlers: %m");
+    }
+}
+
+/*
+ * handle_signal_fd - run the handlers for any signals queued on sigfd.
+ * Several SIGCHLDs arriving together are coalesced by the kernel, so
+ * reap_kids gets to collect all the exited children in one go.
+ */
+static void
+handle_signal_fd(void)
+{
+    int sig;
+
+    while ((sig = read_signal_fd()) > 0) {
+	switch (sig) {
+	case SIGHUP:
+	    hup(sig);
+	    break;
+	case SIGINT:
+	case SIGTERM:
+	    term(sig);
+	    break;
+	case SIGCHLD:
+	    chld(sig);
+	    break;
+	case SIGUSR1:
+	    toggle_debug(sig);
+	    break;
+	case SIGUSR2:
+	    open_ccp(sig);
+	    break;
+	}
+    }
 }
 
 /*
@@ -831,18 +1008,24 @@ detach(void)
     int pid;
     int ret;
     char numbuf[16];
-    int pipefd[2];
+    int pipefd[2], readyfd[2];
 
     if (detached)
 	return;
     if (pipe(pipefd) == -1)
 	pipefd[0] = pipefd[1] = -1;
+    if (pipe(readyfd) == -1)
+	readyfd[0] = readyfd[1] = -1;
     if ((pid = fork()) < 0) {
 	error("Couldn't detach (fork failed: %m)");
 	die(1);			/* or just return? */
     }
     if (pid != 0) {
 	/* parent */
+	close(readyfd[1]);
+	/* don't go until the child holds its own database locks */
+	complete_read(readyfd[0], numbuf, 1);
+	close(readyfd[0]);
 	notify(pidchange, pid);
 	/* update pid files if they have been written already */
 	if (pidfilename[0])
@@ -850,6 +1033,21 @@ detach(void)
 	create_linkpidfile(pid);
 	exit(0);		/* parent dies */
     }
+    close(readyfd[0]);
+#ifdef PPP_WITH_TDB
+    /*
+     * fcntl locks aren't inherited, so the read lock on the database
+     * that tells a new pppd that it is in use (and mustn't have its
+     * chain mutexes reset) would go with the parent.  Take our own.
+     */
+    if (pppdb != NULL && tdb_reopen(pppdb) != 0) {
+	warn("Warning: couldn't reopen ppp database %s", PPP_PATH_PPPDB);
+	pppdb = NULL;
+    }
+    if (pppdb != NULL)
+	db_rekey();
+#endif
+    close(readyfd[1]);
     setsid();
     ret = chdir("/");
     if (ret != 0) {
@@ -870,6 +1068,171 @@ detach(void)
     close(pipefd[0]);
 }
 
+/*
+ * prefork_server - accept session requests on prefork_path.
+ * By now the options files and command line have been read and the
+ * plugins loaded, so each session process forked from here starts
+ * with all of that already done, shared copy-on-write.  Only the
+ * children return, with the words of their request to be parsed as
+ * extra command-line options; the parent serves requests forever.
+ *
+ * A request is one message on a SOCK_SEQPACKET connection holding
+ * NUL-terminated option words.  It may carry a file descriptor in
+ * an SCM_RIGHTS message, which becomes the session's stdin and
+ * stdout.  The session writes its process ID back on the connection.
+ */
+#define PREFORK_MSGLEN	4096
+#define PREFORK_MAXARGS	256
+#define PREFORK_REFRESH	60	/* seconds between looks at TLS files */
+
+static void
+prefork_fill(void)
+{
+    sys_prefork_pool(prefork_pool);
+    notify(prefork_pool_notifier, prefork_pool);
+}
+
+static void
+prefork_server(int *argcp, char ***argvp)
+{
+    static char buf[PREFORK_MSGLEN];
+    static char *args[PREFORK_MAXARGS];
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    union {
+	struct cmsghdr hdr;
+	char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    int sock, conn, fd, pid, n, nargs;
+    char numbuf[16];
+    char *p;
+
+    if (strlen(prefork_path) >= sizeof(addr.sun_path))
+	fatal("prefork-socket name %s is too long", prefork_path);
+    sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0)
+	fatal("Couldn't create socket for prefork-socket: %m");
+    fcntl(sock, F_SETFD, FD_CLOEXEC);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strlcpy(addr.sun_path, prefork_path, sizeof(addr.sun_path));
+    unlink(prefork_path);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	|| chmod(prefork_path, 0600) < 0 || listen(sock, 64) < 0)
+	fatal("Couldn't listen on %s: %m", prefork_path);
+
+    /* let plugins and libraries do their expensive setup once */
+    notify(prefork_notifier, 0);
+    PPP_crypto_init();
+#if defined(PPP_WITH_EAPTLS) || defined(PPP_WITH_PEAP)
+    tls_init();
+#endif
+#ifdef PPP_WITH_EAPTLS
+    eaptls_load_contexts();
+#endif
+
+    /* the kernel reaps the session processes for us */
+    signal(SIGCHLD, SIG_IGN);
+    notice("pppd %s serving sessions on %s", VERSION, prefork_path);
+
+    for (;;) {
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+
+	/*
+	 * Between bursts of requests, make interfaces and the like
+	 * ready for the next prefork_pool sessions.
+	 */
+	if (prefork_pool > 0 && poll(&pfd, 1, 0) == 0)
+	    prefork_fill();
+
+	/*
+	 * While idle, look now and then for certificates and CRLs that
+	 * have changed, so that sessions don't have to load them.
+	 */
+	if (poll(&pfd, 1, PREFORK_REFRESH * 1000) == 0) {
+#ifdef PPP_WITH_EAPTLS
+	    eaptls_load_contexts();
+#endif
+	    continue;
+	}
+	conn = accept(sock, NULL, NULL);
+	if (conn < 0) {
+	    if (errno != EINTR && errno != ECONNABORTED) {
+		error("prefork-socket accept failed: %m");
+		sleep(1);
+	    }
+	    continue;
+	}
+
+	fd = -1;
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = sizeof(buf);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.space;
+	msg.msg_controllen = sizeof(control.space);
+	n = recvmsg(conn, &msg, 0);
+	if (n > 0) {
+	    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+		 cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET
+		    && cmsg->cmsg_type == SCM_RIGHTS
+		    && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+		    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (n <= 0 || buf[n-1] != 0
+	    || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+	    warn("Discarding malformed request on prefork-socket");
+	} else if ((pid = fork()) < 0) {
+	    error("Couldn't fork for session: %m");
+	} else if (pid == 0) {
+	    break;
+	} else if (prefork_pool > 0) {
+	    sys_prefork_pool(-1);
+	    notify(prefork_pool_notifier, -1);
+	}
+	if (fd >= 0)
+	    close(fd);
+	close(conn);
+    }
+
+    /* in the session process */
+    close(sock);
+    /* not the server's drand48 state, which every session would share */
+    magic_init();
+    if (prefork_pool > 0) {
+	sys_prefork_pool(0);
+	notify(prefork_pool_notifier, 0);
+    }
+    signal(SIGCHLD, SIG_DFL);
+    nargs = 0;
+    for (p = buf; p < buf + n; p += strlen(p) + 1) {
+	if (*p == 0)
+	    continue;
+	if (nargs >= PREFORK_MAXARGS)
+	    fatal("Too many options in session request");
+	args[nargs++] = p;
+    }
+    if (fd >= 0) {
+	dup2(fd, 0);
+	dup2(fd, 1);
+	if (fd > 1)
+	    close(fd);
+    }
+    slprintf(numbuf, sizeof(numbuf), "%d\n", getpid());
+    if (write(conn, numbuf, strlen(numbuf)) < 0)
+	warn("Couldn't send pid on prefork-socket: %m");
+    close(conn);
+
+    *argcp = nargs;
+    *argvp = args;
+}
+
 /*
  * reopen_log - (re)open our connection to syslog.
  */
@@ -942,6 +1305,197 @@ holdoff_end(void *arg)
     new_phase(PHASE_DORMANT);
 }
 
+#ifdef PPP_WITH_TDB
+/*
+ * Admission control.  With admit-rate set, the pppd processes on
+ * this system share a token bucket kept in the database, and each
+ * has to take a token from it before starting the link.  The bucket
+ * refills at admit-rate tokens per second and holds at most
+ * admit-burst tokens, so after an outage the links come back at a
+ * steady rate instead of all hitting the authentication servers
+ * at once.
+ */
+#define ADMIT_KEY	"pppd admission"
+
+struct admit_bucket {
+    long	sec;		/* when the bucket was last updated */
+    long	usec;
+    long	mtokens;	/* tokens available, in thousandths */
+};
+
+/*
+ * admit_delay - try to take a token from the bucket.  Returns 0 if
+ * we got one, otherwise the number of milliseconds until one will
+ * be available.
+ */
+static int
+admit_delay(void)
+{
+    TDB_DATA key, dbuf;
+    struct admit_bucket b;
+    struct timeval now;
+    long elapsed, mtokens, full;
+    int wait;
+
+    if (admit_rate <= 0 || pppdb == NULL)
+	return 0;
+    full = (admit_burst > 0? admit_burst: 1) * 1000L;
+    ppp_get_time(&now);
+
+    key.dptr = ADMIT_KEY;
+    key.dsize = strlen(key.dptr);
+    tdb_chainlock(pppdb, key);
+    mtokens = full;
+    dbuf = tdb_fetch(pppdb, key);
+    if (dbuf.dptr != NULL) {
+	if (dbuf.dsize == sizeof(b)) {
+	    memcpy(&b, dbuf.dptr, sizeof(b));
+	    elapsed = (now.tv_sec - b.sec) * 1000
+		+ (now.tv_usec - b.usec) / 1000;
+	    /* an entry from before a reboot can be in the future */
+	    if (elapsed >= 0 && elapsed < full)
+		mtokens = b.mtokens + elapsed * admit_rate;
+	    if (mtokens > full)
+		mtokens = full;
+	}
+	free(dbuf.dptr);
+    }
+
+    wait = 0;
+    if (mtokens >= 1000)
+	mtokens -= 1000;
+    else
+	wait = (1000 - mtokens + admit_rate - 1) / admit_rate;
+
+    b.sec = now.tv_sec;
+    b.usec = now.tv_usec;
+    b.mtokens = mtokens;
+    dbuf.dptr = (char *) &b;
+    dbuf.dsize = sizeof(b);
+    if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
+	error("tdb_store failed: %s", tdb_errorstr(pppdb));
+    tdb_chainunlock(pppdb, key);
+
+    return wait;
+}
+
+/*
+ * The peer cache.  With peer-cache set, each of LCP, IPCP and CCP
+ * saves what it ended up with, once it is open, under the peer's name
+ * for the link: the remote number if there is one, such as the access
+ * concentrator's address with PPPoE, or else the device.  The next
+ * time the link to that peer starts, within peer-cache seconds, the
+ * protocol asks for those values in its first Configure-Request
+ * instead of the ones configured, which the peer would only nak or
+ * reject again, costing a round trip each time.
+ */
+struct peer_cache_hdr {
+    long	sec;		/* when it was saved */
+    int		len;		/* length of what follows */
+};
+
+static void
+peer_cache_key(TDB_DATA *key, char *buf, int buflen, int protocol)
+{
+    slprintf(buf, buflen, "peer %x %s", protocol,
+	     remote_number[0]? remote_number: devnam);
+    key->dptr = buf;
+    key->dsize = strlen(buf);
+}
+
+/*
+ * peer_cache_get - get what protocol saved for this peer into data,
+ * which is len bytes long.  Returns 1 if there was a recent enough
+ * entry of that length.
+ */
+int
+peer_cache_get(int protocol, void *data, int len)
+{
+    TDB_DATA key, dbuf;
+    struct peer_cache_hdr h;
+    struct timeval now;
+    char kbuf[MAXPATHLEN + 16];
+    int ret = 0;
+
+    if (peer_cache_time <= 0 || pppdb == NULL)
+	return 0;
+    peer_cache_key(&key, kbuf, sizeof(kbuf), protocol);
+    dbuf = tdb_fetch(pppdb, key);
+    if (dbuf.dptr == NULL)
+	return 0;
+    ppp_get_time(&now);
+    if (dbuf.dsize == sizeof(h) + len) {
+	memcpy(&h, dbuf.dptr, sizeof(h));
+	if (h.len == len && now.tv_sec >= h.sec
+	    && now.tv_sec - h.sec <= peer_cache_time) {
+	    memcpy(data, dbuf.dptr + sizeof(h), len);
+	    ret = 1;
+	}
+    }
+    free(dbuf.dptr);
+    return ret;
+}
+
+/*
+ * peer_cache_put - save len bytes from data for protocol, for the next
+ * time the link to this peer starts.
+ */
+void
+peer_cache_put(int protocol, void *data, int len)
+{
+    TDB_DATA key, dbuf;
+    struct peer_cache_hdr h;
+    struct timeval now;
+    char kbuf[MAXPATHLEN + 16];
+    char *buf;
+
+    if (peer_cache_time <= 0 || pppdb == NULL)
+	return;
+    if ((buf = malloc(sizeof(h) + len)) == NULL)
+	return;
+    ppp_get_time(&now);
+    h.sec = now.tv_sec;
+    h.len = len;
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf + sizeof(h), data, len);
+    peer_cache_key(&key, kbuf, sizeof(kbuf), protocol);
+    dbuf.dptr = buf;
+    dbuf.dsize = sizeof(h) + len;
+    if (tdb_store(pppdb, key, dbuf, TDB_REPLACE))
+	error("tdb_store failed: %s", tdb_errorstr(pppdb));
+    free(buf);
+}
+#endif /* PPP_WITH_TDB */
+
+/*
+ * wait_for_admission - wait until admission control lets us start
+ * the link.  Returns 0 if we were asked to quit while waiting.
+ */
+static int
+wait_for_admission(void)
+{
+#ifdef PPP_WITH_TDB
+    int t;
+
+    while ((t = admit_delay()) > 0) {
+	/* spread out the processes that are waiting */
+	t += magic() % (1000 / admit_rate + 1);
+	dbglog("Waiting %d ms to be admitted", t);
+	new_phase(PHASE_HOLDOFF);
+	ppp_timeout(holdoff_end, NULL, t / 1000, (t % 1000) * 1000);
+	do {
+	    handle_events();
+	    if (kill_link)
+		new_phase(PHASE_DORMANT);
+	} while (phase == PHASE_HOLDOFF);
+	UNTIMEOUT(holdoff_end, NULL);
+	if (asked_to_quit)
+	    return 0;
+    }
+#endif
+    return 1;
+}
+
 /* List of protocol names, to make our messages a little more informative. */
 struct protocol_list {
     u_short	proto;
@@ -1092,35 +1646,132 @@ protocol_name(int proto)
 }
 
 /*
- * get_input - called when incoming data is available.
+ * Table for looking up the protocol that handles a given PPP protocol
+ * number, so that input_packet doesn't have to search protocols[] for
+ * every packet.  It is indexed by the high byte of the protocol number
+ * and then the low byte; pages of the second level are only allocated
+ * for the high bytes that are actually in use.  Each slot records the
+ * first entry in protocols[] that handles the number, either as its
+ * control protocol or (with PSLOT_DATA) as its data protocol.
+ */
+struct proto_slot {
+    struct protent *protp;	/* protocol handling this number */
+    unsigned char flags;
+};
+
+#define PSLOT_DATA	1	/* pass to protp->datainput, not input */
+#define PSLOT_EARLY	2	/* accepted before the network phase */
+
+static struct proto_slot *proto_table[256];
+
+static struct proto_slot *
+proto_slot_alloc(u_short proto)
+{
+    struct proto_slot **pagep = &proto_table[proto >> 8];
+
+    if (*pagep == NULL) {
+	*pagep = calloc(256, sizeof(struct proto_slot));
+	if (*pagep == NULL)
+	    novm("protocol table");
+    }
+    return &(*pagep)[proto & 0xff];
+}
+
+static inline struct proto_slot *
+proto_slot_find(u_short proto)
+{
+    struct proto_slot *page = proto_table[proto >> 8];
+
+    return page == NULL? NULL: &page[proto & 0xff];
+}
+
+/*
+ * build_proto_table - fill in proto_table from protocols[].
  */
 static void
-get_input(void)
+build_proto_table(void)
 {
-    int len, i;
-    u_char *p;
-    u_short protocol;
+    static const u_short early_protos[] = {
+	PPP_LCP, PPP_LQR, PPP_PAP, PPP_CHAP, PPP_EAP
+    };
     struct protent *protp;
+    struct proto_slot *slot;
+    int i;
 
-    p = inpacket_buf;	/* point to beginning of packet buffer */
+    for (i = 0; (protp = protocols[i]) != NULL; ++i) {
+	slot = proto_slot_alloc(protp->protocol);
+	if (slot->protp == NULL) {
+	    slot->protp = protp;
+	    slot->flags &= ~PSLOT_DATA;
+	}
+	if (protp->datainput != NULL) {
+	    slot = proto_slot_alloc(protp->protocol & ~0x8000);
+	    if (slot->protp == NULL) {
+		slot->protp = protp;
+		slot->flags |= PSLOT_DATA;
+	    }
+	}
+    }
+    for (i = 0; i < sizeof(early_protos) / sizeof(early_protos[0]); ++i)
+	proto_slot_alloc(early_protos[i])->flags |= PSLOT_EARLY;
+}
 
-    len = read_packet(inpacket_buf);
-    if (len < 0)
-	return;
+/*
+ * Maximum number of packets get_input will read each time it is called,
+ * so that a stream of incoming packets can't starve timeouts and
+ * signal handling.
+ */
+#define MAX_INPUT_BATCH	16
+
+/*
+ * get_input - called when incoming data is available.
+ * Reads and dispatches packets until there are none left waiting,
+ * rather than going back to wait_input after each one.
+ */
+static void
+get_input(void)
+{
+    int len, n;
 
-    if (len == 0) {
-	if (bundle_eof && mp_master()) {
-	    notice("Last channel has disconnected");
-	    mp_bundle_terminated();
+    for (n = 0; n < MAX_INPUT_BATCH; ++n) {
+	len = read_packet(inpacket_buf);
+	if (len < 0)
+	    return;
+
+	if (len == 0) {
+	    if (bundle_eof && mp_master()) {
+		notice("Last channel has disconnected");
+		mp_bundle_terminated();
+		return;
+	    }
+	    notice("Modem hangup");
+	    hungup = 1;
+	    code = EXIT_HANGUP;
+	    lcp_lowerdown(0);	/* serial link is no longer available */
+	    link_terminated(0);
 	    return;
 	}
-	notice("Modem hangup");
-	hungup = 1;
-	code = EXIT_HANGUP;
-	lcp_lowerdown(0);	/* serial link is no longer available */
-	link_terminated(0);
-	return;
+
+	prof_input_begin();
+	input_packet(inpacket_buf, len);
+	prof_input_end(len >= PPP_HDRLEN? PPP_PROTOCOL(inpacket_buf): 0);
+
+	/* stop if that packet took the link down */
+	if (phase == PHASE_DEAD)
+	    return;
     }
+}
+
+/*
+ * input_packet - pass a received packet to the protocol it is for.
+ */
+static void
+input_packet(u_char *p, int len)
+{
+    int i;
+    u_short protocol;
+    struct protent *protp;
+    struct proto_slot *slot;
 
     if (len < PPP_HDRLEN) {
 	dbglog("received short packet:%.*B", len, p);
@@ -1129,10 +1780,12 @@ get_input(void)
 
     dump_packet("rcvd", p, len);
     if (snoop_recv_hook) snoop_recv_hook(p, len);
+    snoop_packet(p, len, 1);
 
     p += 2;				/* Skip address and control */
     GETSHORT(protocol, p);
     len -= PPP_HDRLEN;
+    PPP_PROBE2(pppd, input, protocol, len);
 
     /*
      * Toss all non-LCP packets unless LCP is OPEN.
@@ -1146,10 +1799,9 @@ get_input(void)
      * Until we get past the authentication phase, toss all packets
      * except LCP, LQR and authentication packets.
      */
+    slot = proto_slot_find(protocol);
     if (phase <= PHASE_AUTHENTICATE
-	&& !(protocol == PPP_LCP || protocol == PPP_LQR
-	     || protocol == PPP_PAP || protocol == PPP_CHAP ||
-		protocol == PPP_EAP)) {
+	&& (slot == NULL || (slot->flags & PSLOT_EARLY) == 0)) {
 	dbglog("discarding proto 0x%x in phase %d",
 		   protocol, phase);
 	return;
@@ -1158,7 +1810,22 @@ get_input(void)
     /*
      * Upcall the proper protocol input routine.
      */
-    for (i = 0; (protp = protocols[i]) != NULL; ++i) {
+    if (slot != NULL && (protp = slot->protp) != NULL) {
+	if (protp->enabled_flag) {
+	    if (slot->flags & PSLOT_DATA)
+		(*protp->datainput)(0, p, len);
+	    else
+		(*protp->input)(0, p, len);
+	    return;
+	}
+    } else
+	protp = NULL;
+
+    /*
+     * The protocol found above is disabled; see if some later
+     * entry in protocols[] handles this number as well.
+     */
+    for (i = 0; protp != NULL && (protp = protocols[i]) != NULL; ++i) {
 	if (protp->protocol == protocol && protp->enabled_flag) {
 	    (*protp->input)(0, p, len);
 	    return;
@@ -1223,6 +1890,7 @@ void
 new_phase(ppp_phase_t p)
 {
     phase = p;
+    trace_phase(p);
     if (new_phase_hook)
 	(*new_phase_hook)(p);
     notify(phasechange, p);
@@ -1234,6 +1902,23 @@ in_phase(ppp_phase_t p)
     return (phase == p);
 }
 
+/*
+ * phase_name - return the name of phase p, for messages.
+ */
+const char *
+phase_name(int p)
+{
+    static const char *names[] = {
+	"dead", "initialize", "serial connection", "dormant", "establish",
+	"authenticate", "callback", "network", "running", "terminate",
+	"disconnect", "holdoff", "master"
+    };
+
+    if (p < PHASE_DEAD || p > PHASE_MASTER)
+	return "?";
+    return names[p];
+}
+
 /*
  * die - clean up state and exit with the specified status.
  */
@@ -1243,8 +1928,10 @@ die(int status)
 
     if (!mp_on() || mp_master())
 	print_link_stats();
+    prof_dump();
     cleanup();
     notify(exitnotify, status);
+    flush_log();
     syslog(LOG_INFO, "Exit.");
     exit(status);
 }
@@ -1256,6 +1943,7 @@ die(int status)
 static void
 cleanup(void)
 {
+    statsfile_close();
     sys_cleanup();
 
     if (fd_ppp >= 0)
@@ -1265,89 +1953,144 @@ cleanup(void)
     remove_pidfiles();
 
 #ifdef PPP_WITH_TDB
-    if (pppdb != NULL)
+    if (pppdb != NULL) {
+	flush_db();
 	cleanup_db();
+	if (tdb_freelist_size(pppdb) > PPPDB_REPACK_FRAGMENTS)
+	    tdb_repack(pppdb);
+    }
 #endif
 
 }
 
-void
-print_link_stats(void)
-{
-    /*
-     * Print connect time and statistics.
-     */
-    if (link_stats_print && link_stats_valid) {
-       int t = (link_connect_time + 5) / 6;    /* 1/10ths of minutes */
-       info("Connect time %d.%d minutes.", t/10, t%10);
-       info("Sent %u bytes, received %u bytes.",
-	    link_stats.bytes_out, link_stats.bytes_in);
-       link_stats_print = 0;
-    }
-}
 
 /*
- * reset_link_stats - "reset" stats when link goes up.
+ * Pending timeouts are kept in a binary min-heap ordered by expiry
+ * time, so the next one due is always callout_heap[0] and arming or
+ * cancelling a timeout costs O(log n).  Each callout is also hashed
+ * on its (func, arg) pair so that untimeout can find it without
+ * walking every pending timeout.  Callouts with the same expiry time
+ * are run in the order they were armed, as they were with the old
+ * sorted list.
  */
-void
-reset_link_stats(int u)
+struct	callout {
+    struct timeval	c_time;		/* time at which to call routine */
+    void		*c_arg;		/* argument to routine */
+    void		(*c_func)(void *); /* routine */
+    unsigned long	c_seq;		/* sequence number, to order ties */
+    int			c_index;	/* position in callout_heap */
+    struct		callout *c_hnext; /* next in hash chain */
+    struct		callout **c_hprev; /* link pointing at us */
+};
+
+#define CALLOUT_HASH_SIZE	64	/* must be a power of 2 */
+
+static struct callout **callout_heap;	/* heap of pending callouts */
+static int callout_count;		/* # entries in callout_heap */
+static int callout_nalloc;		/* # entries allocated */
+static struct callout *callout_hash[CALLOUT_HASH_SIZE];
+static struct callout *callout_free;	/* callouts available for reuse */
+static unsigned long callout_seq;	/* next sequence number */
+static struct timeval timenow;		/* Current time */
+static int timenow_valid;		/* timenow is up to date */
+
+static unsigned int
+callout_hashfn(void (*func)(void *), void *arg)
 {
-    if (!get_ppp_stats(u, &old_link_stats))
-	return;
-    ppp_get_time(&start_time);
+    uintptr_t h = (uintptr_t) func ^ ((uintptr_t) arg * 31);
+
+    h ^= h >> 16;
+    h ^= h >> 7;
+    return h & (CALLOUT_HASH_SIZE - 1);
 }
 
 /*
- * update_link_stats - get stats at link termination.
+ * callout_before - return true if callout a is due before callout b.
  */
-void
-update_link_stats(int u)
+static int
+callout_before(struct callout *a, struct callout *b)
 {
-    struct timeval now;
-    char numbuf[32];
+    if (a->c_time.tv_sec != b->c_time.tv_sec)
+	return a->c_time.tv_sec < b->c_time.tv_sec;
+    if (a->c_time.tv_usec != b->c_time.tv_usec)
+	return a->c_time.tv_usec < b->c_time.tv_usec;
+    return a->c_seq < b->c_seq;
+}
 
-    if (!get_ppp_stats(u, &link_stats)
-	|| ppp_get_time(&now) < 0)
-	return;
-    link_connect_time = now.tv_sec - start_time.tv_sec;
-    link_stats_valid = 1;
+static void
+callout_set(int i, struct callout *p)
+{
+    callout_heap[i] = p;
+    p->c_index = i;
+}
 
-    link_stats.bytes_in  -= old_link_stats.bytes_in;
-    link_stats.bytes_out -= old_link_stats.bytes_out;
-    link_stats.pkts_in   -= old_link_stats.pkts_in;
-    link_stats.pkts_out  -= old_link_stats.pkts_out;
+static void
+callout_sift_up(int i)
+{
+    struct callout *p = callout_heap[i];
+    int parent;
 
-    slprintf(numbuf, sizeof(numbuf), "%u", link_connect_time);
-    ppp_script_setenv("CONNECT_TIME", numbuf, 0);
-    snprintf(numbuf, sizeof(numbuf), "%" PRIu64, link_stats.bytes_out);
-    ppp_script_setenv("BYTES_SENT", numbuf, 0);
-    snprintf(numbuf, sizeof(numbuf), "%" PRIu64, link_stats.bytes_in);
-    ppp_script_setenv("BYTES_RCVD", numbuf, 0);
+    while (i > 0) {
+	parent = (i - 1) / 2;
+	if (!callout_before(p, callout_heap[parent]))
+	    break;
+	callout_set(i, callout_heap[parent]);
+	i = parent;
+    }
+    callout_set(i, p);
 }
 
-bool
-ppp_get_link_stats(ppp_link_stats_st *stats)
+static void
+callout_sift_down(int i)
 {
-    update_link_stats(0);
-    if (stats != NULL &&
-        link_stats_valid) {
+    struct callout *p = callout_heap[i];
+    int child;
 
-        memcpy(stats, &link_stats, sizeof(*stats));
-        return true;
+    for (;;) {
+	child = 2 * i + 1;
+	if (child >= callout_count)
+	    break;
+	if (child + 1 < callout_count
+	    && callout_before(callout_heap[child + 1], callout_heap[child]))
+	    ++child;
+	if (!callout_before(callout_heap[child], p))
+	    break;
+	callout_set(i, callout_heap[child]);
+	i = child;
     }
-    return false;
+    callout_set(i, p);
 }
 
+/*
+ * callout_remove - take a callout out of the heap and the hash table.
+ * The callout itself is not freed.
+ */
+static void
+callout_remove(struct callout *p)
+{
+    int i = p->c_index;
+    struct callout *last;
 
-struct	callout {
-    struct timeval	c_time;		/* time at which to call routine */
-    void		*c_arg;		/* argument to routine */
-    void		(*c_func)(void *); /* routine */
-    struct		callout *c_next;
-};
+    *p->c_hprev = p->c_hnext;
+    if (p->c_hnext != NULL)
+	p->c_hnext->c_hprev = p->c_hprev;
 
-static struct callout *callout = NULL;	/* Callout list */
-static struct timeval timenow;		/* Current time */
+    last = callout_heap[--callout_count];
+    if (last != p) {
+	callout_set(i, last);
+	if (i > 0 && callout_before(last, callout_heap[(i - 1) / 2]))
+	    callout_sift_up(i);
+	else
+	    callout_sift_down(i);
+    }
+}
+
+static void
+callout_release(struct callout *p)
+{
+    p->c_hnext = callout_free;
+    callout_free = p;
+}
 
 /*
  * timeout - Schedule a timeout.
@@ -1355,16 +2098,35 @@ static struct timeval timenow;		/* Current time */
 void
 ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
 {
-    struct callout *newp, *p, **pp;
+    struct callout *newp, **head;
 
     /*
      * Allocate timeout.
      */
-    if ((newp = (struct callout *) malloc(sizeof(struct callout))) == NULL)
+    if (callout_count >= callout_nalloc) {
+	int new_n = callout_nalloc + 16;
+	struct callout **newheap;
+
+	newheap = realloc(callout_heap, new_n * sizeof(struct callout *));
+	if (newheap == NULL)
+	    fatal("Out of memory in timeout()!");
+	callout_heap = newheap;
+	callout_nalloc = new_n;
+    }
+    if ((newp = callout_free) != NULL)
+	callout_free = newp->c_hnext;
+    else if ((newp = (struct callout *) malloc(sizeof(struct callout))) == NULL)
 	fatal("Out of memory in timeout()!");
     newp->c_arg = arg;
     newp->c_func = func;
-    ppp_get_time(&timenow);
+    newp->c_seq = callout_seq++;
+    PPP_PROBE3(pppd, timeout_add, func, arg, secs * 1000 + usecs / 1000);
+    /*
+     * Timeouts set from within a timeout routine are relative to the
+     * time calltimeout read when it started running them.
+     */
+    if (!timenow_valid)
+	ppp_get_time(&timenow);
     newp->c_time.tv_sec = timenow.tv_sec + secs;
     newp->c_time.tv_usec = timenow.tv_usec + usecs;
     if (newp->c_time.tv_usec >= 1000000) {
@@ -1373,15 +2135,17 @@ ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
     }
 
     /*
-     * Find correct place and link it in.
+     * Link it into the hash table and the heap.
      */
-    for (pp = &callout; (p = *pp); pp = &p->c_next)
-	if (newp->c_time.tv_sec < p->c_time.tv_sec
-	    || (newp->c_time.tv_sec == p->c_time.tv_sec
-		&& newp->c_time.tv_usec < p->c_time.tv_usec))
-	    break;
-    newp->c_next = p;
-    *pp = newp;
+    head = &callout_hash[callout_hashfn(func, arg)];
+    newp->c_hnext = *head;
+    if (*head != NULL)
+	(*head)->c_hprev = &newp->c_hnext;
+    newp->c_hprev = head;
+    *head = newp;
+
+    callout_heap[callout_count] = newp;
+    callout_sift_up(callout_count++);
 }
 
 
@@ -1391,43 +2155,61 @@ ppp_timeout(void (*func)(void *), void *arg, int secs, int usecs)
 void
 ppp_untimeout(void (*func)(void *), void *arg)
 {
-    struct callout **copp, *freep;
+    struct callout *p, *freep = NULL;
 
     /*
-     * Find first matching timeout and remove it from the list.
+     * Find the first matching timeout due and remove it.
      */
-    for (copp = &callout; (freep = *copp); copp = &freep->c_next)
-	if (freep->c_func == func && freep->c_arg == arg) {
-	    *copp = freep->c_next;
-	    free((char *) freep);
-	    break;
-	}
+    for (p = callout_hash[callout_hashfn(func, arg)]; p; p = p->c_hnext)
+	if (p->c_func == func && p->c_arg == arg
+	    && (freep == NULL || callout_before(p, freep)))
+	    freep = p;
+    if (freep != NULL) {
+	callout_remove(freep);
+	callout_release(freep);
+    }
 }
 
 
 /*
  * calltimeout - Call any timeout routines which are now due.
+ * The time is only read once, so a timeout routine which takes a while
+ * doesn't cause later ones to be run in the same pass.
  */
 static void
 calltimeout(void)
 {
     struct callout *p;
+    void (*func)(void *);
+    void *arg;
 
-    while (callout != NULL) {
-	p = callout;
+    if (callout_count == 0)
+	return;
+    if (ppp_get_time(&timenow) < 0)
+	fatal("Failed to get time of day: %m");
+    timenow_valid = 1;
+
+    while (callout_count > 0) {
+	p = callout_heap[0];
 
-	if (ppp_get_time(&timenow) < 0)
-	    fatal("Failed to get time of day: %m");
 	if (!(p->c_time.tv_sec < timenow.tv_sec
 	      || (p->c_time.tv_sec == timenow.tv_sec
 		  && p->c_time.tv_usec <= timenow.tv_usec)))
 	    break;		/* no, it's not time yet */
 
-	callout = p->c_next;
-	(*p->c_func)(p->c_arg);
-
-	free((char *) p);
+	func = p->c_func;
+	arg = p->c_arg;
+	PPP_PROBE3(pppd, timeout_fire, func, arg,
+		   (timenow.tv_sec - p->c_time.tv_sec) * 1000000
+		   + timenow.tv_usec - p->c_time.tv_usec);
+	callout_remove(p);
+	callout_release(p);
+	prof_begin(PROF_TIMEOUT);
+	(*func)(arg);
+	prof_end(PROF_TIMEOUT);
+	PPP_PROBE2(pppd, timeout_done, func, arg);
     }
+    timenow_valid = 0;
 }
 
 
@@ -1437,12 +2219,15 @@ calltimeout(void)
 static struct timeval *
 timeleft(struct timeval *tvp)
 {
-    if (callout == NULL)
+    struct callout *p;
+
+    if (callout_count == 0)
 	return NULL;
 
+    p = callout_heap[0];
     ppp_get_time(&timenow);
-    tvp->tv_sec = callout->c_time.tv_sec - timenow.tv_sec;
-    tvp->tv_usec = callout->c_time.tv_usec - timenow.tv_usec;
+    tvp->tv_sec = p->c_time.tv_sec - timenow.tv_sec;
+    tvp->tv_usec = p->c_time.tv_usec - timenow.tv_usec;
     if (tvp->tv_usec < 0) {
 	tvp->tv_usec += 1000000;
 	tvp->tv_sec -= 1;
@@ -1454,6 +2239,118 @@ timeleft(struct timeval *tvp)
 }
 
 
+/*
+ * wait_for_events - wait until there is input or the next timeout is due.
+ * If the system code can arm a timer for the absolute expiry time of
+ * the first timeout, we don't need to read the clock before waiting.
+ */
+static void
+wait_for_events(void)
+{
+    struct timeval timo;
+
+    if (set_wakeup_time(callout_count > 0? &callout_heap[0]->c_time: NULL))
+	wait_input(NULL);
+    else
+	wait_input(timeleft(&timo));
+}
+
+
+/*
+ * Fds that plugins want the main loop to watch for them, with the
+ * function to call when one becomes readable.
+ */
+struct fd_handler {
+    int			fd;
+    ppp_fd_cb		func;
+    void		*arg;
+    struct fd_handler	*next;
+};
+
+static struct fd_handler *fd_handlers;
+static int n_fd_handlers;
+
+/*
+ * ppp_add_fd_handler - call func(fd, arg) from the main loop whenever
+ * fd is readable, until ppp_remove_fd_handler(fd) is called.
+ */
+void
+ppp_add_fd_handler(int fd, ppp_fd_cb func, void *arg)
+{
+    struct fd_handler *h;
+
+    for (h = fd_handlers; h != NULL; h = h->next)
+	if (h->fd == fd)
+	    break;
+    if (h == NULL) {
+	h = malloc(sizeof(*h));
+	if (h == NULL)
+	    novm("fd handler");
+	h->fd = fd;
+	h->next = fd_handlers;
+	fd_handlers = h;
+	++n_fd_handlers;
+	add_fd(fd);
+    }
+    h->func = func;
+    h->arg = arg;
+}
+
+void
+ppp_remove_fd_handler(int fd)
+{
+    struct fd_handler **hp, *h;
+
+    for (hp = &fd_handlers; (h = *hp) != NULL; hp = &h->next) {
+	if (h->fd == fd) {
+	    *hp = h->next;
+	    --n_fd_handlers;
+	    remove_fd(fd);
+	    free(h);
+	    return;
+	}
+    }
+}
+
+/*
+ * call_fd_handlers - find out which of the handlers' fds are readable
+ * and call their handlers.  A handler may add or remove handlers,
+ * including its own, so each one is looked up again before the call.
+ */
+static void
+call_fd_handlers(void)
+{
+    struct pollfd *fds;
+    struct fd_handler *h;
+    int i, n;
+
+    if (n_fd_handlers == 0)
+	return;
+    fds = malloc(n_fd_handlers * sizeof(*fds));
+    if (fds == NULL)
+	novm("fd handler poll set");
+    n = 0;
+    for (h = fd_handlers; h != NULL; h = h->next) {
+	fds[n].fd = h->fd;
+	fds[n].events = POLLIN;
+	fds[n].revents = 0;
+	++n;
+    }
+    if (poll(fds, n, 0) > 0) {
+	for (i = 0; i < n; ++i) {
+	    if (fds[i].revents == 0)
+		continue;
+	    for (h = fd_handlers; h != NULL; h = h->next)
+		if (h->fd == fds[i].fd)
+		    break;
+	    if (h != NULL)
+		(*h->func)(h->fd, h->arg);
+	}
+    }
+    free(fds);
+}
+
+
 /*
  * kill_my_pg - send a signal to our process group, and ignore it ourselves.
  * We assume that sig is currently blocked.
@@ -1566,7 +2463,7 @@ chld(int sig)
 /*
  * toggle_debug - Catch SIGUSR1 signal.
  *
- * Toggle debug flag.
+ * Toggle debug flag, and have the event trace written to the log.
  */
 /*ARGSUSED*/
 static void
@@ -1578,6 +2475,13 @@ toggle_debug(int sig)
     } else {
 	setlogmask(LOG_UPTO(LOG_WARNING));
     }
+    got_sigusr1 = 1;
+    if (waiting) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-result"
+	write(sigpipe[1], &sig, sizeof(sig));
+#pragma GCC diagnostic pop
+    }
 }
 
 
@@ -1704,9 +2608,79 @@ ppp_safe_fork(int infd, int outfd, int errfd)
 	return 0;
 }
 
+static unsigned int
+env_name_hash(const char *name, size_t len)
+{
+    unsigned int h = 2166136261U;	/* FNV-1a */
+
+    while (len-- > 0)
+	h = (h ^ (unsigned char) *name++) * 16777619U;
+    return h;
+}
+
+/*
+ * hash_script_env - rebuild env_hash, big enough for s_env_count + 1
+ * variables.
+ */
+static void
+hash_script_env(void)
+{
+    int i, n, size;
+    unsigned int h;
+    char *p;
+
+    for (size = 32; size <= 2 * (s_env_count + 1); size *= 2)
+	;
+    if (size != env_hash_size) {
+	free(env_hash);
+	env_hash = malloc(size * sizeof(int));
+	env_hash_size = env_hash? size: 0;
+    }
+    if (env_hash == NULL)
+	return;
+    memset(env_hash, 0, size * sizeof(int));
+    for (i = 0; i < s_env_count; ++i) {
+	p = script_env[i];
+	n = strchr(p, '=') - p;
+	for (h = env_name_hash(p, n); env_hash[h & (size - 1)]; ++h)
+	    ;
+	env_hash[h & (size - 1)] = i + 1;
+    }
+}
+
+/*
+ * find_script_env - return the index in script_env of var, which is
+ * varl long, or -1 if it isn't there.
+ */
+static int
+find_script_env(const char *var, size_t varl)
+{
+    unsigned int h;
+    int i;
+    char *p;
+
+    if (env_hash == NULL) {
+	for (i = 0; i < s_env_count; ++i) {
+	    p = script_env[i];
+	    if (strncmp(p, var, varl) == 0 && p[varl] == '=')
+		return i;
+	}
+	return -1;
+    }
+    for (h = env_name_hash(var, varl); (i = env_hash[h & (env_hash_size - 1)]) != 0; ++h) {
+	p = script_env[i - 1];
+	if (strncmp(p, var, varl) == 0 && p[varl] == '=')
+	    return i - 1;
+    }
+    return -1;
+}
+
 static bool
-add_script_env(int pos, char *newstring)
+add_script_env(char *newstring)
 {
+    int pos = s_env_count;
+    unsigned int h;
+
     if (pos + 1 >= s_env_nalloc) {
 	int new_n = pos + 17;
 	char **newenv = realloc(script_env, new_n * sizeof(char *));
@@ -1719,15 +2693,29 @@ add_script_env(int pos, char *newstring)
     }
     script_env[pos] = newstring;
     script_env[pos + 1] = NULL;
+    ++s_env_count;
+    if (2 * (s_env_count + 1) >= env_hash_size)
+	hash_script_env();
+    else {
+	h = env_name_hash(newstring, strchr(newstring, '=') - newstring);
+	for (; env_hash[h & (env_hash_size - 1)]; ++h)
+	    ;
+	env_hash[h & (env_hash_size - 1)] = pos + 1;
+    }
     return 1;
 }
 
+/*
+ * remove_script_env - take out the variable at pos, putting the last
+ * one in its place; scripts don't mind what order they come in.
+ */
 static void
 remove_script_env(int pos)
 {
     free(script_env[pos] - 1);
-    while ((script_env[pos] = script_env[pos + 1]) != NULL)
-	pos++;
+    script_env[pos] = script_env[--s_env_count];
+    script_env[s_env_count] = NULL;
+    hash_script_env();
 }
 
 /*
@@ -1825,13 +2813,10 @@ update_script_environment(void)
 
     for (uep = userenv_list; uep != NULL; uep = uep->ue_next) {
 	int i;
-	char *p, *newstring;
+	char *newstring;
 	int nlen = strlen(uep->ue_name);
 
-	for (i = 0; (p = script_env[i]) != NULL; i++) {
-	    if (strncmp(p, uep->ue_name, nlen) == 0 && p[nlen] == '=')
-		break;
-	}
+	i = find_script_env(uep->ue_name, nlen);
 	if (uep->ue_isset) {
 	    nlen += strlen(uep->ue_value) + 2;
 	    newstring = malloc(nlen + 1);
@@ -1839,23 +2824,97 @@ update_script_environment(void)
 		continue;
 	    *newstring++ = 0;
 	    slprintf(newstring, nlen, "%s=%s", uep->ue_name, uep->ue_value);
-	    if (p != NULL)
+	    if (i >= 0)
 		script_env[i] = newstring;
 	    else
-		add_script_env(i, newstring);
-	} else if (p != NULL) {
+		add_script_env(newstring);
+	} else if (i >= 0) {
 	    remove_script_env(i);
 	}
     }
 }
 
+/*
+ * spawn_program - start prog the way run_program's child would,
+ * but with posix_spawn, which doesn't copy our address space and
+ * doesn't have us wait for the child to close its fds.  This is only
+ * possible when nothing has to run in the child that spawn can't do:
+ * no plugin wants to hear about the fork, there are no set/unset
+ * options to apply to the environment, and we are root already.
+ * Returns -1 if prog couldn't be started this way.
+ */
+static pid_t
+spawn_program(char *prog, char * const *args)
+{
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP) \
+    && defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP) \
+    && defined(POSIX_SPAWN_SETSID)
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t none, ours;
+    mode_t mask;
+    pid_t pid;
+    int err;
+
+    if (fork_notifier != NULL || userenv_list != NULL
+	|| getuid() != 0 || getgid() != getegid())
+	return -1;
+
+    if (posix_spawn_file_actions_init(&fa) != 0)
+	return -1;
+    if (posix_spawnattr_init(&attr) != 0) {
+	posix_spawn_file_actions_destroy(&fa);
+	return -1;
+    }
+    err = posix_spawn_file_actions_adddup2(&fa, fd_devnull, 0)
+	|| posix_spawn_file_actions_adddup2(&fa, fd_devnull, 1)
+	|| posix_spawn_file_actions_adddup2(&fa, fd_devnull, 2)
+	|| posix_spawn_file_actions_addclosefrom_np(&fa, 3)
+	|| posix_spawn_file_actions_addchdir_np(&fa, "/")
+	|| posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID
+				    | POSIX_SPAWN_SETSIGMASK
+				    | POSIX_SPAWN_SETSIGDEF);
+    if (!err) {
+	/*
+	 * As in the fork path (see ppp_sys_close), the program starts
+	 * with none of the signals that signalfd has us block still
+	 * blocked, and with their default actions.
+	 */
+	sigemptyset(&none);
+	sigemptyset(&ours);
+	sigaddset(&ours, SIGHUP);
+	sigaddset(&ours, SIGINT);
+	sigaddset(&ours, SIGTERM);
+	sigaddset(&ours, SIGCHLD);
+	sigaddset(&ours, SIGUSR1);
+	sigaddset(&ours, SIGUSR2);
+	err = posix_spawnattr_setsigmask(&attr, &none)
+	    || posix_spawnattr_setsigdefault(&attr, &ours);
+    }
+    pid = -1;
+    if (!err) {
+	/* there's no spawn attribute for this */
+	mask = umask(S_IRWXG|S_IRWXO);
+	if (posix_spawn(&pid, prog, &fa, &attr, args, script_env) != 0)
+	    pid = -1;
+	umask(mask);
+    }
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    return pid;
+#else
+    return -1;
+#endif
+}
+
 /*
  * run_program - execute a program with given arguments,
  * but don't wait for it unless wait is non-zero.
  * If the program can't be executed, logs an error unless
  * must_exist is 0 and the program file doesn't exist.
  * Returns -1 if it couldn't fork, 0 if the file doesn't exist
- * or isn't an executable plain file, or the process ID of the child.
+ * or isn't an executable plain file or script_hook ran it instead,
+ * or the process ID of the child.
  * If done != NULL, (*done)(arg) will be called later (within
  * reap_kids) iff the return value is > 0.
  */
@@ -1871,6 +2930,13 @@ run_program(char *prog, char * const *args, int must_exist, void (*done)(void *)
      * real user-id, which might not be root, and the script
      * might be accessible only to root.
      */
+    /*
+     * A plugin may do the script's job itself; if so, carry on
+     * as though the script didn't exist.
+     */
+    if (script_hook != NULL && (*script_hook)(prog, args))
+	return 0;
+
     errno = EINVAL;
     if (stat(prog, &sbuf) < 0 || !S_ISREG(sbuf.st_mode)
 	|| (sbuf.st_mode & (S_IXUSR|S_IXGRP|S_IXOTH)) == 0) {
@@ -1879,7 +2945,9 @@ run_program(char *prog, char * const *args, int must_exist, void (*done)(void *)
 	return 0;
     }
 
-    pid = ppp_safe_fork(fd_devnull, fd_devnull, fd_devnull);
+    pid = spawn_program(prog, args);
+    if (pid < 0)
+	pid = ppp_safe_fork(fd_devnull, fd_devnull, fd_devnull);
     if (pid == -1) {
 	error("Failed to create child process for %s: %m", prog);
 	return -1;
@@ -1956,8 +3024,11 @@ record_child(int pid, char *prog, void (*done)(void *), void *arg, int killable)
 	chp->arg = arg;
 	chp->next = children;
 	chp->killable = killable;
+	ppp_get_time(&chp->start);
 	children = chp;
     }
+    PPP_PROBE2(pppd, script_start, prog, pid);
+    trace_script(prog, pid, 0, -1);
 }
 
 /*
@@ -1984,6 +3055,7 @@ static void
 forget_child(int pid, int status)
 {
     struct subprocess *chp, **prevp;
+    struct timeval now;
 
     for (prevp = &children; (chp = *prevp) != NULL; prevp = &chp->next) {
         if (chp->pid == pid) {
@@ -1992,6 +3064,15 @@ forget_child(int pid, int status)
 	    break;
 	}
     }
+    if (chp) {
+	int ms;
+
+	ppp_get_time(&now);
+	ms = (now.tv_sec - chp->start.tv_sec) * 1000
+	    + (now.tv_usec - chp->start.tv_usec) / 1000;
+	PPP_PROBE4(pppd, script_done, chp->prog, pid, status, ms);
+	trace_script(chp->prog, pid, status, ms);
+    }
     if (WIFSIGNALED(status)) {
         warn("Child process %s (pid %d) terminated with signal %d",
 	     (chp? chp->prog: "??"), pid, WTERMSIG(status));
@@ -2043,6 +3124,8 @@ struct notifier **get_notifier_by_type(ppp_notify_t type)
         [NF_AUTH_UP     ] = &auth_up_notifier,
         [NF_LINK_DOWN   ] = &link_down_notifier,
         [NF_FORK        ] = &fork_notifier,
+        [NF_PREFORK     ] = &prefork_notifier,
+        [NF_PREFORK_POOL] = &prefork_pool_notifier,
     };
     return list[type];
 }
@@ -2091,6 +3174,67 @@ ppp_del_notify(ppp_notify_t type, ppp_notify_fn *func, void *arg)
     }
 }
 
+/*
+ * Functions registered with ppp_add_snoop, each for one protocol.
+ */
+struct snooper {
+    struct snooper *next;
+    int protocol;
+    ppp_snoop_fn *func;
+    void *arg;
+};
+static struct snooper *snoopers;
+
+void
+ppp_add_snoop(int protocol, ppp_snoop_fn *func, void *arg)
+{
+    struct snooper *sp = malloc(sizeof(struct snooper));
+
+    if (sp == 0)
+	novm("snooper struct");
+    sp->next = snoopers;
+    sp->protocol = protocol;
+    sp->func = func;
+    sp->arg = arg;
+    snoopers = sp;
+}
+
+void
+ppp_del_snoop(int protocol, ppp_snoop_fn *func, void *arg)
+{
+    struct snooper *sp, **prevp;
+
+    for (prevp = &snoopers; (sp = *prevp) != 0; prevp = &sp->next) {
+	if (sp->protocol == protocol && sp->func == func && sp->arg == arg) {
+	    *prevp = sp->next;
+	    free(sp);
+	    break;
+	}
+    }
+}
+
+/*
+ * snoop_packet - put a control packet in the event trace and show
+ * it to the functions registered for its protocol.  They may remove
+ * themselves as they go.
+ */
+void
+snoop_packet(u_char *p, int len, int incoming)
+{
+    struct snooper *sp, *next;
+    int protocol;
+
+    trace_packet(p, len, incoming);
+    if (snoopers == 0 || len < PPP_HDRLEN)
+	return;
+    protocol = PPP_PROTOCOL(p);
+    for (sp = snoopers; sp != 0; sp = next) {
+	next = sp->next;
+	if (sp->protocol == protocol)
+	    (*sp->func)(sp->arg, p, len, incoming);
+    }
+}
+
 /*
  * notify - call a set of functions registered with add_notifier.
  */
@@ -2126,35 +3270,42 @@ ppp_script_setenv(char *var, char *value, int iskey)
     int i;
     char *p, *newstring;
 
+    /* check if this variable is already set */
+    i = script_env? find_script_env(var, varl): -1;
+    if (i >= 0) {
+	p = script_env[i];
+	/* setting it to what it is needn't touch the database */
+	if (!p[-1] == !iskey && strcmp(p + varl + 1, value) == 0)
+	    return;
+    }
+
     newstring = (char *) malloc(vl+1);
     if (newstring == 0)
 	return;
     *newstring++ = iskey;
     slprintf(newstring, vl, "%s=%s", var, value);
 
-    /* check if this variable is already set */
-    if (script_env != 0) {
-	for (i = 0; (p = script_env[i]) != 0; ++i) {
-	    if (strncmp(p, var, varl) == 0 && p[varl] == '=') {
+    if (i >= 0) {
 #ifdef PPP_WITH_TDB
-		if (p[-1] && pppdb != NULL)
-		    delete_db_key(p);
+	if (p[-1] && pppdb != NULL)
+	    delete_db_key(p);
+	if (pppdb != NULL)
+	    db_index(p, 0);
 #endif
-		free(p-1);
-		script_env[i] = newstring;
+	free(p-1);
+	script_env[i] = newstring;
 #ifdef PPP_WITH_TDB
-		if (pppdb != NULL) {
-		    if (iskey)
-			add_db_key(newstring);
-		    update_db_entry();
-		}
-#endif
-		return;
-	    }
+	if (pppdb != NULL) {
+	    if (iskey)
+		add_db_key(newstring);
+	    db_index(newstring, 1);
+	    db_dirty = 1;
 	}
-    } else {
+#endif
+	return;
+    }
+    if (script_env == 0) {
 	/* no space allocated for script env. ptrs. yet */
-	i = 0;
 	script_env = malloc(16 * sizeof(char *));
 	if (script_env == 0) {
 	    free(newstring - 1);
@@ -2163,18 +3314,43 @@ ppp_script_setenv(char *var, char *value, int iskey)
 	s_env_nalloc = 16;
     }
 
-    if (!add_script_env(i, newstring))
+    if (!add_script_env(newstring))
 	return;
 
 #ifdef PPP_WITH_TDB
     if (pppdb != NULL) {
 	if (iskey)
 	    add_db_key(newstring);
-	update_db_entry();
+	db_index(newstring, 1);
+	db_dirty = 1;
     }
 #endif
 }
 
+/*
+ * ppp_script_getenv - return the value a script would see for var,
+ * taking account of set and unset options, or NULL if it isn't set.
+ */
+char *
+ppp_script_getenv(const char *var)
+{
+    int vl = strlen(var);
+    int i, found = 0;
+    char *value = NULL;
+    struct userenv *uep;
+
+    for (uep = userenv_list; uep != NULL; uep = uep->ue_next) {
+	if (strcmp(uep->ue_name, var) == 0) {
+	    value = uep->ue_isset? uep->ue_value: NULL;
+	    found = 1;
+	}
+    }
+    if (found || script_env == NULL)
+	return value;
+    i = find_script_env(var, vl);
+    return i >= 0? script_env[i] + vl + 1: NULL;
+}
+
 /*
  * ppp_script_unsetenv - remove a variable from the environment
  * for scripts.
@@ -2184,23 +3360,24 @@ ppp_script_unsetenv(char *var)
 {
     int vl = strlen(var);
     int i;
-    char *p;
 
     if (script_env == 0)
 	return;
-    for (i = 0; (p = script_env[i]) != 0; ++i) {
-	if (strncmp(p, var, vl) == 0 && p[vl] == '=') {
+    i = find_script_env(var, vl);
+    if (i >= 0) {
 #ifdef PPP_WITH_TDB
-	    if (p[-1] && pppdb != NULL)
-		delete_db_key(p);
+	char *p = script_env[i];
+
+	if (p[-1] && pppdb != NULL)
+	    delete_db_key(p);
+	if (pppdb != NULL)
+	    db_index(p, 0);
 #endif
-	    remove_script_env(i);
-	    break;
-	}
+	remove_script_env(i);
     }
 #ifdef PPP_WITH_TDB
     if (pppdb != NULL)
-	update_db_entry();
+	db_dirty = 1;
 #endif
 }
 
@@ -2219,6 +3396,8 @@ void lock_db(void)
 #ifdef PPP_WITH_TDB
 	TDB_DATA key;
 
+	/* let the other pppds see our entry as it is now */
+	flush_db();
 	key.dptr = PPPD_LOCK_KEY;
 	key.dsize = strlen(key.dptr);
 	tdb_chainlock(pppdb, key);
@@ -2233,6 +3412,7 @@ void unlock_db(void)
 #ifdef PPP_WITH_TDB
 	TDB_DATA key;
 
+	flush_db();
 	key.dptr = PPPD_LOCK_KEY;
 	key.dsize = strlen(key.dptr);
 	tdb_chainunlock(pppdb, key);
@@ -2274,6 +3454,60 @@ update_db_entry(void)
 
 }
 
+/*
+ * db_batch - queue database changes until the next flush_db.
+ */
+static void
+db_batch(void)
+{
+    if (!db_batching) {
+	tdb_batch_begin(pppdb);
+	db_batching = 1;
+    }
+}
+
+/*
+ * flush_db - write out our entry if the environment has changed, along
+ * with the key changes queued since the last flush, so that a burst of
+ * ppp_script_setenv calls costs one pass over the database.
+ */
+static void
+flush_db(void)
+{
+    if (pppdb == NULL)
+	return;
+    if (db_dirty) {
+	db_batch();
+	update_db_entry();
+	db_dirty = 0;
+    }
+    if (db_batching) {
+	if (tdb_batch_commit(pppdb))
+	    error("tdb_batch_commit failed: %s", tdb_errorstr(pppdb));
+	db_batching = 0;
+    }
+}
+
+/*
+ * db_snapshot - write the read-only copy of the database that monitors
+ * use, unless another pppd has written it within the last
+ * db_snapshot_interval seconds, and do the same again then.
+ */
+static void
+db_snapshot(void *arg)
+{
+    struct stat st;
+    time_t now = time(NULL);
+
+    if (stat(PPP_PATH_PPPDB_SNAP, &st) < 0 || st.st_mtime > now
+	|| now - st.st_mtime >= db_snapshot_interval) {
+	if (tdb_snapshot(pppdb, PPP_PATH_PPPDB_SNAP) < 0)
+	    error("Couldn't write %s: %s", PPP_PATH_PPPDB_SNAP,
+		  tdb_errorstr(pppdb));
+    }
+    ppp_timeout(db_snapshot, NULL, db_snapshot_interval, 0);
+}
+
 /*
  * add_db_key - add a key that we can use to look up our database entry.
  */
@@ -2282,6 +3516,7 @@ add_db_key(const char *str)
 {
     TDB_DATA key, dbuf;
 
+    db_batch();
     key.dptr = (char *) str;
     key.dsize = strlen(str);
     dbuf.dptr = db_key;
@@ -2298,11 +3533,117 @@ delete_db_key(const char *str)
 {
     TDB_DATA key;
 
+    db_batch();
     key.dptr = (char *) str;
     key.dsize = strlen(str);
     tdb_delete(pppdb, key);
 }
 
+/*
+ * db_index - add our pid to, or remove it from, the session index
+ * for str, a "VAR=value" string, if VAR is one that is indexed.
+ * The index is read and rewritten with its chain locked, which also
+ * makes the change go straight to the database rather than wait for
+ * the batch, so that pppds changing the same index at once don't
+ * lose each other's changes.  Adding drops pppds that have died
+ * without taking themselves out.
+ */
+static void
+db_index(const char *str, int add)
+{
+    TDB_DATA key, rec;
+    const char *eq;
+    int32_t pid = db_pid, *pids;
+    int i, j, n, vl;
+    char *ikey;
+
+    eq = strchr(str, '=');
+    if (eq == NULL)
+	return;
+    vl = eq - str;
+    for (i = 0; db_indexed[i] != NULL; ++i)
+	if (strncmp(str, db_indexed[i], vl) == 0 && db_indexed[i][vl] == 0)
+	    break;
+    if (db_indexed[i] == NULL)
+	return;
+    ikey = malloc(strlen(str) + sizeof(PPPDB_INDEX));
+    if (ikey == NULL)
+	novm("session index key");
+    memcpy(ikey, str, vl);
+    strcpy(ikey + vl, PPPDB_INDEX);
+    strcat(ikey, eq);
+    key.dptr = ikey;
+    key.dsize = strlen(ikey);
+
+    tdb_chainlock(pppdb, key);
+    rec = tdb_fetch(pppdb, key);
+    pids = (int32_t *) rec.dptr;
+    n = pids != NULL? rec.dsize / sizeof(int32_t): 0;
+    for (i = j = 0; i < n; ++i) {
+	if (pids[i] == pid) {
+	    if (add)
+		break;		/* already there */
+	    continue;
+	}
+	if (add && kill(pids[i], 0) < 0 && errno == ESRCH)
+	    continue;
+	pids[j++] = pids[i];
+    }
+    if (add? i < n: j == n)
+	goto out;		/* nothing to change */
+    n = j;
+    if (add) {
+	pids = realloc(pids, (n + 1) * sizeof(int32_t));
+	if (pids == NULL)
+	    novm("session index");
+	pids[n++] = pid;
+    }
+    if (n == 0) {
+	tdb_delete(pppdb, key);
+    } else {
+	rec.dptr = (char *) pids;
+	rec.dsize = n * sizeof(int32_t);
+	if (tdb_store(pppdb, key, rec, TDB_REPLACE))
+	    error("tdb_store index failed: %s", tdb_errorstr(pppdb));
+    }
+ out:
+    tdb_chainunlock(pppdb, key);
+    free(pids);
+    free(ikey);
+}
+
+/*
+ * db_rekey - move our entries in the database over to our own pid,
+ * when detach() has left us running in a child of the pppd that made
+ * them, so that other pppds and pppd-sessions find a live process
+ * behind them.
+ */
+static void
+db_rekey(void)
+{
+    TDB_DATA key;
+    int i, oldpid = db_pid;
+    char *p;
+
+    lock_db();
+    key.dptr = db_key;
+    key.dsize = strlen(db_key);
+    tdb_delete(pppdb, key);
+    for (i = 0; script_env != NULL && (p = script_env[i]) != 0; ++i)
+	db_index(p, 0);
+
+    db_pid = getpid();
+    slprintf(db_key, sizeof(db_key), "pppd%d", db_pid);
+    update_db_entry();
+    for (i = 0; script_env != NULL && (p = script_env[i]) != 0; ++i) {
+	if (p[-1])
+	    add_db_key(p);
+	db_index(p, 1);
+    }
+    mp_rekey(oldpid);
+    unlock_db();
+}
+
 /*
  * cleanup_db - delete all the entries we put in the database.
  */
@@ -2316,8 +3657,10 @@ cleanup_db(void)
     key.dptr = db_key;
     key.dsize = strlen(db_key);
     tdb_delete(pppdb, key);
-    for (i = 0; (p = script_env[i]) != 0; ++i)
+    for (i = 0; (p = script_env[i]) != 0; ++i) {
 	if (p[-1])
 	    delete_db_key(p);
+	db_index(p, 0);
+    }
 }
 #endif /* PPP_WITH_TDB */
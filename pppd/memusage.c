@@ -0,0 +1,136 @@
+/*
+ * memusage.c - report how much memory this pppd holds, and where.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+#include "pppd-private.h"
+
+/*
+ * What the parts of pppd and the plugins say they hold, through
+ * ppp_mem_account.  These are the things there is one of per session
+ * and which might be made smaller or shared; the process-wide figures
+ * from the kernel and the allocator show the rest.
+ */
+#define MEM_MAX_PARTS	16
+
+static struct mem_part {
+    const char *name;
+    size_t bytes;
+    bool shared;
+} mem_parts[MEM_MAX_PARTS];
+static int mem_nparts;
+
+void
+ppp_mem_account(const char *name, size_t bytes, bool shared)
+{
+    int i;
+
+    for (i = 0; i < mem_nparts; ++i)
+	if (strcmp(mem_parts[i].name, name) == 0)
+	    break;
+    if (i == mem_nparts) {
+	if (mem_nparts == MEM_MAX_PARTS)
+	    return;
+	mem_parts[mem_nparts++].name = name;
+    }
+    mem_parts[i].bytes = bytes;
+    mem_parts[i].shared = shared;
+}
+
+/*
+ * mem_smaps - print the resident, proportional, shared and private
+ * sizes of the whole process, from Linux's summary of its mappings.
+ */
+static void
+mem_smaps(printer_func printer, void *arg)
+{
+    static const struct {
+	const char *field;
+	const char *name;
+    } fields[] = {
+	{ "Rss:", "rss_kb" },
+	{ "Pss:", "pss_kb" },
+	{ "Shared_Clean:", "shared_clean_kb" },
+	{ "Shared_Dirty:", "shared_dirty_kb" },
+	{ "Private_Clean:", "private_clean_kb" },
+	{ "Private_Dirty:", "private_dirty_kb" },
+    };
+    char line[128];
+    unsigned long kb;
+    FILE *f;
+    int i, n;
+
+    f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == NULL)
+	return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i) {
+	    n = strlen(fields[i].field);
+	    if (strncmp(line, fields[i].field, n) == 0
+		&& sscanf(line + n, "%lu", &kb) == 1)
+		printer(arg, "%s %lu", fields[i].name, kb);
+	}
+    }
+    fclose(f);
+}
+
+/*
+ * mem_print - format the memory report, one "name value" line per
+ * call to printer.
+ */
+void
+mem_print(printer_func printer, void *arg)
+{
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi;
+#endif
+    int i;
+
+    mem_smaps(printer, arg);
+#ifdef HAVE_MALLINFO2
+    mi = mallinfo2();
+    printer(arg, "heap_in_use %lu", (unsigned long) mi.uordblks);
+    printer(arg, "heap_free %lu", (unsigned long) mi.fordblks);
+    printer(arg, "heap_mmapped %lu", (unsigned long) mi.hblkhd);
+#endif
+    for (i = 0; i < mem_nparts; ++i)
+	printer(arg, "part %s %lu%s", mem_parts[i].name,
+		(unsigned long) mem_parts[i].bytes,
+		mem_parts[i].shared? " shared": "");
+}
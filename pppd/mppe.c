@@ -111,31 +111,17 @@ mppe_clear_keys(void)
 void
 mppe_set_chapv1(unsigned char *rchallenge, unsigned char *PasswordHashHash)
 {
-    PPP_MD_CTX *ctx;
+    struct iovec iov[3];
     u_char Digest[SHA_DIGEST_LENGTH];
-    int DigestLen;
-
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, PasswordHashHash, MD4_DIGEST_LENGTH)) {
-
-                if (PPP_DigestUpdate(ctx, PasswordHashHash, MD4_DIGEST_LENGTH)) {
-
-                    if (PPP_DigestUpdate(ctx, rchallenge, 8)) {
-                        
-                        DigestLen = SHA_DIGEST_LENGTH;
-                        PPP_DigestFinal(ctx, Digest, &DigestLen);
-                    }
-                }
-            }
-        }
-        
-        PPP_MD_CTX_free(ctx);
-    }
+    unsigned int DigestLen;
 
+    iov[0].iov_base = PasswordHashHash;
+    iov[0].iov_len = MD4_DIGEST_LENGTH;
+    iov[1].iov_base = PasswordHashHash;
+    iov[1].iov_len = MD4_DIGEST_LENGTH;
+    iov[2].iov_base = rchallenge;
+    iov[2].iov_len = 8;
+    PPP_Digest(PPP_sha1(), iov, 3, Digest, &DigestLen);
 
     /* Same key in both directions. */
     mppe_set_keys(Digest, Digest, sizeof(Digest));
@@ -151,12 +137,11 @@ void
 mppe_set_chapv2(unsigned char *PasswordHashHash, unsigned char *NTResponse,
         int IsServer)
 {
-    PPP_MD_CTX *ctx;
-    
+    struct iovec iov[4];
     u_char	MasterKey[SHA_DIGEST_LENGTH];
     u_char	SendKey[SHA_DIGEST_LENGTH];
     u_char	RecvKey[SHA_DIGEST_LENGTH];
-    int KeyLen;
+    unsigned int KeyLen;
 
     u_char SHApad1[40] =
 	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -200,26 +185,13 @@ mppe_set_chapv2(unsigned char *PasswordHashHash, unsigned char *NTResponse,
 	  0x6b, 0x65, 0x79, 0x2e };
     u_char *s;
 
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, PasswordHashHash, MD4_DIGEST_LENGTH)) {
-
-                if (PPP_DigestUpdate(ctx, NTResponse, 24)) {
-
-                    if (PPP_DigestUpdate(ctx, Magic1, sizeof(Magic1))) {
-                        
-                        KeyLen = SHA_DIGEST_LENGTH;
-                        PPP_DigestFinal(ctx, MasterKey, &KeyLen);
-                    }
-                }
-            }
-        }
-        
-        PPP_MD_CTX_free(ctx);
-    }
+    iov[0].iov_base = PasswordHashHash;
+    iov[0].iov_len = MD4_DIGEST_LENGTH;
+    iov[1].iov_base = NTResponse;
+    iov[1].iov_len = 24;
+    iov[2].iov_base = Magic1;
+    iov[2].iov_len = sizeof(Magic1);
+    PPP_Digest(PPP_sha1(), iov, 3, MasterKey, &KeyLen);
 
     /*
      * generate send key
@@ -229,30 +201,15 @@ mppe_set_chapv2(unsigned char *PasswordHashHash, unsigned char *NTResponse,
     else
 	s = Magic2;
 
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, MasterKey, 16)) {
-
-                if (PPP_DigestUpdate(ctx, SHApad1, sizeof(SHApad1))) {
-
-                    if (PPP_DigestUpdate(ctx, s, 84)) {
-
-                        if (PPP_DigestUpdate(ctx, SHApad2, sizeof(SHApad2))) {
-                        
-                            KeyLen = SHA_DIGEST_LENGTH;
-                            PPP_DigestFinal(ctx, SendKey, &KeyLen);
-                        }
-                    }
-                }
-            }
-        }
-        
-        PPP_MD_CTX_free(ctx);
-    }
-
+    iov[0].iov_base = MasterKey;
+    iov[0].iov_len = 16;
+    iov[1].iov_base = SHApad1;
+    iov[1].iov_len = sizeof(SHApad1);
+    iov[2].iov_base = s;
+    iov[2].iov_len = 84;
+    iov[3].iov_base = SHApad2;
+    iov[3].iov_len = sizeof(SHApad2);
+    PPP_Digest(PPP_sha1(), iov, 4, SendKey, &KeyLen);
 
     /*
      * generate recv key
@@ -262,29 +219,15 @@ mppe_set_chapv2(unsigned char *PasswordHashHash, unsigned char *NTResponse,
     else
 	s = Magic3;
 
-    ctx = PPP_MD_CTX_new();
-    if (ctx != NULL) {
-
-        if (PPP_DigestInit(ctx, PPP_sha1())) {
-
-            if (PPP_DigestUpdate(ctx, MasterKey, 16)) {
-
-                if (PPP_DigestUpdate(ctx, SHApad1, sizeof(SHApad1))) {
-
-                    if (PPP_DigestUpdate(ctx, s, 84)) {
-
-                        if (PPP_DigestUpdate(ctx, SHApad2, sizeof(SHApad2))) {
-                        
-                            KeyLen = SHA_DIGEST_LENGTH;
-                            PPP_DigestFinal(ctx, RecvKey, &KeyLen);
-                        }
-                    }
-                }
-            }
-        }
-        
-        PPP_MD_CTX_free(ctx);
-    }
+    iov[0].iov_base = MasterKey;
+    iov[0].iov_len = 16;
+    iov[1].iov_base = SHApad1;
+    iov[1].iov_len = sizeof(SHApad1);
+    iov[2].iov_base = s;
+    iov[2].iov_len = 84;
+    iov[3].iov_base = SHApad2;
+    iov[3].iov_len = sizeof(SHApad2);
+    PPP_Digest(PPP_sha1(), iov, 4, RecvKey, &KeyLen);
 
     mppe_set_keys(SendKey, RecvKey, SHA_DIGEST_LENGTH);
 }
@@ -0,0 +1,525 @@
+/*
+ * mppe_data.c - encrypt and decrypt packets with MPPE (RFC 3078).
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stddef.h>
+#include <string.h>
+
+#include "crypto.h"
+#include "mppe_data.h"
+
+static const unsigned char sha_pad1[40] = { 0 };
+static const unsigned char sha_pad2[40] = {
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2,
+    0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2, 0xf2
+};
+
+/* The state every RC4 key schedule starts from. */
+static unsigned int rc4_identity[256];
+static int rc4_identity_done;
+
+void
+ppp_rc4_setkey(struct ppp_rc4 *rc4, const unsigned char *key, int keylen)
+{
+    unsigned int *S = rc4->S;
+    unsigned int i, j, k, t;
+
+    if (!rc4_identity_done) {
+	for (i = 0; i < 256; ++i)
+	    rc4_identity[i] = i;
+	rc4_identity_done = 1;
+    }
+    memcpy(S, rc4_identity, sizeof(rc4->S));
+    for (i = j = k = 0; i < 256; ++i) {
+	t = S[i];
+	j = (j + t + key[k]) & 0xff;
+	S[i] = S[j];
+	S[j] = t;
+	if (++k == keylen)
+	    k = 0;
+    }
+    rc4->i = rc4->j = 0;
+}
+
+void
+ppp_rc4_crypt(struct ppp_rc4 *rc4, const unsigned char *in,
+	      unsigned char *out, size_t len)
+{
+    unsigned int *S = rc4->S;
+    unsigned int i = rc4->i, j = rc4->j, x, y;
+
+    /* two bytes a time lets the loads of one overlap the other */
+    for (; len >= 2; len -= 2, in += 2, out += 2) {
+	i = (i + 1) & 0xff;
+	x = S[i];
+	j = (j + x) & 0xff;
+	y = S[j];
+	S[i] = y;
+	S[j] = x;
+	out[0] = in[0] ^ S[(x + y) & 0xff];
+	i = (i + 1) & 0xff;
+	x = S[i];
+	j = (j + x) & 0xff;
+	y = S[j];
+	S[i] = y;
+	S[j] = x;
+	out[1] = in[1] ^ S[(x + y) & 0xff];
+    }
+    if (len) {
+	i = (i + 1) & 0xff;
+	x = S[i];
+	j = (j + x) & 0xff;
+	y = S[j];
+	S[i] = y;
+	S[j] = x;
+	out[0] = in[0] ^ S[(x + y) & 0xff];
+    }
+    rc4->i = i;
+    rc4->j = j;
+}
+
+/*
+ * GetNewKeyFromSHA of RFC 3079, from the master key and the key in
+ * use.
+ */
+static void
+mppe_sha_key(struct mppe_data *md, const unsigned char *key,
+	     unsigned char *digest)
+{
+    unsigned int len = SHA_DIGEST_LENGTH;
+
+    PPP_DigestInit(md->sha, PPP_sha1());
+    PPP_DigestUpdate(md->sha, md->master_key, md->keylen);
+    PPP_DigestUpdate(md->sha, sha_pad1, sizeof(sha_pad1));
+    PPP_DigestUpdate(md->sha, key, md->keylen);
+    PPP_DigestUpdate(md->sha, sha_pad2, sizeof(sha_pad2));
+    PPP_DigestFinal(md->sha, digest, &len);
+}
+
+/*
+ * Finish off a session key: a 40-bit key has a fixed first three
+ * bytes, and the RC4 state for it is set up once here, to be copied
+ * whenever RC4 starts over with the key.
+ */
+static void
+mppe_key_done(struct mppe_data *md, struct mppe_key *k)
+{
+    if (md->keylen == 8) {
+	k->key[0] = 0xd1;
+	k->key[1] = 0x26;
+	k->key[2] = 0x9e;
+    }
+    ppp_rc4_setkey(&k->rc4, k->key, md->keylen);
+}
+
+/*
+ * Work out the session key that follows from.
+ */
+static void
+mppe_next_key(struct mppe_data *md, const struct mppe_key *from,
+	      struct mppe_key *to)
+{
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    struct ppp_rc4 interim;
+
+    mppe_sha_key(md, from->key, digest);
+    ppp_rc4_setkey(&interim, digest, md->keylen);
+    ppp_rc4_crypt(&interim, digest, to->key, md->keylen);
+    mppe_key_done(md, to);
+    memset(digest, 0, sizeof(digest));
+    memset(&interim, 0, sizeof(interim));
+}
+
+/*
+ * Change to the next session key, and start RC4 over with it.
+ */
+static void
+mppe_rekey(struct mppe_data *md)
+{
+    if (md->nahead > 0) {
+	md->session = md->ahead[md->first_ahead];
+	memset(&md->ahead[md->first_ahead], 0, sizeof(md->ahead[0]));
+	md->first_ahead = (md->first_ahead + 1) % MPPE_KEYS_AHEAD;
+	--md->nahead;
+    } else
+	mppe_next_key(md, &md->session, &md->session);
+    md->rc4 = md->session.rc4;
+}
+
+void
+mppe_data_prime(struct mppe_data *md)
+{
+    struct mppe_key *from;
+
+    while (md->nahead < MPPE_KEYS_AHEAD) {
+	if (md->nahead == 0)
+	    from = &md->session;
+	else
+	    from = &md->ahead[(md->first_ahead + md->nahead - 1)
+			      % MPPE_KEYS_AHEAD];
+	mppe_next_key(md, from, &md->ahead[(md->first_ahead + md->nahead)
+					   % MPPE_KEYS_AHEAD]);
+	++md->nahead;
+    }
+}
+
+int
+mppe_data_init(struct mppe_data *md, const unsigned char *key, int keylen,
+	       int stateful)
+{
+    unsigned char digest[SHA_DIGEST_LENGTH];
+
+    if (keylen != 8 && keylen != 16)
+	return 0;
+    memset(md, 0, sizeof(*md));
+    md->sha = PPP_MD_CTX_new();
+    if (md->sha == NULL)
+	return 0;
+    md->keylen = keylen;
+    md->stateful = stateful;
+    md->ccount = MPPE_CCOUNT_SPACE - 1;	/* so that the first is 0 */
+    md->bits = MPPE_BIT_ENCRYPTED;
+    memcpy(md->master_key, key, keylen);
+
+    /* the first session key is the digest itself */
+    mppe_sha_key(md, md->master_key, digest);
+    memcpy(md->session.key, digest, keylen);
+    mppe_key_done(md, &md->session);
+    md->rc4 = md->session.rc4;
+    memset(digest, 0, sizeof(digest));
+    return 1;
+}
+
+void
+mppe_data_free(struct mppe_data *md)
+{
+    if (md->sha != NULL)
+	PPP_MD_CTX_free(md->sha);
+    memset(md, 0, sizeof(*md));
+}
+
+void
+mppe_data_reset(struct mppe_data *md)
+{
+    md->bits |= MPPE_BIT_FLUSHED;
+}
+
+int
+mppe_encrypt(struct mppe_data *md, const unsigned char *in, int len,
+	     unsigned char *out)
+{
+    md->ccount = (md->ccount + 1) % MPPE_CCOUNT_SPACE;
+    out[0] = md->ccount >> 8;
+    out[1] = md->ccount;
+
+    /*
+     * In stateless mode every packet has a new key.  In stateful
+     * mode it changes at each "flag" packet, whose count ends in
+     * 0xff, and after a Reset-Request RC4 starts over with the key
+     * it has.
+     */
+    if (!md->stateful || (md->ccount & 0xff) == 0xff) {
+	mppe_rekey(md);
+	md->bits |= MPPE_BIT_FLUSHED;
+    } else if (md->bits & MPPE_BIT_FLUSHED)
+	md->rc4 = md->session.rc4;
+    out[0] |= md->bits;
+    md->bits &= ~MPPE_BIT_FLUSHED;
+
+    ppp_rc4_crypt(&md->rc4, in, out + MPPE_HDRLEN, len);
+    return len + MPPE_HDRLEN;
+}
+
+int
+mppe_decrypt(struct mppe_data *md, const unsigned char *in, int len,
+	     unsigned char *out)
+{
+    unsigned int ccount, ahead;
+    int flushed;
+
+    if (len <= MPPE_HDRLEN || !(in[0] & MPPE_BIT_ENCRYPTED))
+	return -1;
+    ccount = ((in[0] & 0x0f) << 8) + in[1];
+    flushed = in[0] & MPPE_BIT_FLUSHED;
+
+    if (!md->stateful) {
+	/* drop packets that are late or repeated, then catch up */
+	ahead = (ccount - md->ccount) % MPPE_CCOUNT_SPACE;
+	if (ahead == 0 || ahead > MPPE_CCOUNT_SPACE / 2)
+	    return -1;
+	while (md->ccount != ccount) {
+	    mppe_rekey(md);
+	    md->ccount = (md->ccount + 1) % MPPE_CCOUNT_SPACE;
+	}
+    } else {
+	if (!md->discard) {
+	    md->ccount = (md->ccount + 1) % MPPE_CCOUNT_SPACE;
+	    if (ccount != md->ccount) {
+		/* lost one; wait for a flushed packet */
+		md->discard = 1;
+		return -1;
+	    }
+	} else {
+	    if (!flushed)
+		return -1;
+	    /* the sender changed key at every flag packet we missed */
+	    while ((ccount & ~0xff) != (md->ccount & ~0xff)) {
+		mppe_rekey(md);
+		md->ccount = (md->ccount + 0x100) % MPPE_CCOUNT_SPACE;
+	    }
+	    md->ccount = ccount;
+	    md->discard = 0;
+	}
+	if ((ccount & 0xff) == 0xff)
+	    mppe_rekey(md);
+	else if (flushed)
+	    md->rc4 = md->session.rc4;
+    }
+
+    ppp_rc4_crypt(&md->rc4, in + MPPE_HDRLEN, out, len - MPPE_HDRLEN);
+    return len - MPPE_HDRLEN;
+}
+
+#ifdef UNIT_TEST
+#include <stdio.h>
+#include <stdlib.h>
+
+static int
+rc4_vector(char *key, char *text, const unsigned char *want)
+{
+    struct ppp_rc4 rc4;
+    unsigned char out[64];
+    size_t len = strlen(text);
+
+    ppp_rc4_setkey(&rc4, (unsigned char *) key, strlen(key));
+    ppp_rc4_crypt(&rc4, (unsigned char *) text, out, len);
+    if (memcmp(out, want, len) != 0) {
+	printf("RC4 test with key \"%s\" failed\n", key);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * Send packets one way, losing some, asking for resets as a peer
+ * would, and working out keys ahead now and then on each side.
+ */
+static int
+round_trip(int keylen, int stateful)
+{
+    static unsigned char key[16] = {
+	0x8b, 0x7c, 0xdc, 0x14, 0x9b, 0x99, 0x3a, 0x1b,
+	0xa1, 0x18, 0xcb, 0x15, 0x3f, 0x56, 0xdc, 0xcb
+    };
+    struct mppe_data tx, rx, plain;
+    unsigned char pkt[1500], enc[1500 + MPPE_HDRLEN], chk[sizeof(enc)];
+    unsigned char dec[1500];
+    int n, i, len, elen, dlen, delivered = 0, failure = 0;
+
+    if (!mppe_data_init(&tx, key, keylen, stateful)
+	|| !mppe_data_init(&rx, key, keylen, stateful)
+	|| !mppe_data_init(&plain, key, keylen, stateful)) {
+	printf("mppe_data_init failed\n");
+	return 1;
+    }
+    for (n = 0; n < 20000; ++n) {
+	len = 1 + rand() % sizeof(pkt);
+	for (i = 0; i < len; ++i)
+	    pkt[i] = rand();
+	if (rand() % 50 == 0)
+	    mppe_data_prime(&tx);
+	if (rand() % 50 == 0)
+	    mppe_data_prime(&rx);
+
+	/* keys worked out ahead have to be the same ones */
+	elen = mppe_encrypt(&tx, pkt, len, enc);
+	if (mppe_encrypt(&plain, pkt, len, chk) != elen
+	    || memcmp(enc, chk, elen) != 0) {
+	    printf("keys worked out ahead differ at packet %d\n", n);
+	    failure = 1;
+	    break;
+	}
+	if (rand() % 20 == 0)
+	    continue;		/* lost */
+	dlen = mppe_decrypt(&rx, enc, elen, dec);
+	if (dlen < 0) {
+	    if (!stateful) {
+		printf("stateless packet %d dropped\n", n);
+		failure = 1;
+		break;
+	    }
+	    /* a Reset-Request, which may be repeated if it is slow */
+	    if (rand() % 4 == 0) {
+		mppe_data_reset(&tx);
+		mppe_data_reset(&plain);
+	    }
+	    continue;
+	}
+	if (dlen != len || memcmp(dec, pkt, len) != 0) {
+	    printf("packet %d decrypted wrongly\n", n);
+	    failure = 1;
+	    break;
+	}
+	++delivered;
+    }
+    if (!failure && delivered < 15000) {
+	printf("only %d packets got through\n", delivered);
+	failure = 1;
+    }
+    if (failure)
+	printf("%d-bit %s test failed\n", keylen == 8? 40: 128,
+	       stateful? "stateful": "stateless");
+    mppe_data_free(&tx);
+    mppe_data_free(&rx);
+    mppe_data_free(&plain);
+    return failure;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const unsigned char v1[] = {
+	0xbb, 0xf3, 0x16, 0xe8, 0xd9, 0x40, 0xaf, 0x0a, 0xd3
+    };
+    static const unsigned char v2[] = { 0x10, 0x21, 0xbf, 0x04, 0x20 };
+    static const unsigned char v3[] = {
+	0x45, 0xa0, 0x1f, 0x64, 0x5f, 0xc3, 0x5b, 0x38, 0x35, 0x52,
+	0x54, 0x4b, 0x9b, 0xf5
+    };
+    int failure = 0;
+
+    if (!PPP_crypto_init()) {
+	printf("Couldn't initialize crypto\n");
+	return 1;
+    }
+    failure += rc4_vector("Key", "Plaintext", v1);
+    failure += rc4_vector("Wiki", "pedia", v2);
+    failure += rc4_vector("Secret", "Attack at dawn", v3);
+
+    srand(1);
+    failure += round_trip(16, 0);
+    failure += round_trip(16, 1);
+    failure += round_trip(8, 0);
+    failure += round_trip(8, 1);
+
+    PPP_crypto_deinit();
+    return failure;
+}
+#endif /* UNIT_TEST */
+
+#ifdef MPPE_BENCH
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double
+elapsed(struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/*
+ * Report RC4 throughput, the cost of a rekey, and packets a second
+ * through a stateless and a stateful sender, with keys worked out as
+ * needed or ahead of time (which isn't counted).
+ */
+int
+main(int argc, char *argv[])
+{
+    static int sizes[] = { 64, 512, 1400 };
+    static unsigned char key[16] = {
+	1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+    };
+    static unsigned char buf[65536], out[65536 + MPPE_HDRLEN];
+    struct mppe_data md;
+    struct ppp_rc4 rc4;
+    struct timespec t0;
+    double secs, primed;
+    long n, iter;
+    int i, mode;
+
+    if (!PPP_crypto_init())
+	return 1;
+    for (i = 0; i < sizeof(buf); ++i)
+	buf[i] = rand();
+
+    ppp_rc4_setkey(&rc4, key, 16);
+    iter = 2000;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (n = 0; n < iter; ++n)
+	ppp_rc4_crypt(&rc4, buf, out, sizeof(buf));
+    printf("RC4: %.0f MB/s\n", iter * sizeof(buf) / elapsed(&t0) / 1e6);
+
+    mppe_data_init(&md, key, 16, 0);
+    iter = 200000;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (n = 0; n < iter; ++n)
+	mppe_rekey(&md);
+    printf("rekey: %.2f us\n", elapsed(&t0) / iter * 1e6);
+    mppe_data_free(&md);
+
+    printf("%-22s", "");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	printf(" %9d", sizes[i]);
+    printf("   (packets/s by size)\n");
+    for (mode = 0; mode < 3; ++mode) {
+	printf("%-22s", mode == 0? "stateless": mode == 1?
+	       "stateless, keys ahead": "stateful");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	    mppe_data_init(&md, key, 16, mode == 2);
+	    iter = 200000;
+	    secs = primed = 0;
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    for (n = 0; n < iter; ++n) {
+		if (mode == 1 && md.nahead == 0) {
+		    primed -= elapsed(&t0);
+		    mppe_data_prime(&md);
+		    primed += elapsed(&t0);
+		}
+		mppe_encrypt(&md, buf, sizes[i], out);
+	    }
+	    secs = elapsed(&t0) - primed;
+	    printf(" %9.0f", iter / secs);
+	    mppe_data_free(&md);
+	}
+	printf("\n");
+    }
+    PPP_crypto_deinit();
+    return 0;
+}
+#endif /* MPPE_BENCH */
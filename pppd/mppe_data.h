@@ -0,0 +1,118 @@
+/*
+ * mppe_data.h - the MPPE data path of RFC 3078: RC4 and the rekeying
+ * of the session keys.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPP_MPPE_DATA_H
+#define PPP_MPPE_DATA_H
+
+#include <stddef.h>
+
+#include "crypto.h"
+
+/*
+ * The kernel normally does this; these are for systems whose kernel
+ * can't, and for measuring it.
+ */
+
+struct ppp_rc4 {
+    unsigned int	i, j;
+    unsigned int	S[256];		/* ints are quicker than bytes */
+};
+
+void ppp_rc4_setkey(struct ppp_rc4 *rc4, const unsigned char *key,
+		    int keylen);
+void ppp_rc4_crypt(struct ppp_rc4 *rc4, const unsigned char *in,
+		   unsigned char *out, size_t len);
+
+#define MPPE_HDRLEN		2	/* added in front of each packet */
+#define MPPE_CCOUNT_SPACE	0x1000	/* the coherency count is 12 bits */
+#define MPPE_BIT_FLUSHED	0x80	/* the A bit */
+#define MPPE_BIT_ENCRYPTED	0x10	/* the D bit */
+
+/* how many session keys mppe_data_prime works out ahead of time */
+#define MPPE_KEYS_AHEAD		16
+
+struct mppe_key {
+    unsigned char	key[16];
+    struct ppp_rc4	rc4;		/* set up with key */
+};
+
+struct mppe_data {
+    unsigned char	master_key[16];
+    struct mppe_key	session;	/* key in use */
+    struct ppp_rc4	rc4;		/* as far through session as we are */
+    int			keylen;		/* 8 for 40-bit, 16 for 128-bit */
+    int			stateful;
+    int			discard;	/* stateful decrypt lost a packet */
+    unsigned int	ccount;		/* last coherency count */
+    unsigned char	bits;		/* for the next packet sent */
+    PPP_MD_CTX		*sha;
+    struct mppe_key	ahead[MPPE_KEYS_AHEAD];
+    int			nahead;		/* how many of ahead are ready */
+    int			first_ahead;	/* which is the next key */
+};
+
+/*
+ * Set up one direction with its start key (the mppe_send_key or
+ * mppe_recv_key) of keylen bytes, 8 or 16.  Returns 0 on failure.
+ */
+int mppe_data_init(struct mppe_data *md, const unsigned char *key,
+		   int keylen, int stateful);
+void mppe_data_free(struct mppe_data *md);
+
+/*
+ * Work out the next few session keys now, so that the packets that
+ * need them only have to copy them.  In stateless mode that is every
+ * packet.
+ */
+void mppe_data_prime(struct mppe_data *md);
+
+/*
+ * A CCP Reset-Request arrived: the next packet sent starts afresh.
+ */
+void mppe_data_reset(struct mppe_data *md);
+
+/*
+ * Encrypt the len bytes at in, a packet from its protocol field on,
+ * into out, which needs room for len + MPPE_HDRLEN.  Returns the
+ * length put in out.
+ */
+int mppe_encrypt(struct mppe_data *md, const unsigned char *in, int len,
+		 unsigned char *out);
+
+/*
+ * Decrypt the packet of len bytes at in, MPPE header first, into out,
+ * which needs room for len - MPPE_HDRLEN.  Returns the length put in
+ * out, or -1 if the packet has to be dropped; in stateful mode the
+ * caller should then send a CCP Reset-Request.
+ */
+int mppe_decrypt(struct mppe_data *md, const unsigned char *in, int len,
+		 unsigned char *out);
+
+#endif /* PPP_MPPE_DATA_H */
@@ -35,6 +35,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <netdb.h>
 #include <errno.h>
 #include <signal.h>
@@ -49,20 +51,37 @@
 
 bool endpoint_specified;	/* user gave explicit endpoint discriminator */
 char *bundle_id;		/* identifier for our bundle */
-char *blinks_id;		/* key for the list of links */
+char *blinks_id;		/* key for the bundle index */
 bool doing_multilink;		/* multilink was enabled and agreed to */
 bool multilink_master;		/* we own the multilink bundle */
 
 extern TDB_CONTEXT *pppdb;
-extern char db_key[];
+
+/*
+ * The index record for a bundle, stored under blinks_id, says which
+ * pppd owns the bundle and which pppds have links in it, so that
+ * neither joining nor hanging up has to parse the pppds' own records.
+ * The number of links comes from the size of the record, so that a
+ * joining link only has to append its pid to it.
+ */
+struct bundle_index {
+	int32_t	master_pid;	/* pppd that made the bundle */
+	int32_t	master_unit;	/* ppp unit of the bundle */
+	int32_t	link_pid[];	/* pppd for each link, master included */
+};
+
+#define BUNDLE_INDEX_SIZE(n)	(offsetof(struct bundle_index, link_pid) \
+				 + (n) * sizeof(int32_t))
 
 static void make_bundle_links(int append);
 static void remove_bundle_link(void);
-static void iterate_bundle_links(void (*func)(char *));
+static struct bundle_index *hangup_bundle_links(int *nhup);
+static struct bundle_index *fetch_bundle_index(int *nlinks);
+static void store_bundle_index(struct bundle_index *bi, int nlinks,
+			       const char *what);
 
 static int get_default_epdisc(struct epdisc *);
-static int parse_num(char *str, const char *key, int *valp);
-static int owns_unit(TDB_DATA pid, int unit);
+static int owns_unit(int pid, int unit);
 
 #define set_ip_epdisc(ep, addr) do {	\
 	ep->length = 4;			\
@@ -125,10 +144,10 @@ mp_join_bundle(void)
 	lcp_options *go = &lcp_gotoptions[0];
 	lcp_options *ho = &lcp_hisoptions[0];
 	lcp_options *ao = &lcp_allowoptions[0];
-	int unit, pppd_pid;
+	int unit;
 	int l, mtu;
 	char *p;
-	TDB_DATA key, pid, rec;
+	struct bundle_index *bi;
 
 	if (doing_multilink) {
 		/* have previously joined a bundle */
@@ -188,12 +207,12 @@ mp_join_bundle(void)
 	if (bundle_name)
 		p += slprintf(p, bundle_id+l-p, "/%v", bundle_name);
 
-	/* Make the key for the list of links belonging to the bundle */
+	/* Make the key for the index of the bundle */
 	l = p - bundle_id;
 	blinks_id = malloc(l + 7);
 	if (blinks_id == NULL)
-		novm("bundle links key");
-	slprintf(blinks_id, l + 7, "BUNDLE_LINKS=%s", bundle_id + 7);
+		novm("bundle index key");
+	slprintf(blinks_id, l + 7, "BUNDLE_INDEX=%s", bundle_id + 7);
 
 	/*
 	 * For demand mode, we only need to configure the bundle
@@ -208,29 +227,17 @@ mp_join_bundle(void)
 	}
 
 	/*
-	 * Check if the bundle ID is already in the database.
+	 * Check if the bundle is already in the database,
+	 * and its owner is still running.
 	 */
 	unit = -1;
 	lock_db();
-	key.dptr = bundle_id;
-	key.dsize = p - bundle_id;
-	pid = tdb_fetch(pppdb, key);
-	if (pid.dptr != NULL) {
-		/* bundle ID exists, see if the pppd record exists */
-		rec = tdb_fetch(pppdb, pid);
-		if (rec.dptr != NULL && rec.dsize > 0) {
-			/* make sure the string is null-terminated */
-			rec.dptr[rec.dsize-1] = 0;
-			/* parse the interface number */
-			parse_num(rec.dptr, "UNIT=", &unit);
-			/* check the pid value */
-			if (!parse_num(rec.dptr, "PPPD_PID=", &pppd_pid)
-			    || !process_exists(pppd_pid)
-			    || !owns_unit(pid, unit))
-				unit = -1;
-			free(rec.dptr);
-		}
-		free(pid.dptr);
+	bi = fetch_bundle_index(NULL);
+	if (bi != NULL) {
+		if (process_exists(bi->master_pid)
+		    && owns_unit(bi->master_pid, bi->master_unit))
+			unit = bi->master_unit;
+		free(bi);
 	}
 
 	if (unit >= 0) {
@@ -265,20 +272,10 @@ void mp_exit_bundle(void)
 	unlock_db();
 }
 
-static void sendhup(char *str)
-{
-	int pid;
-
-	if (parse_num(str, "PPPD_PID=", &pid) && pid != getpid()) {
-		if (debug)
-			dbglog("sending SIGHUP to process %d", pid);
-		kill(pid, SIGHUP);
-	}
-}
-
 void mp_bundle_terminated(void)
 {
-	TDB_DATA key;
+	struct bundle_index *bi;
+	int i, n;
 
 	bundle_terminating = 1;
 	upper_layers_down(0);
@@ -291,155 +288,193 @@ void mp_bundle_terminated(void)
 
 	lock_db();
 	destroy_bundle();
-	iterate_bundle_links(sendhup);
-	key.dptr = blinks_id;
-	key.dsize = strlen(blinks_id);
-	tdb_delete(pppdb, key);
+	bi = hangup_bundle_links(&n);
 	unlock_db();
 
+	/*
+	 * Signal the other links once the database is unlocked, since
+	 * each of them will want it to take itself out of the bundle.
+	 */
+	if (bi != NULL) {
+		for (i = 0; i < n; ++i)
+			kill(bi->link_pid[i], SIGHUP);
+		free(bi);
+	}
+
 	new_phase(PHASE_DEAD);
 
 	doing_multilink = 0;
 	multilink_master = 0;
 }
 
-static void make_bundle_links(int append)
+/*
+ * Fetch the index record for our bundle, checking that it is the
+ * right shape, and set *nlinks to the number of links in it, if
+ * nlinks isn't NULL.  The caller frees it.
+ */
+static struct bundle_index *
+fetch_bundle_index(int *nlinks)
 {
 	TDB_DATA key, rec;
-	char *p;
-	char entry[32];
-	int l;
 
 	key.dptr = blinks_id;
 	key.dsize = strlen(blinks_id);
-	slprintf(entry, sizeof(entry), "%s;", db_key);
-	p = entry;
-	if (append) {
-		rec = tdb_fetch(pppdb, key);
-		if (rec.dptr != NULL && rec.dsize > 0) {
-			rec.dptr[rec.dsize-1] = 0;
-			if (strstr(rec.dptr, db_key) != NULL) {
-				/* already in there? strange */
-				warn("link entry already exists in tdb");
-				return;
-			}
-			l = rec.dsize + strlen(entry);
-			p = malloc(l);
-			if (p == NULL)
-				novm("bundle link list");
-			slprintf(p, l, "%s%s", rec.dptr, entry);
-		} else {
-			warn("bundle link list not found");
-		}
-		if (rec.dptr != NULL)
-			free(rec.dptr);
+	rec = tdb_fetch(pppdb, key);
+	if (rec.dptr == NULL)
+		return NULL;
+	if (rec.dsize < BUNDLE_INDEX_SIZE(0)
+	    || (rec.dsize - BUNDLE_INDEX_SIZE(0)) % sizeof(int32_t) != 0) {
+		warn("bundle index is corrupt");
+		free(rec.dptr);
+		return NULL;
 	}
-	rec.dptr = p;
-	rec.dsize = strlen(p) + 1;
-	if (tdb_store(pppdb, key, rec, TDB_REPLACE))
-		error("couldn't %s bundle link list",
-		      append? "update": "create");
-	if (p != entry)
-		free(p);
+	if (nlinks != NULL)
+		*nlinks = (rec.dsize - BUNDLE_INDEX_SIZE(0)) / sizeof(int32_t);
+	return (struct bundle_index *) rec.dptr;
 }
 
-static void remove_bundle_link(void)
+static void
+store_bundle_index(struct bundle_index *bi, int nlinks, const char *what)
 {
 	TDB_DATA key, rec;
-	char entry[32];
-	char *p, *q;
-	int l;
 
 	key.dptr = blinks_id;
 	key.dsize = strlen(blinks_id);
-	slprintf(entry, sizeof(entry), "%s;", db_key);
+	rec.dptr = (char *) bi;
+	rec.dsize = BUNDLE_INDEX_SIZE(nlinks);
+	if (tdb_store(pppdb, key, rec, TDB_REPLACE))
+		error("couldn't %s bundle index", what);
+}
 
-	rec = tdb_fetch(pppdb, key);
-	if (rec.dptr == NULL || rec.dsize <= 0) {
-		if (rec.dptr != NULL)
-			free(rec.dptr);
+/*
+ * Add our link to the bundle index, making the index if we are
+ * making the bundle.  Joining an existing bundle only appends our pid,
+ * which tdb can usually do without moving the record.
+ */
+static void make_bundle_links(int append)
+{
+	struct bundle_index *bi;
+	TDB_DATA key, rec;
+	int32_t pid = getpid();
+
+	if (append) {
+		key.dptr = blinks_id;
+		key.dsize = strlen(blinks_id);
+		rec.dptr = (char *) &pid;
+		rec.dsize = sizeof(pid);
+		/* the caller has just found the index, with the db locked */
+		if (tdb_append(pppdb, key, rec))
+			error("couldn't update bundle index");
 		return;
 	}
-	rec.dptr[rec.dsize-1] = 0;
-	p = strstr(rec.dptr, entry);
-	if (p != NULL) {
-		q = p + strlen(entry);
-		l = strlen(q) + 1;
-		memmove(p, q, l);
-		rec.dsize = p - rec.dptr + l;
-		if (tdb_store(pppdb, key, rec, TDB_REPLACE))
-			error("couldn't update bundle link list (removal)");
-	}
-	free(rec.dptr);
+	bi = malloc(BUNDLE_INDEX_SIZE(1));
+	if (bi == NULL)
+		novm("bundle index");
+	bi->master_pid = pid;
+	bi->master_unit = ifunit;
+	bi->link_pid[0] = pid;
+	store_bundle_index(bi, 1, "create");
+	free(bi);
 }
 
-static void iterate_bundle_links(void (*func)(char *))
+static void remove_bundle_link(void)
 {
-	TDB_DATA key, rec, pp;
-	char *p, *q;
+	struct bundle_index *bi;
+	int i, n, pid = getpid();
 
-	key.dptr = blinks_id;
-	key.dsize = strlen(blinks_id);
-	rec = tdb_fetch(pppdb, key);
-	if (rec.dptr == NULL || rec.dsize <= 0) {
-		error("bundle link list not found (iterating list)");
-		if (rec.dptr != NULL)
-			free(rec.dptr);
+	bi = fetch_bundle_index(&n);
+	if (bi == NULL)
 		return;
-	}
-	p = rec.dptr;
-	p[rec.dsize-1] = 0;
-	while ((q = strchr(p, ';')) != NULL) {
-		*q = 0;
-		key.dptr = p;
-		key.dsize = q - p;
-		pp = tdb_fetch(pppdb, key);
-		if (pp.dptr != NULL && pp.dsize > 0) {
-			pp.dptr[pp.dsize-1] = 0;
-			func(pp.dptr);
+	for (i = 0; i < n; ++i) {
+		if (bi->link_pid[i] == pid) {
+			bi->link_pid[i] = bi->link_pid[--n];
+			store_bundle_index(bi, n, "update");
+			break;
 		}
-		if (pp.dptr != NULL)
-			free(pp.dptr);
-		p = q + 1;
 	}
-	free(rec.dptr);
+	free(bi);
 }
 
-static int
-parse_num(char *str, const char *key, int *valp)
+/*
+ * Put our new pid in the bundle index in place of oldpid, once
+ * detach() has moved us into a child process.  The caller has the
+ * database locked.
+ */
+void mp_rekey(int oldpid)
 {
-	char *p, *endp;
-	int i;
-
-	p = strstr(str, key);
-	if (p != 0) {
-		p += strlen(key);
-		i = strtol(p, &endp, 10);
-		if (endp != p && (*endp == 0 || *endp == ';')) {
-			*valp = i;
-			return 1;
-		}
+	struct bundle_index *bi;
+	int i, n, pid = getpid();
+
+	if (blinks_id == NULL)
+		return;		/* not in a bundle */
+	bi = fetch_bundle_index(&n);
+	if (bi == NULL)
+		return;
+	if (bi->master_pid == oldpid)
+		bi->master_pid = pid;
+	for (i = 0; i < n; ++i)
+		if (bi->link_pid[i] == oldpid)
+			bi->link_pid[i] = pid;
+	store_bundle_index(bi, n, "update");
+	free(bi);
+}
+
+/*
+ * Delete the bundle index, returning it with just the other pppds
+ * that had links in the bundle and are still running, *nhup of them,
+ * for the caller to hang up and then free.
+ */
+static struct bundle_index *hangup_bundle_links(int *nhup)
+{
+	struct bundle_index *bi;
+	TDB_DATA key;
+	char pkey[32];
+	int i, n, pid = getpid();
+
+	*nhup = 0;
+	bi = fetch_bundle_index(&n);
+	if (bi == NULL) {
+		error("bundle index not found (hanging up links)");
+		return NULL;
 	}
-	return 0;
+	key.dptr = blinks_id;
+	key.dsize = strlen(blinks_id);
+	tdb_delete(pppdb, key);
+
+	for (i = 0; i < n; ++i) {
+		if (bi->link_pid[i] == pid)
+			continue;
+		/* make sure it's still a pppd, and not some reuse of its pid */
+		slprintf(pkey, sizeof(pkey), "pppd%d", bi->link_pid[i]);
+		key.dptr = pkey;
+		key.dsize = strlen(pkey);
+		if (!tdb_exists(pppdb, key))
+			continue;
+		if (debug)
+			dbglog("sending SIGHUP to process %d", bi->link_pid[i]);
+		bi->link_pid[(*nhup)++] = bi->link_pid[i];
+	}
+	return bi;
 }
 
 /*
- * Check whether the pppd identified by `key' still owns ppp unit `unit'.
+ * Check whether the pppd with process ID `pid' still owns ppp unit `unit'.
  */
 static int
-owns_unit(TDB_DATA key, int unit)
+owns_unit(int pid, int unit)
 {
-	char ifkey[32];
+	char ifkey[32], pkey[32];
 	TDB_DATA kd, vd;
 	int ret = 0;
 
 	slprintf(ifkey, sizeof(ifkey), "UNIT=%d", unit);
+	slprintf(pkey, sizeof(pkey), "pppd%d", pid);
 	kd.dptr = ifkey;
 	kd.dsize = strlen(ifkey);
 	vd = tdb_fetch(pppdb, kd);
 	if (vd.dptr != NULL) {
-		ret = vd.dsize == key.dsize
-			&& memcmp(vd.dptr, key.dptr, vd.dsize) == 0;
+		ret = vd.dsize == strlen(pkey)
+			&& memcmp(vd.dptr, pkey, vd.dsize) == 0;
 		free(vd.dptr);
 	}
 	return ret;
@@ -67,6 +67,11 @@ void mp_exit_bundle(void);
  */
 void mp_bundle_terminated(void);
 
+/*
+ * Our pid has changed from oldpid, as when pppd detaches
+ */
+void mp_rekey(int oldpid);
+
 /*
  * Acting as a multilink master
  */
@@ -99,6 +104,7 @@ extern multilink_join_hook_fn *multilink_join_hook;
 #define mp_join_bundle(x)       ((void)0)
 #define mp_exit_bundle(x)       ((void)0)
 #define mp_bundle_terminated(x) ((void)0)
+#define mp_rekey(x)             ((void)0)
 
 static inline bool mp_on() {
     return false;
@@ -0,0 +1,212 @@
+/*
+ * offload.c - run blocking work on a thread beside the main loop.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
+#include "pppd-private.h"
+
+/*
+ * Jobs are run one at a time, in the order they were queued, by a
+ * single thread that is started the first time one is queued.  As
+ * each finishes it is put on the done list and a byte is written to
+ * a pipe, whose other end the main loop watches; the done functions
+ * are called from there.  Running one job at a time also means the
+ * work functions don't have to worry about each other, only about
+ * the main loop.
+ */
+
+struct offload_job {
+    ppp_offload_fn *work;
+    ppp_offload_done_fn *done;
+    void *arg;
+    int result;
+    struct offload_job *next;
+};
+
+#ifdef HAVE_PTHREAD_CREATE
+static pthread_mutex_t offload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t offload_cond = PTHREAD_COND_INITIALIZER;
+static struct offload_job *offload_queue, **offload_queue_tail = &offload_queue;
+static struct offload_job *offload_done, **offload_done_tail = &offload_done;
+static int offload_pipe[2] = { -1, -1 };
+static pid_t offload_pid;		/* process the thread is running in */
+
+/*
+ * offload_thread - run queued jobs as they arrive.
+ */
+static void *
+offload_thread(void *arg)
+{
+    struct offload_job *job;
+
+    pthread_mutex_lock(&offload_lock);
+    for (;;) {
+	while (offload_queue == NULL)
+	    pthread_cond_wait(&offload_cond, &offload_lock);
+	job = offload_queue;
+	offload_queue = job->next;
+	if (offload_queue == NULL)
+	    offload_queue_tail = &offload_queue;
+	pthread_mutex_unlock(&offload_lock);
+
+	job->result = (*job->work)(job->arg);
+
+	pthread_mutex_lock(&offload_lock);
+	job->next = NULL;
+	*offload_done_tail = job;
+	offload_done_tail = &job->next;
+	if (write(offload_pipe[1], "", 1) < 0 && errno != EAGAIN)
+	    error("Couldn't wake the main loop: %m");
+    }
+    return NULL;
+}
+
+/*
+ * offload_input - call the done functions of the jobs that have finished.
+ */
+static void
+offload_input(int fd, void *arg)
+{
+    struct offload_job *jobs, *job;
+    char buf[64];
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+	;
+    pthread_mutex_lock(&offload_lock);
+    jobs = offload_done;
+    offload_done = NULL;
+    offload_done_tail = &offload_done;
+    pthread_mutex_unlock(&offload_lock);
+
+    while ((job = jobs) != NULL) {
+	jobs = job->next;
+	(*job->done)(job->arg, job->result);
+	free(job);
+    }
+}
+
+/*
+ * offload_start - start the thread if this process doesn't have it yet.
+ * A child forked since it was started only has copies of the queues,
+ * for jobs its parent is looking after, so it starts again from scratch.
+ */
+static int
+offload_start(void)
+{
+    sigset_t all, old;
+    pthread_t tid;
+    int err;
+
+    if (offload_pid == getpid())
+	return 1;
+    if (offload_pid != 0) {
+	ppp_remove_fd_handler(offload_pipe[0]);
+	close(offload_pipe[0]);
+	close(offload_pipe[1]);
+	offload_pipe[0] = offload_pipe[1] = -1;
+	pthread_mutex_init(&offload_lock, NULL);
+	pthread_cond_init(&offload_cond, NULL);
+	offload_queue = offload_done = NULL;
+	offload_queue_tail = &offload_queue;
+	offload_done_tail = &offload_done;
+	offload_pid = 0;
+    }
+
+    if (pipe(offload_pipe) < 0) {
+	error("Couldn't create offload pipe: %m");
+	return 0;
+    }
+    fcntl(offload_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(offload_pipe[1], F_SETFD, FD_CLOEXEC);
+    fcntl(offload_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(offload_pipe[1], F_SETFL, O_NONBLOCK);
+
+    /* signals are for the main loop; the thread starts with all blocked */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&tid, NULL, offload_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+	errno = err;
+	error("Couldn't start offload thread: %m");
+	close(offload_pipe[0]);
+	close(offload_pipe[1]);
+	offload_pipe[0] = offload_pipe[1] = -1;
+	return 0;
+    }
+    pthread_detach(tid);
+    ppp_add_fd_handler(offload_pipe[0], offload_input, NULL);
+    offload_pid = getpid();
+    return 1;
+}
+#endif /* HAVE_PTHREAD_CREATE */
+
+/*
+ * ppp_offload - run work(arg) on the offload thread, then call
+ * done(arg, result) from the main loop with what it returned.
+ * Without a thread both are called before this returns.
+ */
+void
+ppp_offload(ppp_offload_fn *work, ppp_offload_done_fn *done, void *arg)
+{
+#ifdef HAVE_PTHREAD_CREATE
+    struct offload_job *job;
+
+    if (offload_start()) {
+	job = malloc(sizeof(*job));
+	if (job == NULL)
+	    novm("offload job");
+	job->work = work;
+	job->done = done;
+	job->arg = arg;
+	job->next = NULL;
+	pthread_mutex_lock(&offload_lock);
+	*offload_queue_tail = job;
+	offload_queue_tail = &job->next;
+	pthread_cond_signal(&offload_cond);
+	pthread_mutex_unlock(&offload_lock);
+	return;
+    }
+#endif
+    (*done)(arg, (*work)(arg));
+}
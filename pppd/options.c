@@ -44,7 +44,6 @@
 #include "config.h"
 #endif
 
-#include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <errno.h>
@@ -55,6 +54,7 @@
 #include <string.h>
 #include <pwd.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <net/if.h>
 #ifdef PPP_WITH_PLUGINS
 #include <dlfcn.h>
@@ -114,10 +114,21 @@ bool	demand = 0;		/* do dial-on-demand */
 int	idle_time_limit = 0;	/* Disconnect if idle for this many seconds */
 int	holdoff = 30;		/* # seconds to pause before reconnecting */
 bool	holdoff_specified;	/* true if a holdoff value has been given */
+#ifdef PPP_WITH_TDB
+int	admit_rate;		/* max # of links started per second */
+int	admit_burst;		/* # of links that may start at once */
+int	peer_cache_time;	/* max age of peer cache entries to use */
+int	db_snapshot_interval;	/* secs between database snapshots */
+#endif
 int	log_to_fd = 1;		/* send log messages to this fd too */
 bool	log_default = 1;	/* log_to_fd is default (stdout) */
+bool	log_json;		/* log to log_to_fd as JSON lines */
 int	maxfail = 10;		/* max # of unsuccessful connection attempts */
 char	linkname[MAXPATHLEN];	/* logical name for link */
+char	prefork_path[MAXPATHLEN]; /* socket to serve session requests on */
+int	prefork_pool;		/* sessions to have interfaces ready for */
+int	stats_interval;		/* secs between stats file updates */
+int	demand_queue = 65536;	/* bytes of packets held for the link */
 bool	tune_kernel;		/* may alter kernel settings */
 int	connect_delay = 1000;	/* wait this many ms after connect script */
 int	req_unit = -1;		/* requested interface unit */
@@ -131,6 +142,7 @@ bool	show_options;		/* print all supported options and exit */
 bool	dryrun;			/* print out option values and exit */
 char	*domain;		/* domain name set by domain option */
 int	child_wait = 5;		/* # seconds to wait for children at exit */
+bool	use_signalfd;		/* handle signals through a signalfd */
 struct userenv *userenv_list;	/* user environment variables */
 int	dfl_route_metric = -1;	/* metric of the default route to set over the PPP link */
 
@@ -205,6 +217,18 @@ struct option_list {
 
 static struct option_list *extra_options = NULL;
 
+/*
+ * Index of the options by name, for find_option.  It is built the
+ * first time an option is looked up, and again after more options are
+ * added or the channel changes.
+ */
+static struct option **option_index;	/* open-addressed hash table */
+static int option_index_size;		/* a power of 2 */
+static struct option **wild_options;	/* o_wild entries, in order */
+static int n_wild_options;
+static int option_index_valid;
+static struct channel *option_index_channel;
+
 /*
  * Valid arguments.
  */
@@ -234,6 +258,21 @@ struct option general_options[] = {
     { "master_detach", o_bool, &master_detach,
       "Detach when we're multilink master but have no link", 1 },
 
+#ifdef PPP_WITH_TDB
+    { "admit-rate", o_int, &admit_rate,
+      "Max number of links to start per second on this system",
+      OPT_PRIO | OPT_PRIV },
+    { "admit-burst", o_int, &admit_burst,
+      "Number of links that may start at once under admit-rate",
+      OPT_PRIO | OPT_PRIV },
+    { "peer-cache", o_int, &peer_cache_time,
+      "Ask for what the peer agreed to last time, if within this many seconds",
+      OPT_PRIO | OPT_PRIV },
+    { "db-snapshot", o_int, &db_snapshot_interval,
+      "Keep a read-only copy of the database no more than this many seconds old",
+      OPT_PRIO | OPT_PRIV },
+#endif
+
     { "holdoff", o_int, &holdoff,
       "Set time in seconds before retrying connection",
       OPT_PRIO, &holdoff_specified },
@@ -262,6 +301,10 @@ struct option general_options[] = {
     { "demand", o_bool, &demand,
       "Dial on demand", OPT_INITONLY | 1, &persist },
 
+    { "demand-queue", o_int, &demand_queue,
+      "Hold at most n bytes of packets while the link comes up",
+      OPT_PRIO | OPT_INITONLY | OPT_LLIMIT, NULL, 0, 0 },
+
     { "--version", o_special_noarg, (void *)showversion,
       "Show version number" },
     { "-v", o_special_noarg, (void *)showversion,
@@ -285,11 +328,30 @@ struct option general_options[] = {
     { "nologfd", o_int, &log_to_fd,
       "Don't send log messages to any file descriptor",
       OPT_PRIOSUB | OPT_ALIAS | OPT_NOARG | OPT_VAL(-1) },
+    { "logjson", o_bool, &log_json,
+      "Write log messages to the log file as JSON lines",
+      OPT_PRIO | 1 },
 
     { "linkname", o_string, linkname,
       "Set logical name for link",
       OPT_PRIO | OPT_PRIV | OPT_STATIC, NULL, MAXPATHLEN },
 
+    { "stats-interval", o_int, &stats_interval,
+      "Publish link counters in the stats file every n seconds",
+      OPT_PRIO },
+
+    { "prefork-socket", o_string, prefork_path,
+      "Fork a session per request on this socket",
+      OPT_PRIV | OPT_STATIC, NULL, MAXPATHLEN },
+
+    { "control-socket", o_string, control_path,
+      "Take commands on this unix socket",
+      OPT_PRIV | OPT_STATIC, NULL, MAXPATHLEN },
+
+    { "prefork-pool", o_int, &prefork_pool,
+      "Have interfaces ready for this many prefork-socket sessions",
+      OPT_PRIV | OPT_LIMITS, NULL, PREFORK_POOL_MAX, 0 },
+
     { "maxfail", o_int, &maxfail,
       "Maximum number of unsuccessful connection attempts to allow",
       OPT_PRIO },
@@ -320,6 +382,9 @@ struct option general_options[] = {
       "Number of seconds to wait for child processes at exit",
       OPT_PRIO },
 
+    { "signalfd", o_bool, &use_signalfd,
+      "Handle signals in the main loop via a signalfd", 1 },
+
     { "set", o_special, (void *)user_setenv,
       "Set user environment variable",
       OPT_A2PRINTER | OPT_NOPRINT, (void *)user_setprint },
@@ -494,6 +559,11 @@ bool ppp_persist()
     return !!persist;
 }
 
+int ppp_holdoff()
+{
+    return need_holdoff? holdoff: 0;
+}
+
 /*
  * parse_args - parse a string of arguments from the command line.
  */
@@ -708,53 +778,104 @@ err:
     return ret;
 }
 
+static unsigned int
+option_hash(char *name)
+{
+	unsigned int h = 2166136261U;
+
+	while (*name != 0)
+		h = (h ^ (unsigned char) *name++) * 16777619U;
+	return h;
+}
+
 /*
- * match_option - see if this option matches an option structure.
+ * index_options - add a table of options to the index.  Where a name
+ * is already there, the earlier entry wins, as it does in a search
+ * of the lists in order.
  */
-static int
-match_option(char *name, struct option *opt, int dowild)
+static void
+index_options(struct option *opt, int count_only, int *np)
 {
-	int (*match)(char *, char **, int);
+	unsigned int h, mask;
 
-	if (dowild != (opt->type == o_wild))
-		return 0;
-	if (!dowild)
-		return strcmp(name, opt->name) == 0;
-	match = (int (*)(char *, char **, int)) opt->addr;
-	return (*match)(name, NULL, 0);
+	mask = option_index_size - 1;
+	for (; opt->name != NULL; ++opt) {
+		if (count_only) {
+			++*np;
+			continue;
+		}
+		if (opt->type == o_wild) {
+			wild_options[n_wild_options++] = opt;
+			continue;
+		}
+		for (h = option_hash(opt->name) & mask; option_index[h] != NULL;
+		     h = (h + 1) & mask)
+			if (strcmp(option_index[h]->name, opt->name) == 0)
+				break;
+		if (option_index[h] == NULL)
+			option_index[h] = opt;
+	}
 }
 
 /*
- * find_option - scan the option lists for the various protocols
- * looking for an entry with the given name.
- * This could be optimized by using a hash table.
+ * build_option_index - (re)build the index over all the option lists,
+ * in the order find_option searches them.
  */
-static struct option *
-find_option(char *name)
+static void
+build_option_index(void)
 {
-	struct option *opt;
 	struct option_list *list;
-	int i, dowild;
-
-	for (dowild = 0; dowild <= 1; ++dowild) {
-		for (opt = general_options; opt->name != NULL; ++opt)
-			if (match_option(name, opt, dowild))
-				return opt;
-		for (opt = auth_options; opt->name != NULL; ++opt)
-			if (match_option(name, opt, dowild))
-				return opt;
+	int i, n, pass;
+
+	free(option_index);
+	free(wild_options);
+	n = 0;
+	for (pass = 0; pass <= 1; ++pass) {
+		if (pass == 1) {
+			/* keep the table no more than half full */
+			for (option_index_size = 64; option_index_size < 2 * n; )
+				option_index_size <<= 1;
+			option_index = calloc(option_index_size, sizeof(*option_index));
+			wild_options = malloc((n + 1) * sizeof(*wild_options));
+			if (option_index == NULL || wild_options == NULL)
+				novm("option index");
+			n_wild_options = 0;
+		}
+		index_options(general_options, !pass, &n);
+		index_options(auth_options, !pass, &n);
 		for (list = extra_options; list != NULL; list = list->next)
-			for (opt = list->options; opt->name != NULL; ++opt)
-				if (match_option(name, opt, dowild))
-					return opt;
-		for (opt = the_channel->options; opt->name != NULL; ++opt)
-			if (match_option(name, opt, dowild))
-				return opt;
+			index_options(list->options, !pass, &n);
+		index_options(the_channel->options, !pass, &n);
 		for (i = 0; protocols[i] != NULL; ++i)
-			if ((opt = protocols[i]->options) != NULL)
-				for (; opt->name != NULL; ++opt)
-					if (match_option(name, opt, dowild))
-						return opt;
+			if (protocols[i]->options != NULL)
+				index_options(protocols[i]->options, !pass, &n);
+	}
+	option_index_channel = the_channel;
+	option_index_valid = 1;
+}
+
+/*
+ * find_option - look for an option with the given name, first by
+ * name in the index and then through the wildcard options.
+ */
+static struct option *
+find_option(char *name)
+{
+	struct option *opt;
+	unsigned int h, mask;
+	int i;
+
+	if (!option_index_valid || option_index_channel != the_channel)
+		build_option_index();
+	mask = option_index_size - 1;
+	for (h = option_hash(name) & mask; (opt = option_index[h]) != NULL;
+	     h = (h + 1) & mask)
+		if (strcmp(name, opt->name) == 0)
+			return opt;
+	for (i = 0; i < n_wild_options; ++i) {
+		opt = wild_options[i];
+		if ((*(int (*)(char *, char **, int)) opt->addr)(name, NULL, 0))
+			return opt;
 	}
 	return NULL;
 }
@@ -1000,6 +1121,7 @@ ppp_add_options(struct option *opt)
     list->options = opt;
     list->next = extra_options;
     extra_options = list;
+    option_index_valid = 0;
 }
 
 /*
@@ -1308,251 +1430,6 @@ readable(int fd)
 }
 #endif
 
-/*
- * Read a word from a file.
- * Words are delimited by white-space or by quotes (" or ').
- * Quotes, white-space and \ may be escaped with \.
- * \<newline> is ignored.
- */
-int
-getword(FILE *f, char *word, int *newlinep, char *filename)
-{
-    int c, len, escape;
-    int quoted, comment;
-    int value, digit, got, n;
-
-#define isoctal(c) ((c) >= '0' && (c) < '8')
-
-    *newlinep = 0;
-    len = 0;
-    escape = 0;
-    comment = 0;
-    quoted = 0;
-
-    /*
-     * First skip white-space and comments.
-     */
-    for (;;) {
-	c = getc(f);
-	if (c == EOF)
-	    break;
-
-	/*
-	 * A newline means the end of a comment; backslash-newline
-	 * is ignored.  Note that we cannot have escape && comment.
-	 */
-	if (c == '\n') {
-	    if (!escape) {
-		*newlinep = 1;
-		comment = 0;
-	    } else
-		escape = 0;
-	    continue;
-	}
-
-	/*
-	 * Ignore characters other than newline in a comment.
-	 */
-	if (comment)
-	    continue;
-
-	/*
-	 * If this character is escaped, we have a word start.
-	 */
-	if (escape)
-	    break;
-
-	/*
-	 * If this is the escape character, look at the next character.
-	 */
-	if (c == '\\') {
-	    escape = 1;
-	    continue;
-	}
-
-	/*
-	 * If this is the start of a comment, ignore the rest of the line.
-	 */
-	if (c == '#') {
-	    comment = 1;
-	    continue;
-	}
-
-	/*
-	 * A non-whitespace character is the start of a word.
-	 */
-	if (!isspace(c))
-	    break;
-    }
-
-    /*
-     * Process characters until the end of the word.
-     */
-    while (c != EOF) {
-	if (escape) {
-	    /*
-	     * This character is escaped: backslash-newline is ignored,
-	     * various other characters indicate particular values
-	     * as for C backslash-escapes.
-	     */
-	    escape = 0;
-	    if (c == '\n') {
-	        c = getc(f);
-		continue;
-	    }
-
-	    got = 0;
-	    switch (c) {
-	    case 'a':
-		value = '\a';
-		break;
-	    case 'b':
-		value = '\b';
-		break;
-	    case 'f':
-		value = '\f';
-		break;
-	    case 'n':
-		value = '\n';
-		break;
-	    case 'r':
-		value = '\r';
-		break;
-	    case 's':
-		value = ' ';
-		break;
-	    case 't':
-		value = '\t';
-		break;
-
-	    default:
-		if (isoctal(c)) {
-		    /*
-		     * \ddd octal sequence
-		     */
-		    value = 0;
-		    for (n = 0; n < 3 && isoctal(c); ++n) {
-			value = (value << 3) + (c & 07);
-			c = getc(f);
-		    }
-		    got = 1;
-		    break;
-		}
-
-		if (c == 'x') {
-		    /*
-		     * \x<hex_string> sequence
-		     */
-		    value = 0;
-		    c = getc(f);
-		    for (n = 0; n < 2 && isxdigit(c); ++n) {
-			digit = toupper(c) - '0';
-			if (digit > 10)
-			    digit += '0' + 10 - 'A';
-			value = (value << 4) + digit;
-			c = getc (f);
-		    }
-		    got = 1;
-		    break;
-		}
-
-		/*
-		 * Otherwise the character stands for itself.
-		 */
-		value = c;
-		break;
-	    }
-
-	    /*
-	     * Store the resulting character for the escape sequence.
-	     */
-	    if (len < MAXWORDLEN) {
-		word[len] = value;
-		++len;
-	    }
-
-	    if (!got)
-		c = getc(f);
-	    continue;
-	}
-
-	/*
-	 * Backslash starts a new escape sequence.
-	 */
-	if (c == '\\') {
-	    escape = 1;
-	    c = getc(f);
-	    continue;
-	}
-
-	/*
-	 * Not escaped: check for the start or end of a quoted
-	 * section and see if we've reached the end of the word.
-	 */
-	if (quoted) {
-	    if (c == quoted) {
-		quoted = 0;
-		c = getc(f);
-		continue;
-	    }
-	} else if (c == '"' || c == '\'') {
-	    quoted = c;
-	    c = getc(f);
-	    continue;
-	} else if (isspace(c) || c == '#') {
-	    ungetc (c, f);
-	    break;
-	}
-
-	/*
-	 * An ordinary character: store it in the word and get another.
-	 */
-	if (len < MAXWORDLEN) {
-	    word[len] = c;
-	    ++len;
-	}
-
-	c = getc(f);
-    }
-    word[MAXWORDLEN-1] = 0;	/* make sure word is null-terminated */
-
-    /*
-     * End of the word: check for errors.
-     */
-    if (c == EOF) {
-	if (ferror(f)) {
-	    if (errno == 0)
-		errno = EIO;
-	    ppp_option_error("Error reading %s: %m", filename);
-	    die(1);
-	}
-	/*
-	 * If len is zero, then we didn't find a word before the
-	 * end of the file.
-	 */
-	if (len == 0)
-	    return 0;
-	if (quoted)
-	    ppp_option_error("warning: quoted word runs to end of file (%.20s...)",
-			 filename, word);
-    }
-
-    /*
-     * Warn if the word was too long, and append a terminating null.
-     */
-    if (len >= MAXWORDLEN) {
-	ppp_option_error("warning: word in file %s too long (%.20s...)",
-		     filename, word);
-	len = MAXWORDLEN - 1;
-    }
-    word[len] = 0;
-
-    return 1;
-
-#undef isoctal
-
-}
-
 /*
  * number_option - parse an unsigned numeric parameter for an option.
  */
@@ -1646,44 +1523,169 @@ callfile(char **argv)
 
 #ifdef PPP_WITH_FILTER
 /*
- * setpassfilter - Set the pass filter for packets
+ * Compiling a long filter expression can take libpcap a noticeable
+ * time, and every pppd with the same options compiles the same one.
+ * So the first pppd to compile an expression saves the program in
+ * the runtime directory, named for a hash of the expression, and
+ * later ones load it from there.  The file records the expression,
+ * the netmask it was compiled with and libpcap's version, and is only
+ * used if all three match and the program passes bpf_validate.
+ */
+#define FILTER_CACHE_MAGIC	0x50464c54	/* "PFLT" */
+
+struct filter_cache_header {
+    u_int32_t magic;
+    u_int32_t netmask;
+    u_int32_t explen;		/* length of the expression that follows */
+    u_int32_t len;		/* number of instructions after that */
+    char pcap_version[64];
+};
+
+static void
+filter_cache_name(const char *expr, char *buf, size_t len)
+{
+    char dir[MAXPATHLEN];
+    u_int32_t h = 2166136261U;
+
+    while (*expr)
+	h = (h ^ (unsigned char) *expr++) * 16777619U;
+    ppp_get_path(PPP_DIR_RUNTIME, dir, sizeof(dir));
+    slprintf(buf, len, "%s/pppd-filter-%08x.bpf", dir, h);
+}
+
+static void
+filter_cache_header(struct filter_cache_header *hdr, const char *expr,
+		    u_int32_t len)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = FILTER_CACHE_MAGIC;
+    hdr->netmask = netmask;
+    hdr->explen = strlen(expr);
+    hdr->len = len;
+    strlcpy(hdr->pcap_version, pcap_lib_version(), sizeof(hdr->pcap_version));
+}
+
+/*
+ * filter_cache_load - fill in prog from the saved program for expr,
+ * if there is a good one.
  */
 static int
-setpassfilter(char **argv)
+filter_cache_load(const char *expr, struct bpf_program *prog)
 {
-    pcap_t *pc;
-    int ret = 1;
+    char name[MAXPATHLEN];
+    struct filter_cache_header hdr, want;
+    struct bpf_insn *insns = NULL;
+    struct stat sbuf;
+    char *text = NULL;
+    int fd, ok = 0;
 
-    pc = pcap_open_dead(DLT_PPP_PPPD, 65535);
-    if (pcap_compile(pc, &pass_filter, *argv, 1, netmask) == -1) {
-	ppp_option_error("error in pass-filter expression: %s\n",
-		     pcap_geterr(pc));
-	ret = 0;
-    }
-    pcap_close(pc);
+    filter_cache_name(expr, name, sizeof(name));
+    if ((fd = open(name, O_RDONLY)) < 0)
+	return 0;
+    /* only trust a file nobody else could have written */
+    if (fstat(fd, &sbuf) < 0 || (sbuf.st_uid != 0 && sbuf.st_uid != geteuid())
+	|| (sbuf.st_mode & (S_IWGRP | S_IWOTH))
+	|| read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+	goto out;
+    filter_cache_header(&want, expr, hdr.len);
+    if (memcmp(&hdr, &want, sizeof(hdr)) != 0
+	|| hdr.len == 0 || hdr.len > BPF_MAXINSNS
+	|| sbuf.st_size != sizeof(hdr) + hdr.explen
+	    + hdr.len * sizeof(struct bpf_insn))
+	goto out;
+
+    text = malloc(hdr.explen);
+    insns = malloc(hdr.len * sizeof(struct bpf_insn));
+    if (text == NULL || insns == NULL
+	|| read(fd, text, hdr.explen) != hdr.explen
+	|| memcmp(text, expr, hdr.explen) != 0
+	|| read(fd, insns, hdr.len * sizeof(struct bpf_insn))
+	    != hdr.len * sizeof(struct bpf_insn)
+	|| !bpf_validate(insns, hdr.len))
+	goto out;
+
+    prog->bf_len = hdr.len;
+    prog->bf_insns = insns;
+    insns = NULL;
+    ok = 1;
 
-    return ret;
+ out:
+    free(text);
+    free(insns);
+    close(fd);
+    return ok;
 }
 
 /*
- * setactivefilter - Set the active filter for packets
+ * filter_cache_save - save the program just compiled from expr.
+ * Failing to is no matter; the next pppd just compiles it again.
+ */
+static void
+filter_cache_save(const char *expr, struct bpf_program *prog)
+{
+    char name[MAXPATHLEN], tmp[MAXPATHLEN];
+    struct filter_cache_header hdr;
+    size_t n = prog->bf_len * sizeof(struct bpf_insn);
+    int fd, ok;
+
+    filter_cache_name(expr, name, sizeof(name));
+    slprintf(tmp, sizeof(tmp), "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) < 0)
+	return;
+    filter_cache_header(&hdr, expr, prog->bf_len);
+    ok = fchmod(fd, 0644) == 0
+	&& write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+	&& write(fd, expr, hdr.explen) == hdr.explen
+	&& write(fd, prog->bf_insns, n) == n;
+    if (close(fd) < 0 || !ok || rename(tmp, name) < 0)
+	unlink(tmp);
+}
+
+/*
+ * filter_compile - compile a pass or active filter expression into
+ * prog, or load the program saved from compiling it before.  Only
+ * filters from a privileged source use the saved programs, so that
+ * an ordinary user of a setuid pppd can't have root write files for
+ * later pppds to load.
  */
 static int
-setactivefilter(char **argv)
+filter_compile(char *expr, struct bpf_program *prog, const char *optname)
 {
     pcap_t *pc;
     int ret = 1;
 
+    if (privileged_option && filter_cache_load(expr, prog))
+	return 1;
+
     pc = pcap_open_dead(DLT_PPP_PPPD, 65535);
-    if (pcap_compile(pc, &active_filter, *argv, 1, netmask) == -1) {
-	ppp_option_error("error in active-filter expression: %s\n",
+    if (pcap_compile(pc, prog, expr, 1, netmask) == -1) {
+	ppp_option_error("error in %s expression: %s\n", optname,
 		     pcap_geterr(pc));
 	ret = 0;
-    }
+    } else if (privileged_option)
+	filter_cache_save(expr, prog);
     pcap_close(pc);
 
     return ret;
 }
+
+/*
+ * setpassfilter - Set the pass filter for packets
+ */
+static int
+setpassfilter(char **argv)
+{
+    return filter_compile(*argv, &pass_filter, "pass-filter");
+}
+
+/*
+ * setactivefilter - Set the active filter for packets
+ */
+static int
+setactivefilter(char **argv)
+{
+    return filter_compile(*argv, &active_filter, "active-filter");
+}
 #endif
 
 /*
@@ -1794,7 +1796,9 @@ loadplugin(char **argv)
 	goto errclose;
     }
     info("Plugin %s loaded.", arg);
+    prof_begin(PROF_PLUGIN);
     (*init)();
+    prof_end(PROF_PLUGIN);
     return 1;
 
  errclose:
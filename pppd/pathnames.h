@@ -90,6 +90,7 @@
 #define PPP_PATH_UPAPFILE       PPP_PATH_CONFDIR "/pap-secrets"
 #define PPP_PATH_CHAPFILE       PPP_PATH_CONFDIR "/chap-secrets"
 #define PPP_PATH_SRPFILE        PPP_PATH_CONFDIR "/srp-secrets"
+#define PPP_PATH_SECRETSDB      PPP_PATH_CONFDIR "/secrets.db"
 
 #ifdef PPP_WITH_EAPTLS
 #define PPP_PATH_EAPTLSCLIFILE  PPP_PATH_CONFDIR "/eaptls-client"
@@ -118,6 +119,11 @@
 #endif
 
 #define PPP_PATH_PPPDB          PPP_PATH_VARRUN  "/pppd2.tdb"
+#define PPP_PATH_PPPDB_SNAP     PPP_PATH_VARRUN  "/pppd2.snap"
+#define PPP_PATH_STATSFILE      PPP_PATH_VARRUN  "/pppd-stats"
+#define PPP_PATH_KCAPS          PPP_PATH_VARRUN  "/pppd-kcaps"
+#define PPP_PATH_IPPOOL         PPP_PATH_VARRUN  "/pppd-ippool-"
+#define PPP_PATH_EAPTLS_SESSIONS PPP_PATH_VARRUN "/pppd-eaptls.tdb"
 
 #ifdef __linux__
 #define PPP_PATH_LOCKDIR        PPP_PATH_VARRUN  "/lock"
@@ -469,6 +469,8 @@ done:
 int peap_init(struct peap_state **ctx, const char *rhostname)
 {
 	const SSL_METHOD *method;
+	const char *files[4];
+	char tag[64];
 
 	if (!ctx)
 		return -1;
@@ -484,6 +486,17 @@ int peap_init(struct peap_state **ctx, const char *rhostname)
 	psm->out_buf = malloc(TLS_RECORD_MAX_SIZE);
 	if (!psm->out_buf)
 		novm("peap tls buffer");
+	/* the CA and CRL files are only read again once they change */
+	files[0] = ca_path;
+	files[1] = cacert_file;
+	files[2] = crl_dir;
+	files[3] = crl_file;
+	slprintf(tag, sizeof(tag), "peap %s",
+		 max_tls_version ? max_tls_version : "");
+	psm->ctx = tls_ctx_get(tag, files, 4);
+	if (psm->ctx)
+		goto have_ctx;
+
 	method = tls_method();
 	if (!method)
 		novm("TLS_method() failed");
@@ -509,6 +522,9 @@ int peap_init(struct peap_state **ctx, const char *rhostname)
 	if (tls_set_crl(psm->ctx, crl_dir, crl_file)) {
 		fatal("Could not set CRL verify locations");
 	}
+	tls_ctx_put(tag, files, 4, psm->ctx);
+
+have_ctx:
 
 	psm->out_bio = BIO_new(BIO_s_mem());
 	psm->in_bio = BIO_new(BIO_s_mem());
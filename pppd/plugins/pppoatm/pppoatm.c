@@ -45,6 +45,12 @@ static int setdevname_pppoatm(const char *cp, const char **argv, int doit);
 struct channel pppoa_channel;
 static int pppoa_fd = -1;
 static char devnam[MAXNAMELEN];
+static int pppoatm_sndbuf, pppoatm_rcvbuf;
+static struct atm_aal_stats pppoatm_stats;	/* when we connected */
+static bool pppoatm_have_stats;
+
+/* Socket buffers sized from the QoS hold this much traffic */
+#define PPPOATM_BUF_MS	100
 
 static struct option pppoa_options[] = {
 	{ "device name", o_wild, (void *) &setdevname_pppoatm,
@@ -57,6 +63,12 @@ static struct option pppoa_options[] = {
 	  "use VC multiplexing for PPPoATM (default)", 1},
 	{ "qos", o_string, &qosstr,
 	  "set QoS for PPPoATM connection", 1},
+	{ "pppoatm-sndbuf", o_int, &pppoatm_sndbuf,
+	  "set socket send buffer for PPPoATM (default from QoS)",
+	  OPT_PRIO | OPT_LLIMIT, NULL, 0, 0 },
+	{ "pppoatm-rcvbuf", o_int, &pppoatm_rcvbuf,
+	  "set socket receive buffer for PPPoATM (default from QoS)",
+	  OPT_PRIO | OPT_LLIMIT, NULL, 0, 0 },
 	{ NULL }
 };
 
@@ -81,9 +93,15 @@ static int setdevname_pppoatm(const char *cp, const char **argv, int doit)
 	if (device_got_set)
 		return 0;
 
+	/*
+	 * This runs once, while the options are parsed, and the result
+	 * is kept in pvcaddr for every connect after.  Only PVCs are
+	 * wanted, so a name is only looked up in /etc/hosts.atm, never
+	 * through ANS (the DNS), which has only SVC addresses.
+	 */
 	memset(&addr, 0, sizeof addr);
 	if (text2atm(cp, (struct sockaddr *) &addr, sizeof(addr),
-	    T2A_PVC | T2A_NAME | T2A_WILDCARD) < 0) {
+	    T2A_PVC | T2A_NAME | T2A_WILDCARD | T2A_LOCAL) < 0) {
 		if (doit)
 			info("cannot parse the ATM address: %s", cp);
 		return 0;
@@ -139,10 +157,65 @@ static void reset_line_discipline_pppoatm(int fd)
 }
 #endif
 
+/*
+ * The cell rate a direction of the VC is shaped to, or 0 if it has
+ * none (UBR at line rate).  text2qos has no SCR, so this is the PCR.
+ */
+static int pppoatm_rate(const struct atm_trafprm *tp)
+{
+	if (tp->traffic_class == ATM_NONE)
+		return 0;
+	if (tp->pcr > 0)
+		return tp->pcr;
+	if (tp->max_pcr > 0)
+		return tp->max_pcr;
+	return tp->min_pcr > 0 ? tp->min_pcr : 0;
+}
+
+/*
+ * Set a socket buffer big enough for PPPOATM_BUF_MS of traffic at
+ * the VC's cell rate, so that a burst queues in the socket rather
+ * than being dropped, unless the size was given as an option.
+ */
+static void set_bufsize_pppoatm(int fd, int opt, const char *name,
+				int size, const struct atm_trafprm *tp)
+{
+	int rate = pppoatm_rate(tp);
+
+	if (size == 0 && rate > 0) {
+		size = (long) rate * ATM_CELL_PAYLOAD * PPPOATM_BUF_MS / 1000;
+		if (size < 2 * tp->max_sdu)
+			size = 2 * tp->max_sdu;
+	}
+	if (size == 0)
+		return;
+	if (setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) < 0)
+		warn("Couldn't set PPPoATM %s to %d: %m", name, size);
+	else
+		dbglog("PPPoATM %s set to %d", name, size);
+}
+
+static int get_stats_pppoatm(int fd, struct atm_aal_stats *aal5)
+{
+	struct atm_dev_stats stats;
+	struct atmif_sioc req;
+
+	req.number = pvcaddr.sap_addr.itf;
+	req.length = sizeof(stats);
+	req.arg = &stats;
+	if (ioctl(fd, ATM_GETSTAT, &req) < 0)
+		return -1;
+	*aal5 = stats.aal5;
+	return 0;
+}
+
 static int connect_pppoatm(void)
 {
 	int fd;
 	struct atm_qos qos;
+	socklen_t len;
+	static const char *classes[] = { "none", "UBR", "CBR", "VBR", "ABR" };
+	const char *class;
 
 	if (!device_got_set)
 		no_device_given_pppoatm();
@@ -154,7 +227,7 @@ static int connect_pppoatm(void)
 	/* TODO: support simplified QoS setting */
 	if (qosstr != NULL)
 		if (text2qos(qosstr, &qos, 0))
-			fatal("Can't parse QoS: \"%s\"");
+			fatal("Can't parse QoS: \"%s\"", qosstr);
 	qos.txtp.max_sdu = lcp_allowoptions[0].mru + pppoatm_overhead();
 	qos.rxtp.max_sdu = lcp_wantoptions[0].mru + pppoatm_overhead();
 	qos.aal = ATM_AAL5;
@@ -164,6 +237,23 @@ static int connect_pppoatm(void)
 	if (connect(fd, (struct sockaddr *) &pvcaddr,
 	    sizeof(struct sockaddr_atmpvc)))
 		fatal("connect(%s): %m", devnam);
+
+	/* the driver may have settled on other rates than we asked for */
+	len = sizeof(qos);
+	getsockopt(fd, SOL_ATM, SO_ATMQOS, &qos, &len);
+	set_bufsize_pppoatm(fd, SO_SNDBUF, "sndbuf", pppoatm_sndbuf, &qos.txtp);
+	set_bufsize_pppoatm(fd, SO_RCVBUF, "rcvbuf", pppoatm_rcvbuf, &qos.rxtp);
+	class = qos.txtp.traffic_class <= ATM_ABR ?
+		classes[qos.txtp.traffic_class] : "?";
+	if (pppoatm_rate(&qos.txtp) > 0)
+		info("PPPoATM %s: %s, sending at up to %d cells/s (%d kbit/s)",
+		     devnam, class, pppoatm_rate(&qos.txtp),
+		     (int) ((long) pppoatm_rate(&qos.txtp)
+			    * ATM_CELL_PAYLOAD * 8 / 1000));
+	else
+		info("PPPoATM %s: %s at line rate", devnam, class);
+	pppoatm_have_stats = get_stats_pppoatm(fd, &pppoatm_stats) == 0;
+
 	pppoatm_max_mtu = lcp_allowoptions[0].mru;
 	pppoatm_max_mru = lcp_wantoptions[0].mru;
 	set_line_discipline_pppoatm(fd);
@@ -172,8 +262,33 @@ static int connect_pppoatm(void)
 	return fd;
 }
 
+/*
+ * Report what the ATM interface counted going wrong during the
+ * session, in the log and to the disconnect script.  The kernel keeps
+ * these only per interface, so they include any other VCs on it.
+ */
 static void disconnect_pppoatm(void)
 {
+	struct atm_aal_stats now;
+	char buf[16];
+
+	if (pppoatm_have_stats && get_stats_pppoatm(pppoa_fd, &now) == 0) {
+		now.tx -= pppoatm_stats.tx;
+		now.tx_err -= pppoatm_stats.tx_err;
+		now.rx -= pppoatm_stats.rx;
+		now.rx_err -= pppoatm_stats.rx_err;
+		now.rx_drop -= pppoatm_stats.rx_drop;
+		info("PPPoATM itf %d AAL5: sent %d (%d errors), "
+		     "received %d (%d errors, %d dropped)",
+		     pvcaddr.sap_addr.itf, now.tx, now.tx_err, now.rx,
+		     now.rx_err, now.rx_drop);
+		slprintf(buf, sizeof(buf), "%d", now.tx_err);
+		ppp_script_setenv("ATM_TX_ERRORS", buf, 0);
+		slprintf(buf, sizeof(buf), "%d", now.rx_err);
+		ppp_script_setenv("ATM_RX_ERRORS", buf, 0);
+		slprintf(buf, sizeof(buf), "%d", now.rx_drop);
+		ppp_script_setenv("ATM_RX_DROPS", buf, 0);
+	}
 	close(pppoa_fd);
 }
 
@@ -87,6 +87,52 @@ parsePacket(PPPoEPacket *packet, ParseFunc *func, void *extra)
     return 0;
 }
 
+/* What findTag is looking for, and where it is */
+struct TagSearch {
+    UINT16_t type;
+    UINT16_t len;
+    unsigned char *data;
+};
+
+static void
+parseForTag(UINT16_t type, UINT16_t len, unsigned char *data, void *extra)
+{
+    struct TagSearch *ts = (struct TagSearch *) extra;
+
+    if (type == ts->type && !ts->data) {
+	ts->data = data;
+	ts->len = len;
+    }
+}
+
+/**********************************************************************
+*%FUNCTION: findTag
+*%ARGUMENTS:
+* packet -- the PPPoE discovery packet to search
+* tagType -- the type of tag to look for
+* tag -- if non-NULL, set to a copy of the tag, ready to go in a packet
+*%RETURNS:
+* A pointer to the data of the first tag of type tagType in packet,
+* or NULL if there isn't one
+***********************************************************************/
+unsigned char *
+findTag(PPPoEPacket *packet, UINT16_t tagType, PPPoETag *tag)
+{
+    struct TagSearch ts;
+
+    ts.type = tagType;
+    ts.len = 0;
+    ts.data = NULL;
+    if (parsePacket(packet, parseForTag, &ts) < 0 || !ts.data)
+	return NULL;
+    if (tag) {
+	tag->type = htons(tagType);
+	tag->length = htons(ts.len);
+	memcpy(tag->payload, ts.data, ts.len);
+    }
+    return ts.data;
+}
+
 /***********************************************************************
 *%FUNCTION: sendPADT
 *%ARGUMENTS:
@@ -45,11 +45,14 @@ static char const RCSID[] =
 #include <signal.h>
 
 #ifdef PLUGIN
+#include <pppd/magic.h>
 #define signaled(x) ppp_signaled(x)
 #define get_time(x) ppp_get_time(x)
+#define jitter() magic()
 #else
 int signaled(int signal);
 int get_time(struct timeval *tv);
+#define jitter() random()
 
 #endif
 
@@ -110,7 +113,7 @@ parseForHostUniq(UINT16_t type, UINT16_t len, unsigned char *data,
 * If we are using the Host-Unique tag, verifies that packet contains
 * our unique identifier.
 ***********************************************************************/
-static int
+int
 packetIsForMe(PPPoEConnection *conn, PPPoEPacket *packet)
 {
     PPPoETag hostUniq = conn->hostUniq;
@@ -300,7 +303,7 @@ parsePADSTags(UINT16_t type, UINT16_t len, unsigned char *data,
 *%DESCRIPTION:
 * Sends a PADI packet
 ***********************************************************************/
-static void
+void
 sendPADI(PPPoEConnection *conn)
 {
     PPPoEPacket packet;
@@ -368,15 +371,142 @@ sendPADI(PPPoEConnection *conn)
     sendPacket(conn, conn->discoverySocket, &packet, (int) (plen + HDR_SIZE));
 }
 
+/**********************************************************************
+*%FUNCTION: useOffer
+*%ARGUMENTS:
+* conn -- PPPoEConnection structure
+* offer -- offer collected by waitForPADO
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Makes the offer's AC the one the PADR goes to
+***********************************************************************/
+static void
+useOffer(PPPoEConnection *conn, PPPoEOffer *offer)
+{
+    memcpy(conn->peerEth, offer->peerEth, ETH_ALEN);
+    memcpy(&conn->cookie, &offer->cookie,
+	   ntohs(offer->cookie.length) + TAG_HDR_SIZE);
+    memcpy(&conn->relayId, &offer->relayId,
+	   ntohs(offer->relayId.length) + TAG_HDR_SIZE);
+    conn->seenMaxPayload = offer->seenMaxPayload;
+    conn->mtu = offer->mtu;
+    conn->mru = offer->mru;
+}
+
+/**********************************************************************
+*%FUNCTION: offerPayload
+*%ARGUMENTS:
+* offer -- offer collected by waitForPADO
+*%RETURNS:
+* The largest PPP payload the session would carry
+***********************************************************************/
+static int
+offerPayload(const PPPoEOffer *offer)
+{
+    int payload = MIN(offer->mtu, offer->mru);
+
+    /* RFC 4638: without PPP-Max-Payload we are held to 1492 */
+    if (!offer->seenMaxPayload && payload > ETH_PPPOE_MTU)
+	payload = ETH_PPPOE_MTU;
+    return payload;
+}
+
+/**********************************************************************
+*%FUNCTION: compareOffers
+*%ARGUMENTS:
+* a, b -- offers to compare
+*%RETURNS:
+* Negative if a is the better offer, positive if b is
+*%DESCRIPTION:
+* Ranks offers by the payload they allow, then by how quickly they came
+***********************************************************************/
+static int
+compareOffers(const void *a, const void *b)
+{
+    const PPPoEOffer *x = a, *y = b;
+    int xp = offerPayload(x), yp = offerPayload(y);
+
+    if (xp != yp)
+	return yp - xp;
+    return (x->latency > y->latency) - (x->latency < y->latency);
+}
+
+/**********************************************************************
+*%FUNCTION: addOffer
+*%ARGUMENTS:
+* conn -- PPPoEConnection structure, holding the tags of the PADO
+* packet -- the PADO
+* sent_at -- when the PADI went out
+* expire_at -- when to stop waiting for PADOs
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Keeps an acceptable PADO among the offers to choose from.  The first
+* one brings expire_at forward to the end of the collection window.
+***********************************************************************/
+static void
+addOffer(PPPoEConnection *conn, PPPoEPacket *packet,
+	 struct timeval *sent_at, struct timeval *expire_at)
+{
+    PPPoEOffer *offer;
+    struct timeval now, until;
+    int i;
+
+    for (i = 0; i < conn->numOffers; i++) {
+	if (!memcmp(conn->offers[i].peerEth, packet->ethHdr.h_source, ETH_ALEN))
+	    return;
+    }
+    if (conn->numOffers == MAX_PADO_OFFERS)
+	return;
+    if (get_time(&now) < 0) {
+	error("get_time (addOffer): %m");
+	return;
+    }
+
+    offer = &conn->offers[conn->numOffers++];
+    memcpy(offer->peerEth, packet->ethHdr.h_source, ETH_ALEN);
+    offer->latency = (now.tv_sec - sent_at->tv_sec) * 1000
+	+ (now.tv_usec - sent_at->tv_usec) / 1000;
+    offer->seenMaxPayload = conn->seenMaxPayload;
+    offer->mtu = conn->mtu;
+    offer->mru = conn->mru;
+    memcpy(&offer->cookie, &conn->cookie,
+	   ntohs(conn->cookie.length) + TAG_HDR_SIZE);
+    memcpy(&offer->relayId, &conn->relayId,
+	   ntohs(conn->relayId.length) + TAG_HDR_SIZE);
+    dbglog("PPPoE offer from %02x:%02x:%02x:%02x:%02x:%02x after %ld ms, "
+	   "payload %d", (unsigned) offer->peerEth[0],
+	   (unsigned) offer->peerEth[1], (unsigned) offer->peerEth[2],
+	   (unsigned) offer->peerEth[3], (unsigned) offer->peerEth[4],
+	   (unsigned) offer->peerEth[5], offer->latency, offerPayload(offer));
+
+    if (conn->numOffers == 1) {
+	until = now;
+	until.tv_sec += conn->padoWait / 1000;
+	until.tv_usec += (conn->padoWait % 1000) * 1000;
+	if (until.tv_usec >= 1000000) {
+	    until.tv_usec -= 1000000;
+	    until.tv_sec++;
+	}
+	if (until.tv_sec < expire_at->tv_sec
+	    || (until.tv_sec == expire_at->tv_sec
+		&& until.tv_usec < expire_at->tv_usec))
+	    *expire_at = until;
+    }
+}
+
 /**********************************************************************
 *%FUNCTION: waitForPADO
 *%ARGUMENTS:
 * conn -- PPPoEConnection structure
-* timeout -- how long to wait (in seconds)
+* timeout -- how long to wait (in milliseconds)
 *%RETURNS:
 * Nothing
 *%DESCRIPTION:
-* Waits for a PADO packet and copies useful information
+* Waits for a PADO packet and copies useful information.  With
+* conn->padoWait set, collects PADOs for that long after the first
+* acceptable one and takes the best of them.
 ***********************************************************************/
 void
 waitForPADO(PPPoEConnection *conn, int timeout)
@@ -384,7 +514,9 @@ waitForPADO(PPPoEConnection *conn, int timeout)
     fd_set readable;
     int r;
     struct timeval tv;
+    struct timeval sent_at;
     struct timeval expire_at;
+    int mtu = conn->mtu, mru = conn->mru;
 
     PPPoEPacket packet;
     int len;
@@ -396,17 +528,25 @@ waitForPADO(PPPoEConnection *conn, int timeout)
     pc.seenACName    = 0;
     pc.seenServiceName = 0;
     conn->seenMaxPayload = 0;
+    conn->numOffers = 0;
+    conn->nextOffer = 0;
 
-    if (get_time(&expire_at) < 0) {
+    if (get_time(&sent_at) < 0) {
 	error("get_time (waitForPADO): %m");
 	return;
     }
-    expire_at.tv_sec += timeout;
+    expire_at = sent_at;
+    expire_at.tv_sec += timeout / 1000;
+    expire_at.tv_usec += (timeout % 1000) * 1000;
+    if (expire_at.tv_usec >= 1000000) {
+	expire_at.tv_usec -= 1000000;
+	expire_at.tv_sec++;
+    }
 
     do {
-	if (BPF_BUFFER_IS_EMPTY) {
+	if (!packetReady(conn->discoverySocket)) {
 	    if (!time_left(&tv, &expire_at))
-		return;		/* Timed out */
+		break;		/* Timed out */
 
 	    FD_ZERO(&readable);
 	    FD_SET(conn->discoverySocket, &readable);
@@ -417,13 +557,23 @@ waitForPADO(PPPoEConnection *conn, int timeout)
 	    }
 	    if (r < 0) {
 		error("select (waitForPADO): %m");
-		return;
+		break;
 	    }
 	    if (r == 0)
-		return;		/* Timed out */
+		break;		/* Timed out */
 	}
 
 	conn->error = 0;
+	if (conn->padoWait > 0) {
+	    /* Parse each PADO's tags afresh; addOffer keeps them */
+	    conn->mtu = mtu;
+	    conn->mru = mru;
+	    conn->seenMaxPayload = 0;
+	    conn->cookie.type = 0;
+	    conn->cookie.length = 0;
+	    conn->relayId.type = 0;
+	    conn->relayId.length = 0;
+	}
 	/* Get the packet */
 	receivePacket(conn->discoverySocket, &packet, &len);
 
@@ -475,12 +625,27 @@ waitForPADO(PPPoEConnection *conn, int timeout)
 		info("--------------------------------------------------");
 	    }
 	    conn->numPADOs++;
-	    if (pc.acNameOK && pc.serviceNameOK && conn->discoveryState != STATE_RECEIVED_PADO) {
+	    if (pc.acNameOK && pc.serviceNameOK && conn->padoWait > 0) {
+		addOffer(conn, &packet, &sent_at, &expire_at);
+	    } else if (pc.acNameOK && pc.serviceNameOK && conn->discoveryState != STATE_RECEIVED_PADO) {
 		memcpy(conn->peerEth, packet.ethHdr.h_source, ETH_ALEN);
 		conn->discoveryState = STATE_RECEIVED_PADO;
 	    }
 	}
-    } while (pppoe_verbose >= 1 || conn->discoveryState != STATE_RECEIVED_PADO);
+    } while (pppoe_verbose >= 1 || conn->padoWait > 0
+	     || conn->discoveryState != STATE_RECEIVED_PADO);
+
+    if (conn->padoWait > 0) {
+	conn->mtu = mtu;
+	conn->mru = mru;
+	if (conn->numOffers > 0) {
+	    qsort(conn->offers, conn->numOffers, sizeof(PPPoEOffer),
+		  compareOffers);
+	    useOffer(conn, &conn->offers[0]);
+	    conn->nextOffer = 1;
+	    conn->discoveryState = STATE_RECEIVED_PADO;
+	}
+    }
 }
 
 /***********************************************************************
@@ -595,7 +760,7 @@ waitForPADS(PPPoEConnection *conn, int timeout)
 
     conn->error = 0;
     do {
-	if (BPF_BUFFER_IS_EMPTY) {
+	if (!packetReady(conn->discoverySocket)) {
 	    if (!time_left(&tv, &expire_at))
 		return;		/* Timed out */
 
@@ -658,6 +823,33 @@ waitForPADS(PPPoEConnection *conn, int timeout)
     }
 }
 
+/**********************************************************************
+*%FUNCTION: nextPADITimeout
+*%ARGUMENTS:
+* conn -- PPPoE connection info structure
+*%RETURNS:
+* How long to wait, in milliseconds, before trying another PADI
+*%DESCRIPTION:
+* Backs off with decorrelated jitter: each wait is drawn at random
+* from between the initial timeout and three times the last wait, up
+* to conn->discoveryMaxTimeout.  Clients that lost their AC together
+* so drift apart instead of retrying in step.
+***********************************************************************/
+int
+nextPADITimeout(PPPoEConnection *conn)
+{
+    long base = conn->discoveryTimeout * 1000L;
+    long cap = conn->discoveryMaxTimeout * 1000L;
+    long last = MAX(conn->padiBackoff, base);
+    long t;
+
+    t = base + (jitter() & 0x7fffffff) % (3 * last - base + 1);
+    if (t > cap)
+	t = cap;
+    conn->padiBackoff = t;
+    return t;
+}
+
 /**********************************************************************
 *%FUNCTION: discovery1
 *%ARGUMENTS:
@@ -671,22 +863,27 @@ void
 discovery1(PPPoEConnection *conn)
 {
     int padiAttempts = 0;
-    int timeout = conn->discoveryTimeout;
+    int timeout = conn->discoveryTimeout * 1000;
 
     do {
 	padiAttempts++;
 	if (signaled(SIGTERM) || padiAttempts > conn->discoveryAttempts) {
 	    warn("Timeout waiting for PADO packets");
-	    close(conn->discoverySocket);
+	    closeInterface(conn->discoverySocket);
 	    conn->discoverySocket = -1;
 	    return;
 	}
+	/* Carry on from where a failed discovery left off */
+	if (conn->discoveryMaxTimeout > 0)
+	    timeout = nextPADITimeout(conn);
 	sendPADI(conn);
 	conn->discoveryState = STATE_SENT_PADI;
 	waitForPADO(conn, timeout);
 
 	timeout *= 2;
     } while (conn->discoveryState == STATE_SENT_PADI);
+
+    conn->padiBackoff = 0;
 }
 
 /**********************************************************************
@@ -708,13 +905,22 @@ discovery2(PPPoEConnection *conn)
 	padrAttempts++;
 	if (signaled(SIGTERM) || padrAttempts > conn->discoveryAttempts) {
 	    warn("Timeout waiting for PADS packets");
-	    close(conn->discoverySocket);
+	    closeInterface(conn->discoverySocket);
 	    conn->discoverySocket = -1;
 	    return;
 	}
 	sendPADR(conn);
 	conn->discoveryState = STATE_SENT_PADR;
 	waitForPADS(conn, timeout);
+	if (conn->discoveryState == STATE_SENT_PADR
+	    && conn->nextOffer < conn->numOffers && !signaled(SIGTERM)) {
+	    /* Go straight to the next best AC rather than back to PADI */
+	    warn("No PADS from access concentrator, trying the next offer");
+	    useOffer(conn, &conn->offers[conn->nextOffer++]);
+	    padrAttempts = 0;
+	    timeout = conn->discoveryTimeout;
+	    continue;
+	}
 	timeout *= 2;
     } while (conn->discoveryState == STATE_SENT_PADR);
 
@@ -726,9 +932,74 @@ discovery2(PPPoEConnection *conn)
 	    conn->mru = ETH_PPPOE_MTU;
     }
 
+    /* Remember the AC in case the session has to be brought up again */
+    memcpy(conn->lastAC.peerEth, conn->peerEth, ETH_ALEN);
+    memcpy(&conn->lastAC.cookie, &conn->cookie,
+	   ntohs(conn->cookie.length) + TAG_HDR_SIZE);
+    memcpy(&conn->lastAC.relayId, &conn->relayId,
+	   ntohs(conn->relayId.length) + TAG_HDR_SIZE);
+    conn->lastAC.seenMaxPayload = conn->seenMaxPayload;
+    conn->lastAC.mtu = conn->mtu;
+    conn->lastAC.mru = conn->mru;
+    conn->haveLastAC = 1;
+
     /* We're done. */
-    close(conn->discoverySocket);
+    closeInterface(conn->discoverySocket);
     conn->discoverySocket = -1;
     conn->discoveryState = STATE_SESSION;
     return;
 }
+
+/**********************************************************************
+*%FUNCTION: discoveryReconnect
+*%ARGUMENTS:
+* conn -- PPPoE connection info structure
+*%RETURNS:
+* 1 if a session was set up, 0 otherwise
+*%DESCRIPTION:
+* Sends a PADR straight to the AC that gave us our last session, with
+* the cookie and relay ID it gave us then, skipping the PADI and PADO.
+* If it doesn't answer with a PADS, conn is left for a full discovery.
+***********************************************************************/
+int
+discoveryReconnect(PPPoEConnection *conn)
+{
+    int mtu = conn->mtu, mru = conn->mru;
+
+    if (!conn->haveLastAC)
+	return 0;
+    info("Asking the last access concentrator for a session again");
+    useOffer(conn, &conn->lastAC);
+    /* The saved limits came from the same configuration as now */
+    conn->mtu = MIN(conn->mtu, mtu);
+    conn->mru = MIN(conn->mru, mru);
+    conn->numOffers = 0;
+    sendPADR(conn);
+    conn->discoveryState = STATE_SENT_PADR;
+    waitForPADS(conn, conn->discoveryTimeout);
+
+    if (conn->discoveryState != STATE_SESSION) {
+	warn("No session from the last access concentrator, doing discovery");
+	conn->haveLastAC = 0;
+	conn->mtu = mtu;
+	conn->mru = mru;
+	conn->seenMaxPayload = 0;
+	conn->cookie.type = 0;
+	conn->cookie.length = 0;
+	conn->relayId.type = 0;
+	conn->relayId.length = 0;
+	conn->discoveryState = STATE_SENT_PADI;
+	return 0;
+    }
+
+    if (!conn->seenMaxPayload) {
+	/* RFC 4638: MUST limit MTU/MRU to 1492 */
+	if (conn->mtu > ETH_PPPOE_MTU)
+	    conn->mtu = ETH_PPPOE_MTU;
+	if (conn->mru > ETH_PPPOE_MTU)
+	    conn->mru = ETH_PPPOE_MTU;
+    }
+    closeInterface(conn->discoverySocket);
+    conn->discoverySocket = -1;
+    return 1;
+}
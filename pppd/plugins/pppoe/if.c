@@ -28,10 +28,11 @@ static char const RCSID[] =
 #include <unistd.h>
 #endif
 
-#ifdef HAVE_NETPACKET_PACKET_H
-#include <netpacket/packet.h>
-#elif defined(HAVE_LINUX_IF_PACKET_H)
+/* linux/if_packet.h has the TPACKET_V3 ring as well */
+#ifdef HAVE_LINUX_IF_PACKET_H
 #include <linux/if_packet.h>
+#elif defined(HAVE_NETPACKET_PACKET_H)
+#include <netpacket/packet.h>
 #endif
 
 #ifdef HAVE_ASM_TYPES_H
@@ -45,17 +46,69 @@ static char const RCSID[] =
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 
 #ifdef HAVE_NET_IF_ARP_H
 #include <net/if_arp.h>
 #endif
 
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
 /* Initialize frame types to RFC 2516 values.  Some broken peers apparently
    use different frame types... sigh... */
 
 UINT16_t Eth_PPPOE_Discovery = ETH_PPPOE_DISCOVERY;
 UINT16_t Eth_PPPOE_Session   = ETH_PPPOE_SESSION;
 
+#if defined(HAVE_STRUCT_SOCKADDR_LL) && defined(PACKET_RX_RING) && defined(TPACKET3_HDRLEN)
+#define USE_RX_RING 1
+
+/* A receive ring for each discovery socket: TPACKET_V3 blocks of frames,
+   each handed over once it fills or RING_BLOCK_TOV ms after its first
+   frame, so that a burst of replies can be read without a recv()
+   apiece. */
+#define RING_BLOCK_SIZE (16 * 1024)
+#define RING_BLOCKS	4
+#define RING_FRAME_SIZE	2048
+#define RING_BLOCK_TOV	10
+
+/* Sockets that can have a ring at once; any more just use recv() */
+#define MAX_RINGS	64
+
+struct ring {
+    int sock;			/* or -1 once the socket is closed */
+    unsigned char *map;
+    int block;			/* the block being read, or next to be */
+    struct tpacket3_hdr *frame;	/* the next frame in it */
+    int left;			/* frames in it not yet read */
+};
+
+static struct ring rings[MAX_RINGS];
+static int numRings;		/* slots that have been used */
+#endif
+
+#if defined(HAVE_STRUCT_SOCKADDR_LL) && defined(HAVE_SENDMMSG)
+#define USE_SEND_BATCH 1
+
+/* Packets queued by queuePacket, all for one socket, which go out
+   with a single sendmmsg() */
+#define SEND_BATCH	32
+
+static struct {
+    PPPoEPacket pkt;
+    int size;
+} batch[SEND_BATCH];
+static int batchLen;
+static int batchSock;
+#endif
+
 /**********************************************************************
 *%FUNCTION: etherType
 *%ARGUMENTS:
@@ -81,6 +134,146 @@ etherType(PPPoEPacket *packet)
     return type;
 }
 
+#ifdef USE_RX_RING
+/**********************************************************************
+*%FUNCTION: setupRing
+*%ARGUMENTS:
+* fd -- a packet socket, not yet bound
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Sets up and maps a receive ring on fd.  If that can't be done,
+* packets are read from fd with recv() as usual.
+***********************************************************************/
+static struct ring *
+findRing(int sock)
+{
+    int i;
+
+    if (sock < 0)
+	return NULL;
+    for (i = 0; i < numRings; i++) {
+	if (rings[i].sock == sock)
+	    return &rings[i];
+    }
+    return NULL;
+}
+
+static void
+dropRing(struct ring *r)
+{
+    munmap(r->map, RING_BLOCK_SIZE * RING_BLOCKS);
+    r->sock = -1;
+    r->map = NULL;
+}
+
+static void
+setupRing(int fd)
+{
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    struct ring *r;
+    void *map;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = RING_BLOCKS;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCKS;
+    req.tp_retire_blk_tov = RING_BLOCK_TOV;
+
+    if ((r = findRing(fd)) != NULL) {
+	/* the socket it was for has gone without closeInterface() */
+	dropRing(r);
+    } else {
+	for (r = rings; r < rings + numRings && r->sock >= 0; r++)
+	    ;
+	if (r == rings + MAX_RINGS) {
+	    dbglog("Not using a receive ring for PPPoE discovery: too many sockets");
+	    return;
+	}
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0
+	|| setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+	dbglog("Not using a receive ring for PPPoE discovery: %m");
+	return;
+    }
+    map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCKS, PROT_READ | PROT_WRITE,
+	       MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	dbglog("Couldn't map the PPPoE discovery ring: %m");
+	/* without a mapping, the socket can't use the ring */
+	memset(&req, 0, sizeof(req));
+	setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+	return;
+    }
+    if (r == rings + numRings)
+	numRings++;
+    r->sock = fd;
+    r->map = map;
+    r->block = 0;
+    r->left = 0;
+}
+
+/* The block r->block, if the kernel has handed it over */
+static struct tpacket_block_desc *
+readyBlock(struct ring *r)
+{
+    struct tpacket_block_desc *bd;
+
+    bd = (struct tpacket_block_desc *) (r->map + r->block * RING_BLOCK_SIZE);
+    if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+	return NULL;
+    return bd;
+}
+#endif
+
+/**********************************************************************
+*%FUNCTION: closeInterface
+*%ARGUMENTS:
+* sock -- a socket from openInterface
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Sends anything queued for sock, closes it, and unmaps its receive
+* ring if it has one.
+***********************************************************************/
+void
+closeInterface(int sock)
+{
+#ifdef USE_RX_RING
+    struct ring *r = findRing(sock);
+
+    if (r)
+	dropRing(r);
+#endif
+#ifdef USE_SEND_BATCH
+    if (batchLen > 0 && batchSock == sock)
+	flushPackets();
+#endif
+    close(sock);
+}
+
+/**********************************************************************
+*%FUNCTION: packetReady
+*%ARGUMENTS:
+* sock -- a socket from openInterface
+*%RETURNS:
+* 1 if receivePacket() has a packet for sock without waiting for the
+* socket to become readable, 0 otherwise.
+***********************************************************************/
+int
+packetReady(int sock)
+{
+#ifdef USE_RX_RING
+    struct ring *r = findRing(sock);
+
+    if (r)
+	return r->left > 0 || readyBlock(r) != NULL;
+#endif
+    return 0;
+}
+
 /**********************************************************************
 *%FUNCTION: openInterface
 *%ARGUMENTS:
@@ -178,10 +371,14 @@ openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr)
     strcpy(sa.sa_data, ifname);
 #endif
 
+#ifdef USE_RX_RING
+    setupRing(fd);
+#endif
+
     /* We're only interested in packets on specified interface */
     if (bind(fd, (struct sockaddr *) &sa, sizeof(sa)) < 0) {
 	error("Failed to bind to interface %s: %m", ifname);
-	close(fd);
+	closeInterface(fd);
 	return -1;
     }
 
@@ -222,6 +419,78 @@ sendPacket(PPPoEConnection *conn, int sock, PPPoEPacket *pkt, int size)
     return 0;
 }
 
+/***********************************************************************
+*%FUNCTION: queuePacket
+*%ARGUMENTS:
+* sock -- socket to send to
+* pkt -- the packet to transmit
+* size -- size of packet (in bytes)
+*%RETURNS:
+* 0 on success; -1 on failure
+*%DESCRIPTION:
+* Like sendPacket, but where sendmmsg() is available the packet is
+* copied and held until flushPackets is called, the batch is full or
+* a packet for another socket is queued.  Without sendmmsg() the
+* packet is sent straight away.
+***********************************************************************/
+int
+queuePacket(int sock, PPPoEPacket *pkt, int size)
+{
+#ifdef USE_SEND_BATCH
+    if (batchLen > 0 && (sock != batchSock || batchLen == SEND_BATCH))
+	flushPackets();
+    if (debug_on())
+	pppoe_log_packet("Send ", pkt);
+    memcpy(&batch[batchLen].pkt, pkt, size);
+    batch[batchLen].size = size;
+    batchSock = sock;
+    ++batchLen;
+    return 0;
+#else
+    return sendPacket(NULL, sock, pkt, size);
+#endif
+}
+
+/***********************************************************************
+*%FUNCTION: flushPackets
+*%ARGUMENTS:
+* None
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Sends the packets held by queuePacket.  A packet that can't be sent
+* is logged and dropped, as sendPacket would, and the rest still go.
+***********************************************************************/
+void
+flushPackets(void)
+{
+#ifdef USE_SEND_BATCH
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+    int i, n;
+
+    memset(msgs, 0, sizeof(msgs[0]) * batchLen);
+    for (i = 0; i < batchLen; i++) {
+	iov[i].iov_base = &batch[i].pkt;
+	iov[i].iov_len = batch[i].size;
+	msgs[i].msg_hdr.msg_iov = &iov[i];
+	msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (i = 0; i < batchLen; i += n) {
+	n = sendmmsg(batchSock, msgs + i, batchLen - i, 0);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		n = 0;
+		continue;
+	    }
+	    error("error sending pppoe packet: %m");
+	    n = 1;
+	}
+    }
+    batchLen = 0;
+#endif
+}
+
 /***********************************************************************
 *%FUNCTION: receivePacket
 *%ARGUMENTS:
@@ -236,6 +505,54 @@ sendPacket(PPPoEConnection *conn, int sock, PPPoEPacket *pkt, int size)
 int
 receivePacket(int sock, PPPoEPacket *pkt, int *size)
 {
+#ifdef USE_RX_RING
+    struct ring *r = findRing(sock);
+
+    if (r) {
+	struct tpacket_block_desc *bd;
+	struct pollfd pfd;
+	UINT32_t len;
+
+	bd = (struct tpacket_block_desc *) (r->map + r->block * RING_BLOCK_SIZE);
+	if (r->left == 0) {
+	    while ((bd = readyBlock(r)) == NULL) {
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+		    error("error receiving pppoe packet: %m");
+		    return -1;
+		}
+	    }
+	    r->frame = (struct tpacket3_hdr *)
+		((unsigned char *) bd + bd->hdr.bh1.offset_to_first_pkt);
+	    r->left = bd->hdr.bh1.num_pkts;
+	}
+
+	if (r->left > 0) {
+	    len = r->frame->tp_snaplen;
+	    if (len > sizeof(PPPoEPacket))
+		len = sizeof(PPPoEPacket);
+	    memcpy(pkt, (unsigned char *) r->frame + r->frame->tp_mac, len);
+	    *size = len;
+	    r->frame = (struct tpacket3_hdr *)
+		((unsigned char *) r->frame + r->frame->tp_next_offset);
+	    --r->left;
+	} else
+	    *size = 0;
+
+	/* give the block back once we have everything out of it */
+	if (r->left == 0) {
+	    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			     __ATOMIC_RELEASE);
+	    r->block = (r->block + 1) % RING_BLOCKS;
+	}
+	if (*size == 0)
+	    return receivePacket(sock, pkt, size);
+	if (debug_on())
+	    pppoe_log_packet("Recv ", pkt);
+	return 0;
+    }
+#endif
     if ((*size = recv(sock, pkt, sizeof(PPPoEPacket), 0)) < 0) {
 	error("error receiving pppoe packet: %m");
 	return -1;
@@ -244,3 +561,116 @@ receivePacket(int sock, PPPoEPacket *pkt, int *size)
 	pppoe_log_packet("Recv ", pkt);
     return 0;
 }
+
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+/* Most tags a filter looks through for our Host-Uniq, and how much of it
+   is compared; past either, the filter lets the packet through for
+   packetIsForMe() to decide. */
+#define FILTER_MAX_TAGS 16
+#define FILTER_MAX_UNIQ 32
+#define FILTER_MAX_INSNS (8 + FILTER_MAX_TAGS * (15 + FILTER_MAX_UNIQ / 2))
+
+#define FILTER_ACCEPT 0xffffffff
+#define FILTER_OFF_TAGS (sizeof(struct ethhdr) + PPPOE_OVERHEAD)
+#endif
+
+/**********************************************************************
+*%FUNCTION: setDiscoveryFilter
+*%ARGUMENTS:
+* conn -- PPPoE connection info, with its discovery socket open
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Asks the kernel to pass up on the discovery socket only packets sent
+* to our MAC address carrying our Host-Unique tag, if we use one, so
+* that we aren't woken for replies to every other client on the
+* segment.  The filter errs on the side of letting packets through;
+* packetIsForMe() still checks each one.
+***********************************************************************/
+void
+setDiscoveryFilter(PPPoEConnection *conn)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_FILTER)
+    struct sock_filter insns[FILTER_MAX_INSNS];
+    struct sock_fprog prog;
+    unsigned char *mac = conn->myEth;
+    unsigned char *uniq = conn->hostUniq.payload;
+    int len = ntohs(conn->hostUniq.length);
+    int cmp = len < FILTER_MAX_UNIQ ? len : FILTER_MAX_UNIQ;
+    int miss[2 + FILTER_MAX_UNIQ / 2];
+    int n = 0, i, j, k, size, nmiss;
+
+    /* Destination MAC address */
+    insns[n++] = (struct sock_filter)
+	BPF_STMT(BPF_LD|BPF_W|BPF_ABS, 0);
+    insns[n++] = (struct sock_filter)
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, ((UINT32_t) mac[0] << 24) | (mac[1] << 16)
+		 | (mac[2] << 8) | mac[3], 1, 0);
+    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0);
+    insns[n++] = (struct sock_filter)
+	BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 4);
+    insns[n++] = (struct sock_filter)
+	BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (mac[4] << 8) | mac[5], 1, 0);
+    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0);
+
+    if (conn->hostUniq.length) {
+	/*
+	 * Step through the tags with X at the start of each, as
+	 * parsePacket() does.  There are no loops in BPF, so this is
+	 * unrolled; a load past the end of the packet ends the filter
+	 * and drops it, which is all right once we have looked at every
+	 * tag.
+	 */
+	insns[n++] = (struct sock_filter)
+	    BPF_STMT(BPF_LDX|BPF_W|BPF_IMM, FILTER_OFF_TAGS);
+	for (i = 0; i < FILTER_MAX_TAGS; ++i) {
+	    /* each miss jumps to the step to the next tag, patched below */
+	    nmiss = 0;
+	    insns[n++] = (struct sock_filter)
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 0);
+	    insns[n++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, TAG_END_OF_LIST, 0, 1);
+	    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0);
+	    miss[nmiss++] = n;
+	    insns[n++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, TAG_HOST_UNIQ, 0, 0);
+	    insns[n++] = (struct sock_filter)
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 2);
+	    miss[nmiss++] = n;
+	    insns[n++] = (struct sock_filter)
+		BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, len, 0, 0);
+	    for (j = 0; j < cmp; j += size) {
+		UINT32_t word = 0;
+		size = cmp - j >= 4 ? 4 : cmp - j >= 2 ? 2 : 1;
+		for (k = 0; k < size; ++k)
+		    word = (word << 8) | uniq[j + k];
+		insns[n++] = (struct sock_filter)
+		    BPF_STMT(BPF_LD|BPF_IND|(size == 4 ? BPF_W : size == 2 ? BPF_H : BPF_B),
+			     TAG_HDR_SIZE + j);
+		miss[nmiss++] = n;
+		insns[n++] = (struct sock_filter)
+		    BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, word, 0, 0);
+	    }
+	    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, FILTER_ACCEPT);
+	    for (k = 0; k < nmiss; ++k)
+		insns[miss[k]].jf = n - miss[k] - 1;
+
+	    /* X += 4 + the tag's length */
+	    insns[n++] = (struct sock_filter)
+		BPF_STMT(BPF_LD|BPF_H|BPF_IND, 2);
+	    insns[n++] = (struct sock_filter)
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_K, TAG_HDR_SIZE);
+	    insns[n++] = (struct sock_filter)
+		BPF_STMT(BPF_ALU|BPF_ADD|BPF_X, 0);
+	    insns[n++] = (struct sock_filter) BPF_STMT(BPF_MISC|BPF_TAX, 0);
+	}
+    }
+    insns[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, FILTER_ACCEPT);
+
+    prog.len = n;
+    prog.filter = insns;
+    if (setsockopt(conn->discoverySocket, SOL_SOCKET, SO_ATTACH_FILTER,
+		   &prog, sizeof(prog)) < 0)
+	warn("Couldn't set a filter on the PPPoE discovery socket: %m");
+#endif
+}
@@ -69,6 +69,9 @@ unsigned char pppoe_reqd_mac_addr[6];
 static char *pppoe_host_uniq;
 static int pppoe_padi_timeout = PADI_TIMEOUT;
 static int pppoe_padi_attempts = MAX_PADI_ATTEMPTS;
+static int pppoe_padi_max_timeout = 0;
+static int pppoe_pado_wait = 0;
+static bool pppoe_fast_reconnect = 0;
 static char devnam[MAXNAMELEN];
 
 static int PPPoEDevnameHook(char *cmd, char **argv, int doit);
@@ -103,11 +106,23 @@ static struct option Options[] = {
       "Initial timeout for discovery packets in seconds" },
     { "pppoe-padi-attempts", o_int, &pppoe_padi_attempts,
       "Number of discovery attempts" },
+    { "pppoe-padi-max-timeout", o_int, &pppoe_padi_max_timeout,
+      "Longest jittered wait for a PADO in seconds" },
+    { "pppoe-pado-wait", o_int, &pppoe_pado_wait,
+      "Milliseconds to collect PADOs for before choosing an AC" },
+    { "pppoe-fast-reconnect", o_bool, &pppoe_fast_reconnect,
+      "Reconnect to the last AC without a PADI first", 1 },
     { NULL }
 };
 int (*OldDevnameHook)(char *cmd, char **argv, int doit) = NULL;
+static int (*OldHoldoffHook)(void) = NULL;
 static PPPoEConnection *conn = NULL;
 
+/* PPPoE sockets made ahead of time for prefork-socket sessions */
+static int sockPool[PREFORK_POOL_MAX];
+static int sockPoolSize;
+static int spareSock = -1;
+
 /**********************************************************************
  * %FUNCTION: PPPOEInitDevice
  * %ARGUMENTS:
@@ -155,7 +170,11 @@ PPPOEConnectDevice(void)
     /* server equipment).                                                  */
     /* Opening this socket just before waitForPADS in the discovery()      */
     /* function would be more appropriate, but it would mess-up the code   */
-    conn->sessionSocket = socket(AF_PPPOX, SOCK_STREAM, PX_PROTO_OE);
+    if (spareSock >= 0) {
+	conn->sessionSocket = spareSock;
+	spareSock = -1;
+    } else
+	conn->sessionSocket = socket(AF_PPPOX, SOCK_STREAM, PX_PROTO_OE);
     if (conn->sessionSocket < 0) {
 	error("Failed to create PPPoE socket: %m");
 	return -1;
@@ -217,15 +236,18 @@ PPPOEConnectDevice(void)
 	    error("Failed to create PPPoE discovery socket: %m");
 	    goto errout;
 	}
-	discovery1(conn);
-	/* discovery1() may update conn->mtu and conn->mru */
-	lcp_allowoptions[0].mru = conn->mtu;
-	lcp_wantoptions[0].mru = conn->mru;
-	if (conn->discoveryState != STATE_RECEIVED_PADO) {
-	    error("Unable to complete PPPoE Discovery phase 1");
-	    goto errout;
+	setDiscoveryFilter(conn);
+	if (!conn->fastReconnect || !discoveryReconnect(conn)) {
+	    discovery1(conn);
+	    /* discovery1() may update conn->mtu and conn->mru */
+	    lcp_allowoptions[0].mru = conn->mtu;
+	    lcp_wantoptions[0].mru = conn->mru;
+	    if (conn->discoveryState != STATE_RECEIVED_PADO) {
+		error("Unable to complete PPPoE Discovery phase 1");
+		goto errout;
+	    }
+	    discovery2(conn);
 	}
-	discovery2(conn);
 	/* discovery2() may update conn->mtu and conn->mru */
 	lcp_allowoptions[0].mru = conn->mtu;
 	lcp_wantoptions[0].mru = conn->mru;
@@ -268,7 +290,7 @@ PPPOEConnectDevice(void)
  errout:
     if (conn->discoverySocket >= 0) {
 	sendPADT(conn, NULL);
-	close(conn->discoverySocket);
+	closeInterface(conn->discoverySocket);
 	conn->discoverySocket = -1;
     }
     close(conn->sessionSocket);
@@ -312,7 +334,7 @@ PPPOEDisconnectDevice(void)
     close(conn->sessionSocket);
     if (conn->discoverySocket >= 0) {
         sendPADT(conn, NULL);
-	close(conn->discoverySocket);
+	closeInterface(conn->discoverySocket);
     }
 }
 
@@ -404,6 +426,71 @@ PPPoEDevnameHook(char *cmd, char **argv, int doit)
     return r;
 }
 
+/**********************************************************************
+ * %FUNCTION: PPPoEHoldoff
+ * %ARGUMENTS:
+ * None
+ * %RETURNS:
+ * Seconds to wait before reconnecting
+ * %DESCRIPTION:
+ * If the last discovery heard from no AC, waits at least the next step
+ * of the PADI backoff before trying again, so the backoff carries on
+ * across reconnects.
+ ***********************************************************************/
+static int
+PPPoEHoldoff(void)
+{
+    int t = OldHoldoffHook ? (*OldHoldoffHook)() : ppp_holdoff();
+    int backoff;
+
+    if (conn && conn->discoveryMaxTimeout > 0 && conn->padiBackoff > 0) {
+	backoff = (nextPADITimeout(conn) + 999) / 1000;
+	if (backoff > t) {
+	    dbglog("PPPoE discovery backing off for %d seconds", backoff);
+	    t = backoff;
+	}
+    }
+    return t;
+}
+
+/**********************************************************************
+ * %FUNCTION: PPPoEPreforkPool
+ * %ARGUMENTS:
+ * arg -- what has happened to the prefork pool (see NF_PREFORK_POOL)
+ * %RETURNS:
+ * Nothing
+ * %DESCRIPTION:
+ * Keeps PPPoE sockets made for sessions forked by a prefork server, so
+ * a session only has to connect one.
+ ***********************************************************************/
+static void
+PPPoEPreforkPool(void *ctx, int arg)
+{
+    int s;
+
+    if (arg == 0) {
+	if (sockPoolSize > 0)
+	    spareSock = sockPool[0];
+	while (sockPoolSize > 1)
+	    close(sockPool[--sockPoolSize]);
+	sockPoolSize = 0;
+    } else if (arg < 0) {
+	if (sockPoolSize > 0) {
+	    close(sockPool[0]);
+	    --sockPoolSize;
+	    memmove(sockPool, sockPool + 1, sockPoolSize * sizeof(int));
+	}
+    } else {
+	while (sockPoolSize < arg && sockPoolSize < PREFORK_POOL_MAX) {
+	    s = socket(AF_PPPOX, SOCK_STREAM, PX_PROTO_OE);
+	    if (s < 0)
+		break;
+	    fcntl(s, F_SETFD, FD_CLOEXEC);
+	    sockPool[sockPoolSize++] = s;
+	}
+    }
+}
+
 /**********************************************************************
  * %FUNCTION: plugin_init
  * %ARGUMENTS:
@@ -422,6 +509,10 @@ plugin_init(void)
 
     ppp_add_options(Options);
 
+    OldHoldoffHook = holdoff_hook;
+    holdoff_hook = PPPoEHoldoff;
+    ppp_add_notify(NF_PREFORK_POOL, PPPoEPreforkPool, NULL);
+
     info("PPPoE plugin from pppd %s", PPPD_VERSION);
 }
 
@@ -442,6 +533,19 @@ void pppoe_check_options(void)
 	conn->req_peer = 1;
     }
 
+    if (pppoe_pado_wait < 0) {
+	ppp_option_error("pppoe-pado-wait must not be negative");
+	exit(EXIT_OPTION_ERROR);
+    }
+    conn->padoWait = pppoe_pado_wait;
+    conn->fastReconnect = pppoe_fast_reconnect;
+
+    if (pppoe_padi_max_timeout != 0 && pppoe_padi_max_timeout < pppoe_padi_timeout) {
+	ppp_option_error("pppoe-padi-max-timeout must be at least pppoe-padi-timeout");
+	exit(EXIT_OPTION_ERROR);
+    }
+    conn->discoveryMaxTimeout = pppoe_padi_max_timeout;
+
     lcp_allowoptions[0].neg_accompression = 0;
     lcp_wantoptions[0].neg_accompression = 0;
 
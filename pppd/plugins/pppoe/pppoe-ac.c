@@ -0,0 +1,1051 @@
+/*
+ * Answer PPPoE discovery as an access concentrator, and start a pppd
+ * for each session granted.
+ *
+ * Copyright (C) 2026 The ppp project contributors.
+ *
+ * This program may be distributed according to the terms of the GNU
+ * General Public License, version 2 or (at your option) any later version.
+ *
+ * Each session is handed to pppd as "pppoe-sess id:mac", so that the
+ * pppoe plugin attaches to it without discovery of its own.  The pppd
+ * is either run afresh, or asked for from a pppd serving sessions on a
+ * prefork socket (see the prefork-socket option), which saves starting
+ * and configuring a new one for every subscriber.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pppoe.h"
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#include <linux/if_packet.h>
+#endif
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+#if defined(PACKET_FANOUT) && defined(PACKET_FANOUT_CBPF) && defined(SKF_LL_OFF)
+#define AC_FANOUT
+#endif
+
+#ifndef PPPD_PATH
+#define PPPD_PATH SBINDIR "/pppd"
+#endif
+
+/* Most services and interfaces we serve */
+#define MAX_SERVICES	16
+#define MAX_AC_INTERFACES 64
+
+/* Longest Host-Uniq remembered to recognise a repeated PADR */
+#define MAX_UNIQ	64
+
+/* A PADR repeated within this many seconds gets the same session */
+#define PADR_REPEAT	10
+
+/* Longest wait for a prefork pppd to say it has the session */
+#define PREFORK_WAIT	5
+
+/* Most worker processes */
+#define MAX_WORKERS	64
+
+/* Packets to take from one interface's receive ring before the next */
+#define DRAIN_MAX	32
+
+int debug;
+int pppoe_verbose;
+static volatile sig_atomic_t got_sigterm;
+
+static char *acName;
+static char *serviceNames[MAX_SERVICES];
+static int numServices;
+static char *preforkPath;
+static char *pppdPath = PPPD_PATH;
+static char **pppdArgs;		/* options given to every session */
+static int numPppdArgs;
+static int maxSessions = 64;
+static int sessionRate;		/* new sessions a second, 0 for no limit */
+
+/*
+ * With -W, discovery is shared among several worker processes.  Each
+ * has its own socket on each interface, and the kernel hands each
+ * discovery packet to one of them by the peer's MAC address, so all
+ * of a peer's packets go to the same worker.  A worker keeps its own
+ * sessions, and takes the session IDs that are workerIndex mod
+ * numWorkers so that no two of them hand out the same one.
+ */
+static int numWorkers = 1;
+static int workerIndex;
+static pid_t acPid;		/* the parent, for naming the fanout groups */
+
+/* An interface we answer discovery on */
+struct AcInterface {
+    char *ifName;
+    int sock;
+    unsigned char mac[ETH_ALEN];
+};
+
+static struct AcInterface interfaces[MAX_AC_INTERFACES];
+static int numInterfaces;
+
+/* A session we have granted */
+struct Session {
+    UINT16_t id;		/* 0 if the slot is free */
+    struct AcInterface *ifp;
+    unsigned char peer[ETH_ALEN];
+    unsigned char uniq[MAX_UNIQ];
+    int uniqLen;		/* -1 if too long to remember */
+    pid_t pid;			/* the pppd running it */
+    time_t started;
+    int peerClosed;		/* the peer sent a PADT */
+};
+
+static struct Session *sessions;
+static int numSessions;
+static unsigned char idUsed[65536 / 8];
+static unsigned int nextId;		/* set in serve() */
+
+/* Token bucket for sessionRate, in thousandths of a session */
+static long mtokens;
+static struct timeval lastRefill;
+
+/* The tags of a PADI or PADR that matter to a reply */
+struct Request {
+    int seenService;
+    int serviceOK;
+    unsigned char *service;
+    UINT16_t serviceLen;
+    PPPoETag hostUniq;
+    PPPoETag relayId;
+};
+
+static void
+logit(char const *level, char *fmt, va_list ap)
+{
+    char buf[1024];
+
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    fprintf(stderr, "pppoe-ac: %s%s\n", level, buf);
+}
+
+void
+fatal(char *fmt, ...)
+{
+    va_list pvar;
+    va_start(pvar, fmt);
+    logit("", fmt, pvar);
+    va_end(pvar);
+    exit(1);
+}
+
+void
+error(char *fmt, ...)
+{
+    va_list pvar;
+    va_start(pvar, fmt);
+    logit("", fmt, pvar);
+    va_end(pvar);
+}
+
+void
+warn(char *fmt, ...)
+{
+    va_list pvar;
+    va_start(pvar, fmt);
+    logit("warning: ", fmt, pvar);
+    va_end(pvar);
+}
+
+void
+info(char *fmt, ...)
+{
+    va_list pvar;
+    va_start(pvar, fmt);
+    logit("", fmt, pvar);
+    va_end(pvar);
+}
+
+void
+dbglog(char *fmt, ...)
+{
+    va_list pvar;
+
+    if (!debug)
+	return;
+    va_start(pvar, fmt);
+    logit("", fmt, pvar);
+    va_end(pvar);
+}
+
+void
+init_pr_log(const char *prefix, int level)
+{
+}
+
+void
+end_pr_log(void)
+{
+    fputc('\n', stderr);
+}
+
+void
+pr_log(void *arg, char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+size_t
+strlcpy(char *dest, const char *src, size_t len)
+{
+    size_t ret = strlen(src);
+
+    if (len != 0) {
+	if (ret < len)
+	    strcpy(dest, src);
+	else {
+	    strncpy(dest, src, len - 1);
+	    dest[len-1] = 0;
+	}
+    }
+    return ret;
+}
+
+bool debug_on()
+{
+    return !!debug;
+}
+
+static void
+term_handler(int signum)
+{
+    got_sigterm = 1;
+}
+
+/**********************************************************************
+*%FUNCTION: parseRequestTags
+*%ARGUMENTS:
+* type -- tag type
+* len -- tag length
+* data -- tag data
+* extra -- pointer to a Request structure
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Picks the Service-Name out of a PADI or PADR, and notes whether we
+* offer it.  An empty one asks for any service.
+***********************************************************************/
+static void
+parseRequestTags(UINT16_t type, UINT16_t len, unsigned char *data,
+		 void *extra)
+{
+    struct Request *rq = (struct Request *) extra;
+    int i;
+
+    if (type != TAG_SERVICE_NAME || rq->seenService)
+	return;
+    rq->seenService = 1;
+    rq->service = data;
+    rq->serviceLen = len;
+    if (len == 0 || numServices == 0) {
+	rq->serviceOK = 1;
+	return;
+    }
+    for (i = 0; i < numServices; i++) {
+	if (len == strlen(serviceNames[i])
+	    && !memcmp(data, serviceNames[i], len)) {
+	    rq->serviceOK = 1;
+	    return;
+	}
+    }
+}
+
+/**********************************************************************
+*%FUNCTION: parseRequest
+*%ARGUMENTS:
+* packet -- a PADI or PADR
+* rq -- set to the tags that matter
+*%RETURNS:
+* 0 if the packet is well formed and asks for a Service-Name, -1 if not
+***********************************************************************/
+static int
+parseRequest(PPPoEPacket *packet, struct Request *rq)
+{
+    memset(rq, 0, sizeof(*rq));
+    if (parsePacket(packet, parseRequestTags, rq) < 0)
+	return -1;
+    if (!rq->seenService) {
+	dbglog("Ignoring discovery packet with no Service-Name tag");
+	return -1;
+    }
+    if (!findTag(packet, TAG_HOST_UNIQ, &rq->hostUniq))
+	rq->hostUniq.type = 0;
+    if (!findTag(packet, TAG_RELAY_SESSION_ID, &rq->relayId))
+	rq->relayId.type = 0;
+    return 0;
+}
+
+/* Add a tag to a packet being built, if it fits */
+static int
+addTag(PPPoEPacket *packet, unsigned char **cursor, UINT16_t type,
+       UINT16_t len, void const *data)
+{
+    if (*cursor - packet->payload + TAG_HDR_SIZE + len > MAX_PPPOE_PAYLOAD) {
+	error("Would create too-long packet");
+	return -1;
+    }
+    (*cursor)[0] = type >> 8;
+    (*cursor)[1] = type & 0xFF;
+    (*cursor)[2] = len >> 8;
+    (*cursor)[3] = len & 0xFF;
+    memcpy(*cursor + TAG_HDR_SIZE, data, len);
+    *cursor += TAG_HDR_SIZE + len;
+    return 0;
+}
+
+/**********************************************************************
+*%FUNCTION: sendReply
+*%ARGUMENTS:
+* ifp -- interface the request came in on
+* req -- the PADI, PADR or session being ended
+* rq -- its tags, or NULL
+* code -- CODE_PADO, CODE_PADS or CODE_PADT
+* session -- session ID, in network order
+* errType -- an error tag to add, or 0
+* errMsg -- the text of the error tag
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Sends a discovery packet to the host that sent req.  A PADO names us
+* and every service we offer, the one asked for first; a PADS names the
+* service asked for.  Host-Uniq and Relay-Session-Id are echoed.
+* The packet is queued, and goes out with the others at the next
+* flushPackets().
+***********************************************************************/
+static void
+sendReply(struct AcInterface *ifp, unsigned char const *dest,
+	  struct Request *rq, int code, UINT16_t session,
+	  UINT16_t errType, char const *errMsg)
+{
+    PPPoEPacket packet;
+    unsigned char *cursor = packet.payload;
+    int i;
+
+    memcpy(packet.ethHdr.h_dest, dest, ETH_ALEN);
+    memcpy(packet.ethHdr.h_source, ifp->mac, ETH_ALEN);
+    packet.ethHdr.h_proto = htons(Eth_PPPOE_Discovery);
+    packet.vertype = PPPOE_VER_TYPE(1, 1);
+    packet.code = code;
+    packet.session = session;
+
+    if (code == CODE_PADO
+	&& addTag(&packet, &cursor, TAG_AC_NAME, strlen(acName), acName) < 0)
+	return;
+    if (rq && code != CODE_PADT
+	&& addTag(&packet, &cursor, TAG_SERVICE_NAME, rq->serviceLen,
+		  rq->service) < 0)
+	return;
+    if (rq && code == CODE_PADO) {
+	for (i = 0; i < numServices; i++) {
+	    if (rq->serviceLen == strlen(serviceNames[i])
+		&& !memcmp(rq->service, serviceNames[i], rq->serviceLen))
+		continue;
+	    if (addTag(&packet, &cursor, TAG_SERVICE_NAME,
+		       strlen(serviceNames[i]), serviceNames[i]) < 0)
+		return;
+	}
+    }
+    if (rq && rq->hostUniq.type
+	&& addTag(&packet, &cursor, TAG_HOST_UNIQ, ntohs(rq->hostUniq.length),
+		  rq->hostUniq.payload) < 0)
+	return;
+    if (rq && rq->relayId.type
+	&& addTag(&packet, &cursor, TAG_RELAY_SESSION_ID,
+		  ntohs(rq->relayId.length), rq->relayId.payload) < 0)
+	return;
+    if (errType
+	&& addTag(&packet, &cursor, errType, strlen(errMsg), errMsg) < 0)
+	return;
+
+    packet.length = htons(cursor - packet.payload);
+    queuePacket(ifp->sock, &packet, (int) (cursor - packet.payload + HDR_SIZE));
+}
+
+/**********************************************************************
+*%FUNCTION: takeToken
+*%ARGUMENTS:
+* take -- 1 to use up a token, 0 only to look
+*%RETURNS:
+* 1 if sessionRate allows another session to start now, 0 if not
+***********************************************************************/
+static int
+takeToken(int take)
+{
+    struct timeval now;
+    long ms;
+
+    if (sessionRate <= 0)
+	return 1;
+    gettimeofday(&now, NULL);
+    ms = (now.tv_sec - lastRefill.tv_sec) * 1000
+	+ (now.tv_usec - lastRefill.tv_usec) / 1000;
+    if (ms > 0) {
+	/* allow a burst of up to a second's worth */
+	mtokens += ms * sessionRate;
+	if (mtokens > sessionRate * 1000L)
+	    mtokens = sessionRate * 1000L;
+	lastRefill = now;
+    }
+    if (mtokens < 1000)
+	return 0;
+    if (take)
+	mtokens -= 1000;
+    return 1;
+}
+
+/* Take a free session ID, going round ours in turn so that the ID of
+   a session just ended isn't handed out again at once.  0 if none. */
+static UINT16_t
+allocSessionId(void)
+{
+    unsigned int i, id;
+
+    for (i = 0; i < 0xFFFE; i += numWorkers) {
+	id = nextId;
+	nextId += numWorkers;
+	if (nextId > 0xFFFE)
+	    nextId = workerIndex + 1;
+	if (!(idUsed[id >> 3] & (1 << (id & 7)))) {
+	    idUsed[id >> 3] |= 1 << (id & 7);
+	    return id;
+	}
+    }
+    return 0;
+}
+
+static void
+freeSessionId(UINT16_t id)
+{
+    idUsed[id >> 3] &= ~(1 << (id & 7));
+}
+
+/**********************************************************************
+*%FUNCTION: startPppd
+*%ARGUMENTS:
+* s -- the session
+*%RETURNS:
+* The process ID of the pppd running the session, or -1
+*%DESCRIPTION:
+* Runs pppd for the session, or asks the prefork pppd for one.  The
+* pppd is told not to detach so that we can tell when it has gone.
+***********************************************************************/
+static pid_t
+startPppd(struct Session *s)
+{
+    char ifarg[IFNAMSIZ + 8], sessarg[32];
+    char *words[8 + 1];
+    int nwords = 0, i;
+    pid_t pid;
+
+    snprintf(ifarg, sizeof(ifarg), "nic-%s", s->ifp->ifName);
+    snprintf(sessarg, sizeof(sessarg), "%u:%02x:%02x:%02x:%02x:%02x:%02x",
+	     (unsigned) s->id, (unsigned) s->peer[0], (unsigned) s->peer[1],
+	     (unsigned) s->peer[2], (unsigned) s->peer[3],
+	     (unsigned) s->peer[4], (unsigned) s->peer[5]);
+    if (!preforkPath) {
+	words[nwords++] = pppdPath;
+	words[nwords++] = "plugin";
+	words[nwords++] = "pppoe.so";
+    }
+    words[nwords++] = ifarg;
+    words[nwords++] = "pppoe-sess";
+    words[nwords++] = sessarg;
+    words[nwords++] = "nodetach";
+
+    if (preforkPath) {
+	struct sockaddr_un addr;
+	struct timeval tv;
+	char buf[4096], numbuf[16];
+	size_t len = 0, l;
+	int fd, n;
+
+	for (i = 0; i < nwords + numPppdArgs; i++) {
+	    char *w = i < nwords ? words[i] : pppdArgs[i - nwords];
+	    l = strlen(w) + 1;
+	    if (len + l > sizeof(buf)) {
+		error("Too many pppd options for the prefork socket");
+		return -1;
+	    }
+	    memcpy(buf + len, w, l);
+	    len += l;
+	}
+	fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (fd < 0) {
+	    error("socket: %m");
+	    return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, preforkPath, sizeof(addr.sun_path));
+	tv.tv_sec = PREFORK_WAIT;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+	    || send(fd, buf, len, 0) < 0) {
+	    error("Couldn't ask %s for a session: %m", preforkPath);
+	    close(fd);
+	    return -1;
+	}
+	n = read(fd, numbuf, sizeof(numbuf) - 1);
+	close(fd);
+	if (n <= 0) {
+	    error("No answer from %s for session %u", preforkPath,
+		  (unsigned) s->id);
+	    return -1;
+	}
+	numbuf[n] = 0;
+	pid = atoi(numbuf);
+	return pid > 0 ? pid : -1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+	error("Couldn't fork for session %u: %m", (unsigned) s->id);
+	return -1;
+    }
+    if (pid == 0) {
+	char **argv = malloc((nwords + numPppdArgs + 1) * sizeof(char *));
+	if (!argv)
+	    _exit(127);
+	memcpy(argv, words, nwords * sizeof(char *));
+	memcpy(argv + nwords, pppdArgs, numPppdArgs * sizeof(char *));
+	argv[nwords + numPppdArgs] = NULL;
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	execv(pppdPath, argv);
+	error("Couldn't run %s: %m", pppdPath);
+	_exit(127);
+    }
+    return pid;
+}
+
+/* The session from this peer and Host-Uniq, if one started lately */
+static struct Session *
+findRepeat(struct AcInterface *ifp, unsigned char const *peer,
+	   struct Request *rq)
+{
+    int i, ulen = rq->hostUniq.type ? ntohs(rq->hostUniq.length) : 0;
+    time_t now = time(NULL);
+    struct Session *s;
+
+    for (i = 0; i < numSessions; i++) {
+	s = &sessions[i];
+	if (s->id && s->ifp == ifp && !memcmp(s->peer, peer, ETH_ALEN)
+	    && s->uniqLen == ulen && !memcmp(s->uniq, rq->hostUniq.payload, ulen)
+	    && now - s->started < PADR_REPEAT)
+	    return s;
+    }
+    return NULL;
+}
+
+/**********************************************************************
+*%FUNCTION: handlePADR
+*%ARGUMENTS:
+* ifp -- interface the PADR came in on
+* packet -- the PADR
+* rq -- its tags
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Grants a session: allocates it an ID, starts its pppd and sends the
+* PADS.  A repeated PADR gets the PADS again.
+***********************************************************************/
+static void
+handlePADR(struct AcInterface *ifp, PPPoEPacket *packet, struct Request *rq)
+{
+    unsigned char *peer = packet->ethHdr.h_source;
+    struct Session *s;
+    int i, ulen;
+
+    if (!rq->serviceOK) {
+	sendReply(ifp, peer, rq, CODE_PADS, 0, TAG_SERVICE_NAME_ERROR,
+		  "Service not offered");
+	return;
+    }
+    if ((s = findRepeat(ifp, peer, rq)) != NULL) {
+	sendReply(ifp, peer, rq, CODE_PADS, htons(s->id), 0, NULL);
+	return;
+    }
+
+    for (i = 0; i < maxSessions && sessions[i].id; i++)
+	;
+    if (i == maxSessions) {
+	sendReply(ifp, peer, rq, CODE_PADS, 0, TAG_AC_SYSTEM_ERROR,
+		  "No free sessions");
+	return;
+    }
+    if (!takeToken(1)) {
+	/* the peer will try again, by when there may be room */
+	dbglog("Too many sessions starting, ignoring PADR");
+	return;
+    }
+    s = &sessions[i];
+    memset(s, 0, sizeof(*s));
+    if ((s->id = allocSessionId()) == 0) {
+	sendReply(ifp, peer, rq, CODE_PADS, 0, TAG_AC_SYSTEM_ERROR,
+		  "No free session IDs");
+	return;
+    }
+    if (i >= numSessions)
+	numSessions = i + 1;
+    s->ifp = ifp;
+    memcpy(s->peer, peer, ETH_ALEN);
+    ulen = rq->hostUniq.type ? ntohs(rq->hostUniq.length) : 0;
+    if (ulen <= MAX_UNIQ) {
+	s->uniqLen = ulen;
+	memcpy(s->uniq, rq->hostUniq.payload, ulen);
+    } else
+	s->uniqLen = -1;
+    s->started = time(NULL);
+
+    s->pid = startPppd(s);
+    if (s->pid < 0) {
+	sendReply(ifp, peer, rq, CODE_PADS, 0, TAG_AC_SYSTEM_ERROR,
+		  "Couldn't start a session");
+	freeSessionId(s->id);
+	s->id = 0;
+	return;
+    }
+    info("Session %u for %02x:%02x:%02x:%02x:%02x:%02x on %s, pppd pid %d",
+	 (unsigned) s->id, (unsigned) peer[0], (unsigned) peer[1],
+	 (unsigned) peer[2], (unsigned) peer[3], (unsigned) peer[4],
+	 (unsigned) peer[5], ifp->ifName, (int) s->pid);
+    sendReply(ifp, peer, rq, CODE_PADS, htons(s->id), 0, NULL);
+}
+
+/**********************************************************************
+*%FUNCTION: handlePacket
+*%ARGUMENTS:
+* ifp -- interface with a packet waiting
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Reads a discovery packet and answers it.
+***********************************************************************/
+static void
+handlePacket(struct AcInterface *ifp)
+{
+    PPPoEPacket packet;
+    struct Request rq;
+    struct Session *s;
+    int len, i;
+
+    if (receivePacket(ifp->sock, &packet, &len) < 0)
+	return;
+    if (len < HDR_SIZE || ntohs(packet.length) + HDR_SIZE > len) {
+	dbglog("Bogus PPPoE length field (%u)",
+	       (unsigned int) ntohs(packet.length));
+	return;
+    }
+#ifdef USE_BPF
+    if (etherType(&packet) != Eth_PPPOE_Discovery) return;
+#endif
+    if (NOT_UNICAST(packet.ethHdr.h_source))
+	return;
+    /* Only a PADI may be broadcast */
+    if (packet.code != CODE_PADI
+	&& memcmp(packet.ethHdr.h_dest, ifp->mac, ETH_ALEN))
+	return;
+
+    switch (packet.code) {
+    case CODE_PADI:
+	if (parseRequest(&packet, &rq) < 0 || !rq.serviceOK)
+	    return;
+	for (i = 0; i < maxSessions && sessions[i].id; i++)
+	    ;
+	/* Stay quiet if we're full, so the peer picks another AC */
+	if (i == maxSessions || !takeToken(0))
+	    return;
+	sendReply(ifp, packet.ethHdr.h_source, &rq, CODE_PADO, 0, 0, NULL);
+	break;
+    case CODE_PADR:
+	if (parseRequest(&packet, &rq) < 0)
+	    return;
+	handlePADR(ifp, &packet, &rq);
+	break;
+    case CODE_PADT:
+	for (i = 0; i < numSessions; i++) {
+	    s = &sessions[i];
+	    if (s->id && s->id == ntohs(packet.session) && s->ifp == ifp
+		&& !memcmp(s->peer, packet.ethHdr.h_source, ETH_ALEN)) {
+		info("Session %u terminated by peer", (unsigned) s->id);
+		s->peerClosed = 1;
+		kill(s->pid, SIGTERM);
+		break;
+	    }
+	}
+	break;
+    }
+}
+
+/* Send a PADT for s and let its ID go */
+static void
+endSession(struct Session *s)
+{
+    struct Request rq;
+
+    if (!s->peerClosed) {
+	memset(&rq, 0, sizeof(rq));
+	if (s->uniqLen > 0) {
+	    rq.hostUniq.type = htons(TAG_HOST_UNIQ);
+	    rq.hostUniq.length = htons(s->uniqLen);
+	    memcpy(rq.hostUniq.payload, s->uniq, s->uniqLen);
+	}
+	sendReply(s->ifp, s->peer, &rq, CODE_PADT, htons(s->id), 0, NULL);
+    }
+    freeSessionId(s->id);
+    s->id = 0;
+}
+
+/* Look for sessions whose pppd has gone */
+static void
+checkSessions(void)
+{
+    int i;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+	;
+    for (i = 0; i < numSessions; i++) {
+	if (sessions[i].id && kill(sessions[i].pid, 0) < 0 && errno == ESRCH) {
+	    info("Session %u ended", (unsigned) sessions[i].id);
+	    endSession(&sessions[i]);
+	}
+    }
+}
+
+#ifdef AC_FANOUT
+/**********************************************************************
+*%FUNCTION: joinFanout
+*%ARGUMENTS:
+* ifp -- an interface whose socket is open
+* group -- fanout group ID to join
+*%RETURNS:
+* 0 on success, -1 on failure
+*%DESCRIPTION:
+* Puts the socket in the interface's fanout group, with a filter that
+* picks the member by the low bits of the source MAC address.
+***********************************************************************/
+static int
+joinFanout(struct AcInterface *ifp, int group)
+{
+    struct sock_filter code[] = {
+	/* the last four bytes of the source address */
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_LL_OFF + 8),
+	/* the kernel takes this modulo the number of members */
+	BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    int arg = group | (PACKET_FANOUT_CBPF << 16);
+
+    if (setsockopt(ifp->sock, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) < 0
+	|| setsockopt(ifp->sock, SOL_PACKET, PACKET_FANOUT_DATA, &prog,
+		      sizeof(prog)) < 0) {
+	error("Can't share discovery on %s among workers: %m", ifp->ifName);
+	return -1;
+    }
+    return 0;
+}
+#endif
+
+/**********************************************************************
+*%FUNCTION: serve
+*%ARGUMENTS:
+* None
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Answers discovery and runs sessions until told to stop, then ends
+* the sessions.  This is the whole of pppoe-ac, or of one worker.
+***********************************************************************/
+static void
+serve(void)
+{
+    struct timeval tv;
+    fd_set readable;
+    int i, n, r, maxfd, ready;
+
+    nextId = workerIndex + 1;
+    if ((sessions = calloc(maxSessions, sizeof(*sessions))) == NULL)
+	fatal("Out of memory for sessions");
+    gettimeofday(&lastRefill, NULL);
+    mtokens = sessionRate * 1000L;
+
+    for (i = 0; i < numInterfaces; i++) {
+	interfaces[i].sock = openInterface(interfaces[i].ifName,
+					   Eth_PPPOE_Discovery,
+					   interfaces[i].mac);
+	if (interfaces[i].sock < 0)
+	    exit(1);
+	if (interfaces[i].sock >= FD_SETSIZE)
+	    fatal("Too many interfaces");
+	fcntl(interfaces[i].sock, F_SETFD, FD_CLOEXEC);
+#ifdef AC_FANOUT
+	if (numWorkers > 1
+	    && joinFanout(&interfaces[i], (acPid + i) & 0xFFFF) < 0)
+	    exit(1);
+#endif
+    }
+
+    while (!got_sigterm) {
+	/* Anything already in a receive ring won't wake select().  Take
+	   a run of packets from each interface in turn so that the
+	   replies to them go out together. */
+	ready = 0;
+	for (i = 0; i < numInterfaces; i++) {
+	    for (n = 0; n < DRAIN_MAX && packetReady(interfaces[i].sock); n++) {
+		handlePacket(&interfaces[i]);
+		ready = 1;
+	    }
+	}
+	if (ready) {
+	    flushPackets();
+	    continue;
+	}
+
+	FD_ZERO(&readable);
+	maxfd = -1;
+	for (i = 0; i < numInterfaces; i++) {
+	    FD_SET(interfaces[i].sock, &readable);
+	    if (interfaces[i].sock > maxfd)
+		maxfd = interfaces[i].sock;
+	}
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	r = select(maxfd + 1, &readable, NULL, NULL, &tv);
+	if (r < 0 && errno != EINTR)
+	    fatal("select: %m");
+	if (r > 0) {
+	    for (i = 0; i < numInterfaces; i++) {
+		if (FD_ISSET(interfaces[i].sock, &readable))
+		    handlePacket(&interfaces[i]);
+	    }
+	}
+	checkSessions();
+	flushPackets();
+    }
+
+    /* Close down every session we started */
+    for (i = 0; i < numSessions; i++) {
+	if (sessions[i].id) {
+	    kill(sessions[i].pid, SIGTERM);
+	    endSession(&sessions[i]);
+	}
+    }
+    for (i = 0; i < numInterfaces; i++)
+	closeInterface(interfaces[i].sock);
+}
+
+/**********************************************************************
+*%FUNCTION: runWorkers
+*%ARGUMENTS:
+* None
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Starts numWorkers workers and waits for them.  They are all stopped
+* when we are told to stop or when any of them exits, since the
+* sessions of one that has gone can't be looked after by the others.
+***********************************************************************/
+static void
+runWorkers(void)
+{
+    pid_t pids[MAX_WORKERS], pid;
+    int i, left = 0;
+
+    memset(pids, 0, sizeof(pids));
+    for (i = 0; i < numWorkers; i++) {
+	pid = fork();
+	if (pid < 0) {
+	    error("Couldn't fork worker %d: %m", i);
+	    break;
+	}
+	if (pid == 0) {
+	    workerIndex = i;
+	    serve();
+	    exit(0);
+	}
+	pids[i] = pid;
+	++left;
+    }
+    if (left < numWorkers)
+	got_sigterm = 1;
+
+    while (left > 0) {
+	if (got_sigterm == 1) {
+	    for (i = 0; i < numWorkers; i++)
+		if (pids[i] > 0)
+		    kill(pids[i], SIGTERM);
+	    got_sigterm = 2;
+	}
+	pid = wait(NULL);
+	if (pid < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+	for (i = 0; i < numWorkers; i++) {
+	    if (pids[i] == pid) {
+		pids[i] = 0;
+		--left;
+		if (!got_sigterm) {
+		    error("Worker %d exited; stopping", i);
+		    got_sigterm = 1;
+		}
+	    }
+	}
+    }
+}
+
+static void usage(void);
+
+int main(int argc, char *argv[])
+{
+    char hostname[256];
+    int opt;
+
+    while ((opt = getopt(argc, argv, "I:C:S:p:x:N:r:W:dh")) > 0) {
+	switch(opt) {
+	case 'I':
+	    if (numInterfaces == MAX_AC_INTERFACES) {
+		fprintf(stderr, "Too many interfaces\n");
+		exit(EXIT_FAILURE);
+	    }
+	    interfaces[numInterfaces++].ifName = optarg;
+	    break;
+	case 'C':
+	    acName = optarg;
+	    break;
+	case 'S':
+	    if (numServices == MAX_SERVICES) {
+		fprintf(stderr, "Too many services\n");
+		exit(EXIT_FAILURE);
+	    }
+	    serviceNames[numServices++] = optarg;
+	    break;
+	case 'p':
+	    preforkPath = optarg;
+	    break;
+	case 'x':
+	    pppdPath = optarg;
+	    break;
+	case 'N':
+	    if (sscanf(optarg, "%d", &maxSessions) != 1 || maxSessions < 1) {
+		fprintf(stderr, "Illegal argument to -N: Should be -N sessions\n");
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+	case 'r':
+	    if (sscanf(optarg, "%d", &sessionRate) != 1 || sessionRate < 0) {
+		fprintf(stderr, "Illegal argument to -r: Should be -r rate\n");
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+	case 'W':
+	    if (sscanf(optarg, "%d", &numWorkers) != 1 || numWorkers < 1
+		|| numWorkers > MAX_WORKERS) {
+		fprintf(stderr, "Illegal argument to -W: Should be -W workers (1 to %d)\n",
+			MAX_WORKERS);
+		exit(EXIT_FAILURE);
+	    }
+#ifndef AC_FANOUT
+	    if (numWorkers > 1) {
+		fprintf(stderr, "-W needs PACKET_FANOUT, which this system lacks\n");
+		exit(EXIT_FAILURE);
+	    }
+#endif
+	    break;
+	case 'd':
+	    debug = 1;
+	    pppoe_verbose = 2;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (!numInterfaces) {
+	fprintf(stderr, "Interface was not specified\n");
+	exit(EXIT_FAILURE);
+    }
+    pppdArgs = argv + optind;
+    numPppdArgs = argc - optind;
+    if (!acName) {
+	if (gethostname(hostname, sizeof(hostname) - 1) < 0)
+	    strcpy(hostname, "pppoe-ac");
+	hostname[sizeof(hostname) - 1] = 0;
+	acName = hostname;
+    }
+
+    /* the limits are shared out among the workers */
+    if (numWorkers > 1) {
+	maxSessions = (maxSessions + numWorkers - 1) / numWorkers;
+	if (sessionRate > 0)
+	    sessionRate = (sessionRate + numWorkers - 1) / numWorkers;
+    }
+    acPid = getpid();
+
+    signal(SIGINT, term_handler);
+    signal(SIGTERM, term_handler);
+    signal(SIGPIPE, SIG_IGN);
+    info("Serving PPPoE as %s on %d interface%s", acName, numInterfaces,
+	 numInterfaces == 1 ? "" : "s");
+
+    if (numWorkers > 1) {
+	info("Sharing discovery among %d workers", numWorkers);
+	runWorkers();
+    } else
+	serve();
+    return 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: pppoe-ac [options] [-- pppd options]\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+	    "   -I if_name     -- Serve sessions on this interface (repeatable)\n"
+	    "   -C name        -- Set the access concentrator name.\n"
+	    "   -S name        -- Offer this service (repeatable).\n"
+	    "   -p path        -- Get sessions from the pppd serving this prefork socket.\n"
+	    "   -x path        -- Run this pppd for each session (default " PPPD_PATH ").\n"
+	    "   -N sessions    -- Most sessions at once (default 64).\n"
+	    "   -r rate        -- Most new sessions a second (default no limit).\n"
+	    "   -W workers     -- Share discovery among this many processes.\n"
+	    "   -d             -- Log debugging information.\n"
+	    "   -h             -- Print usage information.\n");
+    fprintf(stderr, "\npppoe-ac from pppd " PPPD_VERSION "\n");
+}
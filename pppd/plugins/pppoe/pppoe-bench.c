@@ -0,0 +1,375 @@
+/*
+ * Measure how fast PPPoE sessions can be brought up, and what each
+ * costs, over a veth pair.
+ *
+ * Copyright (C) 2026 The ppp project contributors.
+ *
+ * This program may be distributed according to the terms of the GNU
+ * General Public License, version 2 or (at your option) any later version.
+ *
+ * Usage: pppoe-bench [-k sessions] [-W workers] [-p] [-x pppd]
+ *		      [-A pppoe-ac]
+ *
+ * Makes a veth pair, runs pppoe-ac on one end as the access
+ * concentrator, and starts k pppd clients at once with the pppoe plugin
+ * on the other.  Each client logs, on fd 3, how long each phase of
+ * bringing up its session took; for PPPoE the connect phase is the
+ * discovery.  When all the sessions are up, or have had their chance,
+ * the CPU time and RSS of every pppd on the box are totted up, so the
+ * figures per session include the server end and, with -p, the share
+ * of the prefork pppd.
+ *
+ * -W is passed on to pppoe-ac to use that many worker processes, and
+ * -p has it ask a pppd serving a prefork socket for each session rather
+ * than run one afresh.  The server pppds take their remote addresses
+ * from an ip-pool.
+ *
+ * This needs to run as root, with the ppp and veth drivers, and the
+ * installed pppd and plugin.  Build with "make pppoe-bench".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifndef SBINDIR
+#define SBINDIR "/usr/sbin"
+#endif
+
+#define BENCH_IF	"pbench"
+#define BENCH_SOCK	"/run/pppoe-bench.sock"
+#define BENCH_SERVER_OPTS \
+    "noauth noccp nodefaultroute 10.65.0.1: ip-pool 10.65.0.2-10.65.255.254"
+
+#define SETUP_TIMEOUT	60000	/* ms for all the sessions to come up */
+#define MAX_CLIENTS	4096
+
+struct client {
+    pid_t pid;
+    int fd;			/* its log */
+    int len;
+    char line[512];
+    long up_ms;			/* since the clients were started, or -1 */
+    long connect_ms;		/* discovery */
+    long total_ms;		/* from connect to network up */
+};
+
+static struct client *clients;
+static int nclients;
+
+static long
+ms_since(struct timespec *t0)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) * 1000
+	+ (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return x < y? -1: x > y;
+}
+
+static long
+percentile(long *v, int n, int pc)
+{
+    int i = (n * pc + 99) / 100 - 1;
+
+    return v[i < 0? 0: i];
+}
+
+static void
+run(const char *fmt, const char *arg)
+{
+    char cmd[512];
+
+    snprintf(cmd, sizeof(cmd), fmt, arg, arg, arg, arg);
+    if (system(cmd) != 0) {
+	fprintf(stderr, "pppoe-bench: %s failed\n", cmd);
+	exit(1);
+    }
+}
+
+static pid_t
+spawn(const char *cmd, int logfd)
+{
+    pid_t pid;
+
+    pid = fork();
+    if (pid < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	if (logfd >= 0 && logfd != 3) {
+	    dup2(logfd, 3);
+	    close(logfd);
+	}
+	execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+	_exit(127);
+    }
+    return pid;
+}
+
+/*
+ * client_input - read what a client has logged, and note when its
+ * link comes up.
+ */
+static void
+client_input(struct client *c, struct timespec *t0)
+{
+    long total, conn;
+    char *nl, *p;
+    int n;
+
+    n = read(c->fd, c->line + c->len, sizeof(c->line) - 1 - c->len);
+    if (n <= 0) {
+	close(c->fd);
+	c->fd = -1;
+	return;
+    }
+    c->len += n;
+    c->line[c->len] = 0;
+    while ((nl = strchr(c->line, '\n')) != NULL) {
+	*nl = 0;
+	p = strstr(c->line, "Link up after ");
+	if (p != NULL && c->up_ms < 0
+	    && sscanf(p, "Link up after %ld ms: connect %ld", &total,
+		      &conn) == 2) {
+	    c->up_ms = ms_since(t0);
+	    c->connect_ms = conn;
+	    c->total_ms = total;
+	}
+	c->len -= nl + 1 - c->line;
+	memmove(c->line, nl + 1, c->len + 1);
+    }
+    if (c->len == sizeof(c->line) - 1)
+	c->len = 0;
+}
+
+/*
+ * pppd_usage - add up the CPU time, in ms, and RSS, in kB, of all the
+ * pppds running.
+ */
+static int
+pppd_usage(long *cpu_ms, long *rss_kb)
+{
+    char path[300], buf[512], *p;
+    unsigned long ut, st;
+    struct dirent *de;
+    long rss;
+    FILE *f;
+    DIR *d;
+    int n = 0;
+
+    *cpu_ms = *rss_kb = 0;
+    d = opendir("/proc");
+    if (d == NULL)
+	return 0;
+    while ((de = readdir(d)) != NULL) {
+	if (de->d_name[0] < '0' || de->d_name[0] > '9')
+	    continue;
+	snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+	f = fopen(path, "r");
+	if (f == NULL)
+	    continue;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (p == NULL || strstr(buf, " (pppd) ") == NULL)
+	    continue;
+	p = strrchr(buf, ')');
+	if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		   &ut, &st) != 2)
+	    continue;
+	*cpu_ms += (ut + st) * 1000 / sysconf(_SC_CLK_TCK);
+	snprintf(path, sizeof(path), "/proc/%s/status", de->d_name);
+	f = fopen(path, "r");
+	if (f != NULL) {
+	    while (fgets(buf, sizeof(buf), f) != NULL)
+		if (sscanf(buf, "VmRSS: %ld", &rss) == 1)
+		    *rss_kb += rss;
+	    fclose(f);
+	}
+	++n;
+    }
+    closedir(d);
+    return n;
+}
+
+static void
+cleanup(void)
+{
+    run("ip link del %s0 2>/dev/null; true", BENCH_IF);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *pppd = SBINDIR "/pppd", *ac = SBINDIR "/pppoe-ac";
+    char cmd[1024], workers[16] = "";
+    struct pollfd *pfds;
+    struct timespec t0;
+    pid_t ac_pid, prefork_pid = -1;
+    long *v, cpu_ms, rss_kb, last;
+    int prefork = 0, nup, npppd, i, n, c, fds[2];
+
+    nclients = 10;
+    while ((c = getopt(argc, argv, "k:W:px:A:")) != -1) {
+	switch (c) {
+	case 'k':
+	    nclients = atoi(optarg);
+	    break;
+	case 'W':
+	    snprintf(workers, sizeof(workers), "-W %d", atoi(optarg));
+	    break;
+	case 'p':
+	    prefork = 1;
+	    break;
+	case 'x':
+	    pppd = optarg;
+	    break;
+	case 'A':
+	    ac = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-k sessions] [-W workers] [-p]"
+		    " [-x pppd] [-A pppoe-ac]\n", argv[0]);
+	    exit(2);
+	}
+    }
+    if (nclients < 1 || nclients > MAX_CLIENTS) {
+	fprintf(stderr, "pppoe-bench: -k must be 1 to %d\n", MAX_CLIENTS);
+	exit(2);
+    }
+    clients = calloc(nclients, sizeof(*clients));
+    pfds = calloc(nclients, sizeof(*pfds));
+    v = calloc(nclients, sizeof(long));
+    if (clients == NULL || pfds == NULL || v == NULL) {
+	perror("calloc");
+	exit(1);
+    }
+
+    cleanup();
+    run("ip link add %s0 type veth peer name %s1"
+	" && ip link set %s0 up && ip link set %s1 up", BENCH_IF);
+    atexit(cleanup);
+
+    /* the access concentrator, and the prefork pppd it asks */
+    if (prefork) {
+	snprintf(cmd, sizeof(cmd), "exec %s nodetach prefork-socket "
+		 BENCH_SOCK " plugin pppoe.so " BENCH_SERVER_OPTS, pppd);
+	prefork_pid = spawn(cmd, -1);
+	for (i = 0; i < 50 && access(BENCH_SOCK, F_OK) < 0; ++i)
+	    usleep(100000);
+	snprintf(cmd, sizeof(cmd), "exec %s -I " BENCH_IF "0 %s -p "
+		 BENCH_SOCK, ac, workers);
+    } else {
+	snprintf(cmd, sizeof(cmd), "exec %s -I " BENCH_IF "0 %s -x %s "
+		 BENCH_SERVER_OPTS, ac, workers, pppd);
+    }
+    ac_pid = spawn(cmd, -1);
+    sleep(1);
+
+    /* all the clients at once */
+    snprintf(cmd, sizeof(cmd), "exec %s nodetach logfd 3 plugin pppoe.so"
+	     " nic-" BENCH_IF "1 noauth noccp noipdefault nodefaultroute",
+	     pppd);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < nclients; ++i) {
+	if (pipe(fds) < 0) {
+	    perror("pipe");
+	    exit(1);
+	}
+	clients[i].pid = spawn(cmd, fds[1]);
+	close(fds[1]);
+	clients[i].fd = fds[0];
+	clients[i].up_ms = -1;
+    }
+
+    nup = 0;
+    while (nup < nclients && ms_since(&t0) < SETUP_TIMEOUT) {
+	for (i = n = 0; i < nclients; ++i) {
+	    if (clients[i].fd < 0 || clients[i].up_ms >= 0)
+		continue;
+	    pfds[n].fd = clients[i].fd;
+	    pfds[n].events = POLLIN;
+	    ++n;
+	}
+	if (n == 0)
+	    break;		/* the rest have given up */
+	if (poll(pfds, n, 1000) <= 0)
+	    continue;
+	for (i = 0; i < nclients; ++i) {
+	    struct client *cl = &clients[i];
+	    int j;
+
+	    if (cl->fd < 0 || cl->up_ms >= 0)
+		continue;
+	    for (j = 0; j < n && pfds[j].fd != cl->fd; ++j)
+		;
+	    if (j < n && pfds[j].revents != 0) {
+		client_input(cl, &t0);
+		if (cl->up_ms >= 0)
+		    ++nup;
+	    }
+	}
+    }
+    npppd = pppd_usage(&cpu_ms, &rss_kb);
+
+    printf("%d of %d sessions up", nup, nclients);
+    if (nup > 0) {
+	last = 0;
+	for (i = 0; i < nclients; ++i)
+	    if (clients[i].up_ms > last)
+		last = clients[i].up_ms;
+	printf(" in %ld ms, %.1f sessions/s\n", last,
+	       last > 0? nup * 1000.0 / last: 0.0);
+	printf("%-18s %8s %8s %8s %8s  (ms)\n", "", "p50", "p90", "p99",
+	       "max");
+	for (c = 0; c < 3; ++c) {
+	    for (i = n = 0; i < nclients; ++i)
+		if (clients[i].up_ms >= 0)
+		    v[n++] = c == 0? clients[i].connect_ms:
+			c == 1? clients[i].total_ms: clients[i].up_ms;
+	    qsort(v, n, sizeof(long), cmp_long);
+	    printf("%-18s %8ld %8ld %8ld %8ld\n",
+		   c == 0? "discovery": c == 1? "connect to up": "start to up",
+		   percentile(v, n, 50), percentile(v, n, 90),
+		   percentile(v, n, 99), v[n - 1]);
+	}
+	printf("%d pppds: %ld ms CPU and %ld kB RSS per session\n", npppd,
+	       cpu_ms / nup, rss_kb / nup);
+    } else {
+	printf("\n");
+    }
+
+    for (i = 0; i < nclients; ++i)
+	kill(clients[i].pid, SIGTERM);
+    for (i = 0; i < nclients; ++i)
+	waitpid(clients[i].pid, NULL, 0);
+    kill(ac_pid, SIGTERM);
+    waitpid(ac_pid, NULL, 0);
+    if (prefork_pid > 0) {
+	kill(prefork_pid, SIGTERM);
+	waitpid(prefork_pid, NULL, 0);
+    }
+    return nup == nclients? 0: 1;
+}
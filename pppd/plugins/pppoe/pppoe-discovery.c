@@ -24,6 +24,7 @@
 #include <sys/time.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/select.h>
 
 #include "pppoe.h"
 
@@ -32,6 +33,37 @@ int got_sigterm;
 int pppoe_verbose;
 static FILE *debugFile;
 
+/* How -F prints what a scan finds */
+#define FORMAT_TEXT	0
+#define FORMAT_CSV	1
+#define FORMAT_JSON	2
+
+/* Most Service-Name tags reported from one PADO */
+#define MAX_SCAN_SERVICES 16
+
+static int format = FORMAT_TEXT;
+
+/* An interface being scanned */
+struct ScanInterface {
+    char *ifName;
+    int sock;
+    unsigned char myEth[ETH_ALEN];
+    struct timeval sentAt;	/* When its last PADI went out */
+    int numPADOs;
+};
+
+/* What a PADO offers, pointing into the packet */
+struct ScanOffer {
+    struct PacketCriteria pc;
+    unsigned char *acName;
+    int acNameLen;
+    unsigned char *services[MAX_SCAN_SERVICES];
+    int serviceLens[MAX_SCAN_SERVICES];
+    int numServices;
+    int maxPayload;		/* PPP-Max-Payload, or 0 */
+    int error;
+};
+
 void
 fatal(char *fmt, ...)
 {
@@ -63,6 +95,19 @@ warn(char *fmt, ...)
     va_end(pvar);
 }
 
+void
+dbglog(char *fmt, ...)
+{
+    va_list pvar;
+
+    if (!debug)
+	return;
+    va_start(pvar, fmt);
+    vfprintf(stderr, fmt, pvar);
+    fputc('\n', stderr);
+    va_end(pvar);
+}
+
 void
 info(char *fmt, ...)
 {
@@ -143,12 +188,329 @@ term_handler(int signum)
     got_sigterm = 1;
 }
 
+/**********************************************************************
+*%FUNCTION: parseScanTags
+*%ARGUMENTS:
+* type -- tag type
+* len -- tag length
+* data -- tag data
+* extra -- pointer to a ScanOffer structure
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Notes the tags of a PADO that a scan reports.
+***********************************************************************/
+static void
+parseScanTags(UINT16_t type, UINT16_t len, unsigned char *data,
+	      void *extra)
+{
+    struct ScanOffer *so = (struct ScanOffer *) extra;
+    PPPoEConnection *conn = so->pc.conn;
+    UINT16_t mru;
+
+    switch(type) {
+    case TAG_AC_NAME:
+	so->pc.seenACName = 1;
+	so->acName = data;
+	so->acNameLen = len;
+	if (conn->acName && len == strlen(conn->acName) &&
+	    !strncmp((char *) data, conn->acName, len)) {
+	    so->pc.acNameOK = 1;
+	}
+	break;
+    case TAG_SERVICE_NAME:
+	so->pc.seenServiceName = 1;
+	if (so->numServices < MAX_SCAN_SERVICES) {
+	    so->services[so->numServices] = data;
+	    so->serviceLens[so->numServices++] = len;
+	}
+	if (conn->serviceName && len == strlen(conn->serviceName) &&
+	    !strncmp((char *) data, conn->serviceName, len)) {
+	    so->pc.serviceNameOK = 1;
+	}
+	break;
+    case TAG_PPP_MAX_PAYLOAD:
+	if (len == sizeof(mru)) {
+	    memcpy(&mru, data, sizeof(mru));
+	    so->maxPayload = ntohs(mru);
+	}
+	break;
+    case TAG_SERVICE_NAME_ERROR:
+    case TAG_AC_SYSTEM_ERROR:
+    case TAG_GENERIC_ERROR:
+	so->error = 1;
+	break;
+    }
+}
+
+/* Print len bytes of s as a JSON string */
+static void
+printJSONString(unsigned char const *s, int len)
+{
+    int i;
+
+    putchar('"');
+    for (i = 0; i < len; i++) {
+	if (s[i] == '"' || s[i] == '\\')
+	    printf("\\%c", s[i]);
+	else if (s[i] < 0x20 || s[i] >= 0x7f)
+	    printf("\\u%04x", (unsigned) s[i]);
+	else
+	    putchar(s[i]);
+    }
+    putchar('"');
+}
+
+/* Print len bytes of s as a CSV field */
+static void
+printCSVField(unsigned char const *s, int len)
+{
+    int i;
+
+    putchar('"');
+    for (i = 0; i < len; i++) {
+	if (s[i] == '"')
+	    putchar('"');
+	putchar(s[i]);
+    }
+    putchar('"');
+}
+
+/**********************************************************************
+*%FUNCTION: printOffer
+*%ARGUMENTS:
+* si -- interface the PADO came in on
+* packet -- the PADO
+* so -- its tags
+* latency -- milliseconds since the PADI
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Prints one access concentrator found by a scan, in the chosen format.
+***********************************************************************/
+static void
+printOffer(struct ScanInterface *si, PPPoEPacket *packet,
+	   struct ScanOffer *so, long latency)
+{
+    unsigned char *mac = packet->ethHdr.h_source;
+    char macstr[18];
+    int i;
+
+    sprintf(macstr, "%02x:%02x:%02x:%02x:%02x:%02x",
+	    (unsigned) mac[0], (unsigned) mac[1], (unsigned) mac[2],
+	    (unsigned) mac[3], (unsigned) mac[4], (unsigned) mac[5]);
+
+    switch (format) {
+    case FORMAT_TEXT:
+	printf("Interface: %s\n", si->ifName);
+	printf("Access-Concentrator: %.*s\n", so->acNameLen, so->acName);
+	for (i = 0; i < so->numServices; i++) {
+	    if (so->serviceLens[i] > 0)
+		printf("Service-Name: %.*s\n", so->serviceLens[i],
+		       so->services[i]);
+	}
+	if (so->maxPayload)
+	    printf("Max-Payload: %d\n", so->maxPayload);
+	printf("AC-Ethernet-Address: %s\n", macstr);
+	printf("Latency: %ld ms\n", latency);
+	printf("--------------------------------------------------\n");
+	break;
+    case FORMAT_CSV:
+	printCSVField((unsigned char *) si->ifName, strlen(si->ifName));
+	printf(",%s,", macstr);
+	printCSVField(so->acName, so->acNameLen);
+	putchar(',');
+	/* Service names are separated by semicolons within the field */
+	putchar('"');
+	for (i = 0; i < so->numServices; i++) {
+	    int j;
+	    if (i > 0)
+		putchar(';');
+	    for (j = 0; j < so->serviceLens[i]; j++) {
+		if (so->services[i][j] == '"')
+		    putchar('"');
+		putchar(so->services[i][j]);
+	    }
+	}
+	putchar('"');
+	printf(",%d,%ld\n", so->maxPayload, latency);
+	break;
+    case FORMAT_JSON:
+	printf("{\"interface\":");
+	printJSONString((unsigned char *) si->ifName, strlen(si->ifName));
+	printf(",\"ac_mac\":\"%s\",\"ac_name\":", macstr);
+	printJSONString(so->acName, so->acNameLen);
+	printf(",\"services\":[");
+	for (i = 0; i < so->numServices; i++) {
+	    if (i > 0)
+		putchar(',');
+	    printJSONString(so->services[i], so->serviceLens[i]);
+	}
+	printf("],\"max_payload\":%d,\"latency_ms\":%ld}\n",
+	       so->maxPayload, latency);
+	break;
+    }
+    fflush(stdout);
+}
+
+/**********************************************************************
+*%FUNCTION: scanPacket
+*%ARGUMENTS:
+* conn -- PPPoE connection holding the options
+* si -- interface with a packet waiting
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Reads a packet from si and reports it if it is an acceptable PADO.
+***********************************************************************/
+static void
+scanPacket(PPPoEConnection *conn, struct ScanInterface *si)
+{
+    PPPoEPacket packet;
+    struct ScanOffer so;
+    struct timeval now;
+    int len;
+
+    if (receivePacket(si->sock, &packet, &len) < 0)
+	return;
+    if (ntohs(packet.length) + HDR_SIZE > len) {
+	error("%s: Bogus PPPoE length field (%u)", si->ifName,
+	      (unsigned int) ntohs(packet.length));
+	return;
+    }
+#ifdef USE_BPF
+    if (etherType(&packet) != Eth_PPPOE_Discovery) return;
+#endif
+    memcpy(conn->myEth, si->myEth, ETH_ALEN);
+    if (!packetIsForMe(conn, &packet) || packet.code != CODE_PADO)
+	return;
+    if (NOT_UNICAST(packet.ethHdr.h_source)) {
+	error("%s: Ignoring PADO packet from non-unicast MAC address",
+	      si->ifName);
+	return;
+    }
+
+    memset(&so, 0, sizeof(so));
+    so.pc.conn = conn;
+    so.pc.acNameOK = (conn->acName) ? 0 : 1;
+    so.pc.serviceNameOK = (conn->serviceName) ? 0 : 1;
+    if (parsePacket(&packet, parseScanTags, &so) < 0 || so.error)
+	return;
+    if (!so.pc.seenACName || !so.pc.seenServiceName) {
+	error("%s: Ignoring PADO packet with no %s tag", si->ifName,
+	      so.pc.seenACName ? "Service-Name" : "AC-Name");
+	return;
+    }
+    if (!so.pc.acNameOK || !so.pc.serviceNameOK)
+	return;
+
+    si->numPADOs++;
+    conn->numPADOs++;
+    if (pppoe_verbose >= 1) {
+	get_time(&now);
+	printOffer(si, &packet, &so,
+		   (now.tv_sec - si->sentAt.tv_sec) * 1000
+		   + (now.tv_usec - si->sentAt.tv_usec) / 1000);
+    }
+}
+
+/**********************************************************************
+*%FUNCTION: scanInterfaces
+*%ARGUMENTS:
+* conn -- PPPoE connection holding the options
+* ifs -- interfaces to scan, with their sockets open
+* numIfs -- how many there are
+*%RETURNS:
+* Nothing
+*%DESCRIPTION:
+* Sends a PADI out of every interface at once and reports the PADOs
+* that come back on any of them, as discovery1() does for one.  Those
+* interfaces that heard nothing get another PADI after the timeout.
+***********************************************************************/
+static void
+scanInterfaces(PPPoEConnection *conn, struct ScanInterface *ifs, int numIfs)
+{
+    int timeout = conn->discoveryTimeout;
+    struct timeval now, tv, expire_at;
+    fd_set readable;
+    int attempt, i, r, maxfd, pending, ready;
+
+    for (attempt = 0; attempt < conn->discoveryAttempts; attempt++) {
+	pending = 0;
+	for (i = 0; i < numIfs; i++) {
+	    if (ifs[i].sock < 0 || ifs[i].numPADOs)
+		continue;
+	    conn->discoverySocket = ifs[i].sock;
+	    memcpy(conn->myEth, ifs[i].myEth, ETH_ALEN);
+	    get_time(&ifs[i].sentAt);
+	    sendPADI(conn);
+	    pending++;
+	}
+	if (!pending)
+	    return;
+
+	get_time(&expire_at);
+	expire_at.tv_sec += timeout;
+	while (!got_sigterm) {
+	    /* Anything already in a receive ring won't wake select() */
+	    ready = 0;
+	    for (i = 0; i < numIfs; i++) {
+		if (ifs[i].sock >= 0 && packetReady(ifs[i].sock)) {
+		    scanPacket(conn, &ifs[i]);
+		    ready = 1;
+		}
+	    }
+	    if (ready)
+		continue;
+
+	    get_time(&now);
+	    tv.tv_sec = expire_at.tv_sec - now.tv_sec;
+	    tv.tv_usec = expire_at.tv_usec - now.tv_usec;
+	    if (tv.tv_usec < 0) {
+		tv.tv_usec += 1000000;
+		--tv.tv_sec;
+	    }
+	    if (tv.tv_sec < 0)
+		break;
+
+	    FD_ZERO(&readable);
+	    maxfd = -1;
+	    for (i = 0; i < numIfs; i++) {
+		if (ifs[i].sock < 0)
+		    continue;
+		FD_SET(ifs[i].sock, &readable);
+		if (ifs[i].sock > maxfd)
+		    maxfd = ifs[i].sock;
+	    }
+	    r = select(maxfd + 1, &readable, NULL, NULL, &tv);
+	    if (r < 0 && errno == EINTR)
+		continue;
+	    if (r < 0) {
+		error("select (scanInterfaces): %m");
+		return;
+	    }
+	    if (r == 0)
+		break;
+	    for (i = 0; i < numIfs; i++) {
+		if (ifs[i].sock >= 0 && FD_ISSET(ifs[i].sock, &readable))
+		    scanPacket(conn, &ifs[i]);
+	    }
+	}
+	if (got_sigterm)
+	    return;
+	timeout *= 2;
+    }
+}
+
 static void usage(void);
 
 int main(int argc, char *argv[])
 {
     int opt;
     PPPoEConnection *conn;
+    struct ScanInterface *ifs = NULL;
+    int numIfs = 0, i;
+    int scan = 0;
 
     signal(SIGINT, term_handler);
     signal(SIGTERM, term_handler);
@@ -165,7 +527,7 @@ int main(int argc, char *argv[])
     conn->discoveryTimeout = PADI_TIMEOUT;
     conn->discoveryAttempts = MAX_PADI_ATTEMPTS;
 
-    while ((opt = getopt(argc, argv, "I:D:VUQS:C:W:t:a:h")) > 0) {
+    while ((opt = getopt(argc, argv, "I:D:VUQS:C:W:F:t:a:h")) > 0) {
 	switch(opt) {
 	case 'S':
 	    conn->serviceName = xstrdup(optarg);
@@ -224,7 +586,26 @@ int main(int argc, char *argv[])
 	    fprintf(debugFile, "pppoe-discovery from pppd %s\n", PPPD_VERSION);
 	    break;
 	case 'I':
-	    conn->ifName = xstrdup(optarg);
+	    ifs = realloc(ifs, (numIfs + 1) * sizeof(*ifs));
+	    if (!ifs) {
+		perror("realloc");
+		exit(1);
+	    }
+	    memset(&ifs[numIfs], 0, sizeof(*ifs));
+	    ifs[numIfs++].ifName = conn->ifName = xstrdup(optarg);
+	    break;
+	case 'F':
+	    if (!strcmp(optarg, "text")) {
+		format = FORMAT_TEXT;
+	    } else if (!strcmp(optarg, "csv")) {
+		format = FORMAT_CSV;
+	    } else if (!strcmp(optarg, "json")) {
+		format = FORMAT_JSON;
+	    } else {
+		fprintf(stderr, "Illegal argument to -F: Should be text, csv or json\n");
+		exit(EXIT_FAILURE);
+	    }
+	    scan = 1;
 	    break;
 	case 'Q':
 	    pppoe_verbose = 0;
@@ -252,11 +633,49 @@ int main(int argc, char *argv[])
 
     conn->sessionSocket = -1;
 
+    if (scan || numIfs > 1) {
+	int opened = 0;
+
+	for (i = 0; i < numIfs; i++) {
+	    ifs[i].sock = openInterface(ifs[i].ifName, Eth_PPPOE_Discovery,
+					ifs[i].myEth);
+	    if (ifs[i].sock < 0) {
+		fprintf(stderr, "Cannot create PPPoE discovery socket on %s: %s\n",
+			ifs[i].ifName, strerror(errno));
+		continue;
+	    }
+	    if (ifs[i].sock >= FD_SETSIZE) {
+		fprintf(stderr, "Too many interfaces, not scanning %s\n",
+			ifs[i].ifName);
+		closeInterface(ifs[i].sock);
+		ifs[i].sock = -1;
+		continue;
+	    }
+	    conn->discoverySocket = ifs[i].sock;
+	    memcpy(conn->myEth, ifs[i].myEth, ETH_ALEN);
+	    setDiscoveryFilter(conn);
+	    opened++;
+	}
+	if (!opened)
+	    exit(1);
+	if (format == FORMAT_CSV && pppoe_verbose >= 1)
+	    printf("interface,ac_mac,ac_name,service_names,max_payload,latency_ms\n");
+
+	scanInterfaces(conn, ifs, numIfs);
+
+	for (i = 0; i < numIfs; i++) {
+	    if (ifs[i].sock >= 0)
+		closeInterface(ifs[i].sock);
+	}
+	exit(conn->numPADOs ? 0 : 1);
+    }
+
     conn->discoverySocket = openInterface(conn->ifName, Eth_PPPOE_Discovery, conn->myEth);
     if (conn->discoverySocket < 0) {
 	perror("Cannot create PPPoE discovery socket");
 	exit(1);
     }
+    setDiscoveryFilter(conn);
 
     discovery1(conn);
 
@@ -272,6 +691,8 @@ usage(void)
     fprintf(stderr, "Usage: pppoe-discovery [options]\n");
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "   -I if_name     -- Specify interface (mandatory option)\n");
+    fprintf(stderr, "                     Repeat to scan several interfaces at once.\n");
+    fprintf(stderr, "   -F format      -- Print results as text, csv or json.\n");
     fprintf(stderr, "   -D filename    -- Log debugging information in filename.\n");
     fprintf(stderr,
 	    "   -t timeout     -- Initial timeout for discovery packets in seconds\n"
@@ -148,6 +148,9 @@ extern UINT16_t Eth_PPPOE_Session;
 /* Initial timeout for PADO/PADS */
 #define PADI_TIMEOUT 5
 
+/* Most PADOs kept when collecting offers from several ACs */
+#define MAX_PADO_OFFERS 4
+
 /* States for scanning PPP frames */
 #define STATE_WAITFOR_FRAME_ADDR 0
 #define STATE_DROP_PROTO         1
@@ -214,6 +217,17 @@ typedef void ParseFunc(UINT16_t type,
 
 #define PPPINITFCS16    0xffff  /* Initial FCS value */
 
+/* An acceptable PADO, kept while choosing between access concentrators */
+typedef struct PPPoEOfferStruct {
+    unsigned char peerEth[ETH_ALEN]; /* AC's MAC address */
+    long latency;		/* Milliseconds from PADI to PADO */
+    int seenMaxPayload;		/* Offer carried PPP-Max-Payload */
+    int mtu;			/* MTU and MRU as limited by the offer */
+    int mru;
+    PPPoETag cookie;
+    PPPoETag relayId;
+} PPPoEOffer;
+
 /* Keep track of the state of a connection -- collect everything in
    one spot */
 
@@ -237,7 +251,16 @@ typedef struct PPPoEConnectionStruct {
     int error;			/* Error packet received */
     int discoveryTimeout;       /* Timeout for discovery packets */
     int discoveryAttempts;      /* Number of discovery attempts */
+    int discoveryMaxTimeout;	/* Cap on jittered PADI waits, 0 to double */
+    int padiBackoff;		/* Last PADI wait in ms, 0 once an AC answers */
     int seenMaxPayload;
+    int padoWait;		/* ms to collect PADOs for, 0 to take the first */
+    int numOffers;		/* Offers collected in waitForPADO */
+    int nextOffer;		/* Next offer to try if the PADR fails */
+    PPPoEOffer offers[MAX_PADO_OFFERS];
+    int fastReconnect;		/* Try lastAC with a PADR before a PADI */
+    int haveLastAC;		/* lastAC holds the last AC to give a session */
+    PPPoEOffer lastAC;
     int storedmtu;		/* Stored MTU */
     int storedmru;		/* Stored MRU */
     int mtu;
@@ -256,7 +279,12 @@ struct PacketCriteria {
 /* Function Prototypes */
 UINT16_t etherType(PPPoEPacket *packet);
 int openInterface(char const *ifname, UINT16_t type, unsigned char *hwaddr);
+void closeInterface(int sock);
+int packetReady(int sock);
+void setDiscoveryFilter(PPPoEConnection *conn);
 int sendPacket(PPPoEConnection *conn, int sock, PPPoEPacket *pkt, int size);
+int queuePacket(int sock, PPPoEPacket *pkt, int size);
+void flushPackets(void);
 int receivePacket(int sock, PPPoEPacket *pkt, int *size);
 int parsePacket(PPPoEPacket *packet, ParseFunc *func, void *extra);
 void parseLogErrs(UINT16_t typ, UINT16_t len, unsigned char *data, void *xtra);
@@ -272,8 +300,12 @@ void initPPP(void);
 void clampMSS(PPPoEPacket *packet, char const *dir, int clampMss);
 UINT16_t computeTCPChecksum(unsigned char *ipHdr, unsigned char *tcpHdr);
 UINT16_t pppFCS16(UINT16_t fcs, unsigned char *cp, int len);
+int packetIsForMe(PPPoEConnection *conn, PPPoEPacket *packet);
+void sendPADI(PPPoEConnection *conn);
+int nextPADITimeout(PPPoEConnection *conn);
 void discovery1(PPPoEConnection *conn);
 void discovery2(PPPoEConnection *conn);
+int discoveryReconnect(PPPoEConnection *conn);
 unsigned char *findTag(PPPoEPacket *packet, UINT16_t tagType,
 		       PPPoETag *tag);
 
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 
 #include <sys/stat.h>
 #include <net/if.h>
@@ -71,6 +72,24 @@ const char pppd_version[] = PPPD_VERSION;
 
 static int openl2tp_fd = -1;
 
+#define OPENL2TP_RETRY		1	/* seconds before the first resend */
+#define OPENL2TP_RETRY_MAX	30	/* longest wait between resends */
+
+/*
+ * Indications not yet taken by openl2tpd, the latest of each type,
+ * and the last of each type that it did take.
+ */
+struct openl2tp_slot {
+	int		len;		/* 0 if none */
+	unsigned int	seq;		/* to send them in order */
+	uint8_t		buf[OPENL2TP_MSG_MAX_LEN];
+};
+static struct openl2tp_slot openl2tp_pending[OPENL2TP_MSG_TYPE_MAX];
+static struct openl2tp_slot openl2tp_sent[OPENL2TP_MSG_TYPE_MAX];
+static unsigned int openl2tp_seq;
+static int openl2tp_retry = OPENL2TP_RETRY;
+static int openl2tp_waiting;		/* a resend is scheduled */
+
 static void (*old_pppol2tp_send_accm_hook)(int tunnel_id, int session_id,
 					   uint32_t send_accm,
 					   uint32_t recv_accm) = NULL;
@@ -87,6 +106,30 @@ static multilink_join_hook_fn *old_multilink_join_hook = NULL;
  * goes down.
  *****************************************************************************/
 
+static void openl2tp_client_close(void)
+{
+	if (openl2tp_fd >= 0) {
+		ppp_remove_fd_handler(openl2tp_fd);
+		close(openl2tp_fd);
+		openl2tp_fd = -1;
+	}
+	/* a new openl2tpd will want to hear everything again */
+	memset(openl2tp_sent, 0, sizeof(openl2tp_sent));
+}
+
+/* openl2tpd doesn't talk back, but we hear if it goes away */
+static void openl2tp_client_input(int fd, void *arg)
+{
+	uint8_t buf[OPENL2TP_MSG_MAX_LEN];
+
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+		;
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		dbglog("openl2tp connection lost: %m");
+		openl2tp_client_close();
+	}
+}
+
 static int openl2tp_client_create(void)
 {
 	struct sockaddr_un addr;
@@ -98,25 +141,119 @@ static int openl2tp_client_create(void)
 			error("openl2tp connection create: %m");
 			return -ENOTCONN;
 		}
+		fcntl(openl2tp_fd, F_SETFD, FD_CLOEXEC);
+		fcntl(openl2tp_fd, F_SETFL,
+		      fcntl(openl2tp_fd, F_GETFL) | O_NONBLOCK);
 
+		memset(&addr, 0, sizeof(addr));
 		addr.sun_family = AF_UNIX;
 		strcpy(&addr.sun_path[0], OPENL2TP_EVENT_SOCKET_NAME);
 
 		result = connect(openl2tp_fd, (struct sockaddr *) &addr,
 				 sizeof(addr));
 		if (result < 0) {
-			error("openl2tp connection connect: %m");
+			if (openl2tp_retry == OPENL2TP_RETRY)
+				error("openl2tp connection connect: %m");
+			close(openl2tp_fd);
+			openl2tp_fd = -1;
 			return -ENOTCONN;
 		}
+		ppp_add_fd_handler(openl2tp_fd, openl2tp_client_input, NULL);
 	}
 
 	return 0;
 }
 
+/*****************************************************************************
+ * Indications are sent at once if openl2tpd will take them.  If it is
+ * busy or has gone away, they wait and are sent again later, backing
+ * off, with a newer one of the same type replacing one still waiting.
+ * One identical to the last of its type that was sent (as when IPv4
+ * and IPv6 both come up) isn't sent again.
+ *****************************************************************************/
+
+static void openl2tp_flush(void *arg)
+{
+	struct openl2tp_slot *slot;
+	int i, result;
+
+	openl2tp_waiting = 0;
+	for (;;) {
+		slot = NULL;
+		for (i = 0; i < OPENL2TP_MSG_TYPE_MAX; i++)
+			if (openl2tp_pending[i].len
+			    && (!slot || openl2tp_pending[i].seq < slot->seq))
+				slot = &openl2tp_pending[i];
+		if (!slot) {
+			openl2tp_retry = OPENL2TP_RETRY;
+			return;
+		}
+
+		if (openl2tp_client_create() < 0)
+			break;
+		result = send(openl2tp_fd, slot->buf, slot->len, MSG_NOSIGNAL);
+		if (result < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (openl2tp_retry == OPENL2TP_RETRY)
+				error("openl2tp send: %m");
+			openl2tp_client_close();
+			break;
+		}
+		if (result != slot->len) {
+			warn("openl2tp send: unexpected byte count %d, expected %d",
+			     result, slot->len);
+		}
+		dbglog("openl2tp send: sent %s, %d bytes",
+		       slot - openl2tp_pending == OPENL2TP_MSG_TYPE_PPP_ACCM_IND?
+		       "PPP_ACCM_IND": "PPP_UPDOWN_IND", result);
+		openl2tp_sent[slot - openl2tp_pending] = *slot;
+		slot->len = 0;
+	}
+
+	/* try again later */
+	dbglog("openl2tp send: will try again in %d seconds", openl2tp_retry);
+	openl2tp_waiting = 1;
+	ppp_timeout(openl2tp_flush, NULL, openl2tp_retry, 0);
+	openl2tp_retry *= 2;
+	if (openl2tp_retry > OPENL2TP_RETRY_MAX)
+		openl2tp_retry = OPENL2TP_RETRY_MAX;
+}
+
+static void openl2tp_send(struct openl2tp_event_msg *msg)
+{
+	struct openl2tp_slot *slot = &openl2tp_pending[msg->msg_type];
+	struct openl2tp_slot *sent = &openl2tp_sent[msg->msg_type];
+	int len = sizeof(*msg) + msg->msg_len;
+
+	if (!slot->len && sent->len == len && !memcmp(sent->buf, msg, len)) {
+		dbglog("openl2tp send: no change, not sending");
+		return;
+	}
+	if (slot->len)
+		dbglog("openl2tp send: replacing indication not yet sent");
+	memcpy(slot->buf, msg, len);
+	slot->len = len;
+	slot->seq = ++openl2tp_seq;
+
+	/* while resends are backing off, just leave it with the others */
+	if (!openl2tp_waiting)
+		openl2tp_flush(NULL);
+}
+
+/* Make a last try with anything still waiting */
+static void openl2tp_exit(void *opaque, int arg)
+{
+	if (openl2tp_waiting) {
+		ppp_untimeout(openl2tp_flush, NULL);
+		openl2tp_flush(NULL);
+		ppp_untimeout(openl2tp_flush, NULL);
+	}
+}
+
 static void openl2tp_send_accm_ind(int tunnel_id, int session_id,
 				   uint32_t send_accm, uint32_t recv_accm)
 {
-	int result;
 	uint8_t buf[OPENL2TP_MSG_MAX_LEN];
 	struct openl2tp_event_msg *msg = (void *) &buf[0];
 	struct openl2tp_event_tlv *tlv;
@@ -124,13 +261,7 @@ static void openl2tp_send_accm_ind(int tunnel_id, int session_id,
 	uint16_t sid = session_id;
 	struct openl2tp_tlv_ppp_accm accm;
 
-	if (openl2tp_fd < 0) {
-		result = openl2tp_client_create();
-		if (result < 0) {
-			goto out;
-		}
-	}
-
+	memset(buf, 0, sizeof(buf));
 	accm.send_accm = send_accm;
 	accm.recv_accm = recv_accm;
 
@@ -156,18 +287,8 @@ static void openl2tp_send_accm_ind(int tunnel_id, int session_id,
 	memcpy(&tlv->tlv_value[0], &accm, tlv->tlv_len);
 	msg->msg_len += sizeof(*tlv) + ALIGN32(tlv->tlv_len);
 
-	result = send(openl2tp_fd, msg, sizeof(*msg) + msg->msg_len,
-		      MSG_NOSIGNAL);
-	if (result < 0) {
-		error("openl2tp send: %m");
-	}
-	if (result != (sizeof(*msg) + msg->msg_len)) {
-		warn("openl2tp send: unexpected byte count %d, expected %d",
-		     result, sizeof(msg) + msg->msg_len);
-	}
-	dbglog("openl2tp send: sent PPP_ACCM_IND, %d bytes", result);
+	openl2tp_send(msg);
 
-out:
 	if (old_pppol2tp_send_accm_hook != NULL) {
 		(*old_pppol2tp_send_accm_hook)(tunnel_id, session_id,
 					       send_accm, recv_accm);
@@ -177,7 +298,6 @@ out:
 
 static void openl2tp_ppp_updown_ind(int tunnel_id, int session_id, int up)
 {
-	int result;
 	uint8_t buf[OPENL2TP_MSG_MAX_LEN];
 	struct openl2tp_event_msg *msg = (void *) &buf[0];
 	struct openl2tp_event_tlv *tlv;
@@ -190,13 +310,7 @@ static void openl2tp_ppp_updown_ind(int tunnel_id, int session_id, int up)
 
 	unit = ppp_ifunit();
 	ppp_get_ifname(ifname, sizeof(ifname));
-
-	if (openl2tp_fd < 0) {
-		result = openl2tp_client_create();
-		if (result < 0) {
-			goto out;
-		}
-	}
+	memset(buf, 0, sizeof(buf));
 
 	if (!ppp_peer_authname(user_name, sizeof(user_name)))
 		user_name[0] = '\0';
@@ -243,18 +357,8 @@ static void openl2tp_ppp_updown_ind(int tunnel_id, int session_id, int up)
 		msg->msg_len += sizeof(*tlv) + ALIGN32(tlv->tlv_len);
 	}
 
-	result = send(openl2tp_fd, msg, sizeof(*msg) + msg->msg_len,
-		      MSG_NOSIGNAL);
-	if (result < 0) {
-		error("openl2tp send: %m");
-	}
-	if (result != (sizeof(*msg) + msg->msg_len)) {
-		warn("openl2tp send: unexpected byte count %d, expected %d",
-		     result, sizeof(msg) + msg->msg_len);
-	}
-	dbglog("openl2tp send: sent PPP_UPDOWN_IND, %d bytes", result);
+	openl2tp_send(msg);
 
-out:
 	if (old_pppol2tp_ip_updown_hook != NULL) {
 		(*old_pppol2tp_ip_updown_hook)(tunnel_id, session_id, up);
 	}
@@ -303,6 +407,8 @@ void plugin_init(void)
 	old_pppol2tp_ip_updown_hook = pppol2tp_ip_updown_hook;
 	pppol2tp_ip_updown_hook = openl2tp_ppp_updown_ind;
 
+	ppp_add_notify(NF_EXIT, openl2tp_exit, NULL);
+
 #ifdef PPP_WITH_MULTILINK
 	old_multilink_join_hook = multilink_join_hook;
 	multilink_join_hook = openl2tp_multilink_join_ind;
@@ -82,8 +82,7 @@ int pppol2tp_session_id = 0;
 static int device_got_set = 0;
 struct channel pppol2tp_channel;
 
-static void (*old_snoop_recv_hook)(unsigned char *p, int len) = NULL;
-static void (*old_snoop_send_hook)(unsigned char *p, int len) = NULL;
+static bool snooping;	/* pppol2tp_lcp_snoop is registered */
 
 /* Hook provided to allow other plugins to handle ACCM changes */
 void (*pppol2tp_send_accm_hook)(int tunnel_id, int session_id,
@@ -305,55 +304,23 @@ static void recv_config_pppol2tp(int mru,
  * This code is derived from Roaring Penguin L2TP.
  *****************************************************************************/
 
-static void pppol2tp_lcp_snoop(unsigned char *buf, int len, int incoming)
+static void pppol2tp_lcp_snoop(void *ctx, unsigned char *buf, int len,
+			       int incoming)
 {
 	static bool got_send_accm = 0;
 	static bool got_recv_accm = 0;
 	static uint32_t recv_accm = 0xffffffff;
 	static uint32_t send_accm = 0xffffffff;
-	static bool snooping = 1;
 
-	uint16_t protocol;
 	uint16_t lcp_pkt_len;
 	int opt, opt_len;
 	int reject;
 	unsigned char const *opt_data;
 	uint32_t accm;
 
-	/* Skip HDLC header */
-	buf += 2;
-	len -= 2;
-
-	/* Unreasonably short frame?? */
-	if (len <= 0) return;
-
-	/* Get protocol */
-	if (buf[0] & 0x01) {
-		/* Compressed protcol field */
-		protocol = buf[0];
-	} else {
-		protocol = ((unsigned int) buf[0]) * 256 + buf[1];
-	}
-
-	/* If it's a network protocol, stop snooping */
-	if (protocol <= 0x3fff) {
-		if (pppol2tp_debug_mask & PPPOL2TP_MSG_DEBUG) {
-			dbglog("Turning off snooping: "
-			       "Network protocol %04x found.",
-			       protocol);
-		}
-		snooping = 0;
-		return;
-	}
-
-	/* If it's not LCP, do not snoop */
-	if (protocol != 0xc021) {
-		return;
-	}
-
-	/* Skip protocol; go to packet data */
-	buf += 2;
-	len -= 2;
+	/* Skip HDLC header and protocol; only LCP is passed to us */
+	buf += PPP_HDRLEN;
+	len -= PPP_HDRLEN;
 
 	/* Unreasonably short frame?? */
 	if (len <= 0) return;
@@ -430,18 +397,22 @@ static void pppol2tp_lcp_snoop(unsigned char *buf, int len, int incoming)
 	}
 }
 
-static void pppol2tp_lcp_snoop_recv(unsigned char *p, int len)
+/* Snoop only while LCP is negotiating, so established links cost nothing */
+static void pppol2tp_snoop_phase(void *opaque, int phase)
 {
-	if (old_snoop_recv_hook != NULL)
-		(*old_snoop_recv_hook)(p, len);
-	pppol2tp_lcp_snoop(p, len, 1);
-}
-
-static void pppol2tp_lcp_snoop_send(unsigned char *p, int len)
-{
-	if (old_snoop_send_hook != NULL)
-		(*old_snoop_send_hook)(p, len);
-	pppol2tp_lcp_snoop(p, len, 0);
+	if (phase == PHASE_ESTABLISH && !snooping) {
+		if (pppol2tp_debug_mask & PPPOL2TP_MSG_CONTROL) {
+			dbglog("Enabling LCP snooping");
+		}
+		ppp_add_snoop(PPP_LCP, pppol2tp_lcp_snoop, NULL);
+		snooping = 1;
+	} else if (phase >= PHASE_NETWORK && snooping) {
+		if (pppol2tp_debug_mask & PPPOL2TP_MSG_DEBUG) {
+			dbglog("Turning off LCP snooping");
+		}
+		ppp_del_snoop(PPP_LCP, pppol2tp_lcp_snoop, NULL);
+		snooping = 0;
+	}
 }
 
 /*****************************************************************************
@@ -477,14 +448,7 @@ static void pppol2tp_check_options(void)
 		if ((pppol2tp_tunnel_id == 0) || (pppol2tp_session_id == 0)) {
 			fatal("tunnel_id/session_id values not specified");
 		}
-		if (pppol2tp_debug_mask & PPPOL2TP_MSG_CONTROL) {
-			dbglog("Enabling LCP snooping");
-		}
-		old_snoop_recv_hook = snoop_recv_hook;
-		old_snoop_send_hook = snoop_send_hook;
-
-		snoop_recv_hook = pppol2tp_lcp_snoop_recv;
-		snoop_send_hook = pppol2tp_lcp_snoop_send;
+		ppp_add_notify(NF_PHASE_CHANGE, pppol2tp_snoop_phase, NULL);
 	}
 }
 
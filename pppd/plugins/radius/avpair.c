@@ -20,6 +20,41 @@
 static void rc_extract_vendor_specific_attributes(int attrlen,
 						  unsigned char *ptr,
 						  VALUE_PAIR **vp);
+
+/*
+ * Pairs come from a pool of spare ones, which rc_avpair_free puts them
+ * back on, so that building a request and freeing it again doesn't go
+ * to malloc and free for every attribute.  Long-running sessions send
+ * the same sorts of request over and over, so a modest pool is enough
+ * to satisfy nearly every allocation.
+ */
+#define AVPAIR_POOL_MAX	256
+
+static VALUE_PAIR *avpair_pool;
+static int avpair_pool_count;
+
+static VALUE_PAIR *rc_avpair_alloc (void)
+{
+	VALUE_PAIR *vp;
+
+	if ((vp = avpair_pool) != NULL) {
+		avpair_pool = vp->next;
+		--avpair_pool_count;
+		return vp;
+	}
+	return (VALUE_PAIR *) malloc (sizeof (VALUE_PAIR));
+}
+
+static void rc_avpair_release (VALUE_PAIR *vp)
+{
+	if (avpair_pool_count >= AVPAIR_POOL_MAX) {
+		free (vp);
+		return;
+	}
+	vp->next = avpair_pool;
+	avpair_pool = vp;
+	++avpair_pool_count;
+}
 /*
  * Function: rc_avpair_add
  *
@@ -118,7 +153,7 @@ VALUE_PAIR *rc_avpair_new (int attrid, const void *pval, int len, int vendorcode
 	}
 	else
 	{
-		if ((vp = (VALUE_PAIR *) malloc (sizeof (VALUE_PAIR)))
+		if ((vp = rc_avpair_alloc ())
 							!= (VALUE_PAIR *) NULL)
 		{
 			strlcpy (vp->name, pda->name, NAME_LENGTH);
@@ -130,7 +165,7 @@ VALUE_PAIR *rc_avpair_new (int attrid, const void *pval, int len, int vendorcode
 			{
 				return vp;
 			}
-			free (vp);
+			rc_avpair_release (vp);
 			vp = (VALUE_PAIR *) NULL;
 		}
 		else
@@ -204,9 +239,7 @@ VALUE_PAIR *rc_avpair_gen (AUTH_HDR *auth)
 		}
 		else
 		{
-			if ((pair =
-				(VALUE_PAIR *) malloc (sizeof (VALUE_PAIR))) ==
-					(VALUE_PAIR *) NULL)
+			if ((pair = rc_avpair_alloc ()) == (VALUE_PAIR *) NULL)
 			{
 				novm("rc_avpair_gen");
 				rc_avpair_free(vp);
@@ -241,7 +274,7 @@ VALUE_PAIR *rc_avpair_gen (AUTH_HDR *auth)
 
 			    default:
 				warn("rc_avpair_gen: %s has unknown type", attr->name);
-				free (pair);
+				rc_avpair_release (pair);
 				break;
 			}
 
@@ -308,7 +341,7 @@ static void rc_extract_vendor_specific_attributes(int attrlen,
 	}
 
 	/* TODO: Check that length matches data size!!!!! */
-	pair = (VALUE_PAIR *) malloc(sizeof(VALUE_PAIR));
+	pair = rc_avpair_alloc();
 	if (!pair) {
 	    novm("rc_avpair_gen");
 	    return;
@@ -336,7 +369,7 @@ static void rc_extract_vendor_specific_attributes(int attrlen,
 
 	default:
 	    warn("rc_avpair_gen: %s has unknown type", attr->name);
-	    free (pair);
+	    rc_avpair_release (pair);
 	    break;
 	}
     }
@@ -372,7 +405,7 @@ VALUE_PAIR *rc_avpair_copy(VALUE_PAIR *p)
 	VALUE_PAIR *vp, *fp = NULL, *lp = NULL;
 
 	while (p) {
-		vp = malloc(sizeof(VALUE_PAIR));
+		vp = rc_avpair_alloc();
 		if (!vp) {
 		    novm("rc_avpair_copy");
 		    return NULL; /* leaks a little but so what */
@@ -462,7 +495,7 @@ void rc_avpair_free (VALUE_PAIR *pair)
 	while (pair != (VALUE_PAIR *) NULL)
 	{
 		next = pair->next;
-		free (pair);
+		rc_avpair_release (pair);
 		pair = next;
 	}
 }
@@ -580,9 +613,7 @@ int rc_avpair_parse (char *buffer, VALUE_PAIR **first_pair)
 		    case PARSE_MODE_VALUE:		/* Value */
 			rc_fieldcpy (valstr, &buffer);
 
-			if ((pair =
-				(VALUE_PAIR *) malloc (sizeof (VALUE_PAIR)))
-							== (VALUE_PAIR *) NULL)
+			if ((pair = rc_avpair_alloc ()) == (VALUE_PAIR *) NULL)
 			{
 				novm("rc_avpair_parse");
 				if (*first_pair) {
@@ -619,7 +650,7 @@ int rc_avpair_parse (char *buffer, VALUE_PAIR **first_pair)
 							rc_avpair_free(*first_pair);
 							*first_pair = (VALUE_PAIR *) NULL;
 						}
-						free (pair);
+						rc_avpair_release (pair);
 						return (-1);
 					}
 					else
@@ -653,7 +684,7 @@ int rc_avpair_parse (char *buffer, VALUE_PAIR **first_pair)
 					rc_avpair_free(*first_pair);
 					*first_pair = (VALUE_PAIR *) NULL;
 				}
-				free (pair);
+				rc_avpair_release (pair);
 				return (-1);
 			}
 			pair->next = (VALUE_PAIR *) NULL;
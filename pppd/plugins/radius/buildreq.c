@@ -86,68 +86,20 @@ static unsigned char rc_guess_seqnbr(void)
 /*
  * Function: rc_get_seqnbr
  *
- * Purpose: generate a sequence number
+ * Purpose: generate a sequence number.  It is only a starting point:
+ *	    rc_send_server picks the next one that isn't in use on the
+ *	    server's socket, which belongs to this pppd alone.
  *
  */
 
 unsigned char rc_get_seqnbr(void)
 {
-	FILE *sf;
-	int tries = 1;
-	int seq_nbr, pos, ret;
-	char *seqfile = rc_conf_str("seqfile");
+	static int seq_nbr = -1;
 
-	if ((sf = fopen(seqfile, "a+")) == NULL)
-	{
-		error("rc_get_seqnbr: couldn't open sequence file %s: %s", seqfile, strerror(errno));
-		/* well, so guess a sequence number */
-		return rc_guess_seqnbr();
-	}
-
-	while (do_lock_exclusive(fileno(sf))!= 0)
-	{
-		if (errno != EWOULDBLOCK) {
-			error("rc_get_seqnbr: flock failure: %s: %s", seqfile, strerror(errno));
-			fclose(sf);
-			return rc_guess_seqnbr();
-		}
-		tries++;
-		if (tries <= 10)
-			rc_mdelay(500);
-		else
-			break;
-	}
-
-	if (tries > 10) {
-		error("rc_get_seqnbr: couldn't get lock after %d tries: %s", tries-1, seqfile);
-		fclose(sf);
-		return rc_guess_seqnbr();
-	}
-
-	pos = ftell(sf);
-	rewind(sf);
-	if (fscanf(sf, "%d", &seq_nbr) != 1) {
-		if (pos != ftell(sf)) {
-			/* file was not empty */
-			error("rc_get_seqnbr: fscanf failure: %s", seqfile);
-		}
+	if (seq_nbr < 0)
 		seq_nbr = rc_guess_seqnbr();
-	}
-
-	rewind(sf);
-	ret = ftruncate(fileno(sf),0);
-	if (ret != 0) {
-		error("rc_get_seqnbr: couldn't truncate sequence file, %m");
-	}
-	fprintf(sf,"%d\n", (seq_nbr+1) & UCHAR_MAX);
-
-	fflush(sf); /* fflush because a process may read it between the do_unlock and fclose */
-
-	if (do_unlock(fileno(sf)) != 0)
-		error("rc_get_seqnbr: couldn't release lock on %s: %s", seqfile, strerror(errno));
-
-	fclose(sf);
-
+	else
+		seq_nbr = (seq_nbr + 1) & UCHAR_MAX;
 	return (unsigned char)seq_nbr;
 }
 
@@ -193,8 +145,9 @@ int rc_auth_using_server(SERVER *authserver,
 			 char *msg, REQUEST_INFO *info)
 {
 	SEND_DATA       data;
+	SEND_DATA	reqs[SERVER_MAX];
 	int		result;
-	int		i;
+	int		i, n, pass, winner;
 	int		timeout = rc_conf_int("radius_timeout");
 	int		retries = rc_conf_int("radius_retries");
 
@@ -215,21 +168,34 @@ int rc_auth_using_server(SERVER *authserver,
 	if (rc_avpair_add(&(data.send_pairs), PW_NAS_PORT, &client_port, 0, VENDOR_NONE) == NULL)
 		return (ERROR_RC);
 
-	result = ERROR_RC;
-	for(i=0; (i<authserver->max) && (result != OK_RC) && (result != BADRESP_RC)
-		; i++)
-	{
-		if (data.receive_pairs != NULL) {
-			rc_avpair_free(data.receive_pairs);
-			data.receive_pairs = NULL;
+	/*
+	 * Ask the servers in order, except that ones which have stopped
+	 * answering go last, and don't wait for one to time out before
+	 * trying the next; see rc_send_hedged.
+	 */
+	n = 0;
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < authserver->max; i++) {
+			if (rc_server_usable(authserver->name[i],
+					     authserver->port[i]) != (pass == 0))
+				continue;
+			reqs[n] = data;
+			rc_buildreq(&reqs[n], PW_ACCESS_REQUEST, authserver->name[i],
+				    authserver->port[i], timeout, retries);
+			n++;
 		}
-		rc_buildreq(&data, PW_ACCESS_REQUEST, authserver->name[i],
-			    authserver->port[i], timeout, retries);
-
-		result = rc_send_server (&data, msg, info);
 	}
 
-	*received = data.receive_pairs;
+	winner = -1;
+	result = rc_send_hedged(reqs, n, msg, info, &winner);
+
+	*received = NULL;
+	for (i = 0; i < n; i++) {
+		if (i == winner)
+			*received = reqs[i].receive_pairs;
+		else
+			rc_avpair_free(reqs[i].receive_pairs);
+	}
 
 	return result;
 }
@@ -369,6 +335,140 @@ int rc_acct(UINT4 client_port, VALUE_PAIR *send)
     return rc_acct_using_server(acctserver, client_port, send);
 }
 
+/*
+ * State of an rc_acct_async request, as it works through the servers.
+ */
+struct rc_acct_state
+{
+	SEND_DATA	data;
+	SERVER		*acctserver;
+	int		server;		/* index of the server being tried */
+	int		result;
+	VALUE_PAIR	*adt_vp;	/* Acct-Delay-Time */
+	UINT4		delay;		/* its value when we were given it */
+	struct timeval	start_time;
+	int		timeout;
+	int		retries;
+	rc_acct_done_fn	*done;
+	void		*arg;
+};
+
+static void rc_acct_async_next(struct rc_acct_state *st);
+
+static void rc_acct_async_reply(int result, SEND_DATA *data, char *msg, void *arg)
+{
+	struct rc_acct_state *st = arg;
+
+	rc_avpair_free(data->receive_pairs);
+	data->receive_pairs = NULL;
+	st->result = result;
+	if (result != OK_RC && result != BADRESP_RC)
+		++st->server;
+	rc_acct_async_next(st);
+}
+
+static void rc_acct_async_next(struct rc_acct_state *st)
+{
+	struct timeval	dtime;
+
+	while (st->result != OK_RC && st->result != BADRESP_RC
+	       && st->server < st->acctserver->max)
+	{
+		/* pass over a server that isn't answering, if there's another */
+		if (st->server < st->acctserver->max - 1
+		    && !rc_server_usable(st->acctserver->name[st->server],
+					 st->acctserver->port[st->server])) {
+			++st->server;
+			continue;
+		}
+		rc_buildreq(&st->data, PW_ACCOUNTING_REQUEST,
+			    st->acctserver->name[st->server],
+			    st->acctserver->port[st->server],
+			    st->timeout, st->retries);
+
+		ppp_get_time(&dtime);
+		dtime.tv_sec -= st->start_time.tv_sec;
+		dtime.tv_sec += st->delay;
+		rc_avpair_assign(st->adt_vp, &dtime.tv_sec, 0);
+
+		if (rc_send_server_async(&st->data, NULL, rc_acct_async_reply, st) == OK_RC)
+			return;
+		st->result = ERROR_RC;
+		++st->server;
+	}
+
+	(*st->done)(st->result, st->arg);
+	rc_avpair_free(st->data.send_pairs);
+	free(st);
+}
+
+/*
+ * Function: rc_acct_using_server_async
+ *
+ * Purpose: like rc_acct_using_server, but returns without waiting for
+ *	    the servers to answer; done(result, arg) is called, perhaps
+ *	    before this returns, once one has or they have all failed.
+ *	    Takes over send, which is freed when the request completes.
+ *
+ */
+
+void rc_acct_using_server_async(SERVER *acctserver,
+				UINT4 client_port,
+				VALUE_PAIR *send,
+				rc_acct_done_fn *done, void *arg)
+{
+	struct rc_acct_state *st;
+	UINT4		delay = 0;
+
+	if ((st = malloc(sizeof(*st))) == NULL) {
+		rc_avpair_free(send);
+		(*done)(ERROR_RC, arg);
+		return;
+	}
+	memset(st, 0, sizeof(*st));
+	st->data.send_pairs = send;
+	st->acctserver = acctserver;
+	st->result = ERROR_RC;
+	st->timeout = rc_conf_int("radius_timeout");
+	st->retries = rc_conf_int("radius_retries");
+	st->done = done;
+	st->arg = arg;
+
+	/*
+	 * Fill in NAS-IP-Address or NAS-Identifier, NAS-Port
+	 * and Acct-Delay-Time, adding to any Acct-Delay-Time
+	 * already there (for a request that has been queued)
+	 */
+
+	if ((st->adt_vp = rc_avpair_get(send, PW_ACCT_DELAY_TIME)) != NULL)
+		st->delay = st->adt_vp->lvalue;
+	if (acctserver == NULL
+	    || rc_get_nas_id(&(st->data.send_pairs)) == ERROR_RC
+	    || rc_avpair_add(&(st->data.send_pairs), PW_NAS_PORT, &client_port,
+			     0, VENDOR_NONE) == NULL
+	    || (st->adt_vp == NULL
+		&& (st->adt_vp = rc_avpair_add(&(st->data.send_pairs), PW_ACCT_DELAY_TIME,
+					       &delay, 0, VENDOR_NONE)) == NULL))
+		st->server = acctserver? acctserver->max: 0;
+
+	ppp_get_time(&st->start_time);
+	rc_acct_async_next(st);
+}
+
+/*
+ * Function: rc_acct_async
+ *
+ * Purpose: rc_acct_using_server_async with the configured servers
+ *
+ */
+
+void rc_acct_async(UINT4 client_port, VALUE_PAIR *send,
+		   rc_acct_done_fn *done, void *arg)
+{
+	rc_acct_using_server_async(rc_conf_srv("acctserver"), client_port,
+				   send, done, arg);
+}
+
 /*
  * Function: rc_acct_proxy
  *
@@ -19,7 +19,23 @@ struct map2id_s {
 	struct map2id_s *next;
 };
 
-static struct map2id_s *map2id_list = NULL;
+/*
+ * The map is kept in a hash table of chains by name.  Entries go on
+ * the front of their chain, so a name listed twice gets the id from
+ * its last line.
+ */
+#define MAP2ID_HASH_SIZE	256
+
+static struct map2id_s *map2id_hash[MAP2ID_HASH_SIZE];
+
+static unsigned int map2id_hashval(const char *name)
+{
+	unsigned int h = 2166136261U;	/* FNV-1a */
+
+	while (*name)
+		h = (h ^ (unsigned char) *name++) * 16777619U;
+	return h % MAP2ID_HASH_SIZE;
+}
 
 /*
  * Function: rc_read_mapfile
@@ -37,6 +53,7 @@ int rc_read_mapfile(char *filename)
 	FILE *mapfd;
 	char *c, *name, *id, *q;
 	struct map2id_s *p;
+	unsigned int h;
 	int lnr = 0;
 
 	if ((mapfd = fopen(filename,"r")) == NULL)
@@ -72,10 +89,16 @@ int rc_read_mapfile(char *filename)
 				return (-1);
 			}
 
-			p->name = strdup(name);
+			if ((p->name = strdup(name)) == NULL) {
+				novm("rc_read_mapfile");
+				free(p);
+				fclose(mapfd);
+				return (-1);
+			}
 			p->id = atoi(id);
-			p->next = map2id_list;
-			map2id_list = p;
+			h = map2id_hashval(p->name);
+			p->next = map2id_hash[h];
+			map2id_hash[h] = p;
 
 		} else {
 
@@ -114,7 +137,7 @@ UINT4 rc_map2id(const char *name)
 
 	strncat(ttyname, name, sizeof(ttyname) - strlen(ttyname) -1);
 
-	for(p = map2id_list; p; p = p->next)
+	for(p = map2id_hash[map2id_hashval(ttyname)]; p; p = p->next)
 		if (!strcmp(ttyname, p->name)) return p->id;
 
 	warn("rc_map2id: can't find tty %s in map database", ttyname);
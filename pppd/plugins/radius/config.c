@@ -20,6 +20,20 @@
 
 static int test_config(char *);
 
+/* option_index[h] is 1 + the index in config_options of a name hashing to h */
+#define OPTION_HASH_SIZE	64
+
+static unsigned char option_index[OPTION_HASH_SIZE];
+
+static unsigned int option_hash(const char *name)
+{
+	unsigned int h = 0;
+
+	while (*name)
+		h = h * 31 + (unsigned char) *name++;
+	return h % OPTION_HASH_SIZE;
+}
+
 /*
  * Function: find_option
  *
@@ -30,13 +44,25 @@ static int test_config(char *);
 
 static OPTION *find_option(char *optname, unsigned int type)
 {
+	unsigned int h;
 	int i;
 
-	/* there're so few options that a binary search seems not necessary */
-	for (i = 0; i < num_options; i++) {
-		if (!strcmp(config_options[i].name, optname) &&
-		    (config_options[i].type & type))
-			return &config_options[i];
+	/* the options are looked up on every request, so index them */
+	if (option_index[option_hash(config_options[0].name)] == 0) {
+		for (i = 0; i < num_options; i++) {
+			h = option_hash(config_options[i].name);
+			while (option_index[h] != 0)
+				h = (h + 1) % OPTION_HASH_SIZE;
+			option_index[h] = i + 1;
+		}
+	}
+
+	for (h = option_hash(optname); option_index[h] != 0;
+	     h = (h + 1) % OPTION_HASH_SIZE) {
+		i = option_index[h] - 1;
+		if (!strcmp(config_options[i].name, optname))
+			return (config_options[i].type & type)?
+				&config_options[i]: NULL;
 	}
 
 	return NULL;
@@ -83,9 +109,9 @@ static int set_option_int(char *filename, int line, OPTION *option, char *p)
 static int set_option_srv(char *filename, int line, OPTION *option, char *p)
 {
 	SERVER *serv;
-	char *q;
+	char *q, *r;
 	struct servent *svp;
-	int i;
+	int i, tls;
 
 	if (p == NULL) {
 		error("%s: line %d: bogus option value", filename, line);
@@ -101,10 +127,21 @@ static int set_option_srv(char *filename, int line, OPTION *option, char *p)
 
 	while ((p = strtok(p, ", \t")) != NULL) {
 
+		tls = 0;
 		if ((q = strchr(p,':')) != NULL) {
 			*q = '\0';
 			q++;
+			if ((r = strchr(q, ':')) != NULL) {
+				*r++ = '\0';
+				if (strcmp(r, "tls") != 0) {
+					error("%s: line %d: bogus server transport %s", filename, line, r);
+					return (-1);
+				}
+				tls = 1;
+			}
 			serv->port[serv->max] = atoi(q);
+			if (*q == '\0' && tls)
+				serv->port[serv->max] = PW_RADSEC_TCP_PORT;
 		} else {
 			if (!strcmp(option->name,"authserver"))
 				if ((svp = getservbyname ("radius", "udp")) == NULL)
@@ -122,6 +159,8 @@ static int set_option_srv(char *filename, int line, OPTION *option, char *p)
 			}
 		}
 
+		if (tls && rc_radsec_add(p, serv->port[serv->max]) < 0)
+			return (-1);
 		serv->name[serv->max++] = strdup(p);
 
 		p = NULL;
@@ -235,24 +274,28 @@ int rc_read_config(char *filename)
 
 		switch (option->type) {
 			case OT_STR:
-				 if (set_option_str(filename, line, option, p) < 0)
+				if (set_option_str(filename, line, option, p) < 0) {
 					fclose(configfd);
 					return (-1);
+				}
 				break;
 			case OT_INT:
-				 if (set_option_int(filename, line, option, p) < 0)
+				if (set_option_int(filename, line, option, p) < 0) {
 					fclose(configfd);
 					return (-1);
+				}
 				break;
 			case OT_SRV:
-				 if (set_option_srv(filename, line, option, p) < 0)
+				if (set_option_srv(filename, line, option, p) < 0) {
 					fclose(configfd);
 					return (-1);
+				}
 				break;
 			case OT_AUO:
-				 if (set_option_auo(filename, line, option, p) < 0)
+				if (set_option_auo(filename, line, option, p) < 0) {
 					fclose(configfd);
 					return (-1);
+				}
 				break;
 			default:
 				fatal("rc_read_config: impossible case branch!");
@@ -382,11 +425,6 @@ static int test_config(char *filename)
 		error("%s: login_tries <= 0 is illegal", filename);
 		return (-1);
 	}
-	if (rc_conf_str("seqfile") == NULL)
-	{
-		error("%s: seqfile not specified", filename);
-		return (-1);
-	}
 	if (rc_conf_int("login_timeout") <= 0)
 	{
 		error("%s: login_timeout <= 0 is illegal", filename);
@@ -417,9 +455,8 @@ static int test_config(char *filename)
 
 static int find_match (UINT4 *ip_addr, char *hostname)
 {
-	UINT4           addr;
-	char          **paddr;
-	struct hostent *hp;
+	const UINT4    *addrs;
+	int		i, n;
 
 	if (rc_good_ipaddr (hostname) == 0)
 	{
@@ -430,14 +467,10 @@ static int find_match (UINT4 *ip_addr, char *hostname)
 	}
 	else
 	{
-		if ((hp = gethostbyname (hostname)) == (struct hostent *) NULL)
+		n = rc_host_addrs (hostname, &addrs);
+		for (i = 0; i < n; i++)
 		{
-			return (-1);
-		}
-		for (paddr = hp->h_addr_list; *paddr; paddr++)
-		{
-			addr = ** (UINT4 **) paddr;
-			if (ntohl(addr) == *ip_addr)
+			if (addrs[i] == *ip_addr)
 			{
 				return (0);
 			}
@@ -447,39 +480,67 @@ static int find_match (UINT4 *ip_addr, char *hostname)
 }
 
 /*
- * Function: rc_find_server
+ * The servers file is read into memory, and read again only if it
+ * has changed.  We look at it at most once every
+ * SERVERS_RECHECK_TIME seconds to see whether it has.
+ */
+#define SERVERS_RECHECK_TIME	10
+
+struct server_entry
+{
+	char		host1[AUTH_ID_LEN + 1];
+	char		host2[AUTH_ID_LEN + 1];
+	int		paired;			/* <name1>/<name2> form */
+	char		secret[MAX_SECRET_LENGTH + 1];
+};
+
+static struct server_entry *server_entries;
+static int		num_server_entries;
+static int		servers_read;
+static struct stat	servers_stat;		/* of the file we read */
+static time_t		servers_checked;
+
+/*
+ * Function: read_servers
  *
- * Purpose: search a server in the servers file
+ * Purpose: read the servers file, if it has changed since last time
  *
  * Returns: 0 on success, -1 on failure
  *
  */
 
-int rc_find_server (char *server_name, UINT4 *ip_addr, char *secret)
+static int read_servers (void)
 {
-	UINT4	myipaddr = 0;
-	int             len;
-	int             result;
+	char           *file = rc_conf_str("servers");
+	struct server_entry *entries = NULL, *e;
+	int		n = 0, max = 0;
+	struct timeval	now;
+	struct stat	st;
 	FILE           *clientfd;
 	char           *h;
 	char           *s;
-	char           *host2;
 	char            buffer[128];
-	char            hostnm[AUTH_ID_LEN + 1];
 
-	/* Get the IP address of the authentication server */
-	if ((*ip_addr = rc_get_ipaddr (server_name)) == (UINT4) 0)
-		return (-1);
+	ppp_get_time (&now);
+	if (servers_read && now.tv_sec < servers_checked + SERVERS_RECHECK_TIME)
+		return 0;
+	servers_checked = now.tv_sec;
 
-	if ((clientfd = fopen (rc_conf_str("servers"), "r")) == (FILE *) NULL)
+	if ((clientfd = fopen (file, "r")) == (FILE *) NULL)
 	{
-		error("rc_find_server: couldn't open file: %m: %s", rc_conf_str("servers"));
+		error("rc_find_server: couldn't open file: %m: %s", file);
 		return (-1);
 	}
+	if (fstat (fileno (clientfd), &st) < 0)
+		memset (&st, '\0', sizeof (st));
+	else if (servers_read
+	    && st.st_ino == servers_stat.st_ino && st.st_dev == servers_stat.st_dev
+	    && st.st_mtime == servers_stat.st_mtime && st.st_size == servers_stat.st_size)
+	{
+		fclose (clientfd);
+		return 0;
+	}
 
-	myipaddr = rc_own_ipaddress();
-
-	result = 0;
 	while (fgets (buffer, sizeof (buffer), clientfd) != (char *) NULL)
 	{
 		if (*buffer == '#')
@@ -488,52 +549,101 @@ int rc_find_server (char *server_name, UINT4 *ip_addr, char *secret)
 		if ((h = strtok (buffer, " \t\n")) == NULL) /* first hostname */
 			continue;
 
-		memset (hostnm, '\0', AUTH_ID_LEN + 1);
-		strlcpy (hostnm, h, AUTH_ID_LEN + 1);
-
 		if ((s = strtok (NULL, " \t\n")) == NULL) /* and secret field */
 			continue;
 
-		memset (secret, '\0', MAX_SECRET_LENGTH + 1);
-		strlcpy (secret, s, MAX_SECRET_LENGTH + 1);
-
-		if (!strchr (hostnm, '/')) /* If single name form */
+		if (n == max)
 		{
-			if (find_match (ip_addr, hostnm) == 0)
+			max = max? 2 * max: 16;
+			e = realloc (entries, max * sizeof (*entries));
+			if (e == NULL)
 			{
-				result++;
-				break;
+				error("rc_find_server: out of memory");
+				fclose (clientfd);
+				memset (entries, '\0', n * sizeof (*entries));
+				free (entries);
+				return (-1);
 			}
+			entries = e;
+		}
+		e = &entries[n++];
+		memset (e, '\0', sizeof (*e));
+		strlcpy (e->host1, h, sizeof (e->host1));
+		strlcpy (e->secret, s, sizeof (e->secret));
+		if (strchr (e->host1, '/'))	/* "paired" form */
+		{
+			e->paired = 1;
+			strtok (e->host1, "/");
+			if ((h = strtok (NULL, " ")) != NULL)
+				strlcpy (e->host2, h, sizeof (e->host2));
+		}
+	}
+	fclose (clientfd);
+	memset (buffer, '\0', sizeof (buffer));
+
+	if (server_entries != NULL)
+		memset (server_entries, '\0', num_server_entries * sizeof (*server_entries));
+	free (server_entries);
+	server_entries = entries;
+	num_server_entries = n;
+	servers_stat = st;
+	servers_read = 1;
+	return 0;
+}
+
+/*
+ * Function: rc_find_server
+ *
+ * Purpose: search a server in the servers file
+ *
+ * Returns: 0 on success, -1 on failure
+ *
+ */
+
+int rc_find_server (char *server_name, UINT4 *ip_addr, char *secret)
+{
+	UINT4	myipaddr = 0;
+	struct server_entry *e = NULL;
+	int		i;
+
+	/* Get the IP address of the authentication server */
+	if ((*ip_addr = rc_get_ipaddr (server_name)) == (UINT4) 0)
+		return (-1);
+
+	if (read_servers () != 0)
+		return (-1);
+
+	myipaddr = rc_own_ipaddress();
+
+	for (i = 0; i < num_server_entries; i++)
+	{
+		e = &server_entries[i];
+		if (!e->paired) /* If single name form */
+		{
+			if (find_match (ip_addr, e->host1) == 0)
+				break;
 		}
 		else /* <name1>/<name2> "paired" form */
 		{
-			strtok (hostnm, "/");
-			if (find_match (&myipaddr, hostnm) == 0)
+			if (find_match (&myipaddr, e->host1) == 0)
 			{	     /* If we're the 1st name, target is 2nd */
-				host2 = strtok (NULL, " ");
-				if (find_match (ip_addr, host2) == 0)
-				{
-					result++;
+				if (find_match (ip_addr, e->host2) == 0)
 					break;
-				}
 			}
 			else	/* If we were 2nd name, target is 1st name */
 			{
-				if (find_match (ip_addr, hostnm) == 0)
-				{
-					result++;
+				if (find_match (ip_addr, e->host1) == 0)
 					break;
-				}
 			}
 		}
 	}
-	fclose (clientfd);
-	if (result == 0)
+	if (i == num_server_entries)
 	{
-		memset (buffer, '\0', sizeof (buffer));
 		error("rc_find_server: couldn't find RADIUS server %s in %s",
 		      server_name, rc_conf_str("servers"));
 		return (-1);
 	}
+	memset (secret, '\0', MAX_SECRET_LENGTH + 1);
+	strlcpy (secret, e->secret, MAX_SECRET_LENGTH + 1);
 	return 0;
 }
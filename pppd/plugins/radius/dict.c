@@ -19,21 +19,440 @@
 #include <includes.h>
 #include <radiusclient.h>
 
-static DICT_ATTR *dictionary_attributes = NULL;
-static DICT_VALUE *dictionary_values = NULL;
-static VENDOR_DICT *vendor_dictionaries = NULL;
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * The dictionary is kept in three arrays, of attributes, values and
+ * vendors, with hash indexes over them: for each index, the first
+ * entry on each chain and, for each entry, the next one on its chain,
+ * or -1.  Entries go on the front of their chain, so a later
+ * definition hides an earlier one with the same key.  Names are
+ * hashed without regard to case, since attribute and value names are
+ * looked up that way.
+ *
+ * Since none of that holds a pointer, it can be written to a file as
+ * it is and mapped by the next pppd, which then shares the pages with
+ * every other pppd instead of parsing the dictionary into a heap of
+ * its own.  The cache in the runtime directory records the size,
+ * inode and modification time of each dictionary file read into it,
+ * and is only used while they all still have them.
+ */
+#define DICT_HASH_SIZE	256
+
+#define DICT_ATTR_BY_CODE	0	/* (vendor, attribute) */
+#define DICT_ATTR_BY_NAME	1
+#define DICT_VALUE_BY_NAME	2
+#define DICT_VALUE_BY_ATTR	3	/* (attribute name, value) */
+#define DICT_VENDOR_BY_CODE	4
+#define DICT_NINDEX		5
+
+static struct
+{
+	DICT_ATTR	*attrs;
+	DICT_VALUE	*values;
+	VENDOR_DICT	*vendors;
+	int32_t		*heads;		/* DICT_NINDEX * DICT_HASH_SIZE */
+	int32_t		*next[DICT_NINDEX];
+	uint32_t	nattrs, nvalues, nvendors;
+	uint32_t	max_attrs, max_values, max_vendors;
+} dict;
+
+/* the files we read, to be recorded in the cache */
+#define DICT_MAX_FILES	16
+#define DICT_PATH_LEN	256
+
+struct dict_file
+{
+	char		path[DICT_PATH_LEN];
+	uint64_t	dev;
+	uint64_t	ino;
+	uint64_t	size;
+	int64_t		mtime;
+	uint32_t	mtime_nsec;
+	uint32_t	pad;
+};
+
+static struct dict_file dict_files[DICT_MAX_FILES];
+static int dict_nfiles;		/* > DICT_MAX_FILES if too many */
+
+#define DICT_CACHE_MAGIC	0x52444354	/* "RDCT" */
+#define DICT_CACHE_VERSION	1
+
+/*
+ * The cache is this header, then the files, attributes, values,
+ * vendors, chain heads and the next arrays of each index in that
+ * order, each padded to a multiple of 8 bytes, in the byte order of
+ * the host which wrote it.
+ */
+struct dict_cache_header
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	attr_size;	/* the sizes of our structures */
+	uint32_t	value_size;
+	uint32_t	vendor_size;
+	uint32_t	hash_size;
+	uint32_t	nfiles;
+	uint32_t	nattrs;
+	uint32_t	nvalues;
+	uint32_t	nvendors;
+	uint64_t	len;
+};
+
+static char	*dict_map;	/* the cache, if we are using it */
+static size_t	dict_map_len;
+
+static int rc_parse_dictionary (char *filename);
+
+static unsigned int dict_hash_name (const char *name, unsigned int h)
+{
+	while (*name)
+		h = h * 31 + tolower ((unsigned char) *name++);
+	return h;
+}
+
+static unsigned int dict_hash_code (int vendor, int code)
+{
+	unsigned int h = (unsigned int) vendor * 2654435761U + (unsigned int) code;
+
+	return h ^ (h >> 8);
+}
+
+/* the first entry on the chain for hash in index ix */
+#define DICT_HEAD(ix, hash)	dict.heads[(ix) * DICT_HASH_SIZE + (hash) % DICT_HASH_SIZE]
+
+static void dict_link (int ix, unsigned int hash, int32_t i)
+{
+	dict.next[ix][i] = DICT_HEAD (ix, hash);
+	DICT_HEAD (ix, hash) = i;
+}
+
+/*
+ * dict_grow - make room for entry n in an array of entries of the
+ * given size, and in the next arrays of the indexes ix1 and ix2 over
+ * it (ix2 may be -1).
+ */
+static int dict_grow (void **items, size_t size, uint32_t n, uint32_t *max,
+		      int ix1, int ix2)
+{
+	uint32_t	m;
+	void		*p;
+	int		i;
+
+	if (dict.heads == NULL)
+	{
+		dict.heads = malloc (DICT_NINDEX * DICT_HASH_SIZE * sizeof (int32_t));
+		if (dict.heads == NULL)
+			return -1;
+		for (i = 0; i < DICT_NINDEX * DICT_HASH_SIZE; ++i)
+			dict.heads[i] = -1;
+	}
+	if (n < *max)
+		return 0;
+	m = *max ? *max * 2 : 64;
+	if ((p = realloc (*items, m * size)) == NULL)
+		return -1;
+	*items = p;
+	if ((p = realloc (dict.next[ix1], m * sizeof (int32_t))) == NULL)
+		return -1;
+	dict.next[ix1] = p;
+	if (ix2 >= 0)
+	{
+		if ((p = realloc (dict.next[ix2], m * sizeof (int32_t))) == NULL)
+			return -1;
+		dict.next[ix2] = p;
+	}
+	*max = m;
+	return 0;
+}
+
+/* dict_note_file - remember the identity of a file we have opened */
+static void dict_note_file (char *filename, FILE *f)
+{
+	struct dict_file *df;
+	struct stat	sbuf;
+
+	if (dict_nfiles >= DICT_MAX_FILES || strlen (filename) >= DICT_PATH_LEN
+	    || fstat (fileno (f), &sbuf) < 0)
+	{
+		dict_nfiles = DICT_MAX_FILES + 1;
+		return;
+	}
+	df = &dict_files[dict_nfiles++];
+	memset (df, 0, sizeof (*df));
+	strcpy (df->path, filename);
+	df->dev = sbuf.st_dev;
+	df->ino = sbuf.st_ino;
+	df->size = sbuf.st_size;
+	df->mtime = sbuf.st_mtim.tv_sec;
+	df->mtime_nsec = sbuf.st_mtim.tv_nsec;
+}
+
+/* dict_cache_name - the name of the cache for the dictionary filename */
+static int dict_cache_name (char *filename, char *buf, size_t len)
+{
+	char		dir[PATH_MAX];
+
+	if (ppp_get_path (PPP_DIR_RUNTIME, dir, sizeof (dir)) < 0)
+		return -1;
+	if (snprintf (buf, len, "%s/radius-dict-%08x.db", dir,
+		      dict_hash_name (filename, 0)) >= len)
+		return -1;
+	return 0;
+}
+
+#define DICT_ALIGN(n)	(((n) + 7) & ~(uint64_t) 7)
+
+/*
+ * dict_cache_layout - work out where each part of a cache with the
+ * counts in hdr goes, and return its length.
+ */
+static uint64_t dict_cache_layout (struct dict_cache_header *hdr, uint64_t off[])
+{
+	uint64_t	n = DICT_ALIGN (sizeof (*hdr));
+
+	off[0] = n;		/* files */
+	n += DICT_ALIGN ((uint64_t) hdr->nfiles * sizeof (struct dict_file));
+	off[1] = n;		/* attributes */
+	n += DICT_ALIGN ((uint64_t) hdr->nattrs * sizeof (DICT_ATTR));
+	off[2] = n;		/* values */
+	n += DICT_ALIGN ((uint64_t) hdr->nvalues * sizeof (DICT_VALUE));
+	off[3] = n;		/* vendors */
+	n += DICT_ALIGN ((uint64_t) hdr->nvendors * sizeof (VENDOR_DICT));
+	off[4] = n;		/* heads */
+	n += DICT_ALIGN (DICT_NINDEX * DICT_HASH_SIZE * sizeof (int32_t));
+	off[5] = n;		/* next, for each index */
+	n += 2 * DICT_ALIGN ((uint64_t) hdr->nattrs * sizeof (int32_t));
+	n += 2 * DICT_ALIGN ((uint64_t) hdr->nvalues * sizeof (int32_t));
+	n += DICT_ALIGN ((uint64_t) hdr->nvendors * sizeof (int32_t));
+	return n;
+}
+
+/* dict_chain_ok - check that the chains of one index stay in bounds */
+static int dict_chain_ok (int32_t *heads, int32_t *next, uint32_t n)
+{
+	uint32_t	i;
+
+	for (i = 0; i < DICT_HASH_SIZE; ++i)
+		if (heads[i] < -1 || heads[i] >= (int32_t) n)
+			return 0;
+	for (i = 0; i < n; ++i)
+		if (next[i] < -1 || next[i] >= (int32_t) n)
+			return 0;
+	return 1;
+}
+
+/*
+ * dict_cache_map - use the cache of the dictionary filename, if there
+ * is one and the files it was made from haven't changed since.
+ */
+static int dict_cache_map (char *filename)
+{
+	char		name[PATH_MAX];
+	struct dict_cache_header *hdr;
+	struct dict_file *df;
+	struct stat	sbuf;
+	uint64_t	off[6], n;
+	int32_t		*next[DICT_NINDEX];
+	uint32_t	i, count[DICT_NINDEX];
+	char		*map;
+	int		fd;
+
+	if (dict_cache_name (filename, name, sizeof (name)) < 0
+	    || (fd = open (name, O_RDONLY)) < 0)
+		return -1;
+	/* only trust a cache nobody else could have written */
+	if (fstat (fd, &sbuf) < 0 || sbuf.st_size < sizeof (*hdr)
+	    || (sbuf.st_uid != 0 && sbuf.st_uid != geteuid ())
+	    || (sbuf.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		close (fd);
+		return -1;
+	}
+	map = mmap (NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	hdr = (struct dict_cache_header *) map;
+	if (hdr->magic != DICT_CACHE_MAGIC || hdr->version != DICT_CACHE_VERSION
+	    || hdr->attr_size != sizeof (DICT_ATTR)
+	    || hdr->value_size != sizeof (DICT_VALUE)
+	    || hdr->vendor_size != sizeof (VENDOR_DICT)
+	    || hdr->hash_size != DICT_HASH_SIZE
+	    || hdr->nfiles == 0 || hdr->nfiles > DICT_MAX_FILES
+	    || hdr->nattrs > INT32_MAX / 2 || hdr->nvalues > INT32_MAX / 2
+	    || hdr->nvendors > INT32_MAX / 2
+	    || hdr->len != (uint64_t) sbuf.st_size
+	    || dict_cache_layout (hdr, off) != hdr->len)
+		goto bad;
+
+	/* it must be for this dictionary, and every file must be as it was */
+	df = (struct dict_file *) (map + off[0]);
+	if (strncmp (df[0].path, filename, DICT_PATH_LEN) != 0)
+		goto bad;
+	for (i = 0; i < hdr->nfiles; ++i)
+	{
+		if (stat (df[i].path, &sbuf) < 0
+		    || df[i].dev != sbuf.st_dev || df[i].ino != sbuf.st_ino
+		    || df[i].size != (uint64_t) sbuf.st_size
+		    || df[i].mtime != sbuf.st_mtim.tv_sec
+		    || df[i].mtime_nsec != (uint32_t) sbuf.st_mtim.tv_nsec)
+			goto bad;
+	}
+
+	/* a corrupt cache mustn't send a lookup off the end */
+	count[DICT_ATTR_BY_CODE] = count[DICT_ATTR_BY_NAME] = hdr->nattrs;
+	count[DICT_VALUE_BY_NAME] = count[DICT_VALUE_BY_ATTR] = hdr->nvalues;
+	count[DICT_VENDOR_BY_CODE] = hdr->nvendors;
+	n = off[5];
+	for (i = 0; i < DICT_NINDEX; ++i)
+	{
+		next[i] = (int32_t *) (map + n);
+		if (!dict_chain_ok ((int32_t *) (map + off[4]) + i * DICT_HASH_SIZE,
+				    next[i], count[i]))
+			goto bad;
+		n += DICT_ALIGN ((uint64_t) count[i] * sizeof (int32_t));
+	}
+
+	memcpy (dict.next, next, sizeof (next));
+	dict.attrs = (DICT_ATTR *) (map + off[1]);
+	dict.values = (DICT_VALUE *) (map + off[2]);
+	dict.vendors = (VENDOR_DICT *) (map + off[3]);
+	dict.heads = (int32_t *) (map + off[4]);
+	dict.nattrs = hdr->nattrs;
+	dict.nvalues = hdr->nvalues;
+	dict.nvendors = hdr->nvendors;
+	dict_map = map;
+	dict_map_len = hdr->len;
+	return 0;
+
+ bad:
+	munmap (map, sbuf.st_size);
+	return -1;
+}
+
+/* dict_put - write len bytes and pad them to a multiple of 8 */
+static int dict_put (FILE *f, const void *p, uint64_t len)
+{
+	static const char zeros[8];
+
+	if (len > 0 && fwrite (p, len, 1, f) != 1)
+		return -1;
+	if (DICT_ALIGN (len) != len
+	    && fwrite (zeros, DICT_ALIGN (len) - len, 1, f) != 1)
+		return -1;
+	return 0;
+}
+
+/*
+ * dict_cache_write - save the dictionary we have just read, for the
+ * next pppd to map.  Failing to is not an error; it just means the
+ * next one reads the files too.
+ */
+static void dict_cache_write (char *filename)
+{
+	char		name[PATH_MAX], tmp[PATH_MAX + 8];
+	struct dict_cache_header hdr;
+	uint64_t	off[6];
+	FILE		*f;
+	int		fd, i, ok;
+	uint32_t	count[DICT_NINDEX];
+
+	if (dict_nfiles > DICT_MAX_FILES
+	    || dict_cache_name (filename, name, sizeof (name)) < 0)
+		return;
+	snprintf (tmp, sizeof (tmp), "%s.XXXXXX", name);
+	if ((fd = mkstemp (tmp)) < 0)
+		return;
+	fchmod (fd, 0644);
+	if ((f = fdopen (fd, "w")) == NULL)
+	{
+		close (fd);
+		unlink (tmp);
+		return;
+	}
+
+	memset (&hdr, 0, sizeof (hdr));
+	hdr.magic = DICT_CACHE_MAGIC;
+	hdr.version = DICT_CACHE_VERSION;
+	hdr.attr_size = sizeof (DICT_ATTR);
+	hdr.value_size = sizeof (DICT_VALUE);
+	hdr.vendor_size = sizeof (VENDOR_DICT);
+	hdr.hash_size = DICT_HASH_SIZE;
+	hdr.nfiles = dict_nfiles;
+	hdr.nattrs = dict.nattrs;
+	hdr.nvalues = dict.nvalues;
+	hdr.nvendors = dict.nvendors;
+	hdr.len = dict_cache_layout (&hdr, off);
+
+	count[DICT_ATTR_BY_CODE] = count[DICT_ATTR_BY_NAME] = dict.nattrs;
+	count[DICT_VALUE_BY_NAME] = count[DICT_VALUE_BY_ATTR] = dict.nvalues;
+	count[DICT_VENDOR_BY_CODE] = dict.nvendors;
+	ok = dict_put (f, &hdr, sizeof (hdr)) == 0
+	    && dict_put (f, dict_files, dict_nfiles * sizeof (struct dict_file)) == 0
+	    && dict_put (f, dict.attrs, dict.nattrs * sizeof (DICT_ATTR)) == 0
+	    && dict_put (f, dict.values, dict.nvalues * sizeof (DICT_VALUE)) == 0
+	    && dict_put (f, dict.vendors, dict.nvendors * sizeof (VENDOR_DICT)) == 0
+	    && dict_put (f, dict.heads, DICT_NINDEX * DICT_HASH_SIZE * sizeof (int32_t)) == 0;
+	for (i = 0; ok && i < DICT_NINDEX; ++i)
+		ok = dict_put (f, dict.next[i], count[i] * sizeof (int32_t)) == 0;
+	if (fclose (f) != 0)
+		ok = 0;
+	if (!ok || rename (tmp, name) < 0)
+		unlink (tmp);
+}
 
 /*
  * Function: rc_read_dictionary
  *
- * Purpose: Initialize the dictionary.  Read all ATTRIBUTES into
- *	    the dictionary_attributes list.  Read all VALUES into
- *	    the dictionary_values list.  Construct VENDOR dictionaries
- *          as required.
+ * Purpose: Initialize the dictionary.  Map the cache of it if that
+ *	    is still good; otherwise read all ATTRIBUTES, VALUES and
+ *	    VENDORS into the arrays, and write the cache for next time.
  *
  */
 
 int rc_read_dictionary (char *filename)
+{
+	size_t		bytes;
+	int		first = dict.heads == NULL;
+
+	/* the mapped arrays can't be added to */
+	if (dict_map != NULL)
+	{
+		error ("rc_read_dictionary: dictionary already loaded");
+		return -1;
+	}
+	if (first && dict_cache_map (filename) == 0)
+	{
+		ppp_mem_account ("radius-dictionary", dict_map_len, 1);
+		return 0;
+	}
+
+	dict_nfiles = 0;
+	if (rc_parse_dictionary (filename) < 0)
+		return -1;
+	if (first)
+		dict_cache_write (filename);
+
+	bytes = DICT_NINDEX * DICT_HASH_SIZE * sizeof (int32_t)
+		+ dict.max_attrs * (sizeof (DICT_ATTR) + 2 * sizeof (int32_t))
+		+ dict.max_values * (sizeof (DICT_VALUE) + 2 * sizeof (int32_t))
+		+ dict.max_vendors * (sizeof (VENDOR_DICT) + sizeof (int32_t));
+	ppp_mem_account ("radius-dictionary", bytes, 0);
+	return 0;
+}
+
+/*
+ * Function: rc_parse_dictionary
+ *
+ * Purpose: Read one dictionary file, and those it includes, adding
+ *	    its entries to the arrays.
+ *
+ */
+
+static int rc_parse_dictionary (char *filename)
 {
 	FILE           *dictfd;
 	char            dummystr[AUTH_ID_LEN];
@@ -57,6 +476,7 @@ int rc_read_dictionary (char *filename)
 				filename, strerror(errno));
 		return (-1);
 	}
+	dict_note_file (filename, dictfd);
 
 	line_no = 0;
 	retcode = 0;
@@ -86,17 +506,18 @@ int rc_read_dictionary (char *filename)
 			break;
 		    }
 		    /* Create new vendor entry */
-		    vdict = (VENDOR_DICT *) malloc (sizeof (VENDOR_DICT));
-		    if (!vdict) {
+		    if (dict_grow ((void **) &dict.vendors, sizeof (VENDOR_DICT),
+				   dict.nvendors, &dict.max_vendors,
+				   DICT_VENDOR_BY_CODE, -1) < 0) {
 			novm("rc_read_dictionary");
 			retcode = -1;
 			break;
 		    }
+		    vdict = &dict.vendors[dict.nvendors];
+		    memset(vdict, 0, sizeof(*vdict));
 		    strcpy(vdict->vendorname, namestr);
 		    vdict->vendorcode = value;
-		    vdict->attributes = NULL;
-		    vdict->next = vendor_dictionaries;
-		    vendor_dictionaries = vdict;
+		    dict_link(DICT_VENDOR_BY_CODE, dict_hash_code(value, 0), dict.nvendors++);
 		}
 		else if (strncmp (buffer, "ATTRIBUTE", 9) == 0)
 		{
@@ -190,15 +611,17 @@ int rc_read_dictionary (char *filename)
 			} else {
 			    vdict = NULL;
 			}
-			/* Create a new attribute for the list */
-			if ((attr =
-				(DICT_ATTR *) malloc (sizeof (DICT_ATTR)))
-							== (DICT_ATTR *) NULL)
+			/* Create a new attribute in the array */
+			if (dict_grow ((void **) &dict.attrs, sizeof (DICT_ATTR),
+				       dict.nattrs, &dict.max_attrs,
+				       DICT_ATTR_BY_CODE, DICT_ATTR_BY_NAME) < 0)
 			{
 				novm("rc_read_dictionary");
 				retcode = -1;
 				break;
 			}
+			attr = &dict.attrs[dict.nattrs];
+			memset (attr, 0, sizeof (*attr));
 			strcpy (attr->name, namestr);
 			if (vdict) {
 			    attr->vendorcode = vdict->vendorcode;
@@ -208,14 +631,12 @@ int rc_read_dictionary (char *filename)
 			attr->value = value;
 			attr->type = type;
 
-			/* Insert it into the list */
-			if (vdict) {
-			    attr->next = vdict->attributes;
-			    vdict->attributes = attr;
-			} else {
-			    attr->next = dictionary_attributes;
-			    dictionary_attributes = attr;
-			}
+			/* Insert it into the indexes */
+			dict_link (DICT_ATTR_BY_CODE,
+				   dict_hash_code (attr->vendorcode, value), dict.nattrs);
+			dict_link (DICT_ATTR_BY_NAME,
+				   dict_hash_name (attr->name, 0), dict.nattrs);
+			dict.nattrs++;
 		}
 		else if (strncmp (buffer, "VALUE", 5) == 0)
 		{
@@ -257,22 +678,27 @@ int rc_read_dictionary (char *filename)
 			}
 			value = atoi (valstr);
 
-			/* Create a new VALUE entry for the list */
-			if ((dval =
-				(DICT_VALUE *) malloc (sizeof (DICT_VALUE)))
-							== (DICT_VALUE *) NULL)
+			/* Create a new VALUE entry in the array */
+			if (dict_grow ((void **) &dict.values, sizeof (DICT_VALUE),
+				       dict.nvalues, &dict.max_values,
+				       DICT_VALUE_BY_NAME, DICT_VALUE_BY_ATTR) < 0)
 			{
 				novm("rc_read_dictionary");
 				retcode = -1;
 				break;
 			}
+			dval = &dict.values[dict.nvalues];
+			memset (dval, 0, sizeof (*dval));
 			strcpy (dval->attrname, attrstr);
 			strcpy (dval->name, namestr);
 			dval->value = value;
 
-			/* Insert it into the list */
-			dval->next = dictionary_values;
-			dictionary_values = dval;
+			/* Insert it into the indexes */
+			dict_link (DICT_VALUE_BY_NAME,
+				   dict_hash_name (dval->name, 0), dict.nvalues);
+			dict_link (DICT_VALUE_BY_ATTR,
+				   dict_hash_name (dval->attrname, value), dict.nvalues);
+			dict.nvalues++;
 		}
 		else if (strncmp (buffer, "INCLUDE", 7) == 0)
 		{
@@ -284,7 +710,7 @@ int rc_read_dictionary (char *filename)
 				retcode = -1;
 				break;
 			}
-			if (rc_read_dictionary(namestr) == -1)
+			if (rc_parse_dictionary(namestr) == -1)
 			{
 				retcode = -1;
 				break;
@@ -307,28 +733,16 @@ int rc_read_dictionary (char *filename)
 DICT_ATTR *rc_dict_getattr (int attribute, int vendor)
 {
 	DICT_ATTR      *attr;
-	VENDOR_DICT    *dict;
+	int32_t		i;
 
-	if (vendor == VENDOR_NONE) {
-	    attr = dictionary_attributes;
-	    while (attr != (DICT_ATTR *) NULL) {
-		if (attr->value == attribute) {
-		    return (attr);
-		}
-		attr = attr->next;
-	    }
-	} else {
-	    dict = rc_dict_getvendor(vendor);
-	    if (!dict) {
+	if (dict.heads == NULL)
 		return NULL;
-	    }
-	    attr = dict->attributes;
-	    while (attr) {
-		if (attr->value == attribute) {
-		    return attr;
-		}
-		attr = attr->next;
-	    }
+	for (i = DICT_HEAD (DICT_ATTR_BY_CODE, dict_hash_code (vendor, attribute));
+	     i >= 0; i = dict.next[DICT_ATTR_BY_CODE][i])
+	{
+		attr = &dict.attrs[i];
+		if (attr->value == attribute && attr->vendorcode == vendor)
+			return (attr);
 	}
 	return NULL;
 }
@@ -343,32 +757,24 @@ DICT_ATTR *rc_dict_getattr (int attribute, int vendor)
 
 DICT_ATTR *rc_dict_findattr (char *attrname)
 {
-	DICT_ATTR      *attr;
-	VENDOR_DICT    *dict;
+	DICT_ATTR      *attr, *vattr = NULL;
+	int32_t		i;
 
-	attr = dictionary_attributes;
-	while (attr != (DICT_ATTR *) NULL)
+	if (dict.heads == NULL)
+		return NULL;
+	/* Standard attributes take precedence over vendor-specific ones */
+	for (i = DICT_HEAD (DICT_ATTR_BY_NAME, dict_hash_name (attrname, 0));
+	     i >= 0; i = dict.next[DICT_ATTR_BY_NAME][i])
 	{
-		if (strcasecmp (attr->name, attrname) == 0)
-		{
+		attr = &dict.attrs[i];
+		if (strcasecmp (attr->name, attrname) != 0)
+			continue;
+		if (attr->vendorcode == VENDOR_NONE)
 			return (attr);
-		}
-		attr = attr->next;
-	}
-
-	/* Search vendor-specific dictionaries */
-	dict = vendor_dictionaries;
-	while (dict) {
-	    attr = dict->attributes;
-	    while (attr) {
-		if (strcasecmp (attr->name, attrname) == 0) {
-		    return (attr);
-		}
-		attr = attr->next;
-	    }
-	    dict = dict->next;
+		if (vattr == NULL)
+			vattr = attr;
 	}
-	return ((DICT_ATTR *) NULL);
+	return (vattr);
 }
 
 
@@ -383,15 +789,16 @@ DICT_ATTR *rc_dict_findattr (char *attrname)
 DICT_VALUE *rc_dict_findval (char *valname)
 {
 	DICT_VALUE     *val;
+	int32_t		i;
 
-	val = dictionary_values;
-	while (val != (DICT_VALUE *) NULL)
+	if (dict.heads == NULL)
+		return NULL;
+	for (i = DICT_HEAD (DICT_VALUE_BY_NAME, dict_hash_name (valname, 0));
+	     i >= 0; i = dict.next[DICT_VALUE_BY_NAME][i])
 	{
+		val = &dict.values[i];
 		if (strcasecmp (val->name, valname) == 0)
-		{
 			return (val);
-		}
-		val = val->next;
 	}
 	return ((DICT_VALUE *) NULL);
 }
@@ -407,16 +814,17 @@ DICT_VALUE *rc_dict_findval (char *valname)
 DICT_VALUE * rc_dict_getval (UINT4 value, char *attrname)
 {
 	DICT_VALUE     *val;
+	int32_t		i;
 
-	val = dictionary_values;
-	while (val != (DICT_VALUE *) NULL)
+	if (dict.heads == NULL)
+		return NULL;
+	for (i = DICT_HEAD (DICT_VALUE_BY_ATTR, dict_hash_name (attrname, value));
+	     i >= 0; i = dict.next[DICT_VALUE_BY_ATTR][i])
 	{
+		val = &dict.values[i];
 		if (strcmp (val->attrname, attrname) == 0 &&
 				val->value == value)
-		{
 			return (val);
-		}
-		val = val->next;
 	}
 	return ((DICT_VALUE *) NULL);
 }
@@ -429,14 +837,13 @@ DICT_VALUE * rc_dict_getval (UINT4 value, char *attrname)
  */
 VENDOR_DICT * rc_dict_findvendor (char *vendorname)
 {
-    VENDOR_DICT *dict;
+    int32_t i;
 
-    dict = vendor_dictionaries;
-    while (dict) {
-	if (!strcmp(vendorname, dict->vendorname)) {
-	    return dict;
+    /* the newest first, as they were on the old list */
+    for (i = (int32_t) dict.nvendors - 1; i >= 0; --i) {
+	if (!strcmp(vendorname, dict.vendors[i].vendorname)) {
+	    return &dict.vendors[i];
 	}
-	dict = dict->next;
     }
     return NULL;
 }
@@ -449,14 +856,15 @@ VENDOR_DICT * rc_dict_findvendor (char *vendorname)
  */
 VENDOR_DICT * rc_dict_getvendor (int id)
 {
-    VENDOR_DICT *dict;
+    int32_t i;
 
-    dict = vendor_dictionaries;
-    while (dict) {
-	if (id == dict->vendorcode) {
-	    return dict;
+    if (dict.heads == NULL)
+	return NULL;
+    for (i = DICT_HEAD (DICT_VENDOR_BY_CODE, dict_hash_code (id, 0));
+	 i >= 0; i = dict.next[DICT_VENDOR_BY_CODE][i]) {
+	if (id == dict.vendors[i].vendorcode) {
+	    return &dict.vendors[i];
 	}
-	dict = dict->next;
     }
     return NULL;
 }
@@ -17,6 +17,79 @@
 #include <includes.h>
 #include <radiusclient.h>
 
+/*
+ * Host names are passed to the resolver at most once every
+ * RC_HOST_TTL seconds.  Otherwise each request would look up its
+ * server, and each host named in the servers file, all over again.
+ */
+#define RC_HOST_CACHE	32
+#define RC_HOST_ADDRS	8
+#define RC_HOST_TTL	300
+
+struct rc_host
+{
+	char		name[256];
+	UINT4		addrs[RC_HOST_ADDRS];	/* in host order */
+	int		naddrs;
+	time_t		expires;
+};
+
+static struct rc_host rc_hosts[RC_HOST_CACHE];
+static int rc_next_host;		/* the entry to reuse next */
+
+/*
+ * Function: rc_host_addrs
+ *
+ * Purpose: look up the IP addresses of a host name, if they haven't
+ *	    been looked up recently.
+ *
+ * Returns: the number of addresses, with *addrs pointing to them in
+ *	    host order; 0 if the name couldn't be resolved.
+ *
+ */
+
+int rc_host_addrs (const char *host, const UINT4 **addrs)
+{
+	struct rc_host *h;
+	struct hostent *hp;
+	struct timeval	now;
+	char          **paddr;
+	int		i;
+
+	ppp_get_time (&now);
+	for (i = 0; i < RC_HOST_CACHE; i++)
+	{
+		h = &rc_hosts[i];
+		if (h->naddrs > 0 && now.tv_sec < h->expires
+		    && strcmp (h->name, host) == 0)
+		{
+			*addrs = h->addrs;
+			return h->naddrs;
+		}
+	}
+
+	if ((hp = gethostbyname (host)) == (struct hostent *) NULL
+	    || hp->h_addr_list[0] == NULL)
+		return 0;
+
+	/* replace an old entry for the name, or else the oldest one */
+	for (i = 0; i < RC_HOST_CACHE && strcmp (rc_hosts[i].name, host) != 0; i++)
+		;
+	if (i == RC_HOST_CACHE)
+	{
+		i = rc_next_host;
+		rc_next_host = (rc_next_host + 1) % RC_HOST_CACHE;
+	}
+	h = &rc_hosts[i];
+	strlcpy (h->name, host, sizeof (h->name));
+	h->naddrs = 0;
+	for (paddr = hp->h_addr_list; *paddr && h->naddrs < RC_HOST_ADDRS; paddr++)
+		h->addrs[h->naddrs++] = ntohl (** (UINT4 **) paddr);
+	h->expires = now.tv_sec + RC_HOST_TTL;
+	*addrs = h->addrs;
+	return h->naddrs;
+}
+
 /*
  * Function: rc_get_ipaddr
  *
@@ -28,18 +101,18 @@
 
 UINT4 rc_get_ipaddr (const char *host)
 {
-	struct hostent *hp;
+	const UINT4    *addrs;
 
 	if (rc_good_ipaddr (host) == 0)
 	{
 		return ntohl(inet_addr (host));
 	}
-	else if ((hp = gethostbyname (host)) == (struct hostent *) NULL)
+	else if (rc_host_addrs (host, &addrs) == 0)
 	{
 		error("rc_get_ipaddr: couldn't resolve hostname: %s", host);
 		return ((UINT4) 0);
 	}
-	return ntohl((*(UINT4 *) hp->h_addr));
+	return addrs[0];
 }
 
 /*
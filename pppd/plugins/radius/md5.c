@@ -7,24 +7,8 @@
 
 int rc_md5_calc(unsigned char *out, const unsigned char *in, unsigned int inl)
 {
-    int retval = 0;
-    int outl = MD5_DIGEST_LENGTH;
+    struct iovec iov = { (void *) in, inl };
+    unsigned int outl = MD5_DIGEST_LENGTH;
 
-    PPP_MD_CTX *ctx = PPP_MD_CTX_new();
-    if (ctx) {
-
-        if (PPP_DigestInit(ctx, PPP_md5())) {
-
-            if (PPP_DigestUpdate(ctx, in, inl)) {
-
-                if (PPP_DigestFinal(ctx, out, &outl)) {
-
-                    retval = 1;
-                }
-            }
-        }
-
-        PPP_MD_CTX_free(ctx);
-    }
-    return retval;
+    return PPP_Digest(PPP_md5(), &iov, 1, out, &outl);
 }
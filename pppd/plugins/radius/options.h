@@ -56,6 +56,10 @@ static OPTION config_options[] = {
 {"radius_retries",	OT_INT,	ST_UNDEF, NULL},
 {"nas_identifier",      OT_STR, ST_UNDEF, ""},
 {"bindaddr",            OT_STR, ST_UNDEF, NULL},
+{"acct_spool",		OT_STR, ST_UNDEF, NULL},
+{"radsec_ca_file",	OT_STR, ST_UNDEF, NULL},
+{"radsec_cert_file",	OT_STR, ST_UNDEF, NULL},
+{"radsec_key_file",	OT_STR, ST_UNDEF, NULL},
 /* local options */
 {"login_local",		OT_STR, ST_UNDEF, NULL},
 };
@@ -4,8 +4,10 @@
 *
 * A plugin which is stacked on top of radius.so.  This plugin writes
 * all RADIUS attributes from the server's authentication confirmation
-* into /var/run/radattr.pppN.  These attributes are available for
-* consumption by /etc/ppp/ip-{up,down} scripts.
+* into /var/run/radattr.pppN, or with radattr-env into the environment
+* of the scripts pppd runs (and so into its database entry).  These
+* attributes are available for consumption by /etc/ppp/ip-{up,down}
+* scripts.
 *
 * Copyright (C) 2002 Roaring Penguin Software Inc.
 *
@@ -18,6 +20,9 @@ static char const RCSID[] =
 "$Id: radattr.c,v 1.2 2004/10/28 00:24:40 paulus Exp $";
 
 #include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdint.h>
@@ -33,6 +38,14 @@ static void cleanup(void *opaque, int arg);
 
 char pppd_version[] = PPPD_VERSION;
 
+static bool radattr_env;	/* set script variables, not write a file */
+
+static option_t Options[] = {
+    { "radattr-env", o_bool, &radattr_env,
+      "Pass RADIUS attributes to scripts as RADATTR_ variables", 1 },
+    { NULL }
+};
+
 /**********************************************************************
 * %FUNCTION: plugin_init
 * %ARGUMENTS:
@@ -46,6 +59,7 @@ void
 plugin_init(void)
 {
     radius_attributes_hook = print_attributes;
+    ppp_add_options(Options);
 
 #if 0
     /* calling cleanup() on link down is problematic because print_attributes()
@@ -59,6 +73,70 @@ plugin_init(void)
     info("RADATTR plugin initialized.");
 }
 
+/**********************************************************************
+* %FUNCTION: setenv_attributes
+* %ARGUMENTS:
+*  vp -- linked-list of RADIUS attribute-value pairs
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Sets RADATTR_Name to the value of each attribute for the scripts,
+*  with characters not allowed in a variable name changed to '_'.
+*  The values of an attribute sent more than once are put on
+*  separate lines.  pppd stores these in its database entry too.
+***********************************************************************/
+static void
+setenv_attributes(VALUE_PAIR *vp)
+{
+    static char **vars;		/* the variables we set last time */
+    static int nvars, maxvars;
+    char var[2048 + 8];
+    char name[2048];
+    char value[2048];
+    char both[4096 + 2];
+    char *p, **newvars;
+    int i, cnt = 0;
+
+    /* a new authentication replaces what the last one set */
+    for (i = 0; i < nvars; ++i) {
+	ppp_script_unsetenv(vars[i]);
+	free(vars[i]);
+    }
+    nvars = 0;
+
+    for (; vp; vp=vp->next) {
+	if (rc_avpair_tostr(vp, name, sizeof(name), value, sizeof(value)) < 0) {
+	    continue;
+	}
+	slprintf(var, sizeof(var), "RADATTR_%s", name);
+	for (p = var; *p; ++p)
+	    if (!isalnum((unsigned char) *p))
+		*p = '_';
+	cnt++;
+	for (i = 0; i < nvars; ++i)
+	    if (strcmp(vars[i], var) == 0)
+		break;
+	if (i < nvars && (p = ppp_script_getenv(var)) != NULL) {
+	    slprintf(both, sizeof(both), "%s\n%s", p, value);
+	    ppp_script_setenv(var, both, 0);
+	    continue;
+	}
+	if (i < nvars)
+	    continue;
+	ppp_script_setenv(var, value, 0);
+	if (nvars == maxvars) {
+	    newvars = realloc(vars, (maxvars + 16) * sizeof(char *));
+	    if (newvars == NULL)
+		continue;
+	    vars = newvars;
+	    maxvars += 16;
+	}
+	if ((vars[nvars] = strdup(var)) != NULL)
+	    ++nvars;
+    }
+    dbglog("RADATTR plugin set %d script variable(s).", cnt);
+}
+
 /**********************************************************************
 * %FUNCTION: print_attributes
 * %ARGUMENTS:
@@ -79,6 +157,10 @@ print_attributes(VALUE_PAIR *vp)
     int cnt = 0;
     mode_t old_umask;
 
+    if (radattr_env) {
+	setenv_attributes(vp);
+	return;
+    }
     slprintf(fname, sizeof(fname), "/var/run/radattr.%s", ppp_ifname());
     old_umask = umask(077);
     fp = fopen(fname, "w");
@@ -114,6 +196,8 @@ cleanup(void *opaque, int arg)
 {
     char fname[512];
 
+    if (radattr_env)
+	return;
     slprintf(fname, sizeof(fname), "/var/run/radattr.%s", ppp_get_ifname(NULL,0));
     (void) remove(fname);
     dbglog("RADATTR plugin removed file %s.", fname);
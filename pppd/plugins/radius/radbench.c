@@ -0,0 +1,408 @@
+/*
+ * radbench.c - send requests to a RADIUS server through the
+ * radiusclient library and report throughput and latency.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * See the file COPYRIGHT for the respective terms and conditions.
+ *
+ * Usage: radbench [-a] [-c config] [-n requests] [-p processes]
+ *		   [-r rate] [-u user] [-w password] [attribute=value ...]
+ *
+ * Each of the processes sends its share of the requests one at a
+ * time, waiting for each answer as a pppd does: Access-Requests, or
+ * with -a, Accounting-Requests.  With -r the processes between them
+ * start rate requests a second, and latency is counted from when each
+ * request was due to start, so a server that falls behind shows up as
+ * latency rather than as a lower request rate.  The attributes named
+ * on the command line are looked up in the dictionary and added to
+ * every request.
+ *
+ * It isn't built by default; "make radbench" builds it.
+ */
+
+#include <includes.h>
+#include <radiusclient.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <pppd/crypto.h>
+
+static char *config_file = "/etc/radiusclient/radiusclient.conf";
+static int accounting;
+static int nrequests = 1000;
+static int nprocs = 1;
+static int rate;			/* requests/second, 0 for flat out */
+static char *user = "bench";
+static char *password = "bench";
+static char **extra_attrs;
+static int nextra;
+
+struct result
+{
+	uint32_t	usec;		/* how long the request took */
+	int32_t		result;		/* from rc_auth or rc_acct */
+};
+
+/*
+ * The library is normally linked into pppd; these stand in for the
+ * parts of pppd it uses.  Only synchronous requests are made, so
+ * timers and fd handlers are never needed.
+ */
+
+static void logit (const char *level, char *fmt, va_list ap)
+{
+	char	buf[1024];
+
+	vsnprintf (buf, sizeof (buf), fmt, ap);
+	fprintf (stderr, "radbench: %s%s\n", level, buf);
+}
+
+void dbglog (char *fmt, ...)
+{
+}
+
+void info (char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start (ap, fmt);
+	logit ("", fmt, ap);
+	va_end (ap);
+}
+
+void warn (char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start (ap, fmt);
+	logit ("warning: ", fmt, ap);
+	va_end (ap);
+}
+
+void error (char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start (ap, fmt);
+	logit ("", fmt, ap);
+	va_end (ap);
+}
+
+void fatal (char *fmt, ...)
+{
+	va_list	ap;
+
+	va_start (ap, fmt);
+	logit ("", fmt, ap);
+	va_end (ap);
+	exit (1);
+}
+
+void novm (char *msg)
+{
+	fatal ("not enough memory for %s", msg);
+}
+
+size_t strlcpy (char *dest, const char *src, size_t len)
+{
+	size_t	ret = strlen (src);
+
+	if (len != 0)
+		snprintf (dest, len, "%s", src);
+	return ret;
+}
+
+u_int32_t magic (void)
+{
+	return (u_int32_t) random ();
+}
+
+int ppp_get_time (struct timeval *tv)
+{
+	struct timespec ts;
+
+	if (clock_gettime (CLOCK_MONOTONIC, &ts) < 0)
+		return gettimeofday (tv, NULL);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+	return 0;
+}
+
+const char *ppp_hostname (void)
+{
+	static char	hostname[256];
+
+	if (hostname[0] == '\0')
+		gethostname (hostname, sizeof (hostname) - 1);
+	return hostname;
+}
+
+bool ppp_signaled (int sig)
+{
+	return 0;
+}
+
+void ppp_timeout (void (*func)(void *), void *arg, int s, int us)
+{
+}
+
+void ppp_untimeout (void (*func)(void *), void *arg)
+{
+}
+
+void ppp_add_fd_handler (int fd, ppp_fd_cb func, void *arg)
+{
+}
+
+void ppp_remove_fd_handler (int fd)
+{
+}
+
+/* no runtime directory, so the dictionary is always read, not mapped */
+int ppp_get_path (ppp_path_t type, char *buf, size_t bufsz)
+{
+	return -1;
+}
+
+void ppp_mem_account (const char *name, size_t bytes, bool shared)
+{
+}
+
+static long usec_between (struct timeval *from, struct timeval *to)
+{
+	return (to->tv_sec - from->tv_sec) * 1000000L
+		+ (to->tv_usec - from->tv_usec);
+}
+
+/*
+ * Function: build_request
+ *
+ * Purpose: make the attributes for request number n
+ *
+ */
+
+static VALUE_PAIR *build_request (int n)
+{
+	VALUE_PAIR	*send = NULL;
+	char		sid[32];
+	UINT4		av;
+	int		i;
+
+	rc_avpair_add (&send, PW_USER_NAME, user, 0, VENDOR_NONE);
+	av = PW_FRAMED;
+	rc_avpair_add (&send, PW_SERVICE_TYPE, &av, 0, VENDOR_NONE);
+	av = PW_PPP;
+	rc_avpair_add (&send, PW_FRAMED_PROTOCOL, &av, 0, VENDOR_NONE);
+
+	if (accounting)
+	{
+		snprintf (sid, sizeof (sid), "%08X%08X", (unsigned) getpid (), n);
+		rc_avpair_add (&send, PW_ACCT_SESSION_ID, sid, 0, VENDOR_NONE);
+		av = PW_STATUS_ALIVE;
+		rc_avpair_add (&send, PW_ACCT_STATUS_TYPE, &av, 0, VENDOR_NONE);
+		av = n;
+		rc_avpair_add (&send, PW_ACCT_INPUT_OCTETS, &av, 0, VENDOR_NONE);
+		rc_avpair_add (&send, PW_ACCT_OUTPUT_OCTETS, &av, 0, VENDOR_NONE);
+	}
+	else
+		rc_avpair_add (&send, PW_USER_PASSWORD, password, 0, VENDOR_NONE);
+
+	for (i = 0; i < nextra; i++)
+		rc_avpair_parse (extra_attrs[i], &send);
+	return send;
+}
+
+/*
+ * Function: run_worker
+ *
+ * Purpose: send requests first, first + nprocs, ... and write how
+ *	    each one went to out
+ *
+ */
+
+static void run_worker (int first, struct timeval *start, int out)
+{
+	struct timeval	due, begin, end;
+	struct result	r;
+	VALUE_PAIR	*send, *received;
+	char		msg[BUFFER_LEN];
+	long		wait, offset;
+	int		n;
+
+	for (n = first; n < nrequests; n += nprocs)
+	{
+		ppp_get_time (&begin);
+		due = begin;
+		if (rate > 0)
+		{
+			offset = (long) ((double) n * 1000000 / rate);
+			due.tv_sec = start->tv_sec + offset / 1000000;
+			due.tv_usec = start->tv_usec + offset % 1000000;
+			if (due.tv_usec >= 1000000)
+			{
+				due.tv_sec++;
+				due.tv_usec -= 1000000;
+			}
+			wait = usec_between (&begin, &due);
+			if (wait > 0)
+				usleep (wait);
+		}
+
+		send = build_request (n);
+		received = NULL;
+		if (accounting)
+			r.result = rc_acct (0, send);
+		else
+			r.result = rc_auth (0, send, &received, msg, NULL);
+		rc_avpair_free (send);
+		rc_avpair_free (received);
+
+		ppp_get_time (&end);
+		wait = usec_between (&due, &end);
+		r.usec = wait > 0? wait: 0;
+		if (write (out, &r, sizeof (r)) != sizeof (r))
+			_exit (1);
+	}
+	_exit (0);
+}
+
+static int compare_usec (const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y? -1: x > y;
+}
+
+static double percentile (uint32_t *usec, int n, double p)
+{
+	int	i = (int) (p * n);
+
+	if (i >= n)
+		i = n - 1;
+	return usec[i] / 1000.0;
+}
+
+static void usage (void)
+{
+	fprintf (stderr,
+		 "Usage: radbench [-a] [-c config] [-n requests] [-p processes]\n"
+		 "                [-r rate] [-u user] [-w password] [attribute=value ...]\n");
+	exit (2);
+}
+
+int main (int argc, char **argv)
+{
+	struct timeval	start, end;
+	struct result	r;
+	VALUE_PAIR	*vp = NULL;
+	uint32_t	*usec;
+	int		counts[4] = { 0, 0, 0, 0 };	/* ok, reject, timeout, error */
+	int		pipefd[2];
+	int		c, i, n;
+	double		secs;
+
+	while ((c = getopt (argc, argv, "ac:n:p:r:u:w:")) != -1)
+	{
+		switch (c)
+		{
+		    case 'a':
+			accounting = 1;
+			break;
+		    case 'c':
+			config_file = optarg;
+			break;
+		    case 'n':
+			nrequests = atoi (optarg);
+			break;
+		    case 'p':
+			nprocs = atoi (optarg);
+			break;
+		    case 'r':
+			rate = atoi (optarg);
+			break;
+		    case 'u':
+			user = optarg;
+			break;
+		    case 'w':
+			password = optarg;
+			break;
+		    default:
+			usage ();
+		}
+	}
+	if (nrequests <= 0 || nprocs <= 0 || rate < 0)
+		usage ();
+	extra_attrs = argv + optind;
+	nextra = argc - optind;
+
+	if (rc_read_config (config_file) != 0
+	    || rc_read_dictionary (rc_conf_str ("dictionary")) != 0)
+		exit (1);
+	for (i = 0; i < nextra; i++)
+	{
+		if (rc_avpair_parse (extra_attrs[i], &vp) != 0)
+			fatal ("can't parse %s", extra_attrs[i]);
+	}
+	rc_avpair_free (vp);
+
+	if ((usec = malloc (nrequests * sizeof (*usec))) == NULL)
+		novm ("results");
+	if (pipe (pipefd) < 0)
+		fatal ("pipe: %m");
+	PPP_crypto_init ();
+
+	ppp_get_time (&start);
+	for (i = 0; i < nprocs; i++)
+	{
+		switch (fork ())
+		{
+		    case -1:
+			fatal ("fork: %m");
+			break;
+		    case 0:
+			close (pipefd[0]);
+			srandom (getpid ());
+			run_worker (i, &start, pipefd[1]);
+		}
+	}
+	close (pipefd[1]);
+
+	n = 0;
+	while (n < nrequests && read (pipefd[0], &r, sizeof (r)) == sizeof (r))
+	{
+		usec[n++] = r.usec;
+		switch (r.result)
+		{
+		    case OK_RC:
+			counts[0]++;
+			break;
+		    case BADRESP_RC:
+			counts[1]++;
+			break;
+		    case TIMEOUT_RC:
+			counts[2]++;
+			break;
+		    default:
+			counts[3]++;
+		}
+	}
+	ppp_get_time (&end);
+	while (wait (NULL) > 0)
+		;
+	PPP_crypto_deinit ();
+
+	if (n == 0)
+		fatal ("no requests completed");
+	secs = usec_between (&start, &end) / 1e6;
+	qsort (usec, n, sizeof (*usec), compare_usec);
+	printf ("%d %s requests in %.3f s from %d processes: %.1f/s\n",
+		n, accounting? "accounting": "authentication", secs, nprocs,
+		n / secs);
+	printf ("ok %d, rejected %d, timed out %d, failed %d\n",
+		counts[0], counts[1], counts[2], counts[3]);
+	printf ("latency ms: p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+		percentile (usec, n, 0.5), percentile (usec, n, 0.99),
+		percentile (usec, n, 0.999), usec[n - 1] / 1000.0);
+	return 0;
+}
@@ -87,9 +87,12 @@ static int radius_setparams(VALUE_PAIR *vp, char *msg, REQUEST_INFO *req_info,
 			    char *message, int message_space);
 static void radius_choose_ip(u_int32_t *addrp);
 static int radius_init(char *msg);
+static void radius_prefork(void *opaque, int arg);
 static int get_client_port(const char *ifname);
 static int radius_allowed_address(u_int32_t addr);
 static void radius_acct_interim(void *);
+static int radius_interim_delay(void);
+static void radius_acct_done(int result, void *arg);
 #ifdef PPP_WITH_MPPE
 static int radius_setmppekeys(VALUE_PAIR *vp, REQUEST_INFO *req_info,
 			      unsigned char *);
@@ -158,6 +161,7 @@ plugin_init(void)
 
     ppp_add_notify(NF_IP_UP, radius_ip_up, NULL);
     ppp_add_notify(NF_IP_DOWN, radius_ip_down, NULL);
+    ppp_add_notify(NF_PREFORK, radius_prefork, NULL);
 
     memset(&rstate, 0, sizeof(rstate));
 
@@ -986,7 +990,6 @@ static void
 radius_acct_start(void)
 {
     UINT4 av_type;
-    int result;
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
@@ -1042,24 +1045,41 @@ radius_acct_start(void)
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
-    if (rstate.acctserver) {
-	result = rc_acct_using_server(rstate.acctserver,
-				      rstate.client_port, send);
+    /* Don't hold up the link while the server answers */
+    if (!rstate.acctserver && rc_spool_acct(rstate.client_port, send) == OK_RC) {
+	rc_avpair_free(send);
+    } else if (rstate.acctserver) {
+	rc_acct_using_server_async(rstate.acctserver, rstate.client_port,
+				   send, radius_acct_done, "Accounting START");
     } else {
-	result = rc_acct(rstate.client_port, send);
+	rc_acct_async(rstate.client_port, send, radius_acct_done,
+		      "Accounting START");
     }
 
-    rc_avpair_free(send);
+    /* Kick off periodic accounting reports */
+    if (rstate.acct_interim_interval) {
+	ppp_timeout(radius_acct_interim, NULL, radius_interim_delay(), 0);
+    }
+}
 
+/**********************************************************************
+* %FUNCTION: radius_acct_done
+* %ARGUMENTS:
+*  result -- result of an asynchronous accounting request
+*  arg -- what the request was, for the log message
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Called when the RADIUS server has answered an accounting request,
+*  or they have all failed to.
+***********************************************************************/
+static void
+radius_acct_done(int result, void *arg)
+{
     if (result != OK_RC) {
 	/* RADIUS server could be down so make this a warning */
 	syslog(LOG_WARNING,
-		"Accounting START failed for %s", rstate.user);
-    }
-
-    /* Kick off periodic accounting reports */
-    if (rstate.acct_interim_interval) {
-	ppp_timeout(radius_acct_interim, NULL, rstate.acct_interim_interval, 0);
+		"%s failed for %s", (char *) arg, rstate.user);
     }
 }
 
@@ -1076,7 +1096,7 @@ static void
 radius_acct_stop(void)
 {
     UINT4 av_type;
-    VALUE_PAIR *send = NULL;
+    VALUE_PAIR *send = NULL, *spool;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
     int result;
@@ -1211,11 +1231,25 @@ radius_acct_stop(void)
     if (rstate.avp)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
+    /*
+     * pppd exits soon after this, before an asynchronous reply could be
+     * read, so wait for the servers.  Only if none of them takes it
+     * does it go in the spool, if there is one, as it was before
+     * rc_acct added the NAS's identity, NAS-Port and Acct-Delay-Time.
+     */
     if (rstate.acctserver) {
 	result = rc_acct_using_server(rstate.acctserver,
 				      rstate.client_port, send);
     } else {
+	spool = rc_avpair_copy(send);
 	result = rc_acct(rstate.client_port, send);
+	if (result != OK_RC && spool != NULL
+	    && rc_spool_acct(rstate.client_port, spool) == OK_RC) {
+	    syslog(LOG_WARNING,
+		   "Accounting STOP for %s spooled", rstate.user);
+	    result = OK_RC;
+	}
+	rc_avpair_free(spool);
     }
 
     if (result != OK_RC) {
@@ -1242,7 +1276,6 @@ radius_acct_interim(void *ignored)
     VALUE_PAIR *send = NULL;
     ipcp_options *ho = &ipcp_hisoptions[0];
     u_int32_t hisaddr;
-    int result;
     const char *remote_number;
     const char *ipparam;
     ppp_link_stats_st stats;
@@ -1320,21 +1353,39 @@ radius_acct_interim(void *ignored)
 	rc_avpair_insert(&send, NULL, rc_avpair_copy(rstate.avp));
 
     if (rstate.acctserver) {
-	result = rc_acct_using_server(rstate.acctserver,
-				      rstate.client_port, send);
+	rc_acct_using_server_async(rstate.acctserver, rstate.client_port,
+				   send, radius_acct_done, "Interim accounting");
     } else {
-	result = rc_acct(rstate.client_port, send);
-    }
-
-    if (result != OK_RC) {
-	/* RADIUS server could be down so make this a warning */
-	syslog(LOG_WARNING,
-		"Interim accounting failed for %s", rstate.user);
+	rc_acct_async(rstate.client_port, send, radius_acct_done,
+		      "Interim accounting");
     }
-    rc_avpair_free(send);
 
     /* Schedule another one */
-    ppp_timeout(radius_acct_interim, NULL, rstate.acct_interim_interval, 0);
+    ppp_timeout(radius_acct_interim, NULL, radius_interim_delay(), 0);
+}
+
+/**********************************************************************
+* %FUNCTION: radius_interim_delay
+* %ARGUMENTS:
+*  None
+* %RETURNS:
+*  Seconds until the next interim accounting message is due
+* %DESCRIPTION:
+*  Each unit sends its interims at a fixed offset into the interval,
+*  spread over the interval by a multiplicative hash of the unit
+*  number, rather than at multiples of the interval from when the
+*  session came up.  Otherwise all the sessions that come back after
+*  an outage keep sending their interims together.
+***********************************************************************/
+static int
+radius_interim_delay(void)
+{
+    unsigned int interval = rstate.acct_interim_interval;
+    unsigned int phase, delay;
+
+    phase = ((unsigned int) ppp_ifunit() * 2654435761U) % interval;
+    delay = interval - ((unsigned int) time(NULL) - phase) % interval;
+    return delay;
 }
 
 /**********************************************************************
@@ -1369,6 +1420,51 @@ radius_ip_down(void *opaque, int arg)
     radius_acct_stop();
 }
 
+/**********************************************************************
+* %FUNCTION: radius_prefork
+* %ARGUMENTS:
+*  opaque -- ignored
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Called in a pre-forking server before it starts handing out
+*  sessions, so the config, dictionary and map files are read once
+*  and shared by all the session processes.
+***********************************************************************/
+static void
+radius_prefork(void *opaque, int arg)
+{
+    char msg[BUF_LEN];
+
+    msg[0] = 0;
+    if (radius_init(msg) < 0) {
+	warn("%s", msg);
+    }
+}
+
+/**********************************************************************
+* %FUNCTION: radius_add_avpopts
+* %ARGUMENTS:
+*  None
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Adds the av pairs saved during option parsing to rstate.avp
+***********************************************************************/
+static void
+radius_add_avpopts(void)
+{
+    while (avpopt) {
+	struct avpopt *n = avpopt->next;
+
+	rc_avpair_parse(avpopt->vpstr, &rstate.avp);
+	free(avpopt->vpstr);
+	free(avpopt);
+	avpopt = n;
+    }
+}
+
 /**********************************************************************
 * %FUNCTION: radius_init
 * %ARGUMENTS:
@@ -1382,6 +1478,7 @@ static int
 radius_init(char *msg)
 {
     if (rstate.initialized) {
+	radius_add_avpopts();
 	return 0;
     }
 
@@ -1409,15 +1506,13 @@ radius_init(char *msg)
 	return -1;
     }
 
-    /* Add av pairs saved during option parsing */
-    while (avpopt) {
-	struct avpopt *n = avpopt->next;
-
-	rc_avpair_parse(avpopt->vpstr, &rstate.avp);
-	free(avpopt->vpstr);
-	free(avpopt);
-	avpopt = n;
+    if (rc_spool_open() != 0) {
+	slprintf(msg, BUF_LEN, "RADIUS: Can't open accounting spool %s",
+		 rc_conf_str("acct_spool"));
+	return -1;
     }
+
+    radius_add_avpopts();
     return 0;
 }
 
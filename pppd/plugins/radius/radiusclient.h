@@ -75,6 +75,7 @@ typedef struct pw_auth_hdr
 
 #define PW_AUTH_UDP_PORT		1812
 #define PW_ACCT_UDP_PORT		1813
+#define PW_RADSEC_TCP_PORT		2083
 
 #define PW_TYPE_STRING			0
 #define PW_TYPE_INTEGER			1
@@ -379,6 +380,12 @@ typedef struct request_info
 	u_char		request_vector[AUTH_VECTOR_LEN];
 } REQUEST_INFO;
 
+/* Called when a request sent with rc_send_server_async completes */
+typedef void rc_send_done_fn(int result, SEND_DATA *data, char *msg, void *arg);
+
+/* Called when an rc_acct_async request completes */
+typedef void rc_acct_done_fn(int result, void *arg);
+
 #ifndef MIN
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #endif
@@ -425,6 +432,9 @@ int rc_auth_proxy(VALUE_PAIR *, VALUE_PAIR **, char *);
 int rc_acct(UINT4, VALUE_PAIR *);
 int rc_acct_using_server(SERVER *, UINT4, VALUE_PAIR *);
 int rc_acct_proxy(VALUE_PAIR *);
+void rc_acct_async(UINT4, VALUE_PAIR *, rc_acct_done_fn *, void *);
+void rc_acct_using_server_async(SERVER *, UINT4, VALUE_PAIR *,
+				rc_acct_done_fn *, void *);
 int rc_check(char *, unsigned short, char *);
 
 /*	clientid.c		*/
@@ -453,15 +463,37 @@ VENDOR_DICT * rc_dict_getvendor(int);
 /*	ip_util.c		*/
 
 UINT4 rc_get_ipaddr(const char *);
+int rc_host_addrs(const char *, const UINT4 **);
 int rc_good_ipaddr(const char *);
 const char *rc_ip_hostname(UINT4);
 UINT4 rc_own_ipaddress(void);
 UINT4 rc_own_bind_ipaddress(void);
 
 
+/*	radsec.c		*/
+
+struct rc_tls;
+
+int rc_radsec_add(const char *, int);
+int rc_radsec_server(const char *, int);
+struct rc_tls *rc_tls_connect(UINT4, int, char *, int);
+int rc_tls_fd(struct rc_tls *);
+int rc_tls_send(struct rc_tls *, const char *, int);
+int rc_tls_recv(struct rc_tls *, char *, int);
+int rc_tls_pending(struct rc_tls *);
+void rc_tls_close(struct rc_tls *);
+
 /*	sendserver.c		*/
 
 int rc_send_server(SEND_DATA *, char *, REQUEST_INFO *);
+int rc_send_server_async(SEND_DATA *, REQUEST_INFO *, rc_send_done_fn *, void *);
+int rc_send_hedged(SEND_DATA *, int, char *, REQUEST_INFO *, int *);
+int rc_server_usable(const char *, int);
+
+/*	spool.c			*/
+
+int rc_spool_open(void);
+int rc_spool_acct(UINT4, VALUE_PAIR *);
 
 /*	util.c			*/
 
@@ -25,6 +25,7 @@ static char const RCSID[] =
 #include <stdint.h>
 #include <stdarg.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include <pppd/pppd.h>
 
@@ -44,42 +45,89 @@ extern void (*radius_pre_auth_hook)(char const *user,
 				    SERVER **authserver,
 				    SERVER **acctserver);
 
-static void
-lookup_realm(char const *user,
-	     SERVER **authserver,
-	     SERVER **acctserver)
+/*
+ * The realms file is parsed into a table of realms, each with its
+ * auth and acct servers, which is kept until the file changes, so
+ * that each login costs a stat() and a hash lookup.  The realm
+ * "DEFAULT" is used for users without a realm.  We don't free an old
+ * table when the file changes, as a session may still be using its
+ * servers (accounting, say).
+ */
+#define REALM_HASH_SIZE	64
+
+struct realm {
+    struct realm *next;
+    char *name;
+    SERVER auth;
+    SERVER acct;
+};
+
+static struct realm *realm_hash[REALM_HASH_SIZE];
+static int realms_loaded;
+static struct stat realms_stat;
+
+static unsigned int
+realm_hash_of(char const *name)
+{
+    unsigned int h = 2166136261U;	/* FNV-1a */
+
+    while (*name)
+	h = (h ^ (unsigned char) *name++) * 16777619U;
+    return h % REALM_HASH_SIZE;
+}
+
+static struct realm *
+find_realm(char const *name, int create)
+{
+    struct realm *r;
+    unsigned int h = realm_hash_of(name);
+
+    for (r = realm_hash[h]; r != NULL; r = r->next)
+	if (strcmp(r->name, name) == 0)
+	    return r;
+    if (!create)
+	return NULL;
+    r = calloc(1, sizeof(*r));
+    if (r == NULL || (r->name = strdup(name)) == NULL) {
+	free(r);
+	return NULL;
+    }
+    r->next = realm_hash[h];
+    realm_hash[h] = r;
+    return r;
+}
+
+/*
+ * load_realms - parse the realms file into realm_hash, unless we
+ * already have it as it is now.  Returns 0 if the file is unusable.
+ */
+static int
+load_realms(void)
 {
-    char *realm;
     FILE *fd;
-    SERVER *accts, *auths, *s;
-    char buffer[512], *p;
+    struct stat st;
+    struct realm *r;
+    SERVER *s;
+    char buffer[512], *p, *type;
     int line = 0;
-    
-    auths = (SERVER *) malloc(sizeof(SERVER));
-    auths->max = 0;
-    accts = (SERVER *) malloc(sizeof(SERVER));
-    accts->max = 0;
-    
-    realm = strrchr(user, '@');
-    
-    if (realm) {
-	info("Looking up servers for realm '%s'", realm);
-    } else {
-	info("Looking up servers for DEFAULT realm");
-    }
-    if (realm) {
-	if (*(++realm) == '\0') {
-	    realm = NULL;
-	}
+
+    if (stat(radrealms_config, &st) < 0) {
+	ppp_option_error("cannot open %s", radrealms_config);
+	return 0;
     }
-    
+    if (realms_loaded && st.st_mtim.tv_sec == realms_stat.st_mtim.tv_sec
+	&& st.st_mtim.tv_nsec == realms_stat.st_mtim.tv_nsec
+	&& st.st_size == realms_stat.st_size && st.st_ino == realms_stat.st_ino
+	&& st.st_dev == realms_stat.st_dev)
+	return 1;
+
     if ((fd = fopen(radrealms_config, "r")) == NULL) {
 	ppp_option_error("cannot open %s", radrealms_config);
-	free(auths);
-	free(accts);
-	return;
+	return 0;
     }
     info("Reading %s", radrealms_config);
+    realms_loaded = 0;
+    memset(realm_hash, 0, sizeof(realm_hash));
 
     while ((fgets(buffer, sizeof(buffer), fd) != NULL)) {
 	line++;
@@ -89,70 +137,102 @@ lookup_realm(char const *user,
 
 	buffer[strlen(buffer)-1] = '\0';
 
-	p = strtok(buffer, "\t ");
+	type = strtok(buffer, "\t ");
 
-	if (p == NULL || (strcmp(p, "authserver") !=0
-	    && strcmp(p, "acctserver"))) {
+	if (type == NULL || (strcmp(type, "authserver") !=0
+	    && strcmp(type, "acctserver"))) {
 	    fclose(fd);
 	    ppp_option_error("%s: invalid line %d: %s", radrealms_config,
 			 line, buffer);
-	    free(auths);
-	    free(accts);
-	    return;
+	    return 0;
 	}
-	info("Parsing '%s' entry:", p);
-	s = auths;
-	if (p[1] == 'c') {
-	    s = accts;
+
+	if ((p = strtok(NULL, "\t ")) == NULL) {
+	    fclose(fd);
+	    ppp_option_error("%s: realm name missing on line %d: %s",
+			 radrealms_config, line, buffer);
+	    return 0;
 	}
+	if ((r = find_realm(p, 1)) == NULL) {
+	    fclose(fd);
+	    error("Out of memory reading %s", radrealms_config);
+	    return 0;
+	}
+	s = type[1] == 'c'? &r->acct: &r->auth;
 	if (s->max >= SERVER_MAX)
 	    continue;
 
+	if ((p = strtok(NULL, ":")) == NULL) {
+	    fclose(fd);
+	    ppp_option_error("%s: server address missing on line %d: %s",
+			 radrealms_config, line, buffer);
+	    return 0;
+	}
+	s->name[s->max] = strdup(p);
 	if ((p = strtok(NULL, "\t ")) == NULL) {
 	    fclose(fd);
-	    ppp_option_error("%s: realm name missing on line %d: %s",
+	    ppp_option_error("%s: server port missing on line %d:  %s",
 			 radrealms_config, line, buffer);
-	    free(auths);
-	    free(accts);
-	    return;
+	    return 0;
 	}
-
-	if ((realm != NULL && strcmp(p, realm) == 0) ||
-	    (realm == NULL && strcmp(p, "DEFAULT") == 0) ) {
-	    info(" - Matched realm %s", p);
-	    if ((p = strtok(NULL, ":")) == NULL) {
-		fclose(fd);
-		ppp_option_error("%s: server address missing on line %d: %s",
-			     radrealms_config, line, buffer);
-	        free(auths);
-	        free(accts);
-		return;
-	    }
-	    s->name[s->max] = strdup(p);
-	    info(" - Address is '%s'",p);
-	    if ((p = strtok(NULL, "\t ")) == NULL) {
-		fclose(fd);
-		ppp_option_error("%s: server port missing on line %d:  %s",
-			     radrealms_config, line, buffer);
-		free(auths);
-		free(accts);
-		return;
-	    }
-	    s->port[s->max] = atoi(p);
-	    info(" - Port is '%d'", s->port[s->max]);
-	    s->max++;
-	} else 
-	    info(" - Skipping realm '%s'", p);
+	s->port[s->max] = atoi(p);
+	s->max++;
     }
     fclose(fd);
 
-    if (accts->max)
-	*acctserver = accts;
+    realms_stat = st;
+    realms_loaded = 1;
+    return 1;
+}
+
+static void
+lookup_realm(char const *user,
+	     SERVER **authserver,
+	     SERVER **acctserver)
+{
+    char const *realm;
+    struct realm *r;
+    int i;
 
-    if (auths->max)
-	*authserver = auths;
+    realm = strrchr(user, '@');
 
-    return;
+    if (realm) {
+	info("Looking up servers for realm '%s'", realm);
+    } else {
+	info("Looking up servers for DEFAULT realm");
+    }
+    if (realm) {
+	if (*(++realm) == '\0') {
+	    realm = NULL;
+	}
+    }
+
+    if (!load_realms())
+	return;
+    r = find_realm(realm? realm: "DEFAULT", 0);
+    if (r == NULL)
+	return;
+    info(" - Matched realm %s", r->name);
+    for (i = 0; i < r->auth.max; ++i)
+	info(" - authserver %s port %d", r->auth.name[i], r->auth.port[i]);
+    for (i = 0; i < r->acct.max; ++i)
+	info(" - acctserver %s port %d", r->acct.name[i], r->acct.port[i]);
+
+    if (r->acct.max)
+	*acctserver = &r->acct;
+
+    if (r->auth.max)
+	*authserver = &r->auth;
+}
+
+/*
+ * A prefork-socket server reads the file before forking sessions,
+ * which then only have to check that it hasn't changed.
+ */
+static void
+radrealms_prefork(void *arg, int val)
+{
+    load_realms();
 }
 
 void
@@ -161,5 +241,6 @@ plugin_init(void)
     radius_pre_auth_hook = lookup_realm;
 
     ppp_add_options(Options);
+    ppp_add_notify(NF_PREFORK, radrealms_prefork, NULL);
     info("RADIUS Realms plugin initialized.");
 }
@@ -0,0 +1,447 @@
+/*
+ * radsec.c - RADIUS over TLS (RadSec, RFC 6614) connections.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <includes.h>
+#include <radiusclient.h>
+
+/*
+ * A server given as "host:port:tls" in authserver or acctserver is
+ * spoken to over TLS on a TCP connection instead of over UDP.  The
+ * connection is made when the first request is sent, and kept; any
+ * number of requests can be outstanding on it, told apart by their
+ * identifiers as on a UDP socket.  Since TCP recovers lost segments
+ * itself, a request isn't sent again while its connection lasts; if
+ * the connection breaks, the requests on it are sent on a new one
+ * when they are next due.
+ *
+ * The server's certificate is checked against radsec_ca_file, or the
+ * system's default CAs, and must be for the name it was given by.
+ * radsec_cert_file and radsec_key_file give the certificate we
+ * present.  The shared secret is "radsec", as RFC 6614 says.
+ */
+struct rc_radsec_server
+{
+	char		*name;
+	int		port;
+	struct rc_radsec_server *next;
+};
+
+static struct rc_radsec_server *rc_radsec_servers;
+
+/*
+ * Function: rc_radsec_add
+ *
+ * Purpose: note that a server is to be reached over TLS
+ *
+ * Returns: 0, or -1 if this pppd was built without TLS
+ *
+ */
+
+int rc_radsec_add (const char *name, int port)
+{
+	struct rc_radsec_server *s;
+
+#ifndef RC_WITH_RADSEC
+	error("RADIUS server %s:%d: built without RadSec support", name, port);
+	return -1;
+#endif
+	if (rc_radsec_server (name, port))
+		return 0;
+	if ((s = malloc (sizeof (*s))) == NULL || (s->name = strdup (name)) == NULL)
+	{
+		novm("rc_radsec_add");
+		return -1;
+	}
+	s->port = port;
+	s->next = rc_radsec_servers;
+	rc_radsec_servers = s;
+	return 0;
+}
+
+/*
+ * Function: rc_radsec_server
+ *
+ * Purpose: say whether a server is to be reached over TLS
+ *
+ */
+
+int rc_radsec_server (const char *name, int port)
+{
+	struct rc_radsec_server *s;
+
+	for (s = rc_radsec_servers; s != NULL; s = s->next)
+		if (s->port == port && strcmp (s->name, name) == 0)
+			return 1;
+	return 0;
+}
+
+#ifdef RC_WITH_RADSEC
+
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#define RADSEC_PACKET_MAX	4096	/* the largest RADIUS packet */
+
+struct rc_tls
+{
+	int		fd;
+	SSL		*ssl;
+	int		timeout;	/* seconds to wait to send */
+	int		have;		/* bytes in buf */
+	unsigned char	buf[2 * RADSEC_PACKET_MAX];
+};
+
+static SSL_CTX *rc_tls_ctx;
+
+static void rc_tls_error (const char *what, const char *server)
+{
+	unsigned long	e;
+	char		buf[256];
+
+	e = ERR_get_error ();
+	if (e != 0)
+		ERR_error_string_n (e, buf, sizeof (buf));
+	else
+		strlcpy (buf, strerror (errno), sizeof (buf));
+	error("RadSec %s %s: %s", what, server, buf);
+	ERR_clear_error ();
+}
+
+/* rc_tls_context - set up the TLS context the first time it's needed */
+static SSL_CTX *rc_tls_context (void)
+{
+	char		*ca, *cert, *key;
+	SSL_CTX		*ctx;
+
+	if (rc_tls_ctx != NULL)
+		return rc_tls_ctx;
+
+	ca = rc_conf_str ("radsec_ca_file");
+	cert = rc_conf_str ("radsec_cert_file");
+	key = rc_conf_str ("radsec_key_file");
+
+	if ((ctx = SSL_CTX_new (TLS_client_method ())) == NULL)
+	{
+		rc_tls_error ("context", "setup");
+		return NULL;
+	}
+	SSL_CTX_set_min_proto_version (ctx, TLS1_2_VERSION);
+	SSL_CTX_set_verify (ctx, SSL_VERIFY_PEER, NULL);
+	if ((ca != NULL && *ca != '\0')
+	    ? SSL_CTX_load_verify_locations (ctx, ca, NULL) != 1
+	    : SSL_CTX_set_default_verify_paths (ctx) != 1)
+	{
+		rc_tls_error ("CA file", ca? ca: "(default)");
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+	if (cert != NULL && *cert != '\0'
+	    && (SSL_CTX_use_certificate_chain_file (ctx, cert) != 1
+		|| SSL_CTX_use_PrivateKey_file (ctx, (key && *key)? key: cert,
+						SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key (ctx) != 1))
+	{
+		rc_tls_error ("certificate", cert);
+		SSL_CTX_free (ctx);
+		return NULL;
+	}
+	rc_tls_ctx = ctx;
+	return ctx;
+}
+
+/*
+ * rc_tls_wait - wait until fd is ready for what an SSL call that
+ * returned ret wants, or the deadline passes.
+ */
+static int rc_tls_wait (struct rc_tls *t, int ret, struct timeval *deadline)
+{
+	struct pollfd	pfd;
+	struct timeval	now;
+	long		ms;
+
+	pfd.fd = t->fd;
+	switch (SSL_get_error (t->ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		pfd.events = POLLIN;
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		pfd.events = POLLOUT;
+		break;
+	default:
+		return -1;
+	}
+	ppp_get_time (&now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000
+		+ (deadline->tv_usec - now.tv_usec) / 1000;
+	if (ms <= 0)
+		return -1;
+	if (poll (&pfd, 1, ms) <= 0)
+		return -1;
+	return 0;
+}
+
+/*
+ * Function: rc_tls_connect
+ *
+ * Purpose: make a TLS connection to a server, taking no more than
+ *	    timeout seconds
+ *
+ * Returns: the connection, or NULL
+ *
+ */
+
+struct rc_tls *rc_tls_connect (UINT4 ipaddr, int port, char *server_name,
+			       int timeout)
+{
+	struct rc_tls	*t;
+	struct sockaddr_in sin;
+	struct timeval	deadline, tv;
+	socklen_t	len;
+	int		ret, err, on = 1;
+	SSL_CTX		*ctx;
+
+	if ((ctx = rc_tls_context ()) == NULL)
+		return NULL;
+	if ((t = calloc (1, sizeof (*t))) == NULL)
+	{
+		error("rc_tls_connect: out of memory");
+		return NULL;
+	}
+	t->timeout = timeout;
+	ppp_get_time (&deadline);
+	deadline.tv_sec += timeout;
+
+	t->fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (t->fd < 0)
+	{
+		error("rc_tls_connect: socket: %m");
+		free (t);
+		return NULL;
+	}
+	fcntl (t->fd, F_SETFD, FD_CLOEXEC);
+	fcntl (t->fd, F_SETFL, fcntl (t->fd, F_GETFL) | O_NONBLOCK);
+	/* requests are small and each is waited for; don't hold them back */
+	setsockopt (t->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+
+	memset (&sin, 0, sizeof (sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl (rc_own_bind_ipaddress ());
+	if (sin.sin_addr.s_addr != INADDR_ANY
+	    && bind (t->fd, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+	{
+		error("rc_tls_connect: bind: %s: %m", server_name);
+		goto fail;
+	}
+
+	sin.sin_addr.s_addr = htonl (ipaddr);
+	sin.sin_port = htons ((unsigned short) port);
+	if (connect (t->fd, (struct sockaddr *) &sin, sizeof (sin)) < 0)
+	{
+		struct pollfd pfd;
+		long	ms;
+
+		if (errno != EINPROGRESS)
+		{
+			error("RadSec connect %s:%d: %m", server_name, port);
+			goto fail;
+		}
+		pfd.fd = t->fd;
+		pfd.events = POLLOUT;
+		ppp_get_time (&tv);
+		ms = (deadline.tv_sec - tv.tv_sec) * 1000
+			+ (deadline.tv_usec - tv.tv_usec) / 1000;
+		len = sizeof (err);
+		if (ms <= 0 || poll (&pfd, 1, ms) <= 0
+		    || getsockopt (t->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0
+		    || err != 0)
+		{
+			error("RadSec connect %s:%d: %s", server_name, port,
+			      err? strerror (err): "timed out");
+			goto fail;
+		}
+	}
+
+	if ((t->ssl = SSL_new (ctx)) == NULL || SSL_set_fd (t->ssl, t->fd) != 1)
+	{
+		rc_tls_error ("setup", server_name);
+		goto fail;
+	}
+	/* the certificate must be for the name or address we were given */
+	if (rc_good_ipaddr (server_name) == 0)
+		ret = X509_VERIFY_PARAM_set1_ip_asc (SSL_get0_param (t->ssl),
+						     server_name);
+	else
+	{
+		SSL_set_tlsext_host_name (t->ssl, server_name);
+		ret = SSL_set1_host (t->ssl, server_name);
+	}
+	if (ret != 1)
+	{
+		rc_tls_error ("setup", server_name);
+		goto fail;
+	}
+	while ((ret = SSL_connect (t->ssl)) != 1)
+	{
+		if (rc_tls_wait (t, ret, &deadline) < 0)
+		{
+			rc_tls_error ("handshake with", server_name);
+			goto fail;
+		}
+	}
+	dbglog("RadSec connection to %s:%d using %s", server_name, port,
+	       SSL_get_version (t->ssl));
+	return t;
+
+ fail:
+	rc_tls_close (t);
+	return NULL;
+}
+
+int rc_tls_fd (struct rc_tls *t)
+{
+	return t->fd;
+}
+
+/*
+ * Function: rc_tls_send
+ *
+ * Purpose: send a packet on a connection
+ *
+ * Returns: 0, or -1 if the connection has failed
+ *
+ */
+
+int rc_tls_send (struct rc_tls *t, const char *buf, int len)
+{
+	struct timeval	deadline;
+	int		ret;
+
+	ppp_get_time (&deadline);
+	deadline.tv_sec += t->timeout;
+	while ((ret = SSL_write (t->ssl, buf, len)) <= 0)
+	{
+		if (rc_tls_wait (t, ret, &deadline) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Function: rc_tls_recv
+ *
+ * Purpose: take the next whole packet the server has sent, reading
+ *	    more from the connection if need be but not waiting
+ *
+ * Returns: its length, 0 if there isn't a whole one yet, or -1 if
+ *	    the connection has closed or failed
+ *
+ */
+
+int rc_tls_recv (struct rc_tls *t, char *buf, int buflen)
+{
+	int		len, ret;
+
+	for (;;)
+	{
+		if (t->have >= AUTH_HDR_LEN)
+		{
+			len = (t->buf[2] << 8) + t->buf[3];
+			if (len < AUTH_HDR_LEN || len > RADSEC_PACKET_MAX
+			    || len > buflen)
+			{
+				error("RadSec: bad packet length %d", len);
+				return -1;
+			}
+			if (t->have >= len)
+			{
+				memcpy (buf, t->buf, len);
+				t->have -= len;
+				memmove (t->buf, t->buf + len, t->have);
+				return len;
+			}
+		}
+		ret = SSL_read (t->ssl, t->buf + t->have,
+				sizeof (t->buf) - t->have);
+		if (ret > 0)
+		{
+			t->have += ret;
+			continue;
+		}
+		switch (SSL_get_error (t->ssl, ret))
+		{
+		case SSL_ERROR_WANT_READ:
+		case SSL_ERROR_WANT_WRITE:
+			return 0;
+		case SSL_ERROR_ZERO_RETURN:
+			return -1;
+		default:
+			rc_tls_error ("read from", "server");
+			return -1;
+		}
+	}
+}
+
+/*
+ * Function: rc_tls_pending
+ *
+ * Purpose: say whether rc_tls_recv has something to return without
+ *	    the socket becoming readable, which poll wouldn't show
+ *
+ */
+
+int rc_tls_pending (struct rc_tls *t)
+{
+	int		len;
+
+	if (SSL_pending (t->ssl) > 0)
+		return 1;
+	if (t->have < AUTH_HDR_LEN)
+		return 0;
+	len = (t->buf[2] << 8) + t->buf[3];
+	return t->have >= len;
+}
+
+void rc_tls_close (struct rc_tls *t)
+{
+	if (t->ssl != NULL)
+	{
+		SSL_shutdown (t->ssl);
+		SSL_free (t->ssl);
+	}
+	if (t->fd >= 0)
+		close (t->fd);
+	free (t);
+}
+
+#endif /* RC_WITH_RADSEC */
@@ -18,6 +18,8 @@
 #include <radiusclient.h>
 #include <pathnames.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <pppd/probes.h>
 
 static void rc_random_vector (unsigned char *);
 static int rc_check_reply (AUTH_HDR *, int, char *, unsigned char *, unsigned char);
@@ -184,179 +186,554 @@ static int rc_pack_list (VALUE_PAIR *vp, char *secret, AUTH_HDR *auth)
 }
 
 /*
- * Function: rc_send_server
+ * What we have seen of each server's replies.  A server that has
+ * stopped answering is passed over for a while, and the latency of
+ * the ones that answer decides how long rc_send_hedged waits before
+ * asking the next server as well.
+ */
+#define RC_HEALTH_SERVERS	(2 * SERVER_MAX)
+#define RC_LATENCY_SAMPLES	32	/* recent reply times kept */
+#define RC_MIN_SAMPLES		8	/* needed before we hedge early */
+#define RC_HEDGE_MIN_MS		10
+#define RC_MAX_FAILURES		3	/* timeouts in a row before a server is skipped */
+#define RC_SKIP_TIME		30	/* seconds for which it is skipped */
+
+struct rc_health
+{
+	char		name[AUTH_ID_LEN + 1];
+	int		port;
+	int		failures;	/* consecutive timeouts */
+	time_t		skip_until;
+	int		nsamples;
+	int		next_sample;
+	int		latency_ms[RC_LATENCY_SAMPLES];
+};
+
+static struct rc_health rc_health_table[RC_HEALTH_SERVERS];
+static int rc_health_next;		/* slot to reuse next */
+
+static struct rc_health *rc_health_find (const char *name, int port, int create)
+{
+	struct rc_health *h;
+	int i;
+
+	for (i = 0; i < RC_HEALTH_SERVERS; i++)
+	{
+		h = &rc_health_table[i];
+		if (h->port == port && strcmp (h->name, name) == 0)
+			return h;
+	}
+	if (!create)
+		return NULL;
+	h = &rc_health_table[rc_health_next];
+	rc_health_next = (rc_health_next + 1) % RC_HEALTH_SERVERS;
+	memset (h, 0, sizeof (*h));
+	strlcpy (h->name, name, sizeof (h->name));
+	h->port = port;
+	return h;
+}
+
+static long rc_ms_since (struct timeval *then)
+{
+	struct timeval now;
+
+	ppp_get_time (&now);
+	return (now.tv_sec - then->tv_sec) * 1000
+		+ (now.tv_usec - then->tv_usec) / 1000;
+}
+
+static int rc_cmp_int (const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Function: rc_server_usable
  *
- * Purpose: send a request to a RADIUS server and wait for the reply
+ * Purpose: tell whether a server is worth asking, or has timed out
+ *	    too often lately.
  *
  */
 
-int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
+int rc_server_usable (const char *name, int port)
 {
-	int             sockfd;
-	struct sockaddr salocal;
-	struct sockaddr saremote;
-	struct sockaddr_in *sin;
-	struct timeval  authtime;
-	fd_set          readfds;
-	AUTH_HDR       *auth, *recv_auth;
+	struct rc_health *h = rc_health_find (name, port, 0);
+	struct timeval now;
+
+	if (h == NULL || h->skip_until == 0)
+		return 1;
+	ppp_get_time (&now);
+	return now.tv_sec >= h->skip_until;
+}
+
+/*
+ * Function: rc_hedge_delay
+ *
+ * Purpose: how long to wait for a server before asking another one
+ *	    too: its 95th percentile reply time, or the whole timeout
+ *	    until we know that.
+ *
+ */
+
+static long rc_hedge_delay (const char *name, int port, int timeout)
+{
+	struct rc_health *h = rc_health_find (name, port, 0);
+	int sorted[RC_LATENCY_SAMPLES];
+	long ms, max = timeout * 1000L;
+
+	if (h == NULL || h->nsamples < RC_MIN_SAMPLES)
+		return max;
+	memcpy (sorted, h->latency_ms, h->nsamples * sizeof (int));
+	qsort (sorted, h->nsamples, sizeof (int), rc_cmp_int);
+	ms = sorted[(h->nsamples * 95) / 100];
+	if (ms < RC_HEDGE_MIN_MS)
+		ms = RC_HEDGE_MIN_MS;
+	return MIN (ms, max);
+}
+
+/*
+ * Each server gets one UDP socket, opened the first time it is asked
+ * and kept for the life of pppd.  Requests to it are told apart by
+ * their identifier, which is only reused once the request holding it
+ * has finished.  The socket stays in pppd's main loop, so replies to
+ * asynchronous requests, and late ones to requests that have given
+ * up, are read whenever they come in.
+ *
+ * A RadSec server (see radsec.c) gets a TLS connection instead, made
+ * when a request is to be sent and there is none, and otherwise used
+ * in just the same way.
+ */
+struct rc_socket
+{
+	UINT4		ipaddr;
+	int		port;
+	int		fd;		/* -1 while a RadSec one isn't connected */
+	int		radsec;
+	struct rc_tls	*tls;
+	unsigned int	conn;		/* RadSec connections made so far */
+	char		*name;		/* the name the server was given by */
+	struct rc_request *inflight[256];	/* by identifier */
+	struct rc_socket *next;
+};
+
+static struct rc_socket *rc_sockets;
+
+/*
+ * A request on its way to a server: the packet, and what is needed to
+ * resend it and check the reply.
+ */
+struct rc_request
+{
+	SEND_DATA	*data;
+	struct rc_health *health;
+	struct rc_socket *sock;
+	struct timeval	sent;		/* when it was last sent */
+	unsigned int	conn;		/* the RadSec connection it went on */
 	UINT4           auth_ipaddr;
-	char           *server_name;	/* Name of server to query */
-	socklen_t       salen;
-	int             result;
+	struct sockaddr saremote;
 	int             total_length;
-	socklen_t       length;
-	int             retry_max;
-	int		secretlen;
+	int		retries;
 	char            secret[MAX_SECRET_LENGTH + 1];
 	unsigned char   vector[AUTH_VECTOR_LEN];
-	char            recv_buffer[BUFFER_LEN];
 	char            send_buffer[BUFFER_LEN];
-	int		retries;
+	/* for rc_send_server_async */
+	REQUEST_INFO	*info;
+	rc_send_done_fn	*done;
+	void		*arg;
+	char		msg[BUFFER_LEN];
+};
+
+/* rc_request_check: the packet isn't a valid reply, keep waiting */
+#define RC_DISCARD	(-10)
+
+static void rc_socket_input (int fd, void *arg);
+
+/*
+ * Function: rc_socket_get
+ *
+ * Purpose: find the socket for a server, opening it if need be
+ *
+ */
+
+static struct rc_socket *rc_socket_get (UINT4 ipaddr, int port, char *server_name)
+{
+	struct rc_socket *sock;
+	struct sockaddr salocal;
+	struct sockaddr_in *sin;
+	socklen_t       length;
+
+	for (sock = rc_sockets; sock != NULL; sock = sock->next)
+		if (sock->ipaddr == ipaddr && sock->port == port)
+			return sock;
+
+	if ((sock = calloc (1, sizeof (*sock))) == NULL
+	    || (sock->name = strdup (server_name)) == NULL)
+	{
+		error("rc_send_server: out of memory");
+		free (sock);
+		return NULL;
+	}
+	sock->ipaddr = ipaddr;
+	sock->port = port;
+	if (rc_radsec_server (server_name, port))
+	{
+		/* connected when there is something to send */
+		sock->radsec = 1;
+		sock->fd = -1;
+		sock->next = rc_sockets;
+		rc_sockets = sock;
+		return sock;
+	}
+
+	sock->fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (sock->fd < 0)
+	{
+		error("rc_send_server: socket: %s", strerror(errno));
+		free (sock->name);
+		free (sock);
+		return NULL;
+	}
+	fcntl(sock->fd, F_SETFD, FD_CLOEXEC);
+	fcntl(sock->fd, F_SETFL, fcntl(sock->fd, F_GETFL) | O_NONBLOCK);
+
+	length = sizeof (salocal);
+	sin = (struct sockaddr_in *) & salocal;
+	memset ((char *) sin, '\0', (size_t) length);
+	sin->sin_family = AF_INET;
+	sin->sin_addr.s_addr = htonl(rc_own_bind_ipaddress());
+	sin->sin_port = htons ((unsigned short) 0);
+	if (bind (sock->fd, (struct sockaddr *) sin, length) < 0)
+	{
+		error("rc_send_server: bind: %s: %m", server_name);
+		close (sock->fd);
+		free (sock->name);
+		free (sock);
+		return NULL;
+	}
+
+	sock->next = rc_sockets;
+	rc_sockets = sock;
+	ppp_add_fd_handler (sock->fd, rc_socket_input, sock);
+	return sock;
+}
+
+#ifdef RC_WITH_RADSEC
+/* rc_socket_connect - make a RadSec server's connection */
+static int rc_socket_connect (struct rc_socket *sock, int timeout)
+{
+	sock->tls = rc_tls_connect (sock->ipaddr, sock->port, sock->name,
+				    timeout);
+	if (sock->tls == NULL)
+		return -1;
+	sock->fd = rc_tls_fd (sock->tls);
+	sock->conn++;
+	ppp_add_fd_handler (sock->fd, rc_socket_input, sock);
+	return 0;
+}
+
+/*
+ * rc_socket_disconnect - close a RadSec server's connection.  The
+ * requests which were on it are sent on a new one when they are next
+ * due to be.
+ */
+static void rc_socket_disconnect (struct rc_socket *sock)
+{
+	ppp_remove_fd_handler (sock->fd);
+	rc_tls_close (sock->tls);
+	sock->tls = NULL;
+	sock->fd = -1;
+}
+#endif
+
+/*
+ * rc_socket_pending - say whether there is a reply to read which
+ * select wouldn't show, having already been read from the kernel.
+ */
+static int rc_socket_pending (struct rc_socket *sock)
+{
+#ifdef RC_WITH_RADSEC
+	return sock->tls != NULL && rc_tls_pending (sock->tls);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Function: rc_socket_recv
+ *
+ * Purpose: read a packet from a server's socket
+ *
+ * Returns: 0 if there was nothing to read, otherwise 1, with *reqp
+ *	    set to the request it answers, or NULL if it answers none.
+ *
+ */
+
+static int rc_socket_recv (struct rc_socket *sock, char *buf, int buflen,
+			   struct rc_request **reqp)
+{
+	ssize_t         length;
+
+	*reqp = NULL;
+#ifdef RC_WITH_RADSEC
+	if (sock->radsec)
+	{
+		if (sock->tls == NULL)
+			return 0;
+		length = rc_tls_recv (sock->tls, buf, buflen);
+		if (length < 0)
+		{
+			warn("RadSec connection to %s:%d lost", sock->name,
+			     sock->port);
+			rc_socket_disconnect (sock);
+		}
+		if (length <= 0)
+			return 0;
+		*reqp = sock->inflight[((AUTH_HDR *) buf)->id];
+		return 1;
+	}
+#endif
+	length = recv (sock->fd, buf, buflen, 0);
+	if (length < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			error("rc_send_server: recvfrom: %s:%d: %m",
+			      rc_ip_hostname (sock->ipaddr), sock->port);
+		return 0;
+	}
+	if (length >= AUTH_HDR_LEN)
+		*reqp = sock->inflight[((AUTH_HDR *) buf)->id];
+	return 1;
+}
+
+/*
+ * Function: rc_request_open
+ *
+ * Purpose: look up the server, give the request an identifier on
+ *	    the server's socket and build the packet
+ *
+ */
+
+static int rc_request_open (struct rc_request *req, SEND_DATA *data)
+{
+	AUTH_HDR       *auth;
+	char           *server_name;	/* Name of server to query */
+	struct sockaddr_in *sin;
+	int		secretlen, i;
 	VALUE_PAIR	*vp;
 
+	req->data = data;
+	req->sock = NULL;
+	req->retries = 0;
+	req->health = NULL;
+
 	server_name = data->server;
 	if (server_name == (char *) NULL || server_name[0] == '\0')
 		return (ERROR_RC);
 
-	if ((vp = rc_avpair_get(data->send_pairs, PW_SERVICE_TYPE)) && \
+	if (rc_radsec_server (server_name, data->svc_port))
+	{
+		/* TLS does the protecting; RFC 6614 fixes the secret */
+		strcpy(req->secret, "radsec");
+		if ((req->auth_ipaddr = rc_get_ipaddr(server_name)) == 0)
+			return (ERROR_RC);
+	}
+	else if ((vp = rc_avpair_get(data->send_pairs, PW_SERVICE_TYPE)) && \
 	    (vp->lvalue == PW_ADMINISTRATIVE))
 	{
-		strcpy(secret, MGMT_POLL_SECRET);
-		if ((auth_ipaddr = rc_get_ipaddr(server_name)) == 0)
+		strcpy(req->secret, MGMT_POLL_SECRET);
+		if ((req->auth_ipaddr = rc_get_ipaddr(server_name)) == 0)
 			return (ERROR_RC);
 	}
 	else
 	{
-		if (rc_find_server (server_name, &auth_ipaddr, secret) != 0)
+		if (rc_find_server (server_name, &req->auth_ipaddr, req->secret) != 0)
 		{
-			memset (secret, '\0', sizeof (secret));
+			memset (req->secret, '\0', sizeof (req->secret));
 			return (ERROR_RC);
 		}
 	}
 
-	sockfd = socket (AF_INET, SOCK_DGRAM, 0);
-	if (sockfd < 0)
+	if ((req->sock = rc_socket_get (req->auth_ipaddr, data->svc_port,
+					server_name)) == NULL)
 	{
-		memset (secret, '\0', sizeof (secret));
-		error("rc_send_server: socket: %s", strerror(errno));
+		memset (req->secret, '\0', sizeof (req->secret));
 		return (ERROR_RC);
 	}
 
-	length = sizeof (salocal);
-	sin = (struct sockaddr_in *) & salocal;
-	memset ((char *) sin, '\0', (size_t) length);
-	sin->sin_family = AF_INET;
-	sin->sin_addr.s_addr = htonl(rc_own_bind_ipaddress());
-	sin->sin_port = htons ((unsigned short) 0);
-	if (bind (sockfd, (struct sockaddr *) sin, length) < 0 ||
-		   getsockname (sockfd, (struct sockaddr *) sin, &length) < 0)
+	/* the first identifier from data->seq_nbr on that isn't in use */
+	for (i = 0; i < 256 && req->sock->inflight[data->seq_nbr] != NULL; i++)
+		data->seq_nbr++;
+	if (req->sock->inflight[data->seq_nbr] != NULL)
 	{
-		close (sockfd);
-		memset (secret, '\0', sizeof (secret));
-		error("rc_send_server: bind: %s: %m", server_name);
+		error("rc_send_server: too many requests outstanding to %s",
+		      server_name);
+		req->sock = NULL;
+		memset (req->secret, '\0', sizeof (req->secret));
 		return (ERROR_RC);
 	}
 
-	retry_max = data->retries;	/* Max. numbers to try for reply */
-	retries = 0;			/* Init retry cnt for blocking call */
-
 	/* Build a request */
-	auth = (AUTH_HDR *) send_buffer;
+	auth = (AUTH_HDR *) req->send_buffer;
 	auth->code = data->code;
 	auth->id = data->seq_nbr;
 
 	if (data->code == PW_ACCOUNTING_REQUEST)
 	{
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		req->total_length = rc_pack_list(data->send_pairs, req->secret, auth) + AUTH_HDR_LEN;
 
-		auth->length = htons ((unsigned short) total_length);
+		auth->length = htons ((unsigned short) req->total_length);
 
 		memset((char *) auth->vector, 0, AUTH_VECTOR_LEN);
-		secretlen = strlen (secret);
-		memcpy ((char *) auth + total_length, secret, secretlen);
-		rc_md5_calc (vector, (unsigned char *) auth, total_length + secretlen);
-		memcpy ((char *) auth->vector, (char *) vector, AUTH_VECTOR_LEN);
+		secretlen = strlen (req->secret);
+		memcpy ((char *) auth + req->total_length, req->secret, secretlen);
+		rc_md5_calc (req->vector, (unsigned char *) auth, req->total_length + secretlen);
+		memcpy ((char *) auth->vector, (char *) req->vector, AUTH_VECTOR_LEN);
 	}
 	else
 	{
-		rc_random_vector (vector);
-		memcpy (auth->vector, vector, AUTH_VECTOR_LEN);
+		rc_random_vector (req->vector);
+		memcpy (auth->vector, req->vector, AUTH_VECTOR_LEN);
 
-		total_length = rc_pack_list(data->send_pairs, secret, auth) + AUTH_HDR_LEN;
+		req->total_length = rc_pack_list(data->send_pairs, req->secret, auth) + AUTH_HDR_LEN;
 
-		auth->length = htons ((unsigned short) total_length);
+		auth->length = htons ((unsigned short) req->total_length);
 	}
 
-	sin = (struct sockaddr_in *) & saremote;
-	memset ((char *) sin, '\0', sizeof (saremote));
+	sin = (struct sockaddr_in *) & req->saremote;
+	memset ((char *) sin, '\0', sizeof (req->saremote));
 	sin->sin_family = AF_INET;
-	sin->sin_addr.s_addr = htonl (auth_ipaddr);
+	sin->sin_addr.s_addr = htonl (req->auth_ipaddr);
 	sin->sin_port = htons ((unsigned short) data->svc_port);
 
-	for (;;)
-	{
-		sendto (sockfd, (char *) auth, (unsigned int) total_length, (int) 0,
-			(struct sockaddr *) sin, sizeof (struct sockaddr_in));
+	req->sock->inflight[data->seq_nbr] = req;
+	req->health = rc_health_find (server_name, data->svc_port, 1);
+	return (OK_RC);
+}
 
-		authtime.tv_usec = 0L;
-		authtime.tv_sec = (long) data->timeout;
-		FD_ZERO (&readfds);
-		FD_SET (sockfd, &readfds);
-		if (select (sockfd + 1, &readfds, NULL, NULL, &authtime) < 0)
-		{
-			if (errno == EINTR && !ppp_signaled(SIGTERM))
-				continue;
-			error("rc_send_server: select: %m");
-			memset (secret, '\0', sizeof (secret));
-			close (sockfd);
-			return (ERROR_RC);
-		}
-		if (FD_ISSET (sockfd, &readfds))
-			break;
+static void rc_request_send (struct rc_request *req)
+{
+	struct rc_socket *sock = req->sock;
 
-		/*
-		 * Timed out waiting for response.  Retry "retry_max" times
-		 * before giving up.  If retry_max = 0, don't retry at all.
-		 */
-		if (++retries >= retry_max)
+	ppp_get_time (&req->sent);
+#ifdef RC_WITH_RADSEC
+	if (sock->radsec)
+	{
+		/* TCP will get it there if the connection holds */
+		if (req->retries > 0 && sock->tls != NULL && req->conn == sock->conn)
+			return;
+		if (sock->tls == NULL
+		    && rc_socket_connect (sock, req->data->timeout) < 0)
+			return;
+		PPP_PROBE4(radius, request_send, req->auth_ipaddr,
+			   req->data->seq_nbr,
+			   ((AUTH_HDR *) req->send_buffer)->code, req->retries);
+		req->conn = sock->conn;
+		if (rc_tls_send (sock->tls, req->send_buffer,
+				 req->total_length) < 0)
 		{
-			error("rc_send_server: no reply from RADIUS server %s:%u",
-			      rc_ip_hostname (auth_ipaddr), data->svc_port);
-			close (sockfd);
-			memset (secret, '\0', sizeof (secret));
-			return (TIMEOUT_RC);
+			warn("RadSec connection to %s:%d lost", sock->name,
+			     sock->port);
+			rc_socket_disconnect (sock);
 		}
+		return;
 	}
-	salen = sizeof (saremote);
-	length = recvfrom (sockfd, (char *) recv_buffer,
-			   (int) sizeof (recv_buffer),
-			   (int) 0, &saremote, &salen);
+#endif
+	PPP_PROBE4(radius, request_send, req->auth_ipaddr, req->data->seq_nbr,
+		   ((AUTH_HDR *) req->send_buffer)->code, req->retries);
+	sendto (sock->fd, req->send_buffer, (unsigned int) req->total_length,
+		(int) 0, &req->saremote, sizeof (struct sockaddr_in));
+}
 
-	if (length <= 0)
+/* the server answered */
+static void rc_request_answered (struct rc_request *req)
+{
+	struct rc_health *h = req->health;
+
+	if (h == NULL)
+		return;
+	h->failures = 0;
+	h->skip_until = 0;
+	/* a reply to a retransmission doesn't say how long it took */
+	if (req->retries == 0)
 	{
-		error("rc_send_server: recvfrom: %s:%d: %m", server_name,\
-		      data->svc_port);
-		close (sockfd);
-		memset (secret, '\0', sizeof (secret));
-		return (ERROR_RC);
+		h->latency_ms[h->next_sample] = rc_ms_since (&req->sent);
+		h->next_sample = (h->next_sample + 1) % RC_LATENCY_SAMPLES;
+		if (h->nsamples < RC_LATENCY_SAMPLES)
+			h->nsamples++;
+	}
+}
+
+/* the server didn't answer in time */
+static void rc_request_missed (struct rc_request *req)
+{
+	struct rc_health *h = req->health;
+	struct timeval now;
+
+	if (h == NULL)
+		return;
+	if (++h->failures >= RC_MAX_FAILURES)
+	{
+		ppp_get_time (&now);
+		if (h->skip_until == 0)
+			warn("RADIUS server %s:%u is not answering; skipping it for %d seconds",
+			     h->name, h->port, RC_SKIP_TIME);
+		h->skip_until = now.tv_sec + RC_SKIP_TIME;
 	}
+}
+
+/* the server didn't answer at all */
+static void rc_request_timedout (struct rc_request *req)
+{
+	PPP_PROBE2(radius, timeout, req->auth_ipaddr, req->data->seq_nbr);
+	error("rc_send_server: no reply from RADIUS server %s:%u",
+	      rc_ip_hostname (req->auth_ipaddr), req->data->svc_port);
+	rc_request_missed (req);
+}
+
+static void rc_request_close (struct rc_request *req)
+{
+	if (req->sock != NULL && req->sock->inflight[req->data->seq_nbr] == req)
+		req->sock->inflight[req->data->seq_nbr] = NULL;
+	req->sock = NULL;
+	memset (req->secret, '\0', sizeof (req->secret));
+}
+
+/*
+ * Function: rc_request_check
+ *
+ * Purpose: check a reply read from the request's socket
+ *
+ * Returns: OK_RC or BADRESP_RC as the server said, or RC_DISCARD if
+ *	    the packet wasn't a genuine reply to the request.
+ *
+ */
+
+static int rc_request_check (struct rc_request *req, char *recv_buffer,
+			     char *msg, REQUEST_INFO *info)
+{
+	SEND_DATA      *data = req->data;
+	AUTH_HDR       *recv_auth;
+	int             result;
+	VALUE_PAIR	*vp;
 
 	recv_auth = (AUTH_HDR *)recv_buffer;
 
-	result = rc_check_reply (recv_auth, BUFFER_LEN, secret, vector, data->seq_nbr);
+	/* anyone can send us a packet with the right id; ignore forgeries */
+	if (rc_check_reply (recv_auth, BUFFER_LEN, req->secret, req->vector,
+			    data->seq_nbr) != OK_RC)
+		return (RC_DISCARD);
+	PPP_PROBE3(radius, reply, req->auth_ipaddr, data->seq_nbr,
+		   recv_auth->code);
+	rc_request_answered (req);
 
 	data->receive_pairs = rc_avpair_gen(recv_auth);
 
-	close (sockfd);
 	if (info)
 	{
-		memcpy(info->secret, secret, sizeof(info->secret));
-		memcpy(info->request_vector, vector,
+		memcpy(info->secret, req->secret, sizeof(info->secret));
+		memcpy(info->request_vector, req->vector,
 		       sizeof(info->request_vector));
 	}
-	memset (secret, '\0', sizeof (secret));
-
-	if (result != OK_RC) return (result);
 
 	*msg = '\0';
 	vp = data->receive_pairs;
@@ -384,6 +761,290 @@ int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
 	return (result);
 }
 
+static void rc_async_reply (struct rc_request *req, char *buf);
+
+/*
+ * Function: rc_send_server
+ *
+ * Purpose: send a request to a RADIUS server and wait for the reply
+ *
+ */
+
+int rc_send_server (SEND_DATA *data, char *msg, REQUEST_INFO *info)
+{
+	int		winner;
+
+	return rc_send_hedged (data, 1, msg, info, &winner);
+}
+
+/*
+ * Function: rc_send_hedged
+ *
+ * Purpose: send a request to the first of n servers, and if it hasn't
+ *	    answered within its usual reply time (see rc_hedge_delay),
+ *	    to the next one as well, and so on, taking the first
+ *	    answer.  Each data[i] must be set up as for rc_send_server.
+ *
+ * Returns: as rc_send_server; *winner is set to the index of the
+ *	    server whose answer was taken.
+ *
+ */
+
+int rc_send_hedged (SEND_DATA *data, int n, char *msg, REQUEST_INFO *info,
+		    int *winner)
+{
+	struct rc_request *reqs, *req;
+	struct rc_socket *sock;
+	struct timeval  now, tv, hedge_at, wake;
+	long		ms;
+	fd_set          readfds;
+	char            recv_buffer[BUFFER_LEN];
+	int		*state;		/* 0 unsent, 1 waiting, 2 finished */
+	int		i, next, active, maxfd, result, last_error, wake_set;
+
+	reqs = calloc (n, sizeof (*reqs));
+	state = calloc (n, sizeof (*state));
+	if (reqs == NULL || state == NULL)
+	{
+		free (reqs);
+		free (state);
+		error("rc_send_hedged: out of memory");
+		return (ERROR_RC);
+	}
+
+	*winner = -1;
+	result = ERROR_RC;
+	last_error = ERROR_RC;
+	next = 0;
+	active = 0;
+	timerclear (&hedge_at);
+	for (;;)
+	{
+		ppp_get_time (&now);
+
+		/* start the next server if the ones asked so far are slow */
+		while (next < n && (active == 0 || !timercmp (&now, &hedge_at, <)))
+		{
+			i = next++;
+			req = &reqs[i];
+			state[i] = 2;
+			if (rc_request_open (req, &data[i]) != OK_RC)
+				continue;
+			if (active > 0)
+				dbglog("rc_send_hedged: also asking RADIUS server %s:%d",
+				       data[i].server, data[i].svc_port);
+			rc_request_send (req);
+			state[i] = 1;
+			++active;
+			ms = rc_hedge_delay (data[i].server, data[i].svc_port,
+					     data[i].timeout);
+			tv.tv_sec = ms / 1000;
+			tv.tv_usec = (ms % 1000) * 1000;
+			timeradd (&now, &tv, &hedge_at);
+		}
+		if (active == 0)
+		{
+			result = last_error;
+			break;
+		}
+
+		/* wait until something answers or is due to be resent */
+		wake_set = next < n;
+		wake = hedge_at;
+		FD_ZERO (&readfds);
+		maxfd = -1;
+		for (i = 0; i < n; i++)
+		{
+			if (state[i] != 1)
+				continue;
+			req = &reqs[i];
+			tv.tv_sec = req->sent.tv_sec + data[i].timeout;
+			tv.tv_usec = req->sent.tv_usec;
+			if (rc_socket_pending (req->sock))
+				tv = now;
+			if (!wake_set || timercmp (&tv, &wake, <))
+				wake = tv;
+			wake_set = 1;
+			if (req->sock->fd < 0)
+				continue;
+			FD_SET (req->sock->fd, &readfds);
+			if (req->sock->fd > maxfd)
+				maxfd = req->sock->fd;
+		}
+		tv = wake;
+		if (timercmp (&tv, &now, <))
+			timerclear (&tv);
+		else
+			timersub (&tv, &now, &tv);
+
+		if (select (maxfd + 1, &readfds, NULL, NULL, &tv) < 0)
+		{
+			if (errno == EINTR && !ppp_signaled(SIGTERM))
+				continue;
+			error("rc_send_hedged: select: %m");
+			break;
+		}
+
+		/* the sockets may be shared with asynchronous requests too */
+		for (i = 0; i < n; i++)
+		{
+			if (state[i] != 1)
+				continue;
+			sock = reqs[i].sock;
+			if (sock->fd < 0 || !FD_ISSET (sock->fd, &readfds))
+			{
+				if (!rc_socket_pending (sock))
+					continue;
+			}
+			else
+				FD_CLR (sock->fd, &readfds);
+			while (rc_socket_recv (sock, recv_buffer,
+					       sizeof (recv_buffer), &req))
+			{
+				if (req == NULL)
+					continue;
+				if (req->done != NULL)
+				{
+					rc_async_reply (req, recv_buffer);
+					continue;
+				}
+				if (req < reqs || req >= reqs + n)
+					continue;
+				result = rc_request_check (req, recv_buffer, msg, info);
+				if (result != RC_DISCARD)
+				{
+					*winner = req - reqs;
+					goto done;
+				}
+			}
+		}
+
+		ppp_get_time (&now);
+		for (i = 0; i < n; i++)
+		{
+			if (state[i] != 1)
+				continue;
+			req = &reqs[i];
+			tv.tv_sec = req->sent.tv_sec + data[i].timeout;
+			tv.tv_usec = req->sent.tv_usec;
+			if (timercmp (&now, &tv, <))
+				continue;
+			if (++req->retries < data[i].retries)
+			{
+				rc_request_send (req);
+				continue;
+			}
+			rc_request_timedout (req);
+			last_error = TIMEOUT_RC;
+			rc_request_close (req);
+			state[i] = 2;
+			--active;
+		}
+	}
+
+ done:
+	for (i = 0; i < n; i++) {
+		if (state[i] != 1)
+			continue;
+		/* one asked earlier that a later one beat counts as a miss */
+		if (i < *winner)
+			rc_request_missed (&reqs[i]);
+		rc_request_close (&reqs[i]);
+	}
+	free (reqs);
+	free (state);
+
+	/* replies read along with ours that pppd's main loop won't see */
+	for (sock = rc_sockets; sock != NULL; sock = sock->next)
+		if (rc_socket_pending (sock))
+			rc_socket_input (sock->fd, sock);
+	return (result);
+}
+
+static void rc_async_timeout (void *arg);
+
+static void rc_async_finish (struct rc_request *req, int result)
+{
+	ppp_untimeout (rc_async_timeout, req);
+	rc_request_close (req);
+	(*req->done) (result, req->data, req->msg, req->arg);
+	free (req);
+}
+
+static void rc_async_reply (struct rc_request *req, char *buf)
+{
+	int		result;
+
+	result = rc_request_check (req, buf, req->msg, req->info);
+	if (result != RC_DISCARD)
+		rc_async_finish (req, result);
+}
+
+/* called from pppd's main loop when a server's socket is readable */
+static void rc_socket_input (int fd, void *arg)
+{
+	struct rc_socket *sock = arg;
+	struct rc_request *req;
+	char            recv_buffer[BUFFER_LEN];
+
+	while (rc_socket_recv (sock, recv_buffer, sizeof (recv_buffer), &req))
+		if (req != NULL && req->done != NULL)
+			rc_async_reply (req, recv_buffer);
+}
+
+static void rc_async_timeout (void *arg)
+{
+	struct rc_request *req = arg;
+
+	if (++req->retries >= req->data->retries)
+	{
+		rc_request_timedout (req);
+		rc_async_finish (req, TIMEOUT_RC);
+		return;
+	}
+	rc_request_send (req);
+	ppp_timeout (rc_async_timeout, req, req->data->timeout, 0);
+}
+
+/*
+ * Function: rc_send_server_async
+ *
+ * Purpose: send a request to a RADIUS server without waiting for the
+ *	    reply.  The reply is read, and the request retransmitted,
+ *	    from pppd's main loop, and done(result, data, msg, arg) is
+ *	    called when it completes.  data and info must remain valid
+ *	    until then.
+ *
+ * Returns: OK_RC if the request was sent, otherwise ERROR_RC, in which
+ *	    case done is not called.
+ *
+ */
+
+int rc_send_server_async (SEND_DATA *data, REQUEST_INFO *info,
+			  rc_send_done_fn *done, void *arg)
+{
+	struct rc_request *req;
+
+	if ((req = malloc (sizeof (*req))) == NULL)
+	{
+		error("rc_send_server_async: out of memory");
+		return (ERROR_RC);
+	}
+	if (rc_request_open (req, data) != OK_RC)
+	{
+		free (req);
+		return (ERROR_RC);
+	}
+	req->info = info;
+	req->done = done;
+	req->arg = arg;
+	req->msg[0] = '\0';
+
+	rc_request_send (req);
+	ppp_timeout (rc_async_timeout, req, data->timeout, 0);
+	return (OK_RC);
+}
+
 /*
  * Function: rc_check_reply
  *
@@ -0,0 +1,357 @@
+/*
+ * spool.c - keep accounting records on disk until a server has them.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * See the file COPYRIGHT for the respective terms and conditions.
+ *
+ */
+
+#include <includes.h>
+#include <radiusclient.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * The spool is a file of records, each appended with a single write
+ * and synced before rc_spool_acct returns.  Any pppd using the spool
+ * replays the records still waiting in it, one at a time, to the
+ * configured accounting servers, reading them through a mapping of
+ * the file, and marks each one sent as a server acknowledges it.
+ * When none are left the file is truncated, and looked at again from
+ * time to time for records that a pppd which exited left unsent.
+ *
+ * Two bytes of the file are used as fcntl locks, so they go away with
+ * the process holding them: RC_SPOOL_DRAIN_LOCK is held by whichever
+ * pppd is replaying records, and RC_SPOOL_FILE_LOCK is held briefly
+ * while a record is appended or the file is truncated.
+ */
+
+#define RC_SPOOL_MAGIC		0x52535031	/* "RSP1" */
+#define RC_SPOOL_DRAIN_LOCK	0
+#define RC_SPOOL_FILE_LOCK	1
+
+#define RC_SPOOL_RETRY		30	/* seconds before the first retry */
+#define RC_SPOOL_RETRY_MAX	600	/* longest wait between retries */
+
+struct rc_spool_rec
+{
+	uint32_t	magic;
+	uint32_t	length;		/* of the record, header included */
+	uint32_t	sent;		/* set once a server has it */
+	uint32_t	client_port;
+	int64_t		queued;		/* time(2) it was spooled */
+	/* then the attributes, each a rc_spool_attr and its value */
+};
+
+struct rc_spool_attr
+{
+	int32_t		attribute;
+	int32_t		vendorcode;
+	int32_t		type;
+	uint32_t	lvalue;		/* for strings, the length */
+};
+
+#define RC_SPOOL_ALIGN(n)	(((n) + 7) & ~7)
+
+static int spool_fd = -1;
+static int spool_draining;		/* we hold RC_SPOOL_DRAIN_LOCK */
+static off_t spool_pos;			/* record being replayed */
+static int spool_retry = RC_SPOOL_RETRY;
+
+static void rc_spool_drain (void *);
+
+static int rc_spool_lock (int which, int type, int wait)
+{
+	struct flock fl;
+
+	memset (&fl, 0, sizeof (fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = which;
+	fl.l_len = 1;
+	return fcntl (spool_fd, wait? F_SETLKW: F_SETLK, &fl);
+}
+
+/*
+ * Function: rc_spool_open
+ *
+ * Purpose: open the accounting spool named by acct_spool in the
+ *	    config file, if there is one, and start replaying anything
+ *	    left in it.
+ *
+ * Returns: 0 on success (or if no spool is configured), -1 on failure
+ *
+ */
+
+int rc_spool_open (void)
+{
+	char	*path = rc_conf_str ("acct_spool");
+
+	if (spool_fd >= 0 || path == NULL || *path == '\0')
+		return 0;
+	spool_fd = open (path, O_RDWR | O_CREAT, 0600);
+	if (spool_fd < 0)
+	{
+		error("rc_spool_open: couldn't open %s: %m", path);
+		return -1;
+	}
+	fcntl (spool_fd, F_SETFD, FD_CLOEXEC);
+	ppp_timeout (rc_spool_drain, NULL, 1, 0);
+	return 0;
+}
+
+/*
+ * Function: rc_spool_acct
+ *
+ * Purpose: add an accounting request with the value pairs send for
+ *	    port client_port to the spool, to be sent to the configured
+ *	    accounting servers as soon as one will take it.  NAS-Port,
+ *	    Acct-Delay-Time and the NAS's identity are filled in when it
+ *	    is sent.  send is left to the caller.
+ *
+ * Returns: OK_RC once the request is safely on disk, ERROR_RC if
+ *	    there is no spool or it couldn't be written.
+ *
+ */
+
+int rc_spool_acct (UINT4 client_port, VALUE_PAIR *send)
+{
+	struct rc_spool_rec *rec;
+	struct rc_spool_attr *a;
+	VALUE_PAIR	*vp;
+	size_t		len, vlen;
+	char		*buf;
+	ssize_t		n;
+	off_t		end;
+
+	if (spool_fd < 0)
+		return (ERROR_RC);
+
+	len = sizeof (*rec);
+	for (vp = send; vp != NULL; vp = vp->next)
+	{
+		vlen = vp->type == PW_TYPE_STRING? vp->lvalue: 0;
+		len += sizeof (*a) + RC_SPOOL_ALIGN (vlen);
+	}
+	if ((buf = calloc (1, len)) == NULL)
+	{
+		error("rc_spool_acct: out of memory");
+		return (ERROR_RC);
+	}
+
+	rec = (struct rc_spool_rec *) buf;
+	rec->magic = RC_SPOOL_MAGIC;
+	rec->length = len;
+	rec->client_port = client_port;
+	rec->queued = time (NULL);
+	len = sizeof (*rec);
+	for (vp = send; vp != NULL; vp = vp->next)
+	{
+		a = (struct rc_spool_attr *) (buf + len);
+		a->attribute = vp->attribute;
+		a->vendorcode = vp->vendorcode;
+		a->type = vp->type;
+		a->lvalue = vp->lvalue;
+		len += sizeof (*a);
+		if (vp->type == PW_TYPE_STRING)
+		{
+			memcpy (buf + len, vp->strvalue, vp->lvalue);
+			len += RC_SPOOL_ALIGN (vp->lvalue);
+		}
+	}
+
+	rc_spool_lock (RC_SPOOL_FILE_LOCK, F_WRLCK, 1);
+	end = lseek (spool_fd, 0, SEEK_END);
+	n = pwrite (spool_fd, buf, len, end);
+	if (n != (ssize_t) len && ftruncate (spool_fd, end) < 0)
+		error("rc_spool_acct: couldn't remove partial record: %m");
+	rc_spool_lock (RC_SPOOL_FILE_LOCK, F_UNLCK, 0);
+	free (buf);
+	if (n != (ssize_t) len)
+	{
+		error("rc_spool_acct: couldn't write to accounting spool: %m");
+		return (ERROR_RC);
+	}
+	fdatasync (spool_fd);
+
+	/* send it now, unless someone is already working through the spool */
+	if (!spool_draining)
+	{
+		ppp_untimeout (rc_spool_drain, NULL);
+		rc_spool_drain (NULL);
+	}
+	return (OK_RC);
+}
+
+/*
+ * Function: rc_spool_unpack
+ *
+ * Purpose: turn a spooled record back into value pairs
+ *
+ */
+
+static VALUE_PAIR *rc_spool_unpack (struct rc_spool_rec *rec)
+{
+	struct rc_spool_attr *a;
+	VALUE_PAIR	*send = NULL;
+	char		*p = (char *) rec;
+	size_t		off;
+	UINT4		delay;
+
+	for (off = sizeof (*rec); off + sizeof (*a) <= rec->length; )
+	{
+		a = (struct rc_spool_attr *) (p + off);
+		off += sizeof (*a);
+		if (a->type == PW_TYPE_STRING)
+		{
+			if (a->lvalue > AUTH_STRING_LEN
+			    || off + a->lvalue > rec->length)
+				break;
+			/* rc_avpair_add takes a 0 length to mean a C string */
+			if (a->lvalue > 0)
+				rc_avpair_add (&send, a->attribute, p + off,
+					       a->lvalue, a->vendorcode);
+			else
+				rc_avpair_add (&send, a->attribute, "", 0,
+					       a->vendorcode);
+			off += RC_SPOOL_ALIGN (a->lvalue);
+		}
+		else
+			rc_avpair_add (&send, a->attribute, &a->lvalue, 0,
+				       a->vendorcode);
+	}
+
+	/* rc_acct_async adds the time it spends trying on to this */
+	delay = time (NULL) - rec->queued;
+	rc_avpair_add (&send, PW_ACCT_DELAY_TIME, &delay, 0, VENDOR_NONE);
+	return send;
+}
+
+/*
+ * Function: rc_spool_stop
+ *
+ * Purpose: stop replaying for now, and try again in a while
+ *
+ */
+
+static void rc_spool_stop (int delay)
+{
+	if (spool_draining)
+		rc_spool_lock (RC_SPOOL_DRAIN_LOCK, F_UNLCK, 0);
+	spool_draining = 0;
+	ppp_timeout (rc_spool_drain, NULL, delay, 0);
+}
+
+static void rc_spool_sent (int result, void *arg)
+{
+	uint32_t	one = 1;
+
+	if (result != OK_RC)
+	{
+		free (arg);
+		/* back off while the servers are down */
+		rc_spool_stop (spool_retry);
+		spool_retry = MIN (spool_retry * 2, RC_SPOOL_RETRY_MAX);
+		return;
+	}
+	spool_retry = RC_SPOOL_RETRY;
+	if (pwrite (spool_fd, &one, sizeof (one),
+		    spool_pos + offsetof (struct rc_spool_rec, sent)) != sizeof (one))
+		error("rc_spool_sent: couldn't update accounting spool: %m");
+	spool_pos += ((struct rc_spool_rec *) arg)->length;
+	free (arg);
+	rc_spool_drain (NULL);
+}
+
+/*
+ * Function: rc_spool_drain
+ *
+ * Purpose: send the next record waiting in the spool, or if there
+ *	    are none, empty it.
+ *
+ */
+
+static void rc_spool_drain (void *arg)
+{
+	struct rc_spool_rec *rec, *copy;
+	struct stat	st;
+	char		*map;
+	off_t		pos;
+
+	if (spool_fd < 0)
+		return;
+	if (!spool_draining)
+	{
+		/* somebody else is on it */
+		if (rc_spool_lock (RC_SPOOL_DRAIN_LOCK, F_WRLCK, 0) < 0)
+		{
+			ppp_timeout (rc_spool_drain, NULL, RC_SPOOL_RETRY, 0);
+			return;
+		}
+		spool_draining = 1;
+		spool_pos = 0;
+	}
+
+	if (fstat (spool_fd, &st) < 0 || st.st_size <= spool_pos)
+		goto empty;
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, spool_fd, 0);
+	if (map == MAP_FAILED)
+	{
+		error("rc_spool_drain: couldn't map accounting spool: %m");
+		rc_spool_stop (RC_SPOOL_RETRY_MAX);
+		return;
+	}
+	for (pos = spool_pos; pos + (off_t) sizeof (*rec) <= st.st_size; pos += rec->length)
+	{
+		rec = (struct rc_spool_rec *) (map + pos);
+		if (rec->magic != RC_SPOOL_MAGIC || rec->length < sizeof (*rec)
+		    || pos + rec->length > st.st_size)
+		{
+			error("rc_spool_drain: accounting spool is corrupt at offset %ld",
+			      (long) pos);
+			break;
+		}
+		if (rec->sent)
+			continue;
+
+		/* the mapping can't be kept across the round trip */
+		if ((copy = malloc (rec->length)) == NULL)
+			break;
+		memcpy (copy, rec, rec->length);
+		munmap (map, st.st_size);
+		spool_pos = pos;
+		rc_acct_async (copy->client_port, rc_spool_unpack (copy),
+			       rc_spool_sent, copy);
+		return;
+	}
+	munmap (map, st.st_size);
+	if (pos < st.st_size)
+	{
+		/* leave it for someone to look at */
+		rc_spool_stop (RC_SPOOL_RETRY_MAX);
+		return;
+	}
+	spool_pos = pos;
+
+ empty:
+	/* nothing more to send: empty the file, unless more came in */
+	rc_spool_lock (RC_SPOOL_FILE_LOCK, F_WRLCK, 1);
+	if (fstat (spool_fd, &st) == 0 && st.st_size > spool_pos)
+	{
+		rc_spool_lock (RC_SPOOL_FILE_LOCK, F_UNLCK, 0);
+		rc_spool_drain (NULL);
+		return;
+	}
+	if (st.st_size > 0 && ftruncate (spool_fd, 0) < 0)
+		error("rc_spool_drain: couldn't truncate accounting spool: %m");
+	rc_spool_lock (RC_SPOOL_FILE_LOCK, F_UNLCK, 0);
+
+	/*
+	 * Look again in a while, less often the longer it stays empty,
+	 * for records left by a pppd that exited before they were sent.
+	 */
+	rc_spool_stop (spool_retry);
+	spool_retry = MIN (spool_retry * 2, RC_SPOOL_RETRY_MAX);
+}
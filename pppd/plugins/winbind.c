@@ -40,6 +40,7 @@
 #include <fcntl.h>
 #include <sys/time.h>
 #include <sys/wait.h>
+#include <signal.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -66,6 +67,7 @@
 #define AUTHENTICATED 1
 
 static char *ntlm_auth = NULL;
+static int ntlm_auth_helpers = 4;
 
 static int set_ntlm_auth(char **argv)
 {
@@ -90,6 +92,9 @@ static int set_ntlm_auth(char **argv)
 static struct option Options[] = {
 	{ "ntlm_auth-helper", o_special, (void *) &set_ntlm_auth,
 	  "Path to ntlm_auth executable", OPT_PRIV },
+	{ "ntlm_auth-helpers", o_int, &ntlm_auth_helpers,
+	  "Number of ntlm_auth helpers a prefork server keeps running",
+	  OPT_PRIV | OPT_LLIMIT, NULL, 0, 0 },
 	{ NULL }
 };
 
@@ -97,6 +102,7 @@ static pap_check_hook_fn winbind_secret_check;
 static pap_auth_hook_fn winbind_pap_auth;
 static chap_verify_hook_fn winbind_chap_verify;
 static int winbind_allowed_address(uint32_t addr);
+static void winbind_prefork(void *opaque, int arg);
 
 char pppd_version[] = PPPD_VERSION;
 
@@ -118,12 +124,17 @@ plugin_init(void)
     chap_check_hook = winbind_secret_check;
     chap_verify_hook = winbind_chap_verify;
 
+    /* ntlm_auth can take a while; don't hold up the link waiting for it */
+    pap_auth_hook_offload = 1;
+    chap_verify_hook_offload = 1;
+
     allowed_address_hook = winbind_allowed_address;
 
     /* Don't ask the peer for anything other than MS-CHAP or MS-CHAP V2 */
     chap_mdtype_all &= (MDTYPE_MICROSOFT_V2 | MDTYPE_MICROSOFT);
     
     ppp_add_options(Options);
+    ppp_add_notify(NF_PREFORK, winbind_prefork, NULL);
 
     info("WINBIND plugin initialized.");
 }
@@ -234,61 +245,69 @@ char * base64_encode(const char *data)
 	return result;
 }
 
-unsigned int run_ntlm_auth(const char *username, 
-			   const char *domain, 
-			   const char *full_username,
-			   const char *plaintext_password,
-			   const u_char *challenge,
-			   size_t challenge_length,
-			   const u_char *lm_response, 
-			   size_t lm_response_length,
-			   const u_char *nt_response, 
-			   size_t nt_response_length,
-			   u_char nt_key[16], 
-			   char **error_string) 
-{
-	
-	pid_t forkret;
-        int child_in[2];
-        int child_out[2];
-	int status;
-
-	int authenticated = NOT_AUTHENTICATED; /* not auth */
-	int got_user_session_key = 0; /* not got key */
-
-	char buffer[1024];
+/*
+ * ntlm_auth --helper-protocol=ntlm-server-1 answers any number of
+ * requests, so rather than start it for each authentication we keep
+ * it running and reuse it.  A prefork server starts ntlm_auth_helpers
+ * of them before handing out sessions, and the session processes
+ * share them: byte i of helper_lockfd is locked by whichever process
+ * is using helper i, and holds its state.  A session that finds them
+ * all busy starts one of its own, as does a plain pppd.
+ */
+struct ntlm_helper {
+	pid_t pid;
+	FILE *in;		/* requests to the helper */
+	FILE *out;		/* its answers */
+	pid_t owner;		/* process that started it */
+	int uses;		/* requests it has answered */
+};
 
-	FILE *pipe_in;
-	FILE *pipe_out;
-	
-	int i;
-	char *challenge_hex;
-	char *lm_hex_hash;
-	char *nt_hex_hash;
+#define HELPER_IDLE	0
+#define HELPER_BUSY	1	/* a user died part way through */
+#define HELPER_DEAD	2
 
-	/* First see if we have a program to run... */
-	if (ntlm_auth == NULL)
-		return NOT_AUTHENTICATED;
+static struct ntlm_helper *shared_helpers;
+static int n_shared_helpers;
+static int helper_lockfd = -1;
+static struct ntlm_helper own_helper;
 
-        /* Make first child */
-        if (pipe(child_out) == -1) {
-                error("pipe creation failed for child OUT!");
-		return NOT_AUTHENTICATED;
-        }
+/**********************************************************************
+* %FUNCTION: ntlm_helper_start
+* %ARGUMENTS:
+*  h -- the helper to start
+* %RETURNS:
+*  1 if the helper is running, otherwise 0.
+* %DESCRIPTION:
+* Starts ntlm_auth with pipes to and from it.
+***********************************************************************/
+static int
+ntlm_helper_start(struct ntlm_helper *h)
+{
+	pid_t forkret;
+	int child_in[2];
+	int child_out[2];
 
-        if (pipe(child_in) == -1) {
-                error("pipe creation failed for child IN!");
-		return NOT_AUTHENTICATED;
-        }
+	/* Make first child */
+	if (pipe(child_out) == -1) {
+		error("pipe creation failed for child OUT!");
+		return 0;
+	}
 
-        forkret = ppp_safe_fork(child_in[0], child_out[1], 2);
-        if (forkret == -1) {
-		if (error_string) {
-			*error_string = strdup("fork failed!");
-		}
+	if (pipe(child_in) == -1) {
+		error("pipe creation failed for child IN!");
+		close(child_out[0]);
+		close(child_out[1]);
+		return 0;
+	}
 
-                return NOT_AUTHENTICATED;
-        }
+	forkret = ppp_safe_fork(child_in[0], child_out[1], 2);
+	if (forkret == -1) {
+		close(child_out[0]);
+		close(child_out[1]);
+		close(child_in[0]);
+		close(child_in[1]);
+		return 0;
+	}
 
 	if (forkret == 0) {
 		/* child process */
@@ -311,17 +330,229 @@ unsigned int run_ntlm_auth(const char *username,
 		fatal("pppd/winbind: could not exec /bin/sh: %m");
 	}
 
-        /* parent */
+	/* parent */
 	close(child_out[1]);
 	close(child_in[0]);
 
-	/* Need to write the User's info onto the pipe */
+	/* later helpers and scripts mustn't hold this one's stdin open */
+	fcntl(child_in[1], F_SETFD, FD_CLOEXEC);
+	fcntl(child_out[0], F_SETFD, FD_CLOEXEC);
 
-	pipe_in = fdopen(child_in[1], "w");
+	h->pid = forkret;
+	h->in = fdopen(child_in[1], "w");
+	h->out = fdopen(child_out[0], "r");
+	h->owner = getpid();
+	h->uses = 0;
+	return 1;
+}
 
-	pipe_out = fdopen(child_out[0], "r");
+/**********************************************************************
+* %FUNCTION: ntlm_helper_stop
+* %ARGUMENTS:
+*  h -- the helper to stop
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+* Closes our pipes to a helper, and if it is ours, waits for it to go.
+***********************************************************************/
+static void
+ntlm_helper_stop(struct ntlm_helper *h)
+{
+	int status;
 
-	/* look for session key coming back */
+	if (h->in == NULL)
+		return;
+	fclose(h->in);
+	fclose(h->out);
+	h->in = h->out = NULL;
+	if (h->owner == getpid()) {
+		kill(h->pid, SIGTERM);
+		while ((waitpid(h->pid, &status, 0) == -1) && errno == EINTR
+		       && !ppp_signaled(SIGTERM))
+			;
+	}
+}
+
+static int
+helper_lock(int i, int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = i;
+	fl.l_len = 1;
+	return fcntl(helper_lockfd, F_SETLK, &fl);
+}
+
+/**********************************************************************
+* %FUNCTION: ntlm_helper_get
+* %ARGUMENTS:
+*  None
+* %RETURNS:
+*  A running helper for this process to use, or NULL.
+* %DESCRIPTION:
+* Takes an idle helper shared from the prefork server, or if there
+* isn't one, uses our own.
+***********************************************************************/
+static struct ntlm_helper *
+ntlm_helper_get(void)
+{
+	char state;
+	int i;
+
+	for (i = 0; i < n_shared_helpers; i++) {
+		if (shared_helpers[i].in == NULL
+		    || helper_lock(i, F_WRLCK) < 0)
+			continue;
+		if (pread(helper_lockfd, &state, 1, i) == 1
+		    && state == HELPER_IDLE) {
+			state = HELPER_BUSY;
+			if (pwrite(helper_lockfd, &state, 1, i) == 1)
+				return &shared_helpers[i];
+		} else if (state != HELPER_DEAD) {
+			/* its last user left it part way through a request */
+			state = HELPER_DEAD;
+			if (pwrite(helper_lockfd, &state, 1, i) != 1)
+				error("winbind: couldn't update helper state: %m");
+		}
+		helper_lock(i, F_UNLCK);
+		ntlm_helper_stop(&shared_helpers[i]);
+	}
+
+	/* a forked child can't share its parent's helper */
+	if (own_helper.in != NULL && own_helper.owner != getpid()) {
+		fclose(own_helper.in);
+		fclose(own_helper.out);
+		own_helper.in = own_helper.out = NULL;
+	}
+	if (own_helper.in == NULL && !ntlm_helper_start(&own_helper))
+		return NULL;
+	return &own_helper;
+}
+
+/**********************************************************************
+* %FUNCTION: ntlm_helper_put
+* %ARGUMENTS:
+*  h -- a helper from ntlm_helper_get
+*  ok -- 0 if it stopped making sense or went away
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+* Gives a helper back when we are done with it for now.
+***********************************************************************/
+static void
+ntlm_helper_put(struct ntlm_helper *h, int ok)
+{
+	char state = ok? HELPER_IDLE: HELPER_DEAD;
+	int i;
+
+	if (!ok)
+		ntlm_helper_stop(h);
+	if (h == &own_helper)
+		return;
+	i = h - shared_helpers;
+	if (pwrite(helper_lockfd, &state, 1, i) != 1)
+		error("winbind: couldn't update helper state: %m");
+	helper_lock(i, F_UNLCK);
+}
+
+/**********************************************************************
+* %FUNCTION: winbind_prefork
+* %ARGUMENTS:
+*  opaque -- ignored
+*  arg -- ignored
+* %RETURNS:
+*  Nothing
+* %DESCRIPTION:
+*  Called in a pre-forking server before it starts handing out
+*  sessions, to start the helpers they will share.
+***********************************************************************/
+static void
+winbind_prefork(void *opaque, int arg)
+{
+	FILE *lockfile;
+	char *states;
+	int i;
+
+	if (ntlm_auth == NULL || ntlm_auth_helpers <= 0)
+		return;
+	shared_helpers = calloc(ntlm_auth_helpers, sizeof(*shared_helpers));
+	states = calloc(ntlm_auth_helpers, 1);
+	if (shared_helpers == NULL || states == NULL)
+		novm("ntlm_auth helpers");
+	if ((lockfile = tmpfile()) == NULL) {
+		error("winbind: couldn't create helper lock file: %m");
+		goto fail;
+	}
+	helper_lockfd = dup(fileno(lockfile));
+	fclose(lockfile);
+	if (helper_lockfd < 0
+	    || pwrite(helper_lockfd, states, ntlm_auth_helpers, 0)
+	       != ntlm_auth_helpers) {
+		error("winbind: couldn't set up helper lock file: %m");
+		goto fail;
+	}
+	fcntl(helper_lockfd, F_SETFD, FD_CLOEXEC);
+	free(states);
+
+	for (i = 0; i < ntlm_auth_helpers; i++)
+		if (!ntlm_helper_start(&shared_helpers[i]))
+			break;
+	n_shared_helpers = i;
+	info("winbind: started %d ntlm_auth helpers", n_shared_helpers);
+	return;
+
+ fail:
+	if (helper_lockfd >= 0)
+		close(helper_lockfd);
+	helper_lockfd = -1;
+	free(shared_helpers);
+	shared_helpers = NULL;
+	free(states);
+}
+
+/**********************************************************************
+* %FUNCTION: ntlm_helper_ask
+* %ARGUMENTS:
+*  h -- the helper to ask
+*  the rest as for run_ntlm_auth
+* %RETURNS:
+*  1 if the helper answered, with the answer in *authenticated and
+*  *got_user_session_key, otherwise 0.
+* %DESCRIPTION:
+* Sends one request to a helper and reads its answer.
+***********************************************************************/
+static int
+ntlm_helper_ask(struct ntlm_helper *h,
+		const char *username, 
+		const char *domain, 
+		const char *full_username,
+		const char *plaintext_password,
+		const u_char *challenge,
+		size_t challenge_length,
+		const u_char *lm_response, 
+		size_t lm_response_length,
+		const u_char *nt_response, 
+		size_t nt_response_length,
+		u_char nt_key[16], 
+		char **error_string,
+		int *authenticated,
+		int *got_user_session_key)
+{
+	FILE *pipe_in = h->in;
+	FILE *pipe_out = h->out;
+	char buffer[1024];
+	int i;
+	char *challenge_hex;
+	char *lm_hex_hash;
+	char *nt_hex_hash;
+
+	*authenticated = NOT_AUTHENTICATED;
+	*got_user_session_key = 0;
+
+	/* Need to write the User's info onto the pipe */
 
 	if (username) {
 		char *b64_username = base64_encode(username);
@@ -380,8 +611,11 @@ unsigned int run_ntlm_auth(const char *username,
 	}
 	
 	fprintf(pipe_in, ".\n");
-	fflush(pipe_in);
+	if (fflush(pipe_in) == EOF)
+		return 0;
 	
+	/* look for session key coming back */
+
 	while (fgets(buffer, sizeof(buffer)-1, pipe_out) != NULL) {
 		char *message, *parameter;
 		if (buffer[strlen(buffer)-1] != '\n') {
@@ -390,6 +624,12 @@ unsigned int run_ntlm_auth(const char *username,
 		buffer[strlen(buffer)-1] = '\0';
 		message = buffer;
 
+		if (strcmp(message, ".") == 0) {
+			/* end of sequence */
+			++h->uses;
+			return 1;
+		}
+
 		if (!(parameter = strstr(buffer, ": "))) {
 			break;
 		}
@@ -399,31 +639,28 @@ unsigned int run_ntlm_auth(const char *username,
 		parameter[0] = '\0';
 		parameter++;
 		
-		if (strcmp(message, ".") == 0) {
-			/* end of sequence */
-			break;
-		} else if (strcasecmp(message, "Authenticated") == 0) {
+		if (strcasecmp(message, "Authenticated") == 0) {
 			if (strcasecmp(parameter, "Yes") == 0) {
-				authenticated = AUTHENTICATED;
+				*authenticated = AUTHENTICATED;
 			} else {
 				notice("Winbind has declined authentication for user!");
-				authenticated = NOT_AUTHENTICATED;
+				*authenticated = NOT_AUTHENTICATED;
 			}
 		} else if (strcasecmp(message, "User-session-key") == 0) {
 			/* length is the number of characters to parse */
 			if (nt_key) { 
 				if (strhex_to_str(nt_key, 32, parameter) == 16) {
-					got_user_session_key = 1;
+					*got_user_session_key = 1;
 				} else {
 					notice("NT session key for user was not 16 bytes!");
 				}
 			}
 		} else if (strcasecmp(message, "Error") == 0) {
-			authenticated = NOT_AUTHENTICATED;
+			*authenticated = NOT_AUTHENTICATED;
 			if (error_string)
 				*error_string = strdup(parameter);
 		} else if (strcasecmp(message, "Authentication-Error") == 0) {
-			authenticated = NOT_AUTHENTICATED;
+			*authenticated = NOT_AUTHENTICATED;
 			if (error_string)
 				*error_string = strdup(parameter);
 		} else {
@@ -431,22 +668,62 @@ unsigned int run_ntlm_auth(const char *username,
 		}
 	}
 
-        /* parent */
-        if (close(child_out[0]) == -1) {
-                close(child_in[1]);
-                notice("error closing pipe?!? for child OUT[0]");
-                return NOT_AUTHENTICATED;
-        }
+	/* it went away, or we can't tell where its answer ends */
+	return 0;
+}
 
-       /* parent */
-        if (close(child_in[1]) == -1) {
-                notice("error closing pipe?!? for child IN[1]");
-                return NOT_AUTHENTICATED;
-        }
+unsigned int run_ntlm_auth(const char *username, 
+			   const char *domain, 
+			   const char *full_username,
+			   const char *plaintext_password,
+			   const u_char *challenge,
+			   size_t challenge_length,
+			   const u_char *lm_response, 
+			   size_t lm_response_length,
+			   const u_char *nt_response, 
+			   size_t nt_response_length,
+			   u_char nt_key[16], 
+			   char **error_string) 
+{
+	struct ntlm_helper *h;
+	int authenticated = NOT_AUTHENTICATED; /* not auth */
+	int got_user_session_key = 0; /* not got key */
+	char *old_error = error_string? *error_string: NULL;
+	int ok, reused;
+
+	/* First see if we have a program to run... */
+	if (ntlm_auth == NULL)
+		return NOT_AUTHENTICATED;
+
+	do {
+		if ((h = ntlm_helper_get()) == NULL) {
+			if (error_string) {
+				*error_string = strdup("fork failed!");
+			}
+			return NOT_AUTHENTICATED;
+		}
 
-	while ((wait(&status) == -1) && errno == EINTR && !ppp_signaled(SIGTERM))
-                ;
+		/*
+		 * A helper that has answered before may have gone away
+		 * since, or may only take one request; then we try again
+		 * with another.
+		 */
+		reused = h->uses > 0 || h != &own_helper;
+		ok = ntlm_helper_ask(h, username, domain, full_username,
+				     plaintext_password, challenge,
+				     challenge_length, lm_response,
+				     lm_response_length, nt_response,
+				     nt_response_length, nt_key, error_string,
+				     &authenticated, &got_user_session_key);
+		ntlm_helper_put(h, ok);
+		if (!ok && error_string && *error_string != old_error) {
+			free(*error_string);
+			*error_string = old_error;
+		}
+	} while (!ok && reused);
 
+	if (!ok)
+		return NOT_AUTHENTICATED;
 	if ((authenticated == AUTHENTICATED) && nt_key && !got_user_session_key) {
 		notice("Did not get user session key, despite being authenticated!");
 		return NOT_AUTHENTICATED;
@@ -45,67 +45,6 @@
 
 #include "crypto-priv.h"
 
-#ifdef OPENSSL_HAVE_DES
-
-#include <openssl/evp.h>
-
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-#define EVP_CIPHER_CTX_reset EVP_CIPHER_CTX_cleanup
-#endif
-
-static int des_init(PPP_CIPHER_CTX *ctx, const unsigned char *key, const unsigned char *iv)
-{
-    if (ctx) {
-        EVP_CIPHER_CTX *cc = EVP_CIPHER_CTX_new();
-        if (cc) {
-
-            if (key) {
-                memcpy(ctx->key, key, 8);
-            }
-            if (iv) {
-                memcpy(ctx->iv, iv, 8);
-            }
-
-            if (EVP_CipherInit(cc, EVP_des_ecb(), ctx->key, ctx->iv, ctx->is_encr)) {
-
-                if (EVP_CIPHER_CTX_set_padding(cc, 0)) {
-                    ctx->priv = cc;
-                    return 1;
-                }
-            }
-
-            EVP_CIPHER_CTX_free(cc);
-        }
-    }
-    return 0;
-}
-
-static int des_update(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl)
-{
-    if (ctx) {
-        return EVP_CipherUpdate((EVP_CIPHER_CTX*) ctx->priv, out, outl, in, inl);
-    }
-    return 0;
-}
-
-static int des_final(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl)
-{
-    if (ctx) {
-        return EVP_CipherFinal((EVP_CIPHER_CTX*) ctx->priv, out, outl);
-    }
-    return 0;
-}
-
-static void des_clean(PPP_CIPHER_CTX *ctx)
-{
-    if (ctx->priv) {
-        EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*) ctx->priv);
-        ctx->priv = NULL;
-    }
-}
-
-#else
-
 /*
  * DES related functions are imported from openssl 3.0 project with the 
  * follwoing license:
@@ -663,7 +602,7 @@ static void DES_set_key(const DES_cblock *key, DES_key_schedule *schedule)
 
 /* End of import of OpenSSL DES encryption functions */
 
-static int des_init(PPP_CIPHER_CTX *ctx, const unsigned char *key, const unsigned char *iv)
+static int des_builtin_init(PPP_CIPHER_CTX *ctx, const unsigned char *key, const unsigned char *iv)
 {
     DES_key_schedule *ks = calloc(1, sizeof(DES_key_schedule));
     if (ks) {
@@ -687,7 +626,7 @@ static int des_init(PPP_CIPHER_CTX *ctx, const unsigned char *key, const unsigne
     return 0;
 }
 
-static int des_update(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl)
+static int des_builtin_update(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl)
 {
     int offset = 0;
     inl = inl / 8;
@@ -701,12 +640,12 @@ static int des_update(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const
     return 1;
 }
 
-static int des_final(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl)
+static int des_builtin_final(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl)
 {
     return 1;
 }
 
-static void des_clean(PPP_CIPHER_CTX *ctx)
+static void des_builtin_clean(PPP_CIPHER_CTX *ctx)
 {
     if (ctx->priv) {
         free(ctx->priv);
@@ -714,8 +653,104 @@ static void des_clean(PPP_CIPHER_CTX *ctx)
     }
 }
 
+static PPP_CIPHER ppp_des_builtin = {
+    .init_fn = des_builtin_init,
+    .update_fn = des_builtin_update,
+    .final_fn = des_builtin_final,
+    .clean_fn = des_builtin_clean,
+};
+
+#ifdef OPENSSL_HAVE_DES
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_CIPHER_CTX_reset EVP_CIPHER_CTX_cleanup
 #endif
 
+/*
+ * OpenSSL 3 has DES only in the legacy provider.  Without it, this
+ * returns NULL and the builtin DES gets used instead.
+ */
+static const EVP_CIPHER *des_evp(void)
+{
+    static const EVP_CIPHER *cipher;
+    static int missing;
+
+    if (cipher == NULL && !missing) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        cipher = EVP_CIPHER_fetch(NULL, "DES-ECB", NULL);
+        if (cipher == NULL) {
+            ERR_clear_error();
+            missing = 1;
+        }
+#else
+        cipher = EVP_des_ecb();
+#endif
+    }
+    return cipher;
+}
+
+static int des_init(PPP_CIPHER_CTX *ctx, const unsigned char *key, const unsigned char *iv)
+{
+    const EVP_CIPHER *cipher = des_evp();
+    EVP_CIPHER_CTX *cc;
+
+    if (ctx) {
+        if (cipher == NULL) {
+            ctx->cipher = ppp_des_builtin;
+            return ctx->cipher.init_fn(ctx, key, iv);
+        }
+        cc = EVP_CIPHER_CTX_new();
+        if (cc) {
+
+            if (key) {
+                memcpy(ctx->key, key, 8);
+            }
+            if (iv) {
+                memcpy(ctx->iv, iv, 8);
+            }
+
+            if (EVP_CipherInit(cc, cipher, ctx->key, ctx->iv, ctx->is_encr)) {
+
+                if (EVP_CIPHER_CTX_set_padding(cc, 0)) {
+                    ctx->priv = cc;
+                    return 1;
+                }
+            }
+
+            EVP_CIPHER_CTX_free(cc);
+        }
+    }
+    return 0;
+}
+
+static int des_update(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl, const unsigned char *in, int inl)
+{
+    if (ctx) {
+        return EVP_CipherUpdate((EVP_CIPHER_CTX*) ctx->priv, out, outl, in, inl);
+    }
+    return 0;
+}
+
+static int des_final(PPP_CIPHER_CTX *ctx, unsigned char *out, int *outl)
+{
+    if (ctx) {
+        return EVP_CipherFinal((EVP_CIPHER_CTX*) ctx->priv, out, outl);
+    }
+    return 0;
+}
+
+static void des_clean(PPP_CIPHER_CTX *ctx)
+{
+    if (ctx->priv) {
+        EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*) ctx->priv);
+        ctx->priv = NULL;
+    }
+}
+
+
 static PPP_CIPHER ppp_des = {
     .init_fn = des_init,
     .update_fn = des_update,
@@ -723,6 +758,10 @@ static PPP_CIPHER ppp_des = {
     .clean_fn = des_clean,
 };
 
+#else
+#define ppp_des ppp_des_builtin
+#endif
+
 const PPP_CIPHER *PPP_des_ecb(void)
 {
     return &ppp_des;
@@ -85,6 +85,50 @@ static void md5_clean(PPP_MD_CTX *ctx)
     }
 }
 
+/*
+ * RADIUS and CHAP hash a few short messages per request, where setting
+ * up a context and looking up the algorithm each time costs more than
+ * the hashing.  Keep one of each per thread, as the offload thread
+ * may hash too (see PPP_THREAD_LOCAL).
+ */
+static int md5_digest(const struct iovec *iov, int iovcnt,
+                      unsigned char *out, unsigned int *outlen)
+{
+#ifdef PPP_THREAD_LOCAL
+    static PPP_THREAD_LOCAL EVP_MD_CTX *mctx;
+    static PPP_THREAD_LOCAL const EVP_MD *md;
+#else
+    static const EVP_MD *md;
+    EVP_MD_CTX *mctx = NULL;
+#endif
+    int i, ok = 0;
+
+    if (md == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        md = EVP_MD_fetch(NULL, "MD5", NULL);
+        if (md == NULL)
+#endif
+            md = EVP_md5();
+    }
+    if (mctx == NULL && (mctx = EVP_MD_CTX_new()) == NULL) {
+        return 0;
+    }
+    if (EVP_DigestInit_ex(mctx, md, NULL)) {
+        for (i = 0; i < iovcnt; i++) {
+            if (!EVP_DigestUpdate(mctx, iov[i].iov_base, iov[i].iov_len)) {
+                break;
+            }
+        }
+        if (i == iovcnt) {
+            ok = EVP_DigestFinal_ex(mctx, out, outlen);
+        }
+    }
+#ifndef PPP_THREAD_LOCAL
+    EVP_MD_CTX_free(mctx);
+#endif
+    return ok;
+}
+
 #else // !OPENSSL_HAVE_MD5
 
 /*
@@ -435,6 +479,21 @@ static void md5_clean(PPP_MD_CTX *ctx)
     }
 }
 
+static int md5_digest(const struct iovec *iov, int iovcnt,
+                      unsigned char *out, unsigned int *outlen)
+{
+    MD5_CTX md5;
+    int i;
+
+    MD5_Init(&md5);
+    for (i = 0; i < iovcnt; i++) {
+        MD5_Update(&md5, iov[i].iov_base, iov[i].iov_len);
+    }
+    MD5_Final(out, &md5);
+    *outlen = MD5_DIGEST_LENGTH;
+    return 1;
+}
+
 #endif
 
 static PPP_MD ppp_md5 = {
@@ -442,6 +501,7 @@ static PPP_MD ppp_md5 = {
     .update_fn = md5_update,
     .final_fn = md5_final,
     .clean_fn  = md5_clean,
+    .digest_fn = md5_digest,
 };
 
 const PPP_MD *PPP_md5(void)
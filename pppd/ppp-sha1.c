@@ -87,6 +87,44 @@ static void sha1_clean(PPP_MD_CTX *ctx)
     }
 }
 
+static int sha1_digest(const struct iovec *iov, int iovcnt,
+                      unsigned char *out, unsigned int *outlen)
+{
+#ifdef PPP_THREAD_LOCAL
+    static PPP_THREAD_LOCAL EVP_MD_CTX *mctx;
+    static PPP_THREAD_LOCAL const EVP_MD *md;
+#else
+    static const EVP_MD *md;
+    EVP_MD_CTX *mctx = NULL;
+#endif
+    int i, ok = 0;
+
+    if (md == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        md = EVP_MD_fetch(NULL, "SHA1", NULL);
+        if (md == NULL)
+#endif
+            md = EVP_sha1();
+    }
+    if (mctx == NULL && (mctx = EVP_MD_CTX_new()) == NULL) {
+        return 0;
+    }
+    if (EVP_DigestInit_ex(mctx, md, NULL)) {
+        for (i = 0; i < iovcnt; i++) {
+            if (!EVP_DigestUpdate(mctx, iov[i].iov_base, iov[i].iov_len)) {
+                break;
+            }
+        }
+        if (i == iovcnt) {
+            ok = EVP_DigestFinal_ex(mctx, out, outlen);
+        }
+    }
+#ifndef PPP_THREAD_LOCAL
+    EVP_MD_CTX_free(mctx);
+#endif
+    return ok;
+}
+
 
 #else // !OPENSSL_HAVE_SHA
 
@@ -109,12 +147,28 @@ static void sha1_clean(PPP_MD_CTX *ctx)
 #include <string.h>
 #include <netinet/in.h>	/* htonl() */
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define SHA1_NI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 typedef struct {
     u_int32_t state[5];
     u_int32_t count[2];
     unsigned char buffer[64];
 } SHA1_CTX;
 
+/*
+ * Whole blocks are hashed by sha1_blocks, which is SHA1_Blocks below
+ * or, on x86 processors with the SHA extensions, SHA1_Blocks_ni.
+ * The choice is made the first time a context is initialized.
+ */
+typedef void sha1_blocks_fn(u_int32_t[5], const unsigned char *, size_t);
+
+static sha1_blocks_fn *sha1_blocks;
+
 
 static void
 SHA1_Transform(u_int32_t[5], const unsigned char[64]);
@@ -192,11 +246,146 @@ SHA1_Transform(u_int32_t state[5], const unsigned char buffer[64])
 }
 
 
+/* Hash nblocks 512-bit blocks. */
+
+static void
+SHA1_Blocks(u_int32_t state[5], const unsigned char *data, size_t nblocks)
+{
+    unsigned char block[64];
+
+    /* SHA1_Transform works on its buffer in place */
+    for (; nblocks > 0; --nblocks, data += 64) {
+	memcpy(block, data, 64);
+	SHA1_Transform(state, block);
+    }
+    memset(block, 0, sizeof(block));
+}
+
+#ifdef SHA1_NI
+/*
+ * The same with the SHA-NI instructions, four rounds at a time.
+ * SHA1_NI_ROUNDS does rounds 4g to 4g+3, for g from 3 to 16, where w
+ * holds the message words for them: it finishes the words for the
+ * next four rounds in w1, and carries on with those for the four
+ * after that and the four after those in w2 and w3.
+ */
+#define SHA1_NI_ROUNDS(w, w1, w2, w3, e, e1, f) \
+    e = _mm_sha1nexte_epu32(e, w); \
+    e1 = abcd; \
+    w1 = _mm_sha1msg2_epu32(w1, w); \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, f); \
+    w3 = _mm_sha1msg1_epu32(w3, w); \
+    w2 = _mm_xor_si128(w2, w)
+
+__attribute__((target("sha,sse4.1")))
+static void
+SHA1_Blocks_ni(u_int32_t state[5], const unsigned char *data, size_t nblocks)
+{
+    __m128i abcd, abcd_save, e0, e0_save, e1;
+    __m128i w0, w1, w2, w3;
+    const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL,
+					0x08090a0b0c0d0e0fULL);
+
+    abcd = _mm_loadu_si128((const __m128i *) state);
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    for (; nblocks > 0; --nblocks, data += 64) {
+	abcd_save = abcd;
+	e0_save = e0;
+
+	/* rounds 0-15 take the message words as they are */
+	w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) data), swap);
+	e0 = _mm_add_epi32(e0, w0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)),
+			      swap);
+	e1 = _mm_sha1nexte_epu32(e1, w1);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+	w0 = _mm_sha1msg1_epu32(w0, w1);
+
+	w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)),
+			      swap);
+	e0 = _mm_sha1nexte_epu32(e0, w2);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+	w1 = _mm_sha1msg1_epu32(w1, w2);
+	w0 = _mm_xor_si128(w0, w2);
+
+	w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)),
+			      swap);
+	SHA1_NI_ROUNDS(w3, w0, w1, w2, e1, e0, 0);
+	SHA1_NI_ROUNDS(w0, w1, w2, w3, e0, e1, 0);
+	SHA1_NI_ROUNDS(w1, w2, w3, w0, e1, e0, 1);
+	SHA1_NI_ROUNDS(w2, w3, w0, w1, e0, e1, 1);
+	SHA1_NI_ROUNDS(w3, w0, w1, w2, e1, e0, 1);
+	SHA1_NI_ROUNDS(w0, w1, w2, w3, e0, e1, 1);
+	SHA1_NI_ROUNDS(w1, w2, w3, w0, e1, e0, 1);
+	SHA1_NI_ROUNDS(w2, w3, w0, w1, e0, e1, 2);
+	SHA1_NI_ROUNDS(w3, w0, w1, w2, e1, e0, 2);
+	SHA1_NI_ROUNDS(w0, w1, w2, w3, e0, e1, 2);
+	SHA1_NI_ROUNDS(w1, w2, w3, w0, e1, e0, 2);
+	SHA1_NI_ROUNDS(w2, w3, w0, w1, e0, e1, 2);
+	SHA1_NI_ROUNDS(w3, w0, w1, w2, e1, e0, 3);
+	SHA1_NI_ROUNDS(w0, w1, w2, w3, e0, e1, 3);
+
+	/* rounds 68-79: the last words need fewer steps */
+	e1 = _mm_sha1nexte_epu32(e1, w1);
+	e0 = abcd;
+	w2 = _mm_sha1msg2_epu32(w2, w1);
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+	w3 = _mm_xor_si128(w3, w1);
+
+	e0 = _mm_sha1nexte_epu32(e0, w2);
+	e1 = abcd;
+	w3 = _mm_sha1msg2_epu32(w3, w2);
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+	e1 = _mm_sha1nexte_epu32(e1, w3);
+	e0 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    _mm_storeu_si128((__m128i *) state, abcd);
+    state[4] = _mm_extract_epi32(e0, 3);
+}
+
+static int
+sha1_have_ni(void)
+{
+    unsigned int a, b, c, d;
+
+    /* SHA is leaf 7 ebx bit 29; SSSE3 and SSE4.1 are leaf 1 ecx 9, 19 */
+    if (!__get_cpuid(1, &a, &b, &c, &d)
+	|| (c & ((1 << 9) | (1 << 19))) != ((1 << 9) | (1 << 19)))
+	return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+	return 0;
+    __cpuid_count(7, 0, a, b, c, d);
+    return (b & (1 << 29)) != 0;
+}
+#endif /* SHA1_NI */
+
+
 /* SHA1Init - Initialize new context */
 
 static void
 SHA1_Init(SHA1_CTX *context)
 {
+    if (sha1_blocks == NULL) {
+	sha1_blocks = SHA1_Blocks;
+#ifdef SHA1_NI
+	if (sha1_have_ni())
+	    sha1_blocks = SHA1_Blocks_ni;
+#endif
+    }
     /* SHA1 initialization constants */
     context->state[0] = 0x67452301;
     context->state[1] = 0xEFCDAB89;
@@ -218,14 +407,18 @@ SHA1_Update(SHA1_CTX *context, const unsigned char *data, unsigned int len)
     if ((context->count[0] += len << 3) < (len << 3)) context->count[1]++;
     context->count[1] += (len >> 29);
     i = 64 - j;
-    while (len >= i) {
+    if (j > 0 && len >= i) {
 	memcpy(&context->buffer[j], data, i);
-	SHA1_Transform(context->state, context->buffer);
+	(*sha1_blocks)(context->state, context->buffer, 1);
 	data += i;
 	len -= i;
-	i = 64;
 	j = 0;
     }
+    if (len >= 64) {
+	(*sha1_blocks)(context->state, data, len / 64);
+	data += len & ~63;
+	len &= 63;
+    }
 
     memcpy(&context->buffer[j], data, len);
 }
@@ -238,15 +431,15 @@ SHA1_Final(unsigned char digest[20], SHA1_CTX *context)
 {
     u_int32_t i, j;
     unsigned char finalcount[8];
+    static const unsigned char pad[64] = { 0200 };
 
     for (i = 0; i < 8; i++) {
         finalcount[i] = (unsigned char)((context->count[(i >= 4 ? 0 : 1)]
          >> ((3-(i & 3)) * 8) ) & 255);  /* Endian independent */
     }
-    SHA1_Update(context, (unsigned char *) "\200", 1);
-    while ((context->count[0] & 504) != 448) {
-	SHA1_Update(context, (unsigned char *) "\0", 1);
-    }
+    /* pad with 0x80 then zeroes to 8 bytes short of a block */
+    j = (context->count[0] >> 3) & 63;
+    SHA1_Update(context, pad, (j < 56? 56: 120) - j);
     SHA1_Update(context, finalcount, 8);  /* Should cause a SHA1Transform() */
     for (i = 0; i < 20; i++) {
 	digest[i] = (unsigned char)
@@ -296,6 +489,21 @@ static void sha1_clean(PPP_MD_CTX *ctx)
     }
 }
 
+static int sha1_digest(const struct iovec *iov, int iovcnt,
+                      unsigned char *out, unsigned int *outlen)
+{
+    SHA1_CTX sha1;
+    int i;
+
+    SHA1_Init(&sha1);
+    for (i = 0; i < iovcnt; i++) {
+        SHA1_Update(&sha1, iov[i].iov_base, iov[i].iov_len);
+    }
+    SHA1_Final(out, &sha1);
+    *outlen = SHA_DIGEST_LENGTH;
+    return 1;
+}
+
 #endif
 
 static PPP_MD ppp_sha1 = {
@@ -303,6 +511,7 @@ static PPP_MD ppp_sha1 = {
     .update_fn = sha1_update,
     .final_fn = sha1_final,
     .clean_fn = sha1_clean,
+    .digest_fn = sha1_digest,
 };
 
 const PPP_MD *PPP_sha1(void)
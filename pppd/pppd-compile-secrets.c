@@ -0,0 +1,257 @@
+/*
+ * pppd-compile-secrets - build the compiled secrets database that
+ * pppd uses in place of reading the secrets files.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Usage: pppd-compile-secrets [-o database]
+ *
+ * Reads pap-secrets, chap-secrets, srp-secrets and the EAP-TLS
+ * secrets files, and writes them in indexed form to the database,
+ * replacing it in one step with rename(2) so that a pppd never sees
+ * it half written.  pppd goes back to reading a file if it changes
+ * after the database is built, so this needs running again after a
+ * secrets file is edited for pppd to keep its fast start.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "pppd-private.h"
+#include "pathnames.h"
+#include "secrets.h"
+
+static struct secrets_table files[SECRETS_NFILES] = {
+    SECRETS_INIT(PPP_PATH_UPAPFILE, SECRETS_PAP, 3),
+    SECRETS_INIT(PPP_PATH_CHAPFILE, SECRETS_CHAP, 3),
+    SECRETS_INIT(PPP_PATH_SRPFILE, SECRETS_SRP, 3),
+#ifdef PPP_WITH_EAPTLS
+    SECRETS_INIT(PPP_PATH_EAPTLSSERVFILE, SECRETS_EAPTLS_SERVER, 6),
+    SECRETS_INIT(PPP_PATH_EAPTLSCLIFILE, SECRETS_EAPTLS_CLIENT, 6),
+#endif
+};
+
+char *progname = "pppd-compile-secrets";
+
+/*
+ * The secrets code is normally part of pppd; these stand in for
+ * pppd's logging.
+ */
+static void
+logit(char *fmt, va_list ap)
+{
+    fprintf(stderr, "%s: ", progname);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+}
+
+void
+ppp_option_error(char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    logit(fmt, ap);
+    va_end(ap);
+}
+
+void
+warn(char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    logit(fmt, ap);
+    va_end(ap);
+}
+
+void
+error(char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    logit(fmt, ap);
+    va_end(ap);
+}
+
+void
+novm(char *msg)
+{
+    fprintf(stderr, "%s: not enough memory for %s\n", progname, msg);
+    exit(1);
+}
+
+void
+die(int status)
+{
+    exit(status);
+}
+
+void
+ppp_mem_account(const char *name, size_t bytes, bool shared)
+{
+}
+
+/*
+ * put - write len bytes to the database at *offp, padded to a
+ * multiple of 8 bytes.
+ */
+static int
+put(FILE *f, const void *p, size_t len, uint64_t *offp)
+{
+    static const char zeroes[8];
+    size_t pad = (8 - (len & 7)) & 7;
+
+    if (len > 0 && fwrite(p, 1, len, f) != len)
+	return 0;
+    if (pad > 0 && fwrite(zeroes, 1, pad, f) != pad)
+	return 0;
+    *offp += len + pad;
+    return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct ppp_secrets_header hdr;
+    struct ppp_secrets_file *sf;
+    struct secrets_table *t;
+    struct stat sbuf;
+    char *db = PPP_PATH_SECRETSDB;
+    char *tmp;
+    uint64_t off;
+    FILE *f;
+    int c, fd, i;
+
+    while ((c = getopt(argc, argv, "o:")) != -1) {
+	switch (c) {
+	case 'o':
+	    db = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-o database]\n", progname);
+	    exit(2);
+	}
+    }
+    if (optind != argc) {
+	fprintf(stderr, "Usage: %s [-o database]\n", progname);
+	exit(2);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PPP_SECRETS_MAGIC;
+    hdr.version = PPP_SECRETS_VERSION;
+    for (i = 0; i < SECRETS_NFILES; ++i) {
+	t = &files[i];
+	if (t->filename == NULL)
+	    continue;
+	f = fopen(t->filename, "r");
+	if (f == NULL) {
+	    if (errno != ENOENT) {
+		error("Can't open %s: %m", t->filename);
+		exit(1);
+	    }
+	    continue;
+	}
+	check_access(f, t->filename);
+	if (fstat(fileno(f), &sbuf) < 0 || !secrets_read(t, f)) {
+	    error("Can't read %s: %m", t->filename);
+	    exit(1);
+	}
+	fclose(f);
+	sf = &hdr.files[t->index];
+	sf->present = 1;
+	sf->size = sbuf.st_size;
+	sf->ino = sbuf.st_ino;
+	sf->mtime = sbuf.st_mtim.tv_sec;
+	sf->mtime_nsec = sbuf.st_mtim.tv_nsec;
+	sf->nentries = t->nentries;
+	sf->nbuckets = t->nbuckets;
+	sf->strings_len = t->strings_len;
+    }
+
+    if ((tmp = malloc(strlen(db) + 8)) == NULL)
+	novm("file name");
+    sprintf(tmp, "%s.XXXXXX", db);
+    fd = mkstemp(tmp);
+    if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+	error("Can't create %s: %m", tmp);
+	exit(1);
+    }
+
+    /* the header, then each file's entries, hash table and words */
+    off = 0;
+    if (!put(f, &hdr, sizeof(hdr), &off))
+	goto fail;
+    for (i = 0; i < SECRETS_NFILES; ++i) {
+	t = &files[i];
+	if (t->filename == NULL || !hdr.files[t->index].present)
+	    continue;
+	sf = &hdr.files[t->index];
+	sf->entries = off;
+	if (!put(f, t->entries, t->nentries * sizeof(*t->entries), &off))
+	    goto fail;
+	sf->buckets = off;
+	if (!put(f, t->buckets, t->nbuckets * sizeof(*t->buckets), &off))
+	    goto fail;
+	sf->strings = off;
+	if (!put(f, t->strings, t->strings_len, &off))
+	    goto fail;
+	secrets_free(t);
+    }
+    if (fseek(f, 0, SEEK_SET) < 0 || !put(f, &hdr, sizeof(hdr), &off)
+	|| fflush(f) != 0 || fsync(fd) < 0)
+	goto fail;
+    if (fclose(f) != 0) {
+	f = NULL;
+	goto fail;
+    }
+    if (rename(tmp, db) < 0) {
+	error("Can't rename %s to %s: %m", tmp, db);
+	unlink(tmp);
+	exit(1);
+    }
+    return 0;
+
+ fail:
+    error("Can't write %s: %m", tmp);
+    if (f != NULL)
+	fclose(f);
+    unlink(tmp);
+    exit(1);
+}
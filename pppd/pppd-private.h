@@ -48,6 +48,7 @@
 #include <stdio.h>		/* for FILE */
 #include <stdlib.h>		/* for encrypt */
 #include <unistd.h>		/* for setkey */
+#include <signal.h>		/* for sigset_t */
 #if defined(SOL2)
 #include <net/ppp_defs.h>
 #else
@@ -55,6 +56,7 @@
 #endif
 
 #include "pppd.h"
+#include "probes.h"
 
 #ifdef PPP_WITH_IPV6CP
 #include "eui64.h"
@@ -92,6 +94,7 @@ struct notifier {
 
 extern int	hungup;		/* Physical layer has disconnected */
 extern int	ifunit;		/* Interface unit number */
+extern ppp_phase_t phase;	/* where the link is at */
 extern char	ifname[];	/* Interface name (IFNAMSIZ) */
 extern char	hostname[];	/* Our hostname */
 extern unsigned char	outpacket_buf[]; /* Buffer for outgoing packets */
@@ -106,12 +109,13 @@ extern int	privileged;	/* We were run by real-uid root */
 extern int	need_holdoff;	/* Need holdoff period after link terminates */
 extern char	**script_env;	/* Environment variables for scripts */
 extern int	detached;	/* Have detached from controlling tty */
-extern GIDSET_TYPE groups[];	/* groups the user is in */
+extern GIDSET_TYPE *groups;	/* groups the user is in */
 extern int	ngroups;	/* How many groups valid in groups */
 extern int	link_stats_valid; /* set if link_stats is valid */
 extern int	link_stats_print; /* set if link_stats is to be printed on link termination */
 extern int	log_to_fd;	/* logging to this fd as well as syslog */
 extern bool	log_default;	/* log_to_fd is default (stdout) */
+extern bool	log_json;	/* log to log_to_fd as JSON lines */
 extern char	*no_ppp_msg;	/* message to print if ppp not in kernel */
 extern bool	devnam_fixed;	/* can no longer change devnam */
 extern int	unsuccess;	/* # unsuccessful connection attempts */
@@ -122,6 +126,8 @@ extern char	ppp_devname[];	/* name of PPP tty (maybe ttypx) */
 extern int	fd_devnull;	/* fd open to /dev/null */
 
 extern int	listen_time;	/* time to listen first (ms) */
+extern int	kill_link;	/* set to close the link */
+extern int	open_ccp_flag;	/* set to renegotiate CCP */
 extern bool	bundle_eof;
 extern bool	bundle_terminating;
 
@@ -136,6 +142,8 @@ extern struct notifier *ipv6_down_notifier; /* IPV6CP has gone down */
 extern struct notifier *auth_up_notifier; /* peer has authenticated */
 extern struct notifier *link_down_notifier; /* link has gone down */
 extern struct notifier *fork_notifier;	/* we are a new child process */
+extern struct notifier *prefork_notifier; /* about to serve sessions */
+extern struct notifier *prefork_pool_notifier; /* prefork pool changes */
 
 
 /* Values for do_callback and doing_callback */
@@ -175,6 +183,8 @@ extern bool	auth_required;	/* Peer is required to authenticate */
 extern bool	persist;	/* Reopen link after it goes down */
 extern bool	uselogin;	/* Use /etc/passwd for checking PAP */
 extern bool	session_mgmt;	/* Do session management (login records) */
+extern bool	session_wtmp;	/* Record sessions in utmp and wtmp */
+extern bool	session_defer;	/* Open the PAM session after IPCP is up */
 extern char	our_name[MAXNAMELEN];/* Our name for authentication purposes */
 extern char	remote_name[MAXNAMELEN]; /* Peer's name for authentication */
 extern bool	explicit_remote;/* remote_name specified with remotename opt */
@@ -183,11 +193,25 @@ extern char	*ipparam;	/* Extra parameter for ip up/down scripts */
 extern bool	cryptpap;	/* Others' PAP passwords are encrypted */
 extern int	holdoff;	/* Dead time before restarting */
 extern bool	holdoff_specified; /* true if user gave a holdoff value */
+#ifdef PPP_WITH_TDB
+extern int	admit_rate;	/* Max # of links started per second */
+extern int	admit_burst;	/* # of links that may start at once */
+extern int	peer_cache_time; /* Max age of peer cache entries to use */
+extern int	db_snapshot_interval; /* Secs between database snapshots */
+#endif
 extern bool	notty;		/* Stdin/out is not a tty */
 extern char	*pty_socket;	/* Socket to connect to pty */
 extern char	*record_file;	/* File to record chars sent/received */
 extern int	maxfail;	/* Max # of unsuccessful connection attempts */
 extern char	linkname[];	/* logical name for link */
+extern char	prefork_path[];	/* socket to serve session requests on */
+extern int	prefork_pool;	/* sessions to have interfaces ready for */
+extern char	control_path[];	/* socket to take commands on */
+
+/* suffix of the variable name in a session index key in the pppd tdb */
+#define PPPDB_INDEX	"_INDEX"
+extern int	stats_interval;	/* secs between stats file updates */
+extern int	demand_queue;	/* bytes of packets held for the link */
 extern bool	tune_kernel;	/* May alter kernel settings as necessary */
 extern int	connect_delay;	/* Time to delay after connect script */
 extern int	max_data_rate;	/* max bytes/sec through charshunt */
@@ -202,6 +226,7 @@ extern bool	dump_options;	/* print out option values */
 extern bool	show_options;	/* show all option names and descriptions */
 extern bool	dryrun;		/* check everything, print options, exit */
 extern int	child_wait;	/* # seconds to wait for children at end */
+extern bool	use_signalfd;	/* handle signals through a signalfd */
 extern char *current_option;    /* the name of the option being parsed */
 extern int  privileged_option;  /* set iff the current option came from root */
 extern char *option_source;     /* string saying where the option came from */
@@ -230,6 +255,9 @@ extern char *tls_verify_method;
 
 #ifdef PPP_WITH_EAPTLS
 extern char *pkcs12_file;
+extern char *tls_ticket_secret;
+extern bool tls_session_cache;
+extern int tls_session_lifetime;
 #endif /* PPP_WITH_EAPTLS */
 
 typedef enum {
@@ -306,9 +334,83 @@ pid_t run_program(char *prog, char * const * args, int must_exist,
 void reopen_log(void);	/* (re)open the connection to syslog */
 void print_link_stats(void); /* Print stats, if available */
 void reset_link_stats(int); /* Reset (init) stats when link goes up */
+int  link_uptime(void);	/* Seconds since the link came up */
+int  get_link_stats(int, struct pppd_stats *);
+				/* Get link counters, read once per wakeup */
+void link_stats_start(void);	/* Note the time as the link starts */
+void link_stats_expire(void);	/* Read the counters afresh next time */
+#ifdef PPP_WITH_TDB
+int  peer_cache_get(int, void *, int);
+				/* Get what a protocol agreed with this peer */
+void peer_cache_put(int, void *, int);
+				/* ... and save it for next time */
+#else
+#define peer_cache_get(proto, data, len)	0
+#define peer_cache_put(proto, data, len)	do { } while (0)
+#endif
+
+/* Procedures exported from statsfile.c */
+void statsfile_update(void);	/* Publish the link counters now */
+void statsfile_start(void);	/* Start publishing them periodically */
+void statsfile_stop(void);	/* Publish the final counters */
+void statsfile_close(void);	/* Give up our place in the stats file */
+void statsfile_echo_rtt(long);	/* Count an LCP echo round trip time */
+void statsfile_link_up(long, long, long, long); /* Note phase times */
+
+/* Procedures exported from control.c */
+void control_start(void);	/* Take commands on the control socket */
+
+/* Procedures exported from ippool.c */
+int ippool_option(char **);	/* Handle the ip-pool option */
+u_int32_t ippool_get(void);	/* Take an address from the pool */
+int ippool_check(u_int32_t);	/* May the peer use this address? */
+
+/* Procedures exported from trace.c */
+void trace_phase(int);		/* Note a change of phase */
+void trace_state(const char *, int); /* ... of a protocol's state */
+void trace_retransmit(const char *, int); /* ... a resent Request */
+void trace_script(const char *, int, int, int); /* ... a script */
+void trace_packet(unsigned char *, int, int); /* ... a packet */
+void trace_print(printer_func, void *); /* Format the event trace */
+void trace_dump(void);		/* Write the event trace to the log */
+
+/* Procedures exported from memusage.c */
+void mem_print(printer_func, void *); /* Format the memory report */
+
+/* Parts of pppd timed by profile.c, with --enable-profiling */
+enum {
+    PROF_LOOP,			/* once round the main loop */
+    PROF_WAIT,			/* waiting in wait_input */
+    PROF_FDS,			/* fd handlers, including input */
+    PROF_TIMEOUT,		/* a timeout routine */
+    PROF_OPTIONS,		/* parsing the options, and plugin init */
+    PROF_PLUGIN,		/* one plugin's plugin_init */
+    PROF_AUTH,			/* checking a peer's password or response */
+    PROF_NUM
+};
+
+#ifdef PPP_WITH_PROFILING
+/* Procedures exported from profile.c */
+void prof_begin(int);		/* Start timing one of the above */
+void prof_end(int);		/* ... and stop */
+void prof_input_begin(void);	/* Start timing a received packet */
+void prof_input_end(int);	/* ... and stop, with its protocol */
+void prof_print(printer_func, void *); /* Format the counters */
+void prof_dump(void);		/* Write the counters to the log */
+#else
+#define prof_begin(which)	do { } while (0)
+#define prof_end(which)		do { } while (0)
+#define prof_input_begin()	do { } while (0)
+#define prof_input_end(proto)	do { } while (0)
+#define prof_dump()		do { } while (0)
+#endif
+
 void new_phase(ppp_phase_t);	/* signal start of new phase */
 bool in_phase(ppp_phase_t);
+const char *phase_name(int);	/* name of a phase, for messages */
 void notify(struct notifier *, int);
+void snoop_packet(unsigned char *, int, int);
+				/* show a packet to ppp_add_snoop funcs */
 int  ppp_send_config(int, int, u_int32_t, int, int);
 int  ppp_recv_config(int, int, u_int32_t, int, int);
 const char *protocol_name(int);
@@ -323,6 +425,7 @@ void print_string(char *, int,  printer_func, void *);
 				/* Format a string for output */
 ssize_t complete_read(int, void *, size_t);
 				/* read a complete buffer */
+void flush_log(void);		/* write out saved debug messages */
 
 /* Procedures exported from auth.c */
 void link_required(int);	  /* we are starting to use the link */
@@ -347,7 +450,9 @@ void auth_withpeer_success(int, int, int);
 void auth_check_options(void);
 				/* check authentication options supplied */
 void auth_reset(int);	/* check what secrets we have */
-int  check_passwd(int, char *, int, char *, int, char **);
+void auth_limits_changed(void);	/* session limits have been changed */
+typedef void (check_passwd_cb)(void *arg, int ret, char *msg);
+void check_passwd(int, char *, int, char *, int, check_passwd_cb *, void *);
 				/* Check peer-supplied username/password */
 int  get_secret(int, char *, char *, char *, int *, int);
 				/* get "secret" for chap */
@@ -370,6 +475,7 @@ int  loop_frame(unsigned char *, int); /* should we bring link up? */
 void sys_init(void);	/* Do system-dependent initialization */
 void sys_cleanup(void);	/* Restore system state before exiting */
 int  sys_check_options(void); /* Check options specified */
+void sys_prefork_pool(int);	/* Keep ppp units ready for sessions */
 int  get_pty(int *, int *, char *, int);	/* Get pty master/slave */
 int  open_ppp_loopback(void); /* Open loopback for demand-dialling */
 int  tty_establish_ppp(int);  /* Turn serial port into a ppp interface */
@@ -383,8 +489,13 @@ void set_up_tty(int, int); /* Set up port's speed, parameters, etc. */
 void restore_tty(int);	/* Restore port's original parameters */
 void setdtr(int, int);	/* Raise or lower port's DTR line */
 void output(int, unsigned char *, int); /* Output a PPP packet */
+void output_frame(int, unsigned char *, int); /* ... without logging it */
 void wait_input(struct timeval *);
 				/* Wait for input, with timeout */
+int  set_wakeup_time(struct timeval *);
+				/* Arm timer to end wait_input at given time */
+int  open_signal_fd(sigset_t *); /* Receive signals through an fd */
+int  read_signal_fd(void);	/* Get next signal from that fd */
 void add_fd(int);		/* Add fd to set to wait for */
 void remove_fd(int);	/* Remove fd from set to wait for */
 int  read_packet(unsigned char *); /* Read PPP packet */
@@ -404,7 +515,9 @@ int  get_idle_time(int, struct ppp_idle *);
 				/* Find out how long link has been idle */
 int  get_ppp_stats(int, struct pppd_stats *);
 				/* Return link statistics */
-int  sifvjcomp(int, int, int, int);
+int  get_ppp_comp_stats(int, struct ppp_comp_stats *);
+				/* Return compression statistics */
+int  sifvjcomp(int, int, int, int, int);
 				/* Configure VJ TCP header compression */
 int  sifup(int);		/* Configure i/f up for one protocol */
 int  sifnpmode(int u, int proto, enum NPmode mode);
@@ -0,0 +1,389 @@
+/*
+ * pppd-sessions - find pppd sessions by user, address or interface
+ * in the pppd database.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Usage: pppd-sessions [-v] [-s] [-f database] [-u user | -a address
+ *			 | -l address | -i interface]
+ *
+ * Each pppd keeps a record in the database, under "pppd<pid>", of the
+ * variables it gives its scripts.  For the user, the local and remote
+ * IP addresses and the interface it also keeps a session index, under
+ * "PEERNAME_INDEX=<user>" and so on, of the pids of the pppds with
+ * that value, so that looking a session up costs a couple of fetches
+ * rather than a traversal of the database.  With no selector, every
+ * session is listed, which does traverse it.
+ *
+ * With -s the snapshot that pppd writes with the db-snapshot option is
+ * read instead, which takes no locks at all but may be a little out
+ * of date.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#include "pppd-private.h"
+#include "pathnames.h"
+#include "tdb.h"
+
+static TDB_CONTEXT *db;
+static TDB_SNAPSHOT *snap;
+static int verbose;
+static int nfound;
+
+static const char *fields[] = { "IFNAME", "PEERNAME", "IPLOCAL", "IPREMOTE" };
+#define NFIELDS	(sizeof(fields) / sizeof(fields[0]))
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: pppd-sessions [-v] [-s] [-f database] [-u user"
+	    " | -a address | -l address | -i interface]\n");
+    exit(2);
+}
+
+/*
+ * getvar - find the value of var in an entry, a string of
+ * "VAR=value;" items, and return its length, or -1.
+ */
+static int
+getvar(const char *ent, int len, const char *var, const char **valp)
+{
+    const char *p, *end = ent + len, *q;
+    int vl = strlen(var);
+
+    for (p = ent; p < end; p = q + 1) {
+	q = memchr(p, ';', end - p);
+	if (q == NULL)
+	    q = end;
+	if (q - p > vl && p[vl] == '=' && memcmp(p, var, vl) == 0) {
+	    *valp = p + vl + 1;
+	    return q - *valp;
+	}
+    }
+    return -1;
+}
+
+/*
+ * show - print the session in entry rec, belonging to pid, if it
+ * has value val for var (always, if var is NULL).
+ */
+static void
+show(int pid, TDB_DATA rec, const char *var, const char *val)
+{
+    const char *v, *p, *end, *q;
+    unsigned int i;
+    int n;
+
+    if (var != NULL) {
+	n = getvar(rec.dptr, rec.dsize, var, &v);
+	if (n != (int) strlen(val) || memcmp(v, val, n) != 0)
+	    return;		/* the index is out of date */
+    }
+    ++nfound;
+    if (verbose) {
+	printf("pppd %d\n", pid);
+	end = rec.dptr + rec.dsize;
+	for (p = rec.dptr; p < end; p = q + 1) {
+	    q = memchr(p, ';', end - p);
+	    if (q == NULL)
+		q = end;
+	    if (q > p)
+		printf("\t%.*s\n", (int) (q - p), p);
+	}
+	return;
+    }
+    printf("%d", pid);
+    for (i = 0; i < NFIELDS; ++i) {
+	n = getvar(rec.dptr, rec.dsize, fields[i], &v);
+	if (n < 0)
+	    printf(" -");
+	else
+	    printf(" %.*s", n, v);
+    }
+    printf("\n");
+}
+
+/*
+ * db_fetch - look key up in the database or the snapshot; the caller
+ * frees the data either way.
+ */
+static TDB_DATA
+db_fetch(TDB_DATA key)
+{
+    TDB_DATA rec;
+    char *p;
+
+    if (snap == NULL)
+	return tdb_fetch(db, key);
+    rec = tdb_snapshot_fetch(snap, key);
+    if (rec.dptr != NULL) {
+	if ((p = malloc(rec.dsize + 1)) == NULL) {
+	    fprintf(stderr, "pppd-sessions: out of memory\n");
+	    exit(1);
+	}
+	memcpy(p, rec.dptr, rec.dsize);
+	rec.dptr = p;
+    }
+    return rec;
+}
+
+/*
+ * fetch_session - look up the entry for the pppd with the given pid,
+ * if it is still running.
+ */
+static TDB_DATA
+fetch_session(int pid)
+{
+    TDB_DATA key, rec;
+    char pkey[32];
+
+    rec.dptr = NULL;
+    rec.dsize = 0;
+    if (kill(pid, 0) < 0 && errno == ESRCH)
+	return rec;
+    snprintf(pkey, sizeof(pkey), "pppd%d", pid);
+    key.dptr = pkey;
+    key.dsize = strlen(pkey);
+    return db_fetch(key);
+}
+
+static void
+lookup(const char *var, const char *val)
+{
+    TDB_DATA key, rec, ent;
+    int32_t *pids;
+    char *ikey;
+    int i, n;
+
+    ikey = malloc(strlen(var) + strlen(val) + sizeof(PPPDB_INDEX) + 1);
+    if (ikey == NULL) {
+	fprintf(stderr, "pppd-sessions: out of memory\n");
+	exit(1);
+    }
+    sprintf(ikey, "%s" PPPDB_INDEX "=%s", var, val);
+    key.dptr = ikey;
+    key.dsize = strlen(ikey);
+    rec = db_fetch(key);
+    free(ikey);
+    if (rec.dptr == NULL)
+	return;
+    pids = (int32_t *) rec.dptr;
+    n = rec.dsize / sizeof(int32_t);
+    for (i = 0; i < n; ++i) {
+	ent = fetch_session(pids[i]);
+	if (ent.dptr != NULL) {
+	    show(pids[i], ent, var, val);
+	    free(ent.dptr);
+	}
+    }
+    free(rec.dptr);
+}
+
+static int
+list_one(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA rec, void *arg)
+{
+    char pkey[32], *end;
+    long pid;
+
+    /* the sessions' own entries are the keys "pppd<pid>" */
+    if (key.dsize <= 4 || key.dsize >= sizeof(pkey)
+	|| memcmp(key.dptr, "pppd", 4) != 0)
+	return 0;
+    memcpy(pkey, key.dptr + 4, key.dsize - 4);
+    pkey[key.dsize - 4] = 0;
+    pid = strtol(pkey, &end, 10);
+    if (*end != 0 || pid <= 0 || (kill(pid, 0) < 0 && errno == ESRCH))
+	return 0;
+    show(pid, rec, NULL, NULL);
+    return 0;
+}
+
+#ifndef UNIT_TEST
+int
+main(int argc, char **argv)
+{
+    char *dbname = NULL;
+    const char *var = NULL, *val = NULL;
+    int c, use_snap = 0;
+
+    while ((c = getopt(argc, argv, "vsf:u:a:l:i:")) != -1) {
+	switch (c) {
+	case 'v':
+	    verbose = 1;
+	    break;
+	case 's':
+	    use_snap = 1;
+	    break;
+	case 'f':
+	    dbname = optarg;
+	    break;
+	case 'u':
+	case 'a':
+	case 'l':
+	case 'i':
+	    if (var != NULL)
+		usage();
+	    var = c == 'u'? "PEERNAME": c == 'a'? "IPREMOTE":
+		c == 'l'? "IPLOCAL": "IFNAME";
+	    val = optarg;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc)
+	usage();
+
+    if (dbname == NULL)
+	dbname = use_snap? PPP_PATH_PPPDB_SNAP: PPP_PATH_PPPDB;
+    if (use_snap)
+	snap = tdb_snapshot_open(dbname);
+    else
+	db = tdb_open(dbname, 0, 0, O_RDONLY, 0);
+    if (db == NULL && snap == NULL) {
+	fprintf(stderr, "pppd-sessions: can't open %s: %s\n", dbname,
+		strerror(errno));
+	exit(1);
+    }
+    if (var != NULL)
+	lookup(var, val);
+    else if (snap != NULL)
+	tdb_snapshot_traverse(snap, list_one, NULL);
+    else
+	tdb_traverse(db, list_one, NULL);
+    if (snap != NULL)
+	tdb_snapshot_close(snap);
+    else
+	tdb_close(db);
+    return nfound? 0: 1;
+}
+#else /* UNIT_TEST */
+#include <sys/wait.h>
+
+static void
+store(TDB_CONTEXT *tdb, const char *k, const void *v, int len)
+{
+    TDB_DATA key, rec;
+
+    key.dptr = (char *) k;
+    key.dsize = strlen(k);
+    rec.dptr = (char *) v;
+    rec.dsize = len;
+    tdb_store(tdb, key, rec, TDB_REPLACE);
+}
+
+static int
+check(const char *what, int want)
+{
+    if (nfound == want)
+	return 0;
+    printf("%s: found %d sessions, wanted %d\n", what, nfound, want);
+    return 1;
+}
+
+/*
+ * Make a database the way a detached pppd leaves it, with its entry
+ * and its place in each index under the pid it has after detach(),
+ * and a stale session from a pppd that has gone alongside, and check
+ * that only the live one is found, in the database and in a snapshot.
+ */
+int
+main(void)
+{
+    char dbname[] = "utest_sessions.tdb", snapname[] = "utest_sessions.snap";
+    char pkey[32], ent[64];
+    int32_t pids[2];
+    int failure = 0;
+    pid_t gone;
+
+    /* a pid that is certain not to be running */
+    if ((gone = fork()) == 0)
+	_exit(0);
+    waitpid(gone, NULL, 0);
+    pids[0] = gone;
+    pids[1] = getpid();
+
+    db = tdb_open(dbname, 0, 0, O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (db == NULL) {
+	printf("can't make %s: %s\n", dbname, strerror(errno));
+	return 1;
+    }
+    snprintf(pkey, sizeof(pkey), "pppd%d", pids[0]);
+    snprintf(ent, sizeof(ent), "IFNAME=ppp0;PEERNAME=alice;");
+    store(db, pkey, ent, strlen(ent));
+    snprintf(pkey, sizeof(pkey), "pppd%d", pids[1]);
+    snprintf(ent, sizeof(ent), "IFNAME=ppp1;PEERNAME=alice;IPREMOTE=10.0.0.1;");
+    store(db, pkey, ent, strlen(ent));
+    store(db, "PEERNAME" PPPDB_INDEX "=alice", pids, sizeof(pids));
+    store(db, "IFNAME" PPPDB_INDEX "=ppp1", &pids[1], sizeof(pids[1]));
+    store(db, "IPREMOTE" PPPDB_INDEX "=10.0.0.1", &pids[1], sizeof(pids[1]));
+
+    lookup("PEERNAME", "alice");
+    failure += check("by user", 1);
+    nfound = 0;
+    lookup("IFNAME", "ppp1");
+    failure += check("by interface", 1);
+    nfound = 0;
+    lookup("IPREMOTE", "10.0.0.2");
+    failure += check("unknown address", 0);
+    nfound = 0;
+    tdb_traverse(db, list_one, NULL);
+    failure += check("listing", 1);
+
+    /* and the same from a snapshot */
+    if (tdb_snapshot(db, snapname) != 0
+	|| (snap = tdb_snapshot_open(snapname)) == NULL) {
+	printf("can't make snapshot %s\n", snapname);
+	failure++;
+    } else {
+	nfound = 0;
+	lookup("PEERNAME", "alice");
+	failure += check("snapshot by user", 1);
+	nfound = 0;
+	tdb_snapshot_traverse(snap, list_one, NULL);
+	failure += check("snapshot listing", 1);
+	tdb_snapshot_close(snap);
+    }
+
+    tdb_close(db);
+    unlink(dbname);
+    unlink(snapname);
+    return failure? 1: 0;
+}
+#endif /* UNIT_TEST */
@@ -140,6 +140,8 @@ typedef enum
     NF_AUTH_UP,
     NF_LINK_DOWN,
     NF_FORK,
+    NF_PREFORK,
+    NF_PREFORK_POOL,
     NF_MAX_NOTIFY
 } ppp_notify_t;
 
@@ -350,6 +352,37 @@ void ppp_timeout(ppp_timer_cb func, void *arg, int s, int us);
  */
 void ppp_untimeout(void (*func)(void *), void *arg);
 
+/*
+ * Have the main loop call func(fd, arg) whenever fd is readable;
+ * func must not block
+ */
+typedef void (*ppp_fd_cb)(int fd, void *arg);
+void ppp_add_fd_handler(int fd, ppp_fd_cb func, void *arg);
+
+/*
+ * Stop watching an fd passed to ppp_add_fd_handler
+ */
+void ppp_remove_fd_handler(int fd);
+
+/*
+ * Run work(arg) on a thread of its own, so that it may block, then have
+ * the main loop call done(arg, result).  work must not touch anything
+ * the main loop uses.  If no thread can be started both are called
+ * before ppp_offload returns.
+ */
+typedef int (ppp_offload_fn)(void *arg);
+typedef void (ppp_offload_done_fn)(void *arg, int result);
+void ppp_offload(ppp_offload_fn *work, ppp_offload_done_fn *done, void *arg);
+
+/*
+ * Note that a part of pppd or a plugin, called name, now holds bytes
+ * of memory, for the memory report on the control socket.  shared
+ * says that it is mapped from a file which other pppds map too, so
+ * that it costs each of them little.  A later call with the same name
+ * replaces the figure.
+ */
+void ppp_mem_account(const char *name, size_t bytes, bool shared);
+
 /*
  * Clean up in a child before execing
  */
@@ -445,6 +478,11 @@ void ppp_script_setenv(char *, char *, int);
  */
 void ppp_script_unsetenv(char *);
 
+/*
+ * Get the value of a variable in the environment for scripts
+ */
+char *ppp_script_getenv(const char *);
+
 /*
  * Test whether ppp kernel support exists
  */
@@ -539,9 +577,29 @@ typedef void (ppp_notify_fn)(void *ctx, int arg);
 
 /*
  * Add a callback notification for when a given event has occured
+ *
+ * NF_PREFORK_POOL lets a plugin keep resources made ready for sessions
+ * forked by a prefork-socket server.  An arg > 0 asks the server to
+ * have that many ready; 0 tells a new session process to keep one for
+ * itself and let go of the rest; < 0 tells the server that a session
+ * has been forked, taking the first one ready.  No more than
+ * PREFORK_POOL_MAX are asked for.
  */
+#define PREFORK_POOL_MAX 64
+
 void ppp_add_notify(ppp_notify_t type, ppp_notify_fn *func, void *ctx);
 
+/*
+ * Have func(ctx, p, len, incoming) called with each control packet of
+ * the given protocol (e.g. PPP_LCP) that is sent or received, from
+ * the address field on, until removed with ppp_del_snoop.  Cheaper
+ * than snoop_recv_hook and snoop_send_hook, which see every packet.
+ */
+typedef void (ppp_snoop_fn)(void *ctx, unsigned char *p, int len,
+			    int incoming);
+void ppp_add_snoop(int protocol, ppp_snoop_fn *func, void *ctx);
+void ppp_del_snoop(int protocol, ppp_snoop_fn *func, void *ctx);
+
 /*
  * Remove a callback notification previously registered
  */
@@ -562,6 +620,11 @@ int ppp_get_filepath(ppp_path_t type, const char *name, char *buf, size_t bufsz)
  */
 bool ppp_persist();
 
+/*
+ * Get the number of seconds pppd would wait before re-opening the link
+ */
+int ppp_holdoff();
+
 /*
  * Hooks to enable plugins to hook into various parts of the code
  */
@@ -570,6 +633,13 @@ struct ppp_idle; /* Declared in <linux/ppp_defs.h> */
 extern int (*idle_time_hook)(struct ppp_idle *);
 extern int (*new_phase_hook)(int);
 extern int (*holdoff_hook)(void);
+
+/*
+ * Called with the path and arguments of each script pppd is about
+ * to run (ip-up, auth-up and so on); return 1 if the plugin has done
+ * what the script would have, so it isn't run, or 0 to run it.
+ */
+extern int (*script_hook)(char *prog, char * const *args);
 extern int  (*allowed_address_hook)(uint32_t addr);
 extern void (*snoop_recv_hook)(unsigned char *p, int len);
 extern void (*snoop_send_hook)(unsigned char *p, int len);
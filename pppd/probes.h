@@ -0,0 +1,86 @@
+/*
+ * probes.h - static tracepoints on pppd's busy paths.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PPP_PROBES_H
+#define PPP_PROBES_H
+
+#include "pppdconf.h"
+
+/*
+ * With --enable-usdt, each PPP_PROBEn below is a USDT probe from
+ * <sys/sdt.h>: a nop in the code plus a note in the ELF file, which
+ * bpftrace, perf or systemtap turn into a breakpoint only while they
+ * are attached.  Otherwise they compile to nothing.  Either way the
+ * arguments should be cheap to evaluate, as the compiler may still
+ * have to compute them.
+ *
+ * The probes are, by provider:
+ *
+ * pppd:input(proto, len)		 a packet handed to a protocol
+ * pppd:output(proto, len)		 a packet sent to the link
+ * pppd:fsm_state(proto, name, old, new) a protocol changing state
+ * pppd:timeout_add(func, arg, ms)	 a timeout being set
+ * pppd:timeout_fire(func, arg, late_us) a timeout routine starting
+ * pppd:timeout_done(func, arg)		 ... and returning
+ * pppd:auth_start(unit, pending)	 authentication starting
+ * pppd:auth_done(unit, proto, peer, ok) one direction of it finishing
+ * pppd:script_start(prog, pid)		 a script starting
+ * pppd:script_done(prog, pid, status, ms) ... and being reaped
+ * radius:request_send(server, id, code, retries)
+ * radius:reply(server, id, code)	 a genuine reply arriving
+ * radius:timeout(server, id)		 no reply from a server
+ * tdb:lock_wait(list, ltype)		 about to take a chain lock
+ * tdb:lock_done(list, ltype)		 ... and having got it
+ *
+ * "name" and "prog" are strings; "func" is the routine's address,
+ * which bpftrace's usym() will name.  For example,
+ *
+ *	bpftrace -e 'usdt:/usr/sbin/pppd:tdb:lock_wait { @t[tid] = nsecs; }
+ *	    usdt:/usr/sbin/pppd:tdb:lock_done /@t[tid]/ {
+ *		@wait_us = hist((nsecs - @t[tid]) / 1000); delete(@t[tid]); }'
+ */
+#ifdef PPP_WITH_USDT
+#include <sys/sdt.h>
+
+#define PPP_PROBE1(prov, name, a)		DTRACE_PROBE1(prov, name, a)
+#define PPP_PROBE2(prov, name, a, b)		DTRACE_PROBE2(prov, name, a, b)
+#define PPP_PROBE3(prov, name, a, b, c)		DTRACE_PROBE3(prov, name, a, b, c)
+#define PPP_PROBE4(prov, name, a, b, c, d)	DTRACE_PROBE4(prov, name, a, b, c, d)
+
+#else /* PPP_WITH_USDT */
+
+#define PPP_PROBE1(prov, name, a)		do { } while (0)
+#define PPP_PROBE2(prov, name, a, b)		do { } while (0)
+#define PPP_PROBE3(prov, name, a, b, c)		do { } while (0)
+#define PPP_PROBE4(prov, name, a, b, c, d)	do { } while (0)
+
+#endif /* PPP_WITH_USDT */
+
+#endif /* PPP_PROBES_H */
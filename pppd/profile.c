@@ -0,0 +1,226 @@
+/*
+ * profile.c - count and time what pppd spends its time on.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "pppd-private.h"
+
+/*
+ * Built with --enable-profiling, pppd counts the times it goes
+ * round the main loop and goes into each of the parts below, and adds
+ * up the time each took on the monotonic clock, which costs two clock
+ * reads per part.  The time spent in input is kept for each protocol.
+ * At exit, or when asked on the control socket, the totals are
+ * printed with the process's CPU time, so that it is easy to see
+ * where a session's time went.
+ */
+struct prof_counter {
+    unsigned long count;
+    uint64_t ns;		/* total time */
+    uint64_t max_ns;		/* longest single one */
+    uint64_t start;		/* when the current one began */
+};
+
+static const char *prof_names[PROF_NUM] = {
+    "event loop", "wait_input", "fd handlers", "timeouts",
+    "options", "plugin init", "auth backend"
+};
+
+static struct prof_counter prof[PROF_NUM];
+
+/* time spent in input, by protocol */
+#define PROF_MAX_PROTO	24
+
+static struct prof_proto {
+    int protocol;
+    struct prof_counter c;
+} prof_input[PROF_MAX_PROTO];
+static int prof_nproto;
+static uint64_t prof_input_start;
+
+static uint64_t
+prof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+prof_add(struct prof_counter *c, uint64_t ns)
+{
+    ++c->count;
+    c->ns += ns;
+    if (ns > c->max_ns)
+	c->max_ns = ns;
+}
+
+/*
+ * prof_begin, prof_end - time one of the parts listed in pppd-private.h.
+ * Each part has just one start time, so a part can't be timed inside
+ * itself.
+ */
+void
+prof_begin(int which)
+{
+    prof[which].start = prof_now();
+}
+
+void
+prof_end(int which)
+{
+    prof_add(&prof[which], prof_now() - prof[which].start);
+}
+
+/*
+ * prof_input_begin, prof_input_end - time passing a received packet
+ * of the given protocol to its protocol.
+ */
+void
+prof_input_begin(void)
+{
+    prof_input_start = prof_now();
+}
+
+void
+prof_input_end(int protocol)
+{
+    uint64_t ns = prof_now() - prof_input_start;
+    int i;
+
+    for (i = 0; i < prof_nproto; ++i)
+	if (prof_input[i].protocol == protocol)
+	    break;
+    if (i == prof_nproto) {
+	if (prof_nproto == PROF_MAX_PROTO)
+	    return;
+	prof_input[prof_nproto++].protocol = protocol;
+    }
+    prof_add(&prof_input[i].c, ns);
+}
+
+/* the short name of a protocol, as in the protocols[] entry for it */
+static const char *
+prof_proto_name(int protocol)
+{
+    struct protent *protp;
+    int i;
+
+    for (i = 0; (protp = protocols[i]) != NULL; ++i) {
+	if (protp->protocol == protocol)
+	    return protp->name;
+	if ((protp->protocol & ~0x8000) == protocol && protp->data_name)
+	    return protp->data_name;
+    }
+    return NULL;
+}
+
+static void
+prof_line(printer_func printer, void *arg, const char *name,
+	  struct prof_counter *c)
+{
+    /* vslprintf has no '-' flag, so pad the name out by hand */
+    printer(arg, "%s%*s %10lu %12lu %10lu %8lu", name,
+	    (int) (16 - strlen(name)), "", c->count,
+	    (unsigned long) (c->ns / 1000),
+	    c->count? (unsigned long) (c->ns / c->count / 1000): 0,
+	    (unsigned long) (c->max_ns / 1000));
+}
+
+/*
+ * prof_print - format the counters, one line per call to printer.
+ */
+void
+prof_print(printer_func printer, void *arg)
+{
+    struct rusage ru;
+    struct prof_counter busy;
+    const char *name;
+    char pname[24];
+    int i;
+
+    printer(arg, "Profile (times in us):");
+    printer(arg, "%16s %10s %12s %10s %8s", "", "count", "total", "mean",
+	    "max");
+    for (i = 0; i < PROF_NUM; ++i)
+	prof_line(printer, arg, prof_names[i], &prof[i]);
+
+    /* the time the loop took, less the time it spent waiting */
+    busy = prof[PROF_LOOP];
+    busy.ns -= busy.ns < prof[PROF_WAIT].ns? busy.ns: prof[PROF_WAIT].ns;
+    busy.max_ns = 0;
+    prof_line(printer, arg, "event loop busy", &busy);
+
+    for (i = 0; i < prof_nproto; ++i) {
+	name = prof_proto_name(prof_input[i].protocol);
+	if (name != NULL)
+	    slprintf(pname, sizeof(pname), "in %s", name);
+	else
+	    slprintf(pname, sizeof(pname), "in 0x%x", prof_input[i].protocol);
+	prof_line(printer, arg, pname, &prof_input[i].c);
+    }
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+	printer(arg, "CPU user %ld.%06ld s, system %ld.%06ld s",
+		(long) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec,
+		(long) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec);
+}
+
+static void
+prof_log(void *arg, char *fmt, ...)
+{
+    va_list args;
+    char line[256];
+
+    va_start(args, fmt);
+    vslprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    info("%s", line);
+}
+
+/*
+ * prof_dump - write the counters to the log.
+ */
+void
+prof_dump(void)
+{
+    prof_print(prof_log, NULL);
+}
@@ -0,0 +1,777 @@
+/*
+ * secrets.c - read the secrets files, index them by client and
+ * server, and use the compiled secrets database when it is current.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pppd-private.h"
+#include "options.h"
+#include "pathnames.h"
+#include "secrets.h"
+
+#define SECRETS_MAXFIXED	8	/* most fixed words in any file */
+
+static struct secrets_table *tables;	/* all those we've loaded */
+
+static char *db_map;			/* the compiled database */
+static size_t db_len;
+static dev_t db_dev;
+static ino_t db_ino;
+static struct timespec db_mtime;
+
+/*
+ * Read a word from a file.
+ * Words are delimited by white-space or by quotes (" or ').
+ * Quotes, white-space and \ may be escaped with \.
+ * \<newline> is ignored.
+ */
+int
+getword(FILE *f, char *word, int *newlinep, char *filename)
+{
+    int c, len, escape;
+    int quoted, comment;
+    int value, digit, got, n;
+
+#define isoctal(c) ((c) >= '0' && (c) < '8')
+
+    *newlinep = 0;
+    len = 0;
+    escape = 0;
+    comment = 0;
+    quoted = 0;
+
+    /*
+     * First skip white-space and comments.
+     */
+    for (;;) {
+	c = getc(f);
+	if (c == EOF)
+	    break;
+
+	/*
+	 * A newline means the end of a comment; backslash-newline
+	 * is ignored.  Note that we cannot have escape && comment.
+	 */
+	if (c == '\n') {
+	    if (!escape) {
+		*newlinep = 1;
+		comment = 0;
+	    } else
+		escape = 0;
+	    continue;
+	}
+
+	/*
+	 * Ignore characters other than newline in a comment.
+	 */
+	if (comment)
+	    continue;
+
+	/*
+	 * If this character is escaped, we have a word start.
+	 */
+	if (escape)
+	    break;
+
+	/*
+	 * If this is the escape character, look at the next character.
+	 */
+	if (c == '\\') {
+	    escape = 1;
+	    continue;
+	}
+
+	/*
+	 * If this is the start of a comment, ignore the rest of the line.
+	 */
+	if (c == '#') {
+	    comment = 1;
+	    continue;
+	}
+
+	/*
+	 * A non-whitespace character is the start of a word.
+	 */
+	if (!isspace(c))
+	    break;
+    }
+
+    /*
+     * Process characters until the end of the word.
+     */
+    while (c != EOF) {
+	if (escape) {
+	    /*
+	     * This character is escaped: backslash-newline is ignored,
+	     * various other characters indicate particular values
+	     * as for C backslash-escapes.
+	     */
+	    escape = 0;
+	    if (c == '\n') {
+	        c = getc(f);
+		continue;
+	    }
+
+	    got = 0;
+	    switch (c) {
+	    case 'a':
+		value = '\a';
+		break;
+	    case 'b':
+		value = '\b';
+		break;
+	    case 'f':
+		value = '\f';
+		break;
+	    case 'n':
+		value = '\n';
+		break;
+	    case 'r':
+		value = '\r';
+		break;
+	    case 's':
+		value = ' ';
+		break;
+	    case 't':
+		value = '\t';
+		break;
+
+	    default:
+		if (isoctal(c)) {
+		    /*
+		     * \ddd octal sequence
+		     */
+		    value = 0;
+		    for (n = 0; n < 3 && isoctal(c); ++n) {
+			value = (value << 3) + (c & 07);
+			c = getc(f);
+		    }
+		    got = 1;
+		    break;
+		}
+
+		if (c == 'x') {
+		    /*
+		     * \x<hex_string> sequence
+		     */
+		    value = 0;
+		    c = getc(f);
+		    for (n = 0; n < 2 && isxdigit(c); ++n) {
+			digit = toupper(c) - '0';
+			if (digit > 10)
+			    digit += '0' + 10 - 'A';
+			value = (value << 4) + digit;
+			c = getc (f);
+		    }
+		    got = 1;
+		    break;
+		}
+
+		/*
+		 * Otherwise the character stands for itself.
+		 */
+		value = c;
+		break;
+	    }
+
+	    /*
+	     * Store the resulting character for the escape sequence.
+	     */
+	    if (len < MAXWORDLEN) {
+		word[len] = value;
+		++len;
+	    }
+
+	    if (!got)
+		c = getc(f);
+	    continue;
+	}
+
+	/*
+	 * Backslash starts a new escape sequence.
+	 */
+	if (c == '\\') {
+	    escape = 1;
+	    c = getc(f);
+	    continue;
+	}
+
+	/*
+	 * Not escaped: check for the start or end of a quoted
+	 * section and see if we've reached the end of the word.
+	 */
+	if (quoted) {
+	    if (c == quoted) {
+		quoted = 0;
+		c = getc(f);
+		continue;
+	    }
+	} else if (c == '"' || c == '\'') {
+	    quoted = c;
+	    c = getc(f);
+	    continue;
+	} else if (isspace(c) || c == '#') {
+	    ungetc (c, f);
+	    break;
+	}
+
+	/*
+	 * An ordinary character: store it in the word and get another.
+	 */
+	if (len < MAXWORDLEN) {
+	    word[len] = c;
+	    ++len;
+	}
+
+	c = getc(f);
+    }
+    word[MAXWORDLEN-1] = 0;	/* make sure word is null-terminated */
+
+    /*
+     * End of the word: check for errors.
+     */
+    if (c == EOF) {
+	if (ferror(f)) {
+	    if (errno == 0)
+		errno = EIO;
+	    ppp_option_error("Error reading %s: %m", filename);
+	    die(1);
+	}
+	/*
+	 * If len is zero, then we didn't find a word before the
+	 * end of the file.
+	 */
+	if (len == 0)
+	    return 0;
+	if (quoted)
+	    ppp_option_error("warning: quoted word runs to end of file (%.20s...)",
+			 filename, word);
+    }
+
+    /*
+     * Warn if the word was too long, and append a terminating null.
+     */
+    if (len >= MAXWORDLEN) {
+	ppp_option_error("warning: word in file %s too long (%.20s...)",
+		     filename, word);
+	len = MAXWORDLEN - 1;
+    }
+    word[len] = 0;
+
+    return 1;
+
+#undef isoctal
+
+}
+
+/*
+ * check_access - complain if a secret file has too-liberal permissions.
+ */
+void
+check_access(FILE *f, char *filename)
+{
+    struct stat sbuf;
+
+    if (fstat(fileno(f), &sbuf) < 0) {
+	warn("cannot stat secret file %s: %m", filename);
+    } else if ((sbuf.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+	warn("Warning - secret file %s has world and/or group access",
+	     filename);
+    }
+}
+
+/*
+ * secrets_hash - hash a client and server name.
+ */
+static uint32_t
+secrets_hash(const char *client, const char *server)
+{
+    uint32_t h = 2166136261U;
+
+    while (*client)
+	h = (h ^ (unsigned char) *client++) * 16777619U;
+    h *= 16777619U;
+    while (*server)
+	h = (h ^ (unsigned char) *server++) * 16777619U;
+    return h;
+}
+
+/*
+ * secrets_free - forget what we read from a secrets file.
+ */
+void
+secrets_free(struct secrets_table *t)
+{
+    int err = errno;
+
+    if (!t->from_db) {
+	if (t->strings != NULL)
+	    BZERO((char *) t->strings, t->strings_len);
+	free((void *) t->strings);
+	free((void *) t->entries);
+	free((void *) t->buckets);
+    }
+    t->entries = NULL;
+    t->nentries = 0;
+    t->buckets = NULL;
+    t->nbuckets = 0;
+    t->strings = NULL;
+    t->strings_len = 0;
+    t->from_db = 0;
+    t->loaded = 0;
+    errno = err;
+}
+
+/*
+ * secrets_read - parse a secrets file into entries and index them.
+ * Lines without all the fixed words for the file are left out.
+ * Returns 1, or 0 if the file is too big to index.
+ */
+int
+secrets_read(struct secrets_table *t, FILE *f)
+{
+    int newline, eof, nwords, max, i, ret;
+    uint32_t h, nbuckets;
+    char word[MAXWORDLEN];
+    char *strings;
+    size_t len, slen, size, wlen;
+    struct ppp_secrets_entry *entries, *ep;
+    int32_t *buckets;
+
+    secrets_free(t);
+    entries = NULL;
+    strings = NULL;
+    slen = size = 0;
+    max = 0;
+    ret = 1;
+    if (!getword(f, word, &newline, t->filename))
+	goto index;		/* file is empty??? */
+
+    eof = 0;
+    while (!eof) {
+	/*
+	 * Add the words on this line to the strings.
+	 */
+	len = 0;
+	nwords = 0;
+	for (;;) {
+	    wlen = strlen(word) + 1;
+	    if (slen + len + wlen > size) {
+		size = size? size * 2: 65536;
+		strings = realloc(strings, size);
+		if (strings == NULL)
+		    novm("secrets");
+	    }
+	    memcpy(strings + slen + len, word, wlen);
+	    len += wlen;
+	    ++nwords;
+	    if (!getword(f, word, &newline, t->filename)) {
+		eof = 1;
+		break;
+	    }
+	    if (newline)
+		break;
+	}
+	if (nwords < t->nfixed)
+	    continue;
+	if (slen + len > UINT32_MAX || t->nentries == INT32_MAX) {
+	    error("%s is too big to index", t->filename);
+	    ret = 0;
+	    break;
+	}
+
+	if (t->nentries == max) {
+	    max = max? max * 2: 64;
+	    entries = realloc(entries, max * sizeof(*ep));
+	    if (entries == NULL)
+		novm("secrets");
+	}
+	ep = &entries[t->nentries++];
+	ep->words = slen;
+	ep->len = len;
+	ep->nwords = nwords;
+	slen += len;
+    }
+    if (size > slen)
+	BZERO(strings + slen, size - slen);
+
+ index:
+    /* chain entries with the same hash, in the order they're in the file */
+    for (nbuckets = 16; nbuckets < t->nentries * 2; nbuckets *= 2)
+	;
+    buckets = malloc(nbuckets * sizeof(*buckets));
+    if (buckets == NULL)
+	novm("secrets");
+    for (i = 0; i < nbuckets; ++i)
+	buckets[i] = -1;
+    for (i = t->nentries - 1; i >= 0; --i) {
+	ep = &entries[i];
+	h = secrets_hash(strings + ep->words,
+			 strings + ep->words + strlen(strings + ep->words) + 1);
+	h &= nbuckets - 1;
+	ep->next = buckets[h];
+	buckets[h] = i;
+    }
+
+    t->entries = entries;
+    t->buckets = buckets;
+    t->nbuckets = nbuckets;
+    t->strings = strings;
+    t->strings_len = slen;
+    return ret;
+}
+
+/*
+ * secrets_db_unmap - stop using the compiled database.
+ */
+static void
+secrets_db_unmap(void)
+{
+    struct secrets_table *t;
+
+    if (db_map == NULL)
+	return;
+    for (t = tables; t != NULL; t = t->next)
+	if (t->from_db)
+	    secrets_free(t);
+    munmap(db_map, db_len);
+    db_map = NULL;
+    db_len = 0;
+    ppp_mem_account("secrets-db", 0, 1);
+}
+
+/*
+ * secrets_db - map the compiled database, if there is one, or check
+ * that the one we have mapped is still current.
+ */
+static struct ppp_secrets_header *
+secrets_db(void)
+{
+    struct ppp_secrets_header *hdr;
+    struct stat sbuf;
+    void *map;
+    int fd;
+
+    if (stat(PPP_PATH_SECRETSDB, &sbuf) < 0) {
+	secrets_db_unmap();
+	return NULL;
+    }
+    if (db_map != NULL && sbuf.st_dev == db_dev && sbuf.st_ino == db_ino
+	&& sbuf.st_size == db_len
+	&& sbuf.st_mtim.tv_sec == db_mtime.tv_sec
+	&& sbuf.st_mtim.tv_nsec == db_mtime.tv_nsec)
+	return (struct ppp_secrets_header *) db_map;
+
+    secrets_db_unmap();
+    fd = open(PPP_PATH_SECRETSDB, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &sbuf) < 0 || sbuf.st_size < sizeof(*hdr)) {
+	close(fd);
+	return NULL;
+    }
+    if ((sbuf.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+	warn("Warning - secret file %s has world and/or group access",
+	     PPP_PATH_SECRETSDB);
+    map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	error("Couldn't map %s: %m", PPP_PATH_SECRETSDB);
+	return NULL;
+    }
+    hdr = map;
+    if (hdr->magic != PPP_SECRETS_MAGIC || hdr->version != PPP_SECRETS_VERSION) {
+	warn("%s is not a secrets database for this version of pppd",
+	     PPP_PATH_SECRETSDB);
+	munmap(map, sbuf.st_size);
+	return NULL;
+    }
+    db_map = map;
+    db_len = sbuf.st_size;
+    ppp_mem_account("secrets-db", db_len, 1);
+    db_dev = sbuf.st_dev;
+    db_ino = sbuf.st_ino;
+    db_mtime = sbuf.st_mtim;
+    return hdr;
+}
+
+/*
+ * db_range - check that len bytes at off are within the database.
+ */
+static int
+db_range(uint64_t off, uint64_t len)
+{
+    return (off & 7) == 0 && off <= db_len && len <= db_len - off;
+}
+
+/*
+ * secrets_from_db - use what the database has for a secrets file,
+ * if it was compiled from the file as it is now.
+ */
+static int
+secrets_from_db(struct secrets_table *t, struct stat *sbuf)
+{
+    struct ppp_secrets_header *hdr;
+    struct ppp_secrets_file *sf;
+
+    if ((hdr = secrets_db()) == NULL)
+	return 0;
+    sf = &hdr->files[t->index];
+    if (!sf->present || sf->size != sbuf->st_size || sf->ino != sbuf->st_ino
+	|| sf->mtime != sbuf->st_mtim.tv_sec
+	|| sf->mtime_nsec != sbuf->st_mtim.tv_nsec)
+	return 0;
+    if (sf->nbuckets == 0 || (sf->nbuckets & (sf->nbuckets - 1)) != 0
+	|| !db_range(sf->entries, (uint64_t) sf->nentries * sizeof(*t->entries))
+	|| !db_range(sf->buckets, (uint64_t) sf->nbuckets * sizeof(*t->buckets))
+	|| !db_range(sf->strings, sf->strings_len)) {
+	warn("%s is damaged; reading %s", PPP_PATH_SECRETSDB, t->filename);
+	return 0;
+    }
+
+    t->entries = (struct ppp_secrets_entry *) (db_map + sf->entries);
+    t->nentries = sf->nentries;
+    t->buckets = (int32_t *) (db_map + sf->buckets);
+    t->nbuckets = sf->nbuckets;
+    t->strings = db_map + sf->strings;
+    t->strings_len = sf->strings_len;
+    t->from_db = 1;
+    return 1;
+}
+
+/*
+ * secrets_load - make sure we have the current contents of a secrets
+ * file, from the database if it is up to date, otherwise from the
+ * file itself.  The file is stat'ed each time; it is only read again
+ * if it has changed.  Returns 0, with errno set, if the file can't
+ * be read.
+ */
+int
+secrets_load(struct secrets_table *t)
+{
+    struct secrets_table *tp;
+    struct stat sbuf;
+    FILE *f;
+
+    if (stat(t->filename, &sbuf) < 0) {
+	secrets_free(t);
+	return 0;
+    }
+    if (t->loaded && sbuf.st_dev == t->dev && sbuf.st_ino == t->ino
+	&& sbuf.st_size == t->size
+	&& sbuf.st_mtim.tv_sec == t->mtime.tv_sec
+	&& sbuf.st_mtim.tv_nsec == t->mtime.tv_nsec
+	&& sbuf.st_ctim.tv_sec == t->ctime.tv_sec
+	&& sbuf.st_ctim.tv_nsec == t->ctime.tv_nsec)
+	return 1;
+
+    secrets_free(t);
+    for (tp = tables; tp != NULL && tp != t; tp = tp->next)
+	;
+    if (tp == NULL) {
+	t->next = tables;
+	tables = t;
+    }
+
+    if (!secrets_from_db(t, &sbuf)) {
+	f = fopen(t->filename, "r");
+	if (f == NULL)
+	    return 0;
+	check_access(f, t->filename);
+	if (fstat(fileno(f), &sbuf) < 0) {
+	    fclose(f);
+	    return 0;
+	}
+	secrets_read(t, f);
+	fclose(f);
+    }
+
+    t->dev = sbuf.st_dev;
+    t->ino = sbuf.st_ino;
+    t->size = sbuf.st_size;
+    t->mtime = sbuf.st_mtim;
+    t->ctime = sbuf.st_ctim;
+    t->loaded = 1;
+    return 1;
+}
+
+/*
+ * secrets_words - return the words of an entry, and how many there
+ * are in *nwords, or NULL if the entry is damaged.
+ */
+const char *
+secrets_words(struct secrets_table *t, const struct ppp_secrets_entry *ep,
+	      int *nwords)
+{
+    const char *p, *end;
+    uint32_t n;
+
+    if (ep->len == 0 || ep->words > t->strings_len
+	|| ep->len > t->strings_len - ep->words)
+	return NULL;
+    p = t->strings + ep->words;
+    end = p + ep->len;
+    if (end[-1] != 0)
+	return NULL;
+    for (n = 0; p < end; ++n)
+	p += strlen(p) + 1;
+    if (n != ep->nwords || n < t->nfixed)
+	return NULL;
+    *nwords = n;
+    return t->strings + ep->words;
+}
+
+/*
+ * secrets_fixed - point words[] at the fixed words of an entry.
+ */
+static int
+secrets_fixed(struct secrets_table *t, const struct ppp_secrets_entry *ep,
+	      const char **words)
+{
+    const char *p;
+    int i, n;
+
+    if ((p = secrets_words(t, ep, &n)) == NULL)
+	return 0;
+    for (i = 0; i < t->nfixed; ++i) {
+	words[i] = p;
+	p += strlen(p) + 1;
+    }
+    return 1;
+}
+
+/*
+ * secrets_match - check whether an entry is for `client' on `server',
+ * either of which may be NULL to match anything.  Returns -1 if not,
+ * otherwise the NONWILD_* bits for the entry.
+ */
+static int
+secrets_match(const char **words, char *client, char *server)
+{
+    int got_flag = 0;
+
+    if (!ISWILD(words[0])) {
+	if (client != NULL && strcmp(words[0], client) != 0)
+	    return -1;
+	got_flag = NONWILD_CLIENT;
+    }
+    if (!ISWILD(words[1])) {
+	if (server != NULL && strcmp(words[1], server) != 0)
+	    return -1;
+	got_flag |= NONWILD_SERVER;
+    }
+    return got_flag;
+}
+
+/*
+ * secrets_lookup - find the entry to use for authenticating `client'
+ * on `server'; either can be NULL, meaning any name will do.  Of the
+ * entries that match and that check (if non-NULL) accepts, the first
+ * with the most non-wild names is used, as if reading through the
+ * file.  When both names are known, that is found by looking up the
+ * exact names, then each with "*" in turn, in the index.  Returns -1
+ * if there is none, otherwise the NONWILD_* bits for the entry found.
+ */
+int
+secrets_lookup(struct secrets_table *t, char *client, char *server,
+	       secrets_check_fn *check, void *arg,
+	       const struct ppp_secrets_entry **found)
+{
+    const struct ppp_secrets_entry *ep;
+    const char *words[SECRETS_MAXFIXED];
+    char *keys[4][2];
+    int32_t i;
+    uint32_t n;
+    int j, k, got_flag, best_flag;
+
+    *found = NULL;
+    best_flag = -1;
+    if (t->nentries == 0)
+	return -1;
+
+    if (client == NULL || server == NULL) {
+	for (n = 0; n < t->nentries; ++n) {
+	    ep = &t->entries[n];
+	    if (!secrets_fixed(t, ep, words))
+		continue;
+	    got_flag = secrets_match(words, client, server);
+	    if (got_flag <= best_flag)
+		continue;
+	    if (check == NULL || (*check)(words, arg)) {
+		*found = ep;
+		best_flag = got_flag;
+	    }
+	}
+	return best_flag;
+    }
+
+    keys[0][0] = client;	keys[0][1] = server;
+    keys[1][0] = client;	keys[1][1] = "*";
+    keys[2][0] = "*";		keys[2][1] = server;
+    keys[3][0] = "*";		keys[3][1] = "*";
+    for (k = 0; k < 4; ++k) {
+	/* client or server may itself be "*" */
+	for (j = 0; j < k; ++j)
+	    if (strcmp(keys[j][0], keys[k][0]) == 0
+		&& strcmp(keys[j][1], keys[k][1]) == 0)
+		break;
+	if (j < k)
+	    continue;
+	i = t->buckets[secrets_hash(keys[k][0], keys[k][1])
+		       & (t->nbuckets - 1)];
+	/* n bounds the walk, in case the database is damaged */
+	for (n = 0; i >= 0 && i < t->nentries && n < t->nentries;
+	     i = ep->next, ++n) {
+	    ep = &t->entries[i];
+	    if (!secrets_fixed(t, ep, words)
+		|| strcmp(words[0], keys[k][0]) != 0
+		|| strcmp(words[1], keys[k][1]) != 0)
+		continue;
+	    if (check == NULL || (*check)(words, arg)) {
+		*found = ep;
+		return secrets_match(words, client, server);
+	    }
+	}
+    }
+    return -1;
+}
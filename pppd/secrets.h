@@ -0,0 +1,142 @@
+/*
+ * secrets.h - definitions for reading the secrets files, and the
+ * layout of the compiled secrets database.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPP_SECRETS_H
+#define PPP_SECRETS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * The database built by pppd-compile-secrets holds each of the
+ * secrets files in the form pppd keeps it in memory: an array of
+ * entries, one per line of the file, a hash table of entries by
+ * client and server, and the words of the lines.  With each file it
+ * records the size, inode and modification time the file had, and
+ * pppd only uses what is in the database while the file still has
+ * them, so an edited file is read as before until it is compiled
+ * again.  The header is followed by the files' data, each part at
+ * an offset given in the header, in the byte order of the host that
+ * built it.
+ */
+#define PPP_SECRETS_MAGIC	0x50505344	/* "PPSD" */
+#define PPP_SECRETS_VERSION	1
+
+/* The files the database can hold */
+#define SECRETS_PAP		0
+#define SECRETS_CHAP		1
+#define SECRETS_SRP		2
+#define SECRETS_EAPTLS_SERVER	3
+#define SECRETS_EAPTLS_CLIENT	4
+#define SECRETS_NFILES		5
+
+struct ppp_secrets_file {
+    uint32_t	present;	/* 0 if the file didn't exist */
+    uint32_t	mtime_nsec;
+    int64_t	mtime;		/* identity of the file compiled */
+    uint64_t	size;
+    uint64_t	ino;
+    uint32_t	nentries;
+    uint32_t	nbuckets;	/* a power of 2 */
+    uint64_t	entries;	/* offset of the entries */
+    uint64_t	buckets;	/* offset of the hash table */
+    uint64_t	strings;	/* offset of the words */
+    uint64_t	strings_len;
+};
+
+struct ppp_secrets_header {
+    uint32_t	magic;
+    uint32_t	version;
+    struct ppp_secrets_file files[SECRETS_NFILES];
+};
+
+/*
+ * An entry is a line with at least a client, a server and the fixed
+ * words for its file (a secret, or the certificates and key for
+ * EAP-TLS), stored as consecutive nul-terminated strings.  next
+ * chains together entries with the same hash, in the order they were
+ * in the file; the hash table holds the first of each chain, or -1.
+ */
+struct ppp_secrets_entry {
+    uint32_t	words;		/* offset in the strings */
+    uint32_t	len;		/* of all the words */
+    uint32_t	nwords;		/* including the client and server */
+    int32_t	next;
+};
+
+/* Bits in the value returned by secrets_lookup */
+#define NONWILD_SERVER	1
+#define NONWILD_CLIENT	2
+
+#define ISWILD(word)	(word[0] == '*' && word[1] == 0)
+
+/*
+ * What we have read of one secrets file, either from the file itself
+ * or from the database.
+ */
+struct secrets_table {
+    char	*filename;
+    int		nfixed;		/* words each entry must have */
+    int		index;		/* SECRETS_* */
+    int		loaded;
+    int		from_db;	/* points into the database */
+    dev_t	dev;		/* the file we read */
+    ino_t	ino;
+    off_t	size;
+    struct timespec mtime;
+    struct timespec ctime;
+    const struct ppp_secrets_entry *entries;
+    uint32_t	nentries;
+    const int32_t *buckets;
+    uint32_t	nbuckets;
+    const char	*strings;
+    size_t	strings_len;
+    struct secrets_table *next;	/* on the list of tables in use */
+};
+
+#define SECRETS_INIT(file, index, nfixed) \
+    { (file), (nfixed), (index) }
+
+/* Decides whether an entry can be used; words are its fixed words. */
+typedef int (secrets_check_fn)(const char **words, void *arg);
+
+int  secrets_load(struct secrets_table *);
+void secrets_free(struct secrets_table *);
+int  secrets_read(struct secrets_table *, FILE *);
+int  secrets_lookup(struct secrets_table *, char *, char *,
+		    secrets_check_fn *, void *,
+		    const struct ppp_secrets_entry **);
+const char *secrets_words(struct secrets_table *,
+			  const struct ppp_secrets_entry *, int *);
+void check_access(FILE *, char *);
+
+#endif /* PPP_SECRETS_H */
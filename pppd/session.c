@@ -90,10 +90,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include "pppd-private.h"
+#include "fsm.h"
+#include "lcp.h"
 #include "session.h"
 
 #ifdef PPP_WITH_PAM
 #include <security/pam_appl.h>
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
 #endif /* #ifdef PPP_WITH_PAM */
 
 #define SET_MSG(var, msg) if (var != NULL) { var[0] = msg; }
@@ -119,6 +124,35 @@ static const char *PAM_password;
 static int   PAM_session = 0;
 static pam_handle_t *pamh = NULL;
 
+/*
+ * The handle is kept for the life of the link, so that when the peer
+ * authenticates again (CHAP rechallenges, say) the modules are not
+ * loaded and initialized all over again and the session stays open.
+ * With the defer-session option, pam_open_session is left until the
+ * network is up and then run on the offload thread, so it doesn't
+ * hold up the peer getting an address.
+ */
+static char  PAM_user[MAXNAMELEN];	/* user pamh was started for */
+static int   PAM_open_pending;	/* session to open once the network is up */
+static int   PAM_opening;		/* pam_open_session running */
+static int   PAM_ended;		/* session_end called meanwhile */
+static int   PAM_notify_added;
+
+/*
+ * session_start can be called on the offload thread, from the password
+ * and CHAP checks, while the main loop ends the session or opens a
+ * deferred one, so the handle and the flags above are only touched
+ * with PAM_lock held.
+ */
+#ifdef HAVE_PTHREAD_CREATE
+static pthread_mutex_t PAM_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PAM_LOCK()	pthread_mutex_lock(&PAM_lock)
+#define PAM_UNLOCK()	pthread_mutex_unlock(&PAM_lock)
+#else
+#define PAM_LOCK()	do { } while (0)
+#define PAM_UNLOCK()	do { } while (0)
+#endif
+
 /* PAM conversation function
  * Here we assume (for now, at least) that echo on means login name, and
  * echo off means password.
@@ -167,6 +201,82 @@ static struct pam_conv pam_conv_data = {
     &conversation,
     NULL
 };
+
+/*
+ * pam_finish - close the session if it was opened and let go of the
+ * handle.  The caller holds PAM_lock.
+ */
+static void
+pam_finish(void)
+{
+    int pam_error = PAM_SUCCESS;
+
+    if (PAM_session)
+	pam_error = pam_close_session(pamh, PAM_SILENT);
+    PAM_session = 0;
+    PAM_open_pending = 0;
+    pam_end(pamh, pam_error);
+    pamh = NULL;
+    PAM_user[0] = 0;
+    /* Apparently the pam stuff does closelog(). */
+    reopen_log();
+}
+
+static int
+pam_open_work(void *arg)
+{
+    int pam_error;
+
+    PAM_LOCK();
+    pam_error = pam_open_session(pamh, PAM_SILENT);
+    PAM_UNLOCK();
+    return pam_error;
+}
+
+static void
+pam_open_done(void *arg, int pam_error)
+{
+    PAM_LOCK();
+    PAM_opening = 0;
+    if (pam_error == PAM_SUCCESS)
+	PAM_session = 1;
+    if (PAM_ended) {
+	/* the link went down while the session was being opened */
+	PAM_ended = 0;
+	pam_finish();
+	PAM_UNLOCK();
+	return;
+    }
+    reopen_log();
+    if (pam_error == PAM_SUCCESS) {
+	dbglog("PAM Session opened for user %s", PAM_user);
+	PAM_UNLOCK();
+    } else {
+	error("PAM Session denied for user %s: %s", PAM_user,
+	      pam_strerror(pamh, pam_error));
+	PAM_UNLOCK();
+	ppp_set_status(EXIT_PEER_AUTH_FAILED);
+	lcp_close(0, "PAM session denied");
+    }
+}
+
+/*
+ * pam_open_deferred - open the session put off by defer-session, now
+ * that the network is up.
+ */
+static void
+pam_open_deferred(void *arg, int val)
+{
+    PAM_LOCK();
+    if (!PAM_open_pending || pamh == NULL) {
+	PAM_UNLOCK();
+	return;
+    }
+    PAM_open_pending = 0;
+    PAM_opening = 1;
+    PAM_UNLOCK();
+    ppp_offload(pam_open_work, pam_open_done, NULL);
+}
 #endif /* #ifdef PPP_WITH_PAM */
 
 int
@@ -207,14 +317,29 @@ session_start(const int flags, const char *user, const char *passwd, const char
     else
 	usr++;
 
-    PAM_session = 0;
+    PAM_LOCK();
+    /* authenticating again: keep the handle if it's the same user */
+    if (pamh != NULL && strcmp(PAM_user, usr) != 0) {
+	if (PAM_opening) {
+	    PAM_UNLOCK();
+	    SET_MSG(msg, "PAM session for another user is being opened");
+	    return SESSION_FAILED;
+	}
+	pam_finish();
+    }
     PAM_username = usr;
     PAM_password = passwd;
 
-    dbglog("Initializing PAM (%d) for user %s", flags, usr);
-    pam_error = pam_start (SERVICE_NAME, usr, &pam_conv_data, &pamh);
-    dbglog("---> PAM INIT Result = %d", pam_error);
-    ok = (pam_error == PAM_SUCCESS);
+    if (pamh == NULL) {
+	dbglog("Initializing PAM (%d) for user %s", flags, usr);
+	pam_error = pam_start (SERVICE_NAME, usr, &pam_conv_data, &pamh);
+	dbglog("---> PAM INIT Result = %d", pam_error);
+	ok = (pam_error == PAM_SUCCESS);
+	if (ok)
+	    strlcpy(PAM_user, usr, sizeof(PAM_user));
+	else
+	    pamh = NULL;
+    }
 
     if (ok) {
         ok = (pam_set_item(pamh, PAM_TTY, ttyName) == PAM_SUCCESS) &&
@@ -276,6 +401,23 @@ session_start(const int flags, const char *user, const char *passwd, const char
         }
     }
 
+    if (ok && try_session && (SESS_ACCT & flags)
+	&& (PAM_session || PAM_open_pending || PAM_opening)) {
+	/* it is already open, or will be */
+	try_session = 0;
+    }
+
+    if (ok && try_session && (SESS_ACCT & flags) && session_defer) {
+	dbglog("Opening PAM Session for user %s once the network is up", user);
+	PAM_open_pending = 1;
+	if (!PAM_notify_added) {
+	    ppp_add_notify(NF_IP_UP, pam_open_deferred, NULL);
+	    ppp_add_notify(NF_IPV6_UP, pam_open_deferred, NULL);
+	    PAM_notify_added = 1;
+	}
+	try_session = 0;
+    }
+
     if (ok && try_session && (SESS_ACCT & flags)) {
         /* Only open a session if the user's account was found */
         pam_error = pam_open_session (pamh, PAM_SILENT);
@@ -289,8 +431,13 @@ session_start(const int flags, const char *user, const char *passwd, const char
         }
     }
 
+    /* the strings we were given may go away before the handle does */
+    PAM_username = PAM_user;
+    PAM_password = NULL;
+
     /* This is needed because apparently the PAM stuff closes the log */
     reopen_log();
+    PAM_UNLOCK();
 
     /* If our PAM checks have already failed, then we must return a failure */
     if (!ok) return SESSION_FAILED;
@@ -368,7 +515,8 @@ session_start(const int flags, const char *user, const char *passwd, const char
     if (SESS_ACCT & flags) {
 	if (strncmp(ttyName, "/dev/", 5) == 0)
 	    ttyName += 5;
-	logwtmp(ttyName, user, ifname); /* Add wtmp login entry */
+	if (session_wtmp)
+	    logwtmp(ttyName, user, ifname); /* Add wtmp login entry */
 	logged_in = 1;
 
 #if defined(_PATH_LASTLOG) && !defined(PPP_WITH_PAM)
@@ -407,21 +555,18 @@ void
 session_end(const char* ttyName)
 {
 #ifdef PPP_WITH_PAM
-    int pam_error = PAM_SUCCESS;
-
-    if (pamh != NULL) {
-        if (PAM_session) pam_error = pam_close_session (pamh, PAM_SILENT);
-        PAM_session = 0;
-        pam_end (pamh, pam_error);
-        pamh = NULL;
-	/* Apparently the pam stuff does closelog(). */
-	reopen_log();
-    }
+    PAM_LOCK();
+    if (PAM_opening)
+	PAM_ended = 1;		/* pam_open_done will finish up */
+    else if (pamh != NULL)
+	pam_finish();
+    PAM_UNLOCK();
 #endif
     if (logged_in) {
 	if (strncmp(ttyName, "/dev/", 5) == 0)
 	    ttyName += 5;
-	logwtmp(ttyName, "", ""); /* Wipe out utmp logout entry */
+	if (session_wtmp)
+	    logwtmp(ttyName, "", ""); /* Wipe out utmp logout entry */
 	logged_in = 0;
     }
 }
@@ -0,0 +1,281 @@
+/*
+ * sessionbench.c - time pppd bringing up sessions over a pty.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Usage: sessionbench [-n count] [-a none|pap|chap|mschapv2|eap] [-6]
+ *			 [-p pppd]
+ *
+ * Runs count sessions, one after another, each between two pppds: a
+ * client, which takes the server as its pty program, so that tty.c
+ * makes the pty pair with get_pty, and the server, running notty on
+ * the other end.  The client logs, on fd 3, how long each phase took
+ * (as trace.c reports it when the link comes up), and is stopped as
+ * soon as it has.  The percentiles of each phase over the runs are
+ * printed at the end, with the CPU time, context switches and peak
+ * RSS of the pppds.  For counts of the system calls made, run the
+ * benchmark under "strace -f -c".
+ *
+ * This needs to run as root, with the ppp driver, and for the
+ * authenticated runs the secrets files must let the client "bench",
+ * with secret "bench", authenticate to the server "benchsrv".
+ *
+ * Build with "make sessionbench".
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define LINK_TIMEOUT	20000	/* ms to wait for a session to come up */
+
+enum { P_TOTAL, P_CONNECT, P_ESTABLISH, P_AUTH, P_NETWORK, NPHASES };
+
+static const char *phase_names[NPHASES] = {
+    "start to up", "connect", "establish", "authenticate", "network"
+};
+
+static struct auth_method {
+    const char *name;
+    const char *require;	/* server option */
+    const char *refuse;		/* client options to leave only this one */
+} methods[] = {
+    { "none", NULL, NULL },
+    { "pap", "require-pap", "refuse-chap refuse-mschap-v2 refuse-eap" },
+    { "chap", "require-chap", "refuse-pap refuse-mschap-v2 refuse-eap" },
+    { "mschapv2", "require-mschap-v2", "refuse-pap refuse-chap refuse-eap" },
+    { "eap", "require-eap", "refuse-pap refuse-chap refuse-mschap-v2" },
+    { NULL }
+};
+
+static long
+ms_since(struct timespec *t0)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - t0->tv_sec) * 1000
+	+ (t.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+
+    return x < y? -1: x > y;
+}
+
+static long
+percentile(long *v, int n, int pc)
+{
+    int i = (n * pc + 99) / 100 - 1;
+
+    return v[i < 0? 0: i];
+}
+
+/*
+ * run_session - bring up one session and fill in ms[] with how long
+ * each phase took.  Returns 0 if the link didn't come up.
+ */
+static int
+run_session(const char *pppd, struct auth_method *m, int ipv6, long *ms)
+{
+    char server[1024], cmd[2048], line[512], *p, *nl;
+    struct timespec t0;
+    struct pollfd pfd;
+    int fds[2], pid, n, len, up, status;
+    long left;
+
+    snprintf(server, sizeof(server), "%s notty local nodetach noccp"
+	     " name benchsrv 10.64.0.1:10.64.0.2 nodefaultroute%s%s%s",
+	     pppd, m->require? " ": " noauth", m->require? m->require: "",
+	     ipv6? " +ipv6": "");
+    snprintf(cmd, sizeof(cmd), "exec %s nodetach logfd 3 local noauth"
+	     " noccp noipdefault nodefaultroute%s%s%s pty '%s'",
+	     pppd, m->require? " user bench password bench ": "",
+	     m->refuse? m->refuse: "", ipv6? " +ipv6": "", server);
+
+    if (pipe(fds) < 0) {
+	perror("pipe");
+	exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pid = fork();
+    if (pid < 0) {
+	perror("fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	close(fds[0]);
+	if (fds[1] != 3) {
+	    dup2(fds[1], 3);
+	    close(fds[1]);
+	}
+	execl("/bin/sh", "sh", "-c", cmd, (char *) NULL);
+	_exit(127);
+    }
+    close(fds[1]);
+
+    up = 0;
+    len = 0;
+    pfd.fd = fds[0];
+    pfd.events = POLLIN;
+    for (;;) {
+	left = LINK_TIMEOUT - ms_since(&t0);
+	if (!up && left <= 0) {
+	    fprintf(stderr, "session didn't come up in %d ms\n", LINK_TIMEOUT);
+	    kill(pid, SIGTERM);
+	    up = -1;
+	}
+	if (poll(&pfd, 1, up? 1000: left) <= 0)
+	    continue;
+	n = read(fds[0], line + len, sizeof(line) - 1 - len);
+	if (n <= 0)
+	    break;
+	len += n;
+	line[len] = 0;
+	while ((nl = strchr(line, '\n')) != NULL) {
+	    *nl = 0;
+	    p = strstr(line, "Link up after ");
+	    if (p != NULL && !up) {
+		ms[P_TOTAL] = ms_since(&t0);
+		if (sscanf(p, "Link up after %*d ms: connect %ld, "
+			   "establish %ld, authenticate %ld, network %ld",
+			   &ms[P_CONNECT], &ms[P_ESTABLISH], &ms[P_AUTH],
+			   &ms[P_NETWORK]) == 4) {
+		    up = 1;
+		    kill(pid, SIGTERM);
+		}
+	    }
+	    len -= nl + 1 - line;
+	    memmove(line, nl + 1, len + 1);
+	}
+	if (len == sizeof(line) - 1)
+	    len = 0;		/* overlong line: drop it */
+    }
+    close(fds[0]);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+	;
+    return up > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct auth_method *m = &methods[0];
+    const char *pppd = "./pppd";
+    struct rusage ru;
+    long *ms[NPHASES];
+    int count = 20, ipv6 = 0, done, failed, i, c;
+
+    while ((c = getopt(argc, argv, "n:a:6p:")) != -1) {
+	switch (c) {
+	case 'n':
+	    count = atoi(optarg);
+	    break;
+	case 'a':
+	    for (m = methods; m->name != NULL; ++m)
+		if (strcmp(m->name, optarg) == 0)
+		    break;
+	    if (m->name == NULL) {
+		fprintf(stderr, "unknown authentication method %s\n", optarg);
+		exit(2);
+	    }
+	    break;
+	case '6':
+	    ipv6 = 1;
+	    break;
+	case 'p':
+	    pppd = optarg;
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-n count] [-a none|pap|chap|mschapv2"
+		    "|eap] [-6] [-p pppd]\n", argv[0]);
+	    exit(2);
+	}
+    }
+    if (count <= 0)
+	count = 1;
+    for (i = 0; i < NPHASES; ++i) {
+	ms[i] = calloc(count, sizeof(long));
+	if (ms[i] == NULL) {
+	    perror("calloc");
+	    exit(1);
+	}
+    }
+
+    done = failed = 0;
+    while (done + failed < count) {
+	long one[NPHASES];
+
+	if (!run_session(pppd, m, ipv6, one)) {
+	    ++failed;
+	    continue;
+	}
+	for (i = 0; i < NPHASES; ++i)
+	    ms[i][done] = one[i];
+	++done;
+    }
+
+    printf("%d sessions (%s%s), %d failed\n", done, m->name,
+	   ipv6? ", IPv6": "", failed);
+    if (done > 0) {
+	printf("%-14s %8s %8s %8s %8s  (ms)\n", "", "p50", "p90", "p99",
+	       "max");
+	for (i = 0; i < NPHASES; ++i) {
+	    qsort(ms[i], done, sizeof(long), cmp_long);
+	    printf("%-14s %8ld %8ld %8ld %8ld\n", phase_names[i],
+		   percentile(ms[i], done, 50), percentile(ms[i], done, 90),
+		   percentile(ms[i], done, 99), ms[i][done - 1]);
+	}
+    }
+    if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+	printf("pppd cpu: user %ld.%03ld s, system %ld.%03ld s\n",
+	       (long) ru.ru_utime.tv_sec, (long) ru.ru_utime.tv_usec / 1000,
+	       (long) ru.ru_stime.tv_sec, (long) ru.ru_stime.tv_usec / 1000);
+	printf("context switches: %ld voluntary, %ld involuntary\n",
+	       ru.ru_nvcsw, ru.ru_nivcsw);
+	printf("peak RSS: %ld kB\n", ru.ru_maxrss);
+    }
+    return failed > 0;
+}
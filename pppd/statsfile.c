@@ -0,0 +1,306 @@
+/*
+ * statsfile.c - publish live link counters in a memory-mapped file.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pppd-private.h"
+#include "pathnames.h"
+#include "fsm.h"
+#include "lcp.h"
+#include "ccp.h"
+#include "statsfile.h"
+
+static int statsfile_fd = -1;
+static char *statsfile_map;		/* mapped pages holding our slot */
+static size_t statsfile_maplen;
+static volatile struct ppp_statsfile_slot *statsfile_slot;
+static int statsfile_unit = -1;		/* unit whose slot is mapped */
+
+/* kept here as they happen, and copied to the slot on each update */
+static uint32_t link_up_ms[4];		/* connect, establish, auth, network */
+static uint32_t echo_rtt_count;
+static uint64_t echo_rtt_sum;
+static uint32_t echo_rtt_hist[PPP_STATSFILE_RTT_BUCKETS];
+static const uint32_t echo_rtt_bounds[] = PPP_STATSFILE_RTT_BOUNDS;
+
+static void statsfile_timer(void *);
+
+/*
+ * statsfile_open - open the stats file, creating it if need be.
+ */
+static int
+statsfile_open(void)
+{
+    struct ppp_statsfile_header hdr;
+    ssize_t n;
+
+    statsfile_fd = open(PPP_PATH_STATSFILE, O_RDWR | O_CREAT, 0644);
+    if (statsfile_fd < 0) {
+	error("Couldn't open %s: %m", PPP_PATH_STATSFILE);
+	return 0;
+    }
+    fcntl(statsfile_fd, F_SETFD, FD_CLOEXEC);
+
+    n = pread(statsfile_fd, &hdr, sizeof(hdr), 0);
+    if (n < (ssize_t) sizeof(hdr)) {
+	/* a new file; any other pppd creating it writes the same thing */
+	hdr.magic = PPP_STATSFILE_MAGIC;
+	hdr.version = PPP_STATSFILE_VERSION;
+	hdr.slot_size = PPP_STATSFILE_SLOTSIZE;
+	if (pwrite(statsfile_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	    error("Couldn't initialize %s: %m", PPP_PATH_STATSFILE);
+	    goto fail;
+	}
+    } else if (hdr.magic != PPP_STATSFILE_MAGIC
+	       || hdr.version != PPP_STATSFILE_VERSION
+	       || hdr.slot_size != PPP_STATSFILE_SLOTSIZE) {
+	error("%s is not a stats file for this version of pppd",
+	      PPP_PATH_STATSFILE);
+	goto fail;
+    }
+    return 1;
+
+ fail:
+    close(statsfile_fd);
+    statsfile_fd = -1;
+    return 0;
+}
+
+/*
+ * statsfile_attach - map the slot for the current unit.
+ */
+static int
+statsfile_attach(void)
+{
+    struct stat st;
+    off_t off, start;
+    long pagesize;
+    void *map;
+
+    if (statsfile_fd < 0 && !statsfile_open())
+	return 0;
+
+    off = (off_t) (ifunit + 1) * PPP_STATSFILE_SLOTSIZE;
+    if (fstat(statsfile_fd, &st) < 0) {
+	error("Couldn't stat %s: %m", PPP_PATH_STATSFILE);
+	return 0;
+    }
+    /* extend the file to cover our slot; writing never shrinks it */
+    if (st.st_size < off + PPP_STATSFILE_SLOTSIZE
+	&& pwrite(statsfile_fd, "", 1, off + PPP_STATSFILE_SLOTSIZE - 1) != 1) {
+	error("Couldn't extend %s: %m", PPP_PATH_STATSFILE);
+	return 0;
+    }
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    start = off & ~((off_t) pagesize - 1);
+    statsfile_maplen = off + PPP_STATSFILE_SLOTSIZE - start;
+    map = mmap(NULL, statsfile_maplen, PROT_READ | PROT_WRITE, MAP_SHARED,
+	       statsfile_fd, start);
+    if (map == MAP_FAILED) {
+	error("Couldn't map %s: %m", PPP_PATH_STATSFILE);
+	return 0;
+    }
+    statsfile_map = map;
+    statsfile_slot = (struct ppp_statsfile_slot *) (statsfile_map + (off - start));
+    statsfile_unit = ifunit;
+
+    /* a pppd that died part way through an update leaves seq odd */
+    statsfile_slot->seq = (statsfile_slot->seq + 1) & ~1U;
+    return 1;
+}
+
+/*
+ * statsfile_detach - mark our slot unused and unmap it.
+ */
+static void
+statsfile_detach(void)
+{
+    if (statsfile_slot == NULL)
+	return;
+    statsfile_slot->seq++;
+    __sync_synchronize();
+    statsfile_slot->pid = 0;
+    __sync_synchronize();
+    statsfile_slot->seq++;
+    munmap(statsfile_map, statsfile_maplen);
+    statsfile_map = NULL;
+    statsfile_slot = NULL;
+    statsfile_unit = -1;
+}
+
+/*
+ * statsfile_update - copy the current counters into our slot.
+ */
+void
+statsfile_update(void)
+{
+    volatile struct ppp_statsfile_slot *sp;
+    struct pppd_stats stats;
+    struct ppp_comp_stats cstats;
+    struct ccp_stats ccpstats;
+
+    if (stats_interval <= 0 || ifunit < 0)
+	return;
+    if (statsfile_unit != ifunit) {
+	statsfile_detach();
+	if (!statsfile_attach()) {
+	    stats_interval = 0;		/* don't keep trying */
+	    return;
+	}
+    }
+    if (!get_link_stats(0, &stats))
+	return;
+    memset(&cstats, 0, sizeof(cstats));
+    get_ppp_comp_stats(0, &cstats);
+    ccp_get_stats(0, &ccpstats);
+
+    sp = statsfile_slot;
+    sp->seq++;
+    __sync_synchronize();
+    sp->pid = getpid();
+    strncpy((char *) sp->ifname, ifname, sizeof(sp->ifname) - 1);
+    sp->ifname[sizeof(sp->ifname) - 1] = 0;
+    sp->updated = time(NULL);
+    sp->bytes_in = stats.bytes_in;
+    sp->bytes_out = stats.bytes_out;
+    sp->pkts_in = stats.pkts_in;
+    sp->pkts_out = stats.pkts_out;
+    sp->comp_unc_bytes = cstats.c.unc_bytes;
+    sp->comp_bytes = cstats.c.comp_bytes;
+    sp->decomp_unc_bytes = cstats.d.unc_bytes;
+    sp->decomp_bytes = cstats.d.comp_bytes;
+    sp->echo_rtt_us = lcp_echo_rtt(0);
+    sp->comp_method = ccpstats.comp_method;
+    sp->decomp_method = ccpstats.decomp_method;
+    sp->comp_pkts = cstats.c.comp_packets;
+    sp->comp_inc_pkts = cstats.c.inc_packets;
+    sp->comp_inc_bytes = cstats.c.inc_bytes;
+    sp->decomp_inc_pkts = cstats.d.inc_packets;
+    sp->reset_req_sent = ccpstats.reset_req_sent;
+    sp->reset_req_rcvd = ccpstats.reset_req_rcvd;
+    sp->reset_ack_rcvd = ccpstats.reset_ack_rcvd;
+    sp->reset_timeouts = ccpstats.reset_timeouts;
+    sp->reset_rtt_us = ccpstats.reset_rtt_us;
+    sp->reset_rtt_max_us = ccpstats.reset_rtt_max_us;
+    sp->connect_ms = link_up_ms[0];
+    sp->establish_ms = link_up_ms[1];
+    sp->auth_ms = link_up_ms[2];
+    sp->network_ms = link_up_ms[3];
+    sp->echo_rtt_count = echo_rtt_count;
+    sp->echo_rtt_sum_us = echo_rtt_sum;
+    memcpy((void *) sp->echo_rtt_hist, echo_rtt_hist, sizeof(echo_rtt_hist));
+    __sync_synchronize();
+    sp->seq++;
+}
+
+/*
+ * statsfile_echo_rtt - count an LCP echo round trip of us microseconds.
+ */
+void
+statsfile_echo_rtt(long us)
+{
+    int i;
+
+    for (i = 0; i < PPP_STATSFILE_RTT_BUCKETS - 1; ++i)
+	if (us <= echo_rtt_bounds[i])
+	    break;
+    ++echo_rtt_hist[i];
+    ++echo_rtt_count;
+    echo_rtt_sum += us;
+}
+
+/*
+ * statsfile_link_up - note how long each phase of bringing the link
+ * up took, in milliseconds.
+ */
+void
+statsfile_link_up(long conn, long est, long auth, long net)
+{
+    link_up_ms[0] = conn;
+    link_up_ms[1] = est;
+    link_up_ms[2] = auth;
+    link_up_ms[3] = net;
+}
+
+static void
+statsfile_timer(void *arg)
+{
+    statsfile_update();
+    if (stats_interval > 0)
+	TIMEOUT(statsfile_timer, NULL, stats_interval);
+}
+
+/*
+ * statsfile_start - start publishing counters, when the link comes up.
+ */
+void
+statsfile_start(void)
+{
+    if (stats_interval <= 0)
+	return;
+    UNTIMEOUT(statsfile_timer, NULL);
+    statsfile_timer(NULL);
+}
+
+/*
+ * statsfile_stop - publish the final counters when the link goes down.
+ */
+void
+statsfile_stop(void)
+{
+    UNTIMEOUT(statsfile_timer, NULL);
+    statsfile_update();
+}
+
+/*
+ * statsfile_close - give up our slot, when pppd exits.
+ */
+void
+statsfile_close(void)
+{
+    UNTIMEOUT(statsfile_timer, NULL);
+    statsfile_detach();
+    if (statsfile_fd >= 0)
+	close(statsfile_fd);
+    statsfile_fd = -1;
+}
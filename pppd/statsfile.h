@@ -0,0 +1,104 @@
+/*
+ * statsfile.h - layout of the file in which pppd publishes live
+ * link counters, for pppstats and other monitoring tools.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef PPP_STATSFILE_H
+#define PPP_STATSFILE_H
+
+#include <stdint.h>
+
+/*
+ * The file starts with a header, padded out to one slot, followed by
+ * one slot per ppp unit: unit n is at offset (n + 1) * slot_size.
+ * Each pppd maps just the slot for its own unit and keeps it up to
+ * date, so a reader can see all the links by mapping the file once.
+ */
+#define PPP_STATSFILE_NAME	"/pppd-stats"
+#define PPP_STATSFILE_MAGIC	0x50505053	/* "PPPS" */
+#define PPP_STATSFILE_VERSION	3
+#define PPP_STATSFILE_SLOTSIZE	256
+
+/*
+ * LCP echo round trip times are counted in buckets, those up to each
+ * of these bounds (in microseconds) and then the rest.
+ */
+#define PPP_STATSFILE_RTT_BOUNDS	{ 1000, 2000, 5000, 10000, 20000, \
+					  50000, 100000, 200000, 500000, \
+					  1000000, 2000000 }
+#define PPP_STATSFILE_RTT_BUCKETS	12
+
+struct ppp_statsfile_header {
+    uint32_t	magic;
+    uint32_t	version;
+    uint32_t	slot_size;
+};
+
+/*
+ * seq is odd while the owner is updating the slot.  A reader should
+ * copy the slot and try again if seq was odd or has changed since it
+ * started.  pid is 0 if no pppd is using the unit.
+ */
+struct ppp_statsfile_slot {
+    uint32_t	seq;
+    int32_t	pid;		/* pppd for this unit */
+    char	ifname[16];	/* its interface name */
+    int64_t	updated;	/* time(2) of the last update */
+    uint64_t	bytes_in;	/* counters for the interface */
+    uint64_t	bytes_out;
+    uint64_t	pkts_in;
+    uint64_t	pkts_out;
+    uint32_t	comp_unc_bytes;	/* CCP: bytes given to the compressor */
+    uint32_t	comp_bytes;	/* bytes it sent */
+    uint32_t	decomp_unc_bytes; /* bytes out of the decompressor */
+    uint32_t	decomp_bytes;	/* bytes it received */
+    uint32_t	echo_rtt_us;	/* last LCP echo round trip, 0 if none */
+    uint8_t	comp_method;	/* CCP option code each way, 0 if none */
+    uint8_t	decomp_method;
+    uint16_t	pad;
+    uint32_t	comp_pkts;	/* packets the compressor sent compressed */
+    uint32_t	comp_inc_pkts;	/* and sent as they were */
+    uint32_t	comp_inc_bytes;
+    uint32_t	decomp_inc_pkts; /* packets received uncompressed */
+    uint32_t	reset_req_sent;	/* CCP reset-requests we sent */
+    uint32_t	reset_req_rcvd;	/* and that the peer sent */
+    uint32_t	reset_ack_rcvd;	/* reset-acks to ours */
+    uint32_t	reset_timeouts;	/* reset-requests never acked */
+    uint32_t	reset_rtt_us;	/* mean reset-request to ack time */
+    uint32_t	reset_rtt_max_us;
+    uint32_t	connect_ms;	/* how long the last link took to come */
+    uint32_t	establish_ms;	/* up, in each phase, 0 until it has */
+    uint32_t	auth_ms;
+    uint32_t	network_ms;
+    uint32_t	echo_rtt_count;	/* LCP echo round trips timed */
+    uint32_t	pad2;
+    uint64_t	echo_rtt_sum_us;
+    uint32_t	echo_rtt_hist[PPP_STATSFILE_RTT_BUCKETS]; /* not cumulative */
+};
+
+#endif /* PPP_STATSFILE_H */
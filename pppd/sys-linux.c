@@ -100,6 +100,15 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <limits.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
 
 /* This is in netdevice.h. However, this compile will fail miserably if
    you attempt to include netdevice.h because it has so many references
@@ -161,6 +170,7 @@
 
 #include "pppd-private.h"
 #include "options.h"
+#include "pathnames.h"
 #include "fsm.h"
 #include "ipcp.h"
 
@@ -215,6 +225,7 @@ static int ppp_disc = N_PPP;	/* The PPP discpline */
 static int initfdflags = -1;	/* Initial file descriptor flags for fd */
 static int ppp_fd = -1;		/* fd which is set to PPP discipline */
 static int sock_fd = -1;	/* socket for doing interface ioctls */
+static int rtnl_fd = -1;	/* rtnetlink socket for interface config */
 static int slave_fd = -1;	/* pty for old-style demand mode, slave */
 static int master_fd = -1;	/* pty for old-style demand mode, master */
 #ifdef PPP_WITH_IPV6CP
@@ -230,8 +241,55 @@ int ppp_dev_fd = -1;		/* fd for /dev/ppp (new style driver) */
 
 static int chindex;		/* channel index (new style driver) */
 
+/*
+ * ppp units made ahead of time by a prefork-socket server, each with
+ * the /dev/ppp fd that keeps it in being; a session keeps one ready
+ * in spare_unit_fd until make_ppp_unit wants it.
+ */
+static int pool_fds[PREFORK_POOL_MAX];
+static int pool_units[PREFORK_POOL_MAX];
+static int pool_size;
+static int spare_unit_fd = -1;
+static int spare_unit;
+
+/*
+ * What we have found out about the running kernel that is costly or
+ * noisy to find out again: whether ppp interfaces can be made by
+ * rtnetlink, which way of getting 64-bit statistics works, and the
+ * first ethernet address, which takes a walk through every interface
+ * (thousands of them, on a busy access concentrator).  This is kept in PPP_PATH_KCAPS for the next pppd, along with the boot id
+ * and kernel release it was found for, so it is forgotten on reboot.
+ */
+#define KC_UNKNOWN	0
+#define KC_NEWLINK_YES	1
+#define KC_NEWLINK_NO	2
+#define KC_STATS_RTNL	1
+#define KC_STATS_SYSFS	2
+#define KC_STATS_IOCTL	3
+
+static struct {
+    int loaded;
+    int newlink;		/* KC_NEWLINK_*, or KC_UNKNOWN */
+    int stats;			/* KC_STATS_*, or KC_UNKNOWN */
+    int ether;			/* 1 found, -1 none, or KC_UNKNOWN */
+    u_char ether_addr[6];
+    char boot_id[40];
+} kcaps;
+
 static fd_set in_fds;		/* set of fds that wait_input waits for */
 static int max_in_fd;		/* highest fd set in in_fds */
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;	/* epoll instance used by wait_input */
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+static int timer_fd = -1;	/* timerfd for the next timeout */
+static int timer_armed;		/* timer_fd is set to go off at timer_when */
+static struct timeval timer_when;
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+static int signal_fd = -1;	/* signalfd for signals handled in main loop */
+static sigset_t signal_fd_mask;	/* signals blocked for signal_fd */
+#endif
 
 static int has_proxy_arp       = 0;
 static int driver_version      = 0;
@@ -286,6 +344,8 @@ static void decode_version (char *buf, int *version, int *mod, int *patch);
 static int set_kdebugflag(int level);
 static int ppp_registered(void);
 static int make_ppp_unit(void);
+static void kcaps_load(void);
+static void kcaps_save(void);
 static int setifstate (int u, int state);
 
 extern u_char	inpacket_buf[];	/* borrowed from main.c */
@@ -325,7 +385,7 @@ static int rtnetlink_msg(const char *desc, int *shared_fd, void *nlreq, size_t n
     if (shared_fd && *shared_fd >= 0) {
         fd = *shared_fd;
     } else {
-        fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+        fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
         if (fd < 0) {
             error("rtnetlink_msg: socket(NETLINK_ROUTE): %m (line %d)", __LINE__);
             return 1;
@@ -442,6 +502,29 @@ static int rtnetlink_msg(const char *desc, int *shared_fd, void *nlreq, size_t n
     return 0;
 }
 
+/*
+ * rtnl_msg - send an rtnetlink request on our persistent socket.
+ * Returns the same as rtnetlink_msg.  If anything other than the
+ * kernel rejecting the request goes wrong, the socket is closed, so
+ * that a stray reply can't be taken as the answer to a later request.
+ */
+static void rtnl_close(void)
+{
+    if (rtnl_fd >= 0)
+        close(rtnl_fd);
+    rtnl_fd = -1;
+}
+
+static int rtnl_msg(const char *desc, void *nlreq, size_t nlreq_len, void *nlresp_data, size_t *nlresp_size, unsigned nlresp_type)
+{
+    int resp;
+
+    resp = rtnetlink_msg(desc, &rtnl_fd, nlreq, nlreq_len, nlresp_data, nlresp_size, nlresp_type);
+    if (resp > 0)
+        rtnl_close();
+    return resp;
+}
+
 /*
  * Determine if the PPP connection should still be present.
  */
@@ -511,6 +594,30 @@ void sys_init(void)
 
     FD_ZERO(&in_fds);
     max_in_fd = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* Fall back to select() if the kernel can't give us an epoll fd. */
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+	warn("Couldn't create epoll instance, using select: %m");
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+    /*
+     * The timer fd runs off the monotonic clock, so we can only use it
+     * if ppp_get_time is giving us monotonic time as well.
+     */
+    {
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+	    timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+	    if (timer_fd >= 0)
+		add_fd(timer_fd);
+	}
+    }
+#endif
 }
 
 /********************************************************************
@@ -559,6 +666,8 @@ ppp_sys_close(void)
 	close(ppp_dev_fd);
     if (sock_fd >= 0)
 	close(sock_fd);
+    if (rtnl_fd >= 0)
+	close(rtnl_fd);
 #ifdef PPP_WITH_IPV6CP
     if (sock6_fd >= 0)
 	close(sock6_fd);
@@ -567,6 +676,21 @@ ppp_sys_close(void)
 	close(slave_fd);
     if (master_fd >= 0)
 	close(master_fd);
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd >= 0)
+	close(epoll_fd);
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+    if (timer_fd >= 0)
+	close(timer_fd);
+#endif
+#ifdef HAVE_SYS_SIGNALFD_H
+    /* Don't let the blocked signals leak into programs we exec. */
+    if (signal_fd >= 0) {
+	close(signal_fd);
+	sigprocmask(SIG_UNBLOCK, &signal_fd_mask, NULL);
+    }
+#endif
 }
 
 /********************************************************************
@@ -872,7 +996,7 @@ static int make_ppp_unit_rtnetlink(void)
      * possible deadlock in kernel and ask userspace to retry request again.
      */
     do {
-        resp = rtnetlink_msg("RTM_NEWLINK/NLM_F_CREATE", NULL, &nlreq, sizeof(nlreq), NULL, NULL, 0);
+        resp = rtnl_msg("RTM_NEWLINK/NLM_F_CREATE", &nlreq, sizeof(nlreq), NULL, NULL, 0);
     } while (resp == -EBUSY);
 
     if (resp) {
@@ -892,6 +1016,100 @@ static int make_ppp_unit_rtnetlink(void)
     return 1;
 }
 
+/*
+ * rename_ppp_unit - give ppp unit u the name req_ifname.  We try a
+ * single RTM_SETLINK first, which names the interface by its index,
+ * and fall back to SIOCSIFNAME for kernels without it.
+ */
+static int rename_ppp_unit(int u)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+        struct {
+            struct rtattr rta;
+            char ifname[IFNAMSIZ];
+        } ifn;
+    } nlreq;
+    struct ifreq ifr;
+    char t[IFNAMSIZ];
+    int x;
+
+    slprintf(t, sizeof(t), "%s%d", PPP_DRV_NAME, u);
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_SETLINK;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlreq.ifi.ifi_family = AF_UNSPEC;
+    nlreq.ifi.ifi_index = if_nametoindex(t);
+    nlreq.ifn.rta.rta_len = sizeof(nlreq.ifn);
+    nlreq.ifn.rta.rta_type = IFLA_IFNAME;
+    strlcpy(nlreq.ifn.ifname, req_ifname, sizeof(nlreq.ifn.ifname));
+
+    if (nlreq.ifi.ifi_index != 0
+        && rtnl_msg("RTM_SETLINK/IFLA_IFNAME", &nlreq, sizeof(nlreq), NULL, NULL, 0) == 0)
+        x = 0;
+    else {
+        memset(&ifr, 0, sizeof(struct ifreq));
+        strlcpy(ifr.ifr_name, t, IFNAMSIZ);
+        strlcpy(ifr.ifr_newname, req_ifname, IFNAMSIZ);
+        x = ioctl(sock_fd, SIOCSIFNAME, &ifr);
+    }
+    if (x < 0)
+        error("Couldn't rename interface %s to %s: %m", t, req_ifname);
+    else
+        info("Renamed interface %s to %s", t, req_ifname);
+    return x;
+}
+
+/*
+ * sys_prefork_pool - keep ppp units made for sessions of a prefork
+ * server, as described for NF_PREFORK_POOL in pppd.h.
+ */
+void sys_prefork_pool(int n)
+{
+	int fd, unit, flags;
+
+	if (!new_style_driver)
+		return;
+	if (n == 0) {
+		/* in the new session: keep the first, drop the others */
+		if (pool_size > 0) {
+			spare_unit_fd = pool_fds[0];
+			spare_unit = pool_units[0];
+		}
+		while (pool_size > 1)
+			close(pool_fds[--pool_size]);
+		pool_size = 0;
+	} else if (n < 0) {
+		/* the session just forked has the first */
+		if (pool_size > 0) {
+			close(pool_fds[0]);
+			--pool_size;
+			memmove(pool_fds, pool_fds + 1, pool_size * sizeof(int));
+			memmove(pool_units, pool_units + 1, pool_size * sizeof(int));
+		}
+	} else {
+		while (pool_size < n && pool_size < PREFORK_POOL_MAX) {
+			fd = open("/dev/ppp", O_RDWR);
+			if (fd < 0)
+				break;
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			flags = fcntl(fd, F_GETFL);
+			if (flags != -1)
+				fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+			unit = -1;
+			if (ioctl(fd, PPPIOCNEWUNIT, &unit) < 0) {
+				warn("Couldn't make a ppp unit for prefork-pool: %m");
+				close(fd);
+				break;
+			}
+			pool_fds[pool_size] = fd;
+			pool_units[pool_size++] = unit;
+		}
+	}
+}
+
 /*
  * make_ppp_unit - make a new ppp unit for ppp_dev_fd.
  * Assumes new_style_driver.
@@ -904,6 +1122,22 @@ static int make_ppp_unit(void)
 		dbglog("in make_ppp_unit, already had /dev/ppp open?");
 		close(ppp_dev_fd);
 	}
+	if (spare_unit_fd >= 0) {
+		/*
+		 * A unit made before we forked will do, unless a
+		 * different unit number was asked for; it can be
+		 * given the name asked for, if any.
+		 */
+		x = spare_unit_fd;
+		spare_unit_fd = -1;
+		if ((req_unit == -1 || req_unit == spare_unit)
+		    && (req_ifname[0] == '\0' || rename_ppp_unit(spare_unit) == 0)) {
+			ppp_dev_fd = x;
+			ifunit = spare_unit;
+			return 0;
+		}
+		close(x);
+	}
 	ppp_dev_fd = open("/dev/ppp", O_RDWR);
 	if (ppp_dev_fd < 0)
 		fatal("Couldn't open /dev/ppp: %m");
@@ -925,8 +1159,14 @@ static int make_ppp_unit(void)
 	 * So use rtnetlink API only when user requested custom ifname. It will
 	 * avoid system issues with interface renaming.
 	 */
-	if (req_unit == -1 && req_ifname[0] != '\0' && kernel_version >= KVERSION(2,1,16)) {
+	kcaps_load();
+	if (req_unit == -1 && req_ifname[0] != '\0' && kernel_version >= KVERSION(2,1,16)
+	    && kcaps.newlink != KC_NEWLINK_NO) {
 	    if (make_ppp_unit_rtnetlink()) {
+		if (kcaps.newlink != KC_NEWLINK_YES) {
+		    kcaps.newlink = KC_NEWLINK_YES;
+		    kcaps_save();
+		}
 		if (ioctl(ppp_dev_fd, PPPIOCGUNIT, &ifunit))
 		    fatal("Couldn't retrieve PPP unit id: %m");
 		return 0;
@@ -937,6 +1177,11 @@ static int make_ppp_unit(void)
 	     */
 	    if (errno == EEXIST)
 		return -1;
+	    /* the kernel is too old to do it, so don't ask next time */
+	    if (kernel_version < KVERSION(4,7,0)) {
+		kcaps.newlink = KC_NEWLINK_NO;
+		kcaps_save();
+	    }
 	}
 
 	ifunit = req_unit;
@@ -954,19 +1199,8 @@ static int make_ppp_unit(void)
 	if (x < 0)
 		error("Couldn't create new ppp unit: %m");
 
-	if (x == 0 && req_ifname[0] != '\0') {
-		struct ifreq ifr;
-		char t[IFNAMSIZ];
-		memset(&ifr, 0, sizeof(struct ifreq));
-		slprintf(t, sizeof(t), "%s%d", PPP_DRV_NAME, ifunit);
-		strlcpy(ifr.ifr_name, t, IFNAMSIZ);
-		strlcpy(ifr.ifr_newname, req_ifname, IFNAMSIZ);
-		x = ioctl(sock_fd, SIOCSIFNAME, &ifr);
-		if (x < 0)
-		    error("Couldn't rename interface %s to %s: %m", t, req_ifname);
-		else
-		    info("Renamed interface %s to %s", t, req_ifname);
-	}
+	if (x == 0 && req_ifname[0] != '\0')
+		x = rename_ppp_unit(ifunit);
 
 	return x;
 }
@@ -1410,11 +1644,25 @@ void restore_tty (int tty_fd)
 
 void output (int unit, unsigned char *p, int len)
 {
-    int fd = ppp_fd;
-    int proto;
-
+    if (len >= PPP_HDRLEN)
+	PPP_PROBE2(pppd, output, PPP_PROTOCOL(p), len - PPP_HDRLEN);
     dump_packet("sent", p, len);
     if (snoop_send_hook) snoop_send_hook(p, len);
+    snoop_packet(p, len, 0);
+    output_frame(unit, p, len);
+}
+
+/********************************************************************
+ *
+ * output_frame - send a PPP packet without showing it to the packet
+ * dump or the snoopers; demand_rexmit sends the data packets it kept
+ * this way, so each one costs just the write.
+ */
+
+void output_frame (int unit, unsigned char *p, int len)
+{
+    int fd = ppp_fd;
+    int proto;
 
     if (len < PPP_HDRLEN)
 	return;
@@ -1446,6 +1694,22 @@ void wait_input(struct timeval *timo)
     fd_set ready, exc;
     int n;
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd >= 0) {
+	struct epoll_event events[16];
+	int ms = -1;
+
+	/* Round up so that we don't wake just before a timeout is due. */
+	if (timo != NULL)
+	    ms = timo->tv_sec * 1000 + (timo->tv_usec + 999) / 1000;
+	n = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]),
+		       ms);
+	if (n < 0 && errno != EINTR)
+	    fatal("epoll_wait: %m");
+	return;
+    }
+#endif
+
     ready = in_fds;
     exc = in_fds;
     n = select(max_in_fd + 1, &ready, NULL, &exc, timo);
@@ -1453,11 +1717,124 @@ void wait_input(struct timeval *timo)
 	fatal("select: %m");
 }
 
+/*
+ * set_wakeup_time - arm the timer fd so that wait_input returns at
+ * the given (ppp_get_time) time, or disarm it if when is NULL.
+ * Returns 1 if the timer was set, in which case wait_input can be
+ * called with no timeout; returns 0 if the caller has to pass one.
+ * The timer is only reprogrammed when the time changes, and
+ * reprogramming it also clears any expiry that hasn't been read.
+ */
+int
+set_wakeup_time(struct timeval *when)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    struct itimerspec its;
+
+    if (timer_fd < 0)
+	return 0;
+    if (when == NULL) {
+	if (!timer_armed)
+	    return 1;
+    } else if (timer_armed && timer_when.tv_sec == when->tv_sec
+	       && timer_when.tv_usec == when->tv_usec)
+	return 1;
+
+    memset(&its, 0, sizeof(its));
+    if (when != NULL) {
+	its.it_value.tv_sec = when->tv_sec;
+	its.it_value.tv_nsec = when->tv_usec * 1000;
+	/* a zero it_value would disarm the timer */
+	if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+	    its.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+	error("Couldn't set timer, reverting to timeouts: %m");
+	remove_fd(timer_fd);
+	close(timer_fd);
+	timer_fd = -1;
+	return 0;
+    }
+    timer_armed = when != NULL;
+    if (when != NULL)
+	timer_when = *when;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * open_signal_fd - block the signals in *mask and arrange for them to
+ * be read from a file descriptor instead of being delivered to their
+ * handlers.  Returns the fd, or -1 (leaving the signals unblocked)
+ * if that isn't possible.
+ */
+int
+open_signal_fd(sigset_t *mask)
+{
+#ifdef HAVE_SYS_SIGNALFD_H
+    if (sigprocmask(SIG_BLOCK, mask, NULL) < 0)
+	return -1;
+    signal_fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0) {
+	sigprocmask(SIG_UNBLOCK, mask, NULL);
+	return -1;
+    }
+    signal_fd_mask = *mask;
+    return signal_fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * read_signal_fd - return the number of the next signal queued on the
+ * fd from open_signal_fd, or 0 if there are none.
+ */
+int
+read_signal_fd(void)
+{
+#ifdef HAVE_SYS_SIGNALFD_H
+    struct signalfd_siginfo si;
+
+    if (signal_fd < 0)
+	return 0;
+    while (read(signal_fd, &si, sizeof(si)) != sizeof(si)) {
+	if (errno != EINTR)
+	    return 0;
+    }
+    return si.ssi_signo;
+#else
+    return 0;
+#endif
+}
+
 /*
  * add_fd - add an fd to the set that wait_input waits for.
+ * Adding an fd which is already in the set has no effect.
  */
 void add_fd(int fd)
 {
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd >= 0) {
+	struct epoll_event ev;
+
+	/*
+	 * Level-triggered, since the main loop only reads one packet
+	 * from each fd per wakeup and relies on being woken again
+	 * while there is more data waiting.
+	 */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLPRI;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0
+	    && errno != EEXIST)
+	    fatal("epoll_ctl(ADD, %d): %m", fd);
+	return;
+    }
+#endif
     if (fd >= FD_SETSIZE)
 	fatal("internal error: file descriptor too large (%d)", fd);
     FD_SET(fd, &in_fds);
@@ -1470,7 +1847,17 @@ void add_fd(int fd)
  */
 void remove_fd(int fd)
 {
-    FD_CLR(fd, &in_fds);
+#ifdef HAVE_SYS_EPOLL_H
+    if (epoll_fd >= 0) {
+	/* The kernel drops closed fds from the set by itself. */
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0
+	    && errno != ENOENT && errno != EBADF)
+	    error("epoll_ctl(DEL, %d): %m", fd);
+	return;
+    }
+#endif
+    if (fd < FD_SETSIZE)
+	FD_CLR(fd, &in_fds);
 }
 
 
@@ -1548,6 +1935,36 @@ get_loop_output(void)
     return rv;
 }
 
+/*
+ * set_mtu_rtnetlink - set the MTU on the PPP network interface via rtnetlink.
+ */
+static int
+set_mtu_rtnetlink(int mtu)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+        struct {
+            struct rtattr rta;
+            unsigned int mtu;
+        } mtu;
+    } nlreq;
+
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_NEWLINK;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlreq.ifi.ifi_family = AF_UNSPEC;
+    nlreq.ifi.ifi_index = if_nametoindex(ifname);
+    nlreq.mtu.rta.rta_len = sizeof(nlreq.mtu);
+    nlreq.mtu.rta.rta_type = IFLA_MTU;
+    nlreq.mtu.mtu = mtu;
+
+    if (nlreq.ifi.ifi_index == 0)
+        return 0;
+    return rtnl_msg("RTM_NEWLINK/IFLA_MTU", &nlreq, sizeof(nlreq), NULL, NULL, 0) == 0;
+}
+
 /*
  * netif_set_mtu - set the MTU on the PPP network interface.
  */
@@ -1556,11 +1973,14 @@ ppp_set_mtu(int unit, int mtu)
 {
     struct ifreq ifr;
 
+    if (ifunit < 0 || set_mtu_rtnetlink(mtu))
+	return;
+
     memset (&ifr, '\0', sizeof (ifr));
     strlcpy(ifr.ifr_name, ifname, sizeof (ifr.ifr_name));
     ifr.ifr_mtu = mtu;
 
-    if (ifunit >= 0 && ioctl(sock_fd, SIOCSIFMTU, (caddr_t) &ifr) < 0)
+    if (ioctl(sock_fd, SIOCSIFMTU, (caddr_t) &ifr) < 0)
 	error("ioctl(SIOCSIFMTU): %m (line %d)", __LINE__);
 }
 
@@ -1776,8 +2196,6 @@ get_ppp_stats_ioctl(int u, struct pppd_stats *stats)
 static int
 get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
 {
-    static int fd = -1;
-
     struct {
         struct nlmsghdr nlh;
         struct if_stats_msg ifsm;
@@ -1803,7 +2221,7 @@ get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
     nlreq.ifsm.filter_mask = IFLA_STATS_LINK_64;
 
     nlresp_size = sizeof(nlresp_data);
-    resp = rtnetlink_msg("RTM_GETSTATS/NLM_F_REQUEST", &fd, &nlreq, sizeof(nlreq), &nlresp_data, &nlresp_size, RTM_NEWSTATS);
+    resp = rtnl_msg("RTM_GETSTATS/NLM_F_REQUEST", &nlreq, sizeof(nlreq), &nlresp_data, &nlresp_size, RTM_NEWSTATS);
     if (resp) {
         errno = (resp < 0) ? -resp : EINVAL;
         if (kernel_version >= KVERSION(4,7,0))
@@ -1823,8 +2241,7 @@ get_ppp_stats_rtnetlink(int u, struct pppd_stats *stats)
 
     return 1;
 err:
-    close(fd);
-    fd = -1;
+    rtnl_close();
     return 0;
 }
 
@@ -1904,6 +2321,26 @@ get_ppp_stats_sysfs(int u, struct pppd_stats *stats)
     return 1;
 }
 
+/********************************************************************
+ *
+ * get_ppp_comp_stats - return compression statistics for the link.
+ */
+int
+get_ppp_comp_stats(int u, struct ppp_comp_stats *cstats)
+{
+    struct ifreq req;
+
+    memset (&req, 0, sizeof (req));
+    req.ifr_data = (caddr_t) cstats;
+    strlcpy(req.ifr_name, ifname, sizeof(req.ifr_name));
+    if (ioctl(sock_fd, SIOCGPPPCSTATS, &req) < 0) {
+	if (! ok_error (errno))
+	    error("Couldn't get PPP compression statistics: %m");
+	return 0;
+    }
+    return 1;
+}
+
 /********************************************************************
  * Periodic timer function to be used to keep stats up to date in case of ioctl
  * polling.
@@ -1926,16 +2363,29 @@ ppp_stats_poller(void* u)
 int get_ppp_stats(int u, struct pppd_stats *stats)
 {
     static int (*func)(int, struct pppd_stats*) = NULL;
+    int source;
 
     if (!func) {
-	if (get_ppp_stats_rtnetlink(u, stats)) {
+	kcaps_load();
+	source = kcaps.stats;
+	if (source == KC_STATS_RTNL && get_ppp_stats_rtnetlink(u, stats))
 	    func = get_ppp_stats_rtnetlink;
-	    return 1;
-	}
-	if (get_ppp_stats_sysfs(u, stats)) {
+	else if (source == KC_STATS_SYSFS && get_ppp_stats_sysfs(u, stats))
 	    func = get_ppp_stats_sysfs;
-	    return 1;
+	else if (source != KC_STATS_IOCTL) {
+	    if (get_ppp_stats_rtnetlink(u, stats)) {
+		func = get_ppp_stats_rtnetlink;
+		kcaps.stats = KC_STATS_RTNL;
+	    } else if (get_ppp_stats_sysfs(u, stats)) {
+		func = get_ppp_stats_sysfs;
+		kcaps.stats = KC_STATS_SYSFS;
+	    } else
+		kcaps.stats = KC_STATS_IOCTL;
+	    if (kcaps.stats != source)
+		kcaps_save();
 	}
+	if (func)
+	    return 1;
 	warn("statistics falling back to ioctl which only supports 32-bit counters");
 	func = get_ppp_stats_ioctl;
 	TIMEOUT(ppp_stats_poller, (void*)(long)u, 25);
@@ -1999,14 +2449,16 @@ static char *path_to_procfs(const char *tail)
 }
 
 /*
- * /proc/net/route parsing stuff.
+ * Route table reading stuff.  The main routing table is read with an
+ * rtnetlink dump on a socket of its own, so that a caller can stop
+ * reading part way through by closing it.
  */
-#define ROUTE_MAX_COLS	12
-FILE *route_fd = (FILE *) 0;
-static char route_buffer[512];
-static int route_dev_col, route_dest_col, route_gw_col;
-static int route_flags_col, route_metric_col, route_mask_col;
-static int route_num_cols;
+static char route_buffer[32768];
+static int route_nl_fd = -1;	/* socket the dump is read from */
+static int route_nl_family;	/* address family being dumped */
+static size_t route_nl_len;	/* bytes of route_buffer holding messages */
+static struct nlmsghdr *route_nl_msg;	/* next message to look at */
+static char route_dev[IF_NAMESIZE];	/* interface of the current entry */
 
 static int open_route_table (void);
 static void close_route_table (void);
@@ -2019,68 +2471,165 @@ static int read_route_table (struct rtentry *rt);
 
 static void close_route_table (void)
 {
-    if (route_fd != (FILE *) 0) {
-	fclose (route_fd);
-	route_fd = (FILE *) 0;
+    if (route_nl_fd >= 0) {
+	close(route_nl_fd);
+	route_nl_fd = -1;
     }
 }
 
 /********************************************************************
  *
- * open_route_table - open the interface to the route table
+ * open_route_dump - start an rtnetlink dump of the main routing
+ * table for the given address family.
  */
-static char route_delims[] = " \t\n";
 
-static int open_route_table (void)
+static int open_route_dump (int family)
 {
-    char *path;
+    struct {
+	struct nlmsghdr nlh;
+	struct rtmsg rtm;
+    } nlreq;
+    struct sockaddr_nl nladdr;
 
     close_route_table();
 
-    path = path_to_procfs("/net/route");
-    route_fd = fopen (path, "r");
-    if (route_fd == NULL) {
-	error("can't open routing table %s: %m", path);
+    route_nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (route_nl_fd < 0) {
+	error("can't read routing table: socket(NETLINK_ROUTE): %m");
 	return 0;
     }
 
-    route_dev_col = 0;		/* default to usual columns */
-    route_dest_col = 1;
-    route_gw_col = 2;
-    route_flags_col = 3;
-    route_metric_col = 6;
-    route_mask_col = 7;
-    route_num_cols = 8;
-
-    /* parse header line */
-    if (fgets(route_buffer, sizeof(route_buffer), route_fd) != 0) {
-	char *p = route_buffer, *q;
-	int col;
-	for (col = 0; col < ROUTE_MAX_COLS; ++col) {
-	    int used = 1;
-	    if ((q = strtok(p, route_delims)) == 0)
-		break;
-	    if (strcasecmp(q, "iface") == 0)
-		route_dev_col = col;
-	    else if (strcasecmp(q, "destination") == 0)
-		route_dest_col = col;
-	    else if (strcasecmp(q, "gateway") == 0)
-		route_gw_col = col;
-	    else if (strcasecmp(q, "flags") == 0)
-		route_flags_col = col;
-	    else if (strcasecmp(q, "mask") == 0)
-		route_mask_col = col;
-	    else
-		used = 0;
-	    if (used && col >= route_num_cols)
-		route_num_cols = col + 1;
-	    p = NULL;
-	}
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_GETROUTE;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    nlreq.rtm.rtm_family = family;
+    nlreq.rtm.rtm_table = RT_TABLE_MAIN;
+
+    memset(&nladdr, 0, sizeof(nladdr));
+    nladdr.nl_family = AF_NETLINK;
+    if (sendto(route_nl_fd, &nlreq, sizeof(nlreq), 0,
+	       (struct sockaddr *) &nladdr, sizeof(nladdr)) < 0) {
+	error("can't read routing table: sendto(RTM_GETROUTE): %m");
+	close_route_table();
+	return 0;
     }
 
+    route_nl_family = family;
+    route_nl_len = 0;
+    route_nl_msg = NULL;
     return 1;
 }
 
+static int open_route_table (void)
+{
+    return open_route_dump(AF_INET);
+}
+
+/********************************************************************
+ *
+ * next_route_msg - return the next route in the main table from the
+ * dump, or NULL at the end.  *attrs gets its attributes, indexed by
+ * type, and NULL for those it doesn't have.
+ */
+
+static struct rtmsg *next_route_msg (struct rtattr **attrs)
+{
+    struct nlmsghdr *nlh;
+    struct rtmsg *rtm;
+    struct rtattr *rta;
+    ssize_t len;
+    int rtlen;
+    unsigned table;
+
+    if (route_nl_fd < 0)
+	return NULL;
+
+    for (;;) {
+	nlh = route_nl_msg;
+	if (nlh == NULL
+	    || !NLMSG_OK(nlh, (int) (route_buffer + route_nl_len - (char *) nlh))) {
+	    len = recv(route_nl_fd, route_buffer, sizeof(route_buffer), 0);
+	    if (len < 0 && errno == EINTR)
+		continue;
+	    if (len <= 0) {
+		if (len < 0)
+		    error("can't read routing table: recv: %m");
+		close_route_table();
+		return NULL;
+	    }
+	    route_nl_len = len;
+	    nlh = (struct nlmsghdr *) route_buffer;
+	    if (!NLMSG_OK(nlh, len)) {
+		route_nl_msg = NULL;
+		continue;
+	    }
+	}
+	route_nl_msg = (struct nlmsghdr *) ((char *) nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+	if (nlh->nlmsg_type == NLMSG_DONE || nlh->nlmsg_type == NLMSG_ERROR) {
+	    close_route_table();
+	    return NULL;
+	}
+	if (nlh->nlmsg_type != RTM_NEWROUTE
+	    || nlh->nlmsg_len < NLMSG_LENGTH(sizeof(struct rtmsg)))
+	    continue;
+
+	rtm = NLMSG_DATA(nlh);
+	if (rtm->rtm_family != route_nl_family)
+	    continue;
+
+	memset(attrs, 0, (RTA_MAX + 1) * sizeof(*attrs));
+	rtlen = RTM_PAYLOAD(nlh);
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, rtlen); rta = RTA_NEXT(rta, rtlen))
+	    if (rta->rta_type <= RTA_MAX)
+		attrs[rta->rta_type] = rta;
+
+	table = rtm->rtm_table;
+	if (attrs[RTA_TABLE] != NULL
+	    && RTA_PAYLOAD(attrs[RTA_TABLE]) >= sizeof(u_int32_t))
+	    table = *(u_int32_t *) RTA_DATA(attrs[RTA_TABLE]);
+	if (table != RT_TABLE_MAIN)
+	    continue;
+
+	return rtm;
+    }
+}
+
+/*
+ * route_attr_u32 - value of a 32-bit route attribute, or 0 if absent.
+ */
+static u_int32_t route_attr_u32 (struct rtattr *rta)
+{
+    if (rta == NULL || RTA_PAYLOAD(rta) < sizeof(u_int32_t))
+	return 0;
+    return *(u_int32_t *) RTA_DATA(rta);
+}
+
+/*
+ * route_rejects - does this route drop what is sent along it?
+ * Unreachable, prohibit and blackhole routes all get RTF_REJECT, for
+ * IPv4 and IPv6 alike.
+ */
+static int route_rejects (struct rtmsg *rtm)
+{
+    return rtm->rtm_type == RTN_UNREACHABLE || rtm->rtm_type == RTN_PROHIBIT
+	|| rtm->rtm_type == RTN_BLACKHOLE;
+}
+
+/*
+ * route_attr_dev - name of the interface for a route, or "*" if
+ * it doesn't go through a single interface.
+ */
+static char *route_attr_dev (struct rtattr *rta)
+{
+    unsigned int ifindex = route_attr_u32(rta);
+
+    if (ifindex == 0 || if_indextoname(ifindex, route_dev) == NULL)
+	strlcpy(route_dev, "*", sizeof(route_dev));
+    return route_dev;
+}
+
 /********************************************************************
  *
  * read_route_table - read the next entry from the route table
@@ -2088,32 +2637,32 @@ static int open_route_table (void)
 
 static int read_route_table(struct rtentry *rt)
 {
-    char *cols[ROUTE_MAX_COLS], *p;
-    int col;
+    struct rtattr *attrs[RTA_MAX + 1];
+    struct rtmsg *rtm;
 
     memset (rt, '\0', sizeof (struct rtentry));
 
-    if (fgets (route_buffer, sizeof (route_buffer), route_fd) == (char *) 0)
+    if ((rtm = next_route_msg(attrs)) == NULL)
 	return 0;
 
-    p = route_buffer;
-    for (col = 0; col < route_num_cols; ++col) {
-	cols[col] = strtok(p, route_delims);
-	if (cols[col] == NULL)
-	    return 0;		/* didn't get enough columns */
-	p = NULL;
-    }
-
     SET_SA_FAMILY (rt->rt_dst,     AF_INET);
     SET_SA_FAMILY (rt->rt_gateway, AF_INET);
 
-    SIN_ADDR(rt->rt_dst) = strtoul(cols[route_dest_col], NULL, 16);
-    SIN_ADDR(rt->rt_gateway) = strtoul(cols[route_gw_col], NULL, 16);
-    SIN_ADDR(rt->rt_genmask) = strtoul(cols[route_mask_col], NULL, 16);
-
-    rt->rt_flags = (short) strtoul(cols[route_flags_col], NULL, 16);
-    rt->rt_metric = (short) strtoul(cols[route_metric_col], NULL, 10);
-    rt->rt_dev   = cols[route_dev_col];
+    SIN_ADDR(rt->rt_dst) = route_attr_u32(attrs[RTA_DST]);
+    SIN_ADDR(rt->rt_gateway) = route_attr_u32(attrs[RTA_GATEWAY]);
+    SIN_ADDR(rt->rt_genmask) = rtm->rtm_dst_len == 0? 0:
+	htonl(~0U << (32 - rtm->rtm_dst_len));
+
+    /* the flags that /proc/net/route would show */
+    rt->rt_flags = RTF_UP;
+    if (attrs[RTA_GATEWAY] != NULL)
+	rt->rt_flags |= RTF_GATEWAY;
+    if (rtm->rtm_dst_len == 32)
+	rt->rt_flags |= RTF_HOST;
+    if (route_rejects(rtm))
+	rt->rt_flags |= RTF_REJECT;
+    rt->rt_metric = (short) route_attr_u32(attrs[RTA_PRIORITY]);
+    rt->rt_dev   = route_attr_dev(attrs[RTA_OIF]);
 
     return 1;
 }
@@ -2155,11 +2704,83 @@ static int defaultroute_exists (struct rtentry *rt, int metric)
  * For demand mode to work properly, we have to ignore routes
  * through our own interface.
  */
+/*
+ * route_lookup - ask the kernel which route it would use to reach
+ * `addr'.  Returns 1 if that is a route in the main table that
+ * doesn't go through our interface, 0 if the kernel has no route at
+ * all, or -1 if the answer doesn't settle what have_route_to needs
+ * to know.
+ */
+static int route_lookup(u_int32_t addr)
+{
+    struct {
+	struct nlmsghdr nlh;
+	struct rtmsg rtm;
+	struct {
+	    struct rtattr rta;
+	    u_int32_t addr;
+	} dst;
+    } nlreq;
+    union {
+	struct rtmsg rtm;
+	char buf[1024];
+    } nlresp_data;
+    size_t nlresp_size;
+    struct rtattr *rta;
+    int resp, rtlen;
+    unsigned table, oif;
+
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_GETROUTE;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST;
+    nlreq.rtm.rtm_family = AF_INET;
+    nlreq.rtm.rtm_dst_len = 32;
+    nlreq.dst.rta.rta_len = sizeof(nlreq.dst);
+    nlreq.dst.rta.rta_type = RTA_DST;
+    nlreq.dst.addr = addr;
+
+    nlresp_size = sizeof(nlresp_data);
+    resp = rtnl_msg("RTM_GETROUTE", &nlreq, sizeof(nlreq), &nlresp_data, &nlresp_size, RTM_NEWROUTE);
+    if (resp == -ENETUNREACH)
+	return 0;
+    if (resp != 0 || nlresp_size < sizeof(struct rtmsg))
+	return -1;
+    if (nlresp_data.rtm.rtm_type != RTN_UNICAST)
+	return -1;
+
+    table = nlresp_data.rtm.rtm_table;
+    oif = 0;
+    rtlen = nlresp_size - NLMSG_ALIGN(sizeof(struct rtmsg));
+    for (rta = RTM_RTA(&nlresp_data.rtm); RTA_OK(rta, rtlen);
+	 rta = RTA_NEXT(rta, rtlen)) {
+	if (rta->rta_type == RTA_TABLE)
+	    table = route_attr_u32(rta);
+	else if (rta->rta_type == RTA_OIF)
+	    oif = route_attr_u32(rta);
+    }
+    if (table != RT_TABLE_MAIN || oif == 0 || oif == if_nametoindex(ifname))
+	return -1;
+    return 1;
+}
+
 int have_route_to(u_int32_t addr)
 {
     struct rtentry rt;
     int result = 0;
 
+    /*
+     * A lookup costs the same however big the table is, so try that
+     * first.  It only tells us about the best route, though, so if
+     * that goes through our own interface (as in demand mode) or
+     * isn't in the main table, look through the whole table after
+     * all.  Address 0 means any default route, which a lookup can't
+     * answer.
+     */
+    if (addr != 0 && (result = route_lookup(addr)) >= 0)
+	return result;
+    result = 0;
+
     if (!open_route_table())
 	return -1;		/* don't know */
 
@@ -2304,10 +2925,6 @@ int cifdefaultroute (int unit, u_int32_t ouraddr, u_int32_t gateway)
 }
 
 #ifdef PPP_WITH_IPV6CP
-/*
- * /proc/net/ipv6_route parsing stuff.
- */
-static int route_dest_plen_col;
 static int open_route6_table (void);
 static int read_route6_table (struct in6_rtmsg *rt);
 
@@ -2317,27 +2934,7 @@ static int read_route6_table (struct in6_rtmsg *rt);
  */
 static int open_route6_table (void)
 {
-    char *path;
-
-    close_route_table();
-
-    path = path_to_procfs("/net/ipv6_route");
-    route_fd = fopen (path, "r");
-    if (route_fd == NULL) {
-	error("can't open routing table %s: %m", path);
-	return 0;
-    }
-
-    /* default to usual columns */
-    route_dest_col = 0;
-    route_dest_plen_col = 1;
-    route_gw_col = 4;
-    route_metric_col = 5;
-    route_flags_col = 8;
-    route_dev_col = 9;
-    route_num_cols = 10;
-
-    return 1;
+    return open_route_dump(AF_INET6);
 }
 
 /********************************************************************
@@ -2345,45 +2942,31 @@ static int open_route6_table (void)
  * read_route6_table - read the next entry from the route table
  */
 
-static void hex_to_in6_addr(struct in6_addr *addr, const char *s)
-{
-    char hex8[9];
-    unsigned i;
-    uint32_t v;
-
-    hex8[8] = 0;
-    for (i = 0; i < 4; i++) {
-	memcpy(hex8, s + 8*i, 8);
-	v = strtoul(hex8, NULL, 16);
-	addr->s6_addr32[i] = v;
-    }
-}
-
 static int read_route6_table(struct in6_rtmsg *rt)
 {
-    char *cols[ROUTE_MAX_COLS], *p;
-    int col;
+    struct rtattr *attrs[RTA_MAX + 1];
+    struct rtmsg *rtm;
 
     memset (rt, '\0', sizeof (struct in6_rtmsg));
 
-    if (fgets (route_buffer, sizeof (route_buffer), route_fd) == (char *) 0)
+    if ((rtm = next_route_msg(attrs)) == NULL)
 	return 0;
 
-    p = route_buffer;
-    for (col = 0; col < route_num_cols; ++col) {
-	cols[col] = strtok(p, route_delims);
-	if (cols[col] == NULL)
-	    return 0;		/* didn't get enough columns */
-	p = NULL;
+    if (attrs[RTA_DST] != NULL
+	&& RTA_PAYLOAD(attrs[RTA_DST]) >= sizeof(struct in6_addr))
+	memcpy(&rt->rtmsg_dst, RTA_DATA(attrs[RTA_DST]), sizeof(struct in6_addr));
+    rt->rtmsg_dst_len = rtm->rtm_dst_len;
+    if (attrs[RTA_GATEWAY] != NULL
+	&& RTA_PAYLOAD(attrs[RTA_GATEWAY]) >= sizeof(struct in6_addr)) {
+	memcpy(&rt->rtmsg_gateway, RTA_DATA(attrs[RTA_GATEWAY]), sizeof(struct in6_addr));
+	rt->rtmsg_flags |= RTF_GATEWAY;
     }
 
-    hex_to_in6_addr(&rt->rtmsg_dst, cols[route_dest_col]);
-    rt->rtmsg_dst_len = strtoul(cols[route_dest_plen_col], NULL, 16);
-    hex_to_in6_addr(&rt->rtmsg_gateway, cols[route_gw_col]);
-
-    rt->rtmsg_metric = strtoul(cols[route_metric_col], NULL, 16);
-    rt->rtmsg_flags = strtoul(cols[route_flags_col], NULL, 16);
-    rt->rtmsg_ifindex = if_nametoindex(cols[route_dev_col]);
+    rt->rtmsg_metric = route_attr_u32(attrs[RTA_PRIORITY]);
+    rt->rtmsg_flags |= RTF_UP;
+    if (route_rejects(rtm))
+	rt->rtmsg_flags |= RTF_REJECT;
+    rt->rtmsg_ifindex = route_attr_u32(attrs[RTA_OIF]);
 
     return 1;
 }
@@ -2689,7 +3272,8 @@ get_if_hwaddr(u_char *addr, char *name)
 
 /*
  * get_first_ether_hwaddr - get the hardware address for the first
- * ethernet-style interface on this system.
+ * ethernet-style interface on this system.  What an earlier pppd
+ * found since the last boot will do, if there was one.
  */
 int
 get_first_ether_hwaddr(u_char *addr)
@@ -2698,6 +3282,12 @@ get_first_ether_hwaddr(u_char *addr)
 	struct ifreq ifreq;
 	int ret, sock_fd;
 
+	kcaps_load();
+	if (kcaps.ether != KC_UNKNOWN) {
+		memcpy(addr, kcaps.ether_addr, 6);
+		return kcaps.ether > 0? 0: -1;
+	}
+
 	sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock_fd < 0)
 		return -1;
@@ -2724,6 +3314,10 @@ get_first_ether_hwaddr(u_char *addr)
 	if_freenameindex(if_ni);
 	close(sock_fd);
 
+	kcaps.ether = ret >= 0? 1: -1;
+	if (ret >= 0)
+		memcpy(kcaps.ether_addr, addr, 6);
+	kcaps_save();
 	return ret;
 }
 
@@ -2820,6 +3414,90 @@ static void decode_version (char *buf, int *version,
     }
 }
 
+/********************************************************************
+ *
+ * kcaps_load - read what an earlier pppd found out about this kernel,
+ * if it was since the last boot and with the same kernel release.
+ */
+static void
+kcaps_load(void)
+{
+    FILE *f;
+    char id[40], release[sizeof(utsname.release)], ether[16];
+    int newlink, stats, i;
+    unsigned int a[6];
+
+    if (kcaps.loaded)
+	return;
+    kcaps.loaded = 1;
+    f = fopen("/proc/sys/kernel/random/boot_id", "r");
+    if (f == NULL)
+	return;
+    if (fscanf(f, "%39s", kcaps.boot_id) != 1)
+	kcaps.boot_id[0] = 0;
+    fclose(f);
+    if (kcaps.boot_id[0] == 0)
+	return;
+
+    f = fopen(PPP_PATH_KCAPS, "r");
+    if (f == NULL)
+	return;
+    if (fscanf(f, "%39s %64s %d %d %15s", id, release, &newlink, &stats,
+	       ether) == 5
+	&& strcmp(id, kcaps.boot_id) == 0
+	&& strcmp(release, utsname.release) == 0
+	&& newlink >= KC_UNKNOWN && newlink <= KC_NEWLINK_NO
+	&& stats >= KC_UNKNOWN && stats <= KC_STATS_IOCTL) {
+	kcaps.newlink = newlink;
+	kcaps.stats = stats;
+	if (strcmp(ether, "-") == 0)
+	    kcaps.ether = -1;
+	else if (sscanf(ether, "%2x%2x%2x%2x%2x%2x", &a[0], &a[1], &a[2],
+			&a[3], &a[4], &a[5]) == 6) {
+	    for (i = 0; i < 6; ++i)
+		kcaps.ether_addr[i] = a[i];
+	    kcaps.ether = 1;
+	}
+    }
+    fclose(f);
+}
+
+/********************************************************************
+ *
+ * kcaps_save - write what we know about this kernel for the next pppd.
+ * We go by way of a temporary file so that nobody reads half of it.
+ */
+static void
+kcaps_save(void)
+{
+    FILE *f;
+    char tmp[MAXPATHLEN], ether[16];
+    u_char *a = kcaps.ether_addr;
+    int fd;
+
+    if (kcaps.boot_id[0] == 0)
+	return;
+    slprintf(tmp, sizeof(tmp), "%s.%d", PPP_PATH_KCAPS, getpid());
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0644);
+    if (fd < 0)
+	return;
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+	close(fd);
+	unlink(tmp);
+	return;
+    }
+    if (kcaps.ether > 0)
+	slprintf(ether, sizeof(ether), "%.2x%.2x%.2x%.2x%.2x%.2x",
+		 a[0], a[1], a[2], a[3], a[4], a[5]);
+    else
+	strlcpy(ether, kcaps.ether < 0? "-": "?", sizeof(ether));
+    fprintf(f, "%s %s %d %d %s\n", kcaps.boot_id, utsname.release,
+	    kcaps.newlink, kcaps.stats, ether);
+    if (fclose(f) != 0 || rename(tmp, PPP_PATH_KCAPS) < 0)
+	unlink(tmp);
+}
+
 /********************************************************************
  *
  * Procedure to determine if the PPP line discipline is registered.
@@ -3076,11 +3754,14 @@ void logwtmp (const char *line, const char *name, const char *host)
  * sifvjcomp - config tcp header compression
  */
 
-int sifvjcomp (int u, int vjcomp, int cidcomp, int maxcid)
+int sifvjcomp (int u, int vjcomp, int cidcomp, int maxcid, int rmaxcid)
 {
 	u_int x;
 
 	if (vjcomp) {
+		/* the receive slots go in the top half, if not the default */
+		if (rmaxcid != MAX_STATES - 1)
+			maxcid |= rmaxcid << 16;
 		if (ioctl(ppp_dev_fd, PPPIOCSMAXCID, (caddr_t) &maxcid) < 0) {
 			error("Couldn't set up TCP header compression: %m");
 			vjcomp = 0;
@@ -3165,10 +3846,35 @@ int sif6down (int u)
  * setifstate - Config the interface up or down
  */
 
+static int setifstate_rtnetlink (int state)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifinfomsg ifi;
+    } nlreq;
+
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_NEWLINK;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    nlreq.ifi.ifi_family = AF_UNSPEC;
+    nlreq.ifi.ifi_index = if_nametoindex(ifname);
+    nlreq.ifi.ifi_flags = state? IFF_UP: 0;
+    nlreq.ifi.ifi_change = IFF_UP;
+
+    if (nlreq.ifi.ifi_index == 0)
+        return 0;
+    return rtnl_msg("RTM_NEWLINK/IFF_UP", &nlreq, sizeof(nlreq), NULL, NULL, 0) == 0;
+}
+
 static int setifstate (int u, int state)
 {
     struct ifreq ifr;
 
+    /* the ppp driver always sets IFF_POINTOPOINT itself */
+    if (setifstate_rtnetlink(state))
+	return 1;
+
     memset (&ifr, '\0', sizeof (ifr));
     strlcpy(ifr.ifr_name, ifname, sizeof (ifr.ifr_name));
     if (ioctl(sock_fd, SIOCGIFFLAGS, (caddr_t) &ifr) < 0) {
@@ -3190,6 +3896,54 @@ static int setifstate (int u, int state)
     return 1;
 }
 
+/********************************************************************
+ *
+ * sifaddr_rtnetlink - Config the interface with the local and peer IP
+ * addresses in one rtnetlink request.
+ */
+static int sifaddr_rtnetlink(unsigned int iface, u_int32_t our_adr, u_int32_t his_adr)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct ifaddrmsg ifa;
+        struct {
+            struct rtattr rta;
+            u_int32_t addr;
+        } addrs[2];
+    } nlreq;
+    int resp;
+
+    if (iface == 0)
+        return 0;
+
+    memset(&nlreq, 0, sizeof(nlreq));
+    nlreq.nlh.nlmsg_len = sizeof(nlreq);
+    nlreq.nlh.nlmsg_type = RTM_NEWADDR;
+    nlreq.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | NLM_F_CREATE | NLM_F_REPLACE;
+    nlreq.ifa.ifa_family = AF_INET;
+    nlreq.ifa.ifa_prefixlen = 32;
+    nlreq.ifa.ifa_flags = IFA_F_PERMANENT;
+    nlreq.ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+    nlreq.ifa.ifa_index = iface;
+    nlreq.addrs[0].rta.rta_len = sizeof(nlreq.addrs[0]);
+    nlreq.addrs[0].rta.rta_type = IFA_LOCAL;
+    nlreq.addrs[0].addr = our_adr;
+    nlreq.addrs[1].rta.rta_len = sizeof(nlreq.addrs[1]);
+    nlreq.addrs[1].rta.rta_type = IFA_ADDRESS;
+    /* as in sif6addr_rtnetlink, IFA_ADDRESS is the local address if no peer */
+    nlreq.addrs[1].addr = his_adr? his_adr: our_adr;
+
+    resp = rtnl_msg("RTM_NEWADDR/NLM_F_CREATE", &nlreq, sizeof(nlreq), NULL, NULL, 0);
+    if (resp) {
+        /* sifaddr will retry with the ioctls, which give their own errors */
+        errno = (resp < 0) ? -resp : EINVAL;
+        dbglog("sifaddr_rtnetlink: %m (line %d)", __LINE__);
+        return 0;
+    }
+
+    return 1;
+}
+
 /********************************************************************
  *
  * sifaddr - Config the interface IP addresses and netmask.
@@ -3201,6 +3955,15 @@ int sifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr,
     struct ifreq   ifr;
     struct rtentry rt;
 
+    /*
+     * On kernels that force the netmask to 255.255.255.255 anyway, set
+     * the local and peer addresses (and so the route to the peer) in a
+     * single rtnetlink request instead of three ioctls.
+     */
+    if (kernel_version >= KVERSION(2,1,16)
+	&& sifaddr_rtnetlink(if_nametoindex(ifname), our_adr, his_adr))
+	goto configured;
+
     memset (&ifr, '\0', sizeof (ifr));
     memset (&rt,  '\0', sizeof (rt));
 
@@ -3272,6 +4035,7 @@ int sifaddr (int unit, u_int32_t our_adr, u_int32_t his_adr,
 	}
     }
 
+configured:
     /* set ip_dynaddr in demand mode if address changes */
     if (demand && tune_kernel && !dynaddr_set
 	&& our_old_addr && our_old_addr != our_adr) {
@@ -3391,7 +4155,7 @@ static int sif6addr_rtnetlink(unsigned int iface, eui64_t our_eui64, eui64_t his
     else
         IN6_LLADDR_FROM_EUI64(nlreq.addrs[1].addr, our_eui64);
 
-    resp = rtnetlink_msg("RTM_NEWADDR/NLM_F_CREATE", NULL, &nlreq, sizeof(nlreq), NULL, NULL, 0);
+    resp = rtnl_msg("RTM_NEWADDR/NLM_F_CREATE", &nlreq, sizeof(nlreq), NULL, NULL, 0);
     if (resp) {
         /*
          * Linux kernel versions prior 3.11 do not support setting IPv6 peer
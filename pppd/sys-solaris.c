@@ -117,6 +117,9 @@
 #include <sys/stat.h>
 #include <sys/mkdev.h>
 #include <sys/time.h>
+#ifdef HAVE_SYS_DEVPOLL_H
+#include <sys/devpoll.h>
+#endif
 #include <net/if.h>
 #include <net/if_arp.h>
 #include <net/route.h>
@@ -248,6 +251,9 @@ extern u_char	inpacket_buf[];	/* borrowed from main.c */
 #define MAX_POLLFDS	32
 static struct pollfd pollfds[MAX_POLLFDS];
 static int n_pollfds;
+#ifdef HAVE_SYS_DEVPOLL_H
+static int devpoll_fd = -1;	/* /dev/poll set used by wait_input */
+#endif
 
 static int	link_mtu, link_mru;
 
@@ -738,6 +744,14 @@ sys_init(void)
 #endif /* !defined(SOL2) */
 
     n_pollfds = 0;
+#ifdef HAVE_SYS_DEVPOLL_H
+    /* Fall back to poll() if we can't open /dev/poll. */
+    devpoll_fd = open("/dev/poll", O_RDWR);
+    if (devpoll_fd < 0)
+	warn("Couldn't open /dev/poll, using poll: %m");
+    else
+	fcntl(devpoll_fd, F_SETFD, FD_CLOEXEC);
+#endif
 }
 
 /*
@@ -828,6 +842,10 @@ ppp_sys_close(void)
 #endif /* defined(PPP_WITH_IPV6CP) && defined(SOL2) */
     if (pppfd >= 0)
 	close(pppfd);
+#ifdef HAVE_SYS_DEVPOLL_H
+    if (devpoll_fd >= 0)
+	close(devpoll_fd);
+#endif
 }
 
 /*
@@ -839,6 +857,14 @@ sys_check_options(void)
     return 1;
 }
 
+/*
+ * sys_prefork_pool - ppp units can't be made ahead of time here.
+ */
+void
+sys_prefork_pool(int n)
+{
+}
+
 #if 0
 /*
  * daemon - Detach us from controlling terminal session.
@@ -1302,14 +1328,26 @@ open_ppp_loopback(void)
  */
 void
 output(int unit, u_char *p, int len)
+{
+    if (len >= PPP_HDRLEN)
+	PPP_PROBE2(pppd, output, PPP_PROTOCOL(p), len - PPP_HDRLEN);
+    dump_packet("sent", p, len);
+    if (snoop_send_hook) snoop_send_hook(p, len);
+    snoop_packet(p, len, 0);
+    output_frame(unit, p, len);
+}
+
+/*
+ * output_frame - Output PPP packet without showing it to the packet
+ * dump or the snoopers.
+ */
+void
+output_frame(int unit, u_char *p, int len)
 {
     struct strbuf data;
     int retries;
     struct pollfd pfd;
 
-    dump_packet("sent", p, len);
-    if (snoop_send_hook) snoop_send_hook(p, len);
-
     data.len = len;
     data.buf = (caddr_t) p;
     retries = 4;
@@ -1337,10 +1375,56 @@ wait_input(struct timeval *timo)
     int t;
 
     t = timo == NULL? -1: timo->tv_sec * 1000 + timo->tv_usec / 1000;
+#ifdef HAVE_SYS_DEVPOLL_H
+    if (devpoll_fd >= 0) {
+	struct pollfd ready[16];
+	struct dvpoll dp;
+
+	/*
+	 * The set is kept in the kernel, so nothing is rebuilt or
+	 * scanned here however many fds there are.
+	 */
+	dp.dp_fds = ready;
+	dp.dp_nfds = sizeof(ready) / sizeof(ready[0]);
+	dp.dp_timeout = t;
+	if (ioctl(devpoll_fd, DP_POLL, &dp) < 0 && errno != EINTR)
+	    fatal("DP_POLL: %m");
+	return;
+    }
+#endif
     if (poll(pollfds, n_pollfds, t) < 0 && errno != EINTR)
 	fatal("poll: %m");
 }
 
+/*
+ * open_signal_fd - signals can't be read from an fd here.
+ */
+int
+open_signal_fd(sigset_t *mask)
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+/*
+ * read_signal_fd - no signals are ever queued on a signal fd here.
+ */
+int
+read_signal_fd(void)
+{
+    return 0;
+}
+
+/*
+ * set_wakeup_time - arm a timer to end wait_input at a given time.
+ * Not supported here, so the caller passes a timeout to wait_input.
+ */
+int
+set_wakeup_time(struct timeval *when)
+{
+    return 0;
+}
+
 /*
  * add_fd - add an fd to the set that wait_input waits for.
  */
@@ -1348,6 +1432,19 @@ void add_fd(int fd)
 {
     int n;
 
+#ifdef HAVE_SYS_DEVPOLL_H
+    if (devpoll_fd >= 0) {
+	struct pollfd pfd;
+
+	/* Adding an fd that is already there just adds to its events. */
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLPRI | POLLHUP;
+	pfd.revents = 0;
+	if (write(devpoll_fd, &pfd, sizeof(pfd)) != sizeof(pfd))
+	    fatal("Couldn't add fd %d to /dev/poll: %m", fd);
+	return;
+    }
+#endif
     for (n = 0; n < n_pollfds; ++n)
 	if (pollfds[n].fd == fd)
 	    return;
@@ -1366,6 +1463,19 @@ void remove_fd(int fd)
 {
     int n;
 
+#ifdef HAVE_SYS_DEVPOLL_H
+    if (devpoll_fd >= 0) {
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLREMOVE;
+	pfd.revents = 0;
+	if (write(devpoll_fd, &pfd, sizeof(pfd)) != sizeof(pfd)
+	    && errno != EBADF)
+	    error("Couldn't remove fd %d from /dev/poll: %m", fd);
+	return;
+    }
+#endif
     for (n = 0; n < n_pollfds; ++n) {
 	if (pollfds[n].fd == fd) {
 	    while (++n < n_pollfds)
@@ -1648,6 +1758,19 @@ get_ppp_stats(int u, struct pppd_stats *stats)
     return 1;
 }
 
+/*
+ * get_ppp_comp_stats - return compression statistics for the link.
+ */
+int
+get_ppp_comp_stats(int u, struct ppp_comp_stats *cstats)
+{
+    if (strioctl(pppfd, PPPIO_GETCSTAT, cstats, 0, sizeof(*cstats)) < 0) {
+	error("Couldn't get compression statistics: %m");
+	return 0;
+    }
+    return 1;
+}
+
 /*
  * ccp_fatal_error - returns 1 if decompression was disabled as a
  * result of an error detected after decompression of a packet,
@@ -1671,14 +1794,14 @@ ccp_fatal_error(int unit)
  * sifvjcomp - config tcp header compression
  */
 int
-sifvjcomp(int u, int vjcomp, int xcidcomp, int xmaxcid)
+sifvjcomp(int u, int vjcomp, int xcidcomp, int xmaxcid, int rmaxcid)
 {
     int cf[2];
     char maxcid[2];
 
     if (vjcomp) {
-	maxcid[0] = xcidcomp;
-	maxcid[1] = 15;		/* XXX should be rmaxcid */
+	maxcid[0] = xmaxcid;
+	maxcid[1] = rmaxcid;
 	if (strioctl(pppfd, PPPIO_VJINIT, maxcid, sizeof(maxcid), 0) < 0) {
 	    error("Couldn't initialize VJ compression: %m");
 	}
@@ -51,6 +51,8 @@
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -59,12 +61,17 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <signal.h>
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+#include <pthread.h>
+#endif
 #include "tdb.h"
 #include "spinlock.h"
+#include "probes.h"
 
 #define TDB_MAGIC_FOOD "TDB file\n"
-#define TDB_VERSION (0x26011967 + 6)
+#define TDB_VERSION (0x26011967 + 7)
 #define TDB_MAGIC (0x26011999U)
 #define TDB_FREE_MAGIC (~TDB_MAGIC)
 #define TDB_DEAD_MAGIC (0xFEE1DEAD)
@@ -73,12 +80,28 @@
 #define DEFAULT_HASH_SIZE 131
 #define TDB_PAGE_SIZE 0x2000
 #define FREELIST_TOP (sizeof(struct tdb_header))
+#define TDB_FREE_CLASSES 8
+#define TDB_FREELIST(c) (offsetof(struct tdb_header, freelists) + (c)*sizeof(tdb_off))
 #define TDB_ALIGN(x,a) (((x) + (a)-1) & ~((a)-1))
 #define TDB_BYTEREV(x) (((((x)&0xff)<<24)|((x)&0xFF00)<<8)|(((x)>>8)&0xFF00)|((x)>>24))
 #define TDB_DEAD(r) ((r)->magic == TDB_DEAD_MAGIC)
 #define TDB_BAD_MAGIC(r) ((r)->magic != TDB_MAGIC && !TDB_DEAD(r))
 #define TDB_HASH_TOP(hash) (FREELIST_TOP + (BUCKET(hash)+1)*sizeof(tdb_off))
-#define TDB_DATA_START(hash_size) (TDB_HASH_TOP(hash_size-1) + TDB_SPINLOCK_SIZE(hash_size))
+#define TDB_SEQNUM_SIZE(hash_size) (((hash_size) + 1) * sizeof(u32))
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+#define TDB_MUTEX_SIZE(hash_size) (((hash_size) + 1) * sizeof(pthread_mutex_t))
+#else
+#define TDB_MUTEX_SIZE(hash_size) 0
+#endif
+#define TDB_DATA_START(tdb) ((tdb)->header.mutexes ? \
+	(tdb)->header.mutexes + TDB_MUTEX_SIZE((tdb)->header.hash_size) : \
+	TDB_HASH_TOP((tdb)->header.hash_size-1) + sizeof(tdb_off) \
+	+ TDB_SEQNUM_SIZE((tdb)->header.hash_size) \
+	+ TDB_SPINLOCK_SIZE((tdb)->header.hash_size))
+#define TDB_SEQNUM(tdb, list) ((volatile u32 *)((char *)(tdb)->map_ptr + (tdb)->header.seqnums) + (list) + 1)
+
+/* how often a lockless read is retried before taking the chain lock */
+#define TDB_NOLOCK_TRIES 3
 
 
 /* NB assumes there is a local variable called "tdb" that is the
@@ -164,6 +187,83 @@ static void *convert(void *buf, u32 size)
 #define DOCONV() (tdb->flags & TDB_CONVERT)
 #define CONVERT(x) (DOCONV() ? convert(&x, sizeof(x)) : &x)
 
+/* SipHash-2-4 (Aumasson and Bernstein), folded to 32 bits.  Keys
+   such as peer names come from the other end of the link, so a keyed
+   hash stops anyone from choosing names that all land in one chain. */
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define SIP_ROUND(v0, v1, v2, v3) do {					\
+	v0 += v1; v1 = SIP_ROTL(v1, 13); v1 ^= v0; v0 = SIP_ROTL(v0, 32); \
+	v2 += v3; v3 = SIP_ROTL(v3, 16); v3 ^= v2;			\
+	v0 += v3; v3 = SIP_ROTL(v3, 21); v3 ^= v0;			\
+	v2 += v1; v1 = SIP_ROTL(v1, 17); v1 ^= v2; v2 = SIP_ROTL(v2, 32); \
+} while (0)
+
+static u32 tdb_siphash(const u32 *k, const unsigned char *p, size_t len)
+{
+	uint64_t k0 = ((uint64_t)k[1] << 32) | k[0];
+	uint64_t k1 = ((uint64_t)k[3] << 32) | k[2];
+	uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+	uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+	uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+	uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+	uint64_t m, b = (uint64_t)len << 56;
+	size_t i, left = len & 7;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		m = (uint64_t)p[i] | (uint64_t)p[i+1] << 8
+			| (uint64_t)p[i+2] << 16 | (uint64_t)p[i+3] << 24
+			| (uint64_t)p[i+4] << 32 | (uint64_t)p[i+5] << 40
+			| (uint64_t)p[i+6] << 48 | (uint64_t)p[i+7] << 56;
+		v3 ^= m;
+		SIP_ROUND(v0, v1, v2, v3);
+		SIP_ROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+	while (left--)
+		b |= (uint64_t)p[i + left] << (8 * left);
+	v3 ^= b;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	v0 ^= b;
+	v2 ^= 0xff;
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	SIP_ROUND(v0, v1, v2, v3);
+	b = v0 ^ v1 ^ v2 ^ v3;
+	return (u32)(b ^ (b >> 32));
+}
+
+/* hash a key with the function recorded for this database */
+static u32 tdb_hash(TDB_CONTEXT *tdb, TDB_DATA *key)
+{
+	if (tdb->header.hash_kind == TDB_HASH_SIPHASH)
+		return tdb_siphash(tdb->header.hash_key,
+				   (unsigned char *)key->dptr, key->dsize);
+	return tdb->hash_fn(key);
+}
+
+/* a fresh secret for a new database's SipHash key */
+static void tdb_hash_newkey(u32 *k)
+{
+	struct timeval tv;
+	int fd, i;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd >= 0) {
+		i = read(fd, k, 4 * sizeof(u32));
+		close(fd);
+		if (i == 4 * sizeof(u32))
+			return;
+	}
+	/* not very secret, but still different for every database */
+	gettimeofday(&tv, NULL);
+	k[0] = tv.tv_sec;
+	k[1] = tv.tv_usec;
+	k[2] = getpid();
+	k[3] = (u32)(uintptr_t)&tv;
+}
+
 /* the body of the database is made of one list_struct for the free space
    plus a separate data list for each hash value */
 struct list_struct {
@@ -256,6 +356,146 @@ static int tdb_brlock(TDB_CONTEXT *tdb, tdb_off offset,
 	return 0;
 }
 
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+/* The chain locks of a new enough database are robust process-shared
+   mutexes, one per list, so an uncontended lock costs no system call
+   and a pppd that dies holding one can't wedge the others.  They are
+   mapped separately from the rest of the file, since the main mapping
+   moves whenever the database grows. */
+static int tdb_mutex_map(TDB_CONTEXT *tdb)
+{
+	void *p;
+
+	p = mmap(NULL, TDB_MUTEX_SIZE(tdb->header.hash_size),
+		 PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FILE, tdb->fd,
+		 tdb->header.mutexes);
+	if (p == MAP_FAILED) {
+		TDB_LOG((tdb, 0, "tdb_mutex_map failed (%s)\n", strerror(errno)));
+		return -1;
+	}
+	tdb->mutex_ptr = p;
+	return 0;
+}
+
+static void tdb_mutex_unmap(TDB_CONTEXT *tdb)
+{
+	if (tdb->mutex_ptr)
+		munmap(tdb->mutex_ptr, TDB_MUTEX_SIZE(tdb->header.hash_size));
+	tdb->mutex_ptr = NULL;
+}
+
+static int tdb_mutex_init(TDB_CONTEXT *tdb)
+{
+	pthread_mutex_t *m = tdb->mutex_ptr;
+	pthread_mutexattr_t attr;
+	u32 i;
+	int ret;
+
+	if ((ret = pthread_mutexattr_init(&attr)) != 0)
+		goto fail;
+	if ((ret = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) != 0
+	    || (ret = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) != 0) {
+		pthread_mutexattr_destroy(&attr);
+		goto fail;
+	}
+	for (i = 0; i < tdb->header.hash_size + 1; i++)
+		if ((ret = pthread_mutex_init(&m[i], &attr)) != 0)
+			break;
+	pthread_mutexattr_destroy(&attr);
+	if (ret == 0)
+		return 0;
+ fail:
+	TDB_LOG((tdb, 0, "tdb_mutex_init failed (%s)\n", strerror(ret)));
+	errno = ret;
+	return -1;
+}
+
+/* Map the mutexes, and if nobody else has the database open, reset
+   them in case the last user died holding one.  Every user keeps a
+   read lock on ACTIVE_LOCK (as TDB_CLEAR_IF_FIRST does) so that the
+   first one can tell. */
+static int tdb_mutex_open(TDB_CONTEXT *tdb)
+{
+	if (tdb_mutex_map(tdb) != 0)
+		return -1;
+	if (tdb->flags & TDB_CLEAR_IF_FIRST)
+		return 0;	/* tdb_open_ex does the active lock for us */
+	if (tdb_brlock(tdb, ACTIVE_LOCK, F_WRLCK, F_SETLK, 1) == 0
+	    && tdb_mutex_init(tdb) != 0)
+		return -1;
+	return tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0);
+}
+
+static int tdb_mutex_lock(TDB_CONTEXT *tdb, int list)
+{
+	pthread_mutex_t *m = (pthread_mutex_t *)tdb->mutex_ptr + list + 1;
+	int ret;
+
+	ret = pthread_mutex_lock(m);
+	if (ret == EOWNERDEAD) {
+		/* The list may be half-changed, but there is nothing
+		   better to do than carry on; let lockless readers
+		   see the list as stable again. */
+		TDB_LOG((tdb, 0, "tdb_lock: owner of list %d died\n", list));
+		if (tdb->header.seqnums && tdb->map_ptr
+		    && (*TDB_SEQNUM(tdb, list) & 1))
+			__sync_fetch_and_add(TDB_SEQNUM(tdb, list), 1);
+		ret = pthread_mutex_consistent(m);
+	}
+	if (ret != 0) {
+		errno = ret;
+		return TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	}
+	return 0;
+}
+
+static int tdb_mutex_unlock(TDB_CONTEXT *tdb, int list)
+{
+	pthread_mutex_t *m = (pthread_mutex_t *)tdb->mutex_ptr + list + 1;
+	int ret;
+
+	if ((ret = pthread_mutex_unlock(m)) != 0) {
+		errno = ret;
+		return TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	}
+	return 0;
+}
+#else
+static int tdb_mutex_open(TDB_CONTEXT *tdb)
+{
+	TDB_LOG((tdb, 0, "tdb_mutex_open: %s uses mutexes, which this build lacks\n",
+		 tdb->name));
+	errno = EINVAL;
+	return -1;
+}
+#define tdb_mutex_unmap(tdb) do { } while (0)
+#define tdb_mutex_lock(tdb, list) (-1)
+#define tdb_mutex_unlock(tdb, list) (-1)
+#endif
+
+/* Bump the change counter of a list: it is odd while a writer holds
+   the list, so that lockless readers can tell that they may have seen
+   a half-made change.  The writers of a list are serialised by its
+   lock, so without a mapping a plain read and write is enough. */
+static void tdb_seqnum_bump(TDB_CONTEXT *tdb, int list)
+{
+	tdb_off off;
+	u32 seq;
+
+	if (tdb->header.seqnums == 0 || tdb->read_only)
+		return;
+	if (tdb->map_ptr) {
+		__sync_fetch_and_add(TDB_SEQNUM(tdb, list), 1);
+		return;
+	}
+	off = tdb->header.seqnums + (list + 1) * sizeof(u32);
+	if (pread(tdb->fd, &seq, sizeof(seq), off) == sizeof(seq)) {
+		seq++;
+		if (pwrite(tdb->fd, &seq, sizeof(seq), off) != sizeof(seq))
+			TDB_LOG((tdb, 0, "tdb_seqnum_bump: write failed for list %d\n", list));
+	}
+}
+
 /* lock a list in the database. list -1 is the alloc list */
 static int tdb_lock(TDB_CONTEXT *tdb, int list, int ltype)
 {
@@ -270,7 +510,14 @@ static int tdb_lock(TDB_CONTEXT *tdb, int list, int ltype)
 	/* Since fcntl locks don't nest, we do a lock for the first one,
 	   and simply bump the count for future ones */
 	if (tdb->locked[list+1].count == 0) {
-		if (!tdb->read_only && tdb->header.rwlocks) {
+		PPP_PROBE2(tdb, lock_wait, list, ltype);
+		if (tdb->mutex_ptr) {
+			if (tdb_mutex_lock(tdb, list)) {
+				TDB_LOG((tdb, 0, "tdb_lock mutex failed on list %d ltype=%d (%s)\n",
+					   list, ltype, strerror(errno)));
+				return -1;
+			}
+		} else if (!tdb->read_only && tdb->header.rwlocks) {
 			if (tdb_spinlock(tdb, list, ltype)) {
 				TDB_LOG((tdb, 0, "tdb_lock spinlock failed on list %d ltype=%d\n", 
 					   list, ltype));
@@ -281,7 +528,10 @@ static int tdb_lock(TDB_CONTEXT *tdb, int list, int ltype)
 					   list, ltype, strerror(errno)));
 			return -1;
 		}
+		PPP_PROBE2(tdb, lock_done, list, ltype);
 		tdb->locked[list+1].ltype = ltype;
+		if (ltype == F_WRLCK)
+			tdb_seqnum_bump(tdb, list);
 	}
 	tdb->locked[list+1].count++;
 	return 0;
@@ -309,8 +559,12 @@ static int tdb_unlock(TDB_CONTEXT *tdb, int list, int ltype)
 	}
 
 	if (tdb->locked[list+1].count == 1) {
+		if (tdb->locked[list+1].ltype == F_WRLCK)
+			tdb_seqnum_bump(tdb, list);
 		/* Down to last nested lock: unlock underneath */
-		if (!tdb->read_only && tdb->header.rwlocks) {
+		if (tdb->mutex_ptr) {
+			ret = tdb_mutex_unlock(tdb, list);
+		} else if (!tdb->read_only && tdb->header.rwlocks) {
 			ret = tdb_spinunlock(tdb, list, ltype);
 		} else {
 			ret = tdb_brlock(tdb, FREELIST_TOP+4*list, F_UNLCK, F_SETLKW, 0);
@@ -567,36 +821,39 @@ int tdb_printfreelist(TDB_CONTEXT *tdb)
 	long total_free = 0;
 	tdb_off offset, rec_ptr;
 	struct list_struct rec;
+	int c;
 
 	if ((ret = tdb_lock(tdb, -1, F_WRLCK)) != 0)
 		return ret;
 
-	offset = FREELIST_TOP;
+	for (c = 0; c <= TDB_FREE_CLASSES; c++) {
+		offset = c < TDB_FREE_CLASSES ? TDB_FREELIST(c) : FREELIST_TOP;
 
-	/* read in the freelist top */
-	if (ofs_read(tdb, offset, &rec_ptr) == -1) {
-		tdb_unlock(tdb, -1, F_WRLCK);
-		return 0;
-	}
-
-	printf("freelist top=[0x%08x]\n", rec_ptr );
-	while (rec_ptr) {
-		if (tdb_read(tdb, rec_ptr, (char *)&rec, sizeof(rec), DOCONV()) == -1) {
+		/* read in the freelist top */
+		if (ofs_read(tdb, offset, &rec_ptr) == -1) {
 			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
+			return 0;
 		}
 
-		if (rec.magic != TDB_FREE_MAGIC) {
-			printf("bad magic 0x%08x in free list\n", rec.magic);
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return -1;
-		}
+		printf("freelist %d top=[0x%08x]\n", c, rec_ptr );
+		while (rec_ptr) {
+			if (tdb_read(tdb, rec_ptr, (char *)&rec, sizeof(rec), DOCONV()) == -1) {
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
 
-		printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%d)]\n", rec.next, rec.rec_len, rec.rec_len );
-		total_free += rec.rec_len;
+			if (rec.magic != TDB_FREE_MAGIC) {
+				printf("bad magic 0x%08x in free list\n", rec.magic);
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return -1;
+			}
 
-		/* move to the next record */
-		rec_ptr = rec.next;
+			printf("entry offset=[0x%08x], rec.rec_len = [0x%08x (%d)]\n", rec.next, rec.rec_len, rec.rec_len );
+			total_free += rec.rec_len;
+
+			/* move to the next record */
+			rec_ptr = rec.next;
+		}
 	}
 	printf("total rec_len = [0x%08x (%d)]\n", (int)total_free, 
                (int)total_free);
@@ -604,20 +861,37 @@ int tdb_printfreelist(TDB_CONTEXT *tdb)
 	return tdb_unlock(tdb, -1, F_WRLCK);
 }
 
+/* Free records are kept on a list for their size class: class c holds
+   records of under 64 << c bytes, and the last one everything bigger.
+   Older databases may still have some on the single list at
+   FREELIST_TOP, which is searched last. */
+static int tdb_free_class(tdb_len len)
+{
+	int c;
+
+	for (c = 0; c < TDB_FREE_CLASSES - 1 && len >= (64U << c); c++)
+		;
+	return c;
+}
+
 /* Remove an element from the freelist.  Must have alloc lock. */
-static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_off next)
+static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_len len,
+				tdb_off next)
 {
 	tdb_off last_ptr, i;
-
-	/* read in the freelist top */
-	last_ptr = FREELIST_TOP;
-	while (ofs_read(tdb, last_ptr, &i) != -1 && i != 0) {
-		if (i == off) {
-			/* We've found it! */
-			return ofs_write(tdb, last_ptr, &next);
+	int pass;
+
+	/* try the list for its size, then the old single list */
+	for (pass = 0; pass < 2; pass++) {
+		last_ptr = pass == 0 ? TDB_FREELIST(tdb_free_class(len)) : FREELIST_TOP;
+		while (ofs_read(tdb, last_ptr, &i) != -1 && i != 0) {
+			if (i == off) {
+				/* We've found it! */
+				return ofs_write(tdb, last_ptr, &next);
+			}
+			/* Follow chain (next offset is at start of record) */
+			last_ptr = i;
 		}
-		/* Follow chain (next offset is at start of record) */
-		last_ptr = i;
 	}
 	TDB_LOG((tdb, 0,"remove_from_freelist: not on list at off=%d\n", off));
 	return TDB_ERRCODE(TDB_ERR_CORRUPT, -1);
@@ -627,7 +901,7 @@ static int remove_from_freelist(TDB_CONTEXT *tdb, tdb_off off, tdb_off next)
    neccessary. */
 static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 {
-	tdb_off right, left;
+	tdb_off right, left, head;
 
 	/* Allocation and tailer lock */
 	if (tdb_lock(tdb, -1, F_WRLCK) != 0)
@@ -651,7 +925,7 @@ static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 
 		/* If it's free, expand to include it. */
 		if (r.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, right, r.next) == -1) {
+			if (remove_from_freelist(tdb, right, r.rec_len, r.next) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: right free failed at %u\n", right));
 				goto left;
 			}
@@ -662,7 +936,7 @@ static int tdb_free(TDB_CONTEXT *tdb, tdb_off offset, struct list_struct *rec)
 left:
 	/* Look left */
 	left = offset - sizeof(tdb_off);
-	if (left > TDB_DATA_START(tdb->header.hash_size)) {
+	if (left > TDB_DATA_START(tdb)) {
 		struct list_struct l;
 		tdb_off leftsize;
 		
@@ -681,7 +955,7 @@ left:
 
 		/* If it's free, expand to include it. */
 		if (l.magic == TDB_FREE_MAGIC) {
-			if (remove_from_freelist(tdb, left, l.next) == -1) {
+			if (remove_from_freelist(tdb, left, l.rec_len, l.next) == -1) {
 				TDB_LOG((tdb, 0, "tdb_free: left free failed at %u\n", left));
 				goto update;
 			} else {
@@ -697,12 +971,13 @@ update:
 		goto fail;
 	}
 
-	/* Now, prepend to free list */
+	/* Now, prepend to the free list for its size */
 	rec->magic = TDB_FREE_MAGIC;
+	head = TDB_FREELIST(tdb_free_class(rec->rec_len));
 
-	if (ofs_read(tdb, FREELIST_TOP, &rec->next) == -1 ||
+	if (ofs_read(tdb, head, &rec->next) == -1 ||
 	    rec_write(tdb, offset, rec) == -1 ||
-	    ofs_write(tdb, FREELIST_TOP, &offset) == -1) {
+	    ofs_write(tdb, head, &offset) == -1) {
 		TDB_LOG((tdb, 0, "tdb_free record write failed at offset=%d\n", offset));
 		goto fail;
 	}
@@ -844,6 +1119,7 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 {
 	tdb_off rec_ptr, last_ptr, newrec_ptr;
 	struct list_struct newrec;
+	int c;
 
 	memset(&newrec, '\0', sizeof(newrec));
 
@@ -854,64 +1130,68 @@ static tdb_off tdb_allocate(TDB_CONTEXT *tdb, tdb_len length,
 	length += sizeof(tdb_off);
 
  again:
-	last_ptr = FREELIST_TOP;
-
-	/* read in the freelist top */
-	if (ofs_read(tdb, FREELIST_TOP, &rec_ptr) == -1)
-		goto fail;
+	/* first fit on the list for this size, then the bigger ones,
+	   then the old single list */
+	for (c = tdb_free_class(length); c <= TDB_FREE_CLASSES; c++) {
+		last_ptr = c < TDB_FREE_CLASSES ? TDB_FREELIST(c) : FREELIST_TOP;
 
-	/* keep looking until we find a freelist record big enough */
-	while (rec_ptr) {
-		if (rec_free_read(tdb, rec_ptr, rec) == -1)
+		/* read in the freelist top */
+		if (ofs_read(tdb, last_ptr, &rec_ptr) == -1)
 			goto fail;
 
-		if (rec->rec_len >= length) {
-			/* found it - now possibly split it up  */
-			if (rec->rec_len > length + MIN_REC_SIZE) {
-				/* Length of left piece */
-				length = TDB_ALIGN(length, TDB_ALIGNMENT);
+		/* keep looking until we find a freelist record big enough */
+		while (rec_ptr) {
+			if (rec_free_read(tdb, rec_ptr, rec) == -1)
+				goto fail;
 
-				/* Right piece to go on free list */
-				newrec.rec_len = rec->rec_len
-					- (sizeof(*rec) + length);
-				newrec_ptr = rec_ptr + sizeof(*rec) + length;
+			if (rec->rec_len >= length) {
+				/* found it - now possibly split it up  */
+				if (rec->rec_len > length + MIN_REC_SIZE) {
+					/* Length of left piece */
+					length = TDB_ALIGN(length, TDB_ALIGNMENT);
 
-				/* And left record is shortened */
-				rec->rec_len = length;
-			} else
-				newrec_ptr = 0;
+					/* Right piece to go on free list */
+					newrec.rec_len = rec->rec_len
+						- (sizeof(*rec) + length);
+					newrec_ptr = rec_ptr + sizeof(*rec) + length;
 
-			/* Remove allocated record from the free list */
-			if (ofs_write(tdb, last_ptr, &rec->next) == -1)
-				goto fail;
+					/* And left record is shortened */
+					rec->rec_len = length;
+				} else
+					newrec_ptr = 0;
 
-			/* Update header: do this before we drop alloc
-                           lock, otherwise tdb_free() might try to
-                           merge with us, thinking we're free.
-                           (Thanks Jeremy Allison). */
-			rec->magic = TDB_MAGIC;
-			if (rec_write(tdb, rec_ptr, rec) == -1)
-				goto fail;
-
-			/* Did we create new block? */
-			if (newrec_ptr) {
-				/* Update allocated record tailer (we
-                                   shortened it). */
-				if (update_tailer(tdb, rec_ptr, rec) == -1)
+				/* Remove allocated record from the free list */
+				if (ofs_write(tdb, last_ptr, &rec->next) == -1)
 					goto fail;
 
-				/* Free new record */
-				if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
+				/* Update header: do this before we drop alloc
+	                           lock, otherwise tdb_free() might try to
+	                           merge with us, thinking we're free.
+	                           (Thanks Jeremy Allison). */
+				rec->magic = TDB_MAGIC;
+				if (rec_write(tdb, rec_ptr, rec) == -1)
 					goto fail;
-			}
 
-			/* all done - return the new record offset */
-			tdb_unlock(tdb, -1, F_WRLCK);
-			return rec_ptr;
+				/* Did we create new block? */
+				if (newrec_ptr) {
+					/* Update allocated record tailer (we
+	                                   shortened it). */
+					if (update_tailer(tdb, rec_ptr, rec) == -1)
+						goto fail;
+
+					/* Free new record */
+					if (tdb_free(tdb, newrec_ptr, &newrec) == -1)
+						goto fail;
+				}
+
+				/* all done - return the new record offset */
+				tdb_unlock(tdb, -1, F_WRLCK);
+				return rec_ptr;
+			}
+			/* move to the next record */
+			last_ptr = rec_ptr;
+			rec_ptr = rec->next;
 		}
-		/* move to the next record */
-		last_ptr = rec_ptr;
-		rec_ptr = rec->next;
 	}
 	/* we didn't find enough space. See if we can expand the
 	   database and if we can then try again */
@@ -927,15 +1207,24 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 {
 	struct tdb_header *newdb;
 	int size, ret = -1;
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	long pagesize;
+#endif
 
 	/* We make it up in memory, then write it out if not internal */
-	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off);
+	size = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off)
+		+ TDB_SEQNUM_SIZE(hash_size);
 	if (!(newdb = calloc(size, 1)))
 		return TDB_ERRCODE(TDB_ERR_OOM, -1);
 
 	/* Fill in the header */
 	newdb->version = TDB_VERSION;
 	newdb->hash_size = hash_size;
+	if (tdb->flags & TDB_SIPHASH) {
+		newdb->hash_kind = TDB_HASH_SIPHASH;
+		tdb_hash_newkey(newdb->hash_key);
+	}
+	newdb->seqnums = sizeof(struct tdb_header) + (hash_size+1)*sizeof(tdb_off);
 	if (tdb->flags & TDB_INTERNAL) {
 		tdb->map_size = size;
 		tdb->map_ptr = (char *)newdb;
@@ -950,6 +1239,14 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 	if (ftruncate(tdb->fd, 0) == -1)
 		goto fail;
 
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	/* the mutexes go on their own page(s) after everything else */
+	if (!(tdb->flags & (TDB_NOLOCK|TDB_NOMUTEX))
+	    && (pagesize = sysconf(_SC_PAGESIZE)) > 0)
+		newdb->mutexes = TDB_ALIGN(size + TDB_SPINLOCK_SIZE(hash_size),
+					   (tdb_off)pagesize);
+#endif
+
 	/* This creates an endian-converted header, as if read from disk */
 	CONVERT(*newdb);
 	memcpy(&tdb->header, newdb, sizeof(tdb->header));
@@ -959,6 +1256,14 @@ static int tdb_new_database(TDB_CONTEXT *tdb, int hash_size)
 		ret = -1;
 	else
 		ret = tdb_create_rwlocks(tdb->fd, hash_size);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if (ret == 0 && tdb->header.mutexes) {
+		if (ftruncate(tdb->fd, tdb->header.mutexes + TDB_MUTEX_SIZE(hash_size)) == -1
+		    || tdb_mutex_map(tdb) != 0 || tdb_mutex_init(tdb) != 0)
+			ret = -1;
+		tdb_mutex_unmap(tdb);
+	}
+#endif
 
   fail:
 	SAFE_FREE(newdb);
@@ -983,7 +1288,16 @@ static tdb_off tdb_find(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash,
 
 		if (!TDB_DEAD(r) && hash==r->full_hash && key.dsize==r->key_len) {
 			char *k;
-			/* a very likely hit - read the key */
+			/* a very likely hit - compare the key where it lies */
+			if (tdb->map_ptr
+			    && rec_ptr + sizeof(*r) + r->key_len <= tdb->map_size) {
+				if (memcmp(key.dptr, (char *)tdb->map_ptr + rec_ptr
+					   + sizeof(*r), key.dsize) == 0)
+					return rec_ptr;
+				rec_ptr = r->next;
+				continue;
+			}
+			/* or read it in */
 			k = tdb_alloc_read(tdb, rec_ptr + sizeof(*r), 
 					   r->key_len);
 			if (!k)
@@ -1013,6 +1327,201 @@ static tdb_off tdb_find_lock_hash(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash, int
 	return rec_ptr;
 }
 
+/* Look a key up without taking any lock, straight from the mapping.
+   The chain's change counter is checked around (and during) the walk,
+   and any sign of a concurrent writer - an odd or changed counter, a
+   record that doesn't look right, or one beyond our mapping - makes
+   us give up quietly, so the caller can retry or take the lock.
+
+   Returns 1 with *found and, if dbuf is not NULL, the data filled in,
+   or 0 if the lookup could not be done this way. */
+static int tdb_find_nolock(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash,
+			   int *found, TDB_DATA *dbuf)
+{
+	volatile u32 *seqp;
+	struct list_struct rec;
+	tdb_off rec_ptr;
+	char *data;
+	u32 seq;
+
+	if (!tdb->map_ptr || tdb->header.seqnums == 0
+	    || tdb->header.seqnums + TDB_SEQNUM_SIZE(tdb->header.hash_size) > tdb->map_size)
+		return 0;
+	seqp = TDB_SEQNUM(tdb, BUCKET(hash));
+	seq = *seqp;
+	if (seq & 1)
+		return 0;
+	__sync_synchronize();
+
+	memcpy(&rec_ptr, (char *)tdb->map_ptr + TDB_HASH_TOP(hash), sizeof(rec_ptr));
+	if (DOCONV())
+		convert(&rec_ptr, sizeof(rec_ptr));
+	while (rec_ptr) {
+		tdb_len room;
+
+		if (rec_ptr > tdb->map_size - sizeof(rec))
+			return 0;
+		memcpy(&rec, (char *)tdb->map_ptr + rec_ptr, sizeof(rec));
+		if (DOCONV())
+			convert(&rec, sizeof(rec));
+		room = tdb->map_size - sizeof(rec) - rec_ptr;
+		if (TDB_BAD_MAGIC(&rec) || rec.key_len > room
+		    || rec.data_len > room - rec.key_len)
+			return 0;
+		if (!TDB_DEAD(&rec) && hash == rec.full_hash && key.dsize == rec.key_len
+		    && memcmp(key.dptr, (char *)tdb->map_ptr + rec_ptr + sizeof(rec),
+			      key.dsize) == 0)
+			break;
+		/* a chain can only loop while it's being changed */
+		if (*seqp != seq)
+			return 0;
+		rec_ptr = rec.next;
+	}
+
+	data = NULL;
+	if (rec_ptr && dbuf && rec.data_len) {
+		if (!(data = malloc(rec.data_len)))
+			return 0;
+		memcpy(data, (char *)tdb->map_ptr + rec_ptr + sizeof(rec) + rec.key_len,
+		       rec.data_len);
+	}
+	__sync_synchronize();
+	if (*seqp != seq) {
+		SAFE_FREE(data);
+		return 0;
+	}
+
+	*found = (rec_ptr != 0);
+	if (dbuf) {
+		dbuf->dptr = data;
+		dbuf->dsize = rec_ptr ? rec.data_len : 0;
+	}
+	return 1;
+}
+
+/* Try a lookup a few times without locking; 1 if it worked */
+static int tdb_lookup_nolock(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash,
+			     int *found, TDB_DATA *dbuf)
+{
+	int i;
+
+	for (i = 0; i < TDB_NOLOCK_TRIES; i++)
+		if (tdb_find_nolock(tdb, key, hash, found, dbuf)) {
+			tdb->ecode = *found ? TDB_SUCCESS : TDB_ERR_NOEXIST;
+			return 1;
+		}
+	return 0;
+}
+
+/* While batching, tdb_store and tdb_delete just note what they would
+   do, keeping only the last operation on each key, and tdb_batch_commit
+   applies the lot taking each chain lock once.  Lookups see the queued
+   operations; traversals don't.  An operation on a chain the caller has
+   locked goes straight to the database, so that read-modify-write
+   sequences under tdb_chainlock stay atomic. */
+struct tdb_batch_op {
+	struct tdb_batch_op *next;
+	u32 hash;
+	int deleted;	/* a delete rather than a store */
+	TDB_DATA key;
+	TDB_DATA data;	/* key and data follow the structure */
+};
+
+static struct tdb_batch_op *tdb_batch_find(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash)
+{
+	struct tdb_batch_op *op;
+
+	for (op = tdb->batch; op; op = op->next)
+		if (op->hash == hash && op->key.dsize == key.dsize
+		    && memcmp(op->key.dptr, key.dptr, key.dsize) == 0)
+			return op;
+	return NULL;
+}
+
+static void tdb_batch_drop(TDB_CONTEXT *tdb, struct tdb_batch_op *op)
+{
+	struct tdb_batch_op **pp;
+
+	for (pp = &tdb->batch; *pp; pp = &(*pp)->next) {
+		if (*pp == op) {
+			*pp = op->next;
+			free(op);
+			return;
+		}
+	}
+}
+
+/* queue a store of dbuf, or a delete if dbuf is NULL, replacing op */
+static int tdb_batch_queue(TDB_CONTEXT *tdb, struct tdb_batch_op *op,
+			   TDB_DATA key, u32 hash, TDB_DATA *dbuf)
+{
+	struct tdb_batch_op *nop, **pp;
+	size_t dsize = dbuf ? dbuf->dsize : 0;
+
+	if (!(nop = malloc(sizeof(*nop) + key.dsize + dsize)))
+		return TDB_ERRCODE(TDB_ERR_OOM, -1);
+	nop->next = NULL;
+	nop->hash = hash;
+	nop->deleted = (dbuf == NULL);
+	nop->key.dptr = (char *)(nop + 1);
+	nop->key.dsize = key.dsize;
+	memcpy(nop->key.dptr, key.dptr, key.dsize);
+	nop->data.dptr = nop->key.dptr + key.dsize;
+	nop->data.dsize = dsize;
+	if (dsize)
+		memcpy(nop->data.dptr, dbuf->dptr, dsize);
+
+	if (op)
+		tdb_batch_drop(tdb, op);
+	for (pp = &tdb->batch; *pp; pp = &(*pp)->next)
+		;
+	*pp = nop;
+	return 0;
+}
+
+static void tdb_batch_free(TDB_CONTEXT *tdb)
+{
+	struct tdb_batch_op *op;
+
+	while ((op = tdb->batch) != NULL) {
+		tdb->batch = op->next;
+		free(op);
+	}
+}
+
+/* apply the queued operations, a chain at a time */
+static int tdb_batch_apply(TDB_CONTEXT *tdb)
+{
+	struct tdb_batch_op *op, *o;
+	int batching = tdb->batching;
+	int list, ret = 0;
+
+	tdb->batching = 0;
+	while ((op = tdb->batch) != NULL) {
+		list = BUCKET(op->hash);
+		if (tdb_lock(tdb, list, F_WRLCK) == -1) {
+			ret = -1;
+			break;
+		}
+		for (op = tdb->batch; op; op = o) {
+			o = op->next;
+			if (BUCKET(op->hash) != list)
+				continue;
+			if (op->deleted) {
+				if (tdb_delete(tdb, op->key) == -1
+				    && tdb->ecode != TDB_ERR_NOEXIST)
+					ret = -1;
+			} else if (tdb_store(tdb, op->key, op->data, TDB_REPLACE) == -1)
+				ret = -1;
+			tdb_batch_drop(tdb, op);
+		}
+		tdb_unlock(tdb, list, F_WRLCK);
+	}
+	tdb_batch_free(tdb);
+	tdb->batching = batching;
+	return ret;
+}
+
 enum TDB_ERROR tdb_error(TDB_CONTEXT *tdb)
 {
 	return tdb->ecode;
@@ -1085,9 +1594,26 @@ TDB_DATA tdb_fetch(TDB_CONTEXT *tdb, TDB_DATA key)
 	struct list_struct rec;
 	TDB_DATA ret;
 	u32 hash;
+	int found;
+	struct tdb_batch_op *op;
 
 	/* find which hash bucket it is in */
-	hash = tdb->hash_fn(&key);
+	hash = tdb_hash(tdb, &key);
+	if (tdb->batching && (op = tdb_batch_find(tdb, key, hash)) != NULL) {
+		if (op->deleted)
+			return TDB_ERRCODE(TDB_ERR_NOEXIST, tdb_null);
+		ret.dsize = op->data.dsize;
+		ret.dptr = NULL;
+		if (ret.dsize && !(ret.dptr = malloc(ret.dsize)))
+			return TDB_ERRCODE(TDB_ERR_OOM, tdb_null);
+		if (ret.dsize)
+			memcpy(ret.dptr, op->data.dptr, ret.dsize);
+		return ret;
+	}
+	if (tdb_lookup_nolock(tdb, key, hash, &found, &ret))
+		return found ? ret : tdb_null;
+
+	/* a writer is busy with the chain: wait for it */
 	if (!(rec_ptr = tdb_find_lock_hash(tdb,key,hash,F_RDLCK,&rec)))
 		return tdb_null;
 
@@ -1110,7 +1636,10 @@ TDB_DATA tdb_fetch(TDB_CONTEXT *tdb, TDB_DATA key)
 static int tdb_exists_hash(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash)
 {
 	struct list_struct rec;
-	
+	int found;
+
+	if (tdb_lookup_nolock(tdb, key, hash, &found, NULL))
+		return found;
 	if (tdb_find_lock_hash(tdb, key, hash, F_RDLCK, &rec) == 0)
 		return 0;
 	tdb_unlock(tdb, BUCKET(rec.full_hash), F_RDLCK);
@@ -1119,7 +1648,11 @@ static int tdb_exists_hash(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash)
 
 int tdb_exists(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	u32 hash = tdb->hash_fn(&key);
+	u32 hash = tdb_hash(tdb, &key);
+	struct tdb_batch_op *op;
+
+	if (tdb->batching && (op = tdb_batch_find(tdb, key, hash)) != NULL)
+		return !op->deleted;
 	return tdb_exists_hash(tdb, key, hash);
 }
 
@@ -1375,7 +1908,7 @@ TDB_DATA tdb_nextkey(TDB_CONTEXT *tdb, TDB_DATA oldkey)
 
 	if (!tdb->travlocks.off) {
 		/* No previous element: do normal find, and lock record */
-		tdb->travlocks.off = tdb_find_lock_hash(tdb, oldkey, tdb->hash_fn(&oldkey), F_WRLCK, &rec);
+		tdb->travlocks.off = tdb_find_lock_hash(tdb, oldkey, tdb_hash(tdb, &oldkey), F_WRLCK, &rec);
 		if (!tdb->travlocks.off)
 			return tdb_null;
 		tdb->travlocks.hash = BUCKET(rec.full_hash);
@@ -1419,7 +1952,21 @@ static int tdb_delete_hash(TDB_CONTEXT *tdb, TDB_DATA key, u32 hash)
 
 int tdb_delete(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	u32 hash = tdb->hash_fn(&key);
+	u32 hash = tdb_hash(tdb, &key);
+	struct tdb_batch_op *op;
+	int exists;
+
+	if (tdb->batching) {
+		op = tdb_batch_find(tdb, key, hash);
+		exists = op ? !op->deleted : tdb_exists_hash(tdb, key, hash);
+		if (tdb->locked[BUCKET(hash)+1].count == 0) {
+			if (tdb_batch_queue(tdb, op, key, hash, NULL) == -1)
+				return -1;
+			return exists ? 0 : TDB_ERRCODE(TDB_ERR_NOEXIST, -1);
+		}
+		if (op)
+			tdb_batch_drop(tdb, op);
+	}
 	return tdb_delete_hash(tdb, key, hash);
 }
 
@@ -1433,11 +1980,30 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 	struct list_struct rec;
 	u32 hash;
 	tdb_off rec_ptr;
+	tdb_len slack = 0;
 	char *p = NULL;
 	int ret = 0;
+	struct tdb_batch_op *op;
+	int exists;
 
 	/* find which hash bucket it is in */
-	hash = tdb->hash_fn(&key);
+	hash = tdb_hash(tdb, &key);
+
+	if (tdb->batching) {
+		op = tdb_batch_find(tdb, key, hash);
+		exists = op ? !op->deleted : tdb_exists_hash(tdb, key, hash);
+		if (flag == TDB_INSERT && exists)
+			return TDB_ERRCODE(TDB_ERR_EXISTS, -1);
+		if (flag == TDB_MODIFY && !exists)
+			return TDB_ERRCODE(TDB_ERR_NOEXIST, -1);
+		if (tdb->locked[BUCKET(hash)+1].count == 0)
+			return tdb_batch_queue(tdb, op, key, hash, &dbuf);
+		/* the caller holds the chain: write it through */
+		if (op)
+			tdb_batch_drop(tdb, op);
+		flag = TDB_REPLACE;
+	}
+
 	if (tdb_lock(tdb, BUCKET(hash), F_WRLCK) == -1)
 		return -1;
 
@@ -1457,6 +2023,10 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 			 we should fail the store */
 			goto fail;
 	}
+		/* it exists but has outgrown its record: leave some room
+		   so that the next few updates can be done in place */
+		if (tdb->ecode == TDB_SUCCESS)
+			slack = dbuf.dsize / 4;
 	}
 	/* reset the error code potentially set by the tdb_update() */
 	tdb->ecode = TDB_SUCCESS;
@@ -1480,7 +2050,7 @@ int tdb_store(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, int flag)
 		memcpy(p+key.dsize, dbuf.dptr, dbuf.dsize);
 
 	/* we have to allocate some space */
-	if (!(rec_ptr = tdb_allocate(tdb, key.dsize + dbuf.dsize, &rec)))
+	if (!(rec_ptr = tdb_allocate(tdb, key.dsize + dbuf.dsize + slack, &rec)))
 		goto fail;
 
 	/* Read hash top into next ptr */
@@ -1552,8 +2122,12 @@ int tdb_append(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA new_dbuf)
 	int ret = 0;
 	size_t new_data_size = 0;
 
+	/* appends aren't queued, so catch up with the batch first */
+	if (tdb->batching && tdb_batch_apply(tdb) == -1)
+		return -1;
+
 	/* find which hash bucket it is in */
-	hash = tdb->hash_fn(&key);
+	hash = tdb_hash(tdb, &key);
 	if (tdb_lock(tdb, BUCKET(hash), F_WRLCK) == -1)
 		return -1;
 
@@ -1803,6 +2377,9 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 		goto fail;
 	}
 	tdb_mmap(tdb);
+	if (tdb->header.mutexes && !(tdb->flags & TDB_NOLOCK)
+	    && tdb_mutex_open(tdb) != 0)
+		goto fail;
 	if (locked) {
 		if (!tdb->read_only)
 			if (tdb_clear_spinlocks(tdb) != 0) {
@@ -1852,6 +2429,7 @@ TDB_CONTEXT *tdb_open_ex(const char *name, int hash_size, int tdb_flags,
 		else
 			tdb_munmap(tdb);
 	}
+	tdb_mutex_unmap(tdb);
 	SAFE_FREE(tdb->name);
 	if (tdb->fd != -1)
 		if (close(tdb->fd) != 0)
@@ -1879,6 +2457,8 @@ int tdb_close(TDB_CONTEXT *tdb)
 		else
 			tdb_munmap(tdb);
 	}
+	tdb_mutex_unmap(tdb);
+	tdb_batch_free(tdb);	/* an uncommitted batch is dropped */
 	SAFE_FREE(tdb->name);
 	if (tdb->fd != -1)
 		ret = close(tdb->fd);
@@ -1928,26 +2508,513 @@ void tdb_unlockall(TDB_CONTEXT *tdb)
 		tdb_unlock(tdb, i, F_WRLCK);
 }
 
+/* start queueing stores and deletes; see struct tdb_batch_op */
+int tdb_batch_begin(TDB_CONTEXT *tdb)
+{
+	if (tdb->read_only)
+		return TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	tdb->batching = 1;
+	return 0;
+}
+
+/* apply the queued operations and stop batching */
+int tdb_batch_commit(TDB_CONTEXT *tdb)
+{
+	int ret = tdb_batch_apply(tdb);
+
+	tdb->batching = 0;
+	return ret;
+}
+
+/* count the records on the free lists */
+int tdb_freelist_size(TDB_CONTEXT *tdb)
+{
+	struct list_struct rec;
+	tdb_off rec_ptr;
+	int c, count = 0;
+
+	if (tdb_lock(tdb, -1, F_RDLCK) == -1)
+		return -1;
+	for (c = 0; c <= TDB_FREE_CLASSES; c++) {
+		if (ofs_read(tdb, c < TDB_FREE_CLASSES ? TDB_FREELIST(c) : FREELIST_TOP,
+			     &rec_ptr) == -1)
+			goto fail;
+		while (rec_ptr) {
+			if (rec_free_read(tdb, rec_ptr, &rec) == -1)
+				goto fail;
+			count++;
+			rec_ptr = rec.next;
+		}
+	}
+	tdb_unlock(tdb, -1, F_RDLCK);
+	return count;
+ fail:
+	tdb_unlock(tdb, -1, F_RDLCK);
+	return -1;
+}
+
+/* Pack the live records together at the start of the data area, with
+   no slack, and make what is left one free record.  The file keeps its
+   size: readers that take no lock, such as read-only and TDB_NOLOCK
+   users, may have all of it mapped, and would fault on a page that
+   went away.  This needs every chain lock and fails if anyone is
+   traversing the database. */
+int tdb_repack(TDB_CONTEXT *tdb)
+{
+	struct list_struct rec;
+	char *buf = NULL, *p, *nbuf;
+	size_t used = 0, size = 0;
+	tdb_off rec_ptr, off, last = 0, top, zero = 0;
+	tdb_len len;
+	u32 i;
+	int c, ret = -1;
+
+	if (tdb->read_only || (tdb->flags & TDB_INTERNAL) || tdb->travlocks.next)
+		return TDB_ERRCODE(TDB_ERR_LOCK, -1);
+	if (tdb_lockall(tdb) == -1)
+		return -1;
+	if (tdb_lock(tdb, -1, F_WRLCK) == -1) {
+		tdb_unlockall(tdb);
+		return -1;
+	}
+	/* must know about any previous expansions by another process */
+	tdb_oob(tdb, tdb->map_size + 1, 1);
+
+	/* take a copy of every live record */
+	for (i = 0; i < tdb->header.hash_size; i++) {
+		if (ofs_read(tdb, TDB_HASH_TOP(i), &rec_ptr) == -1)
+			goto out;
+		for (; rec_ptr; rec_ptr = rec.next) {
+			if (rec_read(tdb, rec_ptr, &rec) == -1)
+				goto out;
+			/* a traversal elsewhere holds a lock on its record */
+			if (write_lock_record(tdb, rec_ptr) == -1) {
+				tdb->ecode = TDB_ERR_LOCK;
+				goto out;
+			}
+			write_unlock_record(tdb, rec_ptr);
+			if (TDB_DEAD(&rec))
+				continue;
+			len = rec.key_len + rec.data_len;
+			if (used + sizeof(rec) + len > size) {
+				size = 2 * (used + sizeof(rec) + len);
+				if (!(nbuf = realloc(buf, size))) {
+					tdb->ecode = TDB_ERR_OOM;
+					goto out;
+				}
+				buf = nbuf;
+			}
+			memcpy(buf + used, &rec, sizeof(rec));
+			if (tdb_read(tdb, rec_ptr + sizeof(rec), buf + used + sizeof(rec),
+				     len, 0) == -1)
+				goto out;
+			used += sizeof(rec) + len;
+		}
+	}
+
+	/* empty the hash chains and the free lists */
+	for (i = 0; i < tdb->header.hash_size; i++)
+		if (ofs_write(tdb, TDB_HASH_TOP(i), &zero) == -1)
+			goto out;
+	for (c = 0; c < TDB_FREE_CLASSES; c++)
+		if (ofs_write(tdb, TDB_FREELIST(c), &zero) == -1)
+			goto out;
+	if (ofs_write(tdb, FREELIST_TOP, &zero) == -1)
+		goto out;
+
+	/* and write the records back, one after another */
+	off = TDB_DATA_START(tdb);
+	for (p = buf; p < buf + used; p += sizeof(rec) + len) {
+		memcpy(&rec, p, sizeof(rec));
+		len = rec.key_len + rec.data_len;
+		rec.rec_len = TDB_ALIGN(len + sizeof(tdb_off), TDB_ALIGNMENT);
+		top = TDB_HASH_TOP(BUCKET(rec.full_hash));
+		if (ofs_read(tdb, top, &rec.next) == -1
+		    || rec_write(tdb, off, &rec) == -1
+		    || tdb_write(tdb, off + sizeof(rec), p + sizeof(rec), len) == -1
+		    || update_tailer(tdb, off, &rec) == -1
+		    || ofs_write(tdb, top, &off) == -1)
+			goto out;
+		last = off;
+		off += sizeof(rec) + rec.rec_len;
+	}
+
+	/* what is left over becomes free space */
+	if (tdb->map_size - off >= MIN_REC_SIZE) {
+		memset(&rec, '\0', sizeof(rec));
+		rec.rec_len = tdb->map_size - off - sizeof(rec);
+		if (tdb_free(tdb, off, &rec) == -1)
+			goto out;
+	} else if (tdb->map_size > off && last) {
+		if (rec_read(tdb, last, &rec) == -1)
+			goto out;
+		rec.rec_len += tdb->map_size - off;
+		if (rec_write(tdb, last, &rec) == -1 || update_tailer(tdb, last, &rec) == -1)
+			goto out;
+	}
+	ret = 0;
+
+ out:
+	SAFE_FREE(buf);
+	tdb_unlock(tdb, -1, F_WRLCK);
+	tdb_unlockall(tdb);
+	return ret;
+}
+
+/* A snapshot is a file holding a copy of every record, for readers
+   that want to look at the database often but must not slow down its
+   writers: a header, then an index of the records sorted by key, then
+   the keys and data.  It is written to a temporary file and renamed
+   into place, so a reader that has it mapped keeps a consistent copy
+   however often it is rewritten, and needs no locks at all.  Offsets
+   are from the start of the file, in the writer's byte order. */
+#define TDB_SNAP_MAGIC "TDB snap"
+#define TDB_SNAP_VERSION 1
+
+struct tdb_snap_header {
+	char magic[8];
+	u32 version;
+	u32 count; /* entries in the index */
+};
+
+struct tdb_snap_entry {
+	u32 key_off;
+	u32 key_len;
+	u32 data_off;
+	u32 data_len;
+};
+
+struct tdb_snapshot {
+	char *map;
+	size_t size;
+	u32 count;
+	const struct tdb_snap_entry *index;
+};
+
+/* the records collected so far, with offsets into data */
+struct tdb_snap_buf {
+	struct tdb_snap_entry *ents;
+	u32 count, room;
+	char *data;
+	size_t used, size;
+};
+
+/* for the qsort comparison */
+static const char *tdb_snap_data;
+
+static int tdb_snap_cmp(const void *a, const void *b)
+{
+	const struct tdb_snap_entry *x = a, *y = b;
+	int c = memcmp(tdb_snap_data + x->key_off, tdb_snap_data + y->key_off,
+		       x->key_len < y->key_len ? x->key_len : y->key_len);
+
+	if (c == 0)
+		c = (x->key_len > y->key_len) - (x->key_len < y->key_len);
+	return c;
+}
+
+/* Copy the live records of one chain into sb.  Without a lock, the
+   copy is made straight from the mapping and checked against the
+   chain's change counter as tdb_find_nolock does; 0 means a writer
+   got in the way and nothing was added.  Returns 1 when done, or -1
+   on an error. */
+static int tdb_snap_chain(TDB_CONTEXT *tdb, u32 list, struct tdb_snap_buf *sb,
+			  int nolock)
+{
+	volatile u32 *seqp = NULL;
+	struct list_struct rec;
+	struct tdb_snap_entry *ne;
+	tdb_off rec_ptr;
+	tdb_len len, room;
+	size_t used = sb->used;
+	u32 count = sb->count, seq = 0;
+	char *nd;
+
+	if (nolock) {
+		if (!tdb->map_ptr || tdb->header.seqnums == 0
+		    || tdb->header.seqnums + TDB_SEQNUM_SIZE(tdb->header.hash_size) > tdb->map_size)
+			return 0;
+		seqp = TDB_SEQNUM(tdb, list);
+		seq = *seqp;
+		if (seq & 1)
+			return 0;
+		__sync_synchronize();
+		memcpy(&rec_ptr, (char *)tdb->map_ptr + TDB_HASH_TOP(list), sizeof(rec_ptr));
+		if (DOCONV())
+			convert(&rec_ptr, sizeof(rec_ptr));
+	} else if (ofs_read(tdb, TDB_HASH_TOP(list), &rec_ptr) == -1)
+		return -1;
+
+	for (; rec_ptr; rec_ptr = rec.next) {
+		if (nolock) {
+			if (rec_ptr > tdb->map_size - sizeof(rec))
+				goto busy;
+			memcpy(&rec, (char *)tdb->map_ptr + rec_ptr, sizeof(rec));
+			if (DOCONV())
+				convert(&rec, sizeof(rec));
+			room = tdb->map_size - sizeof(rec) - rec_ptr;
+			if (TDB_BAD_MAGIC(&rec) || rec.key_len > room
+			    || rec.data_len > room - rec.key_len)
+				goto busy;
+		} else if (rec_read(tdb, rec_ptr, &rec) == -1)
+			return -1;
+		if (TDB_DEAD(&rec))
+			continue;
+
+		len = rec.key_len + rec.data_len;
+		if (sb->used + len > sb->size) {
+			if (!(nd = realloc(sb->data, 2 * (sb->used + len))))
+				return TDB_ERRCODE(TDB_ERR_OOM, -1);
+			sb->data = nd;
+			sb->size = 2 * (sb->used + len);
+		}
+		if (sb->count == sb->room) {
+			if (!(ne = realloc(sb->ents, 2 * (sb->room + 16) * sizeof(*ne))))
+				return TDB_ERRCODE(TDB_ERR_OOM, -1);
+			sb->ents = ne;
+			sb->room = 2 * (sb->room + 16);
+		}
+		if (nolock)
+			memcpy(sb->data + sb->used, (char *)tdb->map_ptr + rec_ptr + sizeof(rec), len);
+		else if (tdb_read(tdb, rec_ptr + sizeof(rec), sb->data + sb->used, len, 0) == -1)
+			return -1;
+		ne = &sb->ents[sb->count++];
+		ne->key_off = sb->used;
+		ne->key_len = rec.key_len;
+		ne->data_off = sb->used + rec.key_len;
+		ne->data_len = rec.data_len;
+		sb->used += len;
+
+		/* a chain can only loop while it's being changed */
+		if (nolock && *seqp != seq)
+			goto busy;
+	}
+	if (nolock) {
+		__sync_synchronize();
+		if (*seqp != seq)
+			goto busy;
+	}
+	return 1;
+
+ busy:
+	sb->used = used;
+	sb->count = count;
+	return 0;
+}
+
+/* Write a snapshot of the database to the file name.  Each chain is
+   copied without a lock if that can be done in a few tries, and under
+   a read lock otherwise, so writers are held up for at most the time
+   it takes to copy one chain; the snapshot as a whole is not taken at
+   one instant. */
+int tdb_snapshot(TDB_CONTEXT *tdb, const char *name)
+{
+	struct tdb_snap_buf sb;
+	struct tdb_snap_header hdr;
+	char *tmp = NULL;
+	size_t base;
+	u32 i;
+	int fd = -1, r, try, ret = -1;
+
+	memset(&sb, 0, sizeof(sb));
+	for (i = 0; i < tdb->header.hash_size; i++) {
+		for (r = 0, try = 0; r == 0 && try < TDB_NOLOCK_TRIES; try++)
+			r = tdb_snap_chain(tdb, i, &sb, 1);
+		if (r == 0) {
+			if (tdb_lock(tdb, i, F_RDLCK) == -1)
+				goto out;
+			r = tdb_snap_chain(tdb, i, &sb, 0);
+			tdb_unlock(tdb, i, F_RDLCK);
+		}
+		if (r == -1)
+			goto out;
+	}
+
+	base = sizeof(hdr) + (size_t)sb.count * sizeof(struct tdb_snap_entry);
+	if (base + sb.used > 0xFFFFFFFFU) {
+		tdb->ecode = TDB_ERR_OOM;
+		goto out;
+	}
+	tdb_snap_data = sb.data;
+	if (sb.count)
+		qsort(sb.ents, sb.count, sizeof(*sb.ents), tdb_snap_cmp);
+	for (i = 0; i < sb.count; i++) {
+		sb.ents[i].key_off += base;
+		sb.ents[i].data_off += base;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TDB_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = TDB_SNAP_VERSION;
+	hdr.count = sb.count;
+
+	if (!(tmp = malloc(strlen(name) + 8))) {
+		tdb->ecode = TDB_ERR_OOM;
+		goto out;
+	}
+	sprintf(tmp, "%s.XXXXXX", name);
+	if ((fd = mkstemp(tmp)) == -1) {
+		SAFE_FREE(tmp);
+		tdb->ecode = TDB_ERR_IO;
+		goto out;
+	}
+	if (fchmod(fd, 0644) == -1
+	    || write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)
+	    || (sb.count && write(fd, sb.ents, base - sizeof(hdr)) != (ssize_t)(base - sizeof(hdr)))
+	    || (sb.used && write(fd, sb.data, sb.used) != (ssize_t)sb.used)
+	    || close(fd) == -1) {
+		fd = -1;
+		tdb->ecode = TDB_ERR_IO;
+		goto out;
+	}
+	fd = -1;
+	if (rename(tmp, name) == -1) {
+		tdb->ecode = TDB_ERR_IO;
+		goto out;
+	}
+	SAFE_FREE(tmp);
+	ret = 0;
+
+ out:
+	if (fd != -1)
+		close(fd);
+	if (tmp) {
+		unlink(tmp);
+		free(tmp);
+	}
+	SAFE_FREE(sb.ents);
+	SAFE_FREE(sb.data);
+	return ret;
+}
+
+/* Map a snapshot written by tdb_snapshot, checking that every entry
+   lies within the file so that lookups needn't. */
+TDB_SNAPSHOT *tdb_snapshot_open(const char *name)
+{
+	TDB_SNAPSHOT *snap;
+	struct tdb_snap_header hdr;
+	const struct tdb_snap_entry *e;
+	struct stat st;
+	void *map;
+	u32 i;
+	int fd;
+
+	if ((fd = open(name, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(hdr)
+	    || st.st_size > 0xFFFFFFFFU) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (memcmp(hdr.magic, TDB_SNAP_MAGIC, sizeof(hdr.magic)) != 0
+	    || hdr.version != TDB_SNAP_VERSION
+	    || hdr.count > (st.st_size - sizeof(hdr)) / sizeof(*e))
+		goto bad;
+	e = (const struct tdb_snap_entry *)((char *)map + sizeof(hdr));
+	for (i = 0; i < hdr.count; i++)
+		if (e[i].key_off > st.st_size || e[i].key_len > st.st_size - e[i].key_off
+		    || e[i].data_off > st.st_size
+		    || e[i].data_len > st.st_size - e[i].data_off)
+			goto bad;
+	if (!(snap = malloc(sizeof(*snap)))) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	snap->map = map;
+	snap->size = st.st_size;
+	snap->count = hdr.count;
+	snap->index = e;
+	return snap;
+
+ bad:
+	munmap(map, st.st_size);
+	errno = EINVAL;
+	return NULL;
+}
+
+void tdb_snapshot_close(TDB_SNAPSHOT *snap)
+{
+	munmap(snap->map, snap->size);
+	free(snap);
+}
+
+/* Find key in a snapshot.  The data returned points into the mapping,
+   so it is not to be freed, and is only valid until the snapshot is
+   closed; it needn't be aligned. */
+TDB_DATA tdb_snapshot_fetch(TDB_SNAPSHOT *snap, TDB_DATA key)
+{
+	const struct tdb_snap_entry *e;
+	TDB_DATA ret = tdb_null;
+	u32 lo = 0, hi = snap->count, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = &snap->index[mid];
+		c = memcmp(key.dptr, snap->map + e->key_off,
+			   key.dsize < e->key_len ? key.dsize : e->key_len);
+		if (c == 0)
+			c = (key.dsize > e->key_len) - (key.dsize < e->key_len);
+		if (c == 0) {
+			ret.dptr = snap->map + e->data_off;
+			ret.dsize = e->data_len;
+			break;
+		}
+		if (c < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return ret;
+}
+
+/* Call fn on each record of a snapshot, in key order, with a NULL
+   context, until it returns non-zero.  Returns the number of records
+   visited. */
+int tdb_snapshot_traverse(TDB_SNAPSHOT *snap, tdb_traverse_func fn, void *private)
+{
+	const struct tdb_snap_entry *e;
+	TDB_DATA key, dbuf;
+	u32 i;
+
+	for (i = 0; i < snap->count; i++) {
+		e = &snap->index[i];
+		key.dptr = snap->map + e->key_off;
+		key.dsize = e->key_len;
+		dbuf.dptr = snap->map + e->data_off;
+		dbuf.dsize = e->data_len;
+		if (fn(NULL, key, dbuf, private))
+			return i + 1;
+	}
+	return i;
+}
+
 /* lock/unlock one hash chain. This is meant to be used to reduce
    contention - it cannot guarantee how many records will be locked */
 int tdb_chainlock(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	return tdb_lock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	return tdb_lock(tdb, BUCKET(tdb_hash(tdb, &key)), F_WRLCK);
 }
 
 int tdb_chainunlock(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	return tdb_unlock(tdb, BUCKET(tdb->hash_fn(&key)), F_WRLCK);
+	return tdb_unlock(tdb, BUCKET(tdb_hash(tdb, &key)), F_WRLCK);
 }
 
 int tdb_chainlock_read(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	return tdb_lock(tdb, BUCKET(tdb->hash_fn(&key)), F_RDLCK);
+	return tdb_lock(tdb, BUCKET(tdb_hash(tdb, &key)), F_RDLCK);
 }
 
 int tdb_chainunlock_read(TDB_CONTEXT *tdb, TDB_DATA key)
 {
-	return tdb_unlock(tdb, BUCKET(tdb->hash_fn(&key)), F_RDLCK);
+	return tdb_unlock(tdb, BUCKET(tdb_hash(tdb, &key)), F_RDLCK);
 }
 
 
@@ -1985,6 +3052,12 @@ int tdb_reopen(TDB_CONTEXT *tdb)
 		goto fail;
 	}
 	tdb_mmap(tdb);
+	/* the mutexes stay mapped, but the active lock went with the fd */
+	if (tdb->mutex_ptr && !(tdb->flags & TDB_CLEAR_IF_FIRST)
+	    && tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0) == -1) {
+		TDB_LOG((tdb, 0, "tdb_reopen: failed to obtain active lock\n"));
+		goto fail;
+	}
 	if ((tdb->flags & TDB_CLEAR_IF_FIRST) && (tdb_brlock(tdb, ACTIVE_LOCK, F_RDLCK, F_SETLKW, 0) == -1)) {
 		TDB_LOG((tdb, 0, "tdb_reopen: failed to obtain active lock\n"));
 		goto fail;
@@ -2011,3 +3084,272 @@ int tdb_reopen_all(void)
 
 	return 0;
 }
+
+#ifdef TDB_BENCH
+/*
+ * Contention benchmark: "make tdbbench".  Forks writers which keep
+ * rewriting session entries and their keys as pppd does when its
+ * environment changes, and readers which look sessions up by key, as
+ * pppd-sessions does, with an occasional traversal.  This is done on a
+ * database with fcntl chain locks and then on one with mutexes, and
+ * the rate and latency percentiles of each kind of operation are
+ * reported for each.
+ */
+#include <sys/wait.h>
+#include <time.h>
+
+enum { OP_STORE, OP_FETCH, OP_DELETE, OP_TRAVERSE, NOPS };
+
+static const char *op_names[NOPS] = { "store", "fetch", "delete", "traverse" };
+
+/* latencies in ns, 8 buckets to each power of two */
+#define HIST_SUB	8
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+struct bench_hist {
+	unsigned long count[NOPS];
+	unsigned long bucket[NOPS][HIST_BUCKETS];
+};
+
+static int hist_index(unsigned long ns)
+{
+	int b = 0;
+
+	while ((ns >> b) >= 2 * HIST_SUB)
+		++b;
+	return b * HIST_SUB + (ns >> b);
+}
+
+/* the least latency counted in bucket i */
+static unsigned long hist_value(int i)
+{
+	int b = i < 2 * HIST_SUB ? 0 : i / HIST_SUB - 1;
+
+	return (unsigned long)(i - b * HIST_SUB) << b;
+}
+
+static unsigned long bench_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static void bench_note(struct bench_hist *h, int op, unsigned long t0)
+{
+	h->count[op]++;
+	h->bucket[op][hist_index(bench_ns() - t0)]++;
+}
+
+static int bench_count(TDB_CONTEXT *tdb, TDB_DATA key, TDB_DATA dbuf, void *n)
+{
+	++*(int *)n;
+	return 0;
+}
+
+/* a session's entry, about as long as pppd's */
+static TDB_DATA bench_entry(char *buf, int len, int i, int gen)
+{
+	TDB_DATA d;
+	int n;
+
+	n = snprintf(buf, len, "IFNAME=ppp%d;UNIT=%d;PEERNAME=user%d;"
+		     "IPLOCAL=10.0.0.1;IPREMOTE=10.%d.%d.%d;GEN=%d;", i, i, i,
+		     (i >> 16) & 255, (i >> 8) & 255, i & 255, gen);
+	memset(buf + n, 'x', len - n);		/* the rest of the environment */
+	d.dptr = buf;
+	d.dsize = len - (gen & 63);
+	return d;
+}
+
+static void bench_child(const char *name, int writer, int nsess,
+			unsigned long until, struct bench_hist *h)
+{
+	TDB_CONTEXT *tdb;
+	TDB_DATA key, val, d;
+	char kbuf[32], vbuf[32], ebuf[640];
+	unsigned int seed = getpid();
+	unsigned long t0;
+	int i, gen = 0, n;
+
+	tdb = tdb_open(name, 0, 0, O_RDWR, 0);
+	if (tdb == NULL) {
+		perror(name);
+		_exit(1);
+	}
+	while (bench_ns() < until) {
+		i = rand_r(&seed) % nsess;
+		snprintf(vbuf, sizeof(vbuf), "pppd%d", i);
+		snprintf(kbuf, sizeof(kbuf), "IFNAME=ppp%d", i);
+		if (writer) {
+			key.dptr = vbuf;
+			key.dsize = strlen(vbuf);
+			d = bench_entry(ebuf, sizeof(ebuf), i, ++gen);
+			t0 = bench_ns();
+			tdb_store(tdb, key, d, TDB_REPLACE);
+			bench_note(h, OP_STORE, t0);
+			key.dptr = kbuf;
+			key.dsize = strlen(kbuf);
+			if (gen % 8 == 0) {
+				t0 = bench_ns();
+				tdb_delete(tdb, key);
+				bench_note(h, OP_DELETE, t0);
+			}
+			val.dptr = vbuf;
+			val.dsize = strlen(vbuf);
+			t0 = bench_ns();
+			tdb_store(tdb, key, val, TDB_REPLACE);
+			bench_note(h, OP_STORE, t0);
+		} else if (++gen % 1000 == 0) {
+			n = 0;
+			t0 = bench_ns();
+			tdb_traverse(tdb, bench_count, &n);
+			bench_note(h, OP_TRAVERSE, t0);
+		} else {
+			key.dptr = kbuf;
+			key.dsize = strlen(kbuf);
+			t0 = bench_ns();
+			val = tdb_fetch(tdb, key);
+			bench_note(h, OP_FETCH, t0);
+			if (val.dptr == NULL)
+				continue;
+			t0 = bench_ns();
+			d = tdb_fetch(tdb, val);
+			bench_note(h, OP_FETCH, t0);
+			free(val.dptr);
+			free(d.dptr);
+		}
+	}
+	tdb_close(tdb);
+	_exit(0);
+}
+
+static unsigned long hist_percentile(unsigned long *b, unsigned long n, int pm)
+{
+	unsigned long want = (n * pm + 999) / 1000, sum = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		sum += b[i];
+		if (sum >= want && sum > 0)
+			return hist_value(i);
+	}
+	return 0;
+}
+
+static void bench_run(const char *name, int flags, int writers, int readers,
+		      int nsess, int secs)
+{
+	struct bench_hist *h, total;
+	TDB_CONTEXT *tdb;
+	TDB_DATA key, val, d;
+	char kbuf[32], vbuf[32], ebuf[640];
+	unsigned long until;
+	int i, j, op, nproc = writers + readers;
+
+	unlink(name);
+	tdb = tdb_open(name, 8191, TDB_SIPHASH | flags, O_RDWR | O_CREAT, 0600);
+	if (tdb == NULL) {
+		perror(name);
+		exit(1);
+	}
+	for (i = 0; i < nsess; i++) {
+		snprintf(vbuf, sizeof(vbuf), "pppd%d", i);
+		snprintf(kbuf, sizeof(kbuf), "IFNAME=ppp%d", i);
+		key.dptr = vbuf;
+		key.dsize = strlen(vbuf);
+		d = bench_entry(ebuf, sizeof(ebuf), i, 0);
+		tdb_store(tdb, key, d, TDB_REPLACE);
+		key.dptr = kbuf;
+		key.dsize = strlen(kbuf);
+		val.dptr = vbuf;
+		val.dsize = strlen(vbuf);
+		tdb_store(tdb, key, val, TDB_REPLACE);
+	}
+	tdb_close(tdb);
+
+	h = mmap(NULL, nproc * sizeof(*h), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (h == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	memset(h, 0, nproc * sizeof(*h));
+	until = bench_ns() + secs * 1000000000UL;
+	for (i = 0; i < nproc; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			exit(1);
+		}
+		if (pid == 0)
+			bench_child(name, i < writers, nsess, until, &h[i]);
+	}
+	while (wait(NULL) > 0)
+		;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nproc; i++)
+		for (op = 0; op < NOPS; op++) {
+			total.count[op] += h[i].count[op];
+			for (j = 0; j < HIST_BUCKETS; j++)
+				total.bucket[op][j] += h[i].bucket[op][j];
+		}
+	munmap(h, nproc * sizeof(*h));
+	unlink(name);
+
+	printf("%s locks, %d writers, %d readers, %d sessions:\n",
+	       (flags & TDB_NOMUTEX) ? "fcntl" : "mutex", writers, readers,
+	       nsess);
+	printf("  %-9s %10s %9s %9s %9s %9s  (us)\n", "", "ops/s", "p50",
+	       "p99", "p99.9", "max");
+	for (op = 0; op < NOPS; op++) {
+		unsigned long n = total.count[op], max = 0;
+
+		if (n == 0)
+			continue;
+		for (j = 0; j < HIST_BUCKETS; j++)
+			if (total.bucket[op][j])
+				max = hist_value(j);
+		printf("  %-9s %10lu %9.1f %9.1f %9.1f %9.1f\n", op_names[op],
+		       n / secs, hist_percentile(total.bucket[op], n, 500) / 1e3,
+		       hist_percentile(total.bucket[op], n, 990) / 1e3,
+		       hist_percentile(total.bucket[op], n, 999) / 1e3, max / 1e3);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *name = "/tmp/tdbbench.tdb", *locks = "both";
+	int writers = 2, readers = 4, nsess = 1000, secs = 3, c;
+
+	while ((c = getopt(argc, argv, "w:r:s:t:l:f:")) != -1) {
+		switch (c) {
+		case 'w': writers = atoi(optarg); break;
+		case 'r': readers = atoi(optarg); break;
+		case 's': nsess = atoi(optarg); break;
+		case 't': secs = atoi(optarg); break;
+		case 'l': locks = optarg; break;
+		case 'f': name = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-w writers] [-r readers] "
+				"[-s sessions] [-t seconds] [-l fcntl|mutex|both] "
+				"[-f file]\n", argv[0]);
+			exit(2);
+		}
+	}
+	if (writers < 0 || readers < 0 || writers + readers == 0
+	    || nsess < 1 || secs < 1) {
+		fprintf(stderr, "%s: bad arguments\n", argv[0]);
+		exit(2);
+	}
+	if (strcmp(locks, "mutex") != 0)
+		bench_run(name, TDB_NOMUTEX, writers, readers, nsess, secs);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if (strcmp(locks, "fcntl") != 0)
+		bench_run(name, 0, writers, readers, nsess, secs);
+#endif
+	return 0;
+}
+#endif /* TDB_BENCH */
@@ -58,6 +58,12 @@ extern "C" {
 #define TDB_NOMMAP   8 /* don't use mmap */
 #define TDB_CONVERT 16 /* convert endian (internal use) */
 #define TDB_BIGENDIAN 32 /* header is big-endian (internal use) */
+#define TDB_SIPHASH 64 /* hash keys with keyed SipHash (new databases) */
+#define TDB_NOMUTEX 128 /* chain locks are fcntl locks (new databases) */
+
+/* hash functions recorded in the header */
+#define TDB_HASH_DEFAULT 0
+#define TDB_HASH_SIPHASH 1
 
 #define TDB_ERRCODE(code, ret) ((tdb->ecode = (code)), ret)
 
@@ -84,7 +90,12 @@ struct tdb_header {
 	u32 version; /* version of the code */
 	u32 hash_size; /* number of hash entries */
 	tdb_off rwlocks;
-	tdb_off reserved[31];
+	tdb_off seqnums; /* per-chain change counters for lockless reads */
+	tdb_off mutexes; /* page-aligned offset of the chain mutexes, or 0 */
+	u32 hash_kind; /* TDB_HASH_* function used for this database */
+	u32 hash_key[4]; /* secret key for TDB_HASH_SIPHASH */
+	tdb_off freelists[8]; /* free lists by size class */
+	tdb_off reserved[16];
 };
 
 struct tdb_lock_type {
@@ -104,6 +115,7 @@ typedef struct tdb_context {
 	void *map_ptr; /* where it is currently mapped */
 	int fd; /* open file descriptor for the database */
 	tdb_len map_size; /* how much space has been mapped */
+	void *mutex_ptr; /* chain mutexes, mapped on their own */
 	int read_only; /* opened read-only */
 	struct tdb_lock_type *locked; /* array of chain locks */
 	enum TDB_ERROR ecode; /* error code for last tdb error */
@@ -116,9 +128,14 @@ typedef struct tdb_context {
 	void (*log_fn)(struct tdb_context *tdb, int level, const char *, ...) PRINTF_ATTRIBUTE(3,4); /* logging function */
 	u32 (*hash_fn)(TDB_DATA *key);
 	int open_flags; /* flags used in the open - needed by reopen */
+	int batching; /* between tdb_batch_begin and tdb_batch_commit */
+	struct tdb_batch_op *batch; /* stores and deletes queued meanwhile */
 } TDB_CONTEXT;
 
 typedef int (*tdb_traverse_func)(TDB_CONTEXT *, TDB_DATA, TDB_DATA, void *);
+
+/* a read-only copy of a database, from tdb_snapshot */
+typedef struct tdb_snapshot TDB_SNAPSHOT;
 typedef void (*tdb_log_func)(TDB_CONTEXT *, int , const char *, ...);
 typedef u32 (*tdb_hash_func)(TDB_DATA *key);
 
@@ -147,6 +164,15 @@ int tdb_lockkeys(TDB_CONTEXT *tdb, u32 number, TDB_DATA keys[]);
 void tdb_unlockkeys(TDB_CONTEXT *tdb);
 int tdb_lockall(TDB_CONTEXT *tdb);
 void tdb_unlockall(TDB_CONTEXT *tdb);
+int tdb_batch_begin(TDB_CONTEXT *tdb);
+int tdb_batch_commit(TDB_CONTEXT *tdb);
+int tdb_freelist_size(TDB_CONTEXT *tdb);
+int tdb_repack(TDB_CONTEXT *tdb);
+int tdb_snapshot(TDB_CONTEXT *tdb, const char *name);
+TDB_SNAPSHOT *tdb_snapshot_open(const char *name);
+void tdb_snapshot_close(TDB_SNAPSHOT *snap);
+TDB_DATA tdb_snapshot_fetch(TDB_SNAPSHOT *snap, TDB_DATA key);
+int tdb_snapshot_traverse(TDB_SNAPSHOT *snap, tdb_traverse_func fn, void *);
 
 /* Low level locking functions: use with care */
 void tdb_set_lock_alarm(sig_atomic_t *palarm);
@@ -31,6 +31,9 @@
 #endif
 
 #include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/x509v3.h>
@@ -88,6 +91,92 @@ static inline int SSL_CTX_set_max_proto_version(SSL_CTX *ctx, long tls_ver_max)
 #endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
 
+/*
+ * Check the peer's own certificate: its key usage, if asked, and its
+ * name and the certificate itself against what we expect of the peer.
+ */
+static int tls_check_peer(X509 *peer_cert, struct tls_info *inf, int ok)
+{
+    char subject[256];
+    char cn_str[256];
+    char *ptr1 = NULL, *ptr2 = NULL;
+
+    /* Verify certificate based on certificate type and extended key usage */
+    if (tls_verify_key_usage) {
+        int purpose = inf->client ? X509_PURPOSE_SSL_SERVER : X509_PURPOSE_SSL_CLIENT ;
+        if (X509_check_purpose(peer_cert, purpose, 0) == 0) {
+            error("Certificate verification error: nsCertType mismatch");
+            return 0;
+        }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+        int flags = inf->client ? XKU_SSL_SERVER : XKU_SSL_CLIENT;
+        if (!(X509_get_extended_key_usage(peer_cert) & flags)) {
+            error("Certificate verification error: invalid extended key usage");
+            return 0;
+        }
+#endif
+        info("Certificate key usage: OK");
+    }
+
+    /*
+     * If acting as client and the name of the server wasn't specified
+     * explicitely, we can't verify the server authenticity 
+     */
+    if (!tls_verify_method)
+        tls_verify_method = TLS_VERIFY_NONE;
+
+    if (!inf->peer_name || !strcmp(TLS_VERIFY_NONE, tls_verify_method)) {
+        warn("Certificate verication disabled or no peer name was specified");
+        return ok;
+    }
+
+    /* This is the peer certificate */
+    X509_NAME_oneline(X509_get_subject_name(peer_cert),
+              subject, 256);
+
+    X509_NAME_get_text_by_NID(X509_get_subject_name(peer_cert),
+                  NID_commonName, cn_str, 256);
+
+    /* Verify based on subject name */
+    ptr1 = inf->peer_name;
+    if (!strcmp(TLS_VERIFY_SUBJECT, tls_verify_method)) {
+        ptr2 = subject;
+    }
+
+    /* Verify based on common name (default) */
+    if (strlen(tls_verify_method) == 0 ||
+        !strcmp(TLS_VERIFY_NAME, tls_verify_method)) {
+        ptr2 = cn_str;
+    }
+
+    /* Match the suffix of common name */
+    if (!strcmp(TLS_VERIFY_SUFFIX, tls_verify_method)) {
+        int len = strlen(ptr1);
+        int off = strlen(cn_str) - len;
+        ptr2 = cn_str;
+        if (off > 0) {
+            ptr2 = cn_str + off;
+        }
+    }
+
+    if (strcmp(ptr1, ptr2)) {
+        error("Certificate verification error: CN (%s) != %s", ptr1, ptr2);
+        return 0;
+    }
+
+    if (inf->peer_cert) { 
+        if (X509_cmp(inf->peer_cert, peer_cert) != 0) {
+            error("Peer certificate doesn't match stored certificate");
+            return 0;
+        }
+    }
+
+    info("Certificate CN: %s, peer name %s", cn_str, inf->peer_name);
+
+    return ok;
+}
+
 /*
  * Verify a certificate. Most of the work (signatures and issuer attributes checking)
  * is done by ssl; we check the CN in the peer certificate against the peer name.
@@ -100,7 +189,6 @@ static int tls_verify_callback(int ok, X509_STORE_CTX *ctx)
     int err, depth;
     SSL *ssl;
     struct tls_info *inf;
-    char *ptr1 = NULL, *ptr2 = NULL;
 
     peer_cert = X509_STORE_CTX_get_current_cert(ctx);
     err = X509_STORE_CTX_get_error(ctx);
@@ -133,81 +221,8 @@ static int tls_verify_callback(int ok, X509_STORE_CTX *ctx)
 
     tls_log_sslerr();
 
-    if (!depth) 
-    {
-        /* Verify certificate based on certificate type and extended key usage */
-        if (tls_verify_key_usage) {
-            int purpose = inf->client ? X509_PURPOSE_SSL_SERVER : X509_PURPOSE_SSL_CLIENT ;
-            if (X509_check_purpose(peer_cert, purpose, 0) == 0) {
-                error("Certificate verification error: nsCertType mismatch");
-                return 0;
-            }
-
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-            int flags = inf->client ? XKU_SSL_SERVER : XKU_SSL_CLIENT;
-            if (!(X509_get_extended_key_usage(peer_cert) & flags)) {
-                error("Certificate verification error: invalid extended key usage");
-                return 0;
-            }
-#endif
-            info("Certificate key usage: OK");
-        }
-
-        /*
-         * If acting as client and the name of the server wasn't specified
-         * explicitely, we can't verify the server authenticity 
-         */
-        if (!tls_verify_method)
-            tls_verify_method = TLS_VERIFY_NONE;
-
-        if (!inf->peer_name || !strcmp(TLS_VERIFY_NONE, tls_verify_method)) {
-            warn("Certificate verication disabled or no peer name was specified");
-            return ok;
-        }
-
-        /* This is the peer certificate */
-        X509_NAME_oneline(X509_get_subject_name(peer_cert),
-                  subject, 256);
-
-        X509_NAME_get_text_by_NID(X509_get_subject_name(peer_cert),
-                      NID_commonName, cn_str, 256);
-
-        /* Verify based on subject name */
-        ptr1 = inf->peer_name;
-        if (!strcmp(TLS_VERIFY_SUBJECT, tls_verify_method)) {
-            ptr2 = subject;
-        }
-
-        /* Verify based on common name (default) */
-        if (strlen(tls_verify_method) == 0 ||
-            !strcmp(TLS_VERIFY_NAME, tls_verify_method)) {
-            ptr2 = cn_str;
-        }
-
-        /* Match the suffix of common name */
-        if (!strcmp(TLS_VERIFY_SUFFIX, tls_verify_method)) {
-            int len = strlen(ptr1);
-            int off = strlen(cn_str) - len;
-            ptr2 = cn_str;
-            if (off > 0) {
-                ptr2 = cn_str + off;
-            }
-        }
-
-        if (strcmp(ptr1, ptr2)) {
-            error("Certificate verification error: CN (%s) != %s", ptr1, ptr2);
-            return 0;
-        }
-
-        if (inf->peer_cert) { 
-            if (X509_cmp(inf->peer_cert, peer_cert) != 0) {
-                error("Peer certificate doesn't match stored certificate");
-                return 0;
-            }
-        }
-
-        info("Certificate CN: %s, peer name %s", cn_str, inf->peer_name);
-    }
+    if (!depth)
+        ok = tls_check_peer(peer_cert, inf, ok);
 
     return ok;
 }
@@ -217,6 +232,9 @@ int tls_init()
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
     SSL_library_init();
     SSL_load_error_strings();
+#else
+    OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS
+		     | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, NULL);
 #endif
     return 0;
 }
@@ -282,6 +300,48 @@ void tls_free_verify_info(struct tls_info **in) {
     }
 }
 
+/*
+ * A resumed session skips the certificate exchange, and with it
+ * tls_verify_callback; make the same checks of the certificate the
+ * peer had when the session was first set up.
+ */
+int tls_verify_session(SSL *ssl)
+{
+    struct tls_info *inf;
+    X509 *peer_cert;
+    long err;
+    int ok;
+
+    inf = (struct tls_info*) SSL_get_ex_data(ssl, 0);
+    if (inf == NULL) {
+        error("Error: SSL_get_ex_data returned NULL");
+        return -1;
+    }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    peer_cert = SSL_get1_peer_certificate(ssl);
+#else
+    peer_cert = SSL_get_peer_certificate(ssl);
+#endif
+    if (peer_cert == NULL) {
+        error("Resumed TLS session has no peer certificate");
+        return -1;
+    }
+
+    err = SSL_get_verify_result(ssl);
+    ok = (err == X509_V_OK);
+    if (auth_required && !ok) {
+        dbglog("Resumed TLS session failed verification: %s",
+               X509_verify_cert_error_string(err));
+        X509_free(peer_cert);
+        return -1;
+    }
+
+    ok = tls_check_peer(peer_cert, inf, 1);
+    X509_free(peer_cert);
+    return ok? 0: -1;
+}
+
 const SSL_METHOD* tls_method() {
     return TLS_method();
 }
@@ -449,3 +509,168 @@ void tls_log_sslerr( void )
     }
 }
 
+
+/*
+ * Contexts already set up, so that a session whose settings match an
+ * earlier one's can skip loading its certificates, key and CRLs again.
+ * Each entry remembers the files it was built from as they were then;
+ * an entry is dropped, rather than used, once any of them has changed.
+ * For a directory that means the directory itself or any file in it.
+ */
+#define TLS_CTX_CACHE_MAX	8
+
+struct tls_file_stamp
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+};
+
+struct tls_ctx_entry
+{
+    struct tls_ctx_entry *next;
+    char *tag;
+    SSL_CTX *ctx;
+    int nfiles;
+    struct tls_file_stamp files[];
+};
+
+static struct tls_ctx_entry *tls_ctx_cache;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static inline int SSL_CTX_up_ref(SSL_CTX *ctx)
+{
+    CRYPTO_add(&ctx->references, 1, CRYPTO_LOCK_SSL_CTX);
+    return 1;
+}
+#endif
+
+static int tls_timespec_newer(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec > b->tv_sec
+        || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/*
+ * Take a stamp of what path is now.  A file that isn't there gets an
+ * all-zero stamp, so it keeps matching for as long as it stays away.
+ */
+static void tls_stamp_file(const char *path, struct tls_file_stamp *fs)
+{
+    struct stat sbuf;
+    struct dirent *de;
+    DIR *dir;
+
+    memset(fs, 0, sizeof(*fs));
+    if (path == NULL || path[0] == 0 || stat(path, &sbuf) < 0)
+        return;
+    fs->dev = sbuf.st_dev;
+    fs->ino = sbuf.st_ino;
+    fs->size = sbuf.st_size;
+    fs->mtime = sbuf.st_mtim;
+    fs->ctime = sbuf.st_ctim;
+    if (!S_ISDIR(sbuf.st_mode) || (dir = opendir(path)) == NULL)
+        return;
+
+    /* a CRL rewritten in place only shows up on the file itself */
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.'
+            || fstatat(dirfd(dir), de->d_name, &sbuf, 0) < 0)
+            continue;
+        if (tls_timespec_newer(&sbuf.st_mtim, &fs->mtime))
+            fs->mtime = sbuf.st_mtim;
+        if (tls_timespec_newer(&sbuf.st_ctim, &fs->ctime))
+            fs->ctime = sbuf.st_ctim;
+    }
+    closedir(dir);
+}
+
+static int tls_same_path(const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+        return (a == NULL || a[0] == 0) && (b == NULL || b[0] == 0);
+    return strcmp(a, b) == 0;
+}
+
+static void tls_ctx_entry_free(struct tls_ctx_entry *ent)
+{
+    int i;
+
+    SSL_CTX_free(ent->ctx);
+    for (i = 0; i < ent->nfiles; ++i)
+        free(ent->files[i].path);
+    free(ent->tag);
+    free(ent);
+}
+
+SSL_CTX *tls_ctx_get(const char *tag, const char **files, int nfiles)
+{
+    struct tls_ctx_entry **pp, *ent;
+    struct tls_file_stamp now;
+    int i;
+
+    for (pp = &tls_ctx_cache; (ent = *pp) != NULL; pp = &ent->next) {
+        if (ent->nfiles != nfiles || strcmp(ent->tag, tag) != 0)
+            continue;
+        for (i = 0; i < nfiles; ++i)
+            if (!tls_same_path(ent->files[i].path, files[i]))
+                break;
+        if (i == nfiles)
+            break;
+    }
+    if (ent == NULL)
+        return NULL;
+
+    *pp = ent->next;
+    for (i = 0; i < nfiles; ++i) {
+        tls_stamp_file(files[i], &now);
+        if (now.dev != ent->files[i].dev || now.ino != ent->files[i].ino
+            || now.size != ent->files[i].size
+            || memcmp(&now.mtime, &ent->files[i].mtime, sizeof(now.mtime))
+            || memcmp(&now.ctime, &ent->files[i].ctime, sizeof(now.ctime))) {
+            dbglog("TLS: %s has changed, setting up again",
+                   files[i]);
+            tls_ctx_entry_free(ent);
+            return NULL;
+        }
+    }
+
+    /* most recently used first */
+    ent->next = tls_ctx_cache;
+    tls_ctx_cache = ent;
+    SSL_CTX_up_ref(ent->ctx);
+    return ent->ctx;
+}
+
+void tls_ctx_put(const char *tag, const char **files, int nfiles, SSL_CTX *ctx)
+{
+    struct tls_ctx_entry *ent, *old;
+    int i, n;
+
+    ent = calloc(1, sizeof(*ent) + nfiles * sizeof(ent->files[0]));
+    if (ent == NULL || (ent->tag = strdup(tag)) == NULL) {
+        free(ent);
+        return;
+    }
+    for (i = 0; i < nfiles; ++i) {
+        tls_stamp_file(files[i], &ent->files[i]);
+        if (files[i] != NULL && files[i][0] != 0)
+            ent->files[i].path = strdup(files[i]);
+    }
+    ent->nfiles = nfiles;
+    SSL_CTX_up_ref(ctx);
+    ent->ctx = ctx;
+    ent->next = tls_ctx_cache;
+    tls_ctx_cache = ent;
+
+    /* forget the least recently used beyond the limit */
+    for (n = 1; ent->next != NULL && n < TLS_CTX_CACHE_MAX; ++n)
+        ent = ent->next;
+    while ((old = ent->next) != NULL) {
+        ent->next = old->next;
+        tls_ctx_entry_free(old);
+    }
+}
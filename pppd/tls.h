@@ -67,6 +67,11 @@ int tls_set_verify(SSL_CTX *ctx, int depth);
 int tls_set_verify_info(SSL *ssl, const char *peer_name, const char *peer_cert_file, 
         bool client, struct tls_info **out);
 
+/**
+ * Check the peer certificate of a resumed session again
+ */
+int tls_verify_session(SSL *ssl);
+
 /**
  * Free the tls_info structure and it's members
  */
@@ -82,6 +87,17 @@ int tls_set_crl(SSL_CTX *ctx, const char *crl_dir, const char *crl_file);
  */
 int tls_set_ca(SSL_CTX *ctx, const char *ca_dir, const char *ca_file);
 
+/**
+ * Find a context set up earlier with the same tag and files, none of
+ * which have changed since.  The caller gets its own reference.
+ */
+SSL_CTX *tls_ctx_get(const char *tag, const char **files, int nfiles);
+
+/**
+ * Remember a context for tls_ctx_get; the caller keeps its reference
+ */
+void tls_ctx_put(const char *tag, const char **files, int nfiles, SSL_CTX *ctx);
+
 /**
  * Log all errors from ssl library
  */
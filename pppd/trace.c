@@ -0,0 +1,286 @@
+/*
+ * trace.c - keep a trace of recent negotiation events.
+ *
+ * Copyright (c) 2026 The ppp project contributors. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * 3. The name(s) of the authors of this software must not be used to
+ *    endorse or promote products derived from this software without
+ *    prior written permission.
+ *
+ * THE AUTHORS OF THIS SOFTWARE DISCLAIM ALL WARRANTIES WITH REGARD TO
+ * THIS SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS, IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+ * AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING
+ * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/time.h>
+
+#include "pppd-private.h"
+#include "fsm.h"
+
+/*
+ * The last TRACE_SIZE events are kept in a ring: phase changes,
+ * protocol state changes, Configure-Request retransmits, scripts,
+ * and the control packets sent and received, of which the first
+ * TRACE_PKTLEN bytes are kept.  Recording one costs a clock read and
+ * a few stores; the trace is only formatted when trace_dump is
+ * called, on SIGUSR1, or when it is asked for on the control socket,
+ * so packets can be traced without debug.
+ *
+ * Separately, the time each phase was entered is noted, so that
+ * when the link reaches the running phase we can log how long each
+ * part of bringing it up took.
+ */
+#define TRACE_SIZE	128
+#define TRACE_PKTLEN	64
+
+enum trace_type {
+    TR_PHASE,
+    TR_STATE,
+    TR_RETRANSMIT,
+    TR_SCRIPT_START,
+    TR_SCRIPT_DONE,
+    TR_PACKET,
+};
+
+struct trace_event {
+    struct timeval time;
+    unsigned char type;
+    unsigned char state;	/* new phase or fsm state */
+    int arg;			/* retransmits left, pid, exit status,
+				   packet length */
+    int ms;			/* how long the script ran */
+    char name[16];		/* protocol or script */
+    unsigned char data[TRACE_PKTLEN];	/* start of the packet */
+};
+
+static struct trace_event trace_ring[TRACE_SIZE];
+static unsigned int trace_next;		/* count of events recorded */
+
+static struct timeval phase_time[PHASE_MASTER + 1];
+static int phase_seen[PHASE_MASTER + 1];
+static int last_phase;
+
+static const char *state_names[] = {
+    "Initial", "Starting", "Closed", "Stopped", "Closing", "Stopping",
+    "Req-Sent", "Ack-Rcvd", "Ack-Sent", "Opened"
+};
+
+static long
+ms_between(struct timeval *from, struct timeval *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000
+	+ (to->tv_usec - from->tv_usec) / 1000;
+}
+
+static struct trace_event *
+trace_new(int type, const char *name)
+{
+    struct trace_event *ev;
+
+    ev = &trace_ring[trace_next++ % TRACE_SIZE];
+    ppp_get_time(&ev->time);
+    ev->type = type;
+    ev->state = 0;
+    ev->arg = 0;
+    ev->ms = 0;
+    strlcpy(ev->name, name, sizeof(ev->name));
+    return ev;
+}
+
+/*
+ * trace_phase - note that we have entered phase p.
+ */
+void
+trace_phase(int p)
+{
+    struct trace_event *ev;
+    long conn, est, auth, net;
+    struct timeval *start;
+
+    ev = trace_new(TR_PHASE, "");
+    ev->state = p;
+    if (p < PHASE_DEAD || p > PHASE_MASTER)
+	return;
+
+    /* a new attempt at the link starts with one of these */
+    if (p == PHASE_SERIALCONN
+	|| (p == PHASE_ESTABLISH && last_phase != PHASE_SERIALCONN))
+	memset(phase_seen, 0, sizeof(phase_seen));
+    last_phase = p;
+    phase_time[p] = ev->time;
+    phase_seen[p] = 1;
+
+    if (p != PHASE_RUNNING || !phase_seen[PHASE_ESTABLISH]
+	|| !phase_seen[PHASE_NETWORK])
+	return;
+    conn = auth = 0;
+    start = &phase_time[PHASE_ESTABLISH];
+    if (phase_seen[PHASE_SERIALCONN]) {
+	start = &phase_time[PHASE_SERIALCONN];
+	conn = ms_between(start, &phase_time[PHASE_ESTABLISH]);
+    }
+    if (phase_seen[PHASE_AUTHENTICATE])
+	auth = ms_between(&phase_time[PHASE_AUTHENTICATE],
+			  &phase_time[PHASE_NETWORK]);
+    est = ms_between(&phase_time[PHASE_ESTABLISH],
+		     &phase_time[PHASE_NETWORK]) - auth;
+    net = ms_between(&phase_time[PHASE_NETWORK], &ev->time);
+    statsfile_link_up(conn, est, auth, net);
+    info("Link up after %ld ms: connect %ld, establish %ld, "
+	 "authenticate %ld, network %ld",
+	 ms_between(start, &ev->time), conn, est, auth, net);
+}
+
+/*
+ * trace_state - note that protocol name has gone into fsm state state.
+ */
+void
+trace_state(const char *name, int state)
+{
+    trace_new(TR_STATE, name)->state = state;
+}
+
+/*
+ * trace_retransmit - note that protocol name has resent a Request,
+ * with left more tries to go.
+ */
+void
+trace_retransmit(const char *name, int left)
+{
+    trace_new(TR_RETRANSMIT, name)->arg = left;
+}
+
+/*
+ * trace_script - note that script prog has started as process pid
+ * or, if ms >= 0, that it finished with the given status after
+ * running for ms milliseconds.
+ */
+void
+trace_script(const char *prog, int pid, int status, int ms)
+{
+    struct trace_event *ev;
+    const char *base;
+
+    base = strrchr(prog, '/');
+    base = base? base + 1: prog;
+    if (ms < 0) {
+	ev = trace_new(TR_SCRIPT_START, base);
+	ev->arg = pid;
+    } else {
+	ev = trace_new(TR_SCRIPT_DONE, base);
+	ev->arg = status;
+	ev->ms = ms;
+    }
+}
+
+/*
+ * trace_packet - note a control packet sent or received.
+ */
+void
+trace_packet(unsigned char *p, int len, int incoming)
+{
+    struct trace_event *ev;
+
+    ev = trace_new(TR_PACKET, incoming? "rcvd": "sent");
+    ev->arg = len;
+    memcpy(ev->data, p, len < TRACE_PKTLEN? len: TRACE_PKTLEN);
+}
+
+/*
+ * trace_print - format the events in the trace, oldest first, with
+ * their times relative to the oldest.  Each call to printer is one
+ * line.
+ */
+void
+trace_print(printer_func printer, void *arg)
+{
+    struct trace_event *ev, *first;
+    unsigned int i, n;
+    long ms;
+
+    n = trace_next < TRACE_SIZE? trace_next: TRACE_SIZE;
+    if (n == 0)
+	return;
+    first = &trace_ring[(trace_next - n) % TRACE_SIZE];
+    printer(arg, "Event trace (%u events, times in ms):", n);
+    for (i = trace_next - n; i != trace_next; ++i) {
+	ev = &trace_ring[i % TRACE_SIZE];
+	ms = ms_between(&first->time, &ev->time);
+	switch (ev->type) {
+	case TR_PHASE:
+	    printer(arg, "%8ld phase %s", ms, phase_name(ev->state));
+	    break;
+	case TR_STATE:
+	    printer(arg, "%8ld %s %s", ms, ev->name, ev->state <= OPENED?
+		    state_names[ev->state]: "?");
+	    break;
+	case TR_RETRANSMIT:
+	    printer(arg, "%8ld %s retransmit, %d left", ms, ev->name, ev->arg);
+	    break;
+	case TR_SCRIPT_START:
+	    printer(arg, "%8ld script %s started, pid %d", ms, ev->name, ev->arg);
+	    break;
+	case TR_SCRIPT_DONE:
+	    printer(arg, "%8ld script %s finished, status 0x%x, ran %d ms",
+		   ms, ev->name, ev->arg, ev->ms);
+	    break;
+	case TR_PACKET:
+	    if (ev->arg <= TRACE_PKTLEN)
+		printer(arg, "%8ld %s %P", ms, ev->name, ev->data, ev->arg);
+	    else
+		printer(arg, "%8ld %s %P ... (%d bytes)", ms, ev->name,
+			ev->data, TRACE_PKTLEN, ev->arg);
+	    break;
+	}
+    }
+}
+
+static void
+trace_log(void *arg, char *fmt, ...)
+{
+    va_list args;
+    char line[512];
+
+    va_start(args, fmt);
+    vslprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    notice("%s", line);
+}
+
+/*
+ * trace_dump - write the trace to the log.
+ */
+void
+trace_dump(void)
+{
+    int mask;
+
+    /* SIGUSR1 may just have turned debug off, which masks notices */
+    mask = setlogmask(LOG_UPTO(LOG_NOTICE) | setlogmask(0));
+    trace_print(trace_log, NULL);
+    setlogmask(mask);
+}
@@ -68,6 +68,8 @@
  * OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE		/* for splice */
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -81,12 +83,14 @@
 #include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <syslog.h>
 #include <netdb.h>
 #include <utmp.h>
 #include <pwd.h>
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/file.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -118,8 +122,13 @@ static int start_charshunt(int, int);
 static void stop_charshunt(void *, int);
 static void charshunt_done(void *);
 static void charshunt(int, int, char *);
+static void charshunt_relay(int, int);
 static int record_write(FILE *, int code, u_char *buf, int nb,
 			struct timeval *);
+static int record_flush(FILE *);
+static FILE *record_open(char *, struct timeval *);
+static FILE *record_rotate(FILE *, char *, struct timeval *);
+static void charshunt_stop(int);
 static int open_socket(char *);
 static void maybe_relock(void *, int);
 
@@ -136,6 +145,17 @@ int charshunt_pid;		/* Process ID for charshunt */
 int locked;			/* lock() has succeeded */
 struct stat devstat;		/* result of stat() on devnam */
 
+/*
+ * The record file is written through a large stdio buffer and flushed
+ * at most once a second, or when the transfer goes quiet for a second,
+ * or when charshunt is told to stop.
+ */
+#define RECORD_BUFSIZE	65536
+static time_t record_flushed;	/* when the record file was last flushed */
+static int record_pending;	/* record data not yet flushed */
+static off_t record_bytes;	/* size of the record file */
+static volatile int charshunt_quit;	/* got SIGTERM or SIGINT */
+
 /* option variables */
 char	devnam[MAXPATHLEN];	/* Device name */
 char	ppp_devname[MAXPATHLEN];/* name of PPP tty (maybe ttypx) */
@@ -144,6 +164,7 @@ int	stop_bits = 1;		/* Number of serial port stop bits */
 bool	modem = 1;		/* Use modem control lines */
 int	inspeed = 0;		/* Input/Output speed requested */
 bool	lockflag = 0;		/* Create lock file to lock the serial dev */
+bool	devlockflag = 0;	/* flock the serial device itself */
 char	*initializer = NULL;	/* Script to initialize physical link */
 char	*connect_script = NULL;	/* Script to establish physical link */
 char	*disconnect_script = NULL; /* Script to disestablish physical link */
@@ -152,6 +173,8 @@ char	*ptycommand = NULL;	/* Command to run on other side of pty */
 bool	notty = 0;		/* Stdin/out is not a tty */
 char	*record_file = NULL;	/* File to record chars sent/received */
 int	max_data_rate;		/* max bytes/sec through charshunt */
+int	max_data_burst;		/* bytes it may send at once, 0 = default */
+int	record_size;		/* rotate the record file at this many kB */
 bool	sync_serial = 0;	/* Device is synchronous serial device */
 char	*pty_socket = NULL;	/* Socket to connect to pty */
 int	using_pty = 0;		/* we're allocating a pty as the device */
@@ -182,6 +205,10 @@ static struct option tty_options[] = {
       "Lock serial device with UUCP-style lock file", OPT_PRIO | 1 },
     { "nolock", o_bool, &lockflag,
       "Don't lock serial device", OPT_PRIOSUB | OPT_PRIV },
+    { "devlock", o_bool, &devlockflag,
+      "Lock serial device with flock on the device", OPT_PRIO | 1 },
+    { "nodevlock", o_bool, &devlockflag,
+      "Don't flock serial device", OPT_PRIOSUB | OPT_PRIV },
 
     { "init", o_string, &initializer,
       "A program to initialize the device", OPT_PRIO | OPT_PRIVFIX },
@@ -208,6 +235,9 @@ static struct option tty_options[] = {
 
     { "record", o_string, &record_file,
       "Record characters sent/received to file", OPT_PRIO },
+    { "record-size", o_int, &record_size,
+      "Rotate the record file when it reaches this many kilobytes",
+      OPT_PRIO },
 
     { "crtscts", o_int, &crtscts,
       "Set hardware (RTS/CTS) flow control",
@@ -241,6 +271,9 @@ static struct option tty_options[] = {
     { "datarate", o_int, &max_data_rate,
       "Maximum data rate in bytes/sec (with pty, notty or record option)",
       OPT_PRIO },
+    { "datarate-burst", o_int, &max_data_burst,
+      "Bytes that may be sent at once within the datarate",
+      OPT_PRIO | OPT_LLIMIT, NULL, 0, 1 },
 
     { "escape", o_special, (void *)setescape,
       "List of character codes to escape on transmission",
@@ -635,6 +668,24 @@ int connect_tty(void)
 			if (!persist || err != EINTR)
 				goto errret;
 		}
+
+		/*
+		 * An flock on the device is atomic and goes away with
+		 * the last fd for it, so there is nothing to clean up
+		 * after a crash, and our children keep it.
+		 */
+		if (devlockflag && !privopen
+		    && flock(real_ttyfd, LOCK_EX | LOCK_NB) < 0) {
+			if (errno == EWOULDBLOCK)
+				notice("Device %s is locked by another process",
+				       devnam);
+			else
+				error("Can't lock %s: %m", devnam);
+			ppp_set_status(EXIT_LOCK_FAILED);
+			close(real_ttyfd);
+			real_ttyfd = -1;
+			goto errret;
+		}
 		ttyfd = real_ttyfd;
 		if ((fdflags = fcntl(ttyfd, F_GETFL)) == -1
 		    || fcntl(ttyfd, F_SETFL, fdflags & ~O_NONBLOCK) < 0)
@@ -1027,7 +1078,8 @@ charshunt(int ifd, int ofd, char *record_file)
     int pty_readable, stdin_readable;
     struct timeval lasttime;
     FILE *recordf = NULL;
-    int ilevel, olevel, max_level;
+    int max_level, idle;
+    double ilevel, olevel;	/* bytes sent and not yet paid for */
     struct timeval levelt, tout, *top;
     extern u_char inpacket_buf[];
 
@@ -1035,8 +1087,8 @@ charshunt(int ifd, int ofd, char *record_file)
      * Reset signal handlers.
      */
     signal(SIGHUP, SIG_IGN);		/* Hangup */
-    signal(SIGINT, SIG_DFL);		/* Interrupt */
-    signal(SIGTERM, SIG_DFL);		/* Terminate */
+    signal(SIGINT, record_file? charshunt_stop: SIG_DFL);	/* Interrupt */
+    signal(SIGTERM, record_file? charshunt_stop: SIG_DFL);	/* Terminate */
     signal(SIGCHLD, SIG_DFL);
     signal(SIGUSR1, SIG_DFL);
     signal(SIGUSR2, SIG_DFL);
@@ -1085,11 +1137,8 @@ charshunt(int ifd, int ofd, char *record_file)
     /*
      * Open the record file if required.
      */
-    if (record_file != NULL) {
-	recordf = fopen(record_file, "a");
-	if (recordf == NULL)
-	    error("Couldn't create record file %s: %m", record_file);
-    }
+    if (record_file != NULL)
+	recordf = record_open(record_file, &lasttime);
 
     /* set all the fds to non-blocking mode */
     flags = fcntl(pty_master, F_GETFL);
@@ -1113,58 +1162,91 @@ charshunt(int ifd, int ofd, char *record_file)
 
     ilevel = olevel = 0;
     ppp_get_time(&levelt);
+    /*
+     * With a datarate, each direction is a token bucket holding up to
+     * max_level bytes' worth of credit, refilled at max_data_rate.
+     */
     if (max_data_rate) {
-	max_level = max_data_rate / 10;
-	if (max_level < 100)
-	    max_level = 100;
+	max_level = max_data_burst;
+	if (max_level <= 0) {
+	    max_level = max_data_rate / 10;
+	    if (max_level < 100)
+		max_level = 100;
+	}
     } else
 	max_level = PPP_MRU + PPP_HDRLEN + 1;
 
     nfds = (ofd > pty_master? ofd: pty_master) + 1;
-    if (recordf != NULL) {
-	gettimeofday(&lasttime, NULL);
-	putc(7, recordf);	/* put start marker */
-	putc(lasttime.tv_sec >> 24, recordf);
-	putc(lasttime.tv_sec >> 16, recordf);
-	putc(lasttime.tv_sec >> 8, recordf);
-	putc(lasttime.tv_sec, recordf);
-	lasttime.tv_usec = 0;
-    }
 
-    while (nibuf != 0 || nobuf != 0 || pty_readable || stdin_readable) {
+    /* with nothing to record or pace, just pass the data through */
+    if (recordf == NULL && max_data_rate == 0)
+	charshunt_relay(ifd, ofd);
+
+    while ((nibuf != 0 || nobuf != 0 || pty_readable || stdin_readable)
+	   && !charshunt_quit) {
+	if (recordf && record_size > 0
+	    && record_bytes >= (off_t) record_size * 1024)
+	    recordf = record_rotate(recordf, record_file, &lasttime);
 	top = 0;
+	idle = 0;
 	tout.tv_sec = 0;
 	tout.tv_usec = 10000;
 	FD_ZERO(&ready);
 	FD_ZERO(&writey);
 	if (nibuf != 0) {
-	    if (ilevel >= max_level)
+	    if (ilevel + 1 > max_level)
 		top = &tout;
 	    else
 		FD_SET(pty_master, &writey);
 	} else if (stdin_readable)
 	    FD_SET(ifd, &ready);
 	if (nobuf != 0) {
-	    if (olevel >= max_level)
+	    if (olevel + 1 > max_level)
 		top = &tout;
 	    else
 		FD_SET(ofd, &writey);
 	} else if (pty_readable)
 	    FD_SET(pty_master, &ready);
-	if (select(nfds, &ready, &writey, NULL, top) < 0) {
+	if (top != 0) {
+	    /* sleep until there is credit for a byte in one direction */
+	    double wait = 1e6;
+
+	    if (nibuf != 0 && ilevel + 1 > max_level)
+		wait = (ilevel + 1 - max_level) * 1e6 / max_data_rate;
+	    if (nobuf != 0 && olevel + 1 > max_level
+		&& (olevel + 1 - max_level) * 1e6 / max_data_rate < wait)
+		wait = (olevel + 1 - max_level) * 1e6 / max_data_rate;
+	    tout.tv_sec = (long) wait / 1000000;
+	    tout.tv_usec = (long) wait % 1000000 + 1;
+	}
+	if (top == 0 && recordf) {
+	    /*
+	     * Flush the record file if nothing happens for a second;
+	     * this also catches a stop signal that came before select.
+	     */
+	    tout.tv_sec = 1;
+	    tout.tv_usec = 0;
+	    top = &tout;
+	    idle = 1;
+	}
+	n = select(nfds, &ready, &writey, NULL, top);
+	if (n < 0) {
 	    if (errno != EINTR)
 		fatal("select");
 	    continue;
 	}
+	if (n == 0 && idle && record_pending)
+	    if (!record_flush(recordf))
+		recordf = NULL;
 	if (max_data_rate) {
-	    double dt;
-	    int nbt;
+	    double dt, nbt;
 	    struct timeval now;
 
+	    /* keep the fraction of a byte, so slow rates still drain */
 	    ppp_get_time(&now);
 	    dt = (now.tv_sec - levelt.tv_sec
 		  + (now.tv_usec - levelt.tv_usec) / 1e6);
-	    nbt = (int)(dt * max_data_rate);
+	    nbt = dt * max_data_rate;
 	    ilevel = (nbt < 0 || nbt > ilevel)? 0: ilevel - nbt;
 	    olevel = (nbt < 0 || nbt > olevel)? 0: olevel - nbt;
 	    levelt = now;
@@ -1225,7 +1307,7 @@ charshunt(int ifd, int ofd, char *record_file)
 	if (FD_ISSET(ofd, &writey)) {
 	    n = nobuf;
 	    if (olevel + n > max_level)
-		n = max_level - olevel;
+		n = (int) (max_level - olevel);
 	    n = write(ofd, obufp, n);
 	    if (n < 0) {
 		if (errno == EIO) {
@@ -1244,7 +1326,7 @@ charshunt(int ifd, int ofd, char *record_file)
 	if (FD_ISSET(pty_master, &writey)) {
 	    n = nibuf;
 	    if (ilevel + n > max_level)
-		n = max_level - ilevel;
+		n = (int) (max_level - ilevel);
 	    n = write(pty_master, ibufp, n);
 	    if (n < 0) {
 		if (errno == EIO) {
@@ -1261,9 +1343,301 @@ charshunt(int ifd, int ofd, char *record_file)
 	    }
 	}
     }
+    if (recordf)
+	record_flush(recordf);
     exit(0);
 }
 
+/*
+ * One direction of charshunt_relay.  The data goes through a pipe with
+ * splice() where the kernel lets us, or else through buf; a buffer of
+ * RELAY_BUFSIZE is plenty for a link, and more would only queue data
+ * behind a slow one.
+ */
+#define RELAY_BUFSIZE	65536
+
+struct relay {
+    int from, to;
+    int eof;			/* nothing more to read from `from' */
+    int pending;		/* bytes read but not yet written */
+#ifdef HAVE_SPLICE
+    int pipe[2];		/* or -1 when not splicing */
+#endif
+    u_char *buf;
+    u_char *bufp;
+};
+
+static void
+relay_init(struct relay *r, int from, int to)
+{
+    r->from = from;
+    r->to = to;
+    r->eof = 0;
+    r->pending = 0;
+    r->buf = r->bufp = NULL;
+#ifdef HAVE_SPLICE
+    if (pipe(r->pipe) == 0) {
+	fcntl(r->pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(r->pipe[1], F_SETFL, O_NONBLOCK);
+	return;
+    }
+    r->pipe[0] = r->pipe[1] = -1;
+#endif
+    r->buf = malloc(RELAY_BUFSIZE);
+    if (r->buf == NULL)
+	fatal("Couldn't allocate relay buffer");
+}
+
+/*
+ * relay_switch - stop splicing, which the kernel can't do for one of
+ * our fds, and use a buffer.  Only done while the pipe is empty.
+ */
+static void
+relay_switch(struct relay *r)
+{
+#ifdef HAVE_SPLICE
+    close(r->pipe[0]);
+    close(r->pipe[1]);
+    r->pipe[0] = r->pipe[1] = -1;
+#endif
+    r->buf = malloc(RELAY_BUFSIZE);
+    if (r->buf == NULL)
+	fatal("Couldn't allocate relay buffer");
+}
+
+/*
+ * relay_read - read what we can from r->from.  Returns 0 at end of
+ * file, -1 on error, or else 1.
+ */
+static int
+relay_read(struct relay *r)
+{
+    ssize_t n;
+
+#ifdef HAVE_SPLICE
+    if (r->pipe[0] >= 0) {
+	n = splice(r->from, NULL, r->pipe[1], NULL, RELAY_BUFSIZE,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && (errno == EINVAL || errno == ENOSYS)
+	    && r->pending == 0)
+	    relay_switch(r);
+	else {
+	    if (n > 0)
+		r->pending += n;
+	    return n < 0? (errno == EINTR || errno == EAGAIN || errno == EIO
+			   ? 1: -1): n > 0;
+	}
+    }
+#endif
+    n = read(r->from, r->buf, RELAY_BUFSIZE);
+    if (n > 0) {
+	r->pending = n;
+	r->bufp = r->buf;
+	return 1;
+    }
+    if (n < 0)
+	return (errno == EINTR || errno == EAGAIN || errno == EIO)? 1: -1;
+    return 0;
+}
+
+/*
+ * relay_write - write what we can of the pending data to r->to.
+ * Returns -1 on error, 0 if the other end has gone (EIO), or else 1.
+ */
+static int
+relay_write(struct relay *r)
+{
+    ssize_t n;
+
+#ifdef HAVE_SPLICE
+    if (r->pipe[0] >= 0) {
+	n = splice(r->pipe[0], NULL, r->to, NULL, r->pending,
+		   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+	    /* can't splice out, so bring this lot through a buffer */
+	    r->buf = malloc(r->pending);
+	    if (r->buf == NULL || read(r->pipe[0], r->buf, r->pending)
+		!= r->pending)
+		fatal("Couldn't move data out of relay pipe");
+	    r->bufp = r->buf;
+	    close(r->pipe[0]);
+	    close(r->pipe[1]);
+	    r->pipe[0] = r->pipe[1] = -1;
+	    return relay_write(r);
+	}
+    } else
+#endif
+	n = write(r->to, r->bufp, r->pending);
+    if (n < 0) {
+	if (errno == EIO) {
+	    r->pending = 0;
+	    return 0;
+	}
+	return (errno == EAGAIN || errno == EINTR)? 1: -1;
+    }
+    r->bufp += n;
+    r->pending -= n;
+#ifdef HAVE_SPLICE
+    /* after switching in relay_write, go on with a full size buffer */
+    if (r->pending == 0 && r->pipe[0] < 0 && r->buf != NULL) {
+	free(r->buf);
+	r->buf = malloc(RELAY_BUFSIZE);
+	if (r->buf == NULL)
+	    fatal("Couldn't allocate relay buffer");
+    }
+#endif
+    return 1;
+}
+
+/*
+ * charshunt_relay - pass data between ifd/ofd and the pty master, when
+ * there is no record file or data rate to worry about, then exit.
+ * As in the main charshunt loop, we stop at end of file on the pty,
+ * after closing ofd.
+ */
+static void
+charshunt_relay(int ifd, int ofd)
+{
+    struct relay in, out;	/* to and from the pty */
+    struct pollfd pfd[4];
+    int n, rv, iw, ir, ow, or;
+
+    relay_init(&in, ifd, pty_master);
+    relay_init(&out, pty_master, ofd);
+
+    while (!out.eof || out.pending) {
+	n = 0;
+	iw = ir = ow = or = -1;
+	if (in.pending) {
+	    pfd[iw = n].fd = pty_master;
+	    pfd[n++].events = POLLOUT;
+	} else if (!in.eof) {
+	    pfd[ir = n].fd = ifd;
+	    pfd[n++].events = POLLIN;
+	}
+	if (out.pending) {
+	    pfd[ow = n].fd = ofd;
+	    pfd[n++].events = POLLOUT;
+	} else if (!out.eof) {
+	    pfd[or = n].fd = pty_master;
+	    pfd[n++].events = POLLIN;
+	}
+	if (poll(pfd, n, -1) < 0) {
+	    if (errno != EINTR)
+		fatal("poll");
+	    continue;
+	}
+
+	/* what we read we try to write straight away */
+	if (ir >= 0 && pfd[ir].revents) {
+	    rv = relay_read(&in);
+	    if (rv < 0) {
+		error("Error reading standard input: %m");
+		break;
+	    }
+	    if (rv == 0)
+		in.eof = 1;
+	}
+	if (or >= 0 && pfd[or].revents) {
+	    rv = relay_read(&out);
+	    if (rv < 0) {
+		error("Error reading pseudo-tty master: %m");
+		break;
+	    }
+	    if (rv == 0) {
+		/* slave side has closed, so the pty is not writable now */
+		out.eof = in.eof = 1;
+		in.pending = 0;
+		close(ofd);
+	    }
+	}
+	if (out.pending && (or >= 0 || pfd[ow].revents)) {
+	    rv = relay_write(&out);
+	    if (rv < 0) {
+		error("Error writing standard output: %m");
+		break;
+	    }
+	    if (rv == 0)
+		out.eof = 1;
+	}
+	if (in.pending && (ir >= 0 || pfd[iw].revents)) {
+	    rv = relay_write(&in);
+	    if (rv < 0) {
+		error("Error writing pseudo-tty master: %m");
+		break;
+	    }
+	    if (rv == 0)
+		in.eof = 1;
+	}
+    }
+    exit(0);
+}
+
+static void
+charshunt_stop(int sig)
+{
+    charshunt_quit = 1;
+}
+
+/*
+ * record_open - open the record file for appending and put a start
+ * marker in it.
+ */
+static FILE *
+record_open(char *name, struct timeval *tp)
+{
+    FILE *f;
+    struct stat st;
+
+    f = fopen(name, "a");
+    if (f == NULL) {
+	error("Couldn't create record file %s: %m", name);
+	return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, RECORD_BUFSIZE);
+    record_bytes = fstat(fileno(f), &st) == 0? st.st_size: 0;
+    gettimeofday(tp, NULL);
+    putc(7, f);		/* put start marker */
+    putc(tp->tv_sec >> 24, f);
+    putc(tp->tv_sec >> 16, f);
+    putc(tp->tv_sec >> 8, f);
+    putc(tp->tv_sec, f);
+    tp->tv_usec = 0;
+    record_bytes += 5;
+    record_pending = 1;
+    record_flushed = tp->tv_sec;
+    return f;
+}
+
+/*
+ * record_rotate - move the full record file to name.1, replacing
+ * any older one, and start a new one.
+ */
+static FILE *
+record_rotate(FILE *f, char *name, struct timeval *tp)
+{
+    char old[MAXPATHLEN];
+
+    record_flush(f);
+    fclose(f);
+    slprintf(old, sizeof(old), "%s.1", name);
+    if (rename(name, old) < 0)
+	warn("Couldn't rename record file %s to %s: %m", name, old);
+    return record_open(name, tp);
+}
+
+static int
+record_flush(FILE *f)
+{
+    fflush(f);
+    record_pending = 0;
+    if (ferror(f)) {
+	error("Error writing record file: %m");
+	return 0;
+    }
+    return 1;
+}
+
 static int
 record_write(FILE *f, int code, u_char *buf, int nb, struct timeval *tp)
 {
@@ -1280,9 +1654,11 @@ record_write(FILE *f, int code, u_char *buf, int nb, struct timeval *tp)
 	    putc(diff >> 16, f);
 	    putc(diff >> 8, f);
 	    putc(diff, f);
+	    record_bytes += 5;
 	} else {
 	    putc(6, f);
 	    putc(diff, f);
+	    record_bytes += 2;
 	}
 	*tp = now;
     }
@@ -1291,8 +1667,14 @@ record_write(FILE *f, int code, u_char *buf, int nb, struct timeval *tp)
 	putc(nb >> 8, f);
 	putc(nb, f);
 	fwrite(buf, nb, 1, f);
+	record_bytes += 2 + nb;
+    }
+    ++record_bytes;
+    record_pending = 1;
+    if (now.tv_sec != record_flushed || buf == NULL) {
+	record_flushed = now.tv_sec;
+	return record_flush(f);
     }
-    fflush(f);
     if (ferror(f)) {
 	error("Error writing record file: %m");
 	return 0;
@@ -49,6 +49,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "pppd-private.h"
@@ -113,6 +114,7 @@ upap_state upap[NUM_PPP];		/* UPAP state; one for each unit */
 static void upap_timeout(void *);
 static void upap_reqtimeout(void *);
 static void upap_rauthreq(upap_state *, u_char *, int, int);
+static void upap_checked(void *, int, char *);
 static void upap_rauthack(upap_state *, u_char *, int, int);
 static void upap_rauthnak(upap_state *, u_char *, int, int);
 static void upap_sauthreq(upap_state *);
@@ -138,6 +140,8 @@ upap_init(int unit)
     u->us_timeouttime = UPAP_DEFTIMEOUT;
     u->us_maxtransmits = 10;
     u->us_reqtimeout = UPAP_DEFREQTIME;
+    u->us_checking = 0;
+    u->us_checkseq = 0;
 }
 
 
@@ -187,6 +191,8 @@ upap_authpeer(int unit)
     }
 
     u->us_serverstate = UPAPSS_LISTEN;
+    u->us_checking = 0;
+    ++u->us_checkseq;
     if (u->us_reqtimeout > 0)
 	TIMEOUT(upap_reqtimeout, u, u->us_reqtimeout);
 }
@@ -226,6 +232,14 @@ upap_reqtimeout(void *arg)
     if (u->us_serverstate != UPAPSS_LISTEN)
 	return;			/* huh?? */
 
+    /*
+     * The peer has sent its auth-req and we are still checking it,
+     * perhaps with a slow RADIUS server; upap_checked will answer,
+     * however long that takes.
+     */
+    if (u->us_checking)
+	return;
+
     auth_peer_fail(u->us_unit, PPP_PAP);
     u->us_serverstate = UPAPSS_BADAUTH;
 }
@@ -274,6 +288,8 @@ upap_lowerdown(int unit)
 
     u->us_clientstate = UPAPCS_INITIAL;
     u->us_serverstate = UPAPSS_INITIAL;
+    u->us_checking = 0;
+    ++u->us_checkseq;		/* forget any check still going */
 }
 
 
@@ -354,6 +370,17 @@ upap_input(int unit, u_char *inpacket, int l)
 }
 
 
+/*
+ * An auth-req being checked; see upap_checked.
+ */
+struct upap_check {
+    upap_state *u;
+    unsigned seq;		/* u->us_checkseq when it started */
+    int id;
+    int userlen;
+    char user[256];
+};
+
 /*
  * upap_rauth - Receive Authenticate.
  */
@@ -362,10 +389,7 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 {
     u_char ruserlen, rpasswdlen;
     char *ruser, *rpasswd;
-    char rhostname[256];
-    int retcode;
-    char *msg;
-    int msglen;
+    struct upap_check *c;
 
     if (u->us_serverstate < UPAPSS_LISTEN)
 	return;
@@ -383,6 +407,13 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 	return;
     }
 
+    /*
+     * Still checking an earlier one: the peer will send it again,
+     * and get the answer then if we don't send it first.
+     */
+    if (u->us_checking)
+	return;
+
     /*
      * Parse user/passwd.
      */
@@ -406,11 +437,40 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
     rpasswd = (char *) inp;
 
     /*
-     * Check the username and password given.
+     * Check the username and password given.  The answer goes
+     * back from upap_checked.
      */
-    retcode = check_passwd(u->us_unit, ruser, ruserlen, rpasswd,
-			   rpasswdlen, &msg);
+    c = malloc(sizeof(*c));
+    if (c == NULL)
+	novm("PAP check");
+    c->u = u;
+    c->seq = ++u->us_checkseq;
+    c->id = id;
+    c->userlen = ruserlen;
+    memcpy(c->user, ruser, ruserlen);
+    u->us_checking = 1;
+    check_passwd(u->us_unit, ruser, ruserlen, rpasswd, rpasswdlen,
+		 upap_checked, c);
     BZERO(rpasswd, rpasswdlen);
+}
+
+/*
+ * upap_checked - Answer an auth-req, once check_passwd has an answer.
+ */
+static void
+upap_checked(void *arg, int retcode, char *msg)
+{
+    struct upap_check *c = arg;
+    upap_state *u = c->u;
+    char rhostname[256];
+    int msglen;
+
+    /* the link went down, or we gave up on the peer, in the meantime */
+    if (c->seq != u->us_checkseq || u->us_serverstate != UPAPSS_LISTEN) {
+	free(c);
+	return;
+    }
+    u->us_checking = 0;
 
     /*
      * Check remote number authorization.  A plugin may have filled in
@@ -428,15 +488,15 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
     msglen = strlen(msg);
     if (msglen > 255)
 	msglen = 255;
-    upap_sresp(u, retcode, id, msg, msglen);
+    upap_sresp(u, retcode, c->id, msg, msglen);
 
     /* Null terminate and clean remote name. */
-    slprintf(rhostname, sizeof(rhostname), "%.*v", ruserlen, ruser);
+    slprintf(rhostname, sizeof(rhostname), "%.*v", c->userlen, c->user);
 
     if (retcode == UPAP_AUTHACK) {
 	u->us_serverstate = UPAPSS_OPEN;
 	notice("PAP peer authentication succeeded for %q", rhostname);
-	auth_peer_success(u->us_unit, PPP_PAP, 0, ruser, ruserlen);
+	auth_peer_success(u->us_unit, PPP_PAP, 0, c->user, c->userlen);
     } else {
 	u->us_serverstate = UPAPSS_BADAUTH;
 	warn("PAP peer authentication failed for %q", rhostname);
@@ -445,6 +505,7 @@ upap_rauthreq(upap_state *u, u_char *inp, int id, int len)
 
     if (u->us_reqtimeout > 0)
 	UNTIMEOUT(upap_reqtimeout, u);
+    free(c);
 }
 
 
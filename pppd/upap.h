@@ -76,6 +76,8 @@ typedef struct upap_state {
     int us_transmits;		/* Number of auth-reqs sent */
     int us_maxtransmits;	/* Maximum number of auth-reqs to send */
     int us_reqtimeout;		/* Time to wait for auth-req from peer */
+    int us_checking;		/* Waiting for an auth-req to be checked */
+    unsigned us_checkseq;	/* Counts checks, to spot stale answers */
 } upap_state;
 
 
@@ -134,6 +136,14 @@ extern pap_check_hook_fn  *pap_check_hook;
  */
 extern pap_auth_hook_fn   *pap_auth_hook;
 
+/*
+ * A plugin whose pap_auth_hook may block for a while, and doesn't touch
+ *   anything the main loop uses, can set this to have the hook run on
+ *   the offload thread (see ppp_offload) while pppd gets on with other
+ *   things.
+ */
+extern bool pap_auth_hook_offload;
+
 /*
  * Hook for plugin to know about PAP user logout.
  */
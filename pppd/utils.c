@@ -54,6 +54,9 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#ifdef HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
 #ifdef SVR4
 #include <sys/mkdev.h>
 #endif
@@ -156,8 +159,7 @@ vslprintf(char *buf, int buflen, char *fmt, va_list args)
     buf0 = buf;
     --buflen;
     while (buflen > 0) {
-	for (f = fmt; *f != '%' && *f != 0; ++f)
-	    ;
+	f = fmt + strcspn(fmt, "%");
 	if (f > fmt) {
 	    len = f - fmt;
 	    if (len > buflen)
@@ -268,8 +270,17 @@ vslprintf(char *buf, int buflen, char *fmt, va_list args)
 	case 'I':
 	    ip = va_arg(args, u_int32_t);
 	    ip = ntohl(ip);
-	    slprintf(num, sizeof(num), "%d.%d.%d.%d", (ip >> 24) & 0xff,
-		     (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff);
+	    str = num;
+	    for (i = 24; i >= 0; i -= 8) {
+		n = (ip >> i) & 0xff;
+		if (n >= 100)
+		    *str++ = '0' + n / 100;
+		if (n >= 10)
+		    *str++ = '0' + n / 10 % 10;
+		*str++ = '0' + n % 10;
+		*str++ = '.';
+	    }
+	    str[-1] = 0;
 	    str = num;
 	    break;
 	case 't':
@@ -343,6 +354,17 @@ vslprintf(char *buf, int buflen, char *fmt, va_list args)
 #endif
 	case 'B':
 	    p = va_arg(args, unsigned char *);
+	    /* do as many bytes as will surely fit without checking */
+	    len = fillch == ' '? 3: 2;
+	    for (n = prec < buflen / len? prec: buflen / len; n > 0; --n) {
+		c = *p++;
+		if (len == 3)
+		    *buf++ = ' ';
+		*buf++ = hexchars[c >> 4];
+		*buf++ = hexchars[c & 0xf];
+		buflen -= len;
+		--prec;
+	    }
 	    for (n = prec; n > 0; --n) {
 		c = *p++;
 		if (fillch == ' ')
@@ -377,11 +399,8 @@ vslprintf(char *buf, int buflen, char *fmt, va_list args)
 		break;
 	    }
 	    len = num + sizeof(num) - 1 - str;
-	} else {
-	    for (len = 0; len < buflen && (prec == -1 || len < prec); ++len)
-		if (str[len] == 0)
-		    break;
-	}
+	} else
+	    len = strnlen(str, prec == -1 || prec > buflen? buflen: prec);
 	if (width > 0) {
 	    if (width > buflen)
 		width = buflen;
@@ -609,19 +628,233 @@ logit(int level, char *fmt, va_list args)
 }
 
 #ifndef UNIT_TEST
+/*
+ * Debug messages, which with the debug option include a line for
+ * every packet, are saved up in log_buf and written out by flush_log,
+ * which the main loop calls before it waits for the next event.  That
+ * way logging a received packet doesn't hold up the reply to it.
+ * Anything more important than debug flushes the saved messages
+ * first and is then logged straight away, so the order is kept.
+ * The offload thread logs too, so all of this is done holding
+ * log_lock, which is also held across fork() so that a child never
+ * starts with it taken.
+ */
+#define LOG_BUFSIZE	16384
+#define LOG_MAXMSGS	256
+
+static char log_buf[LOG_BUFSIZE];
+static int log_len;			/* bytes used in log_buf */
+static int log_ends[LOG_MAXMSGS];	/* where each message ends */
+static struct timeval log_times[LOG_MAXMSGS]; /* when it was logged */
+static unsigned char log_phases[LOG_MAXMSGS]; /* and in what phase */
+static int log_nmsgs;
+static pid_t log_owner;			/* process that saved them */
+static int log_atexit;
+
+#ifdef HAVE_PTHREAD_CREATE
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static int log_atfork;
+
+static void
+log_lock_take(void)
+{
+    pthread_mutex_lock(&log_lock);
+}
+
+static void
+log_lock_give(void)
+{
+    pthread_mutex_unlock(&log_lock);
+}
+
+static void
+log_lock_init(void)
+{
+    if (!log_atfork) {
+	pthread_atfork(log_lock_take, log_lock_give, log_lock_give);
+	log_atfork = 1;
+    }
+}
+#else
+#define log_lock_take()	do { } while (0)
+#define log_lock_give()	do { } while (0)
+#define log_lock_init()	do { } while (0)
+#endif
+
+/*
+ * What goes to log_to_fd is collected in fd_buf, so that a batch of
+ * messages costs one write.
+ */
+static char fd_buf[LOG_BUFSIZE];
+static int fd_len;
+
+static const char *level_names[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+static void
+fd_flush(void)
+{
+    if (fd_len > 0 && log_to_fd >= 0
+	&& write(log_to_fd, fd_buf, fd_len) != fd_len)
+	log_to_fd = -1;
+    fd_len = 0;
+}
+
+static void
+fd_put(const char *p, int n)
+{
+    if (fd_len + n > sizeof(fd_buf))
+	fd_flush();
+    if (n > sizeof(fd_buf)) {
+	if (log_to_fd >= 0 && write(log_to_fd, p, n) != n)
+	    log_to_fd = -1;
+	return;
+    }
+    memcpy(fd_buf + fd_len, p, n);
+    fd_len += n;
+}
+
+/*
+ * fd_put_json - add s to fd_buf as the inside of a JSON string.
+ * Bytes above 0x7f are escaped too, since messages needn't be UTF-8.
+ */
+static void
+fd_put_json(const char *s, int n)
+{
+    static char hexchars[] = "0123456789abcdef";
+    char esc[6];
+    int i, c, start;
+
+    for (i = start = 0; i < n; ++i) {
+	c = (unsigned char) s[i];
+	if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+	    continue;
+	fd_put(s + start, i - start);
+	start = i + 1;
+	esc[0] = '\\';
+	if (c == '"' || c == '\\') {
+	    esc[1] = c;
+	    fd_put(esc, 2);
+	} else {
+	    esc[1] = 'u';
+	    esc[2] = esc[3] = '0';
+	    esc[4] = hexchars[c >> 4];
+	    esc[5] = hexchars[c & 0xf];
+	    fd_put(esc, 6);
+	}
+    }
+    fd_put(s + start, n - start);
+}
+
+/*
+ * fd_message - add a message of n chars to what goes to log_to_fd:
+ * the text and a newline or, with the logjson option, one line of
+ * JSON with the message and the state of the link when it was logged.
+ */
+static void
+fd_message(int level, char *msg, int n, struct timeval *tv, int ph)
+{
+    char hdr[128];
+    int l;
+
+    if (!log_json) {
+	fd_put(msg, n);
+	fd_put("\n", 1);
+	return;
+    }
+    l = slprintf(hdr, sizeof(hdr), "{\"time\":%ld.%03d,\"pid\":%d,"
+		 "\"unit\":%d,\"session\":%d,\"phase\":\"%s\","
+		 "\"level\":\"%s\",\"ifname\":\"", (long) tv->tv_sec,
+		 (int) (tv->tv_usec / 1000), (int) getpid(),
+		 ifname[0]? ifunit: -1, ppp_session_number, phase_name(ph), level_names[level & 7]);
+    fd_put(hdr, l);
+    fd_put_json(ifname, strlen(ifname));
+    fd_put("\",\"msg\":\"", 9);
+    fd_put_json(msg, n);
+    fd_put("\"}\n", 3);
+}
+
+/*
+ * log_flush_locked - log the debug messages saved up in log_buf,
+ * with log_lock held.
+ */
+static void
+log_flush_locked(void)
+{
+    int i, start, n;
+
+    if (log_nmsgs == 0)
+	return;
+    /* a forked child leaves its parent's messages to the parent */
+    if (getpid() != log_owner) {
+	log_nmsgs = 0;
+	log_len = 0;
+	return;
+    }
+    start = 0;
+    for (i = 0; i < log_nmsgs; ++i) {
+	n = log_ends[i] - start;
+	syslog(LOG_DEBUG, "%.*s", n, log_buf + start);
+	if (log_to_fd >= 0 && debug)
+	    fd_message(LOG_DEBUG, log_buf + start, n, &log_times[i],
+		       log_phases[i]);
+	start = log_ends[i];
+    }
+    fd_flush();
+    log_nmsgs = 0;
+    log_len = 0;
+}
+
+/*
+ * flush_log - log the debug messages saved up in log_buf.
+ */
+void
+flush_log(void)
+{
+    log_lock_take();
+    log_flush_locked();
+    log_lock_give();
+}
+
 static void
 log_write(int level, char *buf)
 {
+    int n = strlen(buf);
+    struct timeval tv;
+
+    if (n > 0 && buf[n-1] == '\n')
+	--n;
+    log_lock_init();
+    log_lock_take();
+    if (level == LOG_DEBUG && n <= LOG_BUFSIZE) {
+	if (log_nmsgs >= LOG_MAXMSGS || log_len + n > LOG_BUFSIZE)
+	    log_flush_locked();
+	if (log_nmsgs == 0)
+	    log_owner = getpid();
+	memcpy(log_buf + log_len, buf, n);
+	log_len += n;
+	if (log_json)
+	    gettimeofday(&log_times[log_nmsgs], NULL);
+	log_phases[log_nmsgs] = phase;
+	log_ends[log_nmsgs++] = log_len;
+	if (!log_atexit) {
+	    atexit(flush_log);
+	    log_atexit = 1;
+	}
+	log_lock_give();
+	return;
+    }
+
+    log_flush_locked();
     syslog(level, "%s", buf);
     if (log_to_fd >= 0 && (level != LOG_DEBUG || debug)) {
-	int n = strlen(buf);
-
-	if (n > 0 && buf[n-1] == '\n')
-	    --n;
-	if (write(log_to_fd, buf, n) != n
-	    || write(log_to_fd, "\n", 1) != 1)
-	    log_to_fd = -1;
+	if (log_json)
+	    gettimeofday(&tv, NULL);
+	fd_message(level, buf, n, &tv, phase);
+	fd_flush();
     }
+    log_lock_give();
 }
 #else
 static void
@@ -51,6 +51,11 @@
 
 #if DO_BSD_COMPRESS
 
+/* the dictionary's hash keys are overlaid on its prefix and suffix */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define BSD_LITTLE_ENDIAN
+#endif
+
 /*
  * PPP "BSD compress" compression
  *  The differences between this compression and the classic BSD LZW
@@ -43,7 +43,21 @@
 #include <string.h>
 
 #include "ppp-comp.h"
+#ifdef PPP_WITH_SYSTEM_ZLIB
+#include <zlib.h>
+
+/*
+ * The system zlib has none of the PPP additions to the bundled one.
+ * A sync flush is what the compressor's packet flush amounts to, and
+ * for a raw inflate, setting a dictionary adds to the history in the
+ * way that inflateIncomp does.
+ */
+#define Z_PACKET_FLUSH	Z_SYNC_FLUSH
+#define inflateIncomp(strm) \
+	inflateSetDictionary((strm), (strm)->next_in, (strm)->avail_in)
+#else
 #include "zlib.h"
+#endif
 
 #if DO_DEFLATE
 
@@ -65,8 +79,10 @@ struct deflate_state {
 
 #define DEFLATE_OVHD	2		/* Deflate overhead/packet */
 
+#ifndef PPP_WITH_SYSTEM_ZLIB
 static void	*z_alloc(void *, u_int items, u_int size);
 static void	z_free(void *, void *ptr, u_int nb);
+#endif
 static void	*z_decomp_alloc(u_char *options, int opt_len);
 static void	z_decomp_free(void *state);
 static int	z_decomp_init(void *state, u_char *options, int opt_len,
@@ -91,6 +107,7 @@ struct compressor ppp_deflate = {
     z_comp_stats,		/* decomp_stat */
 };
 
+#ifndef PPP_WITH_SYSTEM_ZLIB
 /*
  * Space allocation and freeing routines for use by zlib routines.
  */
@@ -105,6 +122,7 @@ z_free(void *notused, void *ptr, u_int nbytes)
 {
     free(ptr);
 }
+#endif
 
 static void
 z_comp_stats(void *arg, struct compstat *stats)
@@ -147,8 +165,16 @@ z_decomp_alloc(u_char *options, int opt_len)
 	return NULL;
 
     state->strm.next_out = NULL;
+#ifdef PPP_WITH_SYSTEM_ZLIB
+    state->strm.next_in = Z_NULL;
+    state->strm.avail_in = 0;
+    state->strm.zalloc = Z_NULL;
+    state->strm.zfree = Z_NULL;
+    state->strm.opaque = Z_NULL;
+#else
     state->strm.zalloc = (alloc_func) z_alloc;
     state->strm.zfree = (free_func) z_free;
+#endif
     if (inflateInit2(&state->strm, -w_size) != Z_OK) {
 	free(state);
 	return NULL;
@@ -254,6 +280,23 @@ z_decompress(void *arg, u_char *mi, int inlen, u_char *mo, int *outlenp)
     state->strm.avail_out = state->mru + 2;
 
     r = inflate(&state->strm, Z_PACKET_FLUSH);
+#ifdef PPP_WITH_SYSTEM_ZLIB
+    /*
+     * A packet flush ends the packet with just the type bits of an
+     * empty stored block, leaving inflate waiting for its length;
+     * supply that.  A sync flush would have put the length in, and
+     * then the packet ends in 0xff, which a packet flush never does.
+     */
+    if (r == Z_OK && state->strm.avail_in == 0 && mi[inlen - 1] != 0xff) {
+	static u_char stored_len[] = { 0, 0, 0xff, 0xff };
+
+	state->strm.next_in = stored_len;
+	state->strm.avail_in = sizeof(stored_len);
+	r = inflate(&state->strm, Z_SYNC_FLUSH);
+	if (r == Z_BUF_ERROR)
+	    r = Z_OK;
+    }
+#endif
     if (r != Z_OK) {
 #if !DEFLATE_DEBUG
 	if (state->debug)
@@ -36,10 +36,19 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "ppp-comp.h"
+#include "fcs.h"
 
 int hexmode;
 int pppmode;
@@ -50,6 +59,29 @@ int abs_times;
 time_t start_time;
 int start_time_tenths;
 int tot_sent, tot_rcvd;
+int range;			/* only show part of the file */
+long range_start, range_end;	/* in tenths of a second after start */
+long elapsed;			/* tenths of a second since start */
+int showing = 1;		/* within the range */
+int only_dir;			/* 1 = only sent, 2 = only received */
+#define MAX_PROTOS	16
+int protos[MAX_PROTOS];		/* protocols to show, with -p */
+int nprotos;
+FILE *pcapf;			/* pcapng output, with -w */
+time_t rec_start;		/* time of the last start record */
+int follow;			/* wait for more at the end, with -f */
+int follow_fd = -1;		/* inotify instance watching the file */
+
+/*
+ * The input is read through inp and inend, straight from the file
+ * if it can be mapped, or else through inbuf.
+ */
+unsigned char *inp, *inend;
+unsigned char *inmap;
+size_t inmaplen;
+unsigned char inbuf[65536];
+
+#define GETC(f)	(inp < inend? *inp++: refill(f))
 
 extern int optind;
 extern char *optarg;
@@ -58,6 +90,15 @@ void dumplog();
 void dumpppp();
 void show_time();
 void handle_ccp();
+int want_proto();
+void pcap_open();
+void pcap_packet();
+void open_input();
+void close_input();
+void follow_input();
+void wait_input();
+int refill();
+int skip();
 
 int
 main(ac, av)
@@ -68,7 +109,7 @@ main(ac, av)
     char *p;
     FILE *f;
 
-    while ((i = getopt(ac, av, "hprdm:a")) != -1) {
+    while ((i = getopt(ac, av, "hprdm:at:D:P:w:f")) != -1) {
 	switch (i) {
 	case 'h':
 	    hexmode = 1;
@@ -88,30 +129,209 @@ main(ac, av)
 	case 'a':
 	    abs_times = 1;
 	    break;
+	case 't':
+	    range = 1;
+	    range_start = strtod(optarg, &p) * 10;
+	    range_end = -1;
+	    if (*p == ',' && p[1] != 0)
+		range_end = strtod(p + 1, &p) * 10;
+	    if (*p != 0 && *p != ',') {
+		fprintf(stderr, "%s: bad time range %s\n", av[0], optarg);
+		exit(1);
+	    }
+	    showing = range_start <= 0;
+	    break;
+	case 'D':
+	    if (strcmp(optarg, "sent") == 0)
+		only_dir = 1;
+	    else if (strcmp(optarg, "rcvd") == 0)
+		only_dir = 2;
+	    else {
+		fprintf(stderr, "%s: -D takes sent or rcvd\n", av[0]);
+		exit(1);
+	    }
+	    break;
+	case 'P':
+	    for (p = optarg; *p != 0 && nprotos < MAX_PROTOS; ) {
+		protos[nprotos++] = strtol(p, &p, 16);
+		if (*p == ',')
+		    ++p;
+		else if (*p != 0) {
+		    fprintf(stderr, "%s: bad protocol list %s\n", av[0], optarg);
+		    exit(1);
+		}
+	    }
+	    break;
+	case 'w':
+	    pcap_open(optarg);
+	    pppmode = 1;
+	    break;
+	case 'f':
+	    follow = 1;
+	    break;
 	default:
-	    fprintf(stderr, "Usage: %s [-h | -p[d]] [-r] [-m mru] [-a] [file ...]\n", av[0]);
+	    fprintf(stderr, "Usage: %s [-h | -p[d]] [-r] [-m mru] [-a] [-t start[,end]] [-D sent|rcvd] [-P proto,...] [-w file] [-f] [file ...]\n", av[0]);
 	    exit(1);
 	}
     }
-    if (optind >= ac)
+    if (follow && ac - optind != 1) {
+	fprintf(stderr, "%s: -f takes just one file\n", av[0]);
+	exit(1);
+    }
+    if (optind >= ac) {
+	open_input(stdin);
 	dumplog(stdin);
-    else {
+    } else {
 	for (i = optind; i < ac; ++i) {
 	    p = av[i];
 	    if ((f = fopen(p, "r")) == NULL) {
 		perror(p);
 		exit(1);
 	    }
+	    if (follow)
+		follow_input(p);
+	    open_input(f);
 	    if (pppmode)
 		dumpppp(f);
 	    else
 		dumplog(f);
+	    close_input();
 	    fclose(f);
 	}
     }
     exit(0);
 }
 
+/*
+ * open_input - get ready to read f, by mapping it if we can.
+ */
+void
+open_input(f)
+    FILE *f;
+{
+    struct stat st;
+    void *m;
+
+    inp = inend = inmap = NULL;
+    if (follow)
+	return;		/* a mapping wouldn't grow with the file */
+    if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+	return;
+    m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (m == MAP_FAILED)
+	return;
+    madvise(m, st.st_size, MADV_SEQUENTIAL);
+    inmap = m;
+    inmaplen = st.st_size;
+    inp = inmap;
+    inend = inmap + inmaplen;
+}
+
+void
+close_input()
+{
+    if (inmap != NULL)
+	munmap(inmap, inmaplen);
+    inp = inend = inmap = NULL;
+}
+
+/*
+ * follow_input - get ready to wait for the file called name to grow.
+ * The watch is set up before the file is first read, so that nothing
+ * written after that can be missed.  Without inotify, wait_input
+ * polls instead.
+ */
+void
+follow_input(name)
+    char *name;
+{
+#ifdef __linux__
+    follow_fd = inotify_init1(IN_CLOEXEC);
+    if (follow_fd >= 0 && inotify_add_watch(follow_fd, name, IN_MODIFY) < 0) {
+	perror(name);
+	exit(1);
+    }
+#endif
+}
+
+/*
+ * wait_input - in follow mode, wait at the end of f until more has
+ * been written to it.  What has been printed so far is flushed out
+ * first, since it may be a while.
+ */
+void
+wait_input(f)
+    FILE *f;
+{
+#ifdef __linux__
+    char ev[sizeof(struct inotify_event) + NAME_MAX + 1];
+#endif
+
+    fflush(stdout);
+    if (pcapf != NULL)
+	fflush(pcapf);
+#ifdef __linux__
+    if (follow_fd >= 0) {
+	if (read(follow_fd, ev, sizeof(ev)) < 0 && errno != EINTR) {
+	    perror("inotify");
+	    exit(1);
+	}
+    } else
+#endif
+	sleep(1);
+    clearerr(f);
+}
+
+/*
+ * refill - get more input when inp reaches inend, and return the
+ * next byte, or EOF.  In follow mode it waits for more instead of
+ * returning EOF, so that the decoding carries on where it was, in
+ * the middle of a record or a packet if need be, and only what is
+ * new is read.
+ */
+int
+refill(f)
+    FILE *f;
+{
+    size_t n;
+
+    if (inmap != NULL)
+	return EOF;
+    while ((n = fread(inbuf, 1, sizeof(inbuf), f)) == 0) {
+	if (!follow)
+	    return EOF;
+	wait_input(f);
+    }
+    inp = inbuf;
+    inend = inbuf + n;
+    return *inp++;
+}
+
+/*
+ * skip - pass over n bytes of input.  Returns 0 if we hit EOF first.
+ */
+int
+skip(f, n)
+    FILE *f;
+    int n;
+{
+    int k;
+
+    while (n > 0) {
+	if (inp >= inend) {
+	    if (refill(f) == EOF)
+		return 0;
+	    --n;
+	}
+	k = inend - inp;
+	if (k > n)
+	    k = n;
+	inp += k;
+	n -= k;
+    }
+    return 1;
+}
+
 void
 dumplog(f)
     FILE *f;
@@ -120,20 +340,27 @@ dumplog(f)
     int nb, c2;
     unsigned char buf[16];
 
-    while ((c = getc(f)) != EOF) {
+    while ((c = GETC(f)) != EOF) {
 	switch (c) {
 	case 1:
 	case 2:
 	    if (reverse)
 		c = 3 - c;
+	    n = GETC(f);
+	    n = (n << 8) + GETC(f);
+	    *(c==1? &tot_sent: &tot_rcvd) += n;
+	    if (!showing || (only_dir && c != only_dir)) {
+		if (!skip(f, n)) {
+		    printf("\nEOF\n");
+		    exit(0);
+		}
+		break;
+	    }
 	    printf("%s %c", c==1? "sent": "rcvd", hexmode? ' ': '"');
 	    col = 6;
-	    n = getc(f);
-	    n = (n << 8) + getc(f);
-	    *(c==1? &tot_sent: &tot_rcvd) += n;
 	    nb = 0;
 	    for (; n > 0; --n) {
-		c = getc(f);
+		c = GETC(f);
 		if (c == EOF) {
 		    printf("\nEOF\n");
 		    exit(0);
@@ -183,7 +410,8 @@ dumplog(f)
 	    break;
 	case 3:
 	case 4:
-	    printf("end %s\n", c==3? "send": "recv");
+	    if (showing && (!only_dir || c - 2 == only_dir))
+		printf("end %s\n", c==3? "send": "recv");
 	    break;
 	case 5:
 	case 6:
@@ -196,45 +424,6 @@ dumplog(f)
     }
 }
 
-/*
- * FCS lookup table as calculated by genfcstab.
- */
-static u_short fcstab[256] = {
-	0x0000,	0x1189,	0x2312,	0x329b,	0x4624,	0x57ad,	0x6536,	0x74bf,
-	0x8c48,	0x9dc1,	0xaf5a,	0xbed3,	0xca6c,	0xdbe5,	0xe97e,	0xf8f7,
-	0x1081,	0x0108,	0x3393,	0x221a,	0x56a5,	0x472c,	0x75b7,	0x643e,
-	0x9cc9,	0x8d40,	0xbfdb,	0xae52,	0xdaed,	0xcb64,	0xf9ff,	0xe876,
-	0x2102,	0x308b,	0x0210,	0x1399,	0x6726,	0x76af,	0x4434,	0x55bd,
-	0xad4a,	0xbcc3,	0x8e58,	0x9fd1,	0xeb6e,	0xfae7,	0xc87c,	0xd9f5,
-	0x3183,	0x200a,	0x1291,	0x0318,	0x77a7,	0x662e,	0x54b5,	0x453c,
-	0xbdcb,	0xac42,	0x9ed9,	0x8f50,	0xfbef,	0xea66,	0xd8fd,	0xc974,
-	0x4204,	0x538d,	0x6116,	0x709f,	0x0420,	0x15a9,	0x2732,	0x36bb,
-	0xce4c,	0xdfc5,	0xed5e,	0xfcd7,	0x8868,	0x99e1,	0xab7a,	0xbaf3,
-	0x5285,	0x430c,	0x7197,	0x601e,	0x14a1,	0x0528,	0x37b3,	0x263a,
-	0xdecd,	0xcf44,	0xfddf,	0xec56,	0x98e9,	0x8960,	0xbbfb,	0xaa72,
-	0x6306,	0x728f,	0x4014,	0x519d,	0x2522,	0x34ab,	0x0630,	0x17b9,
-	0xef4e,	0xfec7,	0xcc5c,	0xddd5,	0xa96a,	0xb8e3,	0x8a78,	0x9bf1,
-	0x7387,	0x620e,	0x5095,	0x411c,	0x35a3,	0x242a,	0x16b1,	0x0738,
-	0xffcf,	0xee46,	0xdcdd,	0xcd54,	0xb9eb,	0xa862,	0x9af9,	0x8b70,
-	0x8408,	0x9581,	0xa71a,	0xb693,	0xc22c,	0xd3a5,	0xe13e,	0xf0b7,
-	0x0840,	0x19c9,	0x2b52,	0x3adb,	0x4e64,	0x5fed,	0x6d76,	0x7cff,
-	0x9489,	0x8500,	0xb79b,	0xa612,	0xd2ad,	0xc324,	0xf1bf,	0xe036,
-	0x18c1,	0x0948,	0x3bd3,	0x2a5a,	0x5ee5,	0x4f6c,	0x7df7,	0x6c7e,
-	0xa50a,	0xb483,	0x8618,	0x9791,	0xe32e,	0xf2a7,	0xc03c,	0xd1b5,
-	0x2942,	0x38cb,	0x0a50,	0x1bd9,	0x6f66,	0x7eef,	0x4c74,	0x5dfd,
-	0xb58b,	0xa402,	0x9699,	0x8710,	0xf3af,	0xe226,	0xd0bd,	0xc134,
-	0x39c3,	0x284a,	0x1ad1,	0x0b58,	0x7fe7,	0x6e6e,	0x5cf5,	0x4d7c,
-	0xc60c,	0xd785,	0xe51e,	0xf497,	0x8028,	0x91a1,	0xa33a,	0xb2b3,
-	0x4a44,	0x5bcd,	0x6956,	0x78df,	0x0c60,	0x1de9,	0x2f72,	0x3efb,
-	0xd68d,	0xc704,	0xf59f,	0xe416,	0x90a9,	0x8120,	0xb3bb,	0xa232,
-	0x5ac5,	0x4b4c,	0x79d7,	0x685e,	0x1ce1,	0x0d68,	0x3ff3,	0x2e7a,
-	0xe70e,	0xf687,	0xc41c,	0xd595,	0xa12a,	0xb0a3,	0x8238,	0x93b1,
-	0x6b46,	0x7acf,	0x4854,	0x59dd,	0x2d62,	0x3ceb,	0x0e70,	0x1ff9,
-	0xf78f,	0xe606,	0xd49d,	0xc514,	0xb1ab,	0xa022,	0x92b9,	0x8330,
-	0x7bc7,	0x6a4e,	0x58d5,	0x495c,	0x3de3,	0x2c6a,	0x1ef1,	0x0f78
-};
-#define PPP_FCS(fcs, c)	(((fcs) >> 8) ^ fcstab[((fcs) ^ (c)) & 0xff])
-
 struct pkt {
     int	cnt;
     int	esc;
@@ -258,7 +447,7 @@ dumpppp(f)
     FILE *f;
 {
     int c, n, k;
-    int nb, nl, dn, proto, rv;
+    int nb, nl, dn, proto, rv, show;
     char *dir, *q;
     unsigned char *p, *r, *endp;
     unsigned char *d;
@@ -267,7 +456,7 @@ dumpppp(f)
 
     spkt.cnt = rpkt.cnt = 0;
     spkt.esc = rpkt.esc = 0;
-    while ((c = getc(f)) != EOF) {
+    while ((c = GETC(f)) != EOF) {
 	switch (c) {
 	case 1:
 	case 2:
@@ -275,11 +464,20 @@ dumpppp(f)
 		c = 3 - c;
 	    dir = c==1? "sent": "rcvd";
 	    pkt = c==1? &spkt: &rpkt;
-	    n = getc(f);
-	    n = (n << 8) + getc(f);
+	    n = GETC(f);
+	    n = (n << 8) + GETC(f);
 	    *(c==1? &tot_sent: &tot_rcvd) += n;
+	    show = showing && (!only_dir || c == only_dir);
+	    if (only_dir && c != only_dir && !decompress) {
+		/* never shown, and no decompressor to keep up to date */
+		if (!skip(f, n)) {
+		    printf("\nEOF\n");
+		    exit(0);
+		}
+		break;
+	    }
 	    for (; n > 0; --n) {
-		c = getc(f);
+		c = GETC(f);
 		switch (c) {
 		case EOF:
 		    printf("\nEOF\n");
@@ -291,13 +489,17 @@ dumpppp(f)
 			       rpkt.cnt);
 		    exit(0);
 		case '~':
-		    if (pkt->cnt > 0) {
+		    if (pkt->cnt > 0 && !show && !decompress) {
+			/* no decompressor to keep up to date */
+			pkt->cnt = 0;
+			pkt->esc = 0;
+		    } else if (pkt->cnt > 0) {
 			q = dir;
-			if (pkt->esc) {
+			if (pkt->esc && show) {
 			    printf("%s aborted packet:\n     ", dir);
 			    q = "    ";
 			}
-			if (pkt->cnt >= sizeof(pkt->buf)) {
+			if (pkt->cnt >= sizeof(pkt->buf) && show) {
 			    printf("%s over-long packet truncated:\n     ", dir);
 			    q = "    ";
 			}
@@ -306,16 +508,15 @@ dumpppp(f)
 			pkt->cnt = 0;
 			pkt->esc = 0;
 			if (nb <= 2) {
+			    if (!show)
+				break;
 			    printf("%s short packet [%d bytes]:", q, nb);
 			    for (k = 0; k < nb; ++k)
 				printf(" %.2x", p[k]);
 			    printf("\n");
 			    break;
 			}
-			fcs = PPP_INITFCS;
-			for (k = 0; k < nb; ++k)
-			    fcs = PPP_FCS(fcs, p[k]);
-			fcs &= 0xFFFF;
+			fcs = ppp_fcs16(PPP_INITFCS, p, nb);
 			nb -= 2;
 			endp = p + nb;
 			r = p;
@@ -324,7 +525,7 @@ dumpppp(f)
 			if ((r[0] & 1) == 0)
 			    ++r;
 			++r;
-			if (endp - r > mru)
+			if (endp - r > mru && show)
 			    printf("     ERROR: length (%zd) > MRU (%d)\n",
 				   endp - r, mru);
 			if (decompress && fcs == PPP_GOODFCS) {
@@ -354,15 +555,17 @@ dumpppp(f)
 					if ((d[0] & 1) == 0)
 					    --dn;
 					--dn;
-					if (dn > mru)
+					if (dn > mru && show)
 					    printf("     ERROR: decompressed length (%d) > MRU (%d)\n", dn, mru);
 					break;
 				    case DECOMP_ERROR:
-					printf("     DECOMPRESSION ERROR\n");
+					if (show)
+					    printf("     DECOMPRESSION ERROR\n");
 					pkt->flags |= CCP_ERROR;
 					break;
 				    case DECOMP_FATALERROR:
-					printf("     FATAL DECOMPRESSION ERROR\n");
+					if (show)
+					    printf("     FATAL DECOMPRESSION ERROR\n");
 					pkt->flags |= CCP_FATALERROR;
 					break;
 				    }
@@ -372,6 +575,12 @@ dumpppp(f)
 				pkt->comp->incomp(pkt->state, r, endp - r);
 			    }
 			}
+			if (!show || !want_proto(p, nb))
+			    break;
+			if (pcapf != NULL) {
+			    pcap_packet(dir[0] == 's', p, nb);
+			    break;
+			}
 			do {
 			    nl = nb < 16? nb: 16;
 			    printf("%s ", q);
@@ -416,6 +625,8 @@ dumpppp(f)
 		c = 7 - c;
 	    dir = c==3? "send": "recv";
 	    pkt = c==3? &spkt: &rpkt;
+	    if (!showing || (only_dir && c - 2 != only_dir))
+		break;
 	    printf("end %s", dir);
 	    if (pkt->cnt > 0)
 		printf("  [%d bytes in incomplete packet]", pkt->cnt);
@@ -432,6 +643,117 @@ dumpppp(f)
     }
 }
 
+/*
+ * want_proto - say whether a packet of len bytes at p is of one of
+ * the protocols given with -P, or whether there wasn't a -P.
+ */
+int
+want_proto(p, len)
+    unsigned char *p;
+    int len;
+{
+    int i, proto;
+
+    if (nprotos == 0)
+	return 1;
+    if (len >= 2 && p[0] == 0xff && p[1] == 3) {
+	p += 2;
+	len -= 2;
+    }
+    if (len < 1)
+	return 0;
+    proto = p[0];
+    if ((proto & 1) == 0 && len >= 2)
+	proto = (proto << 8) + p[1];
+    for (i = 0; i < nprotos; ++i)
+	if (protos[i] == proto)
+	    return 1;
+    return 0;
+}
+
+/*
+ * With -w, the packets are written as a pcapng file, with link type
+ * LINKTYPE_PPP_WITH_DIR: each packet has a byte in front of it which
+ * is 1 if we sent it and 0 if we received it.  The blocks are written
+ * in our own byte order, which the section header block says.
+ */
+#define PCAPNG_SHB	0x0A0D0D0A
+#define PCAPNG_IDB	1
+#define PCAPNG_EPB	6
+#define LINKTYPE_PPP_WITH_DIR	204
+
+void
+pcap_block(type, body, len, data, dlen)
+    u_int32_t type;
+    u_int32_t *body;
+    int len;
+    unsigned char *data;
+    int dlen;
+{
+    u_int32_t hdr[2], total;
+    static unsigned char pad[4];
+
+    total = 12 + len + ((dlen + 3) & ~3);
+    hdr[0] = type;
+    hdr[1] = total;
+    fwrite(hdr, sizeof(hdr), 1, pcapf);
+    fwrite(body, len, 1, pcapf);
+    if (dlen > 0) {
+	fwrite(data, dlen, 1, pcapf);
+	fwrite(pad, -dlen & 3, 1, pcapf);
+    }
+    fwrite(&total, sizeof(total), 1, pcapf);
+}
+
+void
+pcap_open(name)
+    char *name;
+{
+    u_int32_t shb[4], idb[2];
+    u_int16_t *h;
+
+    pcapf = fopen(name, "w");
+    if (pcapf == NULL) {
+	perror(name);
+	exit(1);
+    }
+    shb[0] = 0x1A2B3C4D;	/* byte-order magic */
+    h = (u_int16_t *) &shb[1];
+    h[0] = 1;			/* version 1.0 */
+    h[1] = 0;
+    shb[2] = shb[3] = 0xffffffff;	/* section length not given */
+    pcap_block(PCAPNG_SHB, shb, sizeof(shb), NULL, 0);
+    h = (u_int16_t *) &idb[0];
+    h[0] = LINKTYPE_PPP_WITH_DIR;
+    h[1] = 0;
+    idb[1] = 0;			/* no snap length */
+    pcap_block(PCAPNG_IDB, idb, sizeof(idb), NULL, 0);
+}
+
+/*
+ * pcap_packet - write the packet of len bytes at p, with the time of
+ * the last time record, to microsecond resolution.
+ */
+void
+pcap_packet(sent, p, len)
+    int sent;
+    unsigned char *p;
+    int len;
+{
+    u_int32_t epb[5];
+    unsigned char frame[sizeof(dbuf) + 1];
+    u_int64_t t;
+
+    frame[0] = sent;
+    memcpy(frame + 1, p, len);
+    t = ((u_int64_t) rec_start * 10 + elapsed) * 100000;
+    epb[0] = 0;			/* interface 0 */
+    epb[1] = t >> 32;
+    epb[2] = t;
+    epb[3] = epb[4] = len + 1;
+    pcap_block(PCAPNG_EPB, epb, sizeof(epb), frame, len + 1);
+}
+
 extern struct compressor ppp_bsd_compress, ppp_deflate;
 
 struct compressor *compressors[] = {
@@ -511,29 +833,42 @@ show_time(f, c)
     struct tm *tm;
 
     if (c == 7) {
-	t = getc(f);
-	t = (t << 8) + getc(f);
-	t = (t << 8) + getc(f);
-	t = (t << 8) + getc(f);
-	printf("start %s", ctime(&t));
+	t = GETC(f);
+	t = (t << 8) + GETC(f);
+	t = (t << 8) + GETC(f);
+	t = (t << 8) + GETC(f);
+	if (pcapf == NULL)
+	    printf("start %s", ctime(&t));
 	start_time = t;
+	rec_start = t;
 	start_time_tenths = 0;
 	tot_sent = tot_rcvd = 0;
+	elapsed = 0;
+	if (range)
+	    showing = range_start <= 0;
     } else {
-	n = getc(f);
+	n = GETC(f);
 	if (c == 5) {
 	    for (c = 3; c > 0; --c)
-		n = (n << 8) + getc(f);
+		n = (n << 8) + GETC(f);
 	}
+	elapsed += n;
+	if (range)
+	    showing = elapsed >= range_start
+		&& (range_end < 0 || elapsed <= range_end);
+	if (pcapf != NULL)
+	    return;
 	if (abs_times) {
 	    n += start_time_tenths;
 	    start_time += n / 10;
 	    start_time_tenths = n % 10;
+	    if (!showing)
+		return;
 	    tm = localtime(&start_time);
 	    printf("time  %.2d:%.2d:%.2d.%d", tm->tm_hour, tm->tm_min,
 		   tm->tm_sec, start_time_tenths);
 	    printf("  (sent %d, rcvd %d)\n", tot_sent, tot_rcvd);
-	} else
+	} else if (showing)
 	    printf("time  %.1fs\n", (double) n / 10);
     }
 }
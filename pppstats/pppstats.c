@@ -1,12 +1,19 @@
 /*
  * print PPP statistics:
- * 	pppstats [-a|-d] [-v|-r|-z] [-c count] [-w wait] [interface]
+ * 	pppstats [-a|-d] [-v|-r|-z] [-s] [-c count] [-w wait] [interface ...]
+ * 	pppstats -m|-x [-f file] [-c count] [-w wait] [interface ...]
  *
  *   -a Show absolute values rather than deltas
  *   -d Show data rate (kB/s) rather than bytes
  *   -v Show more stats for VJ TCP header compression
  *   -r Show compression ratio
  *   -z Show compression statistics instead of default display
+ *   -s Summarize the rates seen per interval when finished
+ *   -m Print counters for all links from pppd's stats file
+ *   -x Print them as metrics for Prometheus
+ *
+ * The wait may be a fraction of a second.  Given several interfaces,
+ * the standard display shows their totals.
  *
  * History:
  *      perkins@cps.msu.edu: Added compression statistics and alternate 
@@ -51,6 +58,10 @@ static const char rcsid[] = "$Id: pppstats.c,v 1.29 2002/10/27 12:56:26 fcusack
 #include <sys/param.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
 
 #ifndef STREAMS
 #if defined(__linux__) && defined(__powerpc__) \
@@ -83,15 +94,27 @@ static const char rcsid[] = "$Id: pppstats.c,v 1.29 2002/10/27 12:56:26 fcusack
 
 #endif	/* STREAMS */
 
+#include "statsfile.h"
+
 int	vflag, rflag, zflag;	/* select type of display */
 int	aflag;			/* print absolute values, not deltas */
 int	dflag;			/* print data rates, not bytes */
-int	interval, count;
+int	mflag;			/* print all links from the stats file */
+int	xflag;			/* print them as Prometheus metrics */
+int	sflag;			/* summarize the rates at the end */
+double	interval;		/* seconds between reports */
+int	count;
 int	infinite;
 int	s;			/* socket or /dev/ppp file descriptor */
 int	signalled;		/* set if alarm goes off "early" */
+volatile int interrupted;	/* got SIGINT, with -s */
 char	*progname;
 char	*interface;
+char	**interfaces;		/* all the interfaces given */
+int	ninterfaces;
+double	*in_rates, *out_rates;	/* bytes/s in each interval, for -s */
+int	nrates, maxrates;
+char	*statsfile = PPPD_RUNTIME_DIR PPP_STATSFILE_NAME;
 
 #if defined(SUNOS4) || defined(ULTRIX) || defined(NeXT)
 extern int optind;
@@ -108,16 +131,24 @@ extern char *optarg;
 
 static void usage(void);
 static void catchalarm(int);
+static void catchint(int);
+static void start_timer(void);
 static void get_ppp_stats(struct ppp_stats *);
 static void get_ppp_cstats(struct ppp_comp_stats *);
+static void add_rates(double, double);
+static void summarize(void);
 static void intpr(void);
+static void statspr(void);
+static void metricspr(void);
 
 int main(int, char *argv[]);
 
 static void
 usage(void)
 {
-    fprintf(stderr, "Usage: %s [-a|-d] [-v|-r|-z] [-c count] [-w wait] [interface]\n",
+    fprintf(stderr, "Usage: %s [-a|-d] [-v|-r|-z] [-s] [-c count] [-w wait] [interface ...]\n",
+	    progname);
+    fprintf(stderr, "       %s -m|-x [-f file] [-c count] [-w wait] [interface ...]\n",
 	    progname);
     exit(1);
 }
@@ -132,10 +163,33 @@ catchalarm(int arg)
     signalled = 1;
 }
 
+static void
+catchint(int arg)
+{
+    interrupted = 1;
+}
+
+/*
+ * Set the alarm to go off after interval seconds, which may be less
+ * than one.
+ */
+static void
+start_timer(void)
+{
+    struct itimerval it;
+
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = (long) interval;
+    it.it_value.tv_usec = (long) ((interval - it.it_value.tv_sec) * 1e6);
+    if (it.it_value.tv_sec == 0 && it.it_value.tv_usec == 0)
+	it.it_value.tv_usec = 1;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
 
 #ifndef STREAMS
 static void
-get_ppp_stats(struct ppp_stats *curp)
+get_if_stats(char *name, struct ppp_stats *curp)
 {
     struct ifreq req;
 
@@ -143,7 +197,7 @@ get_ppp_stats(struct ppp_stats *curp)
 
     req.ifr_data = (caddr_t) curp;
 
-    strncpy(req.ifr_name, interface, IFNAMSIZ);
+    strncpy(req.ifr_name, name, IFNAMSIZ);
     req.ifr_name[IFNAMSIZ - 1] = 0;
     if (ioctl(s, SIOCGPPPSTATS, &req) < 0) {
 	fprintf(stderr, "%s: ", progname);
@@ -156,7 +210,7 @@ get_ppp_stats(struct ppp_stats *curp)
 }
 
 static void
-get_ppp_cstats(struct ppp_comp_stats *csp)
+get_if_cstats(char *name, struct ppp_comp_stats *csp)
 {
     struct ifreq req;
     struct ppp_comp_stats stats;
@@ -165,7 +219,7 @@ get_ppp_cstats(struct ppp_comp_stats *csp)
 
     req.ifr_data = (caddr_t) &stats;
 
-    strncpy(req.ifr_name, interface, IFNAMSIZ);
+    strncpy(req.ifr_name, name, IFNAMSIZ);
     req.ifr_name[IFNAMSIZ - 1] = 0;
     if (ioctl(s, SIOCGPPPCSTATS, &req) < 0) {
 	fprintf(stderr, "%s: ", progname);
@@ -203,6 +257,75 @@ get_ppp_cstats(struct ppp_comp_stats *csp)
     *csp = stats;
 }
 
+#define ADD(x)	(tot->x += one.x)
+
+/*
+ * With several interfaces, add up the counters we display.
+ */
+static void
+get_ppp_stats(struct ppp_stats *tot)
+{
+    struct ppp_stats one;
+    int i;
+
+    if (ninterfaces <= 1) {
+	get_if_stats(interface, tot);
+	return;
+    }
+    memset(tot, 0, sizeof(*tot));
+    for (i = 0; i < ninterfaces; ++i) {
+	get_if_stats(interfaces[i], &one);
+	ADD(p.ppp_ibytes);
+	ADD(p.ppp_ipackets);
+	ADD(p.ppp_obytes);
+	ADD(p.ppp_opackets);
+	ADD(vj.vjs_packets);
+	ADD(vj.vjs_compressed);
+	ADD(vj.vjs_searches);
+	ADD(vj.vjs_misses);
+	ADD(vj.vjs_uncompressedin);
+	ADD(vj.vjs_compressedin);
+	ADD(vj.vjs_errorin);
+	ADD(vj.vjs_tossed);
+    }
+}
+
+static void
+get_ppp_cstats(struct ppp_comp_stats *tot)
+{
+    struct ppp_comp_stats one;
+    int i;
+
+    if (ninterfaces <= 1) {
+	get_if_cstats(interface, tot);
+	return;
+    }
+    memset(tot, 0, sizeof(*tot));
+    for (i = 0; i < ninterfaces && (zflag || rflag); ++i) {
+	get_if_cstats(interfaces[i], &one);
+	ADD(c.unc_bytes);
+	ADD(c.unc_packets);
+	ADD(c.comp_bytes);
+	ADD(c.comp_packets);
+	ADD(c.inc_bytes);
+	ADD(c.inc_packets);
+	ADD(c.in_count);
+	ADD(c.bytes_out);
+	ADD(d.unc_bytes);
+	ADD(d.unc_packets);
+	ADD(d.comp_bytes);
+	ADD(d.comp_packets);
+	ADD(d.inc_bytes);
+	ADD(d.inc_packets);
+	ADD(d.in_count);
+	ADD(d.bytes_out);
+    }
+    tot->c.ratio = tot->c.bytes_out == 0? 0.0:
+	256.0 * tot->c.in_count / tot->c.bytes_out;
+    tot->d.ratio = tot->d.bytes_out == 0? 0.0:
+	256.0 * tot->d.in_count / tot->d.bytes_out;
+}
+
 #else	/* STREAMS */
 
 int
@@ -263,6 +386,61 @@ get_ppp_cstats(struct ppp_comp_stats *csp)
 
 #define KBPS(n)		((n) / (interval * 1000.0))
 
+/*
+ * add_rates - remember the byte rates seen in one interval, for -s.
+ */
+static void
+add_rates(double in, double out)
+{
+    if (nrates >= maxrates) {
+	maxrates = maxrates? 2 * maxrates: 256;
+	in_rates = realloc(in_rates, maxrates * sizeof(double));
+	out_rates = realloc(out_rates, maxrates * sizeof(double));
+	if (in_rates == NULL || out_rates == NULL) {
+	    fprintf(stderr, "%s: out of memory\n", progname);
+	    exit(1);
+	}
+    }
+    in_rates[nrates] = in;
+    out_rates[nrates] = out;
+    ++nrates;
+}
+
+static int
+cmp_rates(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y? -1: x > y;
+}
+
+/* nearest-rank percentile of n sorted rates */
+#define PCTL(r, n, pc)	((r)[((n) * (pc) + 99) / 100 - 1])
+
+static void
+print_rates(const char *name, double *r, int n)
+{
+    qsort(r, n, sizeof(double), cmp_rates);
+    printf("%-4s %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n", name,
+	   r[0], PCTL(r, n, 50), PCTL(r, n, 90), PCTL(r, n, 95),
+	   PCTL(r, n, 99), r[n - 1]);
+}
+
+/*
+ * summarize - print percentiles of the per-interval byte rates.
+ */
+static void
+summarize(void)
+{
+    if (nrates == 0)
+	return;
+    printf("\n%d intervals of %gs, bytes/s:\n", nrates, interval);
+    printf("%-4s %10s %10s %10s %10s %10s %10s\n", "",
+	   "MIN", "P50", "P90", "P95", "P99", "MAX");
+    print_rates("IN", in_rates, nrates);
+    print_rates("OUT", out_rates, nrates);
+}
+
 /*
  * Print a running summary of interface statistics.
  * Repeat display every interval seconds, showing statistics
@@ -289,7 +467,7 @@ intpr(void)
 
 	(void)signal(SIGALRM, catchalarm);
 	signalled = 0;
-	(void)alarm(interval);
+	start_timer();
 
 	if ((line % 20) == 0) {
 	    if (zflag) {
@@ -401,6 +579,8 @@ intpr(void)
 
 	putchar('\n');
 	fflush(stdout);
+	if (sflag && line > 0 && !aflag)
+	    add_rates(V(p.ppp_ibytes) / interval, V(p.ppp_obytes) / interval);
 	line++;
 
 	count--;
@@ -409,14 +589,17 @@ intpr(void)
 
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGALRM);
+	sigaddset(&mask, SIGINT);
 	sigprocmask(SIG_BLOCK, &mask, &oldmask);
-	if (!signalled) {
+	if (!signalled && !interrupted) {
 	    sigemptyset(&mask);
 	    sigsuspend(&mask);
 	}
 	sigprocmask(SIG_SETMASK, &oldmask, NULL);
+	if (interrupted)
+	    break;
 	signalled = 0;
-	(void)alarm(interval);
+	start_timer();
 
 	if (!aflag) {
 	    old = cur;
@@ -426,6 +609,309 @@ intpr(void)
     }
 }
 
+/*
+ * read_slots - copy the slots in use for the links we want out of the
+ * stats file on fd, into slots (grown as needed), with their unit
+ * numbers in units.  The file is mapped once per call, so this costs
+ * the same number of system calls however many links there are.
+ */
+static int
+read_slots(int fd, struct ppp_statsfile_slot **slots, int **units, int *max)
+{
+    struct ppp_statsfile_header hdr;
+    struct ppp_statsfile_slot slot;
+    volatile struct ppp_statsfile_slot *sp;
+    struct stat st;
+    char *map;
+    size_t n, nslots;
+    uint32_t seq;
+    int i, nused;
+
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(hdr)) {
+	fprintf(stderr, "%s: %s is not a stats file\n", progname, statsfile);
+	exit(1);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+	fprintf(stderr, "%s: couldn't map ", progname);
+	perror(statsfile);
+	exit(1);
+    }
+    memcpy(&hdr, map, sizeof(hdr));
+    if (hdr.magic != PPP_STATSFILE_MAGIC
+	|| hdr.version != PPP_STATSFILE_VERSION
+	|| hdr.slot_size != PPP_STATSFILE_SLOTSIZE) {
+	fprintf(stderr, "%s: %s is not a stats file for this version\n",
+		progname, statsfile);
+	exit(1);
+    }
+
+    nused = 0;
+    nslots = st.st_size / PPP_STATSFILE_SLOTSIZE;
+    for (n = 1; n < nslots; ++n) {
+	sp = (struct ppp_statsfile_slot *) (map + n * PPP_STATSFILE_SLOTSIZE);
+	do {
+	    while ((seq = sp->seq) & 1)
+		;
+	    __sync_synchronize();
+	    memcpy(&slot, (void *) sp, sizeof(slot));
+	    __sync_synchronize();
+	} while (sp->seq != seq);
+
+	if (slot.pid == 0)
+	    continue;
+	slot.ifname[sizeof(slot.ifname) - 1] = 0;
+	if (ninterfaces > 0) {
+	    for (i = 0; i < ninterfaces; ++i)
+		if (strcmp(interfaces[i], slot.ifname) == 0)
+		    break;
+	    if (i == ninterfaces)
+		continue;
+	}
+	if (nused >= *max) {
+	    *max = *max? 2 * *max: 16;
+	    *slots = realloc(*slots, *max * sizeof(**slots));
+	    *units = realloc(*units, *max * sizeof(**units));
+	    if (*slots == NULL || *units == NULL) {
+		fprintf(stderr, "%s: out of memory\n", progname);
+		exit(1);
+	    }
+	}
+	(*slots)[nused] = slot;
+	(*units)[nused] = n - 1;
+	++nused;
+    }
+    munmap(map, st.st_size);
+    return nused;
+}
+
+static int
+open_statsfile(void)
+{
+    int fd;
+
+    fd = open(statsfile, O_RDONLY);
+    if (fd < 0) {
+	fprintf(stderr, "%s: couldn't open ", progname);
+	perror(statsfile);
+	exit(1);
+    }
+    return fd;
+}
+
+static void
+pause_interval(void)
+{
+    struct timespec ts;
+
+    ts.tv_sec = (time_t) interval;
+    ts.tv_nsec = (long) ((interval - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * statspr - print the counters that pppd publishes in its stats file
+ * for every link (or just the interfaces given) as tab-separated
+ * lines, every interval seconds.
+ */
+static void
+statspr(void)
+{
+    struct ppp_statsfile_slot *slots = NULL, *sp;
+    int *units = NULL;
+    int fd, i, n, max = 0;
+
+    fd = open_statsfile();
+    printf("unit\tinterface\tpid\tupdated\tbytes_in\tbytes_out"
+	   "\tpkts_in\tpkts_out\tcomp_unc_bytes\tcomp_bytes"
+	   "\tdecomp_unc_bytes\tdecomp_bytes\techo_rtt_us"
+	   "\tcomp_method\tdecomp_method\tcomp_pkts\tcomp_inc_pkts"
+	   "\tcomp_inc_bytes\tdecomp_inc_pkts\treset_req_sent"
+	   "\treset_req_rcvd\treset_ack_rcvd\treset_timeouts"
+	   "\treset_rtt_us\treset_rtt_max_us\n");
+    for (;;) {
+	n = read_slots(fd, &slots, &units, &max);
+	for (i = 0; i < n; ++i) {
+	    sp = &slots[i];
+	    printf("%d\t%s\t%d\t%lld\t%llu\t%llu\t%llu\t%llu\t%u\t%u\t%u\t%u\t%u"
+		   "\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n",
+		   units[i], sp->ifname, sp->pid,
+		   (long long) sp->updated,
+		   (unsigned long long) sp->bytes_in,
+		   (unsigned long long) sp->bytes_out,
+		   (unsigned long long) sp->pkts_in,
+		   (unsigned long long) sp->pkts_out,
+		   sp->comp_unc_bytes, sp->comp_bytes,
+		   sp->decomp_unc_bytes, sp->decomp_bytes,
+		   sp->echo_rtt_us,
+		   sp->comp_method, sp->decomp_method,
+		   sp->comp_pkts, sp->comp_inc_pkts, sp->comp_inc_bytes,
+		   sp->decomp_inc_pkts,
+		   sp->reset_req_sent, sp->reset_req_rcvd,
+		   sp->reset_ack_rcvd, sp->reset_timeouts,
+		   sp->reset_rtt_us, sp->reset_rtt_max_us);
+	}
+	fflush(stdout);
+
+	if (!infinite && --count <= 0)
+	    break;
+	pause_interval();
+    }
+    close(fd);
+}
+
+/*
+ * The counters and gauges that metricspr prints for each link, as
+ * the Prometheus text exposition format has them: every sample of a
+ * metric comes together, after its HELP and TYPE lines.
+ */
+struct metric {
+    const char	*name;
+    const char	*type;
+    const char	*help;
+    size_t	offset;		/* of the field in the slot */
+    int		size;		/* 4 or 8 bytes */
+    double	scale;		/* to get the value in base units */
+};
+
+#define SLOT(f)		offsetof(struct ppp_statsfile_slot, f), \
+			sizeof(((struct ppp_statsfile_slot *) 0)->f)
+
+static const struct metric metrics[] = {
+    { "ppp_receive_bytes_total", "counter",
+      "Bytes received on the interface", SLOT(bytes_in), 1 },
+    { "ppp_transmit_bytes_total", "counter",
+      "Bytes sent on the interface", SLOT(bytes_out), 1 },
+    { "ppp_receive_packets_total", "counter",
+      "Packets received on the interface", SLOT(pkts_in), 1 },
+    { "ppp_transmit_packets_total", "counter",
+      "Packets sent on the interface", SLOT(pkts_out), 1 },
+    { "ppp_compress_in_bytes_total", "counter",
+      "Bytes given to the CCP compressor", SLOT(comp_unc_bytes), 1 },
+    { "ppp_compress_out_bytes_total", "counter",
+      "Bytes sent by the CCP compressor", SLOT(comp_bytes), 1 },
+    { "ppp_decompress_in_bytes_total", "counter",
+      "Bytes received by the CCP decompressor", SLOT(decomp_bytes), 1 },
+    { "ppp_decompress_out_bytes_total", "counter",
+      "Bytes out of the CCP decompressor", SLOT(decomp_unc_bytes), 1 },
+    { "ppp_ccp_reset_requests_sent_total", "counter",
+      "CCP Reset-Requests sent", SLOT(reset_req_sent), 1 },
+    { "ppp_ccp_reset_requests_received_total", "counter",
+      "CCP Reset-Requests received", SLOT(reset_req_rcvd), 1 },
+    { "ppp_ccp_reset_timeouts_total", "counter",
+      "CCP Reset-Requests never acknowledged", SLOT(reset_timeouts), 1 },
+    { "ppp_lcp_echo_srtt_seconds", "gauge",
+      "Smoothed LCP echo round trip time", SLOT(echo_rtt_us), 1e-6 },
+    { "ppp_connect_seconds", "gauge",
+      "Time the connect script took for the last link", SLOT(connect_ms), 1e-3 },
+    { "ppp_establish_seconds", "gauge",
+      "Time LCP took to open for the last link", SLOT(establish_ms), 1e-3 },
+    { "ppp_authenticate_seconds", "gauge",
+      "Time authentication took for the last link", SLOT(auth_ms), 1e-3 },
+    { "ppp_network_seconds", "gauge",
+      "Time the network protocols took for the last link", SLOT(network_ms), 1e-3 },
+    { "ppp_last_update_seconds", "gauge",
+      "Time pppd last updated the counters", SLOT(updated), 1 },
+};
+
+#define LABELS	"{unit=\"%d\",interface=\"%s\"}"
+
+static void
+print_value(struct ppp_statsfile_slot *sp, const struct metric *m)
+{
+    char *f = (char *) sp + m->offset;
+    uint64_t v;
+
+    if (m->size == 8)
+	memcpy(&v, f, 8);
+    else
+	v = *(uint32_t *) f;
+    if (m->scale == 1)
+	printf(" %llu\n", (unsigned long long) v);
+    else
+	printf(" %.6f\n", v * m->scale);
+}
+
+static double
+ratio(uint32_t unc, uint32_t comp)
+{
+    return comp == 0? 1.0: (double) unc / comp;
+}
+
+/*
+ * metricspr - print the links in the stats file as metrics for
+ * Prometheus to scrape, for example through the node exporter's
+ * textfile collector or from inetd.
+ */
+static void
+metricspr(void)
+{
+    static const uint32_t bounds[] = PPP_STATSFILE_RTT_BOUNDS;
+    struct ppp_statsfile_slot *slots = NULL, *sp;
+    const struct metric *m;
+    int *units = NULL;
+    int fd, i, j, n, max = 0;
+    unsigned long long cum;
+
+    fd = open_statsfile();
+    for (;;) {
+	n = read_slots(fd, &slots, &units, &max);
+	printf("# HELP ppp_link_info The pppd running each link\n"
+	       "# TYPE ppp_link_info gauge\n");
+	for (i = 0; i < n; ++i)
+	    printf("ppp_link_info{unit=\"%d\",interface=\"%s\",pid=\"%d\"} 1\n",
+		   units[i], slots[i].ifname, slots[i].pid);
+	for (m = metrics; m < metrics + sizeof(metrics) / sizeof(metrics[0]); ++m) {
+	    printf("# HELP %s %s\n# TYPE %s %s\n", m->name, m->help,
+		   m->name, m->type);
+	    for (i = 0; i < n; ++i) {
+		printf("%s" LABELS, m->name, units[i], slots[i].ifname);
+		print_value(&slots[i], m);
+	    }
+	}
+
+	printf("# HELP ppp_compression_ratio Uncompressed over compressed bytes\n"
+	       "# TYPE ppp_compression_ratio gauge\n");
+	for (i = 0; i < n; ++i) {
+	    sp = &slots[i];
+	    printf("ppp_compression_ratio{unit=\"%d\",interface=\"%s\","
+		   "direction=\"transmit\"} %.4f\n", units[i], sp->ifname,
+		   ratio(sp->comp_unc_bytes, sp->comp_bytes));
+	    printf("ppp_compression_ratio{unit=\"%d\",interface=\"%s\","
+		   "direction=\"receive\"} %.4f\n", units[i], sp->ifname,
+		   ratio(sp->decomp_unc_bytes, sp->decomp_bytes));
+	}
+
+	printf("# HELP ppp_lcp_echo_rtt_seconds LCP echo round trip times\n"
+	       "# TYPE ppp_lcp_echo_rtt_seconds histogram\n");
+	for (i = 0; i < n; ++i) {
+	    sp = &slots[i];
+	    cum = 0;
+	    for (j = 0; j < PPP_STATSFILE_RTT_BUCKETS; ++j) {
+		cum += sp->echo_rtt_hist[j];
+		if (j < PPP_STATSFILE_RTT_BUCKETS - 1)
+		    printf("ppp_lcp_echo_rtt_seconds_bucket{unit=\"%d\","
+			   "interface=\"%s\",le=\"%g\"} %llu\n",
+			   units[i], sp->ifname, bounds[j] / 1e6, cum);
+		else
+		    printf("ppp_lcp_echo_rtt_seconds_bucket{unit=\"%d\","
+			   "interface=\"%s\",le=\"+Inf\"} %llu\n",
+			   units[i], sp->ifname, cum);
+	    }
+	    printf("ppp_lcp_echo_rtt_seconds_sum" LABELS " %.6f\n",
+		   units[i], sp->ifname, sp->echo_rtt_sum_us / 1e6);
+	    printf("ppp_lcp_echo_rtt_seconds_count" LABELS " %u\n",
+		   units[i], sp->ifname, sp->echo_rtt_count);
+	}
+	fflush(stdout);
+
+	if (!infinite && --count <= 0)
+	    break;
+	pause_interval();
+    }
+    close(fd);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -441,7 +927,7 @@ main(int argc, char *argv[])
     else
 	++progname;
 
-    while ((c = getopt(argc, argv, "advrzc:w:")) != -1) {
+    while ((c = getopt(argc, argv, "advrzmsxc:f:w:")) != -1) {
 	switch (c) {
 	case 'a':
 	    ++aflag;
@@ -458,13 +944,25 @@ main(int argc, char *argv[])
 	case 'z':
 	    ++zflag;
 	    break;
+	case 'm':
+	    ++mflag;
+	    break;
+	case 's':
+	    ++sflag;
+	    break;
+	case 'x':
+	    ++xflag;
+	    break;
+	case 'f':
+	    statsfile = optarg;
+	    break;
 	case 'c':
 	    count = atoi(optarg);
 	    if (count <= 0)
 		usage();
 	    break;
 	case 'w':
-	    interval = atoi(optarg);
+	    interval = atof(optarg);
 	    if (interval <= 0)
 		usage();
 	    break;
@@ -484,10 +982,25 @@ main(int argc, char *argv[])
     if (aflag)
 	dflag = 0;
 
-    if (argc > 1)
+#ifdef STREAMS
+    if (argc > 1 && !mflag && !xflag)
 	usage();
+#endif
     if (argc > 0)
 	interface = argv[0];
+    interfaces = argv;
+    ninterfaces = argc;
+
+    if (xflag) {
+	metricspr();
+	exit(0);
+    }
+    if (mflag) {
+	statspr();
+	exit(0);
+    }
+    if (sflag)
+	(void)signal(SIGINT, catchint);
 
 #ifndef STREAMS
     {
@@ -504,13 +1017,19 @@ main(int argc, char *argv[])
 #undef  ifr_name
 #define ifr_name ifr_ifrn.ifrn_name
 #endif
-	strncpy(ifr.ifr_name, interface, IFNAMSIZ);
-	ifr.ifr_name[IFNAMSIZ - 1] = 0;
-	if (ioctl(s, SIOCGIFFLAGS, (caddr_t)&ifr) < 0) {
-	    fprintf(stderr, "%s: nonexistent interface '%s' specified\n",
-		    progname, interface);
-	    exit(1);
+	for (c = 0; c < (argc > 0? argc: 1); ++c) {
+	    if (argc > 0)
+		interface = argv[c];
+	    strncpy(ifr.ifr_name, interface, IFNAMSIZ);
+	    ifr.ifr_name[IFNAMSIZ - 1] = 0;
+	    if (ioctl(s, SIOCGIFFLAGS, (caddr_t)&ifr) < 0) {
+		fprintf(stderr, "%s: nonexistent interface '%s' specified\n",
+			progname, interface);
+		exit(1);
+	    }
 	}
+	if (argc > 0)
+	    interface = argv[0];
     }
 
 #else	/* STREAMS */
@@ -537,5 +1056,7 @@ main(int argc, char *argv[])
 #endif	/* STREAMS */
 
     intpr();
+    if (sflag)
+	summarize();
     exit(0);
 }
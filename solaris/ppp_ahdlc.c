@@ -113,6 +113,7 @@ static int ahdlc_wput(queue_t *, mblk_t *);
 static int ahdlc_rput(queue_t *, mblk_t *);
 static void ahdlc_encode(queue_t *, mblk_t *);
 static void ahdlc_decode(queue_t *, mblk_t *);
+static void ahdlc_fcs_init(void);
 static int msg_byte(mblk_t *, unsigned int);
 
 #if defined(SOL2)
@@ -170,11 +171,16 @@ int ppp_ahdlc_count = 0;	    /* open counter */
 #endif /* SUNOS4 */
 
 /*
- * Per-stream state structure
+ * Per-stream state structure.  The module is D_MTQPAIR, so its put
+ * procedures are only ever run one at a time for a stream, and the
+ * receive state and the statistics need no lock of their own.  The
+ * lock is held just to change or take a copy of the ACCMs, MTU and
+ * MRU, so that a frame is encoded or decoded with one consistent set
+ * of them and not while they are half-updated.
  */
 typedef struct ahdlc_state {
 #if defined(USE_MUTEX)
-    kmutex_t	    lock;		    /* lock for this structure */
+    kmutex_t	    lock;		    /* lock for the link settings */
 #endif /* USE_MUTEX */
     int		    flags;		    /* link flags */
     mblk_t	    *rx_buf;		    /* ptr to receive buffer */
@@ -276,6 +282,7 @@ MOD_OPEN(ahdlc_open)
 
     q->q_ptr	 = (caddr_t) state;
     WR(q)->q_ptr = (caddr_t) state;
+    ahdlc_fcs_init();
 
 #if defined(USE_MUTEX)
     mutex_init(&state->lock, NULL, MUTEX_DEFAULT, NULL);
@@ -418,9 +425,7 @@ ahdlc_wput(q, mp)
 	    if (mp->b_cont != 0)
 		freemsg(mp->b_cont);
 	    mp->b_cont = np;
-	    MUTEX_ENTER(&state->lock);
 	    *(int *)np->b_wptr = state->flags & RCV_FLAGS;
-	    MUTEX_EXIT(&state->lock);
 	    np->b_wptr += sizeof(int);
 	    iop->ioc_count = sizeof(int);
 	    error = 0;
@@ -520,14 +525,12 @@ ahdlc_rput(q, mp)
 	break;
 
     case M_HANGUP:
-	MUTEX_ENTER(&state->lock);
 	if (state->rx_buf != 0) {
 	    /* XXX would like to send this up for debugging */
 	    freemsg(state->rx_buf);
 	    state->rx_buf = 0;
 	}
 	state->flags = IFLUSH;
-	MUTEX_EXIT(&state->lock);
 	putnext(q, mp);
 	break;
 
@@ -542,18 +545,114 @@ ahdlc_rput(q, mp)
  */
 #define IN_TX_MAP(c, m)	((m)[(c) >> 5] & (1 << ((c) & 0x1f)))
 
+/*
+ * FCS tables for slicing-by-8: fcstab8[k][b] is the FCS contribution
+ * of byte b followed by k more bytes of zeros.  Row 0 is fcstab.
+ */
+static u_short fcstab8[8][256];
+static int fcstab8_ready;
+
+static void
+ahdlc_fcs_init()
+{
+    int i, k;
+
+    if (fcstab8_ready)
+	return;
+    for (i = 0; i < 256; i++)
+	fcstab8[0][i] = fcstab[i];
+    for (k = 1; k < 8; k++)
+	for (i = 0; i < 256; i++)
+	    fcstab8[k][i] = (fcstab8[k-1][i] >> 8)
+		^ fcstab[fcstab8[k-1][i] & 0xff];
+    fcstab8_ready = 1;
+}
+
+/*
+ * Run the FCS over len bytes at dp, eight at a time where possible
+ */
+static ushort_t
+ahdlc_fcs(fcs, dp, len)
+    ushort_t	fcs;
+    uchar_t	*dp;
+    int		len;
+{
+    if (fcstab8_ready) {
+	for (; len >= 8; dp += 8, len -= 8) {
+	    fcs ^= dp[0] | (dp[1] << 8);
+	    fcs = fcstab8[7][fcs & 0xff] ^ fcstab8[6][fcs >> 8]
+		^ fcstab8[5][dp[2]] ^ fcstab8[4][dp[3]]
+		^ fcstab8[3][dp[4]] ^ fcstab8[2][dp[5]]
+		^ fcstab8[1][dp[6]] ^ fcstab8[0][dp[7]];
+	}
+    }
+    for (; len > 0; dp++, len--)
+	fcs = PPP_FCS(fcs, *dp);
+    return fcs;
+}
+
+/*
+ * Word-at-a-time tests for whether any byte of the long w is zero or
+ * is b.  They work in either byte order.
+ */
+#define ONES_W		(~0UL / 0xff)
+#define HAS_ZERO_W(w)	(((w) - ONES_W) & ~(w) & (ONES_W << 7))
+#define HAS_BYTE_W(w, b) HAS_ZERO_W((w) ^ (ONES_W * (b)))
+
+/*
+ * True if xaccm escapes only 0x7d and 0x7e, as on most links once the
+ * ACCM has been negotiated, so that escapes are rare and whole words
+ * can be checked for them at once
+ */
+#define SIMPLE_TX_MAP(m) \
+    (((m)[0] | (m)[1] | (m)[2] | ((m)[3] & ~0x60000000) \
+      | (m)[4] | (m)[5] | (m)[6] | (m)[7]) == 0)
+
+/*
+ * Find the first byte from dp up to end that xaccm says must be
+ * escaped, or end if there are none.  With a simple map, whole words
+ * without 0x7d or 0x7e are passed over.
+ */
+static uchar_t *
+ahdlc_tx_scan(dp, end, xaccm, simple)
+    uchar_t	*dp, *end;
+    u_int32_t	*xaccm;
+    int		simple;
+{
+    unsigned long w;
+    int		i;
+
+    if (simple) {
+	for (; dp < end && ((uintpointer_t) dp & (sizeof(w) - 1)) != 0; dp++)
+	    if (IN_TX_MAP(*dp, xaccm))
+		return dp;
+	for (; end - dp >= sizeof(w); dp += sizeof(w)) {
+	    w = *(unsigned long *) dp;
+	    if (HAS_BYTE_W(w, PPP_ESCAPE) || HAS_BYTE_W(w, PPP_FLAG)) {
+		for (i = 0; i < sizeof(w); i++)
+		    if (IN_TX_MAP(dp[i], xaccm))
+			return dp + i;
+	    }
+	}
+    }
+    for (; dp < end; dp++)
+	if (IN_TX_MAP(*dp, xaccm))
+	    return dp;
+    return end;
+}
+
 static void
 ahdlc_encode(q, mp)
     queue_t	*q;
     mblk_t	*mp;
 {
     ahdlc_state_t	*state;
-    u_int32_t		*xaccm, loc_xaccm[8];
+    u_int32_t		xaccm[8];
     ushort_t		fcs;
     size_t		outmp_len;
     mblk_t		*outmp, *tmp;
-    uchar_t		*dp, fcs_val;
-    int			is_lcp, code;
+    uchar_t		*dp, *end, *ep, fcs_val;
+    int			is_lcp, code, simple;
 #if defined(SOL2)
     clock_t		lbolt;
 #endif /* SOL2 */
@@ -564,19 +663,51 @@ ahdlc_encode(q, mp)
 
     state = (ahdlc_state_t *)q->q_ptr;
     MUTEX_ENTER(&state->lock);
+    bcopy((caddr_t)state->xaccm, (caddr_t)xaccm, sizeof(xaccm));
+    MUTEX_EXIT(&state->lock);
+
+    /*
+     * All control characters must be escaped for LCP packets with code
+     * values between 1 (Conf-Req) and 7 (Code-Rej).
+     */
+    is_lcp = ((MSG_BYTE(mp, 0) == PPP_ALLSTATIONS) && 
+	      (MSG_BYTE(mp, 1) == PPP_UI) && 
+	      (MSG_BYTE(mp, 2) == (PPP_LCP >> 8)) &&
+	      (MSG_BYTE(mp, 3) == (PPP_LCP & 0xff)) &&
+	      LCP_USE_DFLT(mp));
+    if (is_lcp)
+	xaccm[0] = ~0;		/* force escape on 0x00 through 0x1f */
+
+    simple = SIMPLE_TX_MAP(xaccm);
 
     /*
-     * Allocate an output buffer large enough to handle a case where all
-     * characters need to be escaped
+     * Work out the FCS, and how many bytes there will be once escaped
      */
-    outmp_len = (msgdsize(mp)	 << 1) +		/* input block x 2 */
-		(sizeof(fcs)	 << 2) +		/* HDLC FCS x 4 */
-		(sizeof(uchar_t) << 1);			/* HDLC flags x 2 */
+    fcs = PPP_INITFCS;		/* Initial FCS is 0xffff */
+    outmp_len = 0;
+    for (tmp = mp; tmp; tmp = tmp->b_cont) {
+	if (tmp->b_datap->db_type != M_DATA)
+	    continue;	/* skip if db_type is something other than M_DATA */
+	dp = tmp->b_rptr;
+	end = tmp->b_wptr;
+	fcs = ahdlc_fcs(fcs, dp, end - dp);
+	outmp_len += end - dp;
+	while ((dp = ahdlc_tx_scan(dp, end, xaccm, simple)) < end) {
+	    outmp_len++;
+	    dp++;
+	}
+    }
+
+    /*
+     * Allocate an output buffer just large enough for the frame once
+     * escaped
+     */
+    outmp_len += (sizeof(fcs)	 << 2) +		/* HDLC FCS x 4 */
+		 (sizeof(uchar_t) << 1);		/* HDLC flags x 2 */
 
     outmp = allocb(outmp_len, BPRI_MED);
     if (outmp == NULL) {
 	state->stats.ppp_oerrors++;
-	MUTEX_EXIT(&state->lock);
 	putctl1(RD(q)->q_next, M_CTL, PPPCTL_OERROR);
 	return;
     }
@@ -605,40 +736,22 @@ ahdlc_encode(q, mp)
 #endif
 
     /*
-     * All control characters must be escaped for LCP packets with code
-     * values between 1 (Conf-Req) and 7 (Code-Rej).
-     */
-    is_lcp = ((MSG_BYTE(mp, 0) == PPP_ALLSTATIONS) && 
-	      (MSG_BYTE(mp, 1) == PPP_UI) && 
-	      (MSG_BYTE(mp, 2) == (PPP_LCP >> 8)) &&
-	      (MSG_BYTE(mp, 3) == (PPP_LCP & 0xff)) &&
-	      LCP_USE_DFLT(mp));
-
-    xaccm = state->xaccm;
-    if (is_lcp) {
-	bcopy((caddr_t)state->xaccm, (caddr_t)loc_xaccm, sizeof(loc_xaccm));
-	loc_xaccm[0] = ~0;	/* force escape on 0x00 through 0x1f */
-	xaccm = loc_xaccm;
-    }
-
-    fcs = PPP_INITFCS;		/* Initial FCS is 0xffff */
-
-    /*
-     * Process this block and the rest (if any) attached to the this one
+     * Copy this block and the rest (if any) attached to the this one,
+     * a run at a time between the bytes that need escaping
      */
     for (tmp = mp; tmp; tmp = tmp->b_cont) {
-	if (tmp->b_datap->db_type == M_DATA) {
-	    for (dp = tmp->b_rptr; dp < tmp->b_wptr; dp++) {
-		fcs = PPP_FCS(fcs, *dp);
-		if (IN_TX_MAP(*dp, xaccm)) {
-		    *outmp->b_wptr++ = PPP_ESCAPE;
-		    *outmp->b_wptr++ = *dp ^ PPP_TRANS;
-		} else {
-		    *outmp->b_wptr++ = *dp;
-		}
-	    }
-	} else {
+	if (tmp->b_datap->db_type != M_DATA)
 	    continue;	/* skip if db_type is something other than M_DATA */
+	for (dp = tmp->b_rptr, end = tmp->b_wptr; dp < end; dp = ep + 1) {
+	    ep = ahdlc_tx_scan(dp, end, xaccm, simple);
+	    if (ep > dp) {
+		bcopy((caddr_t) dp, (caddr_t) outmp->b_wptr, ep - dp);
+		outmp->b_wptr += ep - dp;
+	    }
+	    if (ep == end)
+		break;
+	    *outmp->b_wptr++ = PPP_ESCAPE;
+	    *outmp->b_wptr++ = *ep ^ PPP_TRANS;
 	}
     }
 
@@ -670,8 +783,6 @@ ahdlc_encode(q, mp)
     state->stats.ppp_obytes += msgdsize(outmp);
     state->stats.ppp_opackets++;
 
-    MUTEX_EXIT(&state->lock);
-
     putnext(q, outmp);
 }
 
@@ -681,6 +792,35 @@ ahdlc_encode(q, mp)
 #define IN_RX_MAP(c, m)	((((unsigned int) (uchar_t) (c)) < 0x20) && \
 			(m) & (1 << (c)))
 
+/*
+ * Find the first byte from dp up to end that is a flag, an escape or
+ * in raccm, or end if there are none.  With an empty raccm, as on most
+ * links once it has been negotiated, whole words without 0x7d or 0x7e
+ * are passed over.
+ */
+static uchar_t *
+ahdlc_rx_scan(dp, end, raccm)
+    uchar_t	*dp, *end;
+    u_int32_t	raccm;
+{
+    unsigned long w;
+
+    if (raccm == 0) {
+	for (; dp < end && ((uintpointer_t) dp & (sizeof(w) - 1)) != 0; dp++)
+	    if (*dp == PPP_FLAG || *dp == PPP_ESCAPE)
+		return dp;
+	for (; end - dp >= sizeof(w); dp += sizeof(w)) {
+	    w = *(unsigned long *) dp;
+	    if (HAS_BYTE_W(w, PPP_ESCAPE) || HAS_BYTE_W(w, PPP_FLAG))
+		break;
+	}
+    }
+    for (; dp < end; dp++)
+	if (*dp == PPP_FLAG || *dp == PPP_ESCAPE || IN_RX_MAP(*dp, raccm))
+	    return dp;
+    return end;
+}
+
 
 /*
  * Process received characters.
@@ -692,17 +832,44 @@ ahdlc_decode(q, mp)
 {
     ahdlc_state_t   *state;
     mblk_t	    *om;
-    uchar_t	    *dp;
+    uchar_t	    *dp, *ep;
+    int		    n, mru;
+    u_int32_t	    raccm;
 
     state = (ahdlc_state_t *) q->q_ptr;
 
     MUTEX_ENTER(&state->lock);
+    raccm = state->raccm;
+    mru = state->mru;
+    MUTEX_EXIT(&state->lock);
 
     state->stats.ppp_ibytes += msgdsize(mp);
 
     for (; mp != 0; om = mp->b_cont, freeb(mp), mp = om)
     for (dp = mp->b_rptr; dp < mp->b_wptr; dp++) {
 
+	/*
+	 * In the middle of a frame, once every kind of byte the
+	 * checks below look for has been seen, copy the run up to the
+	 * next flag, escape or mapped character in one go, as far as
+	 * the buffer has room.  What stops the run is handled below.
+	 */
+	if ((state->flags & (RCV_FLAGS | IFLUSH | ESCAPED)) == RCV_FLAGS
+	    && state->rx_buf != 0) {
+	    ep = ahdlc_rx_scan(dp, mp->b_wptr, raccm);
+	    n = state->rx_buf_size - msgdsize(state->rx_buf);
+	    if (ep - dp < n)
+		n = ep - dp;
+	    if (n > 0) {
+		state->infcs = ahdlc_fcs(state->infcs, dp, n);
+		bcopy(dp, state->rx_buf->b_wptr, n);
+		state->rx_buf->b_wptr += n;
+		dp += n;
+		if (dp == mp->b_wptr)
+		    break;
+	    }
+	}
+
 	/*
 	 * This should detect the lack of 8-bit communication channel
 	 * which is necessary for PPP to work. In addition, it also
@@ -770,7 +937,7 @@ ahdlc_decode(q, mp)
 	 * we add an extra 32-bytes for a fudge factor
 	 */ 
 	if (state->rx_buf == 0) {
-	    state->rx_buf_size  = (state->mru < PPP_MRU ? PPP_MRU : state->mru);
+	    state->rx_buf_size  = (mru < PPP_MRU ? PPP_MRU : mru);
 	    state->rx_buf_size += (sizeof(u_int32_t) << 3);
 	    state->rx_buf = allocb(state->rx_buf_size, BPRI_MED);
 
@@ -797,7 +964,7 @@ ahdlc_decode(q, mp)
 	if (state->flags & ESCAPED) {
 	    *dp ^= PPP_TRANS;
 	    state->flags &= ~ESCAPED;
-	} else if (IN_RX_MAP(*dp, state->raccm)) 
+	} else if (IN_RX_MAP(*dp, raccm)) 
 	    continue;
 
 	/*
@@ -816,8 +983,6 @@ ahdlc_decode(q, mp)
 	    state->flags     |= IFLUSH;
 	}
     }
-
-    MUTEX_EXIT(&state->lock);
 }
 
 static int
@@ -393,7 +393,7 @@ ppp_comp_wput(q, mp)
 	    nrslots = mp->b_cont->b_rptr[1] + 1;
 	    if (nxslots > MAX_STATES || nrslots > MAX_STATES)
 		break;
-	    vj_compress_init(&cp->vj_comp, nxslots);
+	    vj_compress_init(&cp->vj_comp, nxslots - 1);
 	    cp->vj_last_ierrors = cp->stats.ppp_ierrors;
 	    error = 0;
 	    iop->ioc_count = 0;
@@ -45,6 +45,8 @@
 #include <sys/sunddi.h>
 
 extern struct streamtab ppp_compinfo;
+extern void deflate_pool_init(void);
+extern void deflate_pool_fini(void);
 
 static struct fmodsw fsw = {
     "ppp_comp",
@@ -72,13 +74,22 @@ static struct modlinkage modlinkage = {
 int
 _init(void)
 {
-    return mod_install(&modlinkage);
+    int error;
+
+    deflate_pool_init();
+    if ((error = mod_install(&modlinkage)) != 0)
+	deflate_pool_fini();
+    return error;
 }
 
 int
 _fini(void)
 {
-    return mod_remove(&modlinkage);
+    int error;
+
+    if ((error = mod_remove(&modlinkage)) == 0)
+	deflate_pool_fini();
+    return error;
 }
 
 int